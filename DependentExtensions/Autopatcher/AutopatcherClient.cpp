@@ -19,6 +19,7 @@
 #include "MessageIdentifiers.h"
 #include "AutopatcherPatchContext.h"
 #include "ApplyPatch.h"
+#include "RollingDelta.h"
 #include "FileOperations.h"
 //#include "DR_SHA1.h"
 #include <stdio.h>
@@ -41,9 +42,27 @@ static const unsigned HASH_LENGTH=4;
 
 PatchContext AutopatcherClientCBInterface::ApplyPatchBase(const char *oldFilePath, char **newFileContents, unsigned int *newFileSize, char *patchContents, unsigned int patchSize, uint32_t patchAlgorithm)
 {
+	(void) patchAlgorithm;
 	return ApplyPatchBSDiff(oldFilePath, newFileContents, newFileSize, patchContents, patchSize);
 }
 
+PatchContext AutopatcherClientCBInterface::ApplyPatchRollingDelta(const char *oldFilePath, const char *newFilePath, char *patchContents, unsigned int patchSize)
+{
+	FILE *fp;
+	fp=fopen(oldFilePath, "rb");
+	if (fp==0)
+		return PC_ERROR_PATCH_TARGET_MISSING;
+	fclose(fp);
+
+	if (ApplyRollingDeltaPatch(oldFilePath, patchContents, patchSize, newFilePath)==false)
+	{
+		remove(newFilePath);
+		return PC_ERROR_PATCH_APPLICATION_FAILURE;
+	}
+
+	return PC_WRITE_FILE;
+}
+
 PatchContext AutopatcherClientCBInterface::ApplyPatchBSDiff(const char *oldFilePath, char **newFileContents, unsigned int *newFileSize, char *patchContents, unsigned int patchSize)
 {
 	FILE *fp;
@@ -128,6 +147,36 @@ AutopatcherClientThreadInfo* AutopatcherClientWorkerThread(AutopatcherClientThre
 		else
 			hashMultiplier=2; // else op==PC_HASH_2_WITH_PATCH
 
+		if (input->onFileStruct.context.flnc_extraData2==PATCH_ALGORITHM_ROLLING_DELTA)
+		{
+			// The patched file may not fit in memory, so it goes straight to the file that would be copied on restart, and is then moved over the old file
+			char newDir[1024];
+			strcpy(newDir, fullPathToDir);
+			strcat(newDir, COPY_ON_RESTART_EXTENSION);
+			input->result = input->cbInterface->ApplyPatchRollingDelta(fullPathToDir, newDir, (char*)input->onFileStruct.fileData+HASH_LENGTH*hashMultiplier, input->onFileStruct.byteLengthOfThisFile-HASH_LENGTH*hashMultiplier);
+			if (input->result!=PC_WRITE_FILE)
+				return input;
+
+			unsigned int hash = SuperFastHashFile(newDir);
+			if (RakNet::BitStream::DoEndianSwap())
+				RakNet::BitStream::ReverseBytesInPlace((unsigned char*) &hash, sizeof(hash));
+			if (memcmp(&hash, input->onFileStruct.fileData+HASH_LENGTH*(hashMultiplier-1), HASH_LENGTH)!=0)
+			{
+				remove(newDir);
+				input->result=PC_ERROR_PATCH_RESULT_CHECKSUM_FAILURE;
+			}
+			else if (rename(newDir, fullPathToDir)!=0 && (remove(fullPathToDir)!=0 || rename(newDir, fullPathToDir)!=0))
+			{
+				// The old file is in use
+				input->result=PC_NOTICE_WILL_COPY_ON_RESTART;
+			}
+			else
+			{
+				input->result=(PatchContext)input->onFileStruct.context.op;
+			}
+			return input;
+		}
+
 		PatchContext result = input->cbInterface->ApplyPatchBase(fullPathToDir, &input->postPatchFile, &input->postPatchLength, (char*)input->onFileStruct.fileData+HASH_LENGTH*hashMultiplier, input->onFileStruct.byteLengthOfThisFile-HASH_LENGTH*hashMultiplier, input->onFileStruct.context.flnc_extraData2);
 		if (result == PC_ERROR_PATCH_APPLICATION_FAILURE || input->result==PC_ERROR_PATCH_TARGET_MISSING)
 		{
@@ -35,6 +35,11 @@ class RAK_DLL_EXPORT AutopatcherClientCBInterface : public FileListTransferCBInt
 {
 public:
 	virtual PatchContext ApplyPatchBSDiff(const char *oldFilePath, char **newFileContents, unsigned int *newFileSize, char *patchContents, unsigned int patchSize);
+	/// Applies a patch made with CreateRollingDeltaPatch(), reading only the parts of the old file that are copied.
+	/// The result is written to \a newFilePath as it is made, so it is never held in memory. AutopatcherClient then moves it over \a oldFilePath, and OnFile() gets no fileData for it.
+	/// \return PC_WRITE_FILE on success
+	virtual PatchContext ApplyPatchRollingDelta(const char *oldFilePath, const char *newFilePath, char *patchContents, unsigned int patchSize);
+	/// Applies patches with \a patchAlgorithm other than PATCH_ALGORITHM_ROLLING_DELTA, which are made with CreatePatch(), by calling ApplyPatchBSDiff()
 	virtual PatchContext ApplyPatchBase(const char *oldFilePath, char **newFileContents, unsigned int *newFileSize, char *patchContents, unsigned int patchSize, uint32_t patchAlgorithm);
 };
 
@@ -24,6 +24,7 @@
 // If you get fatal error C1083: Cannot open include file: 'mysql.h' then you need to install MySQL. See readme.txt in this sample directory.
 #include "mysql.h"
 #include "CreatePatch.h"
+#include "RollingDelta.h"
 #include "AutopatcherPatchContext.h"
 // #include "DR_SHA1.h"
 #include <stdlib.h>
@@ -52,6 +53,34 @@ struct FileInfo
 #define PQEXECPARAM_FORMAT_TEXT		0
 #define PQEXECPARAM_FORMAT_BINARY	1
 
+// Makes the patch with bsdiff, unless a version is too large for bsdiff, which holds both in memory several times over
+// bsdiff patches are allocated with new [], and rolling delta patches with malloc(), so free either with FreePatch()
+static bool CreatePatchForContent(const char *oldContent, unsigned int oldLength, char *newContent, unsigned int newLength, char **patch, unsigned int *patchLength, int *patchAlgorithm)
+{
+	if (oldLength < ROLLING_DELTA_MIN_FILE_LENGTH && newLength < ROLLING_DELTA_MIN_FILE_LENGTH)
+	{
+		*patchAlgorithm=0;
+		return CreatePatch(oldContent, oldLength, newContent, newLength, patch, patchLength);
+	}
+
+	*patchAlgorithm=PATCH_ALGORITHM_ROLLING_DELTA;
+	char *signature;
+	unsigned int signatureSize;
+	if (CreateRollingSignature(oldContent, oldLength, 0, 1, &signature, &signatureSize)==false)
+		return false;
+	bool b = CreateRollingDeltaPatch(signature, signatureSize, newContent, newLength, patch, patchLength);
+	free(signature);
+	return b;
+}
+
+static void FreePatch(char *patch, int patchAlgorithm)
+{
+	if (patchAlgorithm==PATCH_ALGORITHM_ROLLING_DELTA)
+		free(patch);
+	else
+		delete [] patch;
+}
+
 AutopatcherMySQLRepository::AutopatcherMySQLRepository()
 {
 	filePartConnection=0;
@@ -88,6 +117,7 @@ bool AutopatcherMySQLRepository::CreateAutopatcherTables(void)
 		"content LONGBLOB,"
 		"contentHash TINYBLOB,"
 		"patch LONGBLOB,"
+		"patchAlgorithm INT NOT NULL DEFAULT 0,"
 		"createFile TINYINT NOT NULL,"
 		"modificationDate double precision DEFAULT (EXTRACT(EPOCH FROM now())),"
 		"lastSentDate double precision,"
@@ -328,7 +358,7 @@ int AutopatcherMySQLRepository::GetPatches(const char *applicationName, FileList
 					char buf [2 * HASH_LENGTH + 1];
 					mysql_real_escape_string(mySqlConnection, buf, userHash, HASH_LENGTH);
 					
-					sprintf(query, "SELECT patch FROM FileVersionHistory WHERE applicationId=%i AND filename='%s' AND contentHash='%s'; ", applicationID, fn, buf);
+					sprintf(query, "SELECT patch, patchAlgorithm FROM FileVersionHistory WHERE applicationId=%i AND filename='%s' AND contentHash='%s'; ", applicationID, fn, buf);
                     MYSQL_RES * patchResult = 0;
 					//sqlCommandMutex.Lock();
                     if (!ExecuteBlockingCommand (query, &patchResult))
@@ -371,12 +401,13 @@ int AutopatcherMySQLRepository::GetPatches(const char *applicationName, FileList
 						// 
 						char * patch = row [0];
 						unsigned long patchLength = mysql_fetch_lengths (patchResult) [0];
+						uint32_t patchAlgorithm = row [1] ? (uint32_t) atoi(row [1]) : 0;
 
 						char *temp = new char [patchLength + HASH_LENGTH];
 						memcpy(temp, contentHash, HASH_LENGTH);
 						memcpy(temp+HASH_LENGTH, patch, patchLength);
 
-						patchList->AddFile(userFilename,userFilename, temp, HASH_LENGTH+patchLength, fileLength, FileListNodeContext(PC_HASH_1_WITH_PATCH,0) );
+						patchList->AddFile(userFilename,userFilename, temp, HASH_LENGTH+patchLength, fileLength, FileListNodeContext(PC_HASH_1_WITH_PATCH,0,patchAlgorithm,0) );
 						delete [] temp;
 					}
 
@@ -637,7 +668,8 @@ bool AutopatcherMySQLRepository::UpdateApplicationFiles(const char *applicationN
 
 			char *patch;
 			unsigned patchLength;	
-			if (!CreatePatch(content, contentLength, (char *) hardDriveData, hardDriveDataLength, &patch, &patchLength))
+			int patchAlgorithm;
+			if (!CreatePatchForContent(content, contentLength, (char *) hardDriveData, hardDriveDataLength, &patch, &patchLength, &patchAlgorithm))
 			{
 				strcpy(lastError,"CreatePatch failed.\n");
 				Rollback();
@@ -650,7 +682,7 @@ bool AutopatcherMySQLRepository::UpdateApplicationFiles(const char *applicationN
 			
 			char buf[512];
 			stmt = mysql_stmt_init(mySqlConnection);
-			sprintf (buf, "UPDATE FileVersionHistory SET patch=? where fileID=%s;", fileID);
+			sprintf (buf, "UPDATE FileVersionHistory SET patch=?, patchAlgorithm=%i where fileID=%s;", patchAlgorithm, fileID);
 			if ((prepareResult=mysql_stmt_prepare(stmt, buf, (unsigned long) strlen(buf)))!=0)
 			{
 				strcpy (lastError, mysql_stmt_error (stmt));
@@ -686,13 +718,13 @@ bool AutopatcherMySQLRepository::UpdateApplicationFiles(const char *applicationN
 				newFiles.Clear();
 				mysql_free_result(res);
 				mysql_free_result(queryResult);
-				delete [] patch;
+				FreePatch(patch, patchAlgorithm);
 				return false;
 			}
 			//sqlCommandMutex.Unlock();
 
 			mysql_stmt_close(stmt);
-			delete [] patch;
+			FreePatch(patch, patchAlgorithm);
 
 			mysql_free_result(queryResult);
 		}
@@ -18,6 +18,7 @@
 // libpq-fe.h is part of PostgreSQL which must be installed on this computer to use the PostgreRepository
 #include "libpq-fe.h"
 #include "CreatePatch.h"
+#include "RollingDelta.h"
 #include "AutopatcherPatchContext.h"
 // #include "DR_SHA1.h"
 #include <stdlib.h>
@@ -47,6 +48,34 @@ static const unsigned HASH_LENGTH=sizeof(unsigned int);
 
 using namespace RakNet;
 
+// Makes the patch with bsdiff, unless a version is too large for bsdiff, which holds both in memory several times over
+// bsdiff patches are allocated with new [], and rolling delta patches with malloc(), so free either with FreePatch()
+static bool CreatePatchForContent(const char *oldContent, unsigned int oldLength, char *newContent, unsigned int newLength, char **patch, unsigned int *patchLength, int *patchAlgorithm)
+{
+	if (oldLength < ROLLING_DELTA_MIN_FILE_LENGTH && newLength < ROLLING_DELTA_MIN_FILE_LENGTH)
+	{
+		*patchAlgorithm=0;
+		return CreatePatch(oldContent, oldLength, newContent, newLength, patch, patchLength);
+	}
+
+	*patchAlgorithm=PATCH_ALGORITHM_ROLLING_DELTA;
+	char *signature;
+	unsigned int signatureSize;
+	if (CreateRollingSignature(oldContent, oldLength, 0, 1, &signature, &signatureSize)==false)
+		return false;
+	bool b = CreateRollingDeltaPatch(signature, signatureSize, newContent, newLength, patch, patchLength);
+	free(signature);
+	return b;
+}
+
+static void FreePatch(char *patch, int patchAlgorithm)
+{
+	if (patchAlgorithm==PATCH_ALGORITHM_ROLLING_DELTA)
+		free(patch);
+	else
+		delete [] patch;
+}
+
 AutopatcherPostgreRepository::AutopatcherPostgreRepository()
 {
 	filePartConnection=0;
@@ -1382,7 +1411,8 @@ bool AutopatcherPostgreRepository::UpdateApplicationFiles(const char *applicatio
 			content=PQgetvalue(result, 0, contentColumnIndex);
 
 
-			if (CreatePatch(content, contentLength, hardDriveData, hardDriveDataLength, &patch, &patchLength)==false)
+			int patchAlgorithm;
+			if (CreatePatchForContent(content, contentLength, hardDriveData, hardDriveDataLength, &patch, &patchLength, &patchAlgorithm)==false)
 			{
 				rakFree_Ex(hardDriveData, _FILE_AND_LINE_);
 
@@ -1406,11 +1436,11 @@ bool AutopatcherPostgreRepository::UpdateApplicationFiles(const char *applicatio
 			
 			//sqlCommandMutex.Lock();
 			char buff[256];
-			sprintf(buff, "UPDATE FileVersionHistory SET patch=$1::bytea, patchAlgorithm=0 where fileID=%s;", fileID);
+			sprintf(buff, "UPDATE FileVersionHistory SET patch=$1::bytea, patchAlgorithm=%i where fileID=%s;", patchAlgorithm, fileID);
 			uploadResult = PQexecParams(pgConn, buff, 1,0,outTemp,outLengths,formats,PQEXECPARAM_FORMAT_BINARY);
 			
 			// Done with this patch data
-			delete [] patch;
+			FreePatch(patch, patchAlgorithm);
 
 			//sqlCommandMutex.Unlock();
 			if (IsResultSuccessful(uploadResult, true)==false)
@@ -1878,7 +1908,7 @@ bool AutopatcherPostgreRepository2::UpdateApplicationFiles(const char *applicati
 				uploadResult = PQexecParams(pgConn, buff, 1,0,outTemp,outLengths,formats,PQEXECPARAM_FORMAT_BINARY);
 
 				// Done with this patch data
-				delete [] patch;
+				FreePatch(patch, patchAlgorithm);
 
 				//sqlCommandMutex.Unlock();
 				if (IsResultSuccessful(uploadResult, true)==false)
@@ -1988,7 +2018,16 @@ int AutopatcherPostgreRepository2::MakePatch(const char *oldFile, const char *ne
 	fseek(fpNew, 0, SEEK_END);
 	int contentLengthNew = ftell(fpNew);
 
-	bool b = MakePatchBSDiff(fpOld, contentLengthOld, fpNew, contentLengthNew, patch, patchLength);
+	// ftell() fails for files over 2 gigabytes
+	bool b;
+	if (contentLengthOld < 0 || contentLengthNew < 0 ||
+		contentLengthOld >= ROLLING_DELTA_MIN_FILE_LENGTH || contentLengthNew >= ROLLING_DELTA_MIN_FILE_LENGTH)
+	{
+		*patchAlgorithm=PATCH_ALGORITHM_ROLLING_DELTA;
+		b = MakePatchRollingDelta(oldFile, newFile, patch, patchLength);
+	}
+	else
+		b = MakePatchBSDiff(fpOld, contentLengthOld, fpNew, contentLengthNew, patch, patchLength);
 	fclose(fpOld);
 	fclose(fpNew);
 	if (b==false)
@@ -2025,6 +2064,29 @@ bool AutopatcherPostgreRepository2::MakePatchBSDiff(FILE *fpOld, int contentLeng
 	rakFree_Ex(newContent, _FILE_AND_LINE_);
 	return b;
 }
+bool AutopatcherPostgreRepository2::MakePatchRollingDelta(const char *oldFile, const char *newFile, char **patch, unsigned int *patchLength)
+{
+	// Both files are streamed from disk, so they can be any size
+	char *signature;
+	unsigned int signatureSize;
+	bool b = CreateRollingSignature(oldFile, 0, 4, &signature, &signatureSize);
+	if (b)
+	{
+		b = CreateRollingDeltaPatch(signature, signatureSize, newFile, patch, patchLength);
+		free(signature);
+	}
+
+	if (b==false)
+	{
+		printf(
+			"AutopatcherPostgreRepository2::MakePatchRollingDelta failed.\n"
+			"oldFile=%s\n"
+			"newFile=%s\n",
+			oldFile, newFile
+			);
+	}
+	return b;
+}
 const char *AutopatcherPostgreRepository::GetLastError(void) const
 {
 	return PostgreSQLInterface::GetLastError();
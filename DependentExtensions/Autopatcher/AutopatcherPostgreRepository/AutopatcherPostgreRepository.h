@@ -135,7 +135,7 @@ public:
 	/// Can override this to create patches using a different tool
 	/// \param[in] oldFile Path to the old version of the file, on disk
 	/// \param[in] newFile Path to the updated file, on disk
-	/// \param[out] patch Pointer you should allocate, to hold the patch
+	/// \param[out] patch Pointer you should allocate, to hold the patch. Allocate with new [], or with malloc() if \a patchAlgorithm is PATCH_ALGORITHM_ROLLING_DELTA
 	/// \param[out] patchLength Write the length of the resultant patch here
 	/// \param[out] patchAlgorithm Stored in the database. Use if you want to represent what algorithm was used. Transmitted to the client for decompression
 	virtual int MakePatch(const char *oldFile, const char *newFile, char **patch, unsigned int *patchLength, int *patchAlgorithm);
@@ -143,6 +143,9 @@ protected:
 	// Implements MakePatch using bsDiff. Uses a lot of memory, should not use for files above about 100 megabytes.
 	virtual bool MakePatchBSDiff(FILE *fpOld, int contentLengthOld, FILE *fpNew, int contentLengthNew, char **patch, unsigned int *patchLength);
 
+	// Implements MakePatch using CreateRollingDeltaPatch(), for files of ROLLING_DELTA_MIN_FILE_LENGTH or more. Streams through the files, so they can be any size.
+	virtual bool MakePatchRollingDelta(const char *oldFile, const char *newFile, char **patch, unsigned int *patchLength);
+
 };
 
 } // namespace RakNet
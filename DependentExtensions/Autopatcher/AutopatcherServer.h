@@ -12,6 +12,8 @@
 /// \brief The server plugin for the autopatcher.  Must be running for the client to get patches.
 
 // TODO - bsdiff doesn't work for files above 100 megabytes.
+// For files of ROLLING_DELTA_MIN_FILE_LENGTH or more, the repositories make patches with CreateRollingDeltaPatch() in RollingDelta.h instead, which streams through files of any size.
+// They send flnc_extraData2 as PATCH_ALGORITHM_ROLLING_DELTA, so AutopatcherClient streams the patched file to disk with ApplyPatchRollingDelta().
 // See http://xdelta.org/
 // XDelta is GPL 2, however I could run that as a separate EXE and invoke to only transmit the delta file. 
 
@@ -0,0 +1,940 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "RollingDelta.h"
+#include "ThreadPool.h"
+#include "RakSleep.h"
+#include "DR_SHA1.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#define fseek64(fp, offset, origin) fseeko(fp, (off_t) (offset), origin)
+#define ftell64 ftello
+#endif
+
+using namespace RakNet;
+
+/*
+Signature format, all integers little endian:
+0	4	SIGNATURE_MAGIC
+4	4	Block size
+8	8	Old file length
+16	4	Block count
+20	12*	Per block: 4 byte weak checksum, 8 byte strong checksum. The last block may be shorter than the block size.
+
+Patch format:
+0	4	PATCH_MAGIC
+4	4	PATCH_VERSION
+8	4	Block size
+12	8	Old file length
+20	8	New file length
+28	*	Ops, each starting with a one byte op type
+		OP_COPY		8 byte first block, 4 byte block count. Copies from the old file.
+		OP_LITERAL	4 byte length, followed by that many bytes to write.
+		OP_END		Followed by the 20 byte SHA1 of the new file.
+*/
+
+static const uint32_t SIGNATURE_MAGIC=0x47534452; // "RDSG"
+static const uint32_t PATCH_MAGIC=0x54504452; // "RDPT"
+static const uint32_t PATCH_VERSION=1;
+static const unsigned int SIGNATURE_HEADER_SIZE=20;
+static const unsigned int STRONG_CHECKSUM_LENGTH=8;
+static const unsigned int SIGNATURE_ENTRY_SIZE=4+STRONG_CHECKSUM_LENGTH;
+static const unsigned int PATCH_HEADER_SIZE=28;
+static const unsigned int MIN_BLOCK_SIZE=1024;
+static const unsigned int MAX_BLOCK_SIZE=1<<20;
+// Unmatched data is written in ops of at most this size, which also bounds the read buffer
+static const unsigned int MAX_LITERAL_LENGTH=1<<20;
+static const unsigned int READ_SIZE=1<<20;
+// Starting and stopping threads takes tens of milliseconds, so smaller files are not split further
+static const uint64_t MIN_BYTES_PER_THREAD=16<<20;
+
+enum DeltaOp
+{
+	OP_END,
+	OP_COPY,
+	OP_LITERAL,
+};
+
+static void WriteUInt32(unsigned char *out, uint32_t value)
+{
+	for (int i=0; i < 4; i++)
+		out[i]=(unsigned char) (value >> (i*8));
+}
+
+static void WriteUInt64(unsigned char *out, uint64_t value)
+{
+	for (int i=0; i < 8; i++)
+		out[i]=(unsigned char) (value >> (i*8));
+}
+
+static uint32_t ReadUInt32(const unsigned char *in)
+{
+	uint32_t value=0;
+	for (int i=3; i >= 0; i--)
+		value=(value << 8) | in[i];
+	return value;
+}
+
+static uint64_t ReadUInt64(const unsigned char *in)
+{
+	uint64_t value=0;
+	for (int i=7; i >= 0; i--)
+		value=(value << 8) | in[i];
+	return value;
+}
+
+// rsync's weak checksum. s1 is the sum of the bytes, s2 the sum of each prefix sum, so both can be rolled one byte at a time.
+static void WeakChecksumParts(const unsigned char *data, unsigned int length, uint32_t *s1, uint32_t *s2)
+{
+	uint32_t a=0, b=0;
+	for (unsigned int i=0; i < length; i++)
+	{
+		a+=data[i];
+		b+=a;
+	}
+	*s1=a;
+	*s2=b;
+}
+
+static inline uint32_t CombineWeakChecksum(uint32_t s1, uint32_t s2)
+{
+	return (s1 & 0xFFFF) | (s2 << 16);
+}
+
+static uint32_t WeakChecksum(const unsigned char *data, unsigned int length)
+{
+	uint32_t s1, s2;
+	WeakChecksumParts(data, length, &s1, &s2);
+	return CombineWeakChecksum(s1, s2);
+}
+
+static void StrongChecksum(const unsigned char *data, unsigned int length, unsigned char out[STRONG_CHECKSUM_LENGTH])
+{
+	CSHA1 sha1;
+	sha1.Update(data, length);
+	sha1.Final();
+	memcpy(out, sha1.GetHash(), STRONG_CHECKSUM_LENGTH);
+}
+
+static bool GetFileLength(FILE *fp, uint64_t *length)
+{
+	if (fseek64(fp, 0, SEEK_END)!=0)
+		return false;
+	int64_t end = (int64_t) ftell64(fp);
+	if (end < 0 || fseek64(fp, 0, SEEK_SET)!=0)
+		return false;
+	*length=(uint64_t) end;
+	return true;
+}
+
+unsigned int GetRollingDeltaBlockSize(uint64_t fileLength)
+{
+	unsigned int blockSize=MIN_BLOCK_SIZE;
+	while ((uint64_t) blockSize*blockSize < fileLength && blockSize < MAX_BLOCK_SIZE)
+		blockSize<<=1;
+	return blockSize;
+}
+
+// -----------------------------------------------------------------
+
+struct SignatureJob
+{
+	// Either the path of the file, or the whole file in memory
+	const char *filePath;
+	const unsigned char *fileData;
+	uint64_t fileLength;
+	unsigned int blockSize;
+	uint64_t firstBlock;
+	uint64_t blockCount;
+	unsigned char *entries;
+};
+
+static void WriteSignatureEntries(const SignatureJob &job, uint64_t firstBlock, const unsigned char *data, unsigned int numBlocks, unsigned int numBytes)
+{
+	for (unsigned int i=0; i < numBlocks; i++)
+	{
+		unsigned int blockStart = i*job.blockSize;
+		unsigned int blockLength = numBytes-blockStart < job.blockSize ? numBytes-blockStart : job.blockSize;
+		unsigned char *entry = job.entries + (firstBlock+i)*SIGNATURE_ENTRY_SIZE;
+		WriteUInt32(entry, WeakChecksum(data+blockStart, blockLength));
+		StrongChecksum(data+blockStart, blockLength, entry+4);
+	}
+}
+
+static bool SignatureJobCB(SignatureJob job, bool *returnOutput, void* perThreadData)
+{
+	(void) perThreadData;
+	*returnOutput=true;
+
+	unsigned int blocksPerRead = READ_SIZE / job.blockSize;
+	if (blocksPerRead==0)
+		blocksPerRead=1;
+
+	if (job.fileData)
+	{
+		for (uint64_t block=0; block < job.blockCount; block+=blocksPerRead)
+		{
+			unsigned int numBlocks = job.blockCount-block < blocksPerRead ? (unsigned int) (job.blockCount-block) : blocksPerRead;
+			uint64_t offset = (job.firstBlock+block)*job.blockSize;
+			uint64_t remaining = job.fileLength-offset;
+			unsigned int numBytes = remaining < (uint64_t) numBlocks*job.blockSize ? (unsigned int) remaining : numBlocks*job.blockSize;
+			WriteSignatureEntries(job, job.firstBlock+block, job.fileData+offset, numBlocks, numBytes);
+		}
+		return true;
+	}
+
+	FILE *fp = fopen(job.filePath, "rb");
+	if (fp==0)
+		return false;
+	if (fseek64(fp, job.firstBlock*job.blockSize, SEEK_SET)!=0)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	unsigned char *buffer = (unsigned char*) malloc(blocksPerRead*job.blockSize);
+	if (buffer==0)
+	{
+		fclose(fp);
+		return false;
+	}
+	bool success=true;
+	uint64_t block=0;
+	while (block < job.blockCount)
+	{
+		unsigned int numBlocks = job.blockCount-block < blocksPerRead ? (unsigned int) (job.blockCount-block) : blocksPerRead;
+		uint64_t offset = (job.firstBlock+block)*job.blockSize;
+		uint64_t remaining = job.fileLength-offset;
+		unsigned int numBytes = remaining < (uint64_t) numBlocks*job.blockSize ? (unsigned int) remaining : numBlocks*job.blockSize;
+		if (fread(buffer, 1, numBytes, fp)!=numBytes)
+		{
+			success=false;
+			break;
+		}
+		WriteSignatureEntries(job, job.firstBlock+block, buffer, numBlocks, numBytes);
+		block+=numBlocks;
+	}
+	free(buffer);
+	fclose(fp);
+	return success;
+}
+
+static bool CreateSignature(SignatureJob job, unsigned int blockSize, int numThreads, char **signature, unsigned int *signatureSize)
+{
+	uint64_t fileLength=job.fileLength;
+	if (blockSize==0)
+		blockSize=GetRollingDeltaBlockSize(fileLength);
+	uint64_t blockCount = (fileLength+blockSize-1)/blockSize;
+	uint64_t size = SIGNATURE_HEADER_SIZE + blockCount*SIGNATURE_ENTRY_SIZE;
+	if (size > 0xFFFFFFFF)
+		return false;
+
+	unsigned char *output = (unsigned char*) malloc((size_t) size);
+	if (output==0)
+		return false;
+	WriteUInt32(output, SIGNATURE_MAGIC);
+	WriteUInt32(output+4, blockSize);
+	WriteUInt64(output+8, fileLength);
+	WriteUInt32(output+16, (uint32_t) blockCount);
+
+	job.blockSize=blockSize;
+	job.entries=output+SIGNATURE_HEADER_SIZE;
+
+	if (numThreads < 1)
+		numThreads=1;
+	if ((uint64_t) numThreads > fileLength/MIN_BYTES_PER_THREAD)
+		numThreads = fileLength >= MIN_BYTES_PER_THREAD ? (int) (fileLength/MIN_BYTES_PER_THREAD) : 1;
+
+	bool success=true;
+	if (numThreads==1)
+	{
+		bool returnOutput;
+		job.firstBlock=0;
+		job.blockCount=blockCount;
+		success=SignatureJobCB(job, &returnOutput, 0);
+	}
+	else
+	{
+		// Each thread reads a contiguous range of blocks with its own file handle
+		ThreadPool<SignatureJob, bool> threadPool;
+		threadPool.StartThreads(numThreads, 0);
+		uint64_t blocksPerJob = (blockCount+numThreads-1)/numThreads;
+		int numJobs=0;
+		for (uint64_t firstBlock=0; firstBlock < blockCount; firstBlock+=blocksPerJob)
+		{
+			job.firstBlock=firstBlock;
+			job.blockCount = blockCount-firstBlock < blocksPerJob ? blockCount-firstBlock : blocksPerJob;
+			threadPool.AddInput(SignatureJobCB, job);
+			numJobs++;
+		}
+		while (numJobs>0)
+		{
+			if (threadPool.HasOutputFast() && threadPool.HasOutput())
+			{
+				if (threadPool.GetOutput()==false)
+					success=false;
+				numJobs--;
+			}
+			else
+				RakSleep(1);
+		}
+		threadPool.StopThreads();
+	}
+
+	if (success==false)
+	{
+		free(output);
+		return false;
+	}
+	*signature=(char*) output;
+	*signatureSize=(unsigned int) size;
+	return true;
+}
+
+bool CreateRollingSignature(const char *oldFilePath, unsigned int blockSize, int numThreads, char **signature, unsigned int *signatureSize)
+{
+	FILE *fp = fopen(oldFilePath, "rb");
+	if (fp==0)
+		return false;
+	uint64_t fileLength;
+	bool gotLength = GetFileLength(fp, &fileLength);
+	fclose(fp);
+	if (gotLength==false)
+		return false;
+
+	SignatureJob job;
+	job.filePath=oldFilePath;
+	job.fileData=0;
+	job.fileLength=fileLength;
+	return CreateSignature(job, blockSize, numThreads, signature, signatureSize);
+}
+
+bool CreateRollingSignature(const char *oldFile, uint64_t oldFileLength, unsigned int blockSize, int numThreads, char **signature, unsigned int *signatureSize)
+{
+	SignatureJob job;
+	job.filePath=0;
+	job.fileData=(const unsigned char*) oldFile;
+	job.fileLength=oldFileLength;
+	return CreateSignature(job, blockSize, numThreads, signature, signatureSize);
+}
+
+// -----------------------------------------------------------------
+
+// Writes a patch or a patched file to either a file or a growing buffer
+class DeltaOutput
+{
+public:
+	DeltaOutput(FILE *_fp) : fp(_fp), data(0), size(0), allocated(0) {}
+	DeltaOutput() : fp(0), data(0), size(0), allocated(0) {}
+	~DeltaOutput() {free(data);}
+
+	bool Reserve(uint64_t length)
+	{
+		if (fp || length <= allocated)
+			return true;
+		if (length > 0xFFFFFFFF)
+			return false;
+		char *newData = (char*) realloc(data, (size_t) length);
+		if (newData==0)
+			return false;
+		data=newData;
+		allocated=(unsigned int) length;
+		return true;
+	}
+
+	bool Write(const void *input, unsigned int length)
+	{
+		if (fp)
+			return fwrite(input, 1, length, fp)==length;
+		if ((uint64_t) size+length > allocated)
+		{
+			uint64_t newAllocated = (uint64_t) allocated*2;
+			if (newAllocated < (uint64_t) size+length)
+				newAllocated=(uint64_t) size+length;
+			if (newAllocated > 0xFFFFFFFF)
+				newAllocated=0xFFFFFFFF;
+			if (newAllocated < (uint64_t) size+length || Reserve(newAllocated)==false)
+				return false;
+		}
+		memcpy(data+size, input, length);
+		size+=length;
+		return true;
+	}
+
+	// Passes ownership of the buffer to the caller
+	void Detach(char **output, unsigned int *outputSize)
+	{
+		*output=data;
+		*outputSize=size;
+		data=0;
+		size=allocated=0;
+	}
+
+protected:
+	FILE *fp;
+	char *data;
+	unsigned int size, allocated;
+};
+
+// Reads a patch or a new file from either a file or a buffer
+class DeltaInput
+{
+public:
+	DeltaInput(FILE *_fp) : fp(_fp), data(0), size(0), offset(0) {}
+	DeltaInput(const char *_data, uint64_t _size) : fp(0), data(_data), size(_size), offset(0) {}
+
+	bool Read(void *output, unsigned int length)
+	{
+		return ReadSome(output, length)==length;
+	}
+
+	// Returns how many bytes were read, which is less than \a length at the end of the input or if Failed()
+	unsigned int ReadSome(void *output, unsigned int length)
+	{
+		if (fp)
+			return (unsigned int) fread(output, 1, length, fp);
+		if (length > size-offset)
+			length=(unsigned int) (size-offset);
+		memcpy(output, data+offset, length);
+		offset+=length;
+		return length;
+	}
+
+	bool Failed(void) const
+	{
+		return fp!=0 && ferror(fp)!=0;
+	}
+
+protected:
+	FILE *fp;
+	const char *data;
+	uint64_t size, offset;
+};
+
+// -----------------------------------------------------------------
+
+struct SignatureIndexEntry
+{
+	uint32_t weak;
+	uint32_t block;
+};
+
+static inline unsigned int WeakChecksumTag(uint32_t weak)
+{
+	return (weak ^ (weak >> 16)) & 0xFFFF;
+}
+
+static int SignatureIndexEntryComp(const void *a, const void *b)
+{
+	const SignatureIndexEntry *x = (const SignatureIndexEntry*) a;
+	const SignatureIndexEntry *y = (const SignatureIndexEntry*) b;
+	unsigned int xTag = WeakChecksumTag(x->weak), yTag = WeakChecksumTag(y->weak);
+	if (xTag!=yTag)
+		return xTag < yTag ? -1 : 1;
+	if (x->weak!=y->weak)
+		return x->weak < y->weak ? -1 : 1;
+	if (x->block!=y->block)
+		return x->block < y->block ? -1 : 1;
+	return 0;
+}
+
+// Full blocks of the old file sorted by weak checksum, with the start of each 16 bit tag so most lookups that miss touch one table entry
+class SignatureIndex
+{
+public:
+	SignatureIndex() : sorted(0), tagStart(0) {}
+	~SignatureIndex()
+	{
+		free(sorted);
+		free(tagStart);
+	}
+
+	bool Init(const unsigned char *signature, unsigned int signatureSize)
+	{
+		if (signatureSize < SIGNATURE_HEADER_SIZE || ReadUInt32(signature)!=SIGNATURE_MAGIC)
+			return false;
+		blockSize=ReadUInt32(signature+4);
+		oldFileLength=ReadUInt64(signature+8);
+		blockCount=ReadUInt32(signature+16);
+		if (blockSize==0 ||
+			(oldFileLength+blockSize-1)/blockSize!=blockCount ||
+			(uint64_t) signatureSize!=SIGNATURE_HEADER_SIZE+(uint64_t) blockCount*SIGNATURE_ENTRY_SIZE)
+			return false;
+		entries=signature+SIGNATURE_HEADER_SIZE;
+		tailLength=(unsigned int) (oldFileLength%blockSize);
+		fullBlockCount = tailLength > 0 ? blockCount-1 : blockCount;
+
+		sorted = (SignatureIndexEntry*) malloc(sizeof(SignatureIndexEntry)*(fullBlockCount+1));
+		for (unsigned int i=0; i < fullBlockCount; i++)
+		{
+			sorted[i].weak=ReadUInt32(entries+i*SIGNATURE_ENTRY_SIZE);
+			sorted[i].block=i;
+		}
+		qsort(sorted, fullBlockCount, sizeof(SignatureIndexEntry), SignatureIndexEntryComp);
+
+		tagStart = (unsigned int*) malloc(sizeof(unsigned int)*65537);
+		unsigned int index=0;
+		for (unsigned int tag=0; tag < 65536; tag++)
+		{
+			tagStart[tag]=index;
+			while (index < fullBlockCount && WeakChecksumTag(sorted[index].weak)==tag)
+				index++;
+		}
+		tagStart[65536]=index;
+		return true;
+	}
+
+	// Finds a full block of the old file equal to \a data. Prefers \a preferredBlock so runs of blocks become a single copy.
+	bool FindBlock(uint32_t weak, const unsigned char *data, uint64_t preferredBlock, uint64_t *block) const
+	{
+		unsigned int tag = WeakChecksumTag(weak);
+		unsigned int first=tagStart[tag], last=tagStart[tag+1];
+		if (first==last)
+			return false;
+
+		unsigned char strong[STRONG_CHECKSUM_LENGTH];
+		bool computedStrong=false;
+
+		if (preferredBlock < fullBlockCount)
+		{
+			unsigned int index = LowerBound(first, last, weak, (uint32_t) preferredBlock);
+			if (index < last && sorted[index].weak==weak && sorted[index].block==preferredBlock)
+			{
+				StrongChecksum(data, blockSize, strong);
+				computedStrong=true;
+				if (memcmp(strong, entries+preferredBlock*SIGNATURE_ENTRY_SIZE+4, STRONG_CHECKSUM_LENGTH)==0)
+				{
+					*block=preferredBlock;
+					return true;
+				}
+			}
+		}
+
+		for (unsigned int index = LowerBound(first, last, weak, 0); index < last && sorted[index].weak==weak; index++)
+		{
+			if (computedStrong==false)
+			{
+				StrongChecksum(data, blockSize, strong);
+				computedStrong=true;
+			}
+			if (memcmp(strong, entries+(uint64_t) sorted[index].block*SIGNATURE_ENTRY_SIZE+4, STRONG_CHECKSUM_LENGTH)==0)
+			{
+				*block=sorted[index].block;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Returns true if \a data, of \a length bytes, equals the last block of the old file when that block is shorter than the block size
+	bool MatchesTail(const unsigned char *data, unsigned int length) const
+	{
+		if (tailLength==0 || length!=tailLength)
+			return false;
+		const unsigned char *entry = entries+(uint64_t) (blockCount-1)*SIGNATURE_ENTRY_SIZE;
+		if (WeakChecksum(data, length)!=ReadUInt32(entry))
+			return false;
+		unsigned char strong[STRONG_CHECKSUM_LENGTH];
+		StrongChecksum(data, length, strong);
+		return memcmp(strong, entry+4, STRONG_CHECKSUM_LENGTH)==0;
+	}
+
+	unsigned int blockSize;
+	uint64_t oldFileLength;
+	unsigned int blockCount, fullBlockCount, tailLength;
+
+protected:
+	unsigned int LowerBound(unsigned int first, unsigned int last, uint32_t weak, uint32_t block) const
+	{
+		while (first < last)
+		{
+			unsigned int middle = first + (last-first)/2;
+			if (sorted[middle].weak < weak || (sorted[middle].weak==weak && sorted[middle].block < block))
+				first=middle+1;
+			else
+				last=middle;
+		}
+		return first;
+	}
+
+	const unsigned char *entries;
+	SignatureIndexEntry *sorted;
+	unsigned int *tagStart;
+};
+
+// Buffers one copy op so consecutive blocks are written as one op
+class DeltaWriter
+{
+public:
+	DeltaWriter(DeltaOutput *_output) : failed(false), output(_output), pendingCopyCount(0) {}
+
+	void Copy(uint64_t block)
+	{
+		if (pendingCopyCount > 0 && block==pendingCopyFirst+pendingCopyCount && pendingCopyCount < 0xFFFFFFFF)
+		{
+			pendingCopyCount++;
+			return;
+		}
+		FlushCopy();
+		pendingCopyFirst=block;
+		pendingCopyCount=1;
+	}
+
+	void Literal(const unsigned char *data, unsigned int length)
+	{
+		if (length==0)
+			return;
+		FlushCopy();
+		unsigned char op[5];
+		op[0]=OP_LITERAL;
+		WriteUInt32(op+1, length);
+		Write(op, sizeof(op));
+		Write(data, length);
+	}
+
+	void End(const unsigned char digest[SHA1_LENGTH])
+	{
+		FlushCopy();
+		unsigned char op=OP_END;
+		Write(&op, 1);
+		Write(digest, SHA1_LENGTH);
+	}
+
+	bool failed;
+
+protected:
+	void FlushCopy(void)
+	{
+		if (pendingCopyCount==0)
+			return;
+		unsigned char op[13];
+		op[0]=OP_COPY;
+		WriteUInt64(op+1, pendingCopyFirst);
+		WriteUInt32(op+9, (uint32_t) pendingCopyCount);
+		Write(op, sizeof(op));
+		pendingCopyCount=0;
+	}
+
+	void Write(const void *data, unsigned int length)
+	{
+		if (failed==false && output->Write(data, length)==false)
+			failed=true;
+	}
+
+	DeltaOutput *output;
+	uint64_t pendingCopyFirst, pendingCopyCount;
+};
+
+static bool GenerateDelta(const char *signature, unsigned int signatureSize, DeltaInput *newFile, uint64_t newFileLength, DeltaOutput *output)
+{
+	SignatureIndex index;
+	if (index.Init((const unsigned char*) signature, signatureSize)==false)
+		return false;
+
+	unsigned char header[PATCH_HEADER_SIZE];
+	WriteUInt32(header, PATCH_MAGIC);
+	WriteUInt32(header+4, PATCH_VERSION);
+	WriteUInt32(header+8, index.blockSize);
+	WriteUInt64(header+12, index.oldFileLength);
+	WriteUInt64(header+20, newFileLength);
+	DeltaWriter writer(output);
+	if (output->Write(header, sizeof(header))==false)
+		return false;
+
+	const unsigned int blockSize = index.blockSize;
+	// Unwritten literal bytes and the block being checked always fit, with at least READ_SIZE left over
+	const unsigned int capacity = MAX_LITERAL_LENGTH + 2*blockSize + READ_SIZE;
+	unsigned char *buffer = (unsigned char*) malloc(capacity);
+	if (buffer==0)
+		return false;
+	unsigned int bufferLength=0, position=0, literalStart=0;
+	uint64_t totalRead=0;
+	bool endOfFile=false, readFailed=false;
+	CSHA1 fileHash;
+
+	uint32_t s1=0, s2=0;
+	bool checksumValid=false;
+	uint64_t nextBlock=(uint64_t) -1;
+
+	for (;;)
+	{
+		if (position+blockSize > bufferLength && endOfFile==false)
+		{
+			// Keep the unwritten literal, discard what was already written
+			memmove(buffer, buffer+literalStart, bufferLength-literalStart);
+			bufferLength-=literalStart;
+			position-=literalStart;
+			literalStart=0;
+			unsigned int toRead = capacity-bufferLength;
+			unsigned int numRead = newFile->ReadSome(buffer+bufferLength, toRead);
+			if (numRead < toRead)
+			{
+				endOfFile=true;
+				readFailed = newFile->Failed();
+			}
+			fileHash.Update(buffer+bufferLength, numRead);
+			bufferLength+=numRead;
+			totalRead+=numRead;
+		}
+		if (position+blockSize > bufferLength)
+			break;
+
+		if (checksumValid==false)
+		{
+			WeakChecksumParts(buffer+position, blockSize, &s1, &s2);
+			checksumValid=true;
+		}
+
+		uint64_t block;
+		if (index.FindBlock(CombineWeakChecksum(s1, s2), buffer+position, nextBlock, &block))
+		{
+			writer.Literal(buffer+literalStart, position-literalStart);
+			writer.Copy(block);
+			nextBlock=block+1;
+			position+=blockSize;
+			literalStart=position;
+			checksumValid=false;
+			continue;
+		}
+
+		// Roll the checksum forward one byte
+		unsigned char byteOut = buffer[position];
+		position++;
+		if (position-literalStart >= MAX_LITERAL_LENGTH)
+		{
+			writer.Literal(buffer+literalStart, position-literalStart);
+			literalStart=position;
+		}
+		if (position+blockSize > bufferLength)
+		{
+			// Recompute after refilling, since the buffer moves
+			checksumValid=false;
+			continue;
+		}
+		unsigned char byteIn = buffer[position+blockSize-1];
+		s1 = s1 - byteOut + byteIn;
+		s2 = s2 - blockSize*byteOut + s1;
+	}
+
+	// Less than one block remains
+	if (index.MatchesTail(buffer+position, bufferLength-position))
+	{
+		writer.Literal(buffer+literalStart, position-literalStart);
+		writer.Copy(index.blockCount-1);
+		literalStart=bufferLength;
+	}
+	writer.Literal(buffer+literalStart, bufferLength-literalStart);
+	free(buffer);
+
+	fileHash.Final();
+	writer.End(fileHash.GetHash());
+
+	// The file changed while it was read
+	if (totalRead!=newFileLength)
+		return false;
+	return readFailed==false && writer.failed==false;
+}
+
+static bool GenerateDelta(const char *signature, unsigned int signatureSize, const char *newFilePath, DeltaOutput *output)
+{
+	FILE *fp = fopen(newFilePath, "rb");
+	if (fp==0)
+		return false;
+	uint64_t newFileLength;
+	bool success = GetFileLength(fp, &newFileLength);
+	if (success)
+	{
+		DeltaInput input(fp);
+		success = GenerateDelta(signature, signatureSize, &input, newFileLength, output);
+	}
+	fclose(fp);
+	return success;
+}
+
+bool CreateRollingDeltaPatch(const char *signature, unsigned int signatureSize, const char *newFilePath, const char *patchFilePath)
+{
+	FILE *fp = fopen(patchFilePath, "wb");
+	if (fp==0)
+		return false;
+	DeltaOutput output(fp);
+	bool success = GenerateDelta(signature, signatureSize, newFilePath, &output);
+	if (fclose(fp)!=0)
+		success=false;
+	return success;
+}
+
+bool CreateRollingDeltaPatch(const char *signature, unsigned int signatureSize, const char *newFilePath, char **patch, unsigned int *patchSize)
+{
+	DeltaOutput output;
+	if (GenerateDelta(signature, signatureSize, newFilePath, &output)==false)
+		return false;
+	output.Detach(patch, patchSize);
+	return true;
+}
+
+bool CreateRollingDeltaPatch(const char *signature, unsigned int signatureSize, const char *newFile, uint64_t newFileLength, char **patch, unsigned int *patchSize)
+{
+	DeltaInput input(newFile, newFileLength);
+	DeltaOutput output;
+	if (GenerateDelta(signature, signatureSize, &input, newFileLength, &output)==false)
+		return false;
+	output.Detach(patch, patchSize);
+	return true;
+}
+
+// -----------------------------------------------------------------
+
+static bool ApplyDelta(const char *oldFilePath, DeltaInput *patch, DeltaOutput *output)
+{
+	unsigned char header[PATCH_HEADER_SIZE];
+	if (patch->Read(header, sizeof(header))==false ||
+		ReadUInt32(header)!=PATCH_MAGIC ||
+		ReadUInt32(header+4)!=PATCH_VERSION)
+		return false;
+	unsigned int blockSize = ReadUInt32(header+8);
+	uint64_t oldFileLength = ReadUInt64(header+12);
+	uint64_t newFileLength = ReadUInt64(header+20);
+	if (blockSize==0 || output->Reserve(newFileLength)==false)
+		return false;
+
+	FILE *fp = fopen(oldFilePath, "rb");
+	if (fp==0)
+		return false;
+	uint64_t actualOldFileLength;
+	if (GetFileLength(fp, &actualOldFileLength)==false || actualOldFileLength!=oldFileLength)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	unsigned char *buffer = (unsigned char*) malloc(READ_SIZE);
+	if (buffer==0)
+	{
+		fclose(fp);
+		return false;
+	}
+	CSHA1 fileHash;
+	uint64_t written=0;
+	bool success=false;
+	for (;;)
+	{
+		unsigned char op;
+		if (patch->Read(&op, 1)==false)
+			break;
+
+		if (op==OP_END)
+		{
+			unsigned char digest[SHA1_LENGTH];
+			fileHash.Final();
+			success = patch->Read(digest, SHA1_LENGTH) &&
+				written==newFileLength &&
+				memcmp(digest, fileHash.GetHash(), SHA1_LENGTH)==0;
+			break;
+		}
+
+		uint64_t length;
+		if (op==OP_COPY)
+		{
+			unsigned char args[12];
+			if (patch->Read(args, sizeof(args))==false)
+				break;
+			uint64_t offset = ReadUInt64(args)*blockSize;
+			length = (uint64_t) ReadUInt32(args+8)*blockSize;
+			if (ReadUInt64(args) > oldFileLength/blockSize || offset > oldFileLength)
+				break;
+			if (length > oldFileLength-offset)
+				length=oldFileLength-offset;
+			if (fseek64(fp, offset, SEEK_SET)!=0)
+				break;
+		}
+		else if (op==OP_LITERAL)
+		{
+			unsigned char args[4];
+			if (patch->Read(args, sizeof(args))==false)
+				break;
+			length=ReadUInt32(args);
+		}
+		else
+			break;
+
+		if (length > newFileLength-written)
+			break;
+
+		bool opFailed=false;
+		while (length > 0)
+		{
+			unsigned int chunk = length < READ_SIZE ? (unsigned int) length : READ_SIZE;
+			bool read = op==OP_COPY ? fread(buffer, 1, chunk, fp)==chunk : patch->Read(buffer, chunk);
+			if (read==false || output->Write(buffer, chunk)==false)
+			{
+				opFailed=true;
+				break;
+			}
+			fileHash.Update(buffer, chunk);
+			written+=chunk;
+			length-=chunk;
+		}
+		if (opFailed)
+			break;
+	}
+
+	free(buffer);
+	fclose(fp);
+	return success;
+}
+
+bool ApplyRollingDeltaPatch(const char *oldFilePath, const char *patchFilePath, const char *newFilePath)
+{
+	FILE *patchFile = fopen(patchFilePath, "rb");
+	if (patchFile==0)
+		return false;
+	FILE *newFile = fopen(newFilePath, "wb");
+	if (newFile==0)
+	{
+		fclose(patchFile);
+		return false;
+	}
+	DeltaInput input(patchFile);
+	DeltaOutput output(newFile);
+	bool success = ApplyDelta(oldFilePath, &input, &output);
+	fclose(patchFile);
+	if (fclose(newFile)!=0)
+		success=false;
+	return success;
+}
+
+bool ApplyRollingDeltaPatch(const char *oldFilePath, const char *patch, unsigned int patchSize, const char *newFilePath)
+{
+	FILE *newFile = fopen(newFilePath, "wb");
+	if (newFile==0)
+		return false;
+	DeltaInput input(patch, patchSize);
+	DeltaOutput output(newFile);
+	bool success = ApplyDelta(oldFilePath, &input, &output);
+	if (fclose(newFile)!=0)
+		success=false;
+	return success;
+}
+
+bool ApplyRollingDeltaPatch(const char *oldFilePath, const char *patch, unsigned int patchSize, char **newFile, unsigned int *newFileSize)
+{
+	DeltaInput input(patch, patchSize);
+	DeltaOutput output;
+	if (ApplyDelta(oldFilePath, &input, &output)==false)
+		return false;
+	output.Detach(newFile, newFileSize);
+	return true;
+}
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file
+/// \brief Block level delta patches between files of any size, using rsync style rolling checksums
+///
+/// CreatePatch() needs both files in memory and several times that in working memory, so it cannot be used for files above about 100 megabytes.
+/// These functions stream through both files instead. Memory use depends only on the block size and the number of blocks.
+/// 1. CreateRollingSignature() on the old version of a file. Any number of threads can share the work.
+/// 2. CreateRollingDeltaPatch() with that signature on the new version of the file.
+/// 3. ApplyRollingDeltaPatch() on the old version of the file, to get the new version.
+/// Patches copy blocks that moved as well as blocks that did not, but unlike bsdiff do not find changes smaller than a block.
+
+#ifndef __ROLLING_DELTA_H
+#define __ROLLING_DELTA_H
+
+#include <stdint.h>
+
+/// Value for FileListNodeContext::flnc_extraData2, and the patchAlgorithm column of the repositories, for patches made with CreateRollingDeltaPatch(). bsdiff patches use 0.
+/// AutopatcherClient applies these with AutopatcherClientCBInterface::ApplyPatchRollingDelta().
+#define PATCH_ALGORITHM_ROLLING_DELTA 1
+
+/// The repositories make patches with CreateRollingDeltaPatch() instead of CreatePatch() when the old or the new version of a file is at least this long
+#ifndef ROLLING_DELTA_MIN_FILE_LENGTH
+#define ROLLING_DELTA_MIN_FILE_LENGTH (16<<20)
+#endif
+
+/// Returns a block size suited to a file of \a fileLength bytes, growing with the square root of the length from 1 kilobyte to 1 megabyte
+unsigned int GetRollingDeltaBlockSize(uint64_t fileLength);
+
+/// Read \a oldFilePath and write the checksums of each block to \a signature, which is allocated for you with malloc()
+/// \param[in] blockSize Size of the blocks to match. Pass 0 to use GetRollingDeltaBlockSize().
+/// \param[in] numThreads How many threads read the file. Each reads its own part.
+/// \return false if the file could not be read
+bool CreateRollingSignature(const char *oldFilePath, unsigned int blockSize, int numThreads, char **signature, unsigned int *signatureSize);
+
+/// Same as the other CreateRollingSignature(), but the old file is in memory
+bool CreateRollingSignature(const char *oldFile, uint64_t oldFileLength, unsigned int blockSize, int numThreads, char **signature, unsigned int *signatureSize);
+
+/// Read \a newFilePath and write a patch from the file described by \a signature to \a patchFilePath
+/// \return false if the signature is invalid, or a file could not be read or written
+bool CreateRollingDeltaPatch(const char *signature, unsigned int signatureSize, const char *newFilePath, const char *patchFilePath);
+
+/// Same as the other CreateRollingDeltaPatch(), but returns the patch in \a patch, which is allocated for you with malloc()
+bool CreateRollingDeltaPatch(const char *signature, unsigned int signatureSize, const char *newFilePath, char **patch, unsigned int *patchSize);
+
+/// Same as the other CreateRollingDeltaPatch(), but the new file is in memory, and the patch is returned in \a patch, which is allocated for you with malloc()
+bool CreateRollingDeltaPatch(const char *signature, unsigned int signatureSize, const char *newFile, uint64_t newFileLength, char **patch, unsigned int *patchSize);
+
+/// Apply the patch in \a patchFilePath to \a oldFilePath, writing the result to \a newFilePath, which must be a different file
+/// \return false if the old file is not the one the patch was made for, the patch is corrupt, or a file could not be read or written
+bool ApplyRollingDeltaPatch(const char *oldFilePath, const char *patchFilePath, const char *newFilePath);
+
+/// Same as the other ApplyRollingDeltaPatch(), but the patch is in memory. The result is still written to \a newFilePath as it is made, so it can be larger than memory.
+bool ApplyRollingDeltaPatch(const char *oldFilePath, const char *patch, unsigned int patchSize, const char *newFilePath);
+
+/// Same as the other ApplyRollingDeltaPatch(), but the patch and the result are in memory. \a newFile is allocated for you with malloc()
+bool ApplyRollingDeltaPatch(const char *oldFilePath, const char *patch, unsigned int patchSize, char **newFile, unsigned int *newFileSize);
+
+#endif
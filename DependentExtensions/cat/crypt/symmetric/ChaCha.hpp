@@ -137,6 +137,9 @@ public:
 
 	// Message with any number of bytes
 	void Crypt(const void *in, void *out, int bytes);
+
+	// Name of the keystream implementation picked for this processor: "AVX2", "SSE2" or "portable"
+	static const char *GetImplementation();
 };
 
 
@@ -139,6 +139,12 @@ public:
     // msg_bytes: Number of bytes in the message, excluding the overhead
 	// If Encrypt() returns true, msg_bytes is set to the size of the encrypted message
     bool Encrypt(u8 *buffer, u32 buffer_bytes, u32 &msg_bytes);
+
+    // Encrypt() split in two, so messages can be encrypted on other threads:
+	// NextIV() reserves the IV for the next message, in the order the messages are sent, from the thread that owns this object.
+	// Encrypt() with that IV only reads the keys, so any thread may call it, as long as the keys are not changed meanwhile.
+	CAT_INLINE u64 NextIV() { return ++local_iv; }
+    bool Encrypt(u64 iv, u8 *buffer, u32 buffer_bytes, u32 &msg_bytes) const;
 };
 
 
@@ -218,7 +218,7 @@ bool HMAC_MD5::SetKey(ICryptHash *parent)
     return true;
 }
 
-void HMAC_MD5::RekeyFromMD5(HMAC_MD5 *parent)
+void HMAC_MD5::RekeyFromMD5(const HMAC_MD5 *parent)
 {
 	memcpy(CachedInitialState, parent->CachedInitialState, sizeof(CachedInitialState));
 	memcpy(CachedFinalState, parent->CachedFinalState, sizeof(CachedFinalState));
@@ -120,6 +120,251 @@ ChaChaOutput::~ChaChaOutput()
 	CAT_OBJCLR(state);
 }
 
+
+//// Vectorized keystream
+
+/*
+	These generate the keystream for 4 (SSE2) or 8 (AVX2) consecutive blocks
+	at once, one block per vector lane, so the output is the same as calling
+	GenerateKeyStream() for each block.  The widest one the processor supports
+	is picked at startup.  Define CAT_CHACHA_NO_SIMD to always use the portable
+	version.
+*/
+
+#if !defined(CAT_CHACHA_NO_SIMD) && (defined(__x86_64) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) && \
+	(defined(CAT_COMPILER_GCC) || defined(CAT_COMPILER_MSVC))
+# define CAT_CHACHA_SIMD
+# include <emmintrin.h>
+# include <immintrin.h>
+# if defined(CAT_COMPILER_MSVC)
+#  include <intrin.h>
+#  define CAT_CHACHA_TARGET(isa)
+# else
+#  define CAT_CHACHA_TARGET(isa) __attribute__((target(isa)))
+# endif
+#endif
+
+// Encrypts or decrypts as many whole groups of blocks as fit in bytes, and returns the number of bytes done
+typedef int (*ChaChaCryptBlocks)(u32 *state, const u8 *in, u8 *out, int bytes);
+
+static int ChaChaCryptBlocksPortable(u32 *state, const u8 *in, u8 *out, int bytes)
+{
+	(void) state; (void) in; (void) out; (void) bytes;
+	return 0;
+}
+
+#if defined(CAT_CHACHA_SIMD)
+
+#define CAT_CHACHA_ROL128(v, r) _mm_or_si128(_mm_slli_epi32(v, r), _mm_srli_epi32(v, 32 - (r)))
+#define CAT_CHACHA_QR128(a,b,c,d) \
+	x[a] = _mm_add_epi32(x[a], x[b]); x[d] = CAT_CHACHA_ROL128(_mm_xor_si128(x[d], x[a]), 16); \
+	x[c] = _mm_add_epi32(x[c], x[d]); x[b] = CAT_CHACHA_ROL128(_mm_xor_si128(x[b], x[c]), 12); \
+	x[a] = _mm_add_epi32(x[a], x[b]); x[d] = CAT_CHACHA_ROL128(_mm_xor_si128(x[d], x[a]), 8); \
+	x[c] = _mm_add_epi32(x[c], x[d]); x[b] = CAT_CHACHA_ROL128(_mm_xor_si128(x[b], x[c]), 7);
+
+CAT_CHACHA_TARGET("sse2") static int ChaChaCryptBlocksSSE2(u32 *state, const u8 *in, u8 *out, int bytes)
+{
+	int done = 0;
+
+	while (bytes - done >= 4 * 64)
+	{
+		__m128i s[16], x[16];
+		for (int ii = 0; ii < 16; ++ii)
+			s[ii] = _mm_set1_epi32((int)state[ii]);
+
+		// Block counters of the 4 lanes, same as GenerateKeyStream() would use
+		CAT_ALIGNED(16) u32 counter_low[4], counter_high[4];
+		for (int ii = 0; ii < 4; ++ii)
+		{
+			counter_low[ii] = state[12] + ii + 1;
+			counter_high[ii] = state[13] + (counter_low[ii] < state[12] ? 1 : 0);
+		}
+		s[12] = _mm_load_si128((const __m128i *)counter_low);
+		s[13] = _mm_load_si128((const __m128i *)counter_high);
+
+		for (int ii = 0; ii < 16; ++ii)
+			x[ii] = s[ii];
+
+		for (int round = 12; round > 0; round -= 2)
+		{
+			CAT_CHACHA_QR128(0, 4, 8,  12)
+			CAT_CHACHA_QR128(1, 5, 9,  13)
+			CAT_CHACHA_QR128(2, 6, 10, 14)
+			CAT_CHACHA_QR128(3, 7, 11, 15)
+			CAT_CHACHA_QR128(0, 5, 10, 15)
+			CAT_CHACHA_QR128(1, 6, 11, 12)
+			CAT_CHACHA_QR128(2, 7, 8,  13)
+			CAT_CHACHA_QR128(3, 4, 9,  14)
+		}
+
+		// Transpose each 4 words of the 4 lanes, so each block is contiguous
+		for (int ii = 0; ii < 16; ii += 4)
+		{
+			__m128i a = _mm_add_epi32(x[ii], s[ii]), b = _mm_add_epi32(x[ii+1], s[ii+1]);
+			__m128i c = _mm_add_epi32(x[ii+2], s[ii+2]), d = _mm_add_epi32(x[ii+3], s[ii+3]);
+			__m128i ab_low = _mm_unpacklo_epi32(a, b), cd_low = _mm_unpacklo_epi32(c, d);
+			__m128i ab_high = _mm_unpackhi_epi32(a, b), cd_high = _mm_unpackhi_epi32(c, d);
+			__m128i key[4] = {
+				_mm_unpacklo_epi64(ab_low, cd_low), _mm_unpackhi_epi64(ab_low, cd_low),
+				_mm_unpacklo_epi64(ab_high, cd_high), _mm_unpackhi_epi64(ab_high, cd_high)
+			};
+
+			for (int block = 0; block < 4; ++block)
+			{
+				int offset = done + block * 64 + ii * 4;
+				__m128i data = _mm_loadu_si128((const __m128i *)(in + offset));
+				_mm_storeu_si128((__m128i *)(out + offset), _mm_xor_si128(data, key[block]));
+			}
+		}
+
+		state[12] = counter_low[3];
+		state[13] = counter_high[3];
+		done += 4 * 64;
+	}
+
+	return done;
+}
+
+#undef CAT_CHACHA_QR128
+#undef CAT_CHACHA_ROL128
+
+#define CAT_CHACHA_ROL256(v, r) _mm256_or_si256(_mm256_slli_epi32(v, r), _mm256_srli_epi32(v, 32 - (r)))
+#define CAT_CHACHA_QR256(a,b,c,d) \
+	x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rol16); \
+	x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = CAT_CHACHA_ROL256(_mm256_xor_si256(x[b], x[c]), 12); \
+	x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rol8); \
+	x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = CAT_CHACHA_ROL256(_mm256_xor_si256(x[b], x[c]), 7);
+
+CAT_CHACHA_TARGET("avx2") static int ChaChaCryptBlocksAVX2(u32 *state, const u8 *in, u8 *out, int bytes)
+{
+	int done = 0;
+
+	// Rotations by whole bytes are a byte shuffle
+	const __m256i rol16 = _mm256_set_epi8(13,12,15,14, 9,8,11,10, 5,4,7,6, 1,0,3,2, 13,12,15,14, 9,8,11,10, 5,4,7,6, 1,0,3,2);
+	const __m256i rol8 = _mm256_set_epi8(14,13,12,15, 10,9,8,11, 6,5,4,7, 2,1,0,3, 14,13,12,15, 10,9,8,11, 6,5,4,7, 2,1,0,3);
+
+	while (bytes - done >= 8 * 64)
+	{
+		__m256i s[16], x[16];
+		for (int ii = 0; ii < 16; ++ii)
+			s[ii] = _mm256_set1_epi32((int)state[ii]);
+
+		// Block counters of the 8 lanes, same as GenerateKeyStream() would use
+		CAT_ALIGNED(32) u32 counter_low[8], counter_high[8];
+		for (int ii = 0; ii < 8; ++ii)
+		{
+			counter_low[ii] = state[12] + ii + 1;
+			counter_high[ii] = state[13] + (counter_low[ii] < state[12] ? 1 : 0);
+		}
+		s[12] = _mm256_load_si256((const __m256i *)counter_low);
+		s[13] = _mm256_load_si256((const __m256i *)counter_high);
+
+		for (int ii = 0; ii < 16; ++ii)
+			x[ii] = s[ii];
+
+		for (int round = 12; round > 0; round -= 2)
+		{
+			CAT_CHACHA_QR256(0, 4, 8,  12)
+			CAT_CHACHA_QR256(1, 5, 9,  13)
+			CAT_CHACHA_QR256(2, 6, 10, 14)
+			CAT_CHACHA_QR256(3, 7, 11, 15)
+			CAT_CHACHA_QR256(0, 5, 10, 15)
+			CAT_CHACHA_QR256(1, 6, 11, 12)
+			CAT_CHACHA_QR256(2, 7, 8,  13)
+			CAT_CHACHA_QR256(3, 4, 9,  14)
+		}
+
+		// Transpose each 4 words of the 8 lanes.  Unpacking works within 128-bit halves,
+		// so the low half of each result belongs to blocks 0-3 and the high half to blocks 4-7.
+		for (int ii = 0; ii < 16; ii += 4)
+		{
+			__m256i a = _mm256_add_epi32(x[ii], s[ii]), b = _mm256_add_epi32(x[ii+1], s[ii+1]);
+			__m256i c = _mm256_add_epi32(x[ii+2], s[ii+2]), d = _mm256_add_epi32(x[ii+3], s[ii+3]);
+			__m256i ab_low = _mm256_unpacklo_epi32(a, b), cd_low = _mm256_unpacklo_epi32(c, d);
+			__m256i ab_high = _mm256_unpackhi_epi32(a, b), cd_high = _mm256_unpackhi_epi32(c, d);
+			__m256i key[4] = {
+				_mm256_unpacklo_epi64(ab_low, cd_low), _mm256_unpackhi_epi64(ab_low, cd_low),
+				_mm256_unpacklo_epi64(ab_high, cd_high), _mm256_unpackhi_epi64(ab_high, cd_high)
+			};
+
+			for (int block = 0; block < 4; ++block)
+			{
+				int offset = done + block * 64 + ii * 4;
+				__m128i data = _mm_loadu_si128((const __m128i *)(in + offset));
+				_mm_storeu_si128((__m128i *)(out + offset), _mm_xor_si128(data, _mm256_castsi256_si128(key[block])));
+
+				offset += 4 * 64;
+				data = _mm_loadu_si128((const __m128i *)(in + offset));
+				_mm_storeu_si128((__m128i *)(out + offset), _mm_xor_si128(data, _mm256_extracti128_si256(key[block], 1)));
+			}
+		}
+
+		state[12] = counter_low[7];
+		state[13] = counter_high[7];
+		done += 8 * 64;
+	}
+
+	return done;
+}
+
+#undef CAT_CHACHA_QR256
+#undef CAT_CHACHA_ROL256
+
+static ChaChaCryptBlocks ChaChaSelectCryptBlocks(const char **name)
+{
+	bool sse2, avx2 = false;
+
+#if defined(CAT_COMPILER_MSVC)
+	int info[4];
+	__cpuid(info, 1);
+	sse2 = (info[3] & (1 << 26)) != 0;
+	// AVX2 also needs the OS to save the YMM registers
+	bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+	if (osxsave && avx && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	// Runs before other constructors, so initialize the CPU model first
+	__builtin_cpu_init();
+	sse2 = __builtin_cpu_supports("sse2") != 0;
+	avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+	if (avx2)
+	{
+		*name = "AVX2";
+		return ChaChaCryptBlocksAVX2;
+	}
+	if (sse2)
+	{
+		*name = "SSE2";
+		return ChaChaCryptBlocksSSE2;
+	}
+	*name = "portable";
+	return ChaChaCryptBlocksPortable;
+}
+
+#else // CAT_CHACHA_SIMD
+
+static ChaChaCryptBlocks ChaChaSelectCryptBlocks(const char **name)
+{
+	*name = "portable";
+	return ChaChaCryptBlocksPortable;
+}
+
+#endif // CAT_CHACHA_SIMD
+
+static const char *ChaChaImplementation = 0;
+// Null until static initialization reaches this file
+static ChaChaCryptBlocks ChaChaCryptBlocksSelected = ChaChaSelectCryptBlocks(&ChaChaImplementation);
+
+const char *ChaChaOutput::GetImplementation()
+{
+	return ChaChaImplementation ? ChaChaImplementation : "portable";
+}
+
 // Message with any number of bytes
 void ChaChaOutput::Crypt(const void *in_bytes, void *out_bytes, int bytes)
 {
@@ -136,6 +381,15 @@ void ChaChaOutput::Crypt(const void *in_bytes, void *out_bytes, int bytes)
 	printf("\n");
 #endif
 
+	// Whole groups of blocks use the vectorized keystream, if there is one
+	if (ChaChaCryptBlocksSelected)
+	{
+		int done = ChaChaCryptBlocksSelected(state, (const u8 *)in_bytes, (u8 *)out_bytes, bytes);
+		in32 += done / 4;
+		out32 += done / 4;
+		bytes -= done;
+	}
+
 	while (bytes >= 64)
 	{
 		u32 key32[16];
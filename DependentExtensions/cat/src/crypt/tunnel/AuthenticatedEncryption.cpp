@@ -346,15 +346,21 @@ bool AuthenticatedEncryption::Decrypt(u8 *buffer, u32 &buf_bytes)
 
 // Encrypt a packet to send to the remote host
 bool AuthenticatedEncryption::Encrypt(u8 *buffer, u32 buffer_bytes, u32 &msg_bytes)
+{
+	if (msg_bytes + OVERHEAD_BYTES > buffer_bytes) return false;
+
+	// Outgoing IV increments by one each time, and starts one ahead of remotely generated IV
+	return Encrypt(NextIV(), buffer, buffer_bytes, msg_bytes);
+}
+
+// Encrypt a packet to send to the remote host, with an IV from NextIV()
+bool AuthenticatedEncryption::Encrypt(u64 iv, u8 *buffer, u32 buffer_bytes, u32 &msg_bytes) const
 {
 	u32 out_bytes = msg_bytes + OVERHEAD_BYTES;
 	if (out_bytes > buffer_bytes) return false;
 
     u8 *overhead = buffer + msg_bytes;
 
-	// Outgoing IV increments by one each time, and starts one ahead of remotely generated IV
-	u64 iv = ++local_iv;
-
 #ifdef CAT_AUDIT
 	printf("AUDIT: Encrypting message with IV ");
 	for (int ii = 0; ii < 8; ++ii)
@@ -0,0 +1,257 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Checks CloudServer subscription notifications with SetNotificationCoalesceInterval(), over loopback.
+// Many clients subscribe to two keys, then an uploader posts new values of both, faster than the coalescing interval.
+// Every subscriber must end with the final value of each key, must never get an older value after a newer one,
+// and must get fewer notifications than there were posts, or nothing was coalesced.
+// Usage: CloudCoalescingTest [subscribers] [updates]
+
+#include "RakPeerInterface.h"
+#include "CloudServer.h"
+#include "CloudClient.h"
+#include "MessageIdentifiers.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+static const RakNet::TimeMS COALESCE_INTERVAL_MS = 50;
+// Between posts of each key
+static const RakNet::TimeMS UPDATE_INTERVAL_MS = 2;
+static const int KEY_COUNT = 2;
+
+static CloudKey MakeKey(int keyIndex)
+{
+    return CloudKey("CoalescedKey", (uint32_t) keyIndex);
+}
+
+struct Client
+{
+    RakPeerInterface *peer;
+    CloudClient cloudClient;
+    RakNetGUID serverGuid;
+    bool connected;
+    bool subscribed;
+    // Latest value of each key, and how many notifications came for it
+    unsigned int values[KEY_COUNT];
+    unsigned int notifications[KEY_COUNT];
+    bool wentBack;
+};
+
+static void PostValue(Client *uploader, int keyIndex, unsigned int value)
+{
+    CloudKey key = MakeKey(keyIndex);
+    uploader->cloudClient.Post(&key, (const unsigned char*) &value, sizeof(value), uploader->serverGuid);
+}
+
+static void ReadClient(Client *client)
+{
+    Packet *packet;
+    for (packet=client->peer->Receive(); packet; client->peer->DeallocatePacket(packet), packet=client->peer->Receive())
+    {
+        if (packet->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+        {
+            client->serverGuid=packet->guid;
+            client->connected=true;
+        }
+        else if (packet->data[0]==ID_CLOUD_GET_RESPONSE)
+        {
+            CloudQueryResult result;
+            client->cloudClient.OnGetReponse(&result, packet);
+            client->subscribed = result.subscribeToResults;
+            client->cloudClient.DeallocateWithDefaultAllocator(&result);
+        }
+        else if (packet->data[0]==ID_CLOUD_SUBSCRIPTION_NOTIFICATION)
+        {
+            bool wasUpdated;
+            CloudQueryRow row;
+            client->cloudClient.OnSubscriptionNotification(&wasUpdated, &row, packet);
+            int keyIndex = (int) row.key.secondaryKey;
+            if (wasUpdated && keyIndex < KEY_COUNT && row.length==sizeof(unsigned int))
+            {
+                unsigned int value;
+                memcpy(&value, row.data, sizeof(value));
+                if (value < client->values[keyIndex])
+                    client->wentBack=true;
+                client->values[keyIndex]=value;
+                client->notifications[keyIndex]++;
+            }
+            client->cloudClient.DeallocateWithDefaultAllocator(&row);
+        }
+    }
+}
+
+static void ReadServer(RakPeerInterface *server)
+{
+    Packet *p;
+    for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+        ;
+}
+
+int main(int argc, char **argv)
+{
+    int subscriberCount = argc > 1 ? atoi(argv[1]) : 200;
+    unsigned int updateCount = argc > 2 ? atoi(argv[2]) : 200;
+    if (subscriberCount <= 0 || updateCount==0)
+    {
+        printf("Usage: CloudCoalescingTest [subscribers] [updates]\n");
+        return 1;
+    }
+
+    RakPeerInterface *server = RakPeerInterface::GetInstance();
+    CloudServer cloudServer;
+    server->AttachPlugin(&cloudServer);
+    cloudServer.SetNotificationCoalesceInterval(COALESCE_INTERVAL_MS);
+    SocketDescriptor serverSd(0,"127.0.0.1");
+    server->Startup(subscriberCount+1, &serverSd, 1);
+    server->SetMaximumIncomingConnections(subscriberCount+1);
+
+    // Client 0 uploads, the rest subscribe
+    int clientCount = subscriberCount+1;
+    Client *clients = new Client[clientCount];
+    for (int i=0; i < clientCount; i++)
+    {
+        clients[i].peer = RakPeerInterface::GetInstance();
+        clients[i].peer->AttachPlugin(&clients[i].cloudClient);
+        clients[i].connected=false;
+        clients[i].subscribed=false;
+        memset(clients[i].values, 0, sizeof(clients[i].values));
+        memset(clients[i].notifications, 0, sizeof(clients[i].notifications));
+        clients[i].wentBack=false;
+        SocketDescriptor sd(0,"127.0.0.1");
+        clients[i].peer->Startup(1, &sd, 1);
+        clients[i].peer->Connect("127.0.0.1", server->GetMyBoundAddress().GetPort(), 0, 0);
+    }
+
+    int connected=0;
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 20000;
+    while (connected < clientCount && RakNet::GetTimeMS() < deadline)
+    {
+        ReadServer(server);
+        connected=0;
+        for (int i=0; i < clientCount; i++)
+        {
+            ReadClient(&clients[i]);
+            if (clients[i].connected)
+                connected++;
+        }
+        RakSleep(10);
+    }
+    bool ok = connected==clientCount;
+    if (ok==false)
+        printf("Only %d of %d clients connected\n", connected, clientCount);
+
+    // Value 0 first, so the keys exist, then subscribe
+    for (int k=0; ok && k < KEY_COUNT; k++)
+        PostValue(&clients[0], k, 0);
+    for (int i=1; ok && i < clientCount; i++)
+    {
+        CloudQuery query;
+        for (int k=0; k < KEY_COUNT; k++)
+            query.keys.Push(MakeKey(k), _FILE_AND_LINE_);
+        query.subscribeToResults=true;
+        clients[i].cloudClient.Get(&query, clients[i].serverGuid);
+    }
+    int subscribed=0;
+    deadline = RakNet::GetTimeMS() + 20000;
+    while (ok && subscribed < subscriberCount && RakNet::GetTimeMS() < deadline)
+    {
+        ReadServer(server);
+        subscribed=0;
+        for (int i=1; i < clientCount; i++)
+        {
+            ReadClient(&clients[i]);
+            if (clients[i].subscribed)
+                subscribed++;
+        }
+        RakSleep(10);
+    }
+    ok = ok && subscribed==subscriberCount;
+    printf("%-40s %s\n", "Subscribed", ok ? "Passed" : "FAILED");
+
+    // Post values 1 to updateCount of each key, many within each interval, while the subscribers read
+    unsigned int value=0;
+    RakNet::TimeMS start = RakNet::GetTimeMS(), nextUpdate = start;
+    deadline = start + 60000;
+    bool allFinal=false;
+    while (ok && allFinal==false && RakNet::GetTimeMS() < deadline)
+    {
+        if (value < updateCount && RakNet::GetTimeMS() >= nextUpdate)
+        {
+            value++;
+            nextUpdate+=UPDATE_INTERVAL_MS;
+            for (int k=0; k < KEY_COUNT; k++)
+                PostValue(&clients[0], k, value);
+        }
+        ReadServer(server);
+        ReadClient(&clients[0]);
+        allFinal = value==updateCount;
+        for (int i=1; i < clientCount; i++)
+        {
+            ReadClient(&clients[i]);
+            for (int k=0; k < KEY_COUNT; k++)
+            {
+                if (clients[i].values[k]!=updateCount)
+                    allFinal=false;
+            }
+        }
+        RakSleep(1);
+    }
+    RakNet::TimeMS elapsed = RakNet::GetTimeMS() - start;
+
+    if (ok)
+    {
+        int final=0, inOrder=0;
+        unsigned int notifications=0, mostNotifications=0;
+        for (int i=1; i < clientCount; i++)
+        {
+            bool clientFinal=true;
+            for (int k=0; k < KEY_COUNT; k++)
+            {
+                if (clients[i].values[k]!=updateCount)
+                    clientFinal=false;
+                notifications+=clients[i].notifications[k];
+                if (clients[i].notifications[k] > mostNotifications)
+                    mostNotifications=clients[i].notifications[k];
+            }
+            if (clientFinal)
+                final++;
+            if (clients[i].wentBack==false)
+                inOrder++;
+        }
+        bool finalOk = final==subscriberCount;
+        printf("%-40s %s, %d of %d subscribers\n", "Final value of every key", finalOk ? "Passed" : "FAILED", final, subscriberCount);
+        bool inOrderOk = inOrder==subscriberCount;
+        printf("%-40s %s, %d of %d subscribers\n", "Values never went back", inOrderOk ? "Passed" : "FAILED", inOrder, subscriberCount);
+        // Without coalescing, each subscriber would get every post of each key
+        bool coalescedOk = mostNotifications < updateCount;
+        printf("%-40s %s, at most %u notifications per key for %u posts\n", "Notifications coalesced", coalescedOk ? "Passed" : "FAILED", mostNotifications, updateCount);
+        printf("%u notifications in all, %u ms\n", notifications, elapsed);
+        ok = finalOk && inOrderOk && coalescedOk;
+    }
+
+    for (int i=0; i < clientCount; i++)
+    {
+        clients[i].peer->Shutdown(0);
+        clients[i].peer->DetachPlugin(&clients[i].cloudClient);
+        RakPeerInterface::DestroyInstance(clients[i].peer);
+    }
+    delete [] clients;
+    server->Shutdown(0);
+    server->DetachPlugin(&cloudServer);
+    RakPeerInterface::DestroyInstance(server);
+
+    printf(ok ? "Passed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
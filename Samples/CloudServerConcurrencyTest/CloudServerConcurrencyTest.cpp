@@ -0,0 +1,402 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Checks that CloudServer gets answered on worker threads return consistent rows while posts change them, over loopback.
+// Two connected servers run StartGetThreads(). Writers on each server post new versions of the same keys over and over,
+// while readers on each server keep one get in flight, for all the keys or for a few spread over the shards.
+// Every row returned must be one whole post of one writer to that key, every writer must have a row for every key asked for,
+// and no row may be older than the same row in an earlier get by the same reader. At the end every reader must see the last version.
+// Usage: CloudServerConcurrencyTest [rounds]
+
+#include "RakPeerInterface.h"
+#include "CloudServer.h"
+#include "CloudClient.h"
+#include "MessageIdentifiers.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include "Rand.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+static const int SERVER_COUNT = 2;
+// Per server
+static const int WRITERS_PER_SERVER = 2;
+static const int READERS_PER_SERVER = 2;
+static const int WRITER_COUNT = SERVER_COUNT * WRITERS_PER_SERVER;
+static const int READER_COUNT = SERVER_COUNT * READERS_PER_SERVER;
+static const unsigned int KEY_COUNT = 64;
+// How many keys a small get asks for
+static const unsigned int SMALL_GET_KEYS = 6;
+static const int GET_THREADS = 4;
+// Posts go out one round at a time, so gets run while the rows change
+static const RakNet::TimeMS ROUND_INTERVAL_MS = 10;
+
+static CloudKey MakeKey(unsigned int keyIndex)
+{
+    // Different primary keys, so the keys are spread over the shards
+    return CloudKey(RakString("Key%u", keyIndex), keyIndex % 3);
+}
+
+// Row data is the version, writer and key, then bytes derived from all three. Some rows are longer than
+// CLOUD_SERVER_DATA_STACK_SIZE and some shorter, and the length changes with the version.
+static unsigned int MakeRowData(unsigned int version, unsigned int writer, unsigned int keyIndex, unsigned char *data)
+{
+    unsigned int length = 12 + (keyIndex * 7 + version * 13) % 60;
+    memcpy(data, &version, 4);
+    memcpy(data+4, &writer, 4);
+    memcpy(data+8, &keyIndex, 4);
+    for (unsigned int i=12; i < length; i++)
+        data[i]=(unsigned char) (version * 31 + writer * 7 + keyIndex + i);
+    return length;
+}
+
+struct Peer
+{
+    RakPeerInterface *peer;
+    CloudClient cloudClient;
+    RakNetGUID serverGuid;
+    bool connected;
+};
+
+struct Reader : public Peer
+{
+    // The newest version seen for each writer and key
+    unsigned int versions[WRITER_COUNT][KEY_COUNT];
+    bool getInFlight;
+    bool lastGetWasFull;
+    unsigned int gets;
+    // Set once a get of every key returned the final version of every row
+    bool done;
+};
+
+static RakNetGUID writerGuids[WRITER_COUNT];
+
+static void SendGet(Reader *reader, bool full)
+{
+    CloudQuery query;
+    if (full)
+    {
+        for (unsigned int k=0; k < KEY_COUNT; k++)
+            query.keys.Push(MakeKey(k), _FILE_AND_LINE_);
+    }
+    else
+    {
+        // Distinct keys, so each row is expected once
+        unsigned int first = randomMT() % KEY_COUNT;
+        unsigned int step = 1 + randomMT() % (KEY_COUNT / SMALL_GET_KEYS - 1);
+        for (unsigned int k=0; k < SMALL_GET_KEYS; k++)
+            query.keys.Push(MakeKey((first + k * step) % KEY_COUNT), _FILE_AND_LINE_);
+    }
+    reader->cloudClient.Get(&query, reader->serverGuid);
+    reader->getInFlight=true;
+    reader->lastGetWasFull=full;
+    reader->gets++;
+}
+
+// \return false if a row is wrong, missing, repeated, or older than before
+static bool CheckGetResult(Reader *reader, CloudQueryResult *result, unsigned int finalVersion)
+{
+    bool seen[WRITER_COUNT][KEY_COUNT];
+    memset(seen, 0, sizeof(seen));
+    bool allFinal=true;
+    for (unsigned int r=0; r < result->rowsReturned.Size(); r++)
+    {
+        CloudQueryRow *row = result->rowsReturned[r];
+        unsigned int version=0, writer=0, keyIndex=0;
+        if (row->length >= 12)
+        {
+            memcpy(&version, row->data, 4);
+            memcpy(&writer, row->data+4, 4);
+            memcpy(&keyIndex, row->data+8, 4);
+        }
+        unsigned char expected[128];
+        if (row->length < 12 || writer >= (unsigned int) WRITER_COUNT || keyIndex >= KEY_COUNT ||
+            MakeRowData(version, writer, keyIndex, expected)!=row->length || memcmp(expected, row->data, row->length)!=0)
+        {
+            printf("Row %u of %u bytes is not whole\n", r, row->length);
+            return false;
+        }
+        if ((row->key==MakeKey(keyIndex))==false || row->clientGUID!=writerGuids[writer])
+        {
+            printf("Row %u for writer %u key %u came back under the wrong key or client\n", r, writer, keyIndex);
+            return false;
+        }
+        if (seen[writer][keyIndex])
+        {
+            printf("Writer %u key %u returned twice\n", writer, keyIndex);
+            return false;
+        }
+        seen[writer][keyIndex]=true;
+        if (version < reader->versions[writer][keyIndex])
+        {
+            printf("Writer %u key %u went back from version %u to %u\n", writer, keyIndex, reader->versions[writer][keyIndex], version);
+            return false;
+        }
+        reader->versions[writer][keyIndex]=version;
+        if (version!=finalVersion)
+            allFinal=false;
+    }
+    for (unsigned int k=0; k < result->cloudQuery.keys.Size(); k++)
+    {
+        CloudKey &key = result->cloudQuery.keys[k];
+        // The primary key is "Key" and the key index
+        unsigned int keyIndex = (unsigned int) atoi(key.primaryKey.C_String()+3);
+        for (int w=0; w < WRITER_COUNT; w++)
+        {
+            if (seen[w][keyIndex]==false)
+            {
+                printf("Writer %d key %u missing\n", w, keyIndex);
+                return false;
+            }
+        }
+    }
+    if (reader->lastGetWasFull && allFinal && result->rowsReturned.Size()==WRITER_COUNT*KEY_COUNT)
+        reader->done=true;
+    return true;
+}
+
+static void ReadPeer(Peer *p)
+{
+    Packet *packet;
+    for (packet=p->peer->Receive(); packet; p->peer->DeallocatePacket(packet), packet=p->peer->Receive())
+    {
+        if (packet->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+        {
+            p->serverGuid=packet->guid;
+            p->connected=true;
+        }
+    }
+}
+
+// \return false if a get returned wrong rows
+static bool ReadReader(Reader *reader, unsigned int finalVersion, bool writersDone)
+{
+    bool ok=true;
+    Packet *packet;
+    for (packet=reader->peer->Receive(); packet; reader->peer->DeallocatePacket(packet), packet=reader->peer->Receive())
+    {
+        if (packet->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+        {
+            reader->serverGuid=packet->guid;
+            reader->connected=true;
+        }
+        else if (packet->data[0]==ID_CLOUD_GET_RESPONSE)
+        {
+            CloudQueryResult result;
+            reader->cloudClient.OnGetReponse(&result, packet);
+            ok = CheckGetResult(reader, &result, finalVersion) && ok;
+            reader->cloudClient.DeallocateWithDefaultAllocator(&result);
+            reader->getInFlight=false;
+        }
+    }
+    // Once the writers are done, only full gets, until one sees every final version
+    if (ok && reader->getInFlight==false && reader->done==false)
+        SendGet(reader, writersDone || randomMT() % 4==0);
+    return ok;
+}
+
+static bool WaitForConnections(RakPeerInterface **servers, Peer **peers, int peerCount)
+{
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 5000;
+    while (RakNet::GetTimeMS() < deadline)
+    {
+        bool all=true;
+        for (int s=0; s < SERVER_COUNT; s++)
+        {
+            Packet *p;
+            for (p=servers[s]->Receive(); p; servers[s]->DeallocatePacket(p), p=servers[s]->Receive())
+                ;
+        }
+        for (int i=0; i < peerCount; i++)
+        {
+            ReadPeer(peers[i]);
+            all = all && peers[i]->connected;
+        }
+        if (all)
+            return true;
+        RakSleep(10);
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    if (rounds==0)
+    {
+        printf("Usage: CloudServerConcurrencyTest [rounds]\n");
+        return 1;
+    }
+    seedMT(0);
+
+    RakPeerInterface *servers[SERVER_COUNT];
+    CloudServer cloudServers[SERVER_COUNT];
+    for (int s=0; s < SERVER_COUNT; s++)
+    {
+        servers[s] = RakPeerInterface::GetInstance();
+        servers[s]->AttachPlugin(&cloudServers[s]);
+        SocketDescriptor sd(0,"127.0.0.1");
+        servers[s]->Startup(WRITERS_PER_SERVER+READERS_PER_SERVER+SERVER_COUNT, &sd, 1);
+        servers[s]->SetMaximumIncomingConnections(WRITERS_PER_SERVER+READERS_PER_SERVER+SERVER_COUNT);
+        cloudServers[s].StartGetThreads(GET_THREADS);
+    }
+
+    Peer writers[WRITER_COUNT];
+    Reader readers[READER_COUNT];
+    Peer *peers[WRITER_COUNT+READER_COUNT];
+    for (int i=0; i < WRITER_COUNT+READER_COUNT; i++)
+    {
+        bool isWriter = i < WRITER_COUNT;
+        Peer *p = isWriter ? &writers[i] : &readers[i-WRITER_COUNT];
+        peers[i]=p;
+        p->peer = RakPeerInterface::GetInstance();
+        p->peer->AttachPlugin(&p->cloudClient);
+        p->connected=false;
+        SocketDescriptor sd(0,"127.0.0.1");
+        p->peer->Startup(1, &sd, 1);
+        int server = isWriter ? i % SERVER_COUNT : (i-WRITER_COUNT) % SERVER_COUNT;
+        p->peer->Connect("127.0.0.1", servers[server]->GetMyBoundAddress().GetPort(), 0, 0);
+    }
+    for (int r=0; r < READER_COUNT; r++)
+    {
+        memset(readers[r].versions, 0, sizeof(readers[r].versions));
+        readers[r].getInFlight=false;
+        readers[r].gets=0;
+        readers[r].done=false;
+    }
+
+    // Each server connects to those before it
+    for (int s=1; s < SERVER_COUNT; s++)
+    {
+        for (int t=0; t < s; t++)
+            servers[s]->Connect("127.0.0.1", servers[t]->GetMyBoundAddress().GetPort(), 0, 0);
+    }
+
+    bool ok = WaitForConnections(servers, peers, WRITER_COUNT+READER_COUNT);
+    // Tell the servers about each other
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 5000;
+    for (int s=0; ok && s < SERVER_COUNT; s++)
+    {
+        for (int t=0; t < SERVER_COUNT; t++)
+        {
+            if (s==t)
+                continue;
+            while (servers[s]->GetConnectionState(servers[t]->GetMyGUID())!=IS_CONNECTED && RakNet::GetTimeMS() < deadline)
+                RakSleep(10);
+            cloudServers[s].AddServer(servers[t]->GetMyGUID());
+        }
+    }
+    if (ok==false)
+        printf("Failed to connect\n");
+
+    // Every writer posts every key once before the readers start, so every get has a row from each writer for each key
+    for (int w=0; w < WRITER_COUNT; w++)
+        writerGuids[w]=writers[w].peer->GetMyGUID();
+    unsigned char data[128];
+    for (int w=0; ok && w < WRITER_COUNT; w++)
+    {
+        for (unsigned int k=0; k < KEY_COUNT; k++)
+        {
+            CloudKey key = MakeKey(k);
+            unsigned int length = MakeRowData(0, w, k, data);
+            writers[w].cloudClient.Post(&key, data, length, writers[w].serverGuid);
+        }
+    }
+    // A full get by each reader that sees version 0 everywhere means all those posts arrived
+    for (int r=0; ok && r < READER_COUNT; r++)
+    {
+        deadline = RakNet::GetTimeMS() + 10000;
+        while (ok && readers[r].done==false && RakNet::GetTimeMS() < deadline)
+        {
+            for (int s=0; s < SERVER_COUNT; s++)
+            {
+                Packet *p;
+                for (p=servers[s]->Receive(); p; servers[s]->DeallocatePacket(p), p=servers[s]->Receive())
+                    ;
+            }
+            ok = ReadReader(&readers[r], 0, true);
+            RakSleep(1);
+        }
+        ok = ok && readers[r].done;
+        readers[r].done=false;
+        readers[r].gets=0;
+    }
+    printf("%-40s %s\n", "Initial posts", ok ? "Passed" : "FAILED");
+
+    // Each round, every writer posts a new version of every key, while the readers keep getting
+    unsigned int version=0, getsDuringPosts=0;
+    RakNet::TimeMS nextRound = RakNet::GetTimeMS();
+    deadline = nextRound + 120000;
+    bool readersDone=false;
+    while (ok && readersDone==false && RakNet::GetTimeMS() < deadline)
+    {
+        if (version < rounds && RakNet::GetTimeMS() >= nextRound)
+        {
+            version++;
+            nextRound+=ROUND_INTERVAL_MS;
+            for (int w=0; w < WRITER_COUNT; w++)
+            {
+                for (unsigned int k=0; k < KEY_COUNT; k++)
+                {
+                    CloudKey key = MakeKey(k);
+                    unsigned int length = MakeRowData(version, w, k, data);
+                    writers[w].cloudClient.Post(&key, data, length, writers[w].serverGuid);
+                }
+            }
+        }
+
+        for (int s=0; s < SERVER_COUNT; s++)
+        {
+            Packet *p;
+            for (p=servers[s]->Receive(); p; servers[s]->DeallocatePacket(p), p=servers[s]->Receive())
+                ;
+        }
+        for (int w=0; w < WRITER_COUNT; w++)
+            ReadPeer(&writers[w]);
+        readersDone=true;
+        for (int r=0; r < READER_COUNT; r++)
+        {
+            ok = ReadReader(&readers[r], rounds, version==rounds) && ok;
+            readersDone = readersDone && readers[r].done;
+        }
+        if (version < rounds)
+        {
+            getsDuringPosts=0;
+            for (int r=0; r < READER_COUNT; r++)
+                getsDuringPosts+=readers[r].gets;
+        }
+        RakSleep(1);
+    }
+    printf("%-40s %s\n", "Gets during posts", ok ? "Passed" : "FAILED");
+    bool finalOk = ok && readersDone;
+    printf("%-40s %s\n", "Final version everywhere", finalOk ? "Passed" : "FAILED");
+    printf("%u rounds of %u posts, with %u gets while posting\n", version, WRITER_COUNT * KEY_COUNT, getsDuringPosts);
+    ok = finalOk;
+
+    for (int i=0; i < WRITER_COUNT+READER_COUNT; i++)
+    {
+        peers[i]->peer->Shutdown(0);
+        peers[i]->peer->DetachPlugin(&peers[i]->cloudClient);
+        RakPeerInterface::DestroyInstance(peers[i]->peer);
+    }
+    for (int s=0; s < SERVER_COUNT; s++)
+    {
+        cloudServers[s].StopGetThreads();
+        servers[s]->Shutdown(0);
+        servers[s]->DetachPlugin(&cloudServers[s]);
+        RakPeerInterface::DestroyInstance(servers[s]);
+    }
+
+    printf(ok ? "Passed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,258 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Checks message coalescing over loopback.
+// First, the client merges many small RELIABLE_ORDERED messages of varying length, some too long to merge, and the server checks
+// that every one comes back out of the merged messages whole and in order.
+// Then the client sends ID_COALESCED_MESSAGES messages with malformed length prefixes, and the server checks that the parts
+// before the malformed one are returned, the rest is dropped, and the connection keeps working.
+// Usage: CoalescingTest [messageCount]
+
+#include "RakPeerInterface.h"
+#include "PluginInterface2.h"
+#include "InternalPacket.h"
+#include "MessageIdentifiers.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+enum
+{
+    ID_TEST_MESSAGE=ID_USER_PACKET_ENUM,
+    // Ends each malformed case, with the case number
+    ID_TEST_END_OF_CASE,
+    // Parts of the hand made merged messages, with the case number
+    ID_TEST_PART
+};
+
+// Counts merged messages as the server's reliability layer receives them
+class CoalescedMessageCounter : public PluginInterface2
+{
+public:
+    CoalescedMessageCounter() {count.store(0);}
+    virtual bool UsesReliabilityLayer(void) const {return true;}
+    virtual void OnInternalPacket(InternalPacket *internalPacket, unsigned frameNumber, SystemAddress remoteSystemAddress, RakNet::TimeMS time, int isSend)
+    {
+        (void) frameNumber; (void) remoteSystemAddress; (void) time;
+        if (isSend==false && internalPacket->dataBitLength >= 8 && internalPacket->data[0]==ID_COALESCED_MESSAGES)
+            count.fetch_add(1);
+    }
+
+    std::atomic<unsigned int> count;
+};
+
+static bool WaitForConnection(RakPeerInterface *server, RakPeerInterface *client)
+{
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 5000;
+    bool connected=false;
+    while (connected==false && RakNet::GetTimeMS() < deadline)
+    {
+        Packet *p;
+        for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+            ;
+        for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+        {
+            if (p->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+                connected=true;
+        }
+        RakSleep(10);
+    }
+    return connected;
+}
+
+// Message i is ID_TEST_MESSAGE, i, then bytes derived from i. Every 50th is longer than the coalescing limit.
+static unsigned int MessageLength(unsigned int i)
+{
+    return (i % 50)==49 ? 400 : 5 + (i * 7) % 120;
+}
+
+static void FillMessage(unsigned int i, unsigned char *data)
+{
+    unsigned int length = MessageLength(i);
+    data[0]=ID_TEST_MESSAGE;
+    memcpy(data+1, &i, sizeof(i));
+    for (unsigned int j=1+sizeof(i); j < length; j++)
+        data[j]=(unsigned char) (i+j);
+}
+
+static bool RunOrderTest(RakPeerInterface *server, RakPeerInterface *client, CoalescedMessageCounter *counter, unsigned int messageCount)
+{
+    SystemAddress serverAddress = server->GetMyBoundAddress();
+    unsigned char message[400], expected[400];
+    unsigned int sent=0, received=0;
+    bool ok=true;
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 60000;
+
+    while (received < messageCount && ok && RakNet::GetTimeMS() < deadline)
+    {
+        // Bursts, so messages wait to be merged and also go out as their delay runs out
+        for (unsigned int burst=0; burst < 200 && sent < messageCount; burst++, sent++)
+        {
+            FillMessage(sent, message);
+            client->Send((const char*) message, MessageLength(sent), HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+        }
+
+        Packet *p;
+        for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+        {
+            if (p->data[0]!=ID_TEST_MESSAGE)
+                continue;
+            FillMessage(received, expected);
+            if (p->length!=MessageLength(received) || memcmp(p->data, expected, p->length)!=0)
+            {
+                unsigned int index=0;
+                if (p->length >= 1+sizeof(index))
+                    memcpy(&index, p->data+1, sizeof(index));
+                printf("Expected message %u, got message %u of %u bytes\n", received, index, p->length);
+                ok=false;
+                break;
+            }
+            received++;
+        }
+        for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+            ;
+        RakSleep(1);
+    }
+
+    if (ok && received < messageCount)
+    {
+        printf("Timed out after %u of %u messages\n", received, messageCount);
+        ok=false;
+    }
+    // Otherwise the test would pass without merging anything
+    if (ok && counter->count.load()==0)
+    {
+        printf("No messages were merged\n");
+        ok=false;
+    }
+    printf("In order: %u/%u messages right, in %u merged messages. %s\n", received, messageCount, counter->count.load(), ok ? "Passed" : "FAILED");
+    return ok;
+}
+
+// A hand made merged message, which the client sends as is
+struct MalformedCase
+{
+    const char *description;
+    // After ID_COALESCED_MESSAGES. 0xFF is replaced with the case number in parts.
+    unsigned char data[16];
+    unsigned int length;
+    // How many parts come out before the malformed one
+    unsigned int expectedParts;
+};
+
+static const MalformedCase malformedCases[] =
+{
+    // Each part is a 16 bit length in bits, then ID_TEST_PART and the case number
+    {"Well formed", {16,0, ID_TEST_PART,0xFF, 16,0, ID_TEST_PART,0xFF}, 8, 2},
+    {"Zero length", {0,0, 16,0, ID_TEST_PART,0xFF}, 6, 0},
+    {"Length past the end", {16,0, ID_TEST_PART,0xFF, 0xFF,0xFF, ID_TEST_PART,0xFF}, 8, 1},
+    {"Length one byte past the end", {16,0, ID_TEST_PART,0xFF, 24,0, ID_TEST_PART,0xFF}, 8, 1},
+    {"Truncated length", {16,0, ID_TEST_PART,0xFF, 16}, 5, 1},
+    {"No parts", {0}, 0, 0},
+};
+
+static bool RunMalformedTest(RakPeerInterface *server, RakPeerInterface *client)
+{
+    SystemAddress serverAddress = server->GetMyBoundAddress();
+    unsigned int caseCount = sizeof(malformedCases) / sizeof(malformedCases[0]);
+    bool ok=true;
+
+    for (unsigned int c=0; c < caseCount; c++)
+    {
+        const MalformedCase &mc = malformedCases[c];
+        unsigned char message[1+16];
+        message[0]=ID_COALESCED_MESSAGES;
+        for (unsigned int i=0; i < mc.length; i++)
+            message[1+i]=(mc.data[i]==0xFF && i > 0 && mc.data[i-1]==ID_TEST_PART) ? (unsigned char) c : mc.data[i];
+        client->Send((const char*) message, 1+mc.length, HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+        unsigned char endOfCase[2] = {ID_TEST_END_OF_CASE, (unsigned char) c};
+        client->Send((const char*) endOfCase, sizeof(endOfCase), HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+    }
+
+    unsigned int currentCase=0, parts=0;
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 10000;
+    while (currentCase < caseCount && RakNet::GetTimeMS() < deadline)
+    {
+        Packet *p;
+        for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+        {
+            if (p->data[0]==ID_TEST_PART)
+            {
+                if (p->length!=2 || p->data[1]!=currentCase)
+                {
+                    printf("%s: part of %u bytes for case %u\n", malformedCases[currentCase].description, p->length, p->length > 1 ? p->data[1] : 0);
+                    ok=false;
+                }
+                parts++;
+            }
+            else if (p->data[0]==ID_TEST_END_OF_CASE && currentCase < caseCount)
+            {
+                bool caseOk = p->data[1]==currentCase && parts==malformedCases[currentCase].expectedParts;
+                printf("%-30s %u/%u parts %s\n", malformedCases[currentCase].description, parts, malformedCases[currentCase].expectedParts, caseOk ? "Passed" : "FAILED");
+                ok = ok && caseOk;
+                currentCase++;
+                parts=0;
+            }
+        }
+        for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+            ;
+        RakSleep(10);
+    }
+
+    if (currentCase < caseCount)
+    {
+        printf("Timed out after %u of %u cases\n", currentCase, caseCount);
+        ok=false;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int messageCount = argc > 1 ? atoi(argv[1]) : 20000;
+    if (messageCount==0)
+    {
+        printf("Usage: CoalescingTest [messageCount]\n");
+        return 1;
+    }
+
+    RakPeerInterface *server = RakPeerInterface::GetInstance();
+    RakPeerInterface *client = RakPeerInterface::GetInstance();
+    CoalescedMessageCounter counter;
+    server->AttachPlugin(&counter);
+    SocketDescriptor serverSd(0,"127.0.0.1");
+    SocketDescriptor clientSd(0,"127.0.0.1");
+    server->Startup(1, &serverSd, 1);
+    server->SetMaximumIncomingConnections(1);
+    client->Startup(1, &clientSd, 1);
+    // Up to 5 milliseconds, for messages up to 256 bytes, on ordering channel 0
+    client->SetMessageCoalescing(5000, 256, 1, UNASSIGNED_SYSTEM_ADDRESS);
+
+    bool ok=false;
+    client->Connect("127.0.0.1", server->GetMyBoundAddress().GetPort(), 0, 0);
+    if (WaitForConnection(server, client)==false)
+        printf("Failed to connect\n");
+    else
+        ok = RunOrderTest(server, client, &counter, messageCount) && RunMalformedTest(server, client);
+
+    client->Shutdown(0);
+    server->Shutdown(0);
+    server->DetachPlugin(&counter);
+    RakPeerInterface::DestroyInstance(client);
+    RakPeerInterface::DestroyInstance(server);
+
+    printf(ok ? "Passed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
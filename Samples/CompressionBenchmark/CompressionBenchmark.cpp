@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Compares the Huffman encoding of DataCompressor with LZCompressor, on generated text, game state, and random data.
+// Reports the compressed size as a percentage of the original, and compression and decompression throughput.
+// Usage: CompressionBenchmark [messageBytes] [totalMegabytes]
+
+#include "DataCompressor.h"
+#include "LZCompressor.h"
+#include "BitStream.h"
+#include "GetTime.h"
+#include "Rand.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+static void GenerateText(unsigned char *data, unsigned int length)
+{
+    static const char *words[] = {"player", "joined", "the", "game", "score", "team", "red", "blue", "match",
+        "round", "started", "ended", "with", "a", "of", "and", "to", "spawned", "at", "position"};
+    unsigned int i=0;
+    while (i < length)
+    {
+        const char *word = words[randomMT() % (sizeof(words)/sizeof(words[0]))];
+        while (*word && i < length)
+            data[i++]=*word++;
+        if (i < length)
+            data[i++]=(randomMT() % 8)==0 ? '\n' : ' ';
+    }
+}
+
+static void GenerateGameState(unsigned char *data, unsigned int length)
+{
+    // Records of an id, a position that moves a little, and flags that rarely change
+    struct Record {unsigned short id; float x, y, z; unsigned char flags, health;};
+    Record r;
+    memset(&r, 0, sizeof(r));
+    for (unsigned int i=0; i < length; i+=sizeof(r))
+    {
+        r.id++;
+        r.x+=(float) (randomMT() % 16) / 16.0f;
+        r.y=10.0f;
+        r.z+=0.5f;
+        r.flags=(randomMT() % 32)==0 ? (unsigned char) randomMT() : r.flags;
+        r.health=100;
+        memcpy(data+i, &r, length-i < sizeof(r) ? length-i : sizeof(r));
+    }
+}
+
+static void GenerateRandom(unsigned char *data, unsigned int length)
+{
+    for (unsigned int i=0; i < length; i++)
+        data[i]=(unsigned char) randomMT();
+}
+
+// Compress totalBytes in messages of messageBytes, then decompress them and check the result
+static void Run(const char *dataName, const char *compressorName, CompressionInterface *compressor, unsigned char *data, unsigned int messageBytes, unsigned int totalBytes)
+{
+    unsigned int numMessages = totalBytes / messageBytes;
+    RakNet::BitStream *streams = new RakNet::BitStream[numMessages];
+    uint64_t compressedBytes=0;
+    bool ok=true;
+
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    for (unsigned int i=0; i < numMessages; i++)
+    {
+        if (compressor)
+            DataCompressor::Compress(data+i*messageBytes, messageBytes, &streams[i], compressor);
+        else
+            DataCompressor::Compress(data+i*messageBytes, messageBytes, &streams[i]);
+        compressedBytes+=streams[i].GetNumberOfBytesUsed();
+    }
+    RakNet::TimeUS compressTime = RakNet::GetTimeUS()-start;
+
+    start = RakNet::GetTimeUS();
+    for (unsigned int i=0; i < numMessages; i++)
+    {
+        unsigned char *output;
+        unsigned int length;
+        if (compressor)
+            length=DataCompressor::DecompressAndAllocate(&streams[i], &output, compressor);
+        else
+            length=DataCompressor::DecompressAndAllocate(&streams[i], &output);
+        if (length!=messageBytes || memcmp(output, data+i*messageBytes, messageBytes)!=0)
+            ok=false;
+        if (length)
+            free(output);
+    }
+    RakNet::TimeUS decompressTime = RakNet::GetTimeUS()-start;
+
+    double megabytes = (double) numMessages * messageBytes / 1000000.0;
+    printf("%-10s %-8s %7.1f%% %10.1f %10.1f %s\n", dataName, compressorName,
+        100.0 * (double) compressedBytes / ((double) numMessages * messageBytes),
+        megabytes / ((double) (compressTime+1) / 1000000.0),
+        megabytes / ((double) (decompressTime+1) / 1000000.0),
+        ok ? "" : "MISMATCH");
+    delete [] streams;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int messageBytes = argc > 1 ? atoi(argv[1]) : 4096;
+    unsigned int totalBytes = (argc > 2 ? atoi(argv[2]) : 16) * 1000000;
+    if (messageBytes==0 || totalBytes < messageBytes)
+    {
+        printf("Usage: CompressionBenchmark [messageBytes] [totalMegabytes]\n");
+        return 1;
+    }
+
+    unsigned char *data = (unsigned char*) malloc(totalBytes);
+    LZCompressor lzCompressor;
+    seedMT(0);
+
+    printf("%u byte messages, %u megabytes per test\n", messageBytes, totalBytes / 1000000);
+    printf("%-10s %-8s %8s %10s %10s\n", "Data", "Codec", "Size", "Comp MB/s", "Decomp MB/s");
+    GenerateText(data, totalBytes);
+    Run("Text", "Huffman", 0, data, messageBytes, totalBytes);
+    Run("Text", "LZ", &lzCompressor, data, messageBytes, totalBytes);
+    GenerateGameState(data, totalBytes);
+    Run("GameState", "Huffman", 0, data, messageBytes, totalBytes);
+    Run("GameState", "LZ", &lzCompressor, data, messageBytes, totalBytes);
+    GenerateRandom(data, totalBytes);
+    Run("Random", "Huffman", 0, data, messageBytes, totalBytes);
+    Run("Random", "LZ", &lzCompressor, data, messageBytes, totalBytes);
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Floods a server over loopback with ID_OPEN_CONNECTION_REQUEST_2 from many addresses, while legitimate clients connect.
+// The flood never reads replies, the same as a sender using spoofed source addresses, so it can only guess the connection cookie.
+// Reports how many legitimate clients connected and how long they took, first without the flood, then with it.
+// Usage: ConnectionFloodTest [floodPacketsPerSecond] [clients] [maxConnections]
+
+#include "RakPeerInterface.h"
+#include "MessageIdentifiers.h"
+#include "BitStream.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include "RakThread.h"
+#include "Rand.h"
+#include "DS_List.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#ifdef _WIN32
+#include "WindowsIncludes.h"
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define closesocket close
+typedef int SOCKET;
+#endif
+
+using namespace RakNet;
+
+// Same as in RakPeer.cpp
+static const unsigned char OFFLINE_MESSAGE_DATA_ID[16] = {
+    0x00, 0xFF, 0xFF, 0x00, 0xFE, 0xFE, 0xFE, 0xFE, 0xFD, 0xFD, 0xFD, 0xFD, 0x12, 0x34, 0x56, 0x78
+};
+
+// Each socket is a different source address to the server
+static const int FLOOD_SOCKETS = 512;
+
+struct Flood
+{
+    unsigned short serverPort;
+    unsigned int packetsPerSecond;
+    std::atomic<bool> stop;
+    std::atomic<unsigned int> packetsSent;
+};
+
+RAK_THREAD_DECLARATION(FloodThread)
+{
+    Flood *flood = (Flood *) arguments;
+    SOCKET sockets[FLOOD_SOCKETS];
+    sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(flood->serverPort);
+    server.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int numSockets;
+    for (numSockets = 0; numSockets < FLOOD_SOCKETS; numSockets++)
+    {
+        sockets[numSockets] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (sockets[numSockets] == (SOCKET) -1)
+            break;
+        sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = inet_addr("127.0.0.1");
+        bind(sockets[numSockets], (sockaddr *) &local, sizeof(local));
+    }
+
+    // Replies are never read, so the cookie is a guess
+    RakNet::BitStream bs;
+    seedMT((unsigned int) RakNet::GetTimeUS());
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    unsigned int sent = 0;
+    while (flood->stop == false)
+    {
+        // Catch up to the target rate once per millisecond
+        unsigned int target = (unsigned int) ((RakNet::GetTimeUS() - start) * flood->packetsPerSecond / 1000000);
+        while (sent < target && flood->stop == false)
+        {
+            bs.Reset();
+            bs.Write((MessageID) ID_OPEN_CONNECTION_REQUEST_2);
+            bs.WriteAlignedBytes(OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID));
+            bs.Write((uint32_t) randomMT());
+            bs.Write(SystemAddress("127.0.0.1", flood->serverPort));
+            bs.Write((uint16_t) 1400);
+            bs.Write(RakNetGUID(((uint64_t) randomMT() << 32) | randomMT()));
+            sendto(sockets[sent % numSockets], (const char *) bs.GetData(), bs.GetNumberOfBytesUsed(), 0, (sockaddr *) &server, sizeof(server));
+            sent++;
+        }
+        flood->packetsSent = sent;
+        RakSleep(1);
+    }
+
+    for (int i = 0; i < numSockets; i++)
+        closesocket(sockets[i]);
+    return 0;
+}
+
+static int CompareTime(const void *a, const void *b)
+{
+    RakNet::TimeMS x = *(const RakNet::TimeMS *) a, y = *(const RakNet::TimeMS *) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void Run(unsigned int floodPacketsPerSecond, int numClients, int maxConnections)
+{
+    RakPeerInterface *server = RakPeerInterface::GetInstance();
+    SocketDescriptor serverSd(0, "127.0.0.1");
+    server->Startup(maxConnections, &serverSd, 1);
+    server->SetMaximumIncomingConnections((unsigned short) maxConnections);
+    unsigned short serverPort = server->GetMyBoundAddress().GetPort();
+
+    Flood flood;
+    flood.serverPort = serverPort;
+    flood.packetsPerSecond = floodPacketsPerSecond;
+    flood.stop = false;
+    flood.packetsSent = 0;
+    if (floodPacketsPerSecond)
+    {
+        RakThread::Create(FloodThread, &flood);
+        // Give the flood time to take what it can before the clients arrive
+        RakNet::TimeMS warmup = RakNet::GetTimeMS() + 1000;
+        while (RakNet::GetTimeMS() < warmup)
+        {
+            for (Packet *p = server->Receive(); p; server->DeallocatePacket(p), p = server->Receive())
+                ;
+            RakSleep(1);
+        }
+    }
+
+    RakPeerInterface **clients = new RakPeerInterface *[numClients];
+    int *result = new int[numClients];
+    RakNet::TimeMS start = RakNet::GetTimeMS();
+    int i;
+    for (i = 0; i < numClients; i++)
+    {
+        clients[i] = RakPeerInterface::GetInstance();
+        SocketDescriptor sd(0, "127.0.0.1");
+        clients[i]->Startup(1, &sd, 1);
+        clients[i]->Connect("127.0.0.1", serverPort, 0, 0);
+        result[i] = 0;
+    }
+
+    int connected = 0, failed = 0;
+    DataStructures::List<RakNet::TimeMS> latencies;
+    RakNet::TimeMS deadline = start + 15000;
+    while (connected + failed < numClients && RakNet::GetTimeMS() < deadline)
+    {
+        for (Packet *p = server->Receive(); p; server->DeallocatePacket(p), p = server->Receive())
+            ;
+        for (i = 0; i < numClients; i++)
+        {
+            for (Packet *p = clients[i]->Receive(); p; clients[i]->DeallocatePacket(p), p = clients[i]->Receive())
+            {
+                if (result[i] != 0)
+                    continue;
+                if (p->data[0] == ID_CONNECTION_REQUEST_ACCEPTED)
+                {
+                    result[i] = 1;
+                    connected++;
+                    latencies.Push(RakNet::GetTimeMS() - start, _FILE_AND_LINE_);
+                }
+                else if (p->data[0] == ID_NO_FREE_INCOMING_CONNECTIONS || p->data[0] == ID_CONNECTION_ATTEMPT_FAILED ||
+                         p->data[0] == ID_ALREADY_CONNECTED || p->data[0] == ID_IP_RECENTLY_CONNECTED)
+                {
+                    result[i] = p->data[0];
+                    failed++;
+                }
+            }
+        }
+        RakSleep(1);
+    }
+    flood.stop = true;
+
+    char latency[64] = "";
+    if (latencies.Size())
+    {
+        qsort(&latencies[0], latencies.Size(), sizeof(RakNet::TimeMS), CompareTime);
+        sprintf(latency, "%u / %u", latencies[latencies.Size() / 2], latencies[latencies.Size() - 1]);
+    }
+    int noFreeConnections = 0;
+    for (i = 0; i < numClients; i++)
+    {
+        if (result[i] == ID_NO_FREE_INCOMING_CONNECTIONS)
+            noFreeConnections++;
+    }
+    printf("%12u %10u %6i/%-6i %8i %10i %18s\n", floodPacketsPerSecond, (unsigned int) flood.packetsSent, connected, numClients,
+           noFreeConnections, numClients - connected - noFreeConnections, latency);
+
+    // Let the flood thread finish before the server goes away
+    RakSleep(100);
+    for (i = 0; i < numClients; i++)
+    {
+        clients[i]->Shutdown(0);
+        RakPeerInterface::DestroyInstance(clients[i]);
+    }
+    delete [] clients;
+    delete [] result;
+    server->Shutdown(0);
+    RakPeerInterface::DestroyInstance(server);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int floodPacketsPerSecond = argc > 1 ? atoi(argv[1]) : 20000;
+    int numClients = argc > 2 ? atoi(argv[2]) : 32;
+    int maxConnections = argc > 3 ? atoi(argv[3]) : 64;
+    if (numClients < 1 || maxConnections < numClients)
+    {
+        printf("Usage: ConnectionFloodTest [floodPacketsPerSecond] [clients] [maxConnections]\n");
+        return 1;
+    }
+
+    printf("%i clients, %i connections on the server\n", numClients, maxConnections);
+    printf("%12s %10s %13s %8s %10s %18s\n", "Flood pkt/s", "Flood sent", "Connected", "Server full", "Failed", "p50 / max ms");
+    Run(0, numClients, maxConnections);
+    if (floodPacketsPerSecond)
+        Run(floodPacketsPerSecond, numClients, maxConnections);
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Times FileList::AddFilesFromDirectory() with hashing on a generated directory tree:
+// serially, with a FileHasher on worker threads, and with a FileHasher whose manifest was saved by a previous run.
+// Usage: FileHashBenchmark [numFiles] [numThreads] [directory]
+
+#include "FileList.h"
+#include "FileHasher.h"
+#include "FileOperations.h"
+#include "GetTime.h"
+#include "Rand.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+static const unsigned int FILES_PER_DIRECTORY=500;
+static const unsigned int MAX_FILE_SIZE=32768;
+
+static void CreateTree(const char *root, unsigned int numFiles)
+{
+    char path[512];
+    char *data = (char*) malloc(MAX_FILE_SIZE);
+    for (unsigned int i=0; i < MAX_FILE_SIZE; i++)
+        data[i]=(char) randomMT();
+    for (unsigned int i=0; i < numFiles; i++)
+    {
+        sprintf(path, "%s/dir%04u/file%06u.bin", root, i / FILES_PER_DIRECTORY, i);
+        // Vary sizes and contents so every file hashes differently
+        unsigned int length = 1 + randomMT() % MAX_FILE_SIZE;
+        data[0]=(char) i;
+        data[1]=(char) (i>>8);
+        data[2]=(char) (i>>16);
+        WriteFileWithDirectories(path, data, length);
+    }
+    free(data);
+}
+
+static RakNet::TimeMS Scan(const char *root, FileHasher *fileHasher, FileList *fileList)
+{
+    fileList->Clear();
+    fileList->SetFileHasher(fileHasher);
+    RakNet::TimeMS start = RakNet::GetTimeMS();
+    fileList->AddFilesFromDirectory(root, 0, true, false, true, FileListNodeContext(0,0,0,0));
+    return RakNet::GetTimeMS()-start;
+}
+
+static bool SameHashes(FileList *a, FileList *b)
+{
+    if (a->fileList.Size()!=b->fileList.Size())
+        return false;
+    for (unsigned int i=0; i < a->fileList.Size(); i++)
+    {
+        if (strcmp(a->fileList[i].filename.C_String(), b->fileList[i].filename.C_String())!=0 ||
+            a->fileList[i].dataLengthBytes!=b->fileList[i].dataLengthBytes ||
+            memcmp(a->fileList[i].data, b->fileList[i].data, a->fileList[i].dataLengthBytes)!=0)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int numFiles = argc > 1 ? atoi(argv[1]) : 50000;
+    int numThreads = argc > 2 ? atoi(argv[2]) : 8;
+    const char *root = argc > 3 ? argv[3] : "FileHashBenchmarkData";
+    char manifestPath[512];
+    sprintf(manifestPath, "%s.manifest", root);
+
+    printf("Creating %u files in %s\n", numFiles, root);
+    seedMT(0);
+    CreateTree(root, numFiles);
+
+    // Note that after the first scan the files are in the OS file cache, so all runs measure hashing rather than disk reads
+    FileList serialList, threadedList, cachedList;
+    RakNet::TimeMS serialTime = Scan(root, 0, &serialList);
+    printf("Serial:                    %u files in %u ms\n", serialList.fileList.Size(), serialTime);
+
+    FileHasher *threadedHasher = FileHasher::GetInstance();
+    threadedHasher->StartThreads(numThreads);
+    RakNet::TimeMS threadedTime = Scan(root, threadedHasher, &threadedList);
+    printf("FileHasher, %2i threads:    %u files in %u ms, %u read\n", numThreads, threadedList.fileList.Size(), threadedTime, threadedHasher->GetFilesHashedCount());
+    threadedHasher->SaveManifest(manifestPath);
+    FileHasher::DestroyInstance(threadedHasher);
+
+    // Simulates a restart, where only the manifest survives
+    FileHasher *cachedHasher = FileHasher::GetInstance();
+    cachedHasher->StartThreads(numThreads);
+    RakNet::TimeMS loadStart = RakNet::GetTimeMS();
+    cachedHasher->LoadManifest(manifestPath);
+    RakNet::TimeMS loadTime = RakNet::GetTimeMS()-loadStart;
+    RakNet::TimeMS cachedTime = Scan(root, cachedHasher, &cachedList);
+    printf("FileHasher with manifest:  %u files in %u ms (+%u ms to load), %u read, %u from manifest\n", cachedList.fileList.Size(), cachedTime, loadTime, cachedHasher->GetFilesHashedCount(), cachedHasher->GetCacheHitCount());
+    FileHasher::DestroyInstance(cachedHasher);
+
+    bool same = SameHashes(&serialList, &threadedList) && SameHashes(&serialList, &cachedList);
+    printf("Hashes %s\n", same ? "match" : "DO NOT MATCH");
+    return same ? 0 : 1;
+}
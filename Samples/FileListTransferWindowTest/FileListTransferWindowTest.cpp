@@ -0,0 +1,256 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Checks FileListTransfer streaming a file many times larger than its chunks-in-flight window, over loopback.
+// The server sends the file with MappedFileReadInterface to two clients, one of which drops some of the datagrams it receives.
+// The resent parts of each chunk then arrive after later parts, so the split chunks must be put back together by part index.
+// Both clients must get the file intact, and the lossy client must have seen split parts out of order, or the test proves nothing.
+// Usage: FileListTransferWindowTest [fileSizeInKB] [chunksInFlight]
+
+#include "RakPeerInterface.h"
+#include "FileListTransfer.h"
+#include "FileListTransferCBInterface.h"
+#include "FileList.h"
+#include "MappedFileReadInterface.h"
+#include "PluginInterface2.h"
+#include "InternalPacket.h"
+#include "MessageIdentifiers.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+static const char *FILE_NAME = "FileListTransferWindowTest.bin";
+static const unsigned int CHUNK_SIZE = 64 * 1024;
+// The lossy client drops one in this many datagrams large enough to hold file data
+static const unsigned int DROP_EVERY = 50;
+
+static char *fileData;
+static unsigned int fileLength;
+static std::atomic<unsigned int> datagramsSeen, datagramsDropped;
+
+class FileCallback : public FileListTransferCBInterface
+{
+public:
+    FileCallback() {files=0; intact=0;}
+    virtual bool OnFile(OnFileStruct *onFileStruct)
+    {
+        files++;
+        if (onFileStruct->byteLengthOfThisFile==fileLength && onFileStruct->fileData && memcmp(onFileStruct->fileData, fileData, fileLength)==0)
+            intact++;
+        else
+            printf("%s arrived with %u bytes, differing from what was sent\n", onFileStruct->fileName, (unsigned int) onFileStruct->byteLengthOfThisFile);
+        return true;
+    }
+    virtual void OnFileProgress(FileProgressStruct *fps) {(void) fps;}
+    virtual bool OnDownloadComplete(DownloadCompleteStruct *dcs) {(void) dcs; return true;}
+
+    unsigned int files, intact;
+};
+
+// Counts parts of split messages whose index is lower than one already received for the same message
+class SplitOrderCounter : public PluginInterface2
+{
+public:
+    SplitOrderCounter() {outOfOrder.store(0); lastSplitPacketId=0; highestIndex=0;}
+    virtual bool UsesReliabilityLayer(void) const {return true;}
+    virtual void OnInternalPacket(InternalPacket *internalPacket, unsigned frameNumber, SystemAddress remoteSystemAddress, RakNet::TimeMS time, int isSend)
+    {
+        (void) frameNumber; (void) remoteSystemAddress; (void) time;
+        if (isSend || internalPacket->splitPacketCount==0)
+            return;
+        // Only the latest message is tracked, so resent parts arriving among the parts of the next message are not counted
+        if (internalPacket->splitPacketId!=lastSplitPacketId)
+        {
+            lastSplitPacketId=internalPacket->splitPacketId;
+            highestIndex=internalPacket->splitPacketIndex;
+        }
+        else if (internalPacket->splitPacketIndex < highestIndex)
+            outOfOrder.fetch_add(1);
+        else
+            highestIndex=internalPacket->splitPacketIndex;
+    }
+
+    std::atomic<unsigned int> outOfOrder;
+    SplitPacketIdType lastSplitPacketId;
+    SplitPacketIndexType highestIndex;
+};
+
+// Counts ID_FILE_LIST_REFERENCE_PUSH_ACK, one per chunk sent. Attached before FileListTransfer, which consumes them.
+class ChunkAckCounter : public PluginInterface2
+{
+public:
+    ChunkAckCounter() {acks=0; AddReceivedMessageID(ID_FILE_LIST_REFERENCE_PUSH_ACK);}
+    virtual PluginReceiveResult OnReceive(Packet *packet)
+    {
+        (void) packet;
+        acks++;
+        return RR_CONTINUE_PROCESSING;
+    }
+
+    unsigned int acks;
+};
+
+static bool DropSomeDatagrams(RNS2RecvStruct *recvStruct)
+{
+    if (recvStruct->bytesRead < 1000)
+        return true;
+    if (datagramsSeen.fetch_add(1) % DROP_EVERY!=DROP_EVERY-1)
+        return true;
+    datagramsDropped.fetch_add(1);
+    return false;
+}
+
+struct Client
+{
+    RakPeerInterface *peer;
+    FileListTransfer *fileListTransfer;
+    SplitOrderCounter splitOrderCounter;
+    FileCallback callback;
+    bool connected;
+};
+
+static void ReadAll(RakPeerInterface *server, Client *clients, int clientCount, int *connected)
+{
+    Packet *p;
+    for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+        ;
+    for (int i=0; i < clientCount; i++)
+    {
+        for (p=clients[i].peer->Receive(); p; clients[i].peer->DeallocatePacket(p), p=clients[i].peer->Receive())
+        {
+            if (p->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+                (*connected)++;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int fileSizeKB = argc > 1 ? atoi(argv[1]) : 4096;
+    unsigned int chunksInFlight = argc > 2 ? atoi(argv[2]) : 4;
+    fileLength = fileSizeKB * 1024 + 123;
+    if (fileSizeKB==0 || chunksInFlight==0 || fileLength <= chunksInFlight * CHUNK_SIZE)
+    {
+        printf("Usage: FileListTransferWindowTest [fileSizeInKB] [chunksInFlight]\n");
+        printf("The file must be larger than chunksInFlight times %u bytes\n", CHUNK_SIZE);
+        return 1;
+    }
+
+    fileData = (char*) malloc(fileLength);
+    for (unsigned int i=0; i < fileLength; i++)
+        fileData[i]=(char) ((i * 2654435761u) >> 13);
+    FILE *fp = fopen(FILE_NAME, "wb");
+    if (fp==0 || fwrite(fileData, 1, fileLength, fp)!=fileLength)
+    {
+        printf("Cannot write %s\n", FILE_NAME);
+        return 1;
+    }
+    fclose(fp);
+
+    RakPeerInterface *server = RakPeerInterface::GetInstance();
+    ChunkAckCounter ackCounter;
+    FileListTransfer *serverTransfer = FileListTransfer::GetInstance();
+    server->AttachPlugin(&ackCounter);
+    server->AttachPlugin(serverTransfer);
+    serverTransfer->SetMaxChunksInFlight(chunksInFlight);
+    SocketDescriptor serverSd(0,"127.0.0.1");
+    server->Startup(2, &serverSd, 1);
+    server->SetMaximumIncomingConnections(2);
+
+    const int clientCount=2;
+    Client clients[clientCount];
+    for (int i=0; i < clientCount; i++)
+    {
+        clients[i].peer = RakPeerInterface::GetInstance();
+        clients[i].fileListTransfer = FileListTransfer::GetInstance();
+        clients[i].peer->AttachPlugin(clients[i].fileListTransfer);
+        clients[i].peer->AttachPlugin(&clients[i].splitOrderCounter);
+        SocketDescriptor clientSd(0,"127.0.0.1");
+        clients[i].peer->Startup(1, &clientSd, 1);
+        clients[i].peer->Connect("127.0.0.1", server->GetMyBoundAddress().GetPort(), 0, 0);
+    }
+
+    int connected=0;
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 5000;
+    while (connected < clientCount && RakNet::GetTimeMS() < deadline)
+    {
+        ReadAll(server, clients, clientCount, &connected);
+        RakSleep(10);
+    }
+
+    bool ok = connected==clientCount;
+    if (ok==false)
+        printf("Failed to connect\n");
+    else
+    {
+        // Only once connected, so the handshake is not lost
+        clients[1].peer->SetIncomingDatagramEventHandler(DropSomeDatagrams);
+
+        MappedFileReadInterface mappedFileReadInterface;
+        FileList fileList;
+        fileList.AddFile(FILE_NAME, FILE_NAME, 0, fileLength, fileLength, FileListNodeContext(0,0,0,0), true);
+        for (int i=0; i < clientCount; i++)
+        {
+            unsigned short setId = clients[i].fileListTransfer->SetupReceive(&clients[i].callback, false, server->GetMyBoundAddress());
+            serverTransfer->Send(&fileList, 0, clients[i].peer->GetMyBoundAddress(), setId, HIGH_PRIORITY, 0, &mappedFileReadInterface, CHUNK_SIZE);
+        }
+
+        RakNet::TimeMS start = RakNet::GetTimeMS();
+        deadline = start + 60000;
+        while ((clients[0].callback.files==0 || clients[1].callback.files==0) && RakNet::GetTimeMS() < deadline)
+        {
+            ReadAll(server, clients, clientCount, &connected);
+            RakSleep(0);
+        }
+        RakNet::TimeMS elapsed = RakNet::GetTimeMS() - start;
+
+        for (int i=0; i < clientCount; i++)
+        {
+            bool clientOk = clients[i].callback.files==1 && clients[i].callback.intact==1;
+            printf("%-40s %s\n", i==0 ? "File intact" : "File intact with dropped datagrams", clientOk ? "Passed" : "FAILED");
+            ok = ok && clientOk;
+        }
+
+        // The file went as many chunks, each acknowledged
+        unsigned int chunks = (fileLength + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        bool chunksOk = ackCounter.acks >= (unsigned int) clientCount * (chunks - 1);
+        printf("%-40s %s, %u acknowledged for %u chunks per client\n", "Sent in chunks", chunksOk ? "Passed" : "FAILED", ackCounter.acks, chunks);
+
+        bool reorderedOk = datagramsDropped.load() > 0 && clients[1].splitOrderCounter.outOfOrder.load() > 0;
+        printf("%-40s %s, %u datagrams dropped, %u parts out of order\n", "Split parts out of order", reorderedOk ? "Passed" : "FAILED", datagramsDropped.load(), clients[1].splitOrderCounter.outOfOrder.load());
+
+        printf("%u bytes to each of %u clients with %u chunks of %u bytes in flight in %u ms\n", fileLength, clientCount, chunksInFlight, CHUNK_SIZE, elapsed);
+        ok = ok && chunksOk && reorderedOk;
+    }
+
+    for (int i=0; i < clientCount; i++)
+    {
+        clients[i].peer->Shutdown(0);
+        clients[i].peer->DetachPlugin(&clients[i].splitOrderCounter);
+        clients[i].peer->DetachPlugin(clients[i].fileListTransfer);
+        FileListTransfer::DestroyInstance(clients[i].fileListTransfer);
+        RakPeerInterface::DestroyInstance(clients[i].peer);
+    }
+    server->Shutdown(0);
+    server->DetachPlugin(serverTransfer);
+    server->DetachPlugin(&ackCounter);
+    FileListTransfer::DestroyInstance(serverTransfer);
+    RakPeerInterface::DestroyInstance(server);
+    remove(FILE_NAME);
+    free(fileData);
+
+    printf(ok ? "Passed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,352 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Tests HTTPConnection2 against a stand-in web server in this process, over loopback.
+// The server answers GET /length/<n>, /chunked/<n> and /close/<n> with a body of n bytes, sent with Content-Length, chunked, or until it closes the connection.
+// Requests are timed one at a time, one at a time with Connection: close so each has its own connection, and all at once to be pipelined.
+// Then the server writes each response in pieces of random length, so the client sees headers and chunks split across reads.
+// Small pieces wait for the acknowledgement of earlier ones, so they are not timed.
+// Last, the server closes the connection on any request for /drop/, which a GET sends again once and a POST does not.
+// Usage: HTTPConnection2Test [port] [requests]
+
+#include "HTTPConnection2.h"
+#include "TCPInterface.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include "DS_List.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+static const unsigned short MAX_SERVER_CONNECTIONS = 64;
+
+static char BodyByte(unsigned int length, unsigned int index)
+{
+    return (char) ('a' + (length * 7 + index) % 26);
+}
+
+// The stand-in web server
+struct TestServer
+{
+    TCPInterface *tcp;
+    // By systemIndex, the connection that last sent to it, and what it sent that is not a complete request yet
+    SystemAddress senders[MAX_SERVER_CONNECTIONS];
+    RakString received[MAX_SERVER_CONNECTIONS];
+    // Closed once their responses were sent, as the body of /close/ runs to the close. Later requests on them are not answered.
+    DataStructures::List<SystemAddress> closeWhenSent;
+    bool closing[MAX_SERVER_CONNECTIONS];
+    unsigned int connectionsAccepted;
+    // Requests for /drop/ received
+    unsigned int dropped;
+    bool splitResponses;
+
+    // Sends data in pieces of random length, if splitResponses
+    void SendInPieces(const SystemAddress &systemAddress, const char *data, unsigned int length)
+    {
+        while (length > 0)
+        {
+            unsigned int piece = 1 + (unsigned int) rand() % (rand() % 4 == 0 ? 8 : 2000);
+            if (piece > length || splitResponses == false)
+                piece = length;
+            tcp->Send(data, piece, systemAddress, false);
+            data += piece;
+            length -= piece;
+        }
+    }
+
+    void Respond(const SystemAddress &systemAddress, const char *request)
+    {
+        char method[16], path[256];
+        path[0] = 0;
+        sscanf(request, "%15s %255s", method, path);
+        if (strncmp(path, "/drop/", 6) == 0)
+        {
+            dropped++;
+            closing[systemAddress.systemIndex] = true;
+            tcp->CloseConnection(systemAddress);
+            return;
+        }
+        bool closeRequested = strstr(request, "Connection: close") != 0;
+
+        unsigned int length = 0;
+        const char *number = strrchr(path, '/');
+        if (number)
+            length = (unsigned int) atoi(number + 1);
+        char *body = new char[length + 1];
+        for (unsigned int i = 0; i < length; i++)
+            body[i] = BodyByte(length, i);
+        body[length] = 0;
+
+        RakString response;
+        if (strncmp(path, "/chunked/", 9) == 0)
+        {
+            response.Set("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n%s\r\n", closeRequested ? "Connection: close\r\n" : "");
+            unsigned int offset = 0;
+            while (offset < length)
+            {
+                unsigned int chunk = 1 + (unsigned int) rand() % 3000;
+                if (chunk > length - offset)
+                    chunk = length - offset;
+                // Some chunk sizes have an extension, which the client ignores
+                response += RakString("%x%s\r\n", chunk, rand() % 4 == 0 ? ";name=value" : "");
+                response.AppendBytes(body + offset, chunk);
+                response += "\r\n";
+                offset += chunk;
+            }
+            response += "0\r\nX-Trailer: 1\r\n\r\n";
+        }
+        else if (strncmp(path, "/close/", 7) == 0)
+        {
+            response.Set("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n");
+            response += body;
+            closeWhenSent.Push(systemAddress, _FILE_AND_LINE_);
+            closing[systemAddress.systemIndex] = true;
+        }
+        else
+        {
+            response.Set("HTTP/1.1 200 OK\r\nContent-Length: %u\r\n%s\r\n", length, closeRequested ? "Connection: close\r\n" : "");
+            response += body;
+        }
+        delete [] body;
+        SendInPieces(systemAddress, response.C_String(), (unsigned int) response.GetLength());
+    }
+
+    void Update(void)
+    {
+        while (tcp->HasNewIncomingConnection() != UNASSIGNED_SYSTEM_ADDRESS)
+            connectionsAccepted++;
+        while (tcp->HasLostConnection() != UNASSIGNED_SYSTEM_ADDRESS)
+            ;
+
+        Packet *p;
+        while ((p = tcp->Receive()) != 0)
+        {
+            // Data of a closed connection comes before that of the next connection in its slot, which has another port
+            SystemIndex index = p->systemAddress.systemIndex;
+            if (senders[index] != p->systemAddress)
+            {
+                senders[index] = p->systemAddress;
+                received[index].Clear();
+                closing[index] = false;
+            }
+            RakString &buffer = received[index];
+            buffer.AppendBytes((const char *) p->data, p->length);
+            // Answer each complete request, in order, as a pipelining server must
+            const char *end;
+            while ((end = strstr(buffer.C_String(), "\r\n\r\n")) != 0)
+            {
+                size_t requestLength = end + 4 - buffer.C_String();
+                RakString request = buffer.SubStr(0, (unsigned int) requestLength);
+                buffer = buffer.SubStr((unsigned int) requestLength, (unsigned int) (buffer.GetLength() - requestLength));
+                if (closing[index] == false)
+                    Respond(p->systemAddress, request.C_String());
+            }
+            tcp->DeallocatePacket(p);
+        }
+
+        for (unsigned int i = 0; i < closeWhenSent.Size(); )
+        {
+            if (tcp->GetOutgoingDataBufferSize(closeWhenSent[i]) == 0)
+            {
+                tcp->CloseConnection(closeWhenSent[i]);
+                closeWhenSent.RemoveAtIndexFast(i);
+            }
+            else
+                i++;
+        }
+    }
+};
+
+static TestServer server;
+static TCPInterface *clientTcp;
+static HTTPConnection2 *httpConnection2;
+
+static void UpdateClient(void)
+{
+    // For TCP plugins, do HasCompletedConnectionAttempt, then Receive(), then HasFailedConnectionAttempt(), HasLostConnection()
+    clientTcp->HasCompletedConnectionAttempt();
+    Packet *packet;
+    for (packet = clientTcp->Receive(); packet; clientTcp->DeallocatePacket(packet), packet = clientTcp->Receive())
+        ;
+    clientTcp->HasFailedConnectionAttempt();
+    clientTcp->HasLostConnection();
+}
+
+// Reads the responses, and checks the body of each against its path
+// \return How many were right
+static unsigned int ReadResponses(unsigned int *responseCount)
+{
+    unsigned int valid = 0;
+    RakString stringTransmitted, hostTransmitted, responseReceived;
+    SystemAddress hostReceived;
+    int contentOffset;
+    while (httpConnection2->GetResponse(stringTransmitted, hostTransmitted, responseReceived, hostReceived, contentOffset))
+    {
+        (*responseCount)++;
+        const char *pathEnd = strstr(stringTransmitted.C_String(), " HTTP/1.1");
+        const char *number = pathEnd ? pathEnd - 1 : 0;
+        while (number && number > stringTransmitted.C_String() && number[-1] != '/')
+            number--;
+        unsigned int length = number ? (unsigned int) atoi(number) : 0;
+        const char *body = contentOffset >= 0 ? responseReceived.C_String() + contentOffset : "";
+        bool ok = strncmp(responseReceived.C_String(), "HTTP/1.1 200", 12) == 0 && strlen(body) == length;
+        for (unsigned int i = 0; ok && i < length; i++)
+            ok = body[i] == BodyByte(length, i);
+        if (ok)
+            valid++;
+        else
+            printf("Wrong response to %.*s\n", pathEnd ? (int) (pathEnd - stringTransmitted.C_String()) : 0, stringTransmitted.C_String());
+    }
+    return valid;
+}
+
+// Transmits requests for the paths, waiting for each response first if oneAtATime
+// \return true if all responses were right
+static bool RunTest(const char *name, unsigned short port, const char **paths, unsigned int pathCount, unsigned int requests, bool oneAtATime, const char *extraHeaders)
+{
+    char host[32];
+    sprintf(host, "127.0.0.1:%i", port);
+    unsigned int connectionsBefore = server.connectionsAccepted;
+    unsigned int transmitted = 0, responses = 0, valid = 0;
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    while (responses < requests && RakNet::GetTimeUS() - start < 60000000)
+    {
+        while (transmitted < requests && (oneAtATime == false || transmitted == responses))
+        {
+            RakString uri("%s%s", host, paths[transmitted % pathCount]);
+            httpConnection2->TransmitRequest(RakString::FormatForGET(uri.C_String(), extraHeaders), "127.0.0.1", port);
+            transmitted++;
+        }
+        server.Update();
+        UpdateClient();
+        valid += ReadResponses(&responses);
+        RakSleep(0);
+    }
+    double seconds = (double) (RakNet::GetTimeUS() - start) / 1000000.0;
+    printf("%s: %u/%u right in %.2f s, %.0f requests/s, %u connections\n", name, valid, requests, seconds, (double) responses / seconds,
+        server.connectionsAccepted - connectionsBefore);
+    return valid == requests;
+}
+
+// Transmits requests to a port nothing listens on
+// \return true if all of them completed, with no response
+static bool RunRefusedTest(unsigned short port, unsigned int requests)
+{
+    char host[32];
+    sprintf(host, "127.0.0.1:%i", port);
+    for (unsigned int i = 0; i < requests; i++)
+        httpConnection2->TransmitRequest(RakString::FormatForGET(RakString("%s/length/100", host).C_String()), "127.0.0.1", port);
+
+    unsigned int responses = 0, empty = 0;
+    RakString stringTransmitted, hostTransmitted, responseReceived;
+    SystemAddress hostReceived;
+    int contentOffset;
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    while (responses < requests && RakNet::GetTimeUS() - start < 60000000)
+    {
+        UpdateClient();
+        while (httpConnection2->GetResponse(stringTransmitted, hostTransmitted, responseReceived, hostReceived, contentOffset))
+        {
+            responses++;
+            if (responseReceived.IsEmpty())
+                empty++;
+        }
+        RakSleep(0);
+    }
+    printf("Connection refused: %u/%u failed in %.2f s\n", empty, requests, (double) (RakNet::GetTimeUS() - start) / 1000000.0);
+    return empty == requests;
+}
+
+// Transmits requests that the server closes the connection on, with no response
+// \return true if all of them failed, having been sent timesSent times each
+static bool RunDroppedTest(unsigned short port, bool post, unsigned int requests, unsigned int timesSent)
+{
+    char uri[64];
+    sprintf(uri, "127.0.0.1:%i/drop/1", port);
+    unsigned int droppedBefore = server.dropped;
+    for (unsigned int i = 0; i < requests; i++)
+        httpConnection2->TransmitRequest(post ? RakString::FormatForPOST(uri, "text/plain", "") : RakString::FormatForGET(uri), "127.0.0.1", port);
+
+    unsigned int responses = 0, empty = 0;
+    RakString stringTransmitted, hostTransmitted, responseReceived;
+    SystemAddress hostReceived;
+    int contentOffset;
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    while (responses < requests && RakNet::GetTimeUS() - start < 60000000)
+    {
+        server.Update();
+        UpdateClient();
+        while (httpConnection2->GetResponse(stringTransmitted, hostTransmitted, responseReceived, hostReceived, contentOffset))
+        {
+            responses++;
+            if (responseReceived.IsEmpty())
+                empty++;
+        }
+        RakSleep(0);
+    }
+    // Anything sent too often would arrive after the responses
+    for (int i = 0; i < 100; i++)
+    {
+        server.Update();
+        UpdateClient();
+        RakSleep(1);
+    }
+    printf("%s dropped by the server: %u/%u failed, received %u times\n", post ? "POST" : "GET", empty, requests, server.dropped - droppedBefore);
+    return empty == requests && server.dropped - droppedBefore == requests * timesSent;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned short port = (unsigned short) (argc > 1 ? atoi(argv[1]) : 61400);
+    unsigned int requests = argc > 2 ? (unsigned int) atoi(argv[2]) : 1000;
+
+    server.tcp = TCPInterface::GetInstance();
+    server.connectionsAccepted = 0;
+    server.dropped = 0;
+    server.splitResponses = false;
+    clientTcp = TCPInterface::GetInstance();
+    if (server.tcp->Start(port, MAX_SERVER_CONNECTIONS) == false || clientTcp->Start(0, 64) == false)
+    {
+        printf("Failed to start on port %i\n", port);
+        return 1;
+    }
+    httpConnection2 = HTTPConnection2::GetInstance();
+    clientTcp->AttachPlugin(httpConnection2);
+
+    const char *mixedPaths[] = {"/length/100", "/chunked/5000", "/length/0", "/chunked/1", "/length/70000", "/chunked/0", "/length/1000"};
+    const unsigned int mixedPathCount = sizeof(mixedPaths) / sizeof(mixedPaths[0]);
+    const char *smallPaths[] = {"/length/100"};
+    const char *closePaths[] = {"/close/3000"};
+
+    bool valid = RunTest("One at a time, connection per request", port, smallPaths, 1, requests, true, "Connection: close");
+    valid = RunTest("One at a time, kept alive", port, smallPaths, 1, requests, true, "") && valid;
+    valid = RunTest("All at once, kept alive", port, smallPaths, 1, requests, false, "") && valid;
+
+    server.splitResponses = true;
+    valid = RunTest("Split responses, mixed bodies", port, mixedPaths, mixedPathCount, requests, false, "") && valid;
+    valid = RunTest("Split responses, body until close", port, closePaths, 1, requests / 10 + 1, false, "") && valid;
+    httpConnection2->SetMaxPipelinedRequests(1);
+    valid = RunTest("Split responses, not pipelined", port, mixedPaths, mixedPathCount, requests, false, "") && valid;
+    valid = RunRefusedTest(port + 1, requests / 10 + 1) && valid;
+    httpConnection2->SetMaxPipelinedRequests(4);
+    valid = RunDroppedTest(port, false, requests / 10 + 1, 2) && valid;
+    valid = RunDroppedTest(port, true, requests / 10 + 1, 1) && valid;
+
+    clientTcp->Stop();
+    server.tcp->Stop();
+    clientTcp->DetachPlugin(httpConnection2);
+    HTTPConnection2::DestroyInstance(httpConnection2);
+    TCPInterface::DestroyInstance(clientTcp);
+    TCPInterface::DestroyInstance(server.tcp);
+    printf(valid ? "Passed\n" : "FAILED\n");
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Measures how much a burst of secure connection attempts delays a secure server's established connections, over loopback.
+// A probe client that is already connected sends a timestamp every few milliseconds, which the server echoes.
+// Then many sockets, each a different address to the server, send ID_OPEN_CONNECTION_REQUEST_2 with a handshake challenge at once,
+// like clients reconnecting after a server restart. Their cookies and challenges are made beforehand, so the server gets the whole burst together.
+// Reports the probe round trip before and during the burst, how long the server took to answer every challenge, and its handshake statistics.
+// Build the library and this sample with LIBCAT_SECURITY defined.
+// Usage: HandshakeBurstTest [clients]
+
+#include "RakPeerInterface.h"
+#include "MessageIdentifiers.h"
+#include "BitStream.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include "RakNetStatistics.h"
+#include "RakNetVersion.h"
+#include "DS_List.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef LIBCAT_SECURITY
+#include "SecureHandshake.h"
+#endif
+
+#ifdef _WIN32
+#include "WindowsIncludes.h"
+typedef int socklen_t;
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define closesocket close
+typedef int SOCKET;
+#endif
+
+using namespace RakNet;
+
+// Same as in RakPeer.cpp
+static const unsigned char OFFLINE_MESSAGE_DATA_ID[16] = {
+    0x00, 0xFF, 0xFF, 0x00, 0xFE, 0xFE, 0xFE, 0xFE, 0xFD, 0xFD, 0xFD, 0xFD, 0x12, 0x34, 0x56, 0x78
+};
+
+// How often the probe sends a timestamp
+static const RakNet::TimeMS PROBE_INTERVAL_MS = 5;
+
+static const uint16_t MTU = 576;
+
+static int CompareTimeUS(const void *a, const void *b)
+{
+    RakNet::TimeUS x = *(const RakNet::TimeUS *) a, y = *(const RakNet::TimeUS *) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void PrintRoundTrips(const char *label, DataStructures::List<RakNet::TimeUS> &roundTrips)
+{
+    unsigned int n = roundTrips.Size();
+    if (n == 0)
+    {
+        printf("%-14s no round trips\n", label);
+        return;
+    }
+    qsort(&roundTrips[0], n, sizeof(RakNet::TimeUS), CompareTimeUS);
+    printf("%-14s %6u round trips, ms: p50 %8.2f, p99 %8.2f, max %8.2f\n", label, n,
+           roundTrips[n / 2] / 1000.0, roundTrips[n * 99 / 100] / 1000.0, roundTrips[n - 1] / 1000.0);
+}
+
+static void SetNonBlocking(SOCKET s)
+{
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+#ifdef LIBCAT_SECURITY
+// Echoes for the server, and collects the probe's round trips
+static void Pump(RakPeerInterface *server, RakPeerInterface *probe, SystemAddress serverAddress,
+                 DataStructures::List<RakNet::TimeUS> &roundTrips, RakNet::TimeMS *nextProbe)
+{
+    Packet *p;
+    for (p = server->Receive(); p; server->DeallocatePacket(p), p = server->Receive())
+    {
+        if (p->data[0] == ID_USER_PACKET_ENUM)
+            server->Send((const char *) p->data, p->length, HIGH_PRIORITY, RELIABLE, 0, p->systemAddress, false);
+    }
+    for (p = probe->Receive(); p; probe->DeallocatePacket(p), p = probe->Receive())
+    {
+        if (p->data[0] != ID_USER_PACKET_ENUM)
+            continue;
+        RakNet::BitStream bs(p->data, p->length, false);
+        bs.IgnoreBytes(sizeof(MessageID));
+        RakNet::TimeUS sent;
+        bs.Read(sent);
+        roundTrips.Push(RakNet::GetTimeUS() - sent, _FILE_AND_LINE_);
+    }
+    RakNet::TimeMS time = RakNet::GetTimeMS();
+    if (time >= *nextProbe)
+    {
+        RakNet::BitStream bs;
+        bs.Write((MessageID) ID_USER_PACKET_ENUM);
+        bs.Write(RakNet::GetTimeUS());
+        probe->Send(&bs, HIGH_PRIORITY, RELIABLE, 0, serverAddress, false);
+        *nextProbe = time + PROBE_INTERVAL_MS;
+    }
+}
+
+// Does what a client does up to ID_OPEN_CONNECTION_REQUEST_2, over a plain socket, and returns that request without sending it
+static bool PrepareRequest2(SOCKET s, sockaddr_in &server, SystemAddress serverAddress, cat::ClientEasyHandshake &handshake,
+                            RakNet::BitStream &request2)
+{
+    RakNet::BitStream request1;
+    request1.Write((MessageID) ID_OPEN_CONNECTION_REQUEST_1);
+    request1.WriteAlignedBytes(OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID));
+    request1.Write((MessageID) RAKNET_PROTOCOL_VERSION);
+    request1.PadWithZeroToByteLength(MTU - 28);
+
+    char reply[MAXIMUM_MTU_SIZE];
+    for (int attempt = 0; attempt < 20; attempt++)
+    {
+        sendto(s, (const char *) request1.GetData(), request1.GetNumberOfBytesUsed(), 0, (sockaddr *) &server, sizeof(server));
+        RakNet::TimeMS deadline = RakNet::GetTimeMS() + 100;
+        while (RakNet::GetTimeMS() < deadline)
+        {
+            int bytes = recvfrom(s, reply, sizeof(reply), 0, 0, 0);
+            if (bytes <= 0 || (unsigned char) reply[0] != ID_OPEN_CONNECTION_REPLY_1)
+            {
+                RakSleep(0);
+                continue;
+            }
+
+            RakNet::BitStream bs((unsigned char *) reply, bytes, false);
+            bs.IgnoreBytes(sizeof(MessageID) + sizeof(OFFLINE_MESSAGE_DATA_ID));
+            RakNetGUID serverGuid;
+            uint32_t connectionCookie, cookie;
+            unsigned char serverHasSecurity = 0;
+            bs.Read(serverGuid);
+            bs.Read(connectionCookie);
+            bs.Read(serverHasSecurity);
+            if (serverHasSecurity == 0)
+                return false;
+            bs.Read(cookie);
+
+            unsigned char challenge[cat::EasyHandshake::CHALLENGE_BYTES];
+            if (handshake.GenerateChallenge(challenge) == false)
+                return false;
+            request2.Write((MessageID) ID_OPEN_CONNECTION_REQUEST_2);
+            request2.WriteAlignedBytes(OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID));
+            request2.Write(connectionCookie);
+            request2.Write(cookie);
+            request2.Write((unsigned char) 1);
+            request2.WriteAlignedBytes(challenge, sizeof(challenge));
+            request2.Write(serverAddress);
+            request2.Write(MTU);
+            request2.Write(RakNetGUID(((uint64_t) rand() << 32) ^ ((uint64_t) rand() << 16) ^ (uint64_t) rand()));
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    int numClients = argc > 1 ? atoi(argv[1]) : 2000;
+    if (numClients < 1)
+    {
+        printf("Usage: HandshakeBurstTest [clients]\n");
+        return 1;
+    }
+#ifdef LIBCAT_SECURITY
+#ifdef _WIN32
+    WSADATA winsockInfo;
+    WSAStartup(MAKEWORD(2, 2), &winsockInfo);
+#endif
+    char publicKey[cat::EasyHandshake::PUBLIC_KEY_BYTES];
+    char privateKey[cat::EasyHandshake::PRIVATE_KEY_BYTES];
+    cat::EasyHandshake keyGenerator;
+    keyGenerator.GenerateServerKey(publicKey, privateKey);
+
+    RakPeerInterface *server = RakPeerInterface::GetInstance();
+    server->InitializeSecurity(publicKey, privateKey, false);
+    SocketDescriptor serverSd(0, "127.0.0.1");
+    server->Startup(numClients + 1, &serverSd, 1);
+    server->SetMaximumIncomingConnections((unsigned short) (numClients + 1));
+    unsigned short serverPort = server->GetMyBoundAddress().GetPort();
+    SystemAddress serverAddress("127.0.0.1", serverPort);
+
+    RakPeerInterface *probe = RakPeerInterface::GetInstance();
+    SocketDescriptor probeSd(0, "127.0.0.1");
+    probe->Startup(1, &probeSd, 1);
+    PublicKey pk;
+    pk.remoteServerPublicKey = publicKey;
+    pk.publicKeyMode = PKM_USE_KNOWN_PUBLIC_KEY;
+    probe->Connect("127.0.0.1", serverPort, 0, 0, &pk);
+    Packet *p;
+    bool probeConnected = false;
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 10000;
+    while (probeConnected == false && RakNet::GetTimeMS() < deadline)
+    {
+        for (p = server->Receive(); p; server->DeallocatePacket(p), p = server->Receive())
+            ;
+        for (p = probe->Receive(); p; probe->DeallocatePacket(p), p = probe->Receive())
+        {
+            if (p->data[0] == ID_CONNECTION_REQUEST_ACCEPTED)
+                probeConnected = true;
+        }
+        RakSleep(1);
+    }
+    if (probeConnected == false)
+    {
+        printf("Probe failed to connect\n");
+        return 1;
+    }
+
+    // Make every client's cookies and challenge
+    sockaddr_in serverSockAddr;
+    memset(&serverSockAddr, 0, sizeof(serverSockAddr));
+    serverSockAddr.sin_family = AF_INET;
+    serverSockAddr.sin_port = htons(serverPort);
+    serverSockAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    cat::ClientEasyHandshake clientHandshake;
+    clientHandshake.Initialize(publicKey);
+    SOCKET *sockets = new SOCKET[numClients];
+    RakNet::BitStream *requests = new RakNet::BitStream[numClients];
+    int numPrepared = 0;
+    DataStructures::List<RakNet::TimeUS> roundTrips;
+    RakNet::TimeMS nextProbe = 0;
+    int i;
+    for (i = 0; i < numClients; i++)
+    {
+        sockets[numPrepared] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = inet_addr("127.0.0.1");
+        bind(sockets[numPrepared], (sockaddr *) &local, sizeof(local));
+        SetNonBlocking(sockets[numPrepared]);
+        if (PrepareRequest2(sockets[numPrepared], serverSockAddr, serverAddress, clientHandshake, requests[numPrepared]))
+            numPrepared++;
+        else
+            closesocket(sockets[numPrepared]);
+        Pump(server, probe, serverAddress, roundTrips, &nextProbe);
+    }
+
+    // Round trips with nothing else going on
+    roundTrips.Clear(false, _FILE_AND_LINE_);
+    RakNet::TimeMS end = RakNet::GetTimeMS() + 1000;
+    while (RakNet::GetTimeMS() < end)
+    {
+        Pump(server, probe, serverAddress, roundTrips, &nextProbe);
+        RakSleep(0);
+    }
+    printf("%i of %i clients send a challenge at once\n", numPrepared, numClients);
+    PrintRoundTrips("Before burst", roundTrips);
+    roundTrips.Clear(false, _FILE_AND_LINE_);
+
+    // Yield now and then, so the server's receive thread keeps up and the socket buffer does not overflow
+    RakNet::TimeUS burstStart = RakNet::GetTimeUS();
+    for (i = 0; i < numPrepared; i++)
+    {
+        sendto(sockets[i], (const char *) requests[i].GetData(), requests[i].GetNumberOfBytesUsed(), 0,
+               (sockaddr *) &serverSockAddr, sizeof(serverSockAddr));
+        if ((i % 64) == 63)
+            RakSleep(0);
+    }
+
+    // Until every client has its answer
+    bool *answered = new bool[numPrepared];
+    memset(answered, 0, numPrepared * sizeof(bool));
+    int numAnswered = 0;
+    RakNet::TimeUS lastAnswer = burstStart;
+    deadline = RakNet::GetTimeMS() + 60000;
+    char reply[MAXIMUM_MTU_SIZE];
+    while (numAnswered < numPrepared && RakNet::GetTimeMS() < deadline)
+    {
+        Pump(server, probe, serverAddress, roundTrips, &nextProbe);
+        for (i = 0; i < numPrepared; i++)
+        {
+            int bytes;
+            while ((bytes = recvfrom(sockets[i], reply, sizeof(reply), 0, 0, 0)) > 0)
+            {
+                if ((unsigned char) reply[0] == ID_OPEN_CONNECTION_REPLY_2 && answered[i] == false)
+                {
+                    answered[i] = true;
+                    numAnswered++;
+                    lastAnswer = RakNet::GetTimeUS();
+                }
+            }
+        }
+        // The clients would be on other computers, so leave the processors to the server
+        RakSleep(1);
+    }
+    // Probes held up by the burst come back after it
+    end = RakNet::GetTimeMS() + 500;
+    while (RakNet::GetTimeMS() < end)
+    {
+        Pump(server, probe, serverAddress, roundTrips, &nextProbe);
+        RakSleep(0);
+    }
+    PrintRoundTrips("During burst", roundTrips);
+    printf("%i answered, the last after %.2f seconds\n", numAnswered, (double) (lastAnswer - burstStart) / 1000000.0);
+
+    HandshakeStatistics handshakeStats;
+    server->GetHandshakeStatistics(&handshakeStats);
+    printf("Server handshakes: %llu answered, %llu rejected, %llu discarded, %u queued\n",
+           (unsigned long long) handshakeStats.answered, (unsigned long long) handshakeStats.rejected,
+           (unsigned long long) handshakeStats.discarded, handshakeStats.queued);
+    printf("Server handshake latency ms, over the last %u: p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n", handshakeStats.latencySamples,
+           handshakeStats.latencyPercentile50 / 1000.0, handshakeStats.latencyPercentile90 / 1000.0,
+           handshakeStats.latencyPercentile99 / 1000.0, handshakeStats.latencyMax / 1000.0);
+
+    for (i = 0; i < numPrepared; i++)
+        closesocket(sockets[i]);
+    delete [] sockets;
+    delete [] requests;
+    delete [] answered;
+    probe->Shutdown(0);
+    RakPeerInterface::DestroyInstance(probe);
+    server->Shutdown(0);
+    RakPeerInterface::DestroyInstance(server);
+    return numAnswered == numPrepared ? 0 : 1;
+#else
+    printf("Requires LIBCAT_SECURITY\n");
+    return 1;
+#endif
+}
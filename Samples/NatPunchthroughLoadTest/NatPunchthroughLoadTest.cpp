@@ -0,0 +1,311 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Load generator for NatPunchthroughServer. Starts one server and many NatPunchthroughClient instances in this process,
+// all over loopback. Half of the clients repeatedly punch through to a partner in the other half.
+// Reports punchthrough latency, results, and how much time the server spent processing.
+// Each client is a separate RakPeer with its own threads and socket, so the client count is bounded by the process limits.
+// With "direct", there are no clients. Users connect, request punchthroughs, and disconnect by calling the server plugin's callbacks, so it can hold hundreds of thousands of users.
+// Usage: NatPunchthroughLoadTest [clients] [roundsPerPair] [idleClients]
+//        NatPunchthroughLoadTest direct [users]
+
+#include "RakPeerInterface.h"
+#include "NatPunchthroughServer.h"
+#include "NatPunchthroughClient.h"
+#include "MessageIdentifiers.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include "DS_List.h"
+#include "BitStream.h"
+#include "Rand.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+struct Client
+{
+    RakPeerInterface *peer;
+    NatPunchthroughClient *natPunchthroughClient;
+    bool connected;
+    // Only used by senders
+    int partner;
+    int roundsLeft;
+    RakNet::TimeUS requestTime;
+};
+
+static int CompareDouble(const void *a, const void *b)
+{
+    double d = *(const double*) a - *(const double*) b;
+    return d < 0 ? -1 : (d > 0 ? 1 : 0);
+}
+
+static int CountResult(unsigned char messageId, int *succeeded, int *failed)
+{
+    switch (messageId)
+    {
+    case ID_NAT_PUNCHTHROUGH_SUCCEEDED:
+        (*succeeded)++;
+        return 1;
+    case ID_NAT_PUNCHTHROUGH_FAILED:
+    case ID_NAT_TARGET_NOT_CONNECTED:
+    case ID_NAT_TARGET_UNRESPONSIVE:
+    case ID_NAT_CONNECTION_TO_TARGET_LOST:
+    case ID_NAT_ALREADY_IN_PROGRESS:
+        (*failed)++;
+        return 1;
+    }
+    return 0;
+}
+
+// NatPunchthroughServer::Update() does nothing until this long after its last update
+static const RakNet::TimeMS UPDATE_INTERVAL_MS = 260;
+
+static void ReceiveOnServer(NatPunchthroughServer *natPunchthroughServer, RakNetGUID sender, const SystemAddress &address, RakNet::BitStream *bs)
+{
+    Packet p;
+    p.data = bs->GetData();
+    p.length = bs->GetNumberOfBytesUsed();
+    p.bitSize = bs->GetNumberOfBitsUsed();
+    p.guid = sender;
+    p.systemAddress = address;
+    natPunchthroughServer->OnReceive(&p);
+}
+
+// Users that are not really there. Messages the server sends them are dropped, so every attempt times out.
+static int RunDirect(int numUsers)
+{
+    RakPeerInterface *server = RakPeerInterface::GetInstance();
+    NatPunchthroughServer *natPunchthroughServer = NatPunchthroughServer::GetInstance();
+    server->AttachPlugin(natPunchthroughServer);
+    SocketDescriptor serverSd(0,"127.0.0.1");
+    if (server->Startup(4, &serverSd, 1)!=RAKNET_STARTED)
+    {
+        printf("Server failed to start\n");
+        return 1;
+    }
+
+    RakNetGUID *guids = new RakNetGUID[numUsers];
+    SystemAddress address("127.0.0.1", 9);
+    seedMT(1);
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    int i;
+    for (i=0; i < numUsers; i++)
+    {
+        guids[i].g = ((uint64_t) randomMT() << 32) | randomMT();
+        natPunchthroughServer->OnNewConnection(address, guids[i], true);
+    }
+    printf("%i users connected in %.1f ms\n", numUsers, (double) (RakNet::GetTimeUS()-start) / 1000.0);
+
+    // Each pair asks twice, once from each side. The second one finds the first in progress.
+    start = RakNet::GetTimeUS();
+    for (i=0; i+1 < numUsers; i+=2)
+    {
+        RakNet::BitStream bs;
+        bs.Write((MessageID) ID_NAT_PUNCHTHROUGH_REQUEST);
+        bs.Write(guids[i+1]);
+        ReceiveOnServer(natPunchthroughServer, guids[i], address, &bs);
+        bs.Reset();
+        bs.Write((MessageID) ID_NAT_PUNCHTHROUGH_REQUEST);
+        bs.Write(guids[i]);
+        ReceiveOnServer(natPunchthroughServer, guids[i+1], address, &bs);
+    }
+    printf("%i punchthrough requests in %.1f ms\n", numUsers & ~1, (double) (RakNet::GetTimeUS()-start) / 1000.0);
+
+    RakNet::TimeUS updateTime = 0;
+    const int updates = 10;
+    for (i=0; i < updates; i++)
+    {
+        RakSleep(UPDATE_INTERVAL_MS);
+        start = RakNet::GetTimeUS();
+        natPunchthroughServer->Update();
+        updateTime += RakNet::GetTimeUS()-start;
+    }
+    printf("Update() with every attempt waiting: %.3f ms per call\n", (double) updateTime / 1000.0 / updates);
+
+    RakSleep(10000 + UPDATE_INTERVAL_MS);
+    start = RakNet::GetTimeUS();
+    natPunchthroughServer->Update();
+    printf("Update() with every attempt timing out: %.1f ms\n", (double) (RakNet::GetTimeUS()-start) / 1000.0);
+
+    start = RakNet::GetTimeUS();
+    for (i=numUsers-1; i >= 0; i--)
+        natPunchthroughServer->OnClosedConnection(address, guids[i], LCR_DISCONNECTION_NOTIFICATION);
+    printf("%i users disconnected in %.1f ms\n", numUsers, (double) (RakNet::GetTimeUS()-start) / 1000.0);
+
+    delete [] guids;
+    server->Shutdown(0);
+    RakPeerInterface::DestroyInstance(server);
+    NatPunchthroughServer::DestroyInstance(natPunchthroughServer);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "direct")==0)
+    {
+        int numUsers = argc > 2 ? atoi(argv[2]) : 300000;
+        if (numUsers < 2)
+        {
+            printf("Usage: NatPunchthroughLoadTest direct [users]\n");
+            return 1;
+        }
+        return RunDirect(numUsers);
+    }
+
+    int numActive = argc > 1 ? atoi(argv[1]) : 200;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    int numIdle = argc > 3 ? atoi(argv[3]) : 0;
+    numActive &= ~1;
+    if (numActive < 2 || rounds < 1 || numIdle < 0)
+    {
+        printf("Usage: NatPunchthroughLoadTest [clients] [roundsPerPair] [idleClients]\n");
+        return 1;
+    }
+    int numClients = numActive + numIdle;
+    int numPairs = numActive / 2;
+
+    RakPeerInterface *server = RakPeerInterface::GetInstance();
+    NatPunchthroughServer *natPunchthroughServer = NatPunchthroughServer::GetInstance();
+    server->AttachPlugin(natPunchthroughServer);
+    SocketDescriptor serverSd(0,"127.0.0.1");
+    if (server->Startup(numClients, &serverSd, 1)!=RAKNET_STARTED)
+    {
+        printf("Server failed to start\n");
+        return 1;
+    }
+    server->SetMaximumIncomingConnections(numClients);
+    unsigned short serverPort = server->GetMyBoundAddress().GetPort();
+    SystemAddress serverAddress("127.0.0.1", serverPort);
+
+    // Idle clients only add users to the server. Active clients come first, senders then recipients.
+    Client *clients = new Client[numClients];
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    int i;
+    for (i=0; i < numClients; i++)
+    {
+        Client &c = clients[i];
+        c.peer = RakPeerInterface::GetInstance();
+        c.natPunchthroughClient = NatPunchthroughClient::GetInstance();
+        c.peer->AttachPlugin(c.natPunchthroughClient);
+        c.connected=false;
+        c.partner = i < numPairs ? i + numPairs : -1;
+        c.roundsLeft = rounds;
+        c.requestTime = 0;
+        SocketDescriptor sd(0,"127.0.0.1");
+        if (c.peer->Startup(2, &sd, 1)!=RAKNET_STARTED)
+        {
+            printf("Client %i failed to start\n", i);
+            return 1;
+        }
+        c.peer->SetMaximumIncomingConnections(1);
+        c.peer->Connect("127.0.0.1", serverPort, 0, 0);
+    }
+
+    RakNet::TimeUS serverTime = 0;
+    Packet *p;
+    int connectedCount = 0;
+    RakNet::TimeUS deadline = RakNet::GetTimeUS() + 60000000;
+    while (connectedCount < numClients && RakNet::GetTimeUS() < deadline)
+    {
+        RakNet::TimeUS serverStart = RakNet::GetTimeUS();
+        for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+            ;
+        serverTime += RakNet::GetTimeUS() - serverStart;
+        for (i=0; i < numClients; i++)
+        {
+            for (p=clients[i].peer->Receive(); p; clients[i].peer->DeallocatePacket(p), p=clients[i].peer->Receive())
+            {
+                if (p->data[0]==ID_CONNECTION_REQUEST_ACCEPTED && clients[i].connected==false)
+                {
+                    clients[i].connected=true;
+                    connectedCount++;
+                }
+            }
+        }
+        RakSleep(0);
+    }
+    printf("%i of %i clients connected in %.2f seconds\n", connectedCount, numClients, (double) (RakNet::GetTimeUS()-start) / 1000000.0);
+    if (connectedCount < numClients)
+        return 1;
+
+    DataStructures::List<double> latencies;
+    int succeeded=0, failed=0, completedPairs=0;
+    serverTime=0;
+    start = RakNet::GetTimeUS();
+    for (i=0; i < numPairs; i++)
+    {
+        clients[i].requestTime = RakNet::GetTimeUS();
+        clients[i].natPunchthroughClient->OpenNAT(clients[clients[i].partner].peer->GetMyGUID(), serverAddress);
+    }
+
+    deadline = RakNet::GetTimeUS() + 120000000;
+    RakNet::TimeUS maxServerReceive = 0;
+    while (completedPairs < numPairs && RakNet::GetTimeUS() < deadline)
+    {
+        RakNet::TimeUS serverStart = RakNet::GetTimeUS();
+        for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+            ;
+        RakNet::TimeUS elapsed = RakNet::GetTimeUS() - serverStart;
+        serverTime += elapsed;
+        if (elapsed > maxServerReceive)
+            maxServerReceive = elapsed;
+
+        for (i=0; i < numClients; i++)
+        {
+            Client &c = clients[i];
+            for (p=c.peer->Receive(); p; c.peer->DeallocatePacket(p), p=c.peer->Receive())
+            {
+                // Recipients also get results, only count them once, on the sender
+                if (c.partner==-1 || c.roundsLeft==0)
+                    continue;
+                if (CountResult(p->data[0], &succeeded, &failed)==0)
+                    continue;
+                latencies.Push((double) (RakNet::GetTimeUS() - c.requestTime) / 1000.0, _FILE_AND_LINE_);
+                if (--c.roundsLeft==0)
+                {
+                    completedPairs++;
+                }
+                else
+                {
+                    c.requestTime = RakNet::GetTimeUS();
+                    c.natPunchthroughClient->OpenNAT(clients[c.partner].peer->GetMyGUID(), serverAddress);
+                }
+            }
+        }
+        RakSleep(0);
+    }
+    double seconds = (double) (RakNet::GetTimeUS()-start) / 1000000.0;
+
+    printf("%i users, %i pairs, %i rounds per pair\n", numClients, numPairs, rounds);
+    printf("%i succeeded, %i failed, %i pairs did not finish, in %.2f seconds (%.1f punchthroughs/sec)\n",
+        succeeded, failed, numPairs-completedPairs, seconds, (double) (succeeded+failed) / seconds);
+    if (latencies.Size())
+    {
+        double *sorted = &latencies[0];
+        unsigned int n = latencies.Size();
+        qsort(sorted, n, sizeof(double), CompareDouble);
+        printf("Latency ms: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n", sorted[n/2], sorted[n*9/10], sorted[n*99/100], sorted[n-1]);
+    }
+    printf("Server Receive(): %.1f ms total, %.2f ms longest call\n", (double) serverTime / 1000.0, (double) maxServerReceive / 1000.0);
+
+    for (i=0; i < numClients; i++)
+    {
+        clients[i].peer->Shutdown(0);
+        RakPeerInterface::DestroyInstance(clients[i].peer);
+        NatPunchthroughClient::DestroyInstance(clients[i].natPunchthroughClient);
+    }
+    delete [] clients;
+    server->Shutdown(0);
+    RakPeerInterface::DestroyInstance(server);
+    NatPunchthroughServer::DestroyInstance(natPunchthroughServer);
+    return completedPairs==numPairs ? 0 : 1;
+}
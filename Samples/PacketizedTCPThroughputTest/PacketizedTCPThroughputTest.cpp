@@ -0,0 +1,153 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Measures how many messages a PacketizedTCP server receives per second from one client, over loopback.
+// Each message starts with its sequence number, which the server checks along with its length.
+// Then a plain TCPInterface client sends a length header over the server's limit, which must close its connection.
+// Usage: PacketizedTCPThroughputTest [port] [smallMessages] [largeMessages]
+
+#include "PacketizedTCP.h"
+#include "MessageIdentifiers.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+// Messages the client queues before waiting for them to be sent
+static const unsigned int QUEUED_BYTES = 4 << 20;
+
+// Sends messageCount messages of messageBytes from the client, and receives them on the server
+// \return false if one was lost, out of order, or the wrong length, or its progress did not start with it
+static bool RunTest(PacketizedTCP *server, PacketizedTCP *client, SystemAddress serverAddress, unsigned int messageBytes, unsigned int messageCount)
+{
+    char *message = new char[messageBytes];
+    memset(message, 0, messageBytes);
+    unsigned int sent = 0, received = 0;
+    bool valid = true;
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    while (received < messageCount && valid && RakNet::GetTimeUS() - start < 60000000)
+    {
+        while (sent < messageCount && client->GetOutgoingDataBufferSize(serverAddress) < QUEUED_BYTES)
+        {
+            memcpy(message, &sent, sizeof(sent));
+            client->Send(message, messageBytes, serverAddress, false);
+            sent++;
+        }
+        Packet *p;
+        while ((p = server->Receive()) != 0)
+        {
+            if (p->data[0] != ID_DOWNLOAD_PROGRESS || p->length == messageBytes)
+            {
+                unsigned int sequence;
+                memcpy(&sequence, p->data, sizeof(sequence));
+                if (p->length != messageBytes || sequence != received)
+                {
+                    printf("Message %u: got %u bytes with sequence number %u\n", received, p->length, sequence);
+                    valid = false;
+                }
+                received++;
+            }
+            else
+            {
+                // Progress carries the start of the message being received
+                unsigned int sequence;
+                memcpy(&sequence, p->data + sizeof(MessageID) + sizeof(unsigned int) * 3, sizeof(sequence));
+                if (sequence != received)
+                {
+                    printf("Progress of message %u: got sequence number %u\n", received, sequence);
+                    valid = false;
+                }
+            }
+            server->DeallocatePacket(p);
+        }
+        RakSleep(0);
+    }
+    double seconds = (double) (RakNet::GetTimeUS() - start) / 1000000.0;
+    printf("%u byte messages: %u/%u in %.2f s, %.0f messages/s, %.1f MB/s\n", messageBytes, received, messageCount, seconds,
+        (double) received / seconds, (double) received * messageBytes / 1000000.0 / seconds);
+    delete [] message;
+    return valid && received == messageCount;
+}
+
+// Sends the header of a message longer than the server accepts, without the message
+// \return false if the server kept the connection, or queued a message from it
+static bool RunOversizedTest(PacketizedTCP *server, unsigned short port)
+{
+    const unsigned int maxLength = 1 << 20;
+    server->SetMaxFramedMessageLength(maxLength);
+    TCPInterface *client = TCPInterface::GetInstance();
+    client->Start(0, 0);
+    SystemAddress serverAddress = client->Connect("127.0.0.1", port, true);
+    bool valid = false;
+    if (serverAddress != UNASSIGNED_SYSTEM_ADDRESS)
+    {
+        // Little endian, as PacketizedTCP sends it on this platform
+        uint32_t header = maxLength + 1;
+        client->Send((const char *) &header, sizeof(header), serverAddress, false);
+        RakNet::TimeMS startTime = RakNet::GetTimeMS();
+        int lost = 0, messages = 0;
+        while (lost < 2 && RakNet::GetTimeMS() - startTime < 5000)
+        {
+            // The server loses both the client from RunTest(), stopped before this, and this one
+            if (server->HasLostConnection() != UNASSIGNED_SYSTEM_ADDRESS)
+                lost++;
+            Packet *p;
+            while ((p = server->Receive()) != 0)
+            {
+                messages++;
+                server->DeallocatePacket(p);
+            }
+            RakSleep(1);
+        }
+        valid = lost == 2 && messages == 0;
+    }
+    printf("Header over the limit of %u bytes: %s\n", maxLength, valid ? "connection closed" : "NOT CLOSED");
+    client->Stop();
+    TCPInterface::DestroyInstance(client);
+    return valid;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned short port = (unsigned short) (argc > 1 ? atoi(argv[1]) : 61300);
+    unsigned int smallMessages = argc > 2 ? (unsigned int) atoi(argv[2]) : 2000000;
+    unsigned int largeMessages = argc > 3 ? (unsigned int) atoi(argv[3]) : 500;
+
+    PacketizedTCP *server = PacketizedTCP::GetInstance();
+    PacketizedTCP *client = PacketizedTCP::GetInstance();
+    if (server->Start(port, 1) == false || client->Start(0, 0) == false)
+    {
+        printf("Failed to start on port %i\n", port);
+        return 1;
+    }
+    client->Connect("127.0.0.1", port, true);
+    SystemAddress serverAddress = UNASSIGNED_SYSTEM_ADDRESS;
+    RakNet::TimeMS startTime = RakNet::GetTimeMS();
+    while ((serverAddress = client->HasCompletedConnectionAttempt()) == UNASSIGNED_SYSTEM_ADDRESS && RakNet::GetTimeMS() - startTime < 5000)
+        RakSleep(1);
+    if (serverAddress == UNASSIGNED_SYSTEM_ADDRESS)
+    {
+        printf("Failed to connect\n");
+        return 1;
+    }
+
+    bool valid = RunTest(server, client, serverAddress, 64, smallMessages);
+    valid = RunTest(server, client, serverAddress, 1 << 20, largeMessages) && valid;
+
+    client->Stop();
+    valid = RunOversizedTest(server, port) && valid;
+    server->Stop();
+    PacketizedTCP::DestroyInstance(client);
+    PacketizedTCP::DestroyInstance(server);
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,207 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Checks that a message reaches OnReceive() of exactly the plugins registered for its identifier.
+// A client sends messages with each of a range of identifiers, plain and after ID_TIMESTAMP, to a server with plugins that
+// registered one identifier, a range, every identifier, or none. Some plugins use the reliability layer, so RakPeer keeps them
+// in its other plugin list. Then one plugin is detached, the messages are sent again, and the detached plugin must get none.
+// Usage: PluginDispatchTest
+
+#include "RakPeerInterface.h"
+#include "PluginInterface2.h"
+#include "MessageIdentifiers.h"
+#include "BitStream.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace RakNet;
+
+static const int FIRST_TEST_ID = ID_USER_PACKET_ENUM;
+static const int TEST_ID_COUNT = 6;
+// Sent after the test messages of a round
+static const int ID_TEST_END_OF_ROUND = ID_USER_PACKET_ENUM + TEST_ID_COUNT;
+
+class CountingPlugin : public PluginInterface2
+{
+public:
+    // \param[in] first, last The identifiers to register, or -1 to register none. Pass first = -2 to not restrict them at all.
+    CountingPlugin(const char *_name, int first, int last, bool _usesReliabilityLayer)
+    {
+        name=_name;
+        usesReliabilityLayer=_usesReliabilityLayer;
+        memset(counts, 0, sizeof(counts));
+        if (first==-1)
+            SetReceivesAllMessageIDs(false);
+        else if (first >= 0)
+            AddReceivedMessageIDRange((MessageID) first, (MessageID) last);
+    }
+    virtual bool UsesReliabilityLayer(void) const {return usesReliabilityLayer;}
+    virtual PluginReceiveResult OnReceive(Packet *packet)
+    {
+        MessageID messageId = packet->data[0];
+        if (messageId==ID_TIMESTAMP && packet->length > sizeof(MessageID)+sizeof(RakNet::Time))
+            messageId = packet->data[sizeof(MessageID)+sizeof(RakNet::Time)];
+        counts[messageId]++;
+        return RR_CONTINUE_PROCESSING;
+    }
+
+    const char *name;
+    bool usesReliabilityLayer;
+    unsigned int counts[256];
+};
+
+static bool WaitForConnection(RakPeerInterface *server, RakPeerInterface *client)
+{
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 5000;
+    bool connected=false;
+    while (connected==false && RakNet::GetTimeMS() < deadline)
+    {
+        Packet *p;
+        for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+            ;
+        for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+        {
+            if (p->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+                connected=true;
+        }
+        RakSleep(10);
+    }
+    return connected;
+}
+
+// Sends each test identifier once plain and once timestamped, then waits for the server to return them all
+// \return How many test messages the server returned to the user, or -1 on timeout
+static int SendRound(RakPeerInterface *server, RakPeerInterface *client)
+{
+    SystemAddress serverAddress = server->GetMyBoundAddress();
+    for (int id=FIRST_TEST_ID; id < FIRST_TEST_ID+TEST_ID_COUNT; id++)
+    {
+        RakNet::BitStream plain, timestamped;
+        plain.Write((MessageID) id);
+        plain.Write(id);
+        client->Send(&plain, HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+        timestamped.Write((MessageID) ID_TIMESTAMP);
+        timestamped.Write(RakNet::GetTime());
+        timestamped.Write((MessageID) id);
+        timestamped.Write(id);
+        client->Send(&timestamped, HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+    }
+    MessageID endOfRound = ID_TEST_END_OF_ROUND;
+    client->Send((const char*) &endOfRound, 1, HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+
+    int returned=0;
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 5000;
+    while (RakNet::GetTimeMS() < deadline)
+    {
+        Packet *p;
+        for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+        {
+            if (p->data[0]==ID_TEST_END_OF_ROUND)
+            {
+                server->DeallocatePacket(p);
+                return returned;
+            }
+            MessageID messageId = p->data[0]==ID_TIMESTAMP ? p->data[sizeof(MessageID)+sizeof(RakNet::Time)] : p->data[0];
+            if (messageId >= FIRST_TEST_ID && messageId < FIRST_TEST_ID+TEST_ID_COUNT)
+                returned++;
+        }
+        for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+            ;
+        RakSleep(10);
+    }
+    return -1;
+}
+
+// Each test identifier must have reached the plugin once per round plain and once timestamped if it registered for it, and never otherwise
+static bool CheckCounts(CountingPlugin *plugin, int first, int last, unsigned int rounds)
+{
+    bool ok=true;
+    for (int id=FIRST_TEST_ID; id <= ID_TEST_END_OF_ROUND; id++)
+    {
+        bool registered = first==-2 || (first >= 0 && id >= first && id <= last);
+        unsigned int expected = registered ? (id==ID_TEST_END_OF_ROUND ? 1 : 2) * rounds : 0;
+        if (plugin->counts[id]!=expected)
+        {
+            printf("%s got identifier %d %u times, expected %u\n", plugin->name, id, plugin->counts[id], expected);
+            ok=false;
+        }
+    }
+    return ok;
+}
+
+int main(void)
+{
+    struct PluginSpec {const char *name; int first, last; bool usesReliabilityLayer;};
+    const PluginSpec specs[] =
+    {
+        {"One identifier", FIRST_TEST_ID, FIRST_TEST_ID, false},
+        {"Range", FIRST_TEST_ID+1, FIRST_TEST_ID+3, false},
+        {"Every identifier", -2, 0, false},
+        {"No identifiers", -1, 0, false},
+        {"Range, reliability layer", FIRST_TEST_ID+2, FIRST_TEST_ID+5, true},
+        {"Every identifier, reliability layer", -2, 0, true},
+        {"Detached after one round", FIRST_TEST_ID, FIRST_TEST_ID+TEST_ID_COUNT, false},
+    };
+    const int pluginCount = sizeof(specs) / sizeof(specs[0]);
+    const int detachedPlugin = pluginCount-1;
+
+    RakPeerInterface *server = RakPeerInterface::GetInstance();
+    RakPeerInterface *client = RakPeerInterface::GetInstance();
+    CountingPlugin *plugins[pluginCount];
+    for (int i=0; i < pluginCount; i++)
+    {
+        plugins[i] = new CountingPlugin(specs[i].name, specs[i].first, specs[i].last, specs[i].usesReliabilityLayer);
+        // Plugins using the reliability layer cannot be attached while RakPeer is running
+        server->AttachPlugin(plugins[i]);
+    }
+    SocketDescriptor serverSd(0,"127.0.0.1");
+    SocketDescriptor clientSd(0,"127.0.0.1");
+    server->Startup(1, &serverSd, 1);
+    server->SetMaximumIncomingConnections(1);
+    client->Startup(1, &clientSd, 1);
+
+    bool ok=false;
+    client->Connect("127.0.0.1", server->GetMyBoundAddress().GetPort(), 0, 0);
+    if (WaitForConnection(server, client)==false)
+        printf("Failed to connect\n");
+    else
+    {
+        int returnedFirst = SendRound(server, client);
+        server->DetachPlugin(plugins[detachedPlugin]);
+        int returnedSecond = SendRound(server, client);
+        // Every plugin continues processing, so the user gets every message too
+        ok = returnedFirst==2*TEST_ID_COUNT && returnedSecond==2*TEST_ID_COUNT;
+        if (ok==false)
+            printf("The user got %d and %d messages, expected %d per round\n", returnedFirst, returnedSecond, 2*TEST_ID_COUNT);
+
+        for (int i=0; i < pluginCount; i++)
+        {
+            bool pluginOk = CheckCounts(plugins[i], specs[i].first, specs[i].last, i==detachedPlugin ? 1 : 2);
+            printf("%-40s %s\n", specs[i].name, pluginOk ? "Passed" : "FAILED");
+            ok = ok && pluginOk;
+        }
+    }
+
+    client->Shutdown(0);
+    server->Shutdown(0);
+    for (int i=0; i < pluginCount; i++)
+    {
+        if (i!=detachedPlugin)
+            server->DetachPlugin(plugins[i]);
+        delete plugins[i];
+    }
+    RakPeerInterface::DestroyInstance(client);
+    RakPeerInterface::DestroyInstance(server);
+
+    printf(ok ? "Passed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,249 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Checks that ReceiveBatch() returns the same messages, in the same order, as calling Receive() repeatedly.
+// A server sends the same messages to two clients over loopback: plain and timestamped messages, and messages a plugin on
+// each client consumes. One client reads with Receive(), the other with ReceiveBatch() and batches of random size,
+// until the server disconnects them. The messages each client read are then compared, apart from the timestamps.
+// Usage: ReceiveBatchTest [messageCount]
+
+#include "RakPeerInterface.h"
+#include "PluginInterface2.h"
+#include "MessageIdentifiers.h"
+#include "RakNetStatistics.h"
+#include "DS_List.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include "Rand.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+enum
+{
+    ID_TEST_MESSAGE=ID_USER_PACKET_ENUM,
+    // Consumed by ConsumingPlugin, so never returned to the user
+    ID_TEST_CONSUMED
+};
+
+static const unsigned int MAX_BATCH = 16;
+
+class ConsumingPlugin : public PluginInterface2
+{
+public:
+    ConsumingPlugin() {consumed=0; AddReceivedMessageID(ID_TEST_CONSUMED);}
+    virtual PluginReceiveResult OnReceive(Packet *packet)
+    {
+        (void) packet;
+        consumed++;
+        return RR_STOP_PROCESSING_AND_DEALLOCATE;
+    }
+
+    unsigned int consumed;
+};
+
+struct Client
+{
+    RakPeerInterface *peer;
+    ConsumingPlugin plugin;
+    // A hash of each message returned, in order
+    DataStructures::List<unsigned int> received;
+    bool disconnected;
+};
+
+// Hashes the message, without the timestamp, which each client shifts by its own clock differential.
+// Connection messages hold addresses that differ between the clients, so only their identifier is hashed.
+static unsigned int HashMessage(Packet *p)
+{
+    unsigned int hash = 2166136261u;
+    unsigned int length = p->data[0]!=ID_TIMESTAMP && p->data[0] < ID_USER_PACKET_ENUM ? 1 : p->length;
+    for (unsigned int i=0; i < length; i++)
+    {
+        if (p->data[0]==ID_TIMESTAMP && i >= sizeof(MessageID) && i < sizeof(MessageID)+sizeof(RakNet::Time))
+            continue;
+        hash = (hash ^ p->data[i]) * 16777619u;
+    }
+    return hash ^ length;
+}
+
+static void Record(Client *client, Packet *p)
+{
+    client->received.Push(HashMessage(p), _FILE_AND_LINE_);
+    if (p->data[0]==ID_DISCONNECTION_NOTIFICATION)
+        client->disconnected=true;
+}
+
+static void ReadOneAtATime(Client *client)
+{
+    Packet *p;
+    for (p=client->peer->Receive(); p; client->peer->DeallocatePacket(p), p=client->peer->Receive())
+        Record(client, p);
+}
+
+static void ReadInBatches(Client *client)
+{
+    Packet *packets[MAX_BATCH];
+    unsigned int count;
+    while ((count=client->peer->ReceiveBatch(packets, randomMT() % MAX_BATCH + 1)) > 0)
+    {
+        for (unsigned int i=0; i < count; i++)
+            Record(client, packets[i]);
+        // Sometimes one at a time, which must work just as well
+        if (randomMT() % 4==0)
+        {
+            for (unsigned int i=0; i < count; i++)
+                client->peer->DeallocatePacket(packets[i]);
+        }
+        else
+            client->peer->DeallocatePackets(packets, count);
+    }
+}
+
+static bool IsConsumed(unsigned int i)
+{
+    return i % 5!=0 && i % 7==0;
+}
+
+static void SendMessages(RakPeerInterface *server, unsigned int first, unsigned int count)
+{
+    unsigned char message[64];
+    for (unsigned int i=first; i < first+count; i++)
+    {
+        unsigned int length;
+        if (i % 5==0)
+        {
+            message[0]=ID_TIMESTAMP;
+            RakNet::Time now = RakNet::GetTime();
+            memcpy(message+1, &now, sizeof(now));
+            message[1+sizeof(now)]=ID_TEST_MESSAGE;
+            length=2+sizeof(now);
+        }
+        else
+        {
+            message[0]=(unsigned char) (IsConsumed(i) ? ID_TEST_CONSUMED : ID_TEST_MESSAGE);
+            length=1;
+        }
+        memcpy(message+length, &i, sizeof(i));
+        length+=sizeof(i) + i % 16;
+        // Broadcast, so both clients get the same messages in the same order
+        server->Send((const char*) message, length, HIGH_PRIORITY, RELIABLE_ORDERED, 0, UNASSIGNED_SYSTEM_ADDRESS, true);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int messageCount = argc > 1 ? atoi(argv[1]) : 20000;
+    if (messageCount==0)
+    {
+        printf("Usage: ReceiveBatchTest [messageCount]\n");
+        return 1;
+    }
+    seedMT(0);
+
+    RakPeerInterface *server = RakPeerInterface::GetInstance();
+    SocketDescriptor serverSd(0,"127.0.0.1");
+    server->Startup(2, &serverSd, 1);
+    server->SetMaximumIncomingConnections(2);
+    unsigned short serverPort = server->GetMyBoundAddress().GetPort();
+
+    Client clients[2];
+    for (int i=0; i < 2; i++)
+    {
+        clients[i].peer = RakPeerInterface::GetInstance();
+        clients[i].peer->AttachPlugin(&clients[i].plugin);
+        clients[i].disconnected=false;
+        SocketDescriptor clientSd(0,"127.0.0.1");
+        clients[i].peer->Startup(1, &clientSd, 1);
+        clients[i].peer->Connect("127.0.0.1", serverPort, 0, 0);
+    }
+
+    // Send in bursts while the clients read, then disconnect them once everything was acknowledged
+    unsigned int connected=0, sent=0;
+    bool closed=false;
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 60000;
+    while ((clients[0].disconnected==false || clients[1].disconnected==false) && RakNet::GetTimeMS() < deadline)
+    {
+        Packet *p;
+        for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+        {
+            if (p->data[0]==ID_NEW_INCOMING_CONNECTION)
+                connected++;
+        }
+        if (connected==2 && sent < messageCount)
+        {
+            unsigned int count = messageCount-sent < 500 ? messageCount-sent : 500;
+            SendMessages(server, sent, count);
+            sent+=count;
+        }
+        else if (connected==2 && closed==false)
+        {
+            DataStructures::List<SystemAddress> addresses;
+            DataStructures::List<RakNetGUID> guids;
+            server->GetSystemList(addresses, guids);
+            bool acknowledged=true;
+            for (unsigned int i=0; i < addresses.Size(); i++)
+            {
+                RakNetStatistics rns;
+                if (server->GetStatistics(addresses[i], &rns) &&
+                    (rns.messagesInResendBuffer > 0 || rns.messageInSendBuffer[HIGH_PRIORITY] > 0))
+                    acknowledged=false;
+            }
+            if (acknowledged)
+            {
+                for (unsigned int i=0; i < addresses.Size(); i++)
+                    server->CloseConnection(addresses[i], true, 0, HIGH_PRIORITY);
+                closed=true;
+            }
+        }
+
+        ReadOneAtATime(&clients[0]);
+        ReadInBatches(&clients[1]);
+        RakSleep(1);
+    }
+
+    bool ok = clients[0].disconnected && clients[1].disconnected;
+    if (ok==false)
+        printf("Timed out after sending %u of %u messages\n", sent, messageCount);
+    unsigned int size0 = clients[0].received.Size(), size1 = clients[1].received.Size();
+    for (unsigned int i=0; ok && (i < size0 || i < size1); i++)
+    {
+        if (i >= size0 || i >= size1 || clients[0].received[i]!=clients[1].received[i])
+        {
+            printf("Message %u differs\n", i);
+            ok=false;
+        }
+    }
+    // The connection, each message not consumed, and the disconnection
+    unsigned int consumed=0;
+    for (unsigned int i=0; i < messageCount; i++)
+    {
+        if (IsConsumed(i))
+            consumed++;
+    }
+    unsigned int expected = 2 + messageCount - consumed;
+    if (ok && (size0!=expected || clients[0].plugin.consumed!=consumed || clients[1].plugin.consumed!=consumed))
+    {
+        printf("Expected %u messages, got %u, with %u and %u consumed by plugins\n", expected, size0, clients[0].plugin.consumed, clients[1].plugin.consumed);
+        ok=false;
+    }
+    printf("Receive(): %u messages. ReceiveBatch(): %u messages. %s\n", size0, size1, ok ? "Passed" : "FAILED");
+
+    for (int i=0; i < 2; i++)
+    {
+        clients[i].peer->Shutdown(0);
+        clients[i].peer->DetachPlugin(&clients[i].plugin);
+        RakPeerInterface::DestroyInstance(clients[i].peer);
+    }
+    server->Shutdown(0);
+    RakPeerInterface::DestroyInstance(server);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Measures how many datagrams per second a server processes from a connected client over loopback,
+// first with an empty ban list, then with a large ban list that does not match the client.
+// The client sends one large reliable message, which is split into datagrams and paced by congestion control,
+// so the rate follows the cost of the server's receive path. Datagrams are counted as they arrive at the server socket.
+// Usage: ReceivePathBenchmark [banListSize] [megabytes]
+
+#include "RakPeerInterface.h"
+#include "MessageIdentifiers.h"
+#include "BitStream.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+// Written on the server's receive thread, read after the message arrives
+static unsigned int datagramsReceived;
+
+static bool OnIncomingDatagram(RNS2RecvStruct *recvStruct)
+{
+    (void) recvStruct;
+    datagramsReceived++;
+    return true;
+}
+
+static bool WaitForConnection(RakPeerInterface *server, RakPeerInterface *client)
+{
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 5000;
+    bool connected=false;
+    while (connected==false && RakNet::GetTimeMS() < deadline)
+    {
+        Packet *p;
+        for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+            ;
+        for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+        {
+            if (p->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+                connected=true;
+        }
+        RakSleep(10);
+    }
+    return connected;
+}
+
+static void Run(unsigned int banListSize, unsigned int messageBytes)
+{
+    RakPeerInterface *server = RakPeerInterface::GetInstance();
+    RakPeerInterface *client = RakPeerInterface::GetInstance();
+    SocketDescriptor serverSd(0,"127.0.0.1");
+    SocketDescriptor clientSd(0,"127.0.0.1");
+    server->Startup(1, &serverSd, 1);
+    server->SetMaximumIncomingConnections(1);
+    server->SetIncomingDatagramEventHandler(OnIncomingDatagram);
+    client->Startup(1, &clientSd, 1);
+
+    // Addresses in 10.0.0.0/8, so none of them match the client
+    char ip[32];
+    for (unsigned int i=0; i < banListSize; i++)
+    {
+        if ((i % 10)==9)
+            sprintf(ip, "10.%u.%u.*", (i >> 8) & 255, i & 255);
+        else
+            sprintf(ip, "10.%u.%u.%u", (i >> 16) & 255, (i >> 8) & 255, i & 255);
+        server->AddToBanList(ip, 0);
+    }
+
+    client->Connect("127.0.0.1", server->GetMyBoundAddress().GetPort(), 0, 0);
+    if (WaitForConnection(server, client)==false)
+    {
+        printf("Failed to connect\n");
+        client->Shutdown(0);
+        server->Shutdown(0);
+        RakPeerInterface::DestroyInstance(client);
+        RakPeerInterface::DestroyInstance(server);
+        return;
+    }
+
+    char *message = (char*) malloc(messageBytes);
+    memset(message, 0, messageBytes);
+    message[0]=(char) ID_USER_PACKET_ENUM;
+    SystemAddress serverAddress = server->GetMyBoundAddress();
+
+    datagramsReceived=0;
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    RakNet::TimeUS end = start + 120000000;
+    client->Send(message, messageBytes, HIGH_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
+    bool received=false;
+    while (received==false && RakNet::GetTimeUS() < end)
+    {
+        Packet *p;
+        for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+        {
+            if (p->data[0]==ID_USER_PACKET_ENUM && p->length==messageBytes)
+                received=true;
+        }
+        for (p=client->Receive(); p; client->DeallocatePacket(p), p=client->Receive())
+            ;
+        RakSleep(0);
+    }
+    double elapsed = (double) (RakNet::GetTimeUS() - start) / 1000000.0;
+    if (received)
+        printf("%8u %12u %10.2f %12.0f %10.1f\n", banListSize, datagramsReceived, elapsed, (double) datagramsReceived / elapsed, (double) messageBytes / elapsed / 1000000.0);
+    else
+        printf("%8u timed out\n", banListSize);
+
+    free(message);
+    client->Shutdown(0);
+    server->Shutdown(0);
+    RakPeerInterface::DestroyInstance(client);
+    RakPeerInterface::DestroyInstance(server);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int banListSize = argc > 1 ? atoi(argv[1]) : 10000;
+    unsigned int megabytes = argc > 2 ? atoi(argv[2]) : 50;
+    if (megabytes==0)
+    {
+        printf("Usage: ReceivePathBenchmark [banListSize] [megabytes]\n");
+        return 1;
+    }
+
+    printf("%u megabyte message\n", megabytes);
+    printf("%8s %12s %10s %12s %10s\n", "Bans", "Datagrams", "Seconds", "Datagrams/s", "MB/s");
+    Run(0, megabytes * 1000000);
+    if (banListSize)
+        Run(banListSize, megabytes * 1000000);
+    return 0;
+}
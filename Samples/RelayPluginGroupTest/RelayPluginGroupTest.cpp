@@ -0,0 +1,349 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Checks RelayPlugin rooms with six clients over loopback, without user input, unlike RelayPluginTest.
+// Five clients join one room in order. Then members leave from the middle of the room, so the last member is moved
+// into the gap each time, and the next to go is always one that was moved: through LeaveGroup(), by joining another
+// room, by being added again under a new name, and by disconnecting. After each step every client must have received
+// exactly the expected notices, group messages, direct messages and room lists, and nothing else.
+// Usage: RelayPluginGroupTest
+
+#include "RakPeerInterface.h"
+#include "RelayPlugin.h"
+#include "MessageIdentifiers.h"
+#include "BitStream.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace RakNet;
+
+static const int CLIENT_COUNT = 6;
+// How long to keep reading once the expected messages arrived, to catch any extra ones
+static const RakNet::TimeMS SETTLE_MS = 100;
+
+struct Client
+{
+    RakPeerInterface *peer;
+    RelayPlugin *relayPlugin;
+    // What arrived since the last step, one line per message
+    RakString events;
+    unsigned int eventCount;
+};
+
+static RakPeerInterface *server;
+static Client clients[CLIENT_COUNT];
+static RakNetGUID serverGuid;
+
+static void AddEvent(Client *client, const RakString &event)
+{
+    if (client->events.IsEmpty()==false)
+        client->events+="|";
+    client->events+=event;
+    client->eventCount++;
+}
+
+static void OnRelayMessage(Client *client, Packet *packet)
+{
+    BitStream bsIn(packet->data, packet->length, false);
+    bsIn.IgnoreBytes(sizeof(MessageID));
+    RelayPluginEnums rpe;
+    bsIn.ReadCasted<MessageID>(rpe);
+    RakString name, data;
+    switch (rpe)
+    {
+    case RPE_ADD_CLIENT_SUCCESS:
+        bsIn.ReadCompressed(name);
+        AddEvent(client, RakString("added %s", name.C_String()));
+        break;
+    case RPE_ADD_CLIENT_NAME_ALREADY_IN_USE:
+        bsIn.ReadCompressed(name);
+        AddEvent(client, RakString("in use %s", name.C_String()));
+        break;
+    case RPE_USER_ENTERED_ROOM:
+        bsIn.ReadCompressed(name);
+        AddEvent(client, RakString("entered %s", name.C_String()));
+        break;
+    case RPE_USER_LEFT_ROOM:
+        bsIn.ReadCompressed(name);
+        AddEvent(client, RakString("left %s", name.C_String()));
+        break;
+    case RPE_GROUP_MSG_FROM_SERVER:
+        bsIn.ReadCompressed(name);
+        bsIn.AlignReadToByteBoundary();
+        bsIn.Read(data);
+        AddEvent(client, RakString("%s: %s", name.C_String(), data.C_String()));
+        break;
+    case RPE_MESSAGE_TO_CLIENT_FROM_SERVER:
+        bsIn.ReadCompressed(name);
+        bsIn.AlignReadToByteBoundary();
+        bsIn.ReadCompressed(data);
+        AddEvent(client, RakString("direct %s: %s", name.C_String(), data.C_String()));
+        break;
+    case RPE_JOIN_GROUP_SUCCESS:
+        {
+            uint16_t userCount;
+            bsIn.Read(userCount);
+            RakString users;
+            for (uint16_t i=0; i < userCount; i++)
+            {
+                bsIn.ReadCompressed(name);
+                if (i > 0)
+                    users+=",";
+                users+=name;
+            }
+            AddEvent(client, RakString("joined %s", users.C_String()));
+        }
+        break;
+    case RPE_JOIN_GROUP_FAILURE:
+        AddEvent(client, "join failed");
+        break;
+    case RPE_GET_GROUP_LIST_REPLY_FROM_SERVER:
+        {
+            // Rooms come in hash order, so list them by name
+            uint16_t roomCount, userCount;
+            bsIn.Read(roomCount);
+            DataStructures::List<RakString> rooms;
+            for (uint16_t i=0; i < roomCount; i++)
+            {
+                bsIn.ReadCompressed(name);
+                bsIn.Read(userCount);
+                RakString room("%s %i", name.C_String(), userCount);
+                unsigned int j=0;
+                while (j < rooms.Size() && strcmp(rooms[j].C_String(), room.C_String()) < 0)
+                    j++;
+                rooms.Insert(room, j, _FILE_AND_LINE_);
+            }
+            RakString list("rooms");
+            for (unsigned int i=0; i < rooms.Size(); i++)
+            {
+                list+=" ";
+                list+=rooms[i];
+            }
+            AddEvent(client, list);
+        }
+        break;
+    default:
+        AddEvent(client, RakString("unexpected %i", (int) rpe));
+        break;
+    }
+}
+
+static void ReadAll(void)
+{
+    Packet *p;
+    for (p=server->Receive(); p; server->DeallocatePacket(p), p=server->Receive())
+        ;
+    for (int i=0; i < CLIENT_COUNT; i++)
+    {
+        for (p=clients[i].peer->Receive(); p; clients[i].peer->DeallocatePacket(p), p=clients[i].peer->Receive())
+        {
+            if (p->data[0]==ID_RELAY_PLUGIN)
+                OnRelayMessage(&clients[i], p);
+        }
+    }
+}
+
+static unsigned int CountEvents(const char *events)
+{
+    if (events[0]==0)
+        return 0;
+    unsigned int count=1;
+    for (const char *c=events; *c; c++)
+    {
+        if (*c=='|')
+            count++;
+    }
+    return count;
+}
+
+// Waits until each client got as many messages as expected, then a little longer, and compares what arrived.
+// Each expected string holds the messages for one client, separated by |.
+static bool Expect(const char *step, const char *e0, const char *e1, const char *e2, const char *e3, const char *e4, const char *e5)
+{
+    const char *expected[CLIENT_COUNT] = {e0, e1, e2, e3, e4, e5};
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 5000;
+    bool arrived=false;
+    while (arrived==false && RakNet::GetTimeMS() < deadline)
+    {
+        RakSleep(10);
+        ReadAll();
+        arrived=true;
+        for (int i=0; i < CLIENT_COUNT; i++)
+        {
+            if (clients[i].eventCount < CountEvents(expected[i]))
+                arrived=false;
+        }
+    }
+    RakNet::TimeMS settleEnd = RakNet::GetTimeMS() + SETTLE_MS;
+    while (RakNet::GetTimeMS() < settleEnd)
+    {
+        RakSleep(10);
+        ReadAll();
+    }
+
+    bool ok=true;
+    for (int i=0; i < CLIENT_COUNT; i++)
+    {
+        if (strcmp(clients[i].events.C_String(), expected[i])!=0)
+        {
+            printf("%s: client %i got \"%s\", expected \"%s\"\n", step, i, clients[i].events.C_String(), expected[i]);
+            ok=false;
+        }
+        clients[i].events.Clear();
+        clients[i].eventCount=0;
+    }
+    printf("%-40s %s\n", step, ok ? "Passed" : "FAILED");
+    return ok;
+}
+
+static void SendGroupMessage(int client, const char *text)
+{
+    BitStream bs;
+    bs.Write(RakString(text));
+    clients[client].relayPlugin->SendGroupMessage(serverGuid, &bs, HIGH_PRIORITY, RELIABLE_ORDERED, 0);
+}
+
+static void SendToParticipant(int client, const char *name, const char *text)
+{
+    BitStream bs;
+    bs.WriteCompressed(RakString(text));
+    clients[client].relayPlugin->SendToParticipant(serverGuid, name, &bs, HIGH_PRIORITY, RELIABLE_ORDERED, 0);
+}
+
+static bool RunScenario(void)
+{
+    bool ok=true;
+    for (int i=0; i < CLIENT_COUNT; i++)
+        clients[i].relayPlugin->AddParticipantRequestFromClient(RakString("User%i", i), serverGuid);
+    ok = Expect("Add participants", "added User0", "added User1", "added User2", "added User3", "added User4", "added User5") && ok;
+
+    clients[0].relayPlugin->AddParticipantRequestFromClient("User1", serverGuid);
+    ok = Expect("Name in use", "in use User1", "", "", "", "", "") && ok;
+
+    // One at a time, so RoomA is User0 to User4 in that order
+    clients[0].relayPlugin->JoinGroupRequest(serverGuid, "RoomA");
+    ok = Expect("User0 joins RoomA", "joined User0", "", "", "", "", "") && ok;
+    clients[1].relayPlugin->JoinGroupRequest(serverGuid, "RoomA");
+    ok = Expect("User1 joins RoomA", "entered User1", "joined User0,User1", "", "", "", "") && ok;
+    clients[2].relayPlugin->JoinGroupRequest(serverGuid, "RoomA");
+    ok = Expect("User2 joins RoomA", "entered User2", "entered User2", "joined User0,User1,User2", "", "", "") && ok;
+    clients[3].relayPlugin->JoinGroupRequest(serverGuid, "RoomA");
+    ok = Expect("User3 joins RoomA", "entered User3", "entered User3", "entered User3", "joined User0,User1,User2,User3", "", "") && ok;
+    clients[4].relayPlugin->JoinGroupRequest(serverGuid, "RoomA");
+    ok = Expect("User4 joins RoomA", "entered User4", "entered User4", "entered User4", "entered User4", "joined User0,User1,User2,User3,User4", "") && ok;
+    clients[5].relayPlugin->JoinGroupRequest(serverGuid, "RoomB");
+    ok = Expect("User5 joins RoomB", "", "", "", "", "", "joined User5") && ok;
+
+    SendGroupMessage(2, "hello");
+    ok = Expect("Group message", "User2: hello", "User2: hello", "", "User2: hello", "User2: hello", "") && ok;
+
+    // RoomA is User0, User4, User2, User3 after this
+    clients[1].relayPlugin->LeaveGroup(serverGuid);
+    ok = Expect("Leave from the middle", "left User1", "", "left User1", "left User1", "left User1", "") && ok;
+    SendGroupMessage(0, "m1");
+    ok = Expect("Group message after leave", "", "", "User0: m1", "User0: m1", "User0: m1", "") && ok;
+
+    // User4 was moved, and leaves RoomA by joining RoomB. RoomA is User0, User3, User2 after this.
+    clients[4].relayPlugin->JoinGroupRequest(serverGuid, "RoomB");
+    ok = Expect("Moved member joins another room", "left User4", "", "left User4", "left User4", "joined User5,User4", "entered User4") && ok;
+    SendGroupMessage(0, "m2");
+    SendGroupMessage(5, "m3");
+    ok = Expect("Group messages in both rooms", "", "", "User0: m2", "User0: m2", "User5: m3", "") && ok;
+
+    // User3 was moved, and leaves RoomA by being added again. RoomA is User0, User2 after this.
+    clients[3].relayPlugin->AddParticipantRequestFromClient("User3b", serverGuid);
+    ok = Expect("Moved member added again", "left User3", "", "left User3", "added User3b", "", "") && ok;
+    SendGroupMessage(0, "m4");
+    SendGroupMessage(3, "m5");
+    ok = Expect("Group messages after add", "", "", "User0: m4", "", "", "") && ok;
+
+    // User2 was moved, and leaves RoomA by disconnecting
+    clients[2].peer->CloseConnection(serverGuid, true);
+    ok = Expect("Moved member disconnects", "left User2", "", "", "", "", "") && ok;
+    SendGroupMessage(0, "m6");
+    SendGroupMessage(4, "m7");
+    ok = Expect("Group messages after disconnect", "", "", "", "", "", "User4: m7") && ok;
+
+    SendToParticipant(5, "User0", "d1");
+    SendToParticipant(0, "User3b", "d2");
+    SendToParticipant(0, "User3", "d3");
+    SendToParticipant(0, "User2", "d4");
+    ok = Expect("Direct messages", "direct User5: d1", "", "", "direct User0: d2", "", "") && ok;
+
+    clients[0].relayPlugin->GetGroupList(serverGuid);
+    ok = Expect("Room list", "rooms RoomA 1 RoomB 2", "", "", "", "", "") && ok;
+
+    // The last member leaves, so RoomA goes
+    clients[0].relayPlugin->LeaveGroup(serverGuid);
+    clients[0].relayPlugin->GetGroupList(serverGuid);
+    ok = Expect("Last member leaves", "rooms RoomB 2", "", "", "", "", "") && ok;
+
+    return ok;
+}
+
+int main(void)
+{
+    server = RakPeerInterface::GetInstance();
+    RelayPlugin *serverRelayPlugin = RelayPlugin::GetInstance();
+    server->AttachPlugin(serverRelayPlugin);
+    serverRelayPlugin->SetAcceptAddParticipantRequests(true);
+    SocketDescriptor serverSd(0,"127.0.0.1");
+    server->Startup(CLIENT_COUNT, &serverSd, 1);
+    server->SetMaximumIncomingConnections(CLIENT_COUNT);
+    serverGuid = server->GetMyGUID();
+
+    for (int i=0; i < CLIENT_COUNT; i++)
+    {
+        clients[i].peer = RakPeerInterface::GetInstance();
+        clients[i].relayPlugin = RelayPlugin::GetInstance();
+        clients[i].peer->AttachPlugin(clients[i].relayPlugin);
+        clients[i].eventCount=0;
+        SocketDescriptor sd(0,"127.0.0.1");
+        clients[i].peer->Startup(1, &sd, 1);
+        clients[i].peer->Connect("127.0.0.1", server->GetMyBoundAddress().GetPort(), 0, 0);
+    }
+
+    bool connected=false;
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 5000;
+    while (connected==false && RakNet::GetTimeMS() < deadline)
+    {
+        RakSleep(10);
+        ReadAll();
+        connected=true;
+        for (int i=0; i < CLIENT_COUNT; i++)
+        {
+            if (clients[i].peer->GetConnectionState(serverGuid)!=IS_CONNECTED)
+                connected=false;
+        }
+    }
+
+    bool ok=false;
+    if (connected==false)
+        printf("Failed to connect\n");
+    else
+        ok = RunScenario();
+
+    for (int i=0; i < CLIENT_COUNT; i++)
+    {
+        clients[i].peer->Shutdown(0);
+        clients[i].peer->DetachPlugin(clients[i].relayPlugin);
+        RelayPlugin::DestroyInstance(clients[i].relayPlugin);
+        RakPeerInterface::DestroyInstance(clients[i].peer);
+    }
+    server->Shutdown(0);
+    server->DetachPlugin(serverRelayPlugin);
+    RelayPlugin::DestroyInstance(serverRelayPlugin);
+    RakPeerInterface::DestroyInstance(server);
+
+    printf(ok ? "Passed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
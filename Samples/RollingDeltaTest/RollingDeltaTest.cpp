@@ -0,0 +1,190 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Round trips of the Autopatcher's rolling delta patches, the way the repositories make them and AutopatcherClient applies them.
+// The new file is the old file with bytes changed, inserted, deleted, and moved. Each patch must rebuild it exactly, and must be rejected for a different old file.
+// Usage: RollingDeltaTest [fileLength] [directory]
+
+#include "RollingDelta.h"
+#include "Rand.h"
+#include "GetTime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+static bool WriteFile(const char *path, const char *data, uint64_t length)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp==0)
+        return false;
+    bool success = length==0 || fwrite(data, 1, (size_t) length, fp)==length;
+    return fclose(fp)==0 && success;
+}
+
+static bool SameFile(const char *path, const char *data, uint64_t length)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp==0)
+        return false;
+    char buffer[65536];
+    uint64_t offset=0;
+    bool same=true;
+    size_t numRead;
+    while (same && (numRead = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    {
+        same = offset+numRead <= length && memcmp(buffer, data+offset, numRead)==0;
+        offset+=numRead;
+    }
+    fclose(fp);
+    return same && offset==length;
+}
+
+// Copies old into new with changes spread through the file
+static uint64_t MakeNewVersion(const char *old, uint64_t oldLength, char *output)
+{
+    uint64_t outputLength=0;
+    uint64_t chunk = oldLength/8 + 1;
+    for (uint64_t offset=0; offset < oldLength; offset+=chunk)
+    {
+        uint64_t length = oldLength-offset < chunk ? oldLength-offset : chunk;
+        switch ((offset/chunk) % 4)
+        {
+        case 0:
+            // Unchanged
+            memcpy(output+outputLength, old+offset, (size_t) length);
+            outputLength+=length;
+            break;
+        case 1:
+            // A few bytes changed
+            memcpy(output+outputLength, old+offset, (size_t) length);
+            for (uint64_t i=0; i < length; i+=length/5+1)
+                output[outputLength+i]^=0x5A;
+            outputLength+=length;
+            break;
+        case 2:
+            // Bytes inserted in front
+            for (unsigned int i=0; i < 777; i++)
+                output[outputLength++]=(char) randomMT();
+            memcpy(output+outputLength, old+offset, (size_t) length);
+            outputLength+=length;
+            break;
+        case 3:
+            // The first half deleted
+            memcpy(output+outputLength, old+offset+length/2, (size_t) (length-length/2));
+            outputLength+=length-length/2;
+            break;
+        }
+    }
+    // A block from the start moved to the end
+    uint64_t moved = oldLength < 65536 ? oldLength : 65536;
+    memcpy(output+outputLength, old, (size_t) moved);
+    return outputLength+moved;
+}
+
+static bool RunTest(uint64_t oldLength, const char *directory)
+{
+    char oldPath[512], newPath[512], patchPath[512], resultPath[512], otherPath[512];
+    sprintf(oldPath, "%s/rollingDeltaOld.bin", directory);
+    sprintf(newPath, "%s/rollingDeltaNew.bin", directory);
+    sprintf(patchPath, "%s/rollingDeltaPatch.bin", directory);
+    sprintf(resultPath, "%s/rollingDeltaResult.bin", directory);
+    sprintf(otherPath, "%s/rollingDeltaOther.bin", directory);
+
+    char *oldFile = (char*) malloc((size_t) oldLength+1);
+    char *newFile = (char*) malloc((size_t) (oldLength + oldLength/8*777/1000 + 8*777 + 65536 + 1));
+    if (oldFile==0 || newFile==0)
+    {
+        printf("%llu bytes: not enough memory\n", (unsigned long long) oldLength);
+        free(oldFile);
+        free(newFile);
+        return false;
+    }
+    for (uint64_t i=0; i < oldLength; i++)
+        oldFile[i]=(char) randomMT();
+    uint64_t newLength = MakeNewVersion(oldFile, oldLength, newFile);
+
+    bool valid = WriteFile(oldPath, oldFile, oldLength) && WriteFile(newPath, newFile, newLength);
+
+    // AutopatcherPostgreRepository2: both versions on disk, with the patch in memory for the database
+    char *signature=0, *patch=0;
+    unsigned int signatureSize, patchSize=0;
+    RakNet::TimeMS startTime = RakNet::GetTimeMS();
+    bool fromFiles = valid &&
+        CreateRollingSignature(oldPath, 0, 4, &signature, &signatureSize) &&
+        CreateRollingDeltaPatch(signature, signatureSize, newPath, &patch, &patchSize);
+    RakNet::TimeMS createTime = RakNet::GetTimeMS()-startTime;
+
+    // AutopatcherClient: the result streamed to disk
+    startTime = RakNet::GetTimeMS();
+    fromFiles = fromFiles &&
+        ApplyRollingDeltaPatch(oldPath, patch, patchSize, resultPath) &&
+        SameFile(resultPath, newFile, newLength);
+    RakNet::TimeMS applyTime = RakNet::GetTimeMS()-startTime;
+    unsigned int filePatchSize = patchSize;
+    free(signature);
+    free(patch);
+    signature=patch=0;
+
+    // AutopatcherMySQLRepository and AutopatcherPostgreRepository: both versions in memory. The patch must be the same.
+    char *memoryPatch=0;
+    unsigned int memoryPatchSize=0;
+    bool fromMemory =
+        CreateRollingSignature(oldFile, oldLength, 0, 1, &signature, &signatureSize) &&
+        CreateRollingDeltaPatch(signature, signatureSize, newFile, newLength, &memoryPatch, &memoryPatchSize) &&
+        memoryPatchSize==filePatchSize;
+    free(signature);
+
+    // Patch file to file, and patch in memory to memory
+    char *result=0;
+    unsigned int resultSize=0;
+    bool otherPaths = fromMemory &&
+        WriteFile(patchPath, memoryPatch, memoryPatchSize) &&
+        ApplyRollingDeltaPatch(oldPath, patchPath, resultPath) &&
+        SameFile(resultPath, newFile, newLength) &&
+        ApplyRollingDeltaPatch(oldPath, memoryPatch, memoryPatchSize, &result, &resultSize) &&
+        resultSize==newLength && memcmp(result, newFile, (size_t) newLength)==0;
+    free(result);
+
+    // A different old file, of the same length, must be rejected unless the patch never copies from it
+    if (oldLength > 0)
+        oldFile[oldLength/2]^=1;
+    bool rejected = WriteFile(otherPath, oldFile, oldLength) &&
+        (ApplyRollingDeltaPatch(otherPath, memoryPatch, memoryPatchSize, resultPath)==false || SameFile(resultPath, newFile, newLength));
+    free(memoryPatch);
+
+    printf("%llu bytes to %llu: patch %u bytes, made in %u ms, applied in %u ms, files %s, memory %s, other paths %s, wrong old file %s\n",
+        (unsigned long long) oldLength, (unsigned long long) newLength, filePatchSize, createTime, applyTime,
+        fromFiles ? "ok" : "FAILED", fromMemory ? "ok" : "FAILED", otherPaths ? "ok" : "FAILED", rejected ? "ok" : "WRONG RESULT");
+
+    remove(oldPath);
+    remove(newPath);
+    remove(patchPath);
+    remove(resultPath);
+    remove(otherPath);
+    free(oldFile);
+    free(newFile);
+    return fromFiles && fromMemory && otherPaths && rejected;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t fileLength = argc > 1 ? (uint64_t) strtoull(argv[1], 0, 10) : (uint64_t) ROLLING_DELTA_MIN_FILE_LENGTH*2;
+    const char *directory = argc > 2 ? argv[2] : ".";
+    seedMT(1234);
+
+    bool valid=true;
+    const uint64_t lengths[] = {0, 1, 1000, 100000, fileLength};
+    for (unsigned int i=0; i < sizeof(lengths)/sizeof(lengths[0]); i++)
+        valid = RunTest(lengths[i], directory) && valid;
+    printf("%s\n", valid ? "Passed" : "FAILED");
+    return valid ? 0 : 1;
+}
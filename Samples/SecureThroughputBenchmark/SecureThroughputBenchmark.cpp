@@ -0,0 +1,231 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Measures how much a server echoes over loopback to many connections, first without security, then with it.
+// Each connection keeps a few messages in flight, and sends another as each echo comes back, so the rate follows how fast the server and clients go.
+// A peer accepts only one connection from each other peer, so the server side is several server peers, and each client peer connects to all of them.
+// That makes many connections from a few peers. All peers are in this process, so client encryption competes with the servers for the same processors.
+// Build the library and this sample with LIBCAT_SECURITY defined for the secure run.
+// Usage: SecureThroughputBenchmark [connections] [seconds] [messageBytes] [encryptThreads] [serverPeers]
+
+#include "RakPeerInterface.h"
+#include "MessageIdentifiers.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include "RakNetStatistics.h"
+#include "DS_List.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef LIBCAT_SECURITY
+#include "SecureHandshake.h"
+#include "EncryptThread.h"
+#endif
+
+using namespace RakNet;
+
+// Messages each client keeps in flight
+static const int MESSAGES_IN_FLIGHT = 4;
+
+static void GetServerBytes(RakPeerInterface **servers, int numServers, uint64_t *bytesReceived, uint64_t *bytesSent)
+{
+    *bytesReceived = 0;
+    *bytesSent = 0;
+    for (int i = 0; i < numServers; i++)
+    {
+        RakNetStatistics stats;
+        servers[i]->GetStatistics(UNASSIGNED_SYSTEM_ADDRESS, &stats);
+        *bytesReceived += stats.runningTotal[ACTUAL_BYTES_RECEIVED];
+        *bytesSent += stats.runningTotal[ACTUAL_BYTES_SENT];
+    }
+}
+
+static void Run(bool secure, int numConnections, int numServers, int seconds, int messageBytes)
+{
+#ifdef LIBCAT_SECURITY
+    char publicKey[cat::EasyHandshake::PUBLIC_KEY_BYTES];
+    char privateKey[cat::EasyHandshake::PRIVATE_KEY_BYTES];
+    if (secure)
+    {
+        cat::EasyHandshake handshake;
+        handshake.GenerateServerKey(publicKey, privateKey);
+    }
+#endif
+    // Each client peer connects to every server peer, so there are enough client peers to make up the connections
+    int numClients = (numConnections + numServers - 1) / numServers;
+    RakPeerInterface **servers = new RakPeerInterface *[numServers];
+    unsigned short *serverPorts = new unsigned short[numServers];
+    int i;
+    for (i = 0; i < numServers; i++)
+    {
+        servers[i] = RakPeerInterface::GetInstance();
+#ifdef LIBCAT_SECURITY
+        if (secure)
+            servers[i]->InitializeSecurity(publicKey, privateKey, false);
+#endif
+        SocketDescriptor sd(0, "127.0.0.1");
+        if (servers[i]->Startup(numClients, &sd, 1) != RAKNET_STARTED)
+        {
+            printf("Server %i failed to start\n", i);
+            exit(1);
+        }
+        servers[i]->SetMaximumIncomingConnections((unsigned short) numClients);
+        serverPorts[i] = servers[i]->GetMyBoundAddress().GetPort();
+    }
+
+    RakPeerInterface **clients = new RakPeerInterface *[numClients];
+    int connectionsStarted = 0;
+    for (i = 0; i < numClients; i++)
+    {
+        clients[i] = RakPeerInterface::GetInstance();
+        SocketDescriptor sd(0, "127.0.0.1");
+        if (clients[i]->Startup(numServers, &sd, 1) != RAKNET_STARTED)
+        {
+            printf("Client %i failed to start\n", i);
+            exit(1);
+        }
+        for (int j = 0; j < numServers && connectionsStarted < numConnections; j++, connectionsStarted++)
+        {
+#ifdef LIBCAT_SECURITY
+            if (secure)
+            {
+                PublicKey pk;
+                pk.remoteServerPublicKey = publicKey;
+                pk.publicKeyMode = PKM_USE_KNOWN_PUBLIC_KEY;
+                clients[i]->Connect("127.0.0.1", serverPorts[j], 0, 0, &pk);
+                continue;
+            }
+#endif
+            clients[i]->Connect("127.0.0.1", serverPorts[j], 0, 0);
+        }
+    }
+
+    char *message = (char *) malloc(messageBytes);
+    memset(message, 0, messageBytes);
+    message[0] = (char) ID_USER_PACKET_ENUM;
+
+    // Start sending on each connection as soon as it is up
+    Packet *p;
+    int connectedCount = 0;
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 60000;
+    while (connectedCount < numConnections && RakNet::GetTimeMS() < deadline)
+    {
+        for (i = 0; i < numServers; i++)
+        {
+            for (p = servers[i]->Receive(); p; servers[i]->DeallocatePacket(p), p = servers[i]->Receive())
+                ;
+        }
+        for (i = 0; i < numClients; i++)
+        {
+            for (p = clients[i]->Receive(); p; clients[i]->DeallocatePacket(p), p = clients[i]->Receive())
+            {
+                if (p->data[0] != ID_CONNECTION_REQUEST_ACCEPTED)
+                    continue;
+                connectedCount++;
+                for (int j = 0; j < MESSAGES_IN_FLIGHT; j++)
+                    clients[i]->Send(message, messageBytes, HIGH_PRIORITY, RELIABLE_ORDERED, 0, p->systemAddress, false);
+            }
+        }
+        RakSleep(1);
+    }
+
+    // Echo for a second before measuring, so congestion control has ramped up
+    unsigned int echoes = 0;
+    uint64_t serverBytesReceived = 0, serverBytesSent = 0;
+    bool measuring = false;
+    RakNet::TimeUS start = RakNet::GetTimeUS() + 1000000;
+    RakNet::TimeUS end = start + (RakNet::TimeUS) seconds * 1000000;
+    RakNet::TimeUS time;
+    while ((time = RakNet::GetTimeUS()) < end)
+    {
+        if (measuring == false && time >= start)
+        {
+            measuring = true;
+            start = time;
+            echoes = 0;
+            GetServerBytes(servers, numServers, &serverBytesReceived, &serverBytesSent);
+        }
+        for (i = 0; i < numServers; i++)
+        {
+            for (p = servers[i]->Receive(); p; servers[i]->DeallocatePacket(p), p = servers[i]->Receive())
+            {
+                if (p->data[0] == ID_USER_PACKET_ENUM)
+                    servers[i]->Send((const char *) p->data, p->length, HIGH_PRIORITY, RELIABLE_ORDERED, 0, p->systemAddress, false);
+            }
+        }
+        for (i = 0; i < numClients; i++)
+        {
+            for (p = clients[i]->Receive(); p; clients[i]->DeallocatePacket(p), p = clients[i]->Receive())
+            {
+                if (p->data[0] != ID_USER_PACKET_ENUM)
+                    continue;
+                echoes++;
+                clients[i]->Send(message, messageBytes, HIGH_PRIORITY, RELIABLE_ORDERED, 0, p->systemAddress, false);
+            }
+        }
+        RakSleep(0);
+    }
+    double elapsed = (double) (RakNet::GetTimeUS() - start) / 1000000.0;
+    uint64_t bytesReceived, bytesSent;
+    GetServerBytes(servers, numServers, &bytesReceived, &bytesSent);
+    serverBytesReceived = bytesReceived - serverBytesReceived;
+    serverBytesSent = bytesSent - serverBytesSent;
+    printf("%-9s %5i/%-5i %12.0f %10.2f %14.0f %14.0f\n", secure ? "Secure" : "Insecure", connectedCount, numConnections,
+           (double) echoes / elapsed, (double) echoes * messageBytes * 2 / elapsed / 1000000.0,
+           (double) serverBytesReceived / elapsed, (double) serverBytesSent / elapsed);
+
+    free(message);
+    for (i = 0; i < numClients; i++)
+    {
+        clients[i]->Shutdown(0);
+        RakPeerInterface::DestroyInstance(clients[i]);
+    }
+    delete [] clients;
+    for (i = 0; i < numServers; i++)
+    {
+        servers[i]->Shutdown(0);
+        RakPeerInterface::DestroyInstance(servers[i]);
+    }
+    delete [] servers;
+    delete [] serverPorts;
+}
+
+int main(int argc, char **argv)
+{
+    int numConnections = argc > 1 ? atoi(argv[1]) : 1000;
+    int seconds = argc > 2 ? atoi(argv[2]) : 10;
+    int messageBytes = argc > 3 ? atoi(argv[3]) : 1000;
+    int numServers = argc > 5 ? atoi(argv[5]) : 20;
+    if (numConnections < 1 || seconds < 1 || messageBytes < 1 || numServers < 1)
+    {
+        printf("Usage: SecureThroughputBenchmark [connections] [seconds] [messageBytes] [encryptThreads] [serverPeers]\n");
+        return 1;
+    }
+    if (numServers > numConnections)
+        numServers = numConnections;
+
+    printf("%i connections to %i server peers, %i byte messages, %i in flight per connection, %i seconds\n",
+           numConnections, numServers, messageBytes, MESSAGES_IN_FLIGHT, seconds);
+#ifdef LIBCAT_SECURITY
+    // 0 picks one less than the number of processors
+    if (argc > 4)
+        EncryptThread::SetNumberOfThreads(atoi(argv[4]));
+    printf("ChaCha keystream: %s\n", cat::ChaChaOutput::GetImplementation());
+#endif
+    printf("%-9s %11s %12s %10s %14s %14s\n", "", "Connected", "Echoes/s", "MB/s", "Server in B/s", "Server out B/s");
+    Run(false, numConnections, numServers, seconds, messageBytes);
+#ifdef LIBCAT_SECURITY
+    Run(true, numConnections, numServers, seconds, messageBytes);
+#else
+    printf("Secure run skipped, LIBCAT_SECURITY is not defined\n");
+#endif
+    return 0;
+}
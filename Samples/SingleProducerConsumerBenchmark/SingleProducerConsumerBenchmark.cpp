@@ -0,0 +1,323 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Compares SingleProducerConsumer, which grows a linked list of blocks, with the fixed size SingleProducerConsumerRing.
+// First checks that a small ring keeps its elements in order when it fills up and wraps around, one at a time and in batches,
+// from one thread and then from two. Returns 1 if it does not.
+// Throughput: one thread writes numbers, another reads them, one at a time, and for the ring also in batches.
+// Latency: two threads pass a number back and forth through two queues, reported per one way trip.
+// The threads spin, yielding, while a queue is empty or full. With one core, that measures the scheduler as much as the queue.
+// Usage: SingleProducerConsumerBenchmark [operations] [roundTrips]
+
+#include "SingleProducerConsumer.h"
+#include "SingleProducerConsumerRing.h"
+#include "RakThread.h"
+#include "GetTime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+
+using namespace RakNet;
+
+static const unsigned int BATCH_SIZE = 64;
+
+struct LinkedQueue
+{
+    DataStructures::SingleProducerConsumer<unsigned int> queue;
+    bool Push(unsigned int value)
+    {
+        *queue.WriteLock() = value;
+        queue.WriteUnlock();
+        return true;
+    }
+    bool Pop(unsigned int *value)
+    {
+        unsigned int *p = queue.ReadLock();
+        if (p == 0)
+            return false;
+        *value = *p;
+        queue.ReadUnlock();
+        return true;
+    }
+};
+
+struct RingQueue
+{
+    DataStructures::SingleProducerConsumerRing<unsigned int> queue;
+    bool Push(unsigned int value) {return queue.Push(value);}
+    bool Pop(unsigned int *value) {return queue.Pop(value);}
+};
+
+template <class Queue>
+struct Throughput
+{
+    Queue queue;
+    unsigned int operations;
+    std::atomic<bool> done;
+};
+
+template <class Queue>
+RAK_THREAD_DECLARATION(WriteThread)
+{
+    Throughput<Queue> *t = (Throughput<Queue> *) arguments;
+    for (unsigned int i = 0; i < t->operations; i++)
+    {
+        while (t->queue.Push(i) == false)
+            std::this_thread::yield();
+    }
+    t->done = true;
+    return 0;
+}
+
+RAK_THREAD_DECLARATION(WriteBatchThread)
+{
+    Throughput<RingQueue> *t = (Throughput<RingQueue> *) arguments;
+    unsigned int i = 0;
+    while (i < t->operations)
+    {
+        unsigned int count = t->operations - i < BATCH_SIZE ? t->operations - i : BATCH_SIZE;
+        unsigned int *slots = t->queue.queue.WriteLock(&count);
+        if (slots == 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        for (unsigned int j = 0; j < count; j++)
+            slots[j] = i++;
+        t->queue.queue.WriteUnlock(count);
+    }
+    t->done = true;
+    return 0;
+}
+
+// \return How many numbers were read
+template <class Queue>
+static unsigned int ReadOne(Queue *queue, unsigned int *expected, bool *inOrder)
+{
+    unsigned int value;
+    if (queue->Pop(&value) == false)
+        return 0;
+    if (value != (*expected)++)
+        *inOrder = false;
+    return 1;
+}
+
+static unsigned int ReadBatch(RingQueue *queue, unsigned int *expected, bool *inOrder)
+{
+    unsigned int count = BATCH_SIZE;
+    unsigned int *values = queue->queue.ReadLock(&count);
+    if (values == 0)
+        return 0;
+    for (unsigned int j = 0; j < count; j++)
+    {
+        if (values[j] != (*expected)++)
+            *inOrder = false;
+    }
+    queue->queue.ReadUnlock(count);
+    return count;
+}
+
+template <class Queue>
+static void RunThroughput(const char *name, Throughput<Queue> *t, bool batched)
+{
+    t->done = false;
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    if (batched)
+        RakThread::Create(WriteBatchThread, t);
+    else
+        RakThread::Create(WriteThread<Queue>, t);
+
+    unsigned int expected = 0;
+    bool inOrder = true;
+    while (expected < t->operations)
+    {
+        unsigned int read = batched ? ReadBatch((RingQueue *) &t->queue, &expected, &inOrder) : ReadOne(&t->queue, &expected, &inOrder);
+        if (read == 0)
+            std::this_thread::yield();
+    }
+    RakNet::TimeUS elapsed = RakNet::GetTimeUS() - start;
+    while (t->done == false)
+        std::this_thread::yield();
+
+    printf("%-40s %12.0f ops/s%s\n", name, elapsed ? t->operations * 1000000.0 / elapsed : 0.0, inOrder ? "" : "  OUT OF ORDER");
+}
+
+// Pops \a count elements one at a time, which should be \a expected onwards
+static bool PopInOrder(DataStructures::SingleProducerConsumerRing<unsigned int> *ring, unsigned int count, unsigned int *expected)
+{
+    unsigned int value;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (ring->Pop(&value) == false || value != (*expected)++)
+            return false;
+    }
+    return true;
+}
+
+static bool RunOrderingTest(void)
+{
+    bool ok = true;
+    DataStructures::SingleProducerConsumerRing<unsigned int> ring(5);
+    unsigned int next = 0, expected = 0;
+    unsigned int value;
+
+    // Rounded up to 8. Fill it, then wrap around it twice, one at a time.
+    ok = ok && ring.GetCapacity() == 8;
+    for (unsigned int round = 0; round < 3 && ok; round++)
+    {
+        while (ring.Push(next))
+            next++;
+        ok = ok && ring.Size() == 8 && ring.WriteLock() == 0 && next - expected == 8;
+        ok = ok && PopInOrder(&ring, 3, &expected);
+        ok = ok && ring.Push(next++) && ring.Push(next++) && ring.Push(next++) && ring.Push(next) == false;
+        ok = ok && PopInOrder(&ring, 8, &expected) && ring.Pop(&value) == false && ring.IsEmpty();
+    }
+    printf("%-40s %s\n", "Fill and wrap, one at a time", ok ? "Passed" : "FAILED");
+
+    // Batches of varying size, which stop at the end of the buffer, and reads that give some elements back
+    bool batchesOk = true;
+    unsigned int seed = 1;
+    for (unsigned int i = 0; i < 100000 && batchesOk; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        unsigned int count = (seed >> 16) % 9 + 1;
+        unsigned int *slots = ring.WriteLock(&count);
+        if (slots)
+        {
+            for (unsigned int j = 0; j < count; j++)
+                slots[j] = next + j;
+            // Sometimes write fewer than were locked
+            unsigned int written = (seed >> 24) % 4 == 0 ? count / 2 : count;
+            next += written;
+            ring.WriteUnlock(written);
+        }
+
+        count = (seed >> 20) % 9 + 1;
+        unsigned int *values = ring.ReadLock(&count);
+        if (values)
+        {
+            unsigned int read = (seed >> 28) % 4 == 0 ? count / 2 : count;
+            for (unsigned int j = 0; j < count; j++)
+            {
+                if (values[j] != expected + j)
+                    batchesOk = false;
+            }
+            expected += read;
+            ring.ReadUnlock(read);
+        }
+        if (ring.Size() != next - expected || ring.Size() > 8)
+            batchesOk = false;
+    }
+    batchesOk = batchesOk && PopInOrder(&ring, next - expected, &expected) && ring.IsEmpty();
+    printf("%-40s %s\n", "Fill and wrap, in batches", batchesOk ? "Passed" : "FAILED");
+    ok = ok && batchesOk;
+
+    // From two threads, with the ring full or empty most of the time
+    Throughput<RingQueue> *t = new Throughput<RingQueue>;
+    t->operations = 1000000;
+    t->queue.queue.SetCapacity(4);
+    bool threadsOk = true;
+    for (int batched = 0; batched < 2; batched++)
+    {
+        t->queue.queue.Clear();
+        t->done = false;
+        RakThread::Create(batched ? WriteBatchThread : WriteThread<RingQueue>, t);
+        expected = 0;
+        while (expected < t->operations)
+        {
+            unsigned int read = batched ? ReadBatch(&t->queue, &expected, &threadsOk) : ReadOne(&t->queue, &expected, &threadsOk);
+            if (read == 0)
+                std::this_thread::yield();
+        }
+        while (t->done == false)
+            std::this_thread::yield();
+    }
+    delete t;
+    printf("%-40s %s\n", "Fill and wrap, from two threads", threadsOk ? "Passed" : "FAILED");
+    return ok && threadsOk;
+}
+
+template <class Queue>
+struct PingPong
+{
+    Queue ping, pong;
+    unsigned int roundTrips;
+    std::atomic<bool> done;
+};
+
+template <class Queue>
+RAK_THREAD_DECLARATION(EchoThread)
+{
+    PingPong<Queue> *p = (PingPong<Queue> *) arguments;
+    unsigned int value;
+    for (unsigned int i = 0; i < p->roundTrips; i++)
+    {
+        while (p->ping.Pop(&value) == false)
+            std::this_thread::yield();
+        while (p->pong.Push(value + 1) == false)
+            std::this_thread::yield();
+    }
+    p->done = true;
+    return 0;
+}
+
+template <class Queue>
+static void RunLatency(const char *name, unsigned int roundTrips)
+{
+    PingPong<Queue> *p = new PingPong<Queue>;
+    p->roundTrips = roundTrips;
+    p->done = false;
+    RakThread::Create(EchoThread<Queue>, p);
+
+    bool correct = true;
+    unsigned int value;
+    RakNet::TimeUS start = RakNet::GetTimeUS();
+    for (unsigned int i = 0; i < roundTrips; i++)
+    {
+        p->ping.Push(i);
+        while (p->pong.Pop(&value) == false)
+            std::this_thread::yield();
+        if (value != i + 1)
+            correct = false;
+    }
+    RakNet::TimeUS elapsed = RakNet::GetTimeUS() - start;
+
+    while (p->done == false)
+        std::this_thread::yield();
+    delete p;
+    printf("%-40s %12.0f ns one way%s\n", name, roundTrips ? elapsed * 1000.0 / (2.0 * roundTrips) : 0.0, correct ? "" : "  WRONG REPLY");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int operations = argc > 1 ? (unsigned int) atoi(argv[1]) : 10000000;
+    unsigned int roundTrips = argc > 2 ? (unsigned int) atoi(argv[2]) : 100000;
+    printf("%u operations, %u round trips, %u hardware threads\n", operations, roundTrips, std::thread::hardware_concurrency());
+
+    if (RunOrderingTest() == false)
+        return 1;
+
+    Throughput<LinkedQueue> *linked = new Throughput<LinkedQueue>;
+    linked->operations = operations;
+    RunThroughput("SingleProducerConsumer", linked, false);
+    delete linked;
+
+    Throughput<RingQueue> *ring = new Throughput<RingQueue>;
+    ring->operations = operations;
+    RunThroughput("SingleProducerConsumerRing", ring, false);
+    ring->queue.queue.Clear();
+    RunThroughput("SingleProducerConsumerRing, batches of 64", ring, true);
+    delete ring;
+
+    RunLatency<LinkedQueue>("SingleProducerConsumer", roundTrips);
+    RunLatency<RingQueue>("SingleProducerConsumerRing", roundTrips);
+    return 0;
+}
@@ -0,0 +1,444 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Measures a TCPInterface server with many connections, over loopback.
+// Plain sockets connect, then in each round every one of them sends a short message and waits for the server to echo it.
+// With select() the server could not watch more sockets than FD_SETSIZE, 1024 on Linux. Allow the server a file descriptor per connection (ulimit -n).
+// Except on Windows, the other ends are in child processes of CONNECTIONS_PER_PROCESS each, bound to 127.0.0.2, 127.0.0.3, ... so the ephemeral ports of one address do not run out.
+// Then a TCPInterface client receives a bulk transfer from the server, which shows the rate of one connection, once with Send() and once with SendBuffer().
+// Usage: TCPInterfaceScaleTest [connections] [rounds] [port] [bulkMessageBytes]
+
+#include "TCPInterface.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include "DS_List.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include "WindowsIncludes.h"
+#define poll WSAPoll
+typedef WSAPOLLFD pollfd;
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#define closesocket close
+typedef int SOCKET;
+#endif
+
+using namespace RakNet;
+
+static const int MESSAGE_BYTES = 32;
+static const size_t BULK_BYTES = (size_t) 256 << 20;
+// Data the server queues for the bulk client before waiting for it to be sent
+static const unsigned int BULK_QUEUED_BYTES = 4 << 20;
+
+// Connections from each source address, below the size of the default ephemeral port range
+static const int CONNECTIONS_PER_ADDRESS = 20000;
+#ifndef _WIN32
+static const int CONNECTIONS_PER_PROCESS = 10000;
+#endif
+
+static int connectionsAccepted, connectionsLost;
+
+// Echoes everything the server receives
+static void UpdateServer(TCPInterface *server)
+{
+    while (server->HasNewIncomingConnection() != UNASSIGNED_SYSTEM_ADDRESS)
+        connectionsAccepted++;
+    while (server->HasLostConnection() != UNASSIGNED_SYSTEM_ADDRESS)
+        connectionsLost++;
+    Packet *p;
+    while ((p = server->Receive()) != 0)
+    {
+        server->Send((const char *) p->data, p->length, p->systemAddress, false);
+        server->DeallocatePacket(p);
+    }
+}
+
+static void SetNonBlocking(SOCKET s)
+{
+#ifdef _WIN32
+    unsigned long nonblocking = 1;
+    ioctlsocket(s, FIONBIO, &nonblocking);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+// Sends BULK_BYTES from the server to the client. With sendBuffer, each message is written into a buffer from AllocateSendBuffer(), which is queued without copying.
+static void RunBulk(TCPInterface *server, TCPInterface *client, SystemAddress clientAddress, int bulkMessageBytes, bool sendBuffer)
+{
+    char *bulkMessage = new char[bulkMessageBytes];
+    memset(bulkMessage, 0, bulkMessageBytes);
+    size_t bytesSent = 0, bytesReceived = 0;
+    RakNet::TimeUS bulkStart = RakNet::GetTimeUS();
+    while (bytesReceived < BULK_BYTES && RakNet::GetTimeUS() - bulkStart < 30000000)
+    {
+        while (bytesSent < BULK_BYTES && server->GetOutgoingDataBufferSize(clientAddress) < BULK_QUEUED_BYTES)
+        {
+            if (sendBuffer)
+            {
+                // A real sender would produce its data here, rather than copying it in
+                char *buffer = server->AllocateSendBuffer(bulkMessageBytes);
+                if (buffer == 0)
+                    break;
+                buffer[0] = 0;
+                server->SendBuffer(buffer, bulkMessageBytes, clientAddress);
+            }
+            else
+                server->Send(bulkMessage, bulkMessageBytes, clientAddress, false);
+            bytesSent += bulkMessageBytes;
+        }
+        Packet *p;
+        while ((p = client->Receive()) != 0)
+        {
+            bytesReceived += p->length;
+            client->DeallocatePacket(p);
+        }
+        RakSleep(0);
+    }
+    double seconds = (double) (RakNet::GetTimeUS() - bulkStart) / 1000000.0;
+    printf("Server to client in %i byte messages%s: %.0f MB in %.2f s, %.1f MB/s\n", bulkMessageBytes, sendBuffer ? " with SendBuffer()" : "",
+        (double) bytesReceived / 1000000.0, seconds, (double) bytesReceived / 1000000.0 / seconds);
+    delete [] bulkMessage;
+}
+
+// The client ends of some of the connections, which send a message on each and wait for the echoes
+struct ClientGroup
+{
+    int firstConnection;
+    DataStructures::List<SOCKET> sockets;
+    pollfd *pollFds;
+    int *bytesEchoed;
+    int echoed;
+
+    ClientGroup() : pollFds(0), bytesEchoed(0) {}
+    ~ClientGroup()
+    {
+        for (unsigned int i = 0; i < sockets.Size(); i++)
+            closesocket(sockets[i]);
+        delete [] pollFds;
+        delete [] bytesEchoed;
+    }
+
+    // \param[in] server If in this process, it is updated while connecting
+    bool Connect(const sockaddr_in &serverAddress, int first, int count, TCPInterface *server)
+    {
+        firstConnection = first;
+        for (int i = first; i < first + count; i++)
+        {
+            SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+            if ((int) s == -1)
+            {
+                printf("Connection %i failed to get a socket. Raise the file descriptor limit, or use fewer connections.\n", i);
+                return false;
+            }
+            sockets.Push(s, _FILE_AND_LINE_);
+            sockaddr_in sourceAddress;
+            memset(&sourceAddress, 0, sizeof(sourceAddress));
+            sourceAddress.sin_family = AF_INET;
+            sourceAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + i / CONNECTIONS_PER_ADDRESS);
+#ifdef IP_BIND_ADDRESS_NO_PORT
+            // Choose the port when connecting, so it only has to be unique for this address and the server's
+            int noPort = 1;
+            setsockopt(s, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, (const char *) &noPort, sizeof(noPort));
+#endif
+            if (bind(s, (sockaddr *) &sourceAddress, sizeof(sourceAddress)) != 0 ||
+                connect(s, (sockaddr *) &serverAddress, sizeof(serverAddress)) != 0)
+            {
+                printf("Connection %i failed to connect.\n", i);
+                return false;
+            }
+            SetNonBlocking(s);
+            // The listen queue is short, so accept as we go
+            if (server && (i & 63) == 0)
+                UpdateServer(server);
+        }
+        pollFds = new pollfd[count];
+        bytesEchoed = new int[count];
+        return true;
+    }
+
+    void Send(int round)
+    {
+        char message[MESSAGE_BYTES];
+        for (unsigned int i = 0; i < sockets.Size(); i++)
+        {
+            memset(message, 'a' + (firstConnection + i + round) % 26, MESSAGE_BYTES);
+            send(sockets[i], message, MESSAGE_BYTES, 0);
+            bytesEchoed[i] = 0;
+        }
+        echoed = 0;
+    }
+
+    // Waits up to a millisecond for echoes
+    // \return false if one had the wrong data
+    bool Receive(int round)
+    {
+        int count = (int) sockets.Size();
+        for (int i = 0; i < count; i++)
+        {
+            pollFds[i].fd = sockets[i];
+            pollFds[i].events = POLLIN;
+            pollFds[i].revents = 0;
+        }
+        if (poll(pollFds, count, 1) <= 0)
+            return true;
+        char message[MESSAGE_BYTES];
+        for (int i = 0; i < count; i++)
+        {
+            if ((pollFds[i].revents & POLLIN) == 0)
+                continue;
+            int received = recv(sockets[i], message, MESSAGE_BYTES, 0);
+            if (received <= 0)
+                continue;
+            for (int j = 0; j < received; j++)
+            {
+                if (message[j] != 'a' + (firstConnection + i + round) % 26)
+                {
+                    printf("Connection %i got the wrong data\n", firstConnection + i);
+                    return false;
+                }
+            }
+            bytesEchoed[i] += received;
+            if (bytesEchoed[i] == MESSAGE_BYTES)
+                echoed++;
+        }
+        return true;
+    }
+
+    bool IsEchoed(void) const {return echoed == (int) sockets.Size();}
+};
+
+#ifndef _WIN32
+// A child process with some of the client ends. It is told the round over one pipe, and answers over another.
+struct ClientProcess
+{
+    pid_t pid;
+    int commands, replies;
+};
+
+// Runs in the child. Waits to be told to connect, then replies 'c' once connected, then for each round 'e' once every connection echoed, 'x' on the wrong data, and 't' on a timeout.
+static void RunClientProcess(const sockaddr_in &serverAddress, int first, int count, int commands, int replies)
+{
+    int round;
+    if (read(commands, &round, sizeof(round)) != sizeof(round))
+        return;
+    ClientGroup group;
+    char reply = group.Connect(serverAddress, first, count, 0) ? 'c' : 'x';
+    if (write(replies, &reply, 1) != 1 || reply != 'c')
+        return;
+    while (read(commands, &round, sizeof(round)) == sizeof(round) && round >= 0)
+    {
+        group.Send(round);
+        reply = 't';
+        RakNet::TimeUS roundStart = RakNet::GetTimeUS();
+        while (RakNet::GetTimeUS() - roundStart < 10000000)
+        {
+            if (group.Receive(round) == false)
+            {
+                reply = 'x';
+                break;
+            }
+            if (group.IsEchoed())
+            {
+                reply = 'e';
+                break;
+            }
+        }
+        if (write(replies, &reply, 1) != 1)
+            return;
+    }
+}
+
+// Updates the server until each child replies, or timeoutMs passes
+// \return How many replied \a expected
+static int WaitForClientProcesses(TCPInterface *server, DataStructures::List<ClientProcess> &processes, char expected, RakNet::TimeMS timeoutMs)
+{
+    int replied = 0, matched = 0;
+    DataStructures::List<bool> done;
+    for (unsigned int i = 0; i < processes.Size(); i++)
+        done.Push(false, _FILE_AND_LINE_);
+    RakNet::TimeMS startTime = RakNet::GetTimeMS();
+    while (replied < (int) processes.Size() && RakNet::GetTimeMS() - startTime < timeoutMs)
+    {
+        UpdateServer(server);
+        for (unsigned int i = 0; i < processes.Size(); i++)
+        {
+            char reply;
+            if (done[i] || read(processes[i].replies, &reply, 1) != 1)
+                continue;
+            done[i] = true;
+            replied++;
+            if (reply == expected)
+                matched++;
+        }
+        RakSleep(0);
+    }
+    return matched;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    int numConnections = argc > 1 ? atoi(argv[1]) : 2000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+    unsigned short port = (unsigned short) (argc > 3 ? atoi(argv[3]) : 61200);
+    int bulkMessageBytes = argc > 4 ? atoi(argv[4]) : 1000;
+    if (numConnections < 1 || numConnections > 65000 || rounds < 1 || bulkMessageBytes < 1)
+    {
+        printf("Usage: TCPInterfaceScaleTest [connections] [rounds] [port] [bulkMessageBytes]\n");
+        return 1;
+    }
+
+    sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons(port);
+    serverAddress.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+#ifndef _WIN32
+    // Before the server starts, so the children have none of its sockets or threads
+    DataStructures::List<ClientProcess> processes;
+    for (int first = 0; first < numConnections; first += CONNECTIONS_PER_PROCESS)
+    {
+        int count = numConnections - first < CONNECTIONS_PER_PROCESS ? numConnections - first : CONNECTIONS_PER_PROCESS;
+        int commandPipe[2], replyPipe[2];
+        if (pipe(commandPipe) != 0 || pipe(replyPipe) != 0)
+            return 1;
+        ClientProcess process;
+        process.pid = fork();
+        if (process.pid == 0)
+        {
+            // Only the ends of its own pipes
+            close(commandPipe[1]);
+            close(replyPipe[0]);
+            RunClientProcess(serverAddress, first, count, commandPipe[0], replyPipe[1]);
+            _exit(0);
+        }
+        close(commandPipe[0]);
+        close(replyPipe[1]);
+        process.commands = commandPipe[1];
+        process.replies = replyPipe[0];
+        fcntl(process.replies, F_SETFL, fcntl(process.replies, F_GETFL, 0) | O_NONBLOCK);
+        processes.Push(process, _FILE_AND_LINE_);
+    }
+#endif
+
+    TCPInterface *server = TCPInterface::GetInstance();
+    if (server->Start(port, (unsigned short) (numConnections + 1), 0, -99999, AF_INET, "127.0.0.1") == false)
+    {
+        printf("Server failed to start on port %i\n", port);
+        return 1;
+    }
+
+    RakNet::TimeMS startTime = RakNet::GetTimeMS();
+#ifdef _WIN32
+    ClientGroup *clients = new ClientGroup;
+    if (clients->Connect(serverAddress, 0, numConnections, server) == false)
+        return 1;
+#else
+    for (unsigned int i = 0; i < processes.Size(); i++)
+    {
+        int start = 0;
+        if (write(processes[i].commands, &start, sizeof(start)) != sizeof(start))
+            return 1;
+    }
+    if (WaitForClientProcesses(server, processes, 'c', 60000) < (int) processes.Size())
+        printf("Not every client process connected\n");
+#endif
+    while (connectionsAccepted < numConnections && RakNet::GetTimeMS() - startTime < 60000)
+    {
+        UpdateServer(server);
+        RakSleep(1);
+    }
+    printf("%i/%i connections accepted in %u ms\n", connectionsAccepted, numConnections, RakNet::GetTimeMS() - startTime);
+
+    double totalMs = 0, worstMs = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        RakNet::TimeUS roundStart = RakNet::GetTimeUS();
+#ifdef _WIN32
+        clients->Send(round);
+        while (clients->IsEchoed() == false && RakNet::GetTimeUS() - roundStart < 10000000)
+        {
+            UpdateServer(server);
+            if (clients->Receive(round) == false)
+                return 1;
+        }
+        bool echoed = clients->IsEchoed();
+#else
+        for (unsigned int i = 0; i < processes.Size(); i++)
+        {
+            if (write(processes[i].commands, &round, sizeof(round)) != sizeof(round))
+                return 1;
+        }
+        bool echoed = WaitForClientProcesses(server, processes, 'e', 11000) == (int) processes.Size();
+#endif
+        double ms = (double) (RakNet::GetTimeUS() - roundStart) / 1000.0;
+        totalMs += ms;
+        if (ms > worstMs)
+            worstMs = ms;
+        if (echoed == false)
+            printf("Round %i: not every connection echoed\n", round);
+    }
+    printf("Echo to every connection: %.1f ms average, %.1f ms worst, over %i rounds\n", totalMs / rounds, worstMs, rounds);
+
+#ifdef _WIN32
+    delete clients;
+#else
+    // A negative round tells the children to close their sockets and exit
+    int quit = -1;
+    for (unsigned int i = 0; i < processes.Size(); i++)
+    {
+        if (write(processes[i].commands, &quit, sizeof(quit)) != sizeof(quit))
+            return 1;
+        close(processes[i].commands);
+    }
+#endif
+    startTime = RakNet::GetTimeMS();
+    while (connectionsLost < numConnections && RakNet::GetTimeMS() - startTime < 10000)
+    {
+        UpdateServer(server);
+        RakSleep(1);
+    }
+    printf("%i/%i lost connections reported, %u left\n", connectionsLost, numConnections, server->GetConnectionCount());
+#ifndef _WIN32
+    for (unsigned int i = 0; i < processes.Size(); i++)
+    {
+        waitpid(processes[i].pid, 0, 0);
+        close(processes[i].replies);
+    }
+#endif
+
+    // One connection, server to client
+    TCPInterface *client = TCPInterface::GetInstance();
+    client->Start(0, 0);
+    client->Connect("127.0.0.1", port, true);
+    SystemAddress clientAddress = UNASSIGNED_SYSTEM_ADDRESS;
+    startTime = RakNet::GetTimeMS();
+    while ((clientAddress = server->HasNewIncomingConnection()) == UNASSIGNED_SYSTEM_ADDRESS && RakNet::GetTimeMS() - startTime < 5000)
+        RakSleep(1);
+    RunBulk(server, client, clientAddress, bulkMessageBytes, false);
+    RunBulk(server, client, clientAddress, bulkMessageBytes, true);
+
+    client->Stop();
+    TCPInterface::DestroyInstance(client);
+    server->Stop();
+    TCPInterface::DestroyInstance(server);
+    return 0;
+}
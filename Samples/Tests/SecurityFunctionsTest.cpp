@@ -43,6 +43,7 @@ Client failed to connect after banlist removal with clear function
 Client did not connect encrypted
 Client connected encrypted but shouldn't have
 IsInSecurityExceptionList does not register localhost addition
+A ban pattern did not match the addresses it covers
 
 RakPeerInterface Functions used, tested indirectly by its use:
 Startup
@@ -322,6 +323,78 @@ int SecurityFunctionsTest::RunTest(DataStructures::List<RakString> params,bool i
 		client->CloseConnection (serverAddress,true,0,LOW_PRIORITY); 
 	}
 
+	if (isVerbose)
+		printf("Testing wildcard, partial octet and CIDR ban patterns\n");
+
+	// Each address is checked after all of the patterns are added
+	static const char *banPatterns[]=
+	{
+		"128.0.0.*",
+		"10.1*",
+		"192.168.0.0/16",
+		"172.16.0.0/12",
+		"1.2.3.4/33",	// Invalid, longer than the address
+		"300.1.1.1",	// Invalid octet
+		"5.6.7",	// Invalid, too short
+#if RAKNET_SUPPORT_IPV6==1
+		"2001:db8::/32",
+		"::ffff:203.0.113.0/120",	// IPv4 mapped, so it bans 203.0.113.*
+#endif
+	};
+	struct BanCheck
+	{
+		const char *address;
+		bool banned;
+	};
+	static const BanCheck banChecks[]=
+	{
+		{"128.0.0.5", true},
+		{"128.0.1.5", false},
+		{"10.1.2.3", true},
+		{"10.15.2.3", true},
+		{"10.199.2.3", true},
+		{"10.2.0.1", false},
+		{"11.1.0.1", false},
+		{"192.168.200.1", true},
+		{"192.169.0.1", false},
+		{"172.31.255.255", true},
+		{"172.32.0.0", false},
+		{"1.2.3.4", false},
+		{"5.6.7.0", false},
+#if RAKNET_SUPPORT_IPV6==1
+		{"2001:db8:1::1", true},
+		{"2001:db9::1", false},
+		{"203.0.113.7", true},
+		{"::ffff:203.0.113.7", true},
+		{"203.0.114.7", false},
+#endif
+	};
+
+	unsigned int banIndex;
+	for (banIndex=0; banIndex < sizeof(banPatterns)/sizeof(banPatterns[0]); banIndex++)
+		server->AddToBanList(banPatterns[banIndex],0);
+	for (banIndex=0; banIndex < sizeof(banChecks)/sizeof(banChecks[0]); banIndex++)
+	{
+		if (server->IsBanned(banChecks[banIndex].address)!=banChecks[banIndex].banned)
+		{
+			if (isVerbose)
+			{
+				printf("%s was %s\n",banChecks[banIndex].address,banChecks[banIndex].banned ? "not banned" : "banned");
+				DebugTools::ShowError("A ban pattern did not match the addresses it covers\n",!noPauses && isVerbose,__LINE__,__FILE__);
+			}
+			return 13;
+		}
+	}
+
+	server->RemoveFromBanList("192.168.0.0/16");
+	if (server->IsBanned("192.168.200.1") || server->IsBanned("128.0.0.5")==false)
+	{
+		if (isVerbose)
+			DebugTools::ShowError("A ban pattern did not match the addresses it covers\n",!noPauses && isVerbose,__LINE__,__FILE__);
+		return 13;
+	}
+	server->ClearBanList();
+
 /*//Disabled because of statistics changes
 
 	if (isVerbose)
@@ -578,6 +651,10 @@ RakString SecurityFunctionsTest::ErrorCodeToString(int errorCode)
 		return "IsInSecurityExceptionList does not register localhost addition";
 		break;
 
+	case 13:
+		return "A ban pattern did not match the addresses it covers";
+		break;
+
 	default:
 		return "Undefined Error";
 	}
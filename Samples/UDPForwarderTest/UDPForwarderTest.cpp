@@ -0,0 +1,241 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Checks UDPForwarder over loopback, with plain UDP sockets on both ends of each forwarding entry.
+// Forwarding: numbered datagrams are relayed both ways, in bursts, through one entry and then through many at once.
+// StartForwarding() refuses an entry that already exists, and StopForwarding() removes entries.
+// Timeout: an entry that keeps forwarding for three times its timeout stays, and once it goes quiet it is removed
+// by the timer wheel within its timeout plus a little slack, after which nothing is relayed.
+// Usage: UDPForwarderTest [pairs]
+
+#include "UDPForwarder.h"
+#include "SocketIncludes.h"
+#include "GetTime.h"
+#include "RakSleep.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace RakNet;
+
+static const RakNet::TimeMS DEFAULT_TIMEOUT_MS = 10000;
+static const RakNet::TimeMS SHORT_TIMEOUT_MS = 500;
+
+// Two sockets, whose datagrams are relayed to each other through forwardingAddress
+struct Pair
+{
+    __UDPSOCKET__ sockets[2];
+    SystemAddress addresses[2];
+    SystemAddress forwardingAddress;
+};
+
+static bool OpenSocket(__UDPSOCKET__ *s, SystemAddress *address)
+{
+    *s = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family=AF_INET;
+    sa.sin_addr.s_addr=inet_addr("127.0.0.1");
+    sa.sin_port=0;
+    socklen_t len = sizeof(sa);
+    if (bind(*s, (sockaddr*) &sa, sizeof(sa))!=0 || getsockname(*s, (sockaddr*) &sa, &len)!=0)
+        return false;
+    address->FromStringExplicitPort("127.0.0.1", ntohs(sa.sin_port), 4);
+    return true;
+}
+
+static bool OpenPair(UDPForwarder *forwarder, Pair *pair, RakNet::TimeMS timeoutMS)
+{
+    if (OpenSocket(&pair->sockets[0], &pair->addresses[0])==false || OpenSocket(&pair->sockets[1], &pair->addresses[1])==false)
+        return false;
+    unsigned short forwardingPort;
+    __UDPSOCKET__ forwardingSocket;
+    if (forwarder->StartForwarding(pair->addresses[0], pair->addresses[1], timeoutMS, "127.0.0.1", AF_INET, &forwardingPort, &forwardingSocket)!=UDPFORWARDER_SUCCESS)
+        return false;
+    pair->forwardingAddress.FromStringExplicitPort("127.0.0.1", forwardingPort, 4);
+    return true;
+}
+
+static void ClosePair(Pair *pair)
+{
+    closesocket(pair->sockets[0]);
+    closesocket(pair->sockets[1]);
+}
+
+static void SendNumber(Pair *pair, int from, unsigned int number)
+{
+    sendto(pair->sockets[from], (const char*) &number, sizeof(number), 0, (const sockaddr*) &pair->forwardingAddress.address.addr4, sizeof(sockaddr_in));
+}
+
+// \return false if nothing arrived within \a timeoutMS
+static bool ReceiveNumber(Pair *pair, int to, unsigned int *number, RakNet::TimeMS timeoutMS)
+{
+    fd_set readFds;
+    FD_ZERO(&readFds);
+    FD_SET(pair->sockets[to], &readFds);
+    timeval tv;
+    tv.tv_sec=timeoutMS / 1000;
+    tv.tv_usec=(timeoutMS % 1000) * 1000;
+    if (select((int) pair->sockets[to]+1, &readFds, 0, 0, &tv)<=0)
+        return false;
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    int bytes = recvfrom(pair->sockets[to], (char*) number, sizeof(*number), 0, (sockaddr*) &from, &fromLen);
+    // Relayed datagrams come from the forwarding socket
+    return bytes==(int) sizeof(*number) && from.sin_port==pair->forwardingAddress.address.addr4.sin_port;
+}
+
+// Sends \a count numbers from socket 0 to socket 1 and back, \a burst at a time, and checks they all arrive in order.
+// Socket 0 sends first, so the forwarder confirms which address is which.
+static bool Exchange(Pair *pairs, unsigned int pairCount, unsigned int count, unsigned int burst)
+{
+    for (unsigned int sent=0; sent < count; sent+=burst)
+    {
+        unsigned int n = count-sent < burst ? count-sent : burst;
+        for (int from=0; from < 2; from++)
+        {
+            for (unsigned int p=0; p < pairCount; p++)
+            {
+                for (unsigned int i=0; i < n; i++)
+                    SendNumber(&pairs[p], from, sent+i);
+            }
+            for (unsigned int p=0; p < pairCount; p++)
+            {
+                for (unsigned int i=0; i < n; i++)
+                {
+                    unsigned int number;
+                    if (ReceiveNumber(&pairs[p], 1-from, &number, 2000)==false || number!=sent+i)
+                    {
+                        printf("Pair %u: datagram %u from socket %d missing or out of order\n", p, sent+i, from);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static bool WaitForUsedEntries(UDPForwarder *forwarder, int expected, RakNet::TimeMS timeoutMS)
+{
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + timeoutMS;
+    while (forwarder->GetUsedForwardEntries()!=expected && RakNet::GetTimeMS() < deadline)
+        RakSleep(1);
+    return forwarder->GetUsedForwardEntries()==expected;
+}
+
+static bool RunForwardingTest(UDPForwarder *forwarder, unsigned int pairCount)
+{
+    Pair *pairs = new Pair[pairCount];
+    unsigned int opened=0;
+    bool ok=true;
+    for (; opened < pairCount && ok; opened++)
+        ok = OpenPair(forwarder, &pairs[opened], DEFAULT_TIMEOUT_MS);
+    if (ok==false)
+        printf("StartForwarding failed for pair %u\n", opened-1);
+
+    // One entry on its own, with bursts longer than one relay batch
+    bool oneOk = ok && Exchange(pairs, 1, 2000, 64);
+    printf("%-40s %s\n", "One entry", oneOk ? "Passed" : "FAILED");
+
+    bool manyOk = oneOk && Exchange(pairs, pairCount, 50, 5);
+    printf("%-40s %s\n", "Many entries at once", manyOk ? "Passed" : "FAILED");
+
+    // In either order
+    unsigned short port;
+    __UDPSOCKET__ s;
+    bool duplicateOk = manyOk &&
+        forwarder->StartForwarding(pairs[0].addresses[0], pairs[0].addresses[1], DEFAULT_TIMEOUT_MS, "127.0.0.1", AF_INET, &port, &s)==UDPFORWARDER_FORWARDING_ALREADY_EXISTS &&
+        forwarder->StartForwarding(pairs[0].addresses[1], pairs[0].addresses[0], DEFAULT_TIMEOUT_MS, "127.0.0.1", AF_INET, &port, &s)==UDPFORWARDER_FORWARDING_ALREADY_EXISTS &&
+        forwarder->GetUsedForwardEntries()==(int) pairCount;
+    printf("%-40s %s\n", "Duplicate entries refused", duplicateOk ? "Passed" : "FAILED");
+
+    // Stop every other entry, half of them with the addresses swapped. The rest must keep working.
+    unsigned int stopped=0;
+    for (unsigned int p=0; p < pairCount; p+=2, stopped++)
+        forwarder->StopForwarding(pairs[p].addresses[(p/2)%2], pairs[p].addresses[1-(p/2)%2]);
+    bool stopOk = duplicateOk && WaitForUsedEntries(forwarder, (int) (pairCount-stopped), 2000);
+    for (unsigned int p=1; p < pairCount && stopOk; p+=2)
+        stopOk = Exchange(&pairs[p], 1, 5, 5);
+    printf("%-40s %s\n", "StopForwarding", stopOk ? "Passed" : "FAILED");
+
+    for (unsigned int p=0; p < opened; p++)
+    {
+        if (p % 2==1)
+            forwarder->StopForwarding(pairs[p].addresses[0], pairs[p].addresses[1]);
+        ClosePair(&pairs[p]);
+    }
+    delete [] pairs;
+    return oneOk && manyOk && duplicateOk && stopOk && WaitForUsedEntries(forwarder, 0, 2000);
+}
+
+static bool RunTimeoutTest(UDPForwarder *forwarder)
+{
+    Pair pair;
+    if (OpenPair(forwarder, &pair, SHORT_TIMEOUT_MS)==false)
+    {
+        printf("StartForwarding failed\n");
+        return false;
+    }
+
+    // Busy for three times the timeout, so the timer wheel has to move the entry on rather than remove it
+    bool ok=true;
+    RakNet::TimeMS quietSince = RakNet::GetTimeMS();
+    RakNet::TimeMS end = quietSince + 3 * SHORT_TIMEOUT_MS;
+    while (ok && RakNet::GetTimeMS() < end)
+    {
+        RakSleep(SHORT_TIMEOUT_MS / 5);
+        ok = forwarder->GetUsedForwardEntries()==1 && Exchange(&pair, 1, 1, 1);
+        quietSince = RakNet::GetTimeMS();
+    }
+    printf("%-40s %s\n", "Busy entry kept", ok ? "Passed" : "FAILED");
+
+    // Quiet, so it should go after the timeout, plus up to one wheel slot and the time to notice
+    bool removed = ok && WaitForUsedEntries(forwarder, 0, SHORT_TIMEOUT_MS * 4);
+    RakNet::TimeMS elapsed = RakNet::GetTimeMS() - quietSince;
+    bool removedOk = removed && elapsed >= SHORT_TIMEOUT_MS - 10 && elapsed <= SHORT_TIMEOUT_MS + 400;
+    if (removed)
+        printf("%-40s %s, after %u ms with a %u ms timeout\n", "Quiet entry removed", removedOk ? "Passed" : "FAILED", elapsed, SHORT_TIMEOUT_MS);
+    else
+        printf("%-40s %s\n", "Quiet entry removed", "FAILED");
+
+    // Nothing is relayed once it is gone
+    bool goneOk = removedOk;
+    if (goneOk)
+    {
+        unsigned int number;
+        SendNumber(&pair, 0, 0);
+        goneOk = ReceiveNumber(&pair, 1, &number, 200)==false;
+        printf("%-40s %s\n", "Removed entry does not forward", goneOk ? "Passed" : "FAILED");
+    }
+
+    ClosePair(&pair);
+    return ok && removedOk && goneOk;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int pairCount = argc > 1 ? atoi(argv[1]) : 100;
+    if (pairCount < 2)
+    {
+        printf("Usage: UDPForwarderTest [pairs]\n");
+        return 1;
+    }
+
+    UDPForwarder forwarder;
+    forwarder.SetMaxForwardEntries((unsigned short) (pairCount+1));
+    forwarder.Startup();
+    bool ok = RunForwardingTest(&forwarder, pairCount);
+    ok = RunTimeoutTest(&forwarder) && ok;
+    forwarder.Shutdown();
+
+    printf(ok ? "Passed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Checks that UDPProxyCoordinator spreads forwarding sessions over the forwarder shards of a UDPProxyServer,
+// and that RakNet connections work through every shard.
+// A coordinator, a server with several shards of two entries each, a source and one target per session run over loopback.
+// The source asks for forwarding to each target in turn. Each shard must end up with two sessions, as the coordinator and
+// the server both report.
+// Then the source connects to each target through its forwarded port and exchanges a message with it.
+// Usage: UDPProxyShardTest [shards]
+
+#include "RakPeerInterface.h"
+#include "UDPProxyCoordinator.h"
+#include "UDPProxyServer.h"
+#include "UDPProxyClient.h"
+#include "MessageIdentifiers.h"
+#include "BitStream.h"
+#include "RakSleep.h"
+#include "GetTime.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace RakNet;
+
+static const unsigned short ENTRIES_PER_SHARD = 2;
+static const unsigned int MAX_SHARDS = 8;
+static const unsigned int MAX_TARGETS = MAX_SHARDS * ENTRIES_PER_SHARD;
+
+enum
+{
+    ID_TEST_HELLO=ID_USER_PACKET_ENUM
+};
+
+enum RequestResult
+{
+    REQUEST_PENDING,
+    REQUEST_FORWARDING,
+    REQUEST_FAILED
+};
+
+struct ClientResultHandler : public UDPProxyClientResultHandler
+{
+    virtual void OnForwardingSuccess(const char *proxyIPAddress, unsigned short proxyPort,
+        SystemAddress proxyCoordinator, SystemAddress sourceAddress, SystemAddress targetAddress, RakNetGUID targetGuid, UDPProxyClient *proxyClientPlugin)
+    {
+        (void) proxyCoordinator; (void) sourceAddress; (void) targetAddress; (void) targetGuid; (void) proxyClientPlugin;
+        proxyAddress.FromStringExplicitPort(proxyIPAddress, proxyPort);
+        result=REQUEST_FORWARDING;
+    }
+    virtual void OnForwardingNotification(const char *proxyIPAddress, unsigned short proxyPort,
+        SystemAddress proxyCoordinator, SystemAddress sourceAddress, SystemAddress targetAddress, RakNetGUID targetGuid, UDPProxyClient *proxyClientPlugin)
+    {
+        (void) proxyIPAddress; (void) proxyPort; (void) proxyCoordinator; (void) sourceAddress; (void) targetAddress; (void) targetGuid; (void) proxyClientPlugin;
+    }
+    virtual void OnNoServersOnline(SystemAddress proxyCoordinator, SystemAddress sourceAddress, SystemAddress targetAddress, RakNetGUID targetGuid, UDPProxyClient *proxyClientPlugin)
+    {
+        (void) proxyCoordinator; (void) sourceAddress; (void) targetAddress; (void) targetGuid; (void) proxyClientPlugin;
+        printf("No servers online\n");
+        result=REQUEST_FAILED;
+    }
+    virtual void OnRecipientNotConnected(SystemAddress proxyCoordinator, SystemAddress sourceAddress, SystemAddress targetAddress, RakNetGUID targetGuid, UDPProxyClient *proxyClientPlugin)
+    {
+        (void) proxyCoordinator; (void) sourceAddress; (void) targetAddress; (void) targetGuid; (void) proxyClientPlugin;
+        printf("Recipient not connected\n");
+        result=REQUEST_FAILED;
+    }
+    virtual void OnAllServersBusy(SystemAddress proxyCoordinator, SystemAddress sourceAddress, SystemAddress targetAddress, RakNetGUID targetGuid, UDPProxyClient *proxyClientPlugin)
+    {
+        (void) proxyCoordinator; (void) sourceAddress; (void) targetAddress; (void) targetGuid; (void) proxyClientPlugin;
+        printf("All servers busy\n");
+        result=REQUEST_FAILED;
+    }
+    virtual void OnForwardingInProgress(const char *proxyIPAddress, unsigned short proxyPort, SystemAddress proxyCoordinator, SystemAddress sourceAddress, SystemAddress targetAddress, RakNetGUID targetGuid, UDPProxyClient *proxyClientPlugin)
+    {
+        (void) proxyIPAddress; (void) proxyPort; (void) proxyCoordinator; (void) sourceAddress; (void) targetAddress; (void) targetGuid; (void) proxyClientPlugin;
+        printf("Forwarding already in progress\n");
+        result=REQUEST_FAILED;
+    }
+
+    RequestResult result;
+    SystemAddress proxyAddress;
+};
+
+struct ServerResultHandler : public UDPProxyServerResultHandler
+{
+    ServerResultHandler() {loggedIn=false;}
+    virtual void OnLoginSuccess(RakString usedPassword, UDPProxyServer *proxyServerPlugin) {(void) usedPassword; (void) proxyServerPlugin; loggedIn=true;}
+    virtual void OnAlreadyLoggedIn(RakString usedPassword, UDPProxyServer *proxyServerPlugin) {(void) usedPassword; (void) proxyServerPlugin; loggedIn=true;}
+    virtual void OnNoPasswordSet(RakString usedPassword, UDPProxyServer *proxyServerPlugin) {(void) usedPassword; (void) proxyServerPlugin; printf("No password set\n");}
+    virtual void OnWrongPassword(RakString usedPassword, UDPProxyServer *proxyServerPlugin) {(void) usedPassword; (void) proxyServerPlugin; printf("Wrong password\n");}
+
+    bool loggedIn;
+};
+
+// Every system, polled together. Messages the test waits for are handled by the callers.
+struct Systems
+{
+    Systems()
+    {
+        targetCount=0;
+        coordinatorConnections=0;
+        for (unsigned int t=0; t < MAX_TARGETS; t++)
+        {
+            connected[t]=false;
+            answered[t]=false;
+        }
+    }
+
+    RakPeerInterface *coordinatorPeer, *serverPeer, *sourcePeer;
+    RakPeerInterface *targetPeers[MAX_TARGETS];
+    unsigned int targetCount;
+    // Per target, whether the source connected to it through the proxy, and whether it answered
+    bool connected[MAX_TARGETS], answered[MAX_TARGETS];
+    SystemAddress proxyAddresses[MAX_TARGETS];
+    unsigned int coordinatorConnections;
+};
+
+static void Poll(Systems *s)
+{
+    Packet *p;
+    for (p=s->coordinatorPeer->Receive(); p; s->coordinatorPeer->DeallocatePacket(p), p=s->coordinatorPeer->Receive())
+    {
+        if (p->data[0]==ID_NEW_INCOMING_CONNECTION)
+            s->coordinatorConnections++;
+    }
+    for (p=s->serverPeer->Receive(); p; s->serverPeer->DeallocatePacket(p), p=s->serverPeer->Receive())
+        ;
+    for (p=s->sourcePeer->Receive(); p; s->sourcePeer->DeallocatePacket(p), p=s->sourcePeer->Receive())
+    {
+        for (unsigned int t=0; t < s->targetCount; t++)
+        {
+            if (p->systemAddress!=s->proxyAddresses[t])
+                continue;
+            if (p->data[0]==ID_CONNECTION_REQUEST_ACCEPTED)
+            {
+                s->connected[t]=true;
+                RakNet::BitStream hello;
+                hello.Write((MessageID) ID_TEST_HELLO);
+                hello.Write(t);
+                s->sourcePeer->Send(&hello, HIGH_PRIORITY, RELIABLE_ORDERED, 0, p->systemAddress, false);
+            }
+            else if (p->data[0]==ID_TEST_HELLO)
+            {
+                RakNet::BitStream bs(p->data, p->length, false);
+                unsigned int index;
+                bs.IgnoreBytes(sizeof(MessageID));
+                if (bs.Read(index) && index==t)
+                    s->answered[t]=true;
+            }
+        }
+    }
+    // Targets echo the hello, which says which target the source meant to reach
+    for (unsigned int t=0; t < s->targetCount; t++)
+    {
+        for (p=s->targetPeers[t]->Receive(); p; s->targetPeers[t]->DeallocatePacket(p), p=s->targetPeers[t]->Receive())
+        {
+            if (p->data[0]==ID_TEST_HELLO)
+                s->targetPeers[t]->Send((const char*) p->data, p->length, HIGH_PRIORITY, RELIABLE_ORDERED, 0, p->systemAddress, false);
+        }
+    }
+}
+
+static bool RequestForwarding(Systems *s, UDPProxyClient *proxyClient, ClientResultHandler *handler, SystemAddress coordinatorAddress,
+                              unsigned int target, RequestResult *result)
+{
+    handler->result=REQUEST_PENDING;
+    proxyClient->RequestForwarding(coordinatorAddress, UNASSIGNED_SYSTEM_ADDRESS, s->targetPeers[target]->GetMyGUID(), 10000);
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 10000;
+    while (handler->result==REQUEST_PENDING && RakNet::GetTimeMS() < deadline)
+    {
+        Poll(s);
+        RakSleep(10);
+    }
+    *result=handler->result;
+    if (handler->result==REQUEST_FORWARDING)
+        s->proxyAddresses[target]=handler->proxyAddress;
+    return handler->result!=REQUEST_PENDING;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int shardCount = argc > 1 ? atoi(argv[1]) : 3;
+    if (shardCount==0 || shardCount > MAX_SHARDS)
+    {
+        printf("Usage: UDPProxyShardTest [shards], with up to %u shards\n", MAX_SHARDS);
+        return 1;
+    }
+
+    Systems s;
+    s.targetCount = shardCount * ENTRIES_PER_SHARD;
+
+    UDPProxyCoordinator coordinator;
+    UDPProxyServer server;
+    UDPProxyClient proxyClient;
+    ClientResultHandler clientHandler;
+    ServerResultHandler serverHandler;
+
+    s.coordinatorPeer = RakPeerInterface::GetInstance();
+    s.coordinatorPeer->AttachPlugin(&coordinator);
+    coordinator.SetRemoteLoginPassword("password");
+    SocketDescriptor coordinatorSd(0,"127.0.0.1");
+    s.coordinatorPeer->Startup(s.targetCount+2, &coordinatorSd, 1);
+    s.coordinatorPeer->SetMaximumIncomingConnections((unsigned short) (s.targetCount+2));
+    SystemAddress coordinatorAddress = s.coordinatorPeer->GetMyBoundAddress();
+
+    s.serverPeer = RakPeerInterface::GetInstance();
+    s.serverPeer->AttachPlugin(&server);
+    server.SetResultHandler(&serverHandler);
+    server.SetForwarderShardCount(shardCount);
+    for (unsigned int i=0; i < shardCount; i++)
+        server.GetForwarderShard(i)->SetMaxForwardEntries(ENTRIES_PER_SHARD);
+    s.sourcePeer = RakPeerInterface::GetInstance();
+    s.sourcePeer->AttachPlugin(&proxyClient);
+    proxyClient.SetResultHandler(&clientHandler);
+
+    RakPeerInterface *connecting[MAX_TARGETS+2];
+    unsigned int connectingCount=0;
+    connecting[connectingCount++]=s.serverPeer;
+    connecting[connectingCount++]=s.sourcePeer;
+    for (unsigned int t=0; t < s.targetCount; t++)
+    {
+        s.targetPeers[t] = RakPeerInterface::GetInstance();
+        connecting[connectingCount++]=s.targetPeers[t];
+    }
+    for (unsigned int i=0; i < connectingCount; i++)
+    {
+        SocketDescriptor sd(0,"127.0.0.1");
+        connecting[i]->Startup(s.targetCount+1, &sd, 1);
+        // Targets accept the source's connection through the proxy
+        connecting[i]->SetMaximumIncomingConnections(1);
+        connecting[i]->Connect(coordinatorAddress.ToString(false), coordinatorAddress.GetPort(), 0, 0);
+    }
+
+    bool ok=true;
+    RakNet::TimeMS deadline = RakNet::GetTimeMS() + 10000;
+    while (s.coordinatorConnections < connectingCount && RakNet::GetTimeMS() < deadline)
+    {
+        Poll(&s);
+        RakSleep(10);
+    }
+    if (s.coordinatorConnections < connectingCount)
+    {
+        printf("Only %u of %u systems connected to the coordinator\n", s.coordinatorConnections, connectingCount);
+        ok=false;
+    }
+
+    // Log in, and wait for the first report of the shard loads
+    SystemAddress serverAddress = s.coordinatorPeer->GetSystemAddressFromGuid(s.serverPeer->GetMyGUID());
+    DataStructures::List<UDPProxyCoordinator::ShardLoad> loads;
+    if (ok)
+    {
+        server.LoginToCoordinator("password", coordinatorAddress);
+        deadline = RakNet::GetTimeMS() + 10000;
+        while ((serverHandler.loggedIn==false || loads.Size()!=shardCount) && RakNet::GetTimeMS() < deadline)
+        {
+            Poll(&s);
+            coordinator.GetServerShardLoad(serverAddress, loads);
+            RakSleep(10);
+        }
+        ok = serverHandler.loggedIn && loads.Size()==shardCount;
+        printf("%-40s %s\n", "Server logged in with its shards", ok ? "Passed" : "FAILED");
+    }
+
+    // Fill every shard, one request at a time
+    bool placementOk=ok;
+    for (unsigned int t=0; placementOk && t < s.targetCount; t++)
+    {
+        RequestResult result;
+        if (RequestForwarding(&s, &proxyClient, &clientHandler, coordinatorAddress, t, &result)==false || result!=REQUEST_FORWARDING)
+        {
+            printf("Forwarding request %u failed\n", t);
+            placementOk=false;
+        }
+    }
+    if (placementOk)
+    {
+        coordinator.GetServerShardLoad(serverAddress, loads);
+        for (unsigned int i=0; i < shardCount; i++)
+        {
+            int used = server.GetForwarderShard(i)->GetUsedForwardEntries();
+            printf("Shard %u: %d sessions on the server, %d on the coordinator\n", i, used, i < loads.Size() ? loads[i].usedForwardEntries : -1);
+            if (used!=ENTRIES_PER_SHARD || i >= loads.Size() || loads[i].usedForwardEntries!=ENTRIES_PER_SHARD)
+                placementOk=false;
+        }
+    }
+    printf("%-40s %s\n", "Sessions spread over the shards", placementOk ? "Passed" : "FAILED");
+    ok = ok && placementOk;
+
+    // Connect to every target through its proxy port. The hello and its echo are sent from Poll().
+    if (ok)
+    {
+        for (unsigned int t=0; t < s.targetCount; t++)
+            s.sourcePeer->Connect(s.proxyAddresses[t].ToString(false), s.proxyAddresses[t].GetPort(), 0, 0);
+        unsigned int answered=0;
+        deadline = RakNet::GetTimeMS() + 10000;
+        while (answered < s.targetCount && RakNet::GetTimeMS() < deadline)
+        {
+            Poll(&s);
+            RakSleep(10);
+            answered=0;
+            for (unsigned int t=0; t < s.targetCount; t++)
+            {
+                if (s.answered[t])
+                    answered++;
+            }
+        }
+        for (unsigned int t=0; t < s.targetCount; t++)
+        {
+            if (s.answered[t]==false)
+                printf("Target %u through %s: %s\n", t, s.proxyAddresses[t].ToString(true), s.connected[t] ? "no answer" : "not connected");
+        }
+        ok = answered==s.targetCount;
+        printf("%-40s %s\n", "Connections through every shard", ok ? "Passed" : "FAILED");
+    }
+
+    for (unsigned int t=0; t < s.targetCount; t++)
+    {
+        s.targetPeers[t]->Shutdown(0);
+        RakPeerInterface::DestroyInstance(s.targetPeers[t]);
+    }
+    s.sourcePeer->Shutdown(0);
+    s.serverPeer->Shutdown(0);
+    s.coordinatorPeer->Shutdown(0);
+    s.sourcePeer->DetachPlugin(&proxyClient);
+    s.serverPeer->DetachPlugin(&server);
+    s.coordinatorPeer->DetachPlugin(&coordinator);
+    RakPeerInterface::DestroyInstance(s.sourcePeer);
+    RakPeerInterface::DestroyInstance(s.serverPeer);
+    RakPeerInterface::DestroyInstance(s.coordinatorPeer);
+
+    printf(ok ? "Passed\n" : "FAILED\n");
+    return ok ? 0 : 1;
+}
@@ -10,6 +10,7 @@
 
 #include "DataCompressor.h"
 #include "DS_HuffmanEncodingTree.h"
+#include "CompressionInterface.h"
 #include "RakAssert.h"
 #include <string.h> // Use string.h rather than memory.h for a console
 #include <cstdlib>
@@ -72,3 +73,58 @@ unsigned DataCompressor::DecompressAndAllocate( RakNet::BitStream * input, unsig
     RakAssert(decompressedBytes==destinationSizeInBytes);
     return destinationSizeInBytes;
 }
+
+void DataCompressor::Compress( unsigned char *userData, unsigned sizeInBytes, RakNet::BitStream * output, CompressionInterface *compressor )
+{
+    unsigned int maxCompressedLength = compressor->GetMaxCompressedLength(sizeInBytes);
+    unsigned char *compressed = (unsigned char*) malloc(maxCompressedLength);
+    unsigned int compressedLength = compressor->Compress(userData, sizeInBytes, compressed, maxCompressedLength);
+    // 0 means the data is stored as is
+    if (compressedLength >= sizeInBytes)
+        compressedLength=0;
+
+    output->WriteCompressed(sizeInBytes);
+    output->WriteCompressed(compressedLength);
+    output->AlignWriteToByteBoundary();
+    if (compressedLength>0)
+        output->Write((const char*) compressed, compressedLength);
+    else
+        output->Write((const char*) userData, sizeInBytes);
+    free(compressed);
+}
+
+unsigned DataCompressor::DecompressAndAllocate( RakNet::BitStream * input, unsigned char **output, CompressionInterface *compressor )
+{
+    unsigned int destinationSizeInBytes, compressedLength;
+    input->ReadCompressed(destinationSizeInBytes);
+    if (input->ReadCompressed(compressedLength)==false || destinationSizeInBytes==0)
+        return 0;
+    input->AlignReadToByteBoundary();
+
+    unsigned int storedLength = compressedLength>0 ? compressedLength : destinationSizeInBytes;
+    if (BITS_TO_BYTES(input->GetNumberOfUnreadBits()) < storedLength)
+    {
+        // Read error
+#ifdef _DEBUG
+        RakAssert(0);
+#endif
+        return 0;
+    }
+
+    *output = (unsigned char*) malloc(destinationSizeInBytes);
+    if (compressedLength==0)
+    {
+        input->Read((char*) *output, destinationSizeInBytes);
+        return destinationSizeInBytes;
+    }
+
+    const unsigned char *compressed = input->GetData() + BITS_TO_BYTES(input->GetReadOffset());
+    input->IgnoreBytes(compressedLength);
+    if (compressor->Decompress(compressed, compressedLength, *output, destinationSizeInBytes)==false)
+    {
+        free(*output);
+        *output=0;
+        return 0;
+    }
+    return destinationSizeInBytes;
+}
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "EncryptThread.h"
+#ifdef LIBCAT_SECURITY
+#include "RakNetSocket2.h"
+#include "RakAssert.h"
+#include <thread>
+
+using namespace RakNet;
+
+int EncryptThread::refCount=0;
+SimpleMutex EncryptThread::refCountMutex;
+unsigned int EncryptThread::numberOfThreads=0;
+ThreadPool<EncryptThread::EncryptThreadBlock*,EncryptThread::EncryptThreadBlock*> *EncryptThread::workers=0;
+std::atomic<unsigned int> EncryptThread::numWorkers(0);
+DataStructures::ThreadsafeAllocatingQueue<EncryptThread::EncryptThreadBlock> EncryptThread::objectQueue;
+
+EncryptThread::EncryptThreadBlock* EncryptWorkerThread(EncryptThread::EncryptThreadBlock* input, bool *returnOutput, void* perThreadData)
+{
+    (void) perThreadData;
+    *returnOutput=false;
+
+    cat::u32 length = input->dataWriteOffset;
+    bool success = input->authEnc->Encrypt(input->iv, (cat::u8 *) input->data, sizeof(input->data), length);
+    RakAssert(success);
+    (void) success;
+
+    RNS2_SendParameters bsp;
+    bsp.data = input->data;
+    bsp.length = length;
+    bsp.systemAddress = input->systemAddress;
+    input->s->Send(&bsp, _FILE_AND_LINE_);
+
+    // The connection may be reset as soon as this reaches 0, so do not touch the block after
+    std::atomic<unsigned int> *pendingSends = input->pendingSends;
+    EncryptThread::objectQueue.Push(input);
+    pendingSends->fetch_sub(1, std::memory_order_release);
+    return 0;
+}
+EncryptThread::EncryptThreadBlock* EncryptThread::AllocateBlock(void)
+{
+    EncryptThreadBlock *b;
+    b=objectQueue.Pop();
+    if (b==0)
+        b=objectQueue.Allocate(_FILE_AND_LINE_);
+    return b;
+}
+void EncryptThread::ProcessBlock(EncryptThreadBlock* block)
+{
+    RakAssert(block->dataWriteOffset>0 && block->dataWriteOffset + cat::AuthenticatedEncryption::OVERHEAD_BYTES <= MAXIMUM_MTU_SIZE);
+    unsigned int count = numWorkers.load(std::memory_order_acquire);
+    RakAssert(count > 0);
+    workers[SystemAddress::ToInteger(block->systemAddress) % count].AddInput(EncryptWorkerThread, block);
+}
+bool EncryptThread::IsRunning(void)
+{
+    return numWorkers.load(std::memory_order_acquire)!=0;
+}
+void EncryptThread::SetNumberOfThreads(unsigned int _numberOfThreads)
+{
+    refCountMutex.Lock();
+    numberOfThreads=_numberOfThreads;
+    refCountMutex.Unlock();
+}
+void EncryptThread::AddRef(void)
+{
+    refCountMutex.Lock();
+    if (++refCount==1)
+    {
+        unsigned int count = numberOfThreads;
+        if (count==0)
+        {
+            unsigned int processors = std::thread::hardware_concurrency();
+            count = processors > 1 ? processors - 1 : 0;
+        }
+        if (count > 0)
+        {
+            workers = new ThreadPool<EncryptThreadBlock*,EncryptThreadBlock*>[count];
+            for (unsigned int i=0; i < count; i++)
+                workers[i].StartThreads(1,0);
+            numWorkers.store(count, std::memory_order_release);
+        }
+    }
+    refCountMutex.Unlock();
+}
+void EncryptThread::Deref(void)
+{
+    refCountMutex.Lock();
+    if (refCount>0 && --refCount==0)
+    {
+        // Every RakPeer waited for its sends before getting here, so the queues are empty
+        unsigned int count = numWorkers.exchange(0, std::memory_order_acq_rel);
+        for (unsigned int i=0; i < count; i++)
+        {
+            workers[i].StopThreads();
+            RakAssert(workers[i].InputSize()==0);
+        }
+        delete [] workers;
+        workers=0;
+        objectQueue.Clear(_FILE_AND_LINE_);
+    }
+    refCountMutex.Unlock();
+}
+#endif // LIBCAT_SECURITY
@@ -0,0 +1,193 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "HandshakeThread.h"
+#ifdef LIBCAT_SECURITY
+#include "GetTime.h"
+#include "RakAssert.h"
+#include <string.h>
+#include <stdlib.h>
+#include <thread>
+#if defined(_WIN32)
+#include "WindowsIncludes.h"
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace RakNet;
+
+// Data of each worker
+struct HandshakeWorker
+{
+    cat::ServerEasyHandshake handshake;
+    HandshakeThread *owner;
+};
+
+static int CompareTimeUS(const void *a, const void *b)
+{
+    RakNet::TimeUS x = *(const RakNet::TimeUS *) a, y = *(const RakNet::TimeUS *) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+HandshakeThread::HandshakeThread()
+{
+    running=false;
+    wakeEvent=0;
+    jobsInProgress.store(0);
+    memset(jobCounts, 0, sizeof(jobCounts));
+    latencyCount=0;
+    latencyWriteIndex=0;
+}
+HandshakeThread::~HandshakeThread()
+{
+    Stop();
+}
+void HandshakeThread::Start(const char *_publicKey, const char *_privateKey, SignaledEvent *_wakeEvent)
+{
+    RakAssert(running==false);
+    memcpy(publicKey, _publicKey, sizeof(publicKey));
+    memcpy(privateKey, _privateKey, sizeof(privateKey));
+    wakeEvent=_wakeEvent;
+
+    statisticsMutex.Lock();
+    memset(jobCounts, 0, sizeof(jobCounts));
+    latencyCount=0;
+    latencyWriteIndex=0;
+    statisticsMutex.Unlock();
+
+    // Leave a processor to the update thread, but always have a worker, so handshakes never run on the update thread
+    unsigned int processors = std::thread::hardware_concurrency();
+    int count = processors > 1 ? (int) processors - 1 : 1;
+    workers.SetThreadDataInterface(this, 0);
+    workers.StartThreads(count, 0);
+    running=true;
+}
+void HandshakeThread::Stop(void)
+{
+    if (running==false)
+        return;
+    running=false;
+    workers.StopThreads();
+
+    unsigned int i;
+    workers.LockInput();
+    for (i=0; i < workers.InputSize(); i++)
+        DeallocateJob(workers.GetInputAtIndex(i), JOB_DISCARDED);
+    workers.ClearInput();
+    workers.UnlockInput();
+
+    finishedJobsMutex.Lock();
+    while (finishedJobs.Size())
+        DeallocateJob(finishedJobs.Pop(), JOB_DISCARDED);
+    finishedJobsMutex.Unlock();
+
+    // The workers copied the keys, this copy is no longer needed
+    memset(privateKey, 0, sizeof(privateKey));
+}
+HandshakeThread::Job *HandshakeThread::AllocateJob(void)
+{
+    return new Job;
+}
+void HandshakeThread::ProcessJob(Job *job)
+{
+    RakAssert(running);
+    job->queuedTime=RakNet::GetTimeUS();
+    jobsInProgress.fetch_add(1, std::memory_order_relaxed);
+    workers.AddInput(HandshakeWorkerThread, job);
+}
+HandshakeThread::Job *HandshakeThread::GetFinishedJob(void)
+{
+    Job *job=0;
+    finishedJobsMutex.Lock();
+    if (finishedJobs.Size())
+        job=finishedJobs.Pop();
+    finishedJobsMutex.Unlock();
+    return job;
+}
+void HandshakeThread::DeallocateJob(Job *job, JobResult result)
+{
+    statisticsMutex.Lock();
+    jobCounts[result]++;
+    if (result==JOB_ANSWERED)
+    {
+        latencies[latencyWriteIndex]=RakNet::GetTimeUS()-job->queuedTime;
+        latencyWriteIndex=(latencyWriteIndex+1) % LATENCY_HISTORY;
+        if (latencyCount < LATENCY_HISTORY)
+            latencyCount++;
+    }
+    statisticsMutex.Unlock();
+
+    jobsInProgress.fetch_sub(1, std::memory_order_relaxed);
+    delete job;
+}
+void HandshakeThread::GetStatistics(HandshakeStatistics *stats)
+{
+    RakNet::TimeUS sorted[LATENCY_HISTORY];
+    statisticsMutex.Lock();
+    stats->answered=jobCounts[JOB_ANSWERED];
+    stats->rejected=jobCounts[JOB_REJECTED];
+    stats->discarded=jobCounts[JOB_DISCARDED];
+    unsigned int count=latencyCount;
+    memcpy(sorted, latencies, count * sizeof(RakNet::TimeUS));
+    statisticsMutex.Unlock();
+
+    stats->queued=jobsInProgress.load(std::memory_order_relaxed);
+    stats->latencySamples=count;
+    if (count==0)
+    {
+        stats->latencyPercentile50=stats->latencyPercentile90=stats->latencyPercentile99=stats->latencyMax=0;
+        return;
+    }
+    qsort(sorted, count, sizeof(RakNet::TimeUS), CompareTimeUS);
+    stats->latencyPercentile50=sorted[count/2];
+    stats->latencyPercentile90=sorted[count*9/10];
+    stats->latencyPercentile99=sorted[count*99/100];
+    stats->latencyMax=sorted[count-1];
+}
+void* HandshakeThread::PerThreadFactory(void *context)
+{
+    (void) context;
+
+    // Called on the worker. When processors are short, established connections on the update thread come before new ones.
+#if defined(_WIN32)
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif defined(__linux__)
+    setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 10);
+#endif
+
+    HandshakeWorker *worker = new HandshakeWorker;
+    worker->owner=this;
+    bool success = worker->handshake.Initialize(publicKey, privateKey);
+    RakAssert(success);
+    (void) success;
+    return worker;
+}
+void HandshakeThread::PerThreadDestructor(void* factoryResult, void *context)
+{
+    (void) context;
+    delete (HandshakeWorker*) factoryResult;
+}
+HandshakeThread::Job* HandshakeThread::HandshakeWorkerThread(Job* input, bool *returnOutput, void* perThreadData)
+{
+    // Finished jobs go to finishedJobs rather than the pool output, so the update thread is woken after they are there
+    *returnOutput=false;
+    HandshakeWorker *worker = (HandshakeWorker*) perThreadData;
+    input->valid = worker->handshake.ProcessChallenge(input->challenge, input->answer, &input->authEnc);
+
+    HandshakeThread *owner = worker->owner;
+    owner->finishedJobsMutex.Lock();
+    owner->finishedJobs.Push(input, _FILE_AND_LINE_);
+    owner->finishedJobsMutex.Unlock();
+    owner->wakeEvent->SetEvent();
+    return 0;
+}
+#endif // LIBCAT_SECURITY
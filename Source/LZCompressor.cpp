@@ -0,0 +1,222 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "LZCompressor.h"
+#include <string.h>
+#include <stdint.h>
+
+using namespace RakNet;
+
+STATIC_FACTORY_DEFINITIONS(LZCompressor,LZCompressor)
+
+/*
+Each sequence is:
+1 byte token. The high 4 bits are the literal length, the low 4 bits the match length minus MIN_MATCH. 15 means more length bytes follow.
+Literal length bytes, each added to the length, until a byte other than 255.
+The literals.
+2 byte little endian offset back from the current output position to copy the match from.
+Match length bytes, in the same way as the literal length bytes.
+The last sequence has only literals, and ends the input.
+*/
+
+static const unsigned int MIN_MATCH=4;
+// The last LAST_LITERALS bytes are always literals, and no match starts within MATCH_FIND_LIMIT bytes of the end
+static const unsigned int LAST_LITERALS=5;
+static const unsigned int MATCH_FIND_LIMIT=12;
+static const unsigned int MAX_OFFSET=65535;
+static const unsigned int HASH_LOG=12;
+// Search faster through data that does not compress, by skipping further ahead the longer no match is found
+static const unsigned int SKIP_TRIGGER=6;
+
+static inline uint32_t Read32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t HashSequence(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32-HASH_LOG);
+}
+
+static inline unsigned char *WriteLength(unsigned char *op, unsigned int length)
+{
+    while (length >= 255)
+    {
+        *op++=255;
+        length-=255;
+    }
+    *op++=(unsigned char) length;
+    return op;
+}
+
+static inline unsigned char *WriteLiterals(unsigned char *op, const unsigned char *literals, unsigned int literalLength, unsigned char **token)
+{
+    *token=op++;
+    if (literalLength >= 15)
+    {
+        **token=15<<4;
+        op=WriteLength(op, literalLength-15);
+    }
+    else
+        **token=(unsigned char) (literalLength<<4);
+    if (literalLength > 0)
+        memcpy(op, literals, literalLength);
+    return op+literalLength;
+}
+
+unsigned int LZCompressor::GetMaxCompressedLength(unsigned int inputLength) const
+{
+    return inputLength + inputLength/255 + 16;
+}
+
+unsigned int LZCompressor::Compress(const unsigned char *input, unsigned int inputLength, unsigned char *output, unsigned int outputCapacity) const
+{
+    if (outputCapacity < GetMaxCompressedLength(inputLength))
+        return 0;
+
+    const unsigned char *ip=input;
+    const unsigned char *anchor=input;
+    const unsigned char *const inputEnd=input+inputLength;
+    unsigned char *op=output;
+    unsigned char *token;
+
+    if (inputLength > MATCH_FIND_LIMIT)
+    {
+        const unsigned char *const matchLimit=inputEnd-LAST_LITERALS;
+        const unsigned char *const findLimit=inputEnd-MATCH_FIND_LIMIT;
+        // Offsets from input of the last position with each hash
+        uint32_t hashTable[1<<HASH_LOG];
+        memset(hashTable, 0, sizeof(hashTable));
+
+        ip++;
+        while (ip < findLimit)
+        {
+            uint32_t sequence=Read32(ip);
+            uint32_t hash=HashSequence(sequence);
+            const unsigned char *match=input+hashTable[hash];
+            hashTable[hash]=(uint32_t) (ip-input);
+
+            if ((unsigned int) (ip-match) > MAX_OFFSET || Read32(match)!=sequence)
+            {
+                ip+=1+((ip-anchor) >> SKIP_TRIGGER);
+                continue;
+            }
+
+            // Extend backwards into the pending literals, then forwards
+            while (ip > anchor && match > input && ip[-1]==match[-1])
+            {
+                ip--;
+                match--;
+            }
+            const unsigned char *matchEnd=ip+MIN_MATCH;
+            const unsigned char *ref=match+MIN_MATCH;
+            while (matchEnd < matchLimit && *matchEnd==*ref)
+            {
+                matchEnd++;
+                ref++;
+            }
+
+            op=WriteLiterals(op, anchor, (unsigned int) (ip-anchor), &token);
+            unsigned int offset=(unsigned int) (ip-match);
+            *op++=(unsigned char) offset;
+            *op++=(unsigned char) (offset>>8);
+            unsigned int matchLength=(unsigned int) (matchEnd-ip)-MIN_MATCH;
+            if (matchLength >= 15)
+            {
+                *token|=15;
+                op=WriteLength(op, matchLength-15);
+            }
+            else
+                *token|=(unsigned char) matchLength;
+
+            ip=matchEnd;
+            anchor=ip;
+            // Index a position inside the match, so the next repeat of it is found
+            if (ip < findLimit)
+                hashTable[HashSequence(Read32(ip-2))]=(uint32_t) (ip-2-input);
+        }
+    }
+
+    op=WriteLiterals(op, anchor, (unsigned int) (inputEnd-anchor), &token);
+    return (unsigned int) (op-output);
+}
+
+bool LZCompressor::Decompress(const unsigned char *input, unsigned int inputLength, unsigned char *output, unsigned int outputLength) const
+{
+    const unsigned char *ip=input;
+    const unsigned char *const inputEnd=input+inputLength;
+    unsigned char *op=output;
+    unsigned char *const outputEnd=output+outputLength;
+
+    for (;;)
+    {
+        if (ip >= inputEnd)
+            return false;
+        unsigned int token=*ip++;
+
+        unsigned int literalLength=token>>4;
+        if (literalLength==15)
+        {
+            unsigned int b;
+            do
+            {
+                if (ip >= inputEnd || literalLength > outputLength)
+                    return false;
+                b=*ip++;
+                literalLength+=b;
+            } while (b==255);
+        }
+        if (literalLength > (unsigned int) (inputEnd-ip) || literalLength > (unsigned int) (outputEnd-op))
+            return false;
+        memcpy(op, ip, literalLength);
+        op+=literalLength;
+        ip+=literalLength;
+
+        // The last sequence has no match
+        if (ip==inputEnd)
+            return op==outputEnd;
+
+        if (inputEnd-ip < 2)
+            return false;
+        unsigned int offset=ip[0] | (ip[1] << 8);
+        ip+=2;
+        if (offset==0 || offset > (unsigned int) (op-output))
+            return false;
+
+        unsigned int matchLength=token & 15;
+        if (matchLength==15)
+        {
+            unsigned int b;
+            do
+            {
+                if (ip >= inputEnd || matchLength > outputLength)
+                    return false;
+                b=*ip++;
+                matchLength+=b;
+            } while (b==255);
+        }
+        matchLength+=MIN_MATCH;
+        if (matchLength > (unsigned int) (outputEnd-op))
+            return false;
+
+        const unsigned char *match=op-offset;
+        if (offset >= matchLength)
+            memcpy(op, match, matchLength);
+        else
+        {
+            // Overlapping copy repeats the last offset bytes
+            for (unsigned int i=0; i < matchLength; i++)
+                op[i]=match[i];
+        }
+        op+=matchLength;
+    }
+}
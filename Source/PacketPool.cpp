@@ -0,0 +1,323 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "PacketPool.h"
+#include "RakAssert.h"
+#include <stdlib.h>
+#include <new>
+
+using namespace RakNet;
+
+// Keep the Packet that follows the header aligned for its pointer and 64 bit members
+static const size_t PACKET_OFFSET = (sizeof(PacketPoolBlock) + 15) & ~((size_t) 15);
+static const size_t DATA_OFFSET = PACKET_OFFSET + ((sizeof(Packet) + 15) & ~((size_t) 15));
+
+// Covers internal messages, typical game traffic, and anything up to a full datagram
+static const unsigned int sizeClassMaxData[4] = {64, 256, 1024, 2048};
+
+PacketPool::PacketPool()
+{
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++)
+    {
+        sizeClasses[i].maxDataSize = sizeClassMaxData[i];
+        sizeClasses[i].blockSize = (unsigned int) ((DATA_OFFSET + sizeClassMaxData[i] + 15) & ~((size_t) 15));
+        sizeClasses[i].freeHead.store(0);
+        sizeClasses[i].pageCount.store(0);
+    }
+}
+
+PacketPool::~PacketPool()
+{
+    Clear();
+}
+
+Packet *PacketPool::Allocate(unsigned dataSize)
+{
+    PacketPoolBlock *block = AllocateBlock(dataSize);
+    Packet *p = new((void *) GetPacket(block)) Packet;
+    p->data = GetInlineData(p);
+    p->length = dataSize;
+    p->bitSize = BYTES_TO_BITS(dataSize);
+    p->deleteData = true;
+    p->guid = UNASSIGNED_RAKNET_GUID;
+    p->wasGeneratedLocally = false;
+    return p;
+}
+
+Packet *PacketPool::Allocate(unsigned dataSize, unsigned char *data)
+{
+    // The block was taken by AllocateData(), and the packet goes in front of the data
+    Packet *p = new((void *) (data - DATA_OFFSET + PACKET_OFFSET)) Packet;
+    RakAssert(GetInlineData(p) == data);
+    p->data = data;
+    p->length = dataSize;
+    p->bitSize = BYTES_TO_BITS(dataSize);
+    p->deleteData = true;
+    p->guid = UNASSIGNED_RAKNET_GUID;
+    p->wasGeneratedLocally = false;
+    return p;
+}
+
+unsigned char *PacketPool::AllocateData(unsigned dataSize)
+{
+    PacketPoolBlock *block = AllocateBlock(dataSize);
+    if (block == 0)
+        return 0;
+    return (unsigned char *) block + DATA_OFFSET;
+}
+
+void PacketPool::ReleaseData(unsigned char *data)
+{
+    PacketPoolBlock *block = (PacketPoolBlock *) (data - DATA_OFFSET);
+    if (block->sizeClass == OVERSIZED_CLASS)
+    {
+        free(block);
+        return;
+    }
+    RakAssert(block->sizeClass < NUM_SIZE_CLASSES);
+    PushFree(&sizeClasses[block->sizeClass], block, block);
+}
+
+void PacketPool::Release(Packet *packet)
+{
+    PacketPoolBlock *block = GetBlock(packet);
+    if (packet->data != GetInlineData(packet))
+        free(packet->data);
+    packet->~Packet();
+
+    if (block->sizeClass == OVERSIZED_CLASS)
+    {
+        free(block);
+        return;
+    }
+    RakAssert(block->sizeClass < NUM_SIZE_CLASSES);
+    PushFree(&sizeClasses[block->sizeClass], block, block);
+}
+
+void PacketPool::Clear(void)
+{
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++)
+    {
+        SizeClass *sc = &sizeClasses[i];
+        unsigned int pageCount = sc->pageCount.load();
+        for (unsigned int j = 0; j < pageCount; j++)
+            free(sc->pages[j]);
+        sc->pageCount.store(0);
+        sc->freeHead.store(0);
+    }
+}
+
+PacketPoolBlock *PacketPool::GetBlock(Packet *packet)
+{
+    return (PacketPoolBlock *) ((char *) packet - PACKET_OFFSET);
+}
+
+Packet *PacketPool::GetPacket(PacketPoolBlock *block)
+{
+    return (Packet *) ((char *) block + PACKET_OFFSET);
+}
+
+unsigned char *PacketPool::GetInlineData(Packet *packet)
+{
+    return (unsigned char *) packet - PACKET_OFFSET + DATA_OFFSET;
+}
+
+PacketPoolBlock *PacketPool::AllocateBlock(unsigned dataSize)
+{
+    PacketPoolBlock *block;
+    for (int i = 0; i < NUM_SIZE_CLASSES; i++)
+    {
+        if (dataSize <= sizeClasses[i].maxDataSize)
+        {
+            block = PopFree(&sizeClasses[i]);
+            if (block == 0)
+                block = Grow(&sizeClasses[i]);
+            if (block)
+                return block;
+            // Out of pages for this class, fall through to malloc
+            break;
+        }
+    }
+
+    block = (PacketPoolBlock *) malloc(DATA_OFFSET + dataSize);
+    RakAssert(block);
+    if (block == 0)
+        return 0;
+    new((void *) block) PacketPoolBlock;
+    block->blockIndex = 0;
+    block->sizeClass = OVERSIZED_CLASS;
+    return block;
+}
+
+PacketPoolBlock *PacketPool::GetBlockAtIndex(SizeClass *sc, uint32_t blockIndex)
+{
+    return (PacketPoolBlock *) (sc->pages[blockIndex / BLOCKS_PER_PAGE] + (blockIndex % BLOCKS_PER_PAGE) * sc->blockSize);
+}
+
+PacketPoolBlock *PacketPool::PopFree(SizeClass *sc)
+{
+    uint64_t head = sc->freeHead.load(std::memory_order_acquire);
+    while ((uint32_t) head != 0)
+    {
+        PacketPoolBlock *block = GetBlockAtIndex(sc, (uint32_t) head - 1);
+        // If another thread pops this block first, the tag changes and the exchange fails, so a stale freeNext is never installed
+        uint64_t newHead = (((head >> 32) + 1) << 32) | block->freeNext.load(std::memory_order_relaxed);
+        if (sc->freeHead.compare_exchange_weak(head, newHead, std::memory_order_acquire, std::memory_order_acquire))
+            return block;
+    }
+    return 0;
+}
+
+void PacketPool::PushFree(SizeClass *sc, PacketPoolBlock *first, PacketPoolBlock *last)
+{
+    uint64_t head = sc->freeHead.load(std::memory_order_relaxed);
+    uint64_t newHead;
+    do
+    {
+        last->freeNext.store((uint32_t) head, std::memory_order_relaxed);
+        newHead = (((head >> 32) + 1) << 32) | (uint64_t) (first->blockIndex + 1);
+    } while (!sc->freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+PacketPoolBlock *PacketPool::Grow(SizeClass *sc)
+{
+    sc->growMutex.Lock();
+
+    // Another thread may have grown or released blocks while we waited
+    PacketPoolBlock *block = PopFree(sc);
+    if (block)
+    {
+        sc->growMutex.Unlock();
+        return block;
+    }
+
+    unsigned int pageIndex = sc->pageCount.load(std::memory_order_relaxed);
+    if (pageIndex == MAX_PAGES_PER_CLASS)
+    {
+        sc->growMutex.Unlock();
+        return 0;
+    }
+
+    // Allocate() falls back to allocating the packet on its own, as when the pages run out
+    char *page = (char *) malloc(sc->blockSize * BLOCKS_PER_PAGE);
+    if (page == 0)
+    {
+        sc->growMutex.Unlock();
+        return 0;
+    }
+    sc->pages[pageIndex] = page;
+    unsigned char sizeClassIndex = (unsigned char) (sc - sizeClasses);
+    for (unsigned int i = 0; i < BLOCKS_PER_PAGE; i++)
+    {
+        PacketPoolBlock *b = new((void *) (page + i * sc->blockSize)) PacketPoolBlock;
+        b->blockIndex = pageIndex * BLOCKS_PER_PAGE + i;
+        b->sizeClass = sizeClassIndex;
+        b->freeNext.store(b->blockIndex + 2, std::memory_order_relaxed);
+    }
+    sc->pageCount.store(pageIndex + 1, std::memory_order_release);
+
+    // Keep the first block, and publish the rest of the page as one chain
+    block = (PacketPoolBlock *) page;
+    PushFree(sc, GetBlockAtIndex(sc, pageIndex * BLOCKS_PER_PAGE + 1),
+             GetBlockAtIndex(sc, pageIndex * BLOCKS_PER_PAGE + BLOCKS_PER_PAGE - 1));
+
+    sc->growMutex.Unlock();
+    return block;
+}
+
+PacketReturnQueue::PacketReturnQueue()
+{
+    stub.queueNext.store(0);
+    head.store(&stub);
+    tail = &stub;
+    count.store(0);
+}
+
+PacketReturnQueue::~PacketReturnQueue()
+{
+}
+
+void PacketReturnQueue::Push(Packet *packet)
+{
+    PacketPoolBlock *block = PacketPool::GetBlock(packet);
+    block->queueNext.store(0, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    PacketPoolBlock *prev = head.exchange(block, std::memory_order_acq_rel);
+    prev->queueNext.store(block, std::memory_order_release);
+}
+
+void PacketReturnQueue::PushAtHead(Packet *packet)
+{
+    count.fetch_add(1, std::memory_order_relaxed);
+    pushedAtHead.PushAtHead(packet, 0, _FILE_AND_LINE_);
+}
+
+Packet *PacketReturnQueue::Pop(void)
+{
+    if (pushedAtHead.IsEmpty() == false)
+    {
+        count.fetch_sub(1, std::memory_order_relaxed);
+        return pushedAtHead.Pop();
+    }
+
+    PacketPoolBlock *block = PopTail();
+    if (block == 0)
+        return 0;
+    count.fetch_sub(1, std::memory_order_relaxed);
+    return PacketPool::GetPacket(block);
+}
+
+PacketPoolBlock *PacketReturnQueue::PopTail(void)
+{
+    PacketPoolBlock *t = tail;
+    PacketPoolBlock *next = t->queueNext.load(std::memory_order_acquire);
+    if (t == &stub)
+    {
+        if (next == 0)
+            return 0;
+        tail = next;
+        t = next;
+        next = next->queueNext.load(std::memory_order_acquire);
+    }
+    if (next)
+    {
+        tail = next;
+        return t;
+    }
+
+    // A producer has exchanged head but not yet linked it. Report empty rather than wait on it.
+    if (t != head.load(std::memory_order_acquire))
+        return 0;
+
+    // t is the only element. Put the stub behind it so t can be unlinked.
+    stub.queueNext.store(0, std::memory_order_relaxed);
+    PacketPoolBlock *prev = head.exchange(&stub, std::memory_order_acq_rel);
+    prev->queueNext.store(&stub, std::memory_order_release);
+
+    next = t->queueNext.load(std::memory_order_acquire);
+    if (next)
+    {
+        tail = next;
+        return t;
+    }
+    return 0;
+}
+
+unsigned int PacketReturnQueue::Size(void) const
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+void PacketReturnQueue::Clear(PacketPool *pool)
+{
+    Packet *packet;
+    while ((packet = Pop()) != 0)
+        pool->Release(packet);
+}
@@ -25,20 +25,11 @@ STATIC_FACTORY_DEFINITIONS(PacketizedTCP,PacketizedTCP)
 
 PacketizedTCP::PacketizedTCP()
 {
-
+    // The update thread splits the stream into messages, in the slot of each connection
+    framedReceive=true;
 }
 PacketizedTCP::~PacketizedTCP()
 {
-    ClearAllConnections();
-}
-
-void PacketizedTCP::Stop(void)
-{
-    unsigned int i;
-    TCPInterface::Stop();
-    for (i=0; i < waitingPackets.Size(); i++)
-        DeallocatePacket(waitingPackets[i]);
-    ClearAllConnections();
 }
 
 void PacketizedTCP::Send( const char *data, unsigned length, const SystemAddress &systemAddress, bool broadcast )
@@ -60,6 +51,33 @@ void PacketizedTCP::Send( const char *data, unsigned length, const SystemAddress
     lengthsArray[1]=length;
     TCPInterface::SendList(dataArray,lengthsArray,2,systemAddress,broadcast);
 }
+void PacketizedTCP::SetMaxFramedMessageLength( unsigned int length )
+{
+    maxFramedMessageLength.store(length, std::memory_order_relaxed);
+}
+char* PacketizedTCP::AllocateSendBuffer( unsigned int length )
+{
+    if (length > (unsigned int) -1 - sizeof(PTCPHeader))
+        return 0;
+    char *buffer = TCPInterface::AllocateSendBuffer(sizeof(PTCPHeader)+length);
+    return buffer ? buffer+sizeof(PTCPHeader) : 0;
+}
+bool PacketizedTCP::SendBuffer( char *buffer, unsigned int length, const SystemAddress &systemAddress )
+{
+    PTCPHeader dataLength;
+    dataLength=length;
+#ifndef __BITSTREAM_NATIVE_END
+    if (RakNet::BitStream::DoEndianSwap())
+        RakNet::BitStream::ReverseBytes((unsigned char*) &length,(unsigned char*) &dataLength,sizeof(dataLength));
+#endif
+    memcpy(buffer-sizeof(PTCPHeader), &dataLength, sizeof(PTCPHeader));
+    return TCPInterface::SendBuffer(buffer-sizeof(PTCPHeader),sizeof(PTCPHeader)+length,systemAddress);
+}
+void PacketizedTCP::DeallocateSendBuffer( char *buffer )
+{
+    if (buffer)
+        TCPInterface::DeallocateSendBuffer(buffer-sizeof(PTCPHeader));
+}
 bool PacketizedTCP::SendList( const char **data, const unsigned int *lengths, const int numParameters, const SystemAddress &systemAddress, bool broadcast )
 {
     if (isStarted == 0)
@@ -105,7 +123,6 @@ void PacketizedTCP::PushNotificationsToQueues(void)
     if (sa!=UNASSIGNED_SYSTEM_ADDRESS)
     {
         _newIncomingConnections.Push(sa, _FILE_AND_LINE_ );
-        AddToConnectionList(sa);
     }
 
     sa = TCPInterface::HasFailedConnectionAttempt();
@@ -118,14 +135,12 @@ void PacketizedTCP::PushNotificationsToQueues(void)
     if (sa!=UNASSIGNED_SYSTEM_ADDRESS)
     {
         _lostConnections.Push(sa, _FILE_AND_LINE_ );
-        RemoveFromConnectionList(sa);
     }
 
     sa = TCPInterface::HasCompletedConnectionAttempt();
     if (sa!=UNASSIGNED_SYSTEM_ADDRESS)
     {
         _completedConnectionAttempts.Push(sa, _FILE_AND_LINE_ );
-        AddToConnectionList(sa);
     }
 }
 Packet* PacketizedTCP::Receive( void )
@@ -136,138 +151,14 @@ Packet* PacketizedTCP::Receive( void )
     for (i=0; i < messageHandlerList.Size(); i++)
         messageHandlerList[i]->Update();
 
-    Packet *outgoingPacket=ReturnOutgoingPacket();
-    if (outgoingPacket)
-        return outgoingPacket;
-
-    Packet *incomingPacket;
-    incomingPacket = TCPInterface::ReceiveInt();
-    unsigned int index;
-
-    while (incomingPacket)
-    {
-        if (connections.Has(incomingPacket->systemAddress))
-            index = connections.GetIndexAtKey(incomingPacket->systemAddress);
-        else
-            index=(unsigned int) -1;
-        if ((unsigned int)index==(unsigned int)-1)
-        {
-            DeallocatePacket(incomingPacket);
-            incomingPacket = TCPInterface::ReceiveInt();
-            continue;
-        }
-
-
-        if (incomingPacket->deleteData==true)
-        {
-            // Came from network
-            SystemAddress systemAddressFromPacket;
-            if (index < connections.Size())
-            {
-                DataStructures::ByteQueue *bq = connections[index];
-                // Buffer data
-                bq->WriteBytes((const char*) incomingPacket->data,incomingPacket->length, _FILE_AND_LINE_);
-                systemAddressFromPacket=incomingPacket->systemAddress;
-                PTCPHeader dataLength;
-
-                // Peek the header to see if a full message is waiting
-                bq->ReadBytes((char*) &dataLength,sizeof(PTCPHeader),true);
-                if (RakNet::BitStream::DoEndianSwap())
-                    RakNet::BitStream::ReverseBytesInPlace((unsigned char*) &dataLength,sizeof(dataLength));
-                // Header indicates packet length. If enough data is available, read out and return one packet
-                if (bq->GetBytesWritten()>=dataLength+sizeof(PTCPHeader))
-                {
-                    do
-                    {
-                        bq->IncrementReadOffset(sizeof(PTCPHeader));
-                        outgoingPacket =new Packet;
-                        outgoingPacket->length=dataLength;
-                        outgoingPacket->bitSize=BYTES_TO_BITS(dataLength);
-                        outgoingPacket->guid=UNASSIGNED_RAKNET_GUID;
-                        outgoingPacket->systemAddress=systemAddressFromPacket;
-                        outgoingPacket->deleteData=false; // Did not come from the network
-                        outgoingPacket->data=(unsigned char*) malloc(dataLength);
-                        if (outgoingPacket->data==0)
-                        {
-                            RakAssert(0)
-                            delete outgoingPacket;
-                            return 0;
-                        }
-                        bq->ReadBytes((char*) outgoingPacket->data,dataLength,false);
-
-                        waitingPackets.Push(outgoingPacket, _FILE_AND_LINE_ );
-
-                        // Peek the header to see if a full message is waiting
-                        if (bq->ReadBytes((char*) &dataLength,sizeof(PTCPHeader),true))
-                        {
-                            if (RakNet::BitStream::DoEndianSwap())
-                                RakNet::BitStream::ReverseBytesInPlace((unsigned char*) &dataLength,sizeof(dataLength));
-                        }
-                        else
-                            break;
-                    } while (bq->GetBytesWritten()>=dataLength+sizeof(PTCPHeader));
-                }
-                else
-                {
-
-                    unsigned int oldWritten = bq->GetBytesWritten()-incomingPacket->length;
-                    unsigned int newWritten = bq->GetBytesWritten();
-
-                    // Return ID_DOWNLOAD_PROGRESS
-                    if (newWritten/65536!=oldWritten/65536)
-                    {
-                        outgoingPacket =new Packet;
-                        outgoingPacket->length=sizeof(MessageID) +
-                            sizeof(unsigned int)*2 +
-                            sizeof(unsigned int) +
-                            65536;
-                        outgoingPacket->bitSize=BYTES_TO_BITS(incomingPacket->length);
-                        outgoingPacket->guid=UNASSIGNED_RAKNET_GUID;
-                        outgoingPacket->systemAddress=incomingPacket->systemAddress;
-                        outgoingPacket->deleteData=false;
-                        outgoingPacket->data=(unsigned char*) malloc(outgoingPacket->length);
-                        if (outgoingPacket->data==0)
-                        {
-                            RakAssert(0)
-                            delete outgoingPacket;
-                            return 0;
-                        }
-
-                        outgoingPacket->data[0]=(MessageID)ID_DOWNLOAD_PROGRESS;
-                        unsigned int totalParts=dataLength/65536;
-                        unsigned int partIndex=newWritten/65536;
-                        unsigned int oneChunkSize=65536;
-                        memcpy(outgoingPacket->data+sizeof(MessageID), &partIndex, sizeof(unsigned int));
-                        memcpy(outgoingPacket->data+sizeof(MessageID)+sizeof(unsigned int)*1, &totalParts, sizeof(unsigned int));
-                        memcpy(outgoingPacket->data+sizeof(MessageID)+sizeof(unsigned int)*2, &oneChunkSize, sizeof(unsigned int));
-                        bq->IncrementReadOffset(sizeof(PTCPHeader));
-                        bq->ReadBytes((char*) outgoingPacket->data+sizeof(MessageID)+sizeof(unsigned int)*3,oneChunkSize,true);
-                        bq->DecrementReadOffset(sizeof(PTCPHeader));
-
-                        waitingPackets.Push(outgoingPacket, _FILE_AND_LINE_ );
-                    }
-                }
-
-            }
-
-            DeallocatePacket(incomingPacket);
-            incomingPacket=0;
-        }
-        else
-            waitingPackets.Push(incomingPacket, _FILE_AND_LINE_ );
-
-        incomingPacket = TCPInterface::ReceiveInt();
-    }
-
     return ReturnOutgoingPacket();
 }
 Packet *PacketizedTCP::ReturnOutgoingPacket(void)
 {
-    Packet *outgoingPacket=0;
+    Packet *outgoingPacket;
     unsigned int i;
-    while (outgoingPacket==0 && waitingPackets.IsEmpty()==false)
+    while ((outgoingPacket=TCPInterface::ReceiveInt())!=0)
     {
-        outgoingPacket=waitingPackets.Pop();
         PluginReceiveResult pluginResult;
         for (i=0; i < messageHandlerList.Size(); i++)
         {
@@ -284,41 +175,11 @@ Packet *PacketizedTCP::ReturnOutgoingPacket(void)
                 break;
             }
         }
+        if (outgoingPacket)
+            return outgoingPacket;
     }
 
-    return outgoingPacket;
-}
-void PacketizedTCP::CloseConnection( SystemAddress systemAddress )
-{
-    RemoveFromConnectionList(systemAddress);
-    TCPInterface::CloseConnection(systemAddress);
-}
-void PacketizedTCP::RemoveFromConnectionList(const SystemAddress &sa)
-{
-    if (sa==UNASSIGNED_SYSTEM_ADDRESS)
-        return;
-    if (connections.Has(sa))
-    {
-        unsigned int index = connections.GetIndexAtKey(sa);
-        if (index!=(unsigned int)-1)
-        {
-            delete connections[index];
-            connections.RemoveAtIndex(index);
-        }
-    }
-}
-void PacketizedTCP::AddToConnectionList(const SystemAddress &sa)
-{
-    if (sa==UNASSIGNED_SYSTEM_ADDRESS)
-        return;
-    connections.SetNew(sa,new DataStructures::ByteQueue);
-}
-void PacketizedTCP::ClearAllConnections(void)
-{
-    unsigned int i;
-    for (i=0; i < connections.Size(); i++)
-        delete connections[i];
-    connections.Clear();
+    return 0;
 }
 SystemAddress PacketizedTCP::HasCompletedConnectionAttempt(void)
 {
@@ -13,6 +13,7 @@
 #include "PacketizedTCP.h"
 #include "RakPeerInterface.h"
 #include "BitStream.h"
+#include "RakAssert.h"
 
 using namespace RakNet;
 
@@ -22,10 +23,31 @@ PluginInterface2::PluginInterface2()
 #if _RAKNET_SUPPORT_PacketizedTCP==1 && _RAKNET_SUPPORT_TCPInterface==1
     tcpInterface=0;
 #endif
+    SetReceivesAllMessageIDs(true);
 }
 PluginInterface2::~PluginInterface2()
 {
 
+}
+bool PluginInterface2::ReceivesMessageID(MessageID messageId) const
+{
+    if (receivesAllMessageIDs)
+        return true;
+    return (receivedMessageIDs[messageId>>5] & (1u << (messageId&31)))!=0;
+}
+void PluginInterface2::AddReceivedMessageIDRange(MessageID firstMessageId, MessageID lastMessageId)
+{
+    RakAssert(rakPeerInterface==0);
+    if (receivesAllMessageIDs)
+        SetReceivesAllMessageIDs(false);
+    for (unsigned int messageId=firstMessageId; messageId <= (unsigned int) lastMessageId; messageId++)
+        receivedMessageIDs[messageId>>5] |= 1u << (messageId&31);
+}
+void PluginInterface2::SetReceivesAllMessageIDs(bool b)
+{
+    receivesAllMessageIDs=b;
+    for (unsigned int i=0; i < sizeof(receivedMessageIDs)/sizeof(receivedMessageIDs[0]); i++)
+        receivedMessageIDs[i]=0;
 }
 void PluginInterface2::SendUnified( const RakNet::BitStream * bitStream, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast )
 {
@@ -95,6 +117,18 @@ void PluginInterface2::SendUnified( const char * data, const int length, PacketP
         Update();
     }
 }
+void PluginInterface2::SendUnified( const RakNet::BitStream * bitStream, PacketPriority priority, PacketReliability reliability, char orderingChannel, const DataStructures::List<RakNetGUID> &systemIdentifiers )
+{
+    if (rakPeerInterface)
+    {
+        rakPeerInterface->SendToSystems(bitStream,priority,reliability,orderingChannel,systemIdentifiers);
+        return;
+    }
+
+    unsigned int i;
+    for (i=0; i < systemIdentifiers.Size(); i++)
+        SendUnified(bitStream,priority,reliability,orderingChannel,systemIdentifiers[i],false);
+}
 Packet *PluginInterface2::AllocatePacketUnified(unsigned dataSize)
 {
     if (rakPeerInterface)
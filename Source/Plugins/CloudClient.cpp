@@ -23,6 +23,8 @@ STATIC_FACTORY_DEFINITIONS(CloudClient,CloudClient)
 
 CloudClient::CloudClient()
 {
+    // Responses are parsed by the user with OnGetReponse() and OnSubscriptionNotification()
+    SetReceivesAllMessageIDs(false);
     callback=0;
     allocator=&unsetDefaultAllocator;
 }
@@ -51,6 +51,10 @@ void CloudKey::Serialize(bool writeToBitstream, BitStream *bitStream)
     bitStream->Serialize(writeToBitstream, primaryKey);
     bitStream->Serialize(writeToBitstream, secondaryKey);
 }
+unsigned long CloudKey::ToInteger(const CloudKey &key)
+{
+    return RakString::ToInteger(key.primaryKey) ^ ((unsigned long) key.secondaryKey * 2654435761UL);
+}
 void CloudQuery::Serialize(bool writeToBitstream, BitStream *bitStream)
 {
     bool startingRowIndexIsZero=0;
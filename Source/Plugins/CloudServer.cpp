@@ -59,18 +59,6 @@ int CloudServer::KeyDataPtrComp( const RakNetGUID &key, CloudData* const &data )
         return 1;
     return 0;
 }
-int CloudServer::KeyDataListComp( const CloudKey &key, CloudDataList * const &data )
-{
-    if (key.primaryKey < data->key.primaryKey)
-        return -1;
-    if (key.primaryKey > data->key.primaryKey)
-        return 1;
-    if (key.secondaryKey < data->key.secondaryKey)
-        return -1;
-    if (key.secondaryKey > data->key.secondaryKey)
-        return 1;
-    return 0;
-}
 int CloudServer::BufferedGetResponseFromServerComp(const RakNetGUID &key, CloudServer::BufferedGetResponseFromServer* const &data )
 {
     if (key < data->serverAddress)
@@ -84,7 +72,7 @@ int CloudServer::GetRequestComp(const uint32_t &key, CloudServer::GetRequest* co
     if (key < data->requestId)
         return -1;
     if (key > data->requestId)
-        return -1;
+        return 1;
     return 0;
 }
 void CloudServer::CloudQueryWithAddresses::Serialize(bool writeToBitstream, BitStream *bitStream)
@@ -142,15 +130,39 @@ void CloudServer::BufferedGetResponseFromServer::Clear(CloudAllocator *allocator
 }
 CloudServer::CloudServer()
 {
+    AddReceivedMessageIDRange(ID_CLOUD_POST_REQUEST, ID_CLOUD_SERVER_TO_SERVER_COMMAND);
     maxUploadBytesPerClient=0;
     maxBytesPerDowload=0;
     nextGetRequestId=0;
     nextGetRequestsCheck=0;
+    notificationCoalesceInterval=0;
+    nextPendingNotificationsSend=0;
 }
 CloudServer::~CloudServer()
 {
+    getRequestThreadPool.StopThreads();
+    ClearGetRequestJobs();
     Clear();
 }
+bool CloudServer::StartGetThreads(int numThreads)
+{
+    return getRequestThreadPool.StartThreads(numThreads, 0);
+}
+void CloudServer::StopGetThreads(void)
+{
+    getRequestThreadPool.StopThreads();
+
+    // Answer what the threads did not get to
+    unsigned int i;
+    for (i=0; i < getRequestThreadPool.InputSize(); i++)
+    {
+        bool returnOutput;
+        SendGetRequestJob(ProcessGetRequestJobCB(getRequestThreadPool.GetInputAtIndex(i), &returnOutput, 0));
+    }
+    getRequestThreadPool.ClearInput();
+    while (getRequestThreadPool.HasOutput())
+        SendGetRequestJob(getRequestThreadPool.GetOutput());
+}
 void CloudServer::SetMaxUploadBytesPerClient(uint64_t bytes)
 {
     maxUploadBytesPerClient=bytes;
@@ -159,10 +171,25 @@ void CloudServer::SetMaxBytesPerDownload(uint64_t bytes)
 {
     maxBytesPerDowload=bytes;
 }
+void CloudServer::SetNotificationCoalesceInterval(RakNet::TimeMS intervalMS)
+{
+    notificationCoalesceInterval=intervalMS;
+    if (intervalMS==0)
+        SendPendingNotifications();
+}
 void CloudServer::Update(void)
 {
+    // Send results of queries run by StartGetThreads()
+    while (getRequestThreadPool.HasOutputFast() && getRequestThreadPool.HasOutput())
+        SendGetRequestJob(getRequestThreadPool.GetOutput());
+
+    RakNet::Time time = RakNet::GetTime();
+
+    // Send notifications held by SetNotificationCoalesceInterval()
+    if (pendingNotifications.Size()>0 && time >= nextPendingNotificationsSend)
+        SendPendingNotifications();
+
     // Timeout getRequests
-    RakNet::Time time = RakNet::Time();
     if (time > nextGetRequestsCheck)
     {
         nextGetRequestsCheck=time+1000;
@@ -174,8 +201,6 @@ void CloudServer::Update(void)
             {
                 // Remote server is not responding, just send back data with whoever did respond
                 ProcessAndTransmitGetRequest(getRequests[i]);
-                getRequests[i]->Clear(this);
-                delete getRequests[i];
                 getRequests.RemoveAtIndex(i);
             }
             else
@@ -274,26 +299,25 @@ void CloudServer::OnPostRequest(Packet *packet)
     if (remoteSystemsHashIndex.IsInvalid())
     {
         remoteCloudClient =new RemoteCloudClient;
-        remoteCloudClient->uploadedKeys.Insert(key,key,true,_FILE_AND_LINE_);
+        remoteCloudClient->uploadedKeys.Push(key,key,_FILE_AND_LINE_);
         remoteCloudClient->uploadedBytes=0;
         remoteSystems.Push(packet->guid, remoteCloudClient, _FILE_AND_LINE_);
     }
     else
     {
         remoteCloudClient = remoteSystems.ItemAtIndex(remoteSystemsHashIndex);
-        bool objectExists;
         // Add to RemoteCloudClient::uploadedKeys if it isn't there already
-        unsigned int uploadedKeysIndex = remoteCloudClient->uploadedKeys.GetIndexFromKey(key,&objectExists);
-        if (objectExists==false)
+        if (remoteCloudClient->uploadedKeys.HasData(key)==false)
         {
-            remoteCloudClient->uploadedKeys.InsertAtIndex(key, uploadedKeysIndex, _FILE_AND_LINE_);
+            remoteCloudClient->uploadedKeys.Push(key, key, _FILE_AND_LINE_);
         }
     }
 
     bool cloudDataAlreadyUploaded;
-    unsigned int dataRepositoryIndex;
     bool dataRepositoryExists;
-    CloudDataList* cloudDataList = GetOrAllocateCloudDataList(key, &dataRepositoryExists, dataRepositoryIndex);
+    DataRepositoryShard *shard = GetShard(key);
+    shard->mutex.Lock();
+    CloudDataList* cloudDataList = GetOrAllocateCloudDataList(key, &dataRepositoryExists);
     if (dataRepositoryExists==false)
     {
         cloudDataList->uploaderCount=1;
@@ -313,11 +337,14 @@ void CloudServer::OnPostRequest(Packet *packet)
         if (maxUploadBytesPerClient>0 && remoteCloudClient->uploadedBytes+dataLengthBytes>maxUploadBytesPerClient)
         {
             // Undo prior insertion of cloudDataList into cloudData if needed
-            if (keyDataListExists==false)
+            if (dataRepositoryExists==false)
             {
+                RemoveCloudDataList(key);
                 delete cloudDataList;
-                dataRepository.RemoveAtIndex(dataRepositoryIndex);
             }
+            else
+                cloudDataList->uploaderCount--;
+            shard->mutex.Unlock();
 
             if (remoteCloudClient->IsUnused())
             {
@@ -384,9 +411,14 @@ void CloudServer::OnPostRequest(Packet *packet)
             // Undo prior insertion of cloudDataList into cloudData if needed
             if (dataRepositoryExists==false)
             {
+                RemoveCloudDataList(key);
                 delete cloudDataList;
-                dataRepository.RemoveAtIndex(dataRepositoryIndex);
             }
+            else
+                cloudDataList->uploaderCount--;
+            shard->mutex.Unlock();
+            if (dataLengthBytes>CLOUD_SERVER_DATA_STACK_SIZE)
+                free(data);
             return;
         }
         else
@@ -415,7 +447,10 @@ void CloudServer::OnPostRequest(Packet *packet)
     }
     // Update how many bytes were written for this data
     cloudData->dataLengthBytes=dataLengthBytes;
+    // May have been a placeholder for a subscription to this specific system
+    cloudData->isUploaded=true;
     remoteCloudClient->uploadedBytes+=dataLengthBytes;
+    shard->mutex.Unlock();
 
     if (cloudDataAlreadyUploaded==false)
     {
@@ -474,13 +509,12 @@ void CloudServer::OnReleaseRequest(Packet *packet)
         key=cloudKeys[keyCountIndex];
 
         // Remove remote systems uploaded keys
-        bool objectExists;
-        unsigned int uploadedKeysIndex = remoteCloudClient->uploadedKeys.GetIndexFromKey(key,&objectExists);
-        if (objectExists)
+        DataStructures::HashIndex uploadedKeysIndex = remoteCloudClient->uploadedKeys.GetIndexOf(key);
+        if (uploadedKeysIndex.IsInvalid()==false)
         {
-            bool dataRepositoryExists;
-            unsigned int dataRepositoryIndex = dataRepository.GetIndexFromKey(key, &dataRepositoryExists);
-            CloudDataList* cloudDataList = dataRepository[dataRepositoryIndex];
+            DataRepositoryShard *shard = GetShard(key);
+            shard->mutex.Lock();
+            CloudDataList* cloudDataList = GetCloudDataList(key);
             RakAssert(cloudDataList);
 
             CloudData *cloudData;
@@ -488,7 +522,7 @@ void CloudServer::OnReleaseRequest(Packet *packet)
             unsigned int keyDataListIndex = cloudDataList->keyData.GetIndexFromKey(packet->guid, &keyDataListExists);
             cloudData = cloudDataList->keyData[keyDataListIndex];
 
-            remoteCloudClient->uploadedKeys.RemoveAtIndex(uploadedKeysIndex);
+            remoteCloudClient->uploadedKeys.RemoveAtIndex(uploadedKeysIndex, _FILE_AND_LINE_);
             remoteCloudClient->uploadedBytes-=cloudData->dataLengthBytes;
             cloudDataList->uploaderCount--;
 
@@ -511,10 +545,11 @@ void CloudServer::OnReleaseRequest(Packet *packet)
 
                 if (cloudDataList->IsUnused())
                 {
+                    RemoveCloudDataList(key);
                     delete cloudDataList;
-                    dataRepository.RemoveAtIndex(dataRepositoryIndex);
                 }
             }
+            shard->mutex.Unlock();
 
             if (remoteCloudClient->IsUnused())
             {
@@ -555,7 +590,10 @@ void CloudServer::OnGetRequest(Packet *packet)
     for (unsigned int filterIndex=0; filterIndex < queryFilters.Size(); filterIndex++)
     {
         if (queryFilters[filterIndex]->OnGetRequest(packet->guid, packet->systemAddress, getRequest->cloudQueryWithAddresses.cloudQuery, getRequest->cloudQueryWithAddresses.specificSystems )==false)
+        {
+            delete getRequest;
             return;
+        }
     }
 
     getRequest->requestStartTime=RakNet::GetTime();
@@ -565,11 +603,7 @@ void CloudServer::OnGetRequest(Packet *packet)
     DataStructures::List<RemoteServer*> remoteServersWithData;
     GetServersWithUploadedKeys(getRequest->cloudQueryWithAddresses.cloudQuery.keys, remoteServersWithData);
 
-    if (remoteServersWithData.Size()==0)
-    {
-        ProcessAndTransmitGetRequest(getRequest);
-    }
-    else
+    if (remoteServersWithData.Size()>0)
     {
         RakNet::BitStream bsOut;
         bsOut.Write((MessageID)ID_CLOUD_SERVER_TO_SERVER_COMMAND);
@@ -611,6 +645,8 @@ void CloudServer::OnGetRequest(Packet *packet)
         for (keyIndex=0; keyIndex < getRequest->cloudQueryWithAddresses.cloudQuery.keys.Size(); keyIndex++)
         {
             cloudKey = getRequest->cloudQueryWithAddresses.cloudQuery.keys[keyIndex];
+            DataRepositoryShard *shard = GetShard(cloudKey);
+            shard->mutex.Lock();
 
             unsigned int keySubscriberIndex;
             bool hasKeySubscriber;
@@ -634,9 +670,8 @@ void CloudServer::OnGetRequest(Packet *packet)
             remoteCloudClient->subscribedKeys.InsertAtIndex(keySubscriberId, keySubscriberIndex, _FILE_AND_LINE_);
 
             // Add CloudData in a similar way
-            unsigned int dataRepositoryIndex;
             bool dataRepositoryExists;
-            CloudDataList* cloudDataList = GetOrAllocateCloudDataList(cloudKey, &dataRepositoryExists, dataRepositoryIndex);
+            CloudDataList* cloudDataList = GetOrAllocateCloudDataList(cloudKey, &dataRepositoryExists);
 
             // If this is the first local client to subscribe to this key, call SendSubscribedKeyToServers
             if (cloudDataList->subscriberCount==0)
@@ -703,6 +738,7 @@ void CloudServer::OnGetRequest(Packet *packet)
                     }
                 }
             }
+            shard->mutex.Unlock();
         }
 
         if (remoteCloudClient->subscribedKeys.Size()==0)
@@ -713,8 +749,9 @@ void CloudServer::OnGetRequest(Packet *packet)
         }
     }
 
+    // Answer after subscribing, since the answer may be given on another thread
     if (remoteServersWithData.Size()==0)
-        delete getRequest;
+        ProcessAndTransmitGetRequest(getRequest);
 }
 void CloudServer::OnUnsubscribeRequest(Packet *packet)
 {
@@ -754,19 +791,12 @@ void CloudServer::OnUnsubscribeRequest(Packet *packet)
             return;
     }
 
-//    CloudDataList *cloudDataList;
-    bool dataRepositoryExists;
-//    unsigned int dataRepositoryIndex;
-
     for (index=0; index < keyCount; index++)
     {
         CloudKey cloudKey = cloudKeys[index];
 
-    //    dataRepositoryIndex =
-            dataRepository.GetIndexFromKey(cloudKey, &dataRepositoryExists);
-        if (dataRepositoryExists==false)
+        if (GetCloudDataList(cloudKey)==0)
             continue;
-//        cloudDataList = dataRepository[dataRepositoryIndex];
 
         unsigned int keySubscriberIndex;
         bool hasKeySubscriber;
@@ -775,7 +805,10 @@ void CloudServer::OnUnsubscribeRequest(Packet *packet)
         if (hasKeySubscriber==false)
             continue;
 
+        DataRepositoryShard *shard = GetShard(cloudKey);
+        shard->mutex.Lock();
         UnsubscribeFromKey(remoteCloudClient, packet->guid, keySubscriberIndex, cloudKey, specificSystems);
+        shard->mutex.Unlock();
     }
 
     if (remoteCloudClient->IsUnused())
@@ -796,21 +829,11 @@ void CloudServer::OnServerToServerGetRequest(Packet *packet)
     RakNet::BitStream bsIn(packet->data, packet->length, false);
     bsIn.IgnoreBytes(sizeof(MessageID)*2);
 
-    CloudQueryWithAddresses cloudQueryWithAddresses;
-    uint32_t requestId;
-    cloudQueryWithAddresses.Serialize(false, &bsIn);
-    bsIn.Read(requestId);
-
-    DataStructures::List<CloudData*> cloudDataResultList;
-    DataStructures::List<CloudKey> cloudKeyResultList;
-    ProcessCloudQueryWithAddresses(cloudQueryWithAddresses, cloudDataResultList, cloudKeyResultList);
-
-    RakNet::BitStream bsOut;
-    bsOut.Write((MessageID)ID_CLOUD_SERVER_TO_SERVER_COMMAND);
-    bsOut.Write((MessageID)STSC_PROCESS_GET_RESPONSE);
-    bsOut.Write(requestId);
-    WriteCloudQueryRowFromResultList(cloudDataResultList, cloudKeyResultList, &bsOut);
-    SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, packet->guid, false);
+    GetRequest *getRequest =new GetRequest;
+    getRequest->cloudQueryWithAddresses.Serialize(false, &bsIn);
+    bsIn.Read(getRequest->requestId);
+    getRequest->requestingClient=packet->guid;
+    ProcessAndTransmitGetRequest(getRequest, true);
 }
 void CloudServer::OnServerToServerGetResponse(Packet *packet)
 {
@@ -854,12 +877,8 @@ void CloudServer::OnServerToServerGetResponse(Packet *packet)
     // If all results returned, then also process locally, and return to user
     if (getRequest->AllRemoteServersHaveResponded())
     {
-        ProcessAndTransmitGetRequest(getRequest);
-
-        getRequest->Clear(this);
-        delete getRequest;
-
         getRequests.RemoveAtIndex(getRequestIndex);
+        ProcessAndTransmitGetRequest(getRequest);
     }
 }
 void CloudServer::OnClosedConnection(const SystemAddress &systemAddress, RakNetGUID rakNetGUID, PI2_LostConnectionReason lostConnectionReason )
@@ -887,11 +906,8 @@ void CloudServer::OnClosedConnection(const SystemAddress &systemAddress, RakNetG
 
                 if (getRequest->AllRemoteServersHaveResponded())
                 {
-                    ProcessAndTransmitGetRequest(getRequest);
-                    getRequest->Clear(this);
-                    delete getRequest;
-
                     getRequests.RemoveAtIndex(getRequestIndex);
+                    ProcessAndTransmitGetRequest(getRequest);
                 }
                 else
                     getRequestIndex++;
@@ -908,15 +924,17 @@ void CloudServer::OnClosedConnection(const SystemAddress &systemAddress, RakNetG
     if (remoteSystemIndex.IsInvalid()==false)
     {
         RemoteCloudClient* remoteCloudClient = remoteSystems.ItemAtIndex(remoteSystemIndex);
+        DataStructures::List<CloudKey> uploadedKeys, uploadedKeysUnused;
+        remoteCloudClient->uploadedKeys.GetAsList(uploadedKeys, uploadedKeysUnused, _FILE_AND_LINE_);
         unsigned int uploadedKeysIndex;
-        for (uploadedKeysIndex=0; uploadedKeysIndex < remoteCloudClient->uploadedKeys.Size(); uploadedKeysIndex++)
+        for (uploadedKeysIndex=0; uploadedKeysIndex < uploadedKeys.Size(); uploadedKeysIndex++)
         {
             // Delete keys this system has uploaded
-            bool keyDataRepositoryExists;
-            unsigned int dataRepositoryIndex = dataRepository.GetIndexFromKey(remoteCloudClient->uploadedKeys[uploadedKeysIndex], &keyDataRepositoryExists);
-            if (keyDataRepositoryExists)
+            DataRepositoryShard *shard = GetShard(uploadedKeys[uploadedKeysIndex]);
+            shard->mutex.Lock();
+            CloudDataList* cloudDataList = GetCloudDataList(uploadedKeys[uploadedKeysIndex]);
+            if (cloudDataList)
             {
-                CloudDataList* cloudDataList = dataRepository[dataRepositoryIndex];
                 bool keyDataExists;
                 unsigned int keyDataIndex = cloudDataList->keyData.GetIndexFromKey(rakNetGUID, &keyDataExists);
                 if (keyDataExists)
@@ -946,12 +964,13 @@ void CloudServer::OnClosedConnection(const SystemAddress &systemAddress, RakNetG
                             // Tell other servers that this key is no longer uploaded, so they do not request it from us
                             RemoveUploadedKeyFromServers(cloudDataList->key);
 
+                            RemoveCloudDataList(cloudDataList->key);
                             delete cloudDataList;
-                            dataRepository.RemoveAtIndex(dataRepositoryIndex);
                         }
                     }
                 }
             }
+            shard->mutex.Unlock();
         }
 
         unsigned int subscribedKeysIndex;
@@ -960,11 +979,11 @@ void CloudServer::OnClosedConnection(const SystemAddress &systemAddress, RakNetG
             KeySubscriberID* keySubscriberId;
             keySubscriberId = remoteCloudClient->subscribedKeys[subscribedKeysIndex];
 
-            bool keyDataRepositoryExists;
-            unsigned int keyDataRepositoryIndex = dataRepository.GetIndexFromKey(remoteCloudClient->subscribedKeys[subscribedKeysIndex]->key, &keyDataRepositoryExists);
-            if (keyDataRepositoryExists)
+            DataRepositoryShard *shard = GetShard(keySubscriberId->key);
+            shard->mutex.Lock();
+            CloudDataList* cloudDataList = GetCloudDataList(keySubscriberId->key);
+            if (cloudDataList)
             {
-                CloudDataList* cloudDataList = dataRepository[keyDataRepositoryIndex];
                 if (keySubscriberId->specificSystemsSubscribedTo.Size()==0)
                 {
                     cloudDataList->nonSpecificSubscribers.Remove(rakNetGUID);
@@ -986,6 +1005,7 @@ void CloudServer::OnClosedConnection(const SystemAddress &systemAddress, RakNetG
                     }
                 }
             }
+            shard->mutex.Unlock();
 
             delete keySubscriberId;
         }
@@ -1002,17 +1022,26 @@ void CloudServer::OnRakPeerShutdown(void)
 void CloudServer::Clear(void)
 {
     unsigned int i,j;
-    for (i=0; i < dataRepository.Size(); i++)
-    {
-        CloudDataList *cloudDataList = dataRepository[i];
-        for (j=0; j < cloudDataList->keyData.Size(); j++)
+    for (unsigned int shardIndex=0; shardIndex < CLOUD_SERVER_SHARD_COUNT; shardIndex++)
+    {
+        DataRepositoryShard *shard = &dataRepository[shardIndex];
+        shard->mutex.Lock();
+        DataStructures::List<CloudDataList*> cloudDataLists;
+        DataStructures::List<CloudKey> cloudKeys;
+        shard->dataLists.GetAsList(cloudDataLists, cloudKeys, _FILE_AND_LINE_);
+        for (i=0; i < cloudDataLists.Size(); i++)
         {
-            cloudDataList->keyData[j]->Clear();
-            delete cloudDataList->keyData[j];
+            CloudDataList *cloudDataList = cloudDataLists[i];
+            for (j=0; j < cloudDataList->keyData.Size(); j++)
+            {
+                cloudDataList->keyData[j]->Clear();
+                delete cloudDataList->keyData[j];
+            }
+            delete cloudDataList;
         }
-        delete cloudDataList;
+        shard->dataLists.Clear(_FILE_AND_LINE_);
+        shard->mutex.Unlock();
     }
-    dataRepository.Clear(false, _FILE_AND_LINE_);
 
     for (i=0; i < remoteServers.Size(); i++)
     {
@@ -1028,6 +1057,8 @@ void CloudServer::Clear(void)
     }
     getRequests.Clear(false, _FILE_AND_LINE_);
 
+    ClearPendingNotifications();
+
     DataStructures::List<RakNetGUID> keyList;
     DataStructures::List<RemoteCloudClient*> itemList;
     remoteSystems.GetAsList(itemList, keyList, _FILE_AND_LINE_);
@@ -1066,9 +1097,9 @@ void CloudServer::WriteCloudQueryRowFromResultList(unsigned int i, DataStructure
 }
 void CloudServer::NotifyClientSubscribersOfDataChange( CloudData *cloudData, CloudKey &key, DataStructures::OrderedList<RakNetGUID, RakNetGUID> &subscribers, bool wasUpdated )
 {
-    RakNet::BitStream bsOut;
-    bsOut.Write((MessageID) ID_CLOUD_SUBSCRIPTION_NOTIFICATION);
-    bsOut.Write(wasUpdated);
+    if (subscribers.Size()==0)
+        return;
+
     CloudQueryRow row;
     row.key=key;
     row.data=cloudData->dataPtr;
@@ -1077,25 +1108,107 @@ void CloudServer::NotifyClientSubscribersOfDataChange( CloudData *cloudData, Clo
     row.clientSystemAddress=cloudData->clientSystemAddress;
     row.serverGUID=cloudData->serverGUID;
     row.clientGUID=cloudData->clientGUID;
-    row.Serialize(true,&bsOut,0);
+    NotifyClientSubscribersOfDataChange(&row, subscribers, wasUpdated);
+}
+void CloudServer::NotifyClientSubscribersOfDataChange( CloudQueryRow *row, DataStructures::OrderedList<RakNetGUID, RakNetGUID> &subscribers, bool wasUpdated )
+{
+    if (subscribers.Size()==0)
+        return;
 
     unsigned int i;
+    if (notificationCoalesceInterval==0)
+    {
+        RakNet::BitStream bsOut;
+        bsOut.Write((MessageID) ID_CLOUD_SUBSCRIPTION_NOTIFICATION);
+        bsOut.Write(wasUpdated);
+        row->Serialize(true,&bsOut,0);
+
+        DataStructures::List<RakNetGUID> systemIdentifiers;
+        for (i=0; i < subscribers.Size(); i++)
+            systemIdentifiers.Push(subscribers[i], _FILE_AND_LINE_);
+        SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, systemIdentifiers);
+        return;
+    }
+
+    // Replace any notification for this row not sent yet
+    PendingNotification *pendingNotification=0;
+    PendingNotification **pendingNotificationList = pendingNotifications.Peek(row->key);
+    if (pendingNotificationList)
+    {
+        for (pendingNotification=*pendingNotificationList; pendingNotification; pendingNotification=pendingNotification->next)
+        {
+            if (pendingNotification->clientGUID==row->clientGUID)
+                break;
+        }
+    }
+    if (pendingNotification==0)
+    {
+        if (pendingNotifications.Size()==0)
+            nextPendingNotificationsSend=RakNet::GetTime()+notificationCoalesceInterval;
+
+        pendingNotification = new PendingNotification;
+        pendingNotification->clientGUID=row->clientGUID;
+        if (pendingNotificationList)
+        {
+            pendingNotification->next=(*pendingNotificationList)->next;
+            (*pendingNotificationList)->next=pendingNotification;
+        }
+        else
+        {
+            pendingNotification->next=0;
+            pendingNotifications.Push(row->key, pendingNotification, _FILE_AND_LINE_);
+        }
+    }
+
+    pendingNotification->bsOut.Reset();
+    pendingNotification->bsOut.Write((MessageID) ID_CLOUD_SUBSCRIPTION_NOTIFICATION);
+    pendingNotification->bsOut.Write(wasUpdated);
+    row->Serialize(true,&pendingNotification->bsOut,0);
     for (i=0; i < subscribers.Size(); i++)
+        pendingNotification->subscribers.Insert(subscribers[i], subscribers[i], false, _FILE_AND_LINE_);
+}
+void CloudServer::SendPendingNotifications(void)
+{
+    DataStructures::List<PendingNotification*> pendingNotificationLists;
+    DataStructures::List<CloudKey> cloudKeys;
+    pendingNotifications.GetAsList(pendingNotificationLists, cloudKeys, _FILE_AND_LINE_);
+    pendingNotifications.Clear(_FILE_AND_LINE_);
+
+    DataStructures::List<RakNetGUID> systemIdentifiers;
+    unsigned int i,j;
+    for (i=0; i < pendingNotificationLists.Size(); i++)
     {
-        SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, subscribers[i], false);
+        PendingNotification *pendingNotification = pendingNotificationLists[i];
+        while (pendingNotification)
+        {
+            systemIdentifiers.Clear(true, _FILE_AND_LINE_);
+            for (j=0; j < pendingNotification->subscribers.Size(); j++)
+                systemIdentifiers.Push(pendingNotification->subscribers[j], _FILE_AND_LINE_);
+            SendUnified(&pendingNotification->bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, systemIdentifiers);
+
+            PendingNotification *next = pendingNotification->next;
+            delete pendingNotification;
+            pendingNotification=next;
+        }
     }
 }
-void CloudServer::NotifyClientSubscribersOfDataChange( CloudQueryRow *row, DataStructures::OrderedList<RakNetGUID, RakNetGUID> &subscribers, bool wasUpdated )
+void CloudServer::ClearPendingNotifications(void)
 {
-    RakNet::BitStream bsOut;
-    bsOut.Write((MessageID) ID_CLOUD_SUBSCRIPTION_NOTIFICATION);
-    bsOut.Write(wasUpdated);
-    row->Serialize(true,&bsOut,0);
+    DataStructures::List<PendingNotification*> pendingNotificationLists;
+    DataStructures::List<CloudKey> cloudKeys;
+    pendingNotifications.GetAsList(pendingNotificationLists, cloudKeys, _FILE_AND_LINE_);
+    pendingNotifications.Clear(_FILE_AND_LINE_);
 
     unsigned int i;
-    for (i=0; i < subscribers.Size(); i++)
+    for (i=0; i < pendingNotificationLists.Size(); i++)
     {
-        SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, subscribers[i], false);
+        PendingNotification *pendingNotification = pendingNotificationLists[i];
+        while (pendingNotification)
+        {
+            PendingNotification *next = pendingNotification->next;
+            delete pendingNotification;
+            pendingNotification=next;
+        }
     }
 }
 void CloudServer::NotifyServerSubscribersOfDataChange( CloudData *cloudData, CloudKey &key, bool wasUpdated )
@@ -1116,14 +1229,17 @@ void CloudServer::NotifyServerSubscribersOfDataChange( CloudData *cloudData, Clo
     row.clientGUID=cloudData->clientGUID;
     row.Serialize(true,&bsOut,0);
 
+    DataStructures::List<RakNetGUID> systemIdentifiers;
     unsigned int i;
     for (i=0; i < remoteServers.Size(); i++)
     {
         if (remoteServers[i]->gotSubscribedAndUploadedKeys==false || remoteServers[i]->subscribedKeys.HasData(key))
         {
-            SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, remoteServers[i]->serverAddress, false);
+            systemIdentifiers.Push(remoteServers[i]->serverAddress, _FILE_AND_LINE_);
         }
     }
+    if (systemIdentifiers.Size()>0)
+        SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, systemIdentifiers);
 }
 void CloudServer::AddServer(RakNetGUID systemIdentifier)
 {
@@ -1162,16 +1278,86 @@ void CloudServer::GetRemoteServers(DataStructures::List<RakNetGUID> &remoteServe
         remoteServersOut.Push(remoteServers[i]->serverAddress, _FILE_AND_LINE_);
     }
 }
-void CloudServer::ProcessAndTransmitGetRequest(GetRequest *getRequest)
+void CloudServer::ProcessAndTransmitGetRequest(GetRequest *getRequest, bool fromRemoteServer)
 {
-    RakNet::BitStream bsOut;
-    bsOut.Write((MessageID) ID_CLOUD_GET_RESPONSE);
+    GetRequestJob *job =new GetRequestJob;
+    job->cloudServer=this;
+    job->getRequest=getRequest;
+    job->fromRemoteServer=fromRemoteServer;
+
+    if (getRequestThreadPool.WasStarted())
+    {
+        getRequestThreadPool.AddInput(ProcessGetRequestJobCB, job);
+    }
+    else
+    {
+        bool returnOutput;
+        SendGetRequestJob(ProcessGetRequestJobCB(job, &returnOutput, 0));
+    }
+}
+CloudServer::GetRequestJob* CloudServer::ProcessGetRequestJobCB(GetRequestJob* job, bool *returnOutput, void* perThreadData)
+{
+    (void) perThreadData;
+
+    CloudServer *cloudServer = job->cloudServer;
+    GetRequest *getRequest = job->getRequest;
+
+    // Rows are serialized while their shards are locked, so they cannot change or be freed meanwhile
+    cloudServer->LockShards(getRequest->cloudQueryWithAddresses.cloudQuery.keys, true);
+    if (job->fromRemoteServer)
+    {
+        DataStructures::List<CloudData*> cloudDataResultList;
+        DataStructures::List<CloudKey> cloudKeyResultList;
+        cloudServer->ProcessCloudQueryWithAddresses(getRequest->cloudQueryWithAddresses, cloudDataResultList, cloudKeyResultList);
+
+        job->bsOut.Write((MessageID)ID_CLOUD_SERVER_TO_SERVER_COMMAND);
+        job->bsOut.Write((MessageID)STSC_PROCESS_GET_RESPONSE);
+        job->bsOut.Write(getRequest->requestId);
+        cloudServer->WriteCloudQueryRowFromResultList(cloudDataResultList, cloudKeyResultList, &job->bsOut);
+    }
+    else
+    {
+        cloudServer->WriteGetResponse(getRequest, &job->bsOut);
+    }
+    cloudServer->LockShards(getRequest->cloudQueryWithAddresses.cloudQuery.keys, false);
+
+    *returnOutput=true;
+    return job;
+}
+void CloudServer::SendGetRequestJob(GetRequestJob *job)
+{
+    SendUnified(&job->bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, job->getRequest->requestingClient, false);
+    DeallocateGetRequestJob(job);
+}
+void CloudServer::DeallocateGetRequestJob(GetRequestJob *job)
+{
+    job->getRequest->Clear(this);
+    delete job->getRequest;
+    delete job;
+}
+void CloudServer::ClearGetRequestJobs(void)
+{
+    unsigned int i;
+    getRequestThreadPool.LockInput();
+    for (i=0; i < getRequestThreadPool.InputSize(); i++)
+        DeallocateGetRequestJob(getRequestThreadPool.GetInputAtIndex(i));
+    getRequestThreadPool.ClearInput();
+    getRequestThreadPool.UnlockInput();
+    getRequestThreadPool.LockOutput();
+    for (i=0; i < getRequestThreadPool.OutputSize(); i++)
+        DeallocateGetRequestJob(getRequestThreadPool.GetOutputAtIndex(i));
+    getRequestThreadPool.ClearOutput();
+    getRequestThreadPool.UnlockOutput();
+}
+void CloudServer::WriteGetResponse(GetRequest *getRequest, BitStream *bsOut)
+{
+    bsOut->Write((MessageID) ID_CLOUD_GET_RESPONSE);
 
     //    BufferedGetResponseFromServer getResponse;
     CloudQueryResult cloudQueryResult;
     cloudQueryResult.cloudQuery=getRequest->cloudQueryWithAddresses.cloudQuery;
     cloudQueryResult.subscribeToResults=getRequest->cloudQueryWithAddresses.cloudQuery.subscribeToResults;
-    cloudQueryResult.SerializeHeader(true, &bsOut);
+    cloudQueryResult.SerializeHeader(true, bsOut);
 
     DataStructures::List<CloudData*> cloudDataResultList;
     DataStructures::List<CloudKey> cloudKeyResultList;
@@ -1184,7 +1370,7 @@ void CloudServer::ProcessAndTransmitGetRequest(GetRequest *getRequest)
         localNumRows - getRequest->cloudQueryWithAddresses.cloudQuery.startingRowIndex > getRequest->cloudQueryWithAddresses.cloudQuery.maxRowsToReturn )
         localNumRows=getRequest->cloudQueryWithAddresses.cloudQuery.startingRowIndex + getRequest->cloudQueryWithAddresses.cloudQuery.maxRowsToReturn;
 
-    BitSize_t bitStreamOffset = bsOut.GetWriteOffset();
+    BitSize_t bitStreamOffset = bsOut->GetWriteOffset();
     uint32_t localRowsToWrite;
     unsigned int skipRows;
     if (localNumRows>getRequest->cloudQueryWithAddresses.cloudQuery.startingRowIndex)
@@ -1197,10 +1383,10 @@ void CloudServer::ProcessAndTransmitGetRequest(GetRequest *getRequest)
         localRowsToWrite=0;
         skipRows=getRequest->cloudQueryWithAddresses.cloudQuery.startingRowIndex-localNumRows;
     }
-    cloudQueryResult.SerializeNumRows(true, localRowsToWrite, &bsOut);
+    cloudQueryResult.SerializeNumRows(true, localRowsToWrite, bsOut);
     for (unsigned int i=getRequest->cloudQueryWithAddresses.cloudQuery.startingRowIndex; i < localNumRows; i++)
     {
-        WriteCloudQueryRowFromResultList(i, cloudDataResultList, cloudKeyResultList, &bsOut);
+        WriteCloudQueryRowFromResultList(i, cloudDataResultList, cloudKeyResultList, bsOut);
     }
 
     // Append remote systems for remaining rows
@@ -1223,7 +1409,7 @@ void CloudServer::ProcessAndTransmitGetRequest(GetRequest *getRequest)
                     --skipRows;
                     continue;
                 }
-                bufferedGetResponseFromServer->queryResult.rowsReturned[cloudQueryRowIndex]->Serialize(true, &bsOut, this);
+                bufferedGetResponseFromServer->queryResult.rowsReturned[cloudQueryRowIndex]->Serialize(true, bsOut, this);
 
                 ++additionalRowsWritten;
                 if (unlimitedRows==false && --remainingRows==0)
@@ -1236,22 +1422,20 @@ void CloudServer::ProcessAndTransmitGetRequest(GetRequest *getRequest)
 
         if (additionalRowsWritten>0)
         {
-            BitSize_t curOffset = bsOut.GetWriteOffset();
-            bsOut.SetWriteOffset(bitStreamOffset);
+            BitSize_t curOffset = bsOut->GetWriteOffset();
+            bsOut->SetWriteOffset(bitStreamOffset);
             localRowsToWrite+=additionalRowsWritten;
-            cloudQueryResult.SerializeNumRows(true, localRowsToWrite, &bsOut);
-            bsOut.SetWriteOffset(curOffset);
+            cloudQueryResult.SerializeNumRows(true, localRowsToWrite, bsOut);
+            bsOut->SetWriteOffset(curOffset);
         }
     }
 
-    SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, getRequest->requestingClient, false);
 }
 void CloudServer::ProcessCloudQueryWithAddresses( CloudServer::CloudQueryWithAddresses &cloudQueryWithAddresses, DataStructures::List<CloudData*> &cloudDataResultList, DataStructures::List<CloudKey> &cloudKeyResultList )
 {
     CloudQueryResult cloudQueryResult;
     CloudQueryRow cloudQueryRow;
     unsigned int queryIndex;
-    bool dataRepositoryExists;
     CloudDataList* cloudDataList;
     unsigned int keyDataIndex;
 
@@ -1261,11 +1445,9 @@ void CloudServer::ProcessCloudQueryWithAddresses( CloudServer::CloudQueryWithAdd
     {
         const CloudKey &key = cloudQueryWithAddresses.cloudQuery.keys[queryIndex];
 
-        unsigned int dataRepositoryIndex = dataRepository.GetIndexFromKey(key, &dataRepositoryExists);
-        if (dataRepositoryExists)
+        cloudDataList=GetCloudDataList(key);
+        if (cloudDataList)
         {
-            cloudDataList=dataRepository[dataRepositoryIndex];
-
             if (cloudDataList->uploaderCount>0)
             {
                 // Return all keyData that was uploaded by specificSystems, or all if not specified
@@ -1277,7 +1459,8 @@ void CloudServer::ProcessCloudQueryWithAddresses( CloudServer::CloudQueryWithAdd
                     {
                         bool uploaderExists;
                         keyDataIndex = cloudDataList->keyData.GetIndexFromKey(cloudQueryWithAddresses.specificSystems[specificSystemIndex], &uploaderExists);
-                        if (uploaderExists)
+                        // keyData also holds systems that are only subscribed to
+                        if (uploaderExists && cloudDataList->keyData[keyDataIndex]->isUploaded)
                         {
                             cloudDataResultList.Push(cloudDataList->keyData[keyDataIndex], _FILE_AND_LINE_);
                             cloudKeyResultList.Push(key, _FILE_AND_LINE_);
@@ -1289,6 +1472,8 @@ void CloudServer::ProcessCloudQueryWithAddresses( CloudServer::CloudQueryWithAdd
                     // Return data for all systems
                     for (keyDataIndex=0; keyDataIndex < cloudDataList->keyData.Size(); keyDataIndex++)
                     {
+                        if (cloudDataList->keyData[keyDataIndex]->isUploaded==false)
+                            continue;
                         cloudDataResultList.Push(cloudDataList->keyData[keyDataIndex], _FILE_AND_LINE_);
                         cloudKeyResultList.Push(key, _FILE_AND_LINE_);
                     }
@@ -1302,19 +1487,21 @@ void CloudServer::SendUploadedAndSubscribedKeysToServer( RakNetGUID systemAddres
     RakNet::BitStream bsOut;
     bsOut.Write((MessageID)ID_CLOUD_SERVER_TO_SERVER_COMMAND);
     bsOut.Write((MessageID)STSC_ADD_UPLOADED_AND_SUBSCRIBED_KEYS);
-    bsOut.WriteCasted<uint16_t>(dataRepository.Size());
-    for (unsigned int i=0; i < dataRepository.Size(); i++)
-        dataRepository[i]->key.Serialize(true, &bsOut);
+    DataStructures::List<CloudDataList*> cloudDataLists;
+    GetDataRepositoryAsList(cloudDataLists);
+    bsOut.WriteCasted<uint16_t>(cloudDataLists.Size());
+    for (unsigned int i=0; i < cloudDataLists.Size(); i++)
+        cloudDataLists[i]->key.Serialize(true, &bsOut);
 
     BitSize_t startOffset, endOffset;
     uint16_t subscribedKeyCount=0;
     startOffset=bsOut.GetWriteOffset();
     bsOut.WriteCasted<uint16_t>(subscribedKeyCount);
-    for (unsigned int i=0; i < dataRepository.Size(); i++)
+    for (unsigned int i=0; i < cloudDataLists.Size(); i++)
     {
-        if (dataRepository[i]->subscriberCount>0)
+        if (cloudDataLists[i]->subscriberCount>0)
         {
-            dataRepository[i]->key.Serialize(true, &bsOut);
+            cloudDataLists[i]->key.Serialize(true, &bsOut);
             subscribedKeyCount++;
         }
     }
@@ -1323,7 +1510,7 @@ void CloudServer::SendUploadedAndSubscribedKeysToServer( RakNetGUID systemAddres
     bsOut.WriteCasted<uint16_t>(subscribedKeyCount);
     bsOut.SetWriteOffset(endOffset);
 
-    if (dataRepository.Size()>0 || subscribedKeyCount>0)
+    if (cloudDataLists.Size()>0 || subscribedKeyCount>0)
         SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, systemAddress, false);
 }
 void CloudServer::SendUploadedKeyToServers( CloudKey &cloudKey )
@@ -1374,8 +1561,6 @@ void CloudServer::OnSendUploadedAndSubscribedKeysToServer( Packet *packet )
     RemoteServer *remoteServer = remoteServers[index];
     remoteServer->gotSubscribedAndUploadedKeys=true;
 
-//    unsigned int insertionIndex;
-    bool alreadyHasKey;
     uint16_t numUploadedKeys, numSubscribedKeys;
     bsIn.Read(numUploadedKeys);
     for (uint16_t i=0; i < numUploadedKeys; i++)
@@ -1383,10 +1568,8 @@ void CloudServer::OnSendUploadedAndSubscribedKeysToServer( Packet *packet )
         CloudKey cloudKey;
         cloudKey.Serialize(false, &bsIn);
 
-    //    insertionIndex =
-            remoteServer->uploadedKeys.GetIndexFromKey(cloudKey, &alreadyHasKey);
-        if (alreadyHasKey==false)
-            remoteServer->uploadedKeys.Insert(cloudKey,cloudKey,true,_FILE_AND_LINE_);
+        if (remoteServer->uploadedKeys.HasData(cloudKey)==false)
+            remoteServer->uploadedKeys.Push(cloudKey,cloudKey,_FILE_AND_LINE_);
     }
 
     bsIn.Read(numSubscribedKeys);
@@ -1395,10 +1578,8 @@ void CloudServer::OnSendUploadedAndSubscribedKeysToServer( Packet *packet )
         CloudKey cloudKey;
         cloudKey.Serialize(false, &bsIn);
 
-        //insertionIndex =
-            remoteServer->subscribedKeys.GetIndexFromKey(cloudKey, &alreadyHasKey);
-        if (alreadyHasKey==false)
-            remoteServer->subscribedKeys.Insert(cloudKey,cloudKey,true,_FILE_AND_LINE_);
+        if (remoteServer->subscribedKeys.HasData(cloudKey)==false)
+            remoteServer->subscribedKeys.Push(cloudKey,cloudKey,_FILE_AND_LINE_);
     }
 
     // Potential todo - join servers
@@ -1417,12 +1598,8 @@ void CloudServer::OnSendUploadedKeyToServers( Packet *packet )
     RemoteServer *remoteServer = remoteServers[index];
     CloudKey cloudKey;
     cloudKey.Serialize(false, &bsIn);
-//    unsigned int insertionIndex;
-    bool alreadyHasKey;
-//    insertionIndex =
-        remoteServer->uploadedKeys.GetIndexFromKey(cloudKey, &alreadyHasKey);
-    if (alreadyHasKey==false)
-        remoteServer->uploadedKeys.Insert(cloudKey,cloudKey,true,_FILE_AND_LINE_);
+    if (remoteServer->uploadedKeys.HasData(cloudKey)==false)
+        remoteServer->uploadedKeys.Push(cloudKey,cloudKey,_FILE_AND_LINE_);
 }
 void CloudServer::OnSendSubscribedKeyToServers( Packet *packet )
 {
@@ -1436,14 +1613,9 @@ void CloudServer::OnSendSubscribedKeyToServers( Packet *packet )
     RemoteServer *remoteServer = remoteServers[index];
     CloudKey cloudKey;
     cloudKey.Serialize(false, &bsIn);
-//    unsigned int insertionIndex;
-    bool alreadyHasKey;
-//    insertionIndex =
-        remoteServer->subscribedKeys.GetIndexFromKey(cloudKey, &alreadyHasKey);
-
     // Do not need to send current values, the Get request will do that as the Get request is sent at the same time
-    if (alreadyHasKey==false)
-        remoteServer->subscribedKeys.Insert(cloudKey,cloudKey,true,_FILE_AND_LINE_);
+    if (remoteServer->subscribedKeys.HasData(cloudKey)==false)
+        remoteServer->subscribedKeys.Push(cloudKey,cloudKey,_FILE_AND_LINE_);
 }
 void CloudServer::OnRemoveUploadedKeyFromServers( Packet *packet )
 {
@@ -1457,11 +1629,7 @@ void CloudServer::OnRemoveUploadedKeyFromServers( Packet *packet )
     RemoteServer *remoteServer = remoteServers[index];
     CloudKey cloudKey;
     cloudKey.Serialize(false, &bsIn);
-    unsigned int insertionIndex;
-    bool alreadyHasKey;
-    insertionIndex = remoteServer->uploadedKeys.GetIndexFromKey(cloudKey, &alreadyHasKey);
-    if (alreadyHasKey==true)
-        remoteServer->uploadedKeys.RemoveAtIndex(insertionIndex);
+    remoteServer->uploadedKeys.Remove(cloudKey,_FILE_AND_LINE_);
 }
 void CloudServer::OnRemoveSubscribedKeyFromServers( Packet *packet )
 {
@@ -1475,11 +1643,7 @@ void CloudServer::OnRemoveSubscribedKeyFromServers( Packet *packet )
     RemoteServer *remoteServer = remoteServers[index];
     CloudKey cloudKey;
     cloudKey.Serialize(false, &bsIn);
-    unsigned int insertionIndex;
-    bool alreadyHasKey;
-    insertionIndex = remoteServer->subscribedKeys.GetIndexFromKey(cloudKey, &alreadyHasKey);
-    if (alreadyHasKey==true)
-        remoteServer->subscribedKeys.RemoveAtIndex(insertionIndex);
+    remoteServer->subscribedKeys.Remove(cloudKey,_FILE_AND_LINE_);
 }
 void CloudServer::OnServerDataChanged( Packet *packet )
 {
@@ -1497,16 +1661,12 @@ void CloudServer::OnServerDataChanged( Packet *packet )
     CloudQueryRow row;
     row.Serialize(false, &bsIn, this);
 
-    CloudDataList *cloudDataList;
-    bool dataRepositoryExists;
-    unsigned int dataRepositoryIndex;
-    dataRepositoryIndex = dataRepository.GetIndexFromKey(row.key, &dataRepositoryExists);
-    if (dataRepositoryExists==false)
+    CloudDataList *cloudDataList = GetCloudDataList(row.key);
+    if (cloudDataList==0)
     {
         DeallocateRowData(row.data);
         return;
     }
-    cloudDataList = dataRepository[dataRepositoryIndex];
     CloudData *cloudData;
     bool keyDataListExists;
     unsigned int keyDataListIndex = cloudDataList->keyData.GetIndexFromKey(row.clientGUID, &keyDataListExists);
@@ -1558,22 +1718,65 @@ void CloudServer::GetServersWithUploadedKeys(
     }
 }
 
-CloudServer::CloudDataList *CloudServer::GetOrAllocateCloudDataList(CloudKey key, bool *dataRepositoryExists, unsigned int &dataRepositoryIndex)
+unsigned int CloudServer::GetShardIndex(const CloudKey &key)
 {
-    CloudDataList *cloudDataList;
+    // All secondary keys of a primary key share a shard, so a query for one application locks as few shards as possible
+    return (unsigned int) (RakString::ToInteger(key.primaryKey) % CLOUD_SERVER_SHARD_COUNT);
+}
+CloudServer::CloudDataList *CloudServer::GetCloudDataList(const CloudKey &key)
+{
+    CloudDataList **cloudDataList = GetShard(key)->dataLists.Peek(key);
+    return cloudDataList ? *cloudDataList : 0;
+}
+void CloudServer::RemoveCloudDataList(const CloudKey &key)
+{
+    GetShard(key)->dataLists.Remove(key, _FILE_AND_LINE_);
+}
+void CloudServer::GetDataRepositoryAsList(DataStructures::List<CloudDataList*> &cloudDataLists)
+{
+    DataStructures::List<CloudDataList*> shardDataLists;
+    DataStructures::List<CloudKey> shardKeys;
+    cloudDataLists.Clear(true, _FILE_AND_LINE_);
+    for (unsigned int shardIndex=0; shardIndex < CLOUD_SERVER_SHARD_COUNT; shardIndex++)
+    {
+        dataRepository[shardIndex].dataLists.GetAsList(shardDataLists, shardKeys, _FILE_AND_LINE_);
+        for (unsigned int i=0; i < shardDataLists.Size(); i++)
+            cloudDataLists.Push(shardDataLists[i], _FILE_AND_LINE_);
+        shardDataLists.Clear(true, _FILE_AND_LINE_);
+        shardKeys.Clear(true, _FILE_AND_LINE_);
+    }
+}
+void CloudServer::LockShards(DataStructures::List<CloudKey> &keys, bool lock)
+{
+    uint32_t shardMask=0;
+    unsigned int shardIndex;
+    for (unsigned int i=0; i < keys.Size(); i++)
+        shardMask |= (uint32_t) 1 << GetShardIndex(keys[i]);
+
+    // Always lock in the same order, so two queries cannot each hold a shard the other waits on
+    for (shardIndex=0; shardIndex < CLOUD_SERVER_SHARD_COUNT; shardIndex++)
+    {
+        if (shardMask & ((uint32_t) 1 << shardIndex))
+        {
+            if (lock)
+                dataRepository[shardIndex].mutex.Lock();
+            else
+                dataRepository[shardIndex].mutex.Unlock();
+        }
+    }
+}
+CloudServer::CloudDataList *CloudServer::GetOrAllocateCloudDataList(CloudKey key, bool *dataRepositoryExists)
+{
+    CloudDataList *cloudDataList = GetCloudDataList(key);
 
-    dataRepositoryIndex = dataRepository.GetIndexFromKey(key, dataRepositoryExists);
-    if (*dataRepositoryExists==false)
+    *dataRepositoryExists = cloudDataList!=0;
+    if (cloudDataList==0)
     {
         cloudDataList =new CloudDataList;
         cloudDataList->key=key;
         cloudDataList->uploaderCount=0;
         cloudDataList->subscriberCount=0;
-        dataRepository.InsertAtIndex(cloudDataList,dataRepositoryIndex,_FILE_AND_LINE_);
-    }
-    else
-    {
-        cloudDataList = dataRepository[dataRepositoryIndex];
+        GetShard(key)->dataLists.Push(key, cloudDataList, _FILE_AND_LINE_);
     }
 
     return cloudDataList;
@@ -1587,15 +1790,12 @@ void CloudServer::UnsubscribeFromKey(RemoteCloudClient *remoteCloudClient, RakNe
     if (keySubscriberId->specificSystemsSubscribedTo.Size()==0 && specificSystems.Size()>0)
         return;
 
-    bool dataRepositoryExists;
-    CloudDataList *cloudDataList;
-    unsigned int dataRepositoryIndex = dataRepository.GetIndexFromKey(cloudKey, &dataRepositoryExists);
-    if (dataRepositoryExists==false)
+    CloudDataList *cloudDataList = GetCloudDataList(cloudKey);
+    if (cloudDataList==0)
         return;
 
     unsigned int i,j;
 
-    cloudDataList = dataRepository[dataRepositoryIndex];
     if (specificSystems.Size()==0)
     {
         // Remove global subscriber. If returns false, have to remove specific subscribers
@@ -1634,8 +1834,8 @@ void CloudServer::UnsubscribeFromKey(RemoteCloudClient *remoteCloudClient, RakNe
 
     if (cloudDataList->IsUnused())
     {
+        RemoveCloudDataList(cloudKey);
         delete cloudDataList;
-        dataRepository.RemoveAtIndex(dataRepositoryIndex);
     }
 }
 void CloudServer::RemoveSpecificSubscriber(RakNetGUID specificSubscriber, CloudDataList *cloudDataList, RakNetGUID remoteCloudClientGuid)
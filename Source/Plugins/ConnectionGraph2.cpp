@@ -39,6 +39,7 @@ int RakNet::ConnectionGraph2::SystemAddressAndGuidComp( const SystemAddressAndGu
 }
 ConnectionGraph2::ConnectionGraph2()
 {
+    AddReceivedMessageIDRange(ID_REMOTE_DISCONNECTION_NOTIFICATION, ID_REMOTE_NEW_INCOMING_CONNECTION);
     autoProcessNewConnections=true;
 }
 ConnectionGraph2::~ConnectionGraph2()
@@ -78,12 +78,14 @@ STATIC_FACTORY_DEFINITIONS(DirectoryDeltaTransfer,DirectoryDeltaTransfer)
 
 DirectoryDeltaTransfer::DirectoryDeltaTransfer()
 {
+    AddReceivedMessageID(ID_DDT_DOWNLOAD_REQUEST);
     applicationDirectory[0]=0;
     fileListTransfer=0;
     availableUploads =new FileList;
     priority=HIGH_PRIORITY;
     orderingChannel=0;
     incrementalReadInterface=0;
+    fileHasher=0;
 }
 DirectoryDeltaTransfer::~DirectoryDeltaTransfer()
 {
@@ -127,6 +129,11 @@ void DirectoryDeltaTransfer::SetApplicationDirectory(const char *pathToApplicati
         applicationDirectory[511]=0;
     }
 }
+void DirectoryDeltaTransfer::SetFileHasher(FileHasher *hasher)
+{
+    fileHasher=hasher;
+    availableUploads->SetFileHasher(hasher);
+}
 void DirectoryDeltaTransfer::SetUploadSendParameters(PacketPriority _priority, char _orderingChannel)
 {
     priority=_priority;
@@ -181,12 +188,15 @@ unsigned short DirectoryDeltaTransfer::DownloadFromSubdirectory(FileList &localF
 unsigned short DirectoryDeltaTransfer::DownloadFromSubdirectory(const char *subdir, const char *outputSubdir, bool prependAppDirToOutputSubdir, SystemAddress host, FileListTransferCBInterface *onFileCallback, PacketPriority _priority, char _orderingChannel, FileListProgress *cb)
 {
     FileList localFiles;
+    localFiles.SetFileHasher(fileHasher);
     // Get a hash of all the files that we already have (if any)
     localFiles.AddFilesFromDirectory(prependAppDirToOutputSubdir ? applicationDirectory : 0, outputSubdir, true, false, true, FileListNodeContext(0,0,0,0));
     return DownloadFromSubdirectory(localFiles, subdir, outputSubdir, prependAppDirToOutputSubdir, host, onFileCallback, _priority, _orderingChannel, cb);
 }
 void DirectoryDeltaTransfer::GenerateHashes(FileList &localFiles, const char *outputSubdir, bool prependAppDirToOutputSubdir)
 {
+    if (localFiles.GetFileHasher()==0)
+        localFiles.SetFileHasher(fileHasher);
     localFiles.AddFilesFromDirectory(prependAppDirToOutputSubdir ? applicationDirectory : 0, outputSubdir, true, false, true, FileListNodeContext(0,0,0,0));
 }
 void DirectoryDeltaTransfer::ClearUploads(void)
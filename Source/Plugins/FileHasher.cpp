@@ -0,0 +1,326 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "FileHasher.h"
+
+#if _RAKNET_SUPPORT_FileOperations==1
+
+#include "SuperFastHash.h"
+#include "BitStream.h"
+#include "RakAssert.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+using namespace RakNet;
+
+// "RHMF", followed by the format version
+static const uint32_t MANIFEST_MAGIC=0x464D4852;
+static const uint32_t MANIFEST_VERSION=1;
+
+STATIC_FACTORY_DEFINITIONS(FileHasher,FileHasher)
+
+FileHasher::FileHasher()
+{
+    cacheHitCount=0;
+    filesHashedCount=0;
+}
+FileHasher::~FileHasher()
+{
+    StopThreads();
+    ClearManifest();
+}
+bool FileHasher::StartThreads(int numThreads)
+{
+    return threadPool.StartThreads(numThreads, 0);
+}
+void FileHasher::StopThreads(void)
+{
+    threadPool.StopThreads();
+}
+void FileHasher::HashFiles(const char * const *fullPaths, unsigned int count, uint32_t *hashes, bool *succeeded)
+{
+    if (count==0)
+        return;
+
+    HashBatch batch;
+    batch.fullPaths=fullPaths;
+    batch.hashes=hashes;
+    batch.succeeded=succeeded;
+    batch.fileLengths=(uint64_t*) malloc(sizeof(uint64_t)*count);
+    batch.modificationTimes=(int64_t*) malloc(sizeof(int64_t)*count);
+    batch.remaining=0;
+    RakAssert(batch.fileLengths && batch.modificationTimes);
+
+    // Answer what we can from the manifest, and gather the rest for the worker threads
+    DataStructures::List<unsigned int> misses;
+    for (unsigned int i=0; i < count; i++)
+    {
+        if (GetFileInfo(fullPaths[i], &batch.fileLengths[i], &batch.modificationTimes[i])==false)
+        {
+            hashes[i]=0;
+            if (succeeded)
+                succeeded[i]=false;
+            continue;
+        }
+        if (LookupManifest(fullPaths[i], batch.fileLengths[i], batch.modificationTimes[i], &hashes[i]))
+        {
+            if (succeeded)
+                succeeded[i]=true;
+            continue;
+        }
+        misses.Push(i, _FILE_AND_LINE_);
+    }
+
+    if (misses.Size()>1 && threadPool.WasStarted())
+    {
+        batch.remaining=misses.Size();
+        batch.doneEvent.InitEvent();
+        HashJob job;
+        job.fileHasher=this;
+        job.batch=&batch;
+        for (unsigned int i=0; i < misses.Size(); i++)
+        {
+            job.index=misses[i];
+            threadPool.AddInput(HashJobCB, job);
+        }
+
+        for (;;)
+        {
+            batch.remainingMutex.Lock();
+            unsigned int remaining=batch.remaining;
+            batch.remainingMutex.Unlock();
+            if (remaining==0)
+                break;
+            batch.doneEvent.WaitOnEvent(1000);
+        }
+        batch.doneEvent.CloseEvent();
+    }
+    else
+    {
+        for (unsigned int i=0; i < misses.Size(); i++)
+            HashAndStore(&batch, misses[i]);
+    }
+
+    free(batch.fileLengths);
+    free(batch.modificationTimes);
+}
+bool FileHasher::HashFile(const char *fullPath, uint32_t *hash)
+{
+    bool succeeded;
+    HashFiles(&fullPath, 1, hash, &succeeded);
+    return succeeded;
+}
+int FileHasher::HashJobCB(HashJob job, bool *returnOutput, void* perThreadData)
+{
+    (void) perThreadData;
+    *returnOutput=false;
+
+    job.fileHasher->HashAndStore(job.batch, job.index);
+
+    job.batch->remainingMutex.Lock();
+    bool done = --job.batch->remaining==0;
+    // Set while locked, so the waiting thread cannot close the event first
+    if (done)
+        job.batch->doneEvent.SetEvent();
+    job.batch->remainingMutex.Unlock();
+    return 0;
+}
+void FileHasher::HashAndStore(HashBatch *batch, unsigned int index)
+{
+    const char *fullPath = batch->fullPaths[index];
+    FILE *fp = fopen(fullPath, "rb");
+    if (fp==0)
+    {
+        batch->hashes[index]=0;
+        if (batch->succeeded)
+            batch->succeeded[index]=false;
+        return;
+    }
+    uint32_t hash = SuperFastHashFilePtr(fp);
+    fclose(fp);
+    batch->hashes[index]=hash;
+    if (batch->succeeded)
+        batch->succeeded[index]=true;
+
+    ManifestEntry entry;
+    entry.fileLength=batch->fileLengths[index];
+    entry.modificationTime=batch->modificationTimes[index];
+    entry.hash=hash;
+    entry.used=true;
+
+    RakString key(fullPath);
+    manifestMutex.Lock();
+    ManifestEntry *existing = manifest.Peek(key);
+    if (existing)
+        *existing=entry;
+    else
+        manifest.Push(key, entry, _FILE_AND_LINE_);
+    filesHashedCount++;
+    manifestMutex.Unlock();
+}
+bool FileHasher::LookupManifest(const char *fullPath, uint64_t fileLength, int64_t modificationTime, uint32_t *hash)
+{
+    RakString key(fullPath);
+    manifestMutex.Lock();
+    ManifestEntry *entry = manifest.Peek(key);
+    if (entry && entry->fileLength==fileLength && entry->modificationTime==modificationTime)
+    {
+        *hash=entry->hash;
+        entry->used=true;
+        cacheHitCount++;
+        manifestMutex.Unlock();
+        return true;
+    }
+    manifestMutex.Unlock();
+    return false;
+}
+bool FileHasher::GetFileInfo(const char *fullPath, uint64_t *fileLength, int64_t *modificationTime)
+{
+#if defined(_WIN32)
+    struct _stat64 fileInfo;
+    if (_stat64(fullPath, &fileInfo)!=0 || (fileInfo.st_mode & _S_IFREG)==0)
+        return false;
+    *modificationTime=(int64_t) fileInfo.st_mtime;
+#else
+    struct stat fileInfo;
+    if (stat(fullPath, &fileInfo)!=0 || S_ISREG(fileInfo.st_mode)==0)
+        return false;
+#if defined(__linux__)
+    // Sub-second resolution, so a file rewritten within the same second with the same size is still caught
+    *modificationTime=(int64_t) fileInfo.st_mtim.tv_sec*1000000000 + fileInfo.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    *modificationTime=(int64_t) fileInfo.st_mtimespec.tv_sec*1000000000 + fileInfo.st_mtimespec.tv_nsec;
+#else
+    *modificationTime=(int64_t) fileInfo.st_mtime;
+#endif
+#endif
+    *fileLength=(uint64_t) fileInfo.st_size;
+    return true;
+}
+bool FileHasher::LoadManifest(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp==0)
+        return false;
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (length<=0)
+    {
+        fclose(fp);
+        return false;
+    }
+    unsigned char *data = (unsigned char*) malloc(length);
+    RakAssert(data);
+    size_t ret = fread(data, 1, length, fp);
+    fclose(fp);
+    if (ret!=(size_t) length)
+    {
+        free(data);
+        return false;
+    }
+
+    RakNet::BitStream bs(data, (unsigned int) length, false);
+    uint32_t magic, version, count;
+    if (bs.Read(magic)==false || magic!=MANIFEST_MAGIC || bs.Read(version)==false || version!=MANIFEST_VERSION || bs.Read(count)==false)
+    {
+        free(data);
+        return false;
+    }
+
+    RakString key;
+    ManifestEntry entry;
+    entry.used=false;
+    bool success=true;
+    manifestMutex.Lock();
+    for (uint32_t i=0; i < count; i++)
+    {
+        if (key.Deserialize(&bs)==false || bs.Read(entry.fileLength)==false || bs.Read(entry.modificationTime)==false || bs.Read(entry.hash)==false)
+        {
+            success=false;
+            break;
+        }
+        ManifestEntry *existing = manifest.Peek(key);
+        if (existing)
+            *existing=entry;
+        else
+            manifest.Push(key, entry, _FILE_AND_LINE_);
+    }
+    manifestMutex.Unlock();
+    free(data);
+    return success;
+}
+bool FileHasher::SaveManifest(const char *path, bool onlyUsedEntries)
+{
+    DataStructures::List<ManifestEntry> entries;
+    DataStructures::List<RakString> keys;
+    manifestMutex.Lock();
+    manifest.GetAsList(entries, keys, _FILE_AND_LINE_);
+    manifestMutex.Unlock();
+
+    uint32_t count=0;
+    for (unsigned int i=0; i < entries.Size(); i++)
+    {
+        if (onlyUsedEntries==false || entries[i].used)
+            count++;
+    }
+
+    RakNet::BitStream bs;
+    bs.Write(MANIFEST_MAGIC);
+    bs.Write(MANIFEST_VERSION);
+    bs.Write(count);
+    for (unsigned int i=0; i < entries.Size(); i++)
+    {
+        if (onlyUsedEntries && entries[i].used==false)
+            continue;
+        keys[i].Serialize(&bs);
+        bs.Write(entries[i].fileLength);
+        bs.Write(entries[i].modificationTime);
+        bs.Write(entries[i].hash);
+    }
+
+    FILE *fp = fopen(path, "wb");
+    if (fp==0)
+        return false;
+    size_t ret = fwrite(bs.GetData(), 1, bs.GetNumberOfBytesUsed(), fp);
+    fclose(fp);
+    return ret==bs.GetNumberOfBytesUsed();
+}
+void FileHasher::ClearManifest(void)
+{
+    manifestMutex.Lock();
+    manifest.Clear(_FILE_AND_LINE_);
+    manifestMutex.Unlock();
+}
+unsigned int FileHasher::GetManifestSize(void)
+{
+    manifestMutex.Lock();
+    unsigned int size = manifest.Size();
+    manifestMutex.Unlock();
+    return size;
+}
+unsigned int FileHasher::GetCacheHitCount(void)
+{
+    manifestMutex.Lock();
+    unsigned int count = cacheHitCount;
+    manifestMutex.Unlock();
+    return count;
+}
+unsigned int FileHasher::GetFilesHashedCount(void)
+{
+    manifestMutex.Lock();
+    unsigned int count = filesHashedCount;
+    manifestMutex.Unlock();
+    return count;
+}
+
+#endif // _RAKNET_SUPPORT_*
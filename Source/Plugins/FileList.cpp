@@ -40,6 +40,7 @@
 #include "BitStream.h"
 #include "FileOperations.h"
 #include "SuperFastHash.h"
+#include "FileHasher.h"
 #include "RakAssert.h"
 #include "../Utils/LinuxStrings.h"
 
@@ -106,6 +107,7 @@ void FLP_Printf::OnSendAborted( SystemAddress systemAddress )
 }
 FileList::FileList()
 {
+    fileHasher=0;
 }
 FileList::~FileList()
 {
@@ -162,6 +164,10 @@ void FileList::AddFile(const char *filepath, const char *filename, FileListNodeC
 
 }
 void FileList::AddFile(const char *filename, const char *fullPathToFile, const char *data, const unsigned dataLength, const unsigned fileLength, FileListNodeContext context, bool isAReference, bool takeDataPointer)
+{
+    AddFileInternal(filename, fullPathToFile, data, dataLength, fileLength, context, isAReference, takeDataPointer, true);
+}
+void FileList::AddFileInternal(const char *filename, const char *fullPathToFile, const char *data, const unsigned dataLength, const unsigned fileLength, FileListNodeContext context, bool isAReference, bool takeDataPointer, bool checkDuplicates)
 {
     if (filename==0)
         return;
@@ -175,7 +181,7 @@ void FileList::AddFile(const char *filename, const char *fullPathToFile, const c
     RakAssert(isAReference==false || data==0);
     // Avoid duplicate insertions unless the data is different, in which case overwrite the old data
     unsigned i;
-    for (i=0; i<fileList.Size();i++)
+    for (i=0; checkDuplicates && i<fileList.Size();i++)
     {
         if (strcmp(fileList[i].filename, filename)==0)
         {
@@ -229,6 +235,11 @@ void FileList::AddFilesFromDirectory(const char *applicationDirectory, const cha
 
 
     DataStructures::Queue<char*> dirList;
+    // Files found by one scan have unique names, so only files already in the list can be duplicates
+    bool checkDuplicates=fileList.Size()>0;
+    // With fileHasher, files to hash are gathered during the scan and hashed together afterwards
+    DataStructures::List<RakString> pendingFilenames, pendingFullPaths;
+    DataStructures::List<unsigned int> pendingFileLengths;
     char root[260];
     char fullPath[520];
     _finddata_t fileInfo;
@@ -278,7 +289,7 @@ void FileList::AddFilesFromDirectory(const char *applicationDirectory, const cha
             unsigned i;
             for (i=0; i < dirList.Size(); i++)
                 free(dirList[i]);
-            return;
+            break;
         }
 
 //        RAKNET_DEBUG_PRINTF("Adding %s. %i remaining.\n", fullPath, dirList.Size());
@@ -325,9 +336,15 @@ void FileList::AddFilesFromDirectory(const char *applicationDirectory, const cha
                         //                    sha1.Final();
                         //                    memcpy(fileData, sha1.GetHash(), HASH_LENGTH);
                         // File data and hash
-                        AddFile((const char*)fullPath+rootLen, fullPath, fileData, fileInfo.size+HASH_LENGTH, fileInfo.size, context);
+                        AddFileInternal((const char*)fullPath+rootLen, fullPath, fileData, fileInfo.size+HASH_LENGTH, fileInfo.size, context, false, false, checkDuplicates);
                     }
                 }
+                else if (writeHash && fileHasher)
+                {
+                    pendingFilenames.Push(RakString(fullPath+rootLen), _FILE_AND_LINE_);
+                    pendingFullPaths.Push(RakString(fullPath), _FILE_AND_LINE_);
+                    pendingFileLengths.Push(fileInfo.size, _FILE_AND_LINE_);
+                }
                 else if (writeHash)
                 {
 //                    sha1.Reset();
@@ -340,7 +357,7 @@ void FileList::AddFilesFromDirectory(const char *applicationDirectory, const cha
 
                     // Hash only
                 //    AddFile((const char*)fullPath+rootLen, (const char*)sha1.GetHash(), HASH_LENGTH, fileInfo.size, context);
-                    AddFile((const char*)fullPath+rootLen, fullPath, (const char*)&hash, HASH_LENGTH, fileInfo.size, context);
+                    AddFileInternal((const char*)fullPath+rootLen, fullPath, (const char*)&hash, HASH_LENGTH, fileInfo.size, context, false, false, checkDuplicates);
                 }
                 else if (writeData)
                 {
@@ -352,12 +369,12 @@ void FileList::AddFilesFromDirectory(const char *applicationDirectory, const cha
                     fclose(fp);
 
                     // File data only
-                    AddFile(fullPath+rootLen, fullPath, fileData, fileInfo.size, fileInfo.size, context);
+                    AddFileInternal(fullPath+rootLen, fullPath, fileData, fileInfo.size, fileInfo.size, context, false, false, checkDuplicates);
                 }
                 else
                 {
                     // Just the filename
-                    AddFile(fullPath+rootLen, fullPath, 0, 0, fileInfo.size, context);
+                    AddFileInternal(fullPath+rootLen, fullPath, 0, 0, fileInfo.size, context, false, false, checkDuplicates);
                 }
 
                 if (fileData)
@@ -379,6 +396,26 @@ void FileList::AddFilesFromDirectory(const char *applicationDirectory, const cha
         free(dirSoFar);
     }
 
+    if (pendingFullPaths.Size()>0)
+    {
+        const char **fullPaths = (const char**) malloc(sizeof(const char*)*pendingFullPaths.Size());
+        uint32_t *hashes = (uint32_t*) malloc(sizeof(uint32_t)*pendingFullPaths.Size());
+        RakAssert(fullPaths && hashes);
+        for (unsigned int i=0; i < pendingFullPaths.Size(); i++)
+            fullPaths[i]=pendingFullPaths[i].C_String();
+        fileHasher->HashFiles(fullPaths, pendingFullPaths.Size(), hashes);
+
+        for (unsigned int i=0; i < pendingFullPaths.Size(); i++)
+        {
+            unsigned int hash = hashes[i];
+            if (RakNet::BitStream::DoEndianSwap())
+                RakNet::BitStream::ReverseBytesInPlace((unsigned char*) &hash, sizeof(hash));
+            // Hash only
+            AddFileInternal(pendingFilenames[i].C_String(), fullPaths[i], (const char*)&hash, HASH_LENGTH, pendingFileLengths[i], context, false, false, checkDuplicates);
+        }
+        free(fullPaths);
+        free(hashes);
+    }
 }
 void FileList::Clear(void)
 {
@@ -554,21 +591,62 @@ void FileList::ListMissingOrChangedFiles(const char *applicationDirectory, FileL
     unsigned i;
 //    char *fileData;
 
+    // Find which files exist, and which of those need their contents hashed to compare.
+    // The hashing is done as one batch afterwards, so fileHasher can read the files in parallel.
+    DataStructures::List<bool> fileExists;
+    DataStructures::List<unsigned> fileLengths;
+    DataStructures::List<RakString> pathsToHash;
     for (i=0; i < fileList.Size(); i++)
     {
         strcpy(fullPath, applicationDirectory);
         FixEndingSlash(fullPath);
         strcat(fullPath,fileList[i].filename);
         fp=fopen(fullPath, "rb");
+        fileExists.Push(fp!=0, _FILE_AND_LINE_);
         if (fp==0)
+        {
+            fileLengths.Push(0, _FILE_AND_LINE_);
+            continue;
+        }
+        fseek(fp, 0, SEEK_END);
+        fileLength = ftell(fp);
+        fclose(fp);
+        fileLengths.Push(fileLength, _FILE_AND_LINE_);
+        if (fileLength == fileList[i].fileLengthBytes || alwaysWriteHash)
+            pathsToHash.Push(RakString(fullPath), _FILE_AND_LINE_);
+    }
+
+    uint32_t *hashes=0;
+    if (pathsToHash.Size()>0)
+    {
+        hashes = (uint32_t*) malloc(sizeof(uint32_t)*pathsToHash.Size());
+        RakAssert(hashes);
+        if (fileHasher)
+        {
+            const char **paths = (const char**) malloc(sizeof(const char*)*pathsToHash.Size());
+            RakAssert(paths);
+            for (i=0; i < pathsToHash.Size(); i++)
+                paths[i]=pathsToHash[i].C_String();
+            fileHasher->HashFiles(paths, pathsToHash.Size(), hashes);
+            free(paths);
+        }
+        else
+        {
+            for (i=0; i < pathsToHash.Size(); i++)
+                hashes[i]=SuperFastHashFile(pathsToHash[i].C_String());
+        }
+    }
+
+    unsigned hashIndex=0;
+    for (i=0; i < fileList.Size(); i++)
+    {
+        if (fileExists[i]==false)
         {
             missingOrChangedFiles->AddFile(fileList[i].filename, fileList[i].fullPathToFile, 0, 0, 0, FileListNodeContext(0,0,0,0), false);
         }
         else
         {
-            fseek(fp, 0, SEEK_END);
-            fileLength = ftell(fp);
-            fseek(fp, 0, SEEK_SET);
+            fileLength = fileLengths[i];
 
             if (fileLength != fileList[i].fileLengthBytes && alwaysWriteHash==false)
             {
@@ -586,7 +664,7 @@ void FileList::ListMissingOrChangedFiles(const char *applicationDirectory, FileL
 
 //                free(fileData);
 
-                unsigned int hash = SuperFastHashFilePtr(fp);
+                unsigned int hash = hashes[hashIndex++];
                 if (RakNet::BitStream::DoEndianSwap())
                     RakNet::BitStream::ReverseBytesInPlace((unsigned char*) &hash, sizeof(hash));
 
@@ -600,9 +678,9 @@ void FileList::ListMissingOrChangedFiles(const char *applicationDirectory, FileL
                         missingOrChangedFiles->AddFile((const char*)fileList[i].filename, (const char*)fileList[i].fullPathToFile, 0, 0, fileLength, FileListNodeContext(0,0,0,0), false);
                 }
             }
-            fclose(fp);
         }
     }
+    free(hashes);
 }
 void FileList::PopulateDataFromDisk(const char *applicationDirectory, bool writeFileData, bool writeFileHash, bool removeUnknownFiles)
 {
@@ -695,6 +773,14 @@ void FileList::PopulateDataFromDisk(const char *applicationDirectory, bool write
         }
     }
 }
+void FileList::SetFileHasher(FileHasher *hasher)
+{
+    fileHasher=hasher;
+}
+FileHasher *FileList::GetFileHasher(void) const
+{
+    return fileHasher;
+}
 void FileList::FlagFilesAsReferences(void)
 {
     for (unsigned int i=0; i < fileList.Size(); i++)
@@ -22,6 +22,7 @@
 #include "RakPeerInterface.h"
 #include "RakNetStatistics.h"
 #include "IncrementalReadInterface.h"
+#include "CompressionInterface.h"
 #include "RakAssert.h"
 #include "RakAlloca.h"
 
@@ -50,6 +51,7 @@ struct FileListReceiver
     unsigned setTotalDownloadedLength;
     bool gotSetHeader;
     bool deleteDownloadHandler;
+    // The sender has a compressor, so each part says whether it is compressed
     bool isCompressed;
     int  filesReceived;
     DataStructures::Map<unsigned int, FLR_MemoryBlock> pushedFiles;
@@ -63,7 +65,7 @@ struct FileListReceiver
 
 using namespace RakNet;
 
-FileListReceiver::FileListReceiver() {filesReceived=0; setTotalDownloadedLength=0; partLength=1; DataStructures::Map<unsigned int, FLR_MemoryBlock>::IMPLEMENT_DEFAULT_COMPARISON();}
+FileListReceiver::FileListReceiver() {filesReceived=0; setTotalDownloadedLength=0; partLength=1; isCompressed=false; DataStructures::Map<unsigned int, FLR_MemoryBlock>::IMPLEMENT_DEFAULT_COMPARISON();}
 FileListReceiver::~FileListReceiver() {
     unsigned int i=0;
     for (i=0; i < pushedFiles.Size(); i++)
@@ -100,7 +102,12 @@ void FileListTransfer::FileToPushRecipient::Deref(void)
 }
 FileListTransfer::FileListTransfer()
 {
+    AddReceivedMessageIDRange(ID_FILE_LIST_TRANSFER_HEADER, ID_FILE_LIST_REFERENCE_PUSH_ACK);
+    AddReceivedMessageID(ID_FILE_LIST_REFERENCE_PUSH);
+    AddReceivedMessageID(ID_DOWNLOAD_PROGRESS);
     setId=0;
+    maxChunksInFlight=1;
+    compressor=0;
     DataStructures::Map<unsigned short, FileListReceiver*>::IMPLEMENT_DEFAULT_COMPARISON();
 }
 FileListTransfer::~FileListTransfer()
@@ -155,6 +162,8 @@ void FileListTransfer::Send(FileList *fileList, RakNet::RakPeerInterface *rakPee
     bool sendReference;
     const char *dataBlocks[2];
     int lengths[2];
+    char *compressBuffer=0;
+    unsigned int compressBufferSize=0;
     totalLength=0;
     for (i=0; i < fileList->fileList.Size(); i++)
     {
@@ -172,6 +181,9 @@ void FileListTransfer::Send(FileList *fileList, RakNet::RakPeerInterface *rakPee
     {
         outBitstream.WriteCompressed(fileList->fileList.Size());
         outBitstream.WriteCompressed(totalLength);
+        // Only written with a compressor, so without one, receivers that predate compression can still read the parts
+        if (compressor)
+            outBitstream.Write(true);
 
         if (rakPeer)
             rakPeer->Send(&outBitstream, priority, RELIABLE_ORDERED, orderingChannel, recipient, false);
@@ -199,6 +211,7 @@ void FileListTransfer::Send(FileList *fileList, RakNet::RakPeerInterface *rakPee
                 fileToPush->currentOffset=0;
                 fileToPush->incrementalReadInterface=_incrementalReadInterface;
                 fileToPush->chunkSize=_chunkSize;
+                fileToPush->compressor=compressor;
                 filesToPush.Push(fileToPush,_FILE_AND_LINE_);
             }
             else
@@ -212,16 +225,19 @@ void FileListTransfer::Send(FileList *fileList, RakNet::RakPeerInterface *rakPee
 
                 outBitstream.WriteCompressed(i);
                 outBitstream.WriteCompressed(fileList->fileList[i].dataLengthBytes); // Original length in bytes
+                unsigned int sendLength=fileList->fileList[i].dataLengthBytes;
+                const char *sendData=WriteFilePartCompression(compressor, &outBitstream, fileList->fileList[i].data, &sendLength, &compressBuffer, &compressBufferSize);
 
                 outBitstream.AlignWriteToByteBoundary();
 
                 dataBlocks[0]=(char*) outBitstream.GetData();
                 lengths[0]=outBitstream.GetNumberOfBytesUsed();
-                dataBlocks[1]=fileList->fileList[i].data;
-                lengths[1]=fileList->fileList[i].dataLengthBytes;
+                dataBlocks[1]=sendData;
+                lengths[1]=sendLength;
                 SendListUnified(dataBlocks,lengths,2,priority, RELIABLE_ORDERED, orderingChannel, recipient, false);
             }
         }
+        free(compressBuffer);
 
         if (filesToPush.IsEmpty()==false)
         {
@@ -246,6 +262,7 @@ void FileListTransfer::Send(FileList *fileList, RakNet::RakPeerInterface *rakPee
                 ftpr->systemAddress=recipient;
                 ftpr->setId=setID;
                 ftpr->refCount=2; // Allocated and in the list
+                ftpr->chunksInFlight=0;
                 fileToPushRecipientList.Push(ftpr, _FILE_AND_LINE_);
             //}
             while (filesToPush.IsEmpty()==false)
@@ -256,7 +273,7 @@ void FileListTransfer::Send(FileList *fileList, RakNet::RakPeerInterface *rakPee
             }
             // ftpr out of scope
             ftpr->Deref();
-            SendIRIToAddress(recipient, setID);
+            SendIRIToAddress(recipient, setID, false);
             return;
         }
         else
@@ -313,6 +330,9 @@ bool FileListTransfer::DecodeSetHeader(Packet *packet)
         inBitStream.ReadCompressed(fileListReceiver->setCount);
         if (inBitStream.ReadCompressed(fileListReceiver->setTotalFinalLength))
         {
+            // Absent if the sender has no compressor, or predates compression
+            fileListReceiver->isCompressed=false;
+            inBitStream.Read(fileListReceiver->isCompressed);
             fileListReceiver->setTotalCompressedTransmissionLength=fileListReceiver->setTotalFinalLength;
             fileListReceiver->gotSetHeader=true;
             return true;
@@ -396,6 +416,12 @@ bool FileListTransfer::DecodeFile(Packet *packet, bool isTheFullFile)
 
     inBitStream.ReadCompressed(onFileStruct.fileIndex);
     inBitStream.ReadCompressed(onFileStruct.byteLengthOfThisFile);
+    bool compressed=false;
+    unsigned int compressedLength=0;
+    if (fileListReceiver->isCompressed)
+        inBitStream.Read(compressed);
+    if (compressed)
+        inBitStream.ReadCompressed(compressedLength);
 
     onFileStruct.numberOfFilesInThisSet=fileListReceiver->setCount;
     onFileStruct.byteLengthOfThisSet=fileListReceiver->setTotalFinalLength;
@@ -417,7 +443,14 @@ bool FileListTransfer::DecodeFile(Packet *packet, bool isTheFullFile)
     {
         inBitStream.AlignReadToByteBoundary();
         onFileStruct.fileData = (char*) malloc( (size_t) onFileStruct.byteLengthOfThisFile);
-        inBitStream.Read((char*)onFileStruct.fileData, onFileStruct.byteLengthOfThisFile);
+        if (ReadFilePartData(&inBitStream, compressed, compressedLength, onFileStruct.fileData, onFileStruct.byteLengthOfThisFile)==false)
+        {
+            free(onFileStruct.fileData);
+#ifdef _DEBUG
+            RakAssert(0);
+#endif
+            return false;
+        }
 
         FileListTransferCBInterface::FileProgressStruct fps;
         fps.onFileStruct=&onFileStruct;
@@ -474,8 +507,9 @@ bool FileListTransfer::DecodeFile(Packet *packet, bool isTheFullFile)
         fps.onFileStruct=&onFileStruct;
         fps.partCount=partCount;
         fps.partTotal=partTotal;
-        fps.dataChunkLength=unreadBytes;
-        fps.firstDataChunk=firstDataChunk;
+        // Compressed data is of no use until all of it arrives
+        fps.dataChunkLength=compressed ? 0 : unreadBytes;
+        fps.firstDataChunk=compressed ? 0 : firstDataChunk;
         fps.iriDataChunk=0;
         fps.allocateIrIDataChunkAutomatically=true;
         fps.iriWriteOffset=0;
@@ -752,6 +786,12 @@ void FileListTransfer::OnReferencePush(Packet *packet, bool isTheFullFile)
     bool lastChunk=false;
     inBitStream.Read(lastChunk);
     bool finished = lastChunk && isTheFullFile;
+    bool compressed=false;
+    unsigned int compressedLength=0;
+    if (fileListReceiver->isCompressed)
+        inBitStream.Read(compressed);
+    if (compressed)
+        inBitStream.ReadCompressed(compressedLength);
 
     if (isTheFullFile==false)
         fileListReceiver->partLength=partLength;
@@ -778,15 +818,40 @@ void FileListTransfer::OnReferencePush(Packet *packet, bool isTheFullFile)
     inBitStream.AlignReadToByteBoundary();
 
     FileListTransferCBInterface::FileProgressStruct fps;
+    char *decompressedChunk=0;
 
     if (isTheFullFile)
     {
+        if (compressed && (offset > onFileStruct.byteLengthOfThisFile || chunkLength > onFileStruct.byteLengthOfThisFile-offset))
+        {
+#ifdef _DEBUG
+            RakAssert(0);
+#endif
+            return;
+        }
+
         if (mb.flrMemoryBlock)
         {
             // Either the very first block, or a subsequent block and allocateIrIDataChunkAutomatically was true for the first block
-            memcpy(mb.flrMemoryBlock+offset, inBitStream.GetData()+BITS_TO_BYTES(inBitStream.GetReadOffset()), amountToRead);
+            if (compressed)
+            {
+                if (ReadFilePartData(&inBitStream, compressed, compressedLength, mb.flrMemoryBlock+offset, chunkLength)==false)
+                    return;
+            }
+            else
+                memcpy(mb.flrMemoryBlock+offset, inBitStream.GetData()+BITS_TO_BYTES(inBitStream.GetReadOffset()), amountToRead);
             fps.iriDataChunk=mb.flrMemoryBlock+offset;
         }
+        else if (compressed)
+        {
+            decompressedChunk=(char*) malloc(chunkLength);
+            if (ReadFilePartData(&inBitStream, compressed, compressedLength, decompressedChunk, chunkLength)==false)
+            {
+                free(decompressedChunk);
+                return;
+            }
+            fps.iriDataChunk=decompressedChunk;
+        }
         else
         {
             // In here mb.flrMemoryBlock is null
@@ -911,6 +976,7 @@ void FileListTransfer::OnReferencePush(Packet *packet, bool isTheFullFile)
         }
     }
 
+    free(decompressedChunk);
     return;
 }
 namespace RakNet
@@ -943,12 +1009,19 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
     *returnOutput=false;
 
     // Was previously using GetStatistics to get outgoing buffer size, but TCP with UnifiedSend doesn't have this
+    // Instead, the number of unacknowledged ID_FILE_LIST_REFERENCE_PUSH is limited by maxChunksInFlight
     unsigned int bytesRead;
     const char *dataBlocks[2];
     int lengths[2];
-    unsigned int smallFileTotalSize=0;
+    unsigned int smallFileTotalSize;
     RakNet::BitStream outBitstream;
     unsigned int ftpIndex;
+    char *readBuffer=0;
+    unsigned int readBufferSize=0;
+    char *compressBuffer=0;
+    unsigned int compressBufferSize=0;
+    const char *sendData;
+    unsigned int sendLength;
 
     fileListTransfer->fileToPushRecipientListMutex.Lock();
     for (ftpIndex=0; ftpIndex < fileListTransfer->fileToPushRecipientList.Size(); ftpIndex++)
@@ -961,131 +1034,128 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
 
         if (ftpr->systemAddress==systemAddress && ftpr->setId==setId)
         {
-            FileListTransfer::FileToPush *ftp;
-            ////ftpr->filesToPushMutex.Lock();
-            ftp = ftpr->filesToPush.Pop();
-            ////ftpr->filesToPushMutex.Unlock();
-
-            // Read and send chunk. If done, delete at this index
-            void *buff = malloc(ftp->chunkSize);
-            if (buff==0)
-            {
-                ////ftpr->filesToPushMutex.Lock();
-                ftpr->filesToPush.PushAtHead(ftp,0,_FILE_AND_LINE_);
-                ////ftpr->filesToPushMutex.Unlock();
-
-                ftpr->Deref();
-                RakAssert(0)
-                return 0;
-            }
+            bool sentLastChunk=false;
 
-            // Read the next file chunk
-            bytesRead=ftp->incrementalReadInterface->GetFilePart(ftp->fileListNode.fullPathToFile, ftp->currentOffset, ftp->chunkSize, buff, ftp->fileListNode.context);
+            ftpr->filesToPushMutex.Lock();
+            if (threadData.chunkAcknowledged && ftpr->chunksInFlight>0)
+                ftpr->chunksInFlight--;
 
-            bool done = ftp->fileListNode.dataLengthBytes == ftp->currentOffset+bytesRead;
-            while (done && ftp->currentOffset==0 && smallFileTotalSize<ftp->chunkSize)
+            while (ftpr->chunksInFlight < fileListTransfer->maxChunksInFlight && ftpr->filesToPush.IsEmpty()==false)
             {
-                ////ftpr->filesToPushMutex.Lock();
-                // The reason for 2 is that ID_FILE_LIST_REFERENCE_PUSH gets ID_FILE_LIST_REFERENCE_PUSH_ACK. WIthout ID_FILE_LIST_REFERENCE_PUSH_ACK, SendIRIToAddressCB would not be called again
-                if (ftpr->filesToPush.Size()<2)
+                FileListTransfer::FileToPush *ftp;
+                ftp = ftpr->filesToPush.Pop();
+
+                // Read the next file chunk
+                const char *fileData = FileListTransfer::ReadFilePart(ftp, &readBuffer, &readBufferSize, &bytesRead);
+                if (fileData==0)
                 {
-                    ////ftpr->filesToPushMutex.Unlock();
+                    ftpr->filesToPush.PushAtHead(ftp,0,_FILE_AND_LINE_);
+                    RakAssert(0)
+                    break;
+                }
+
+                bool done = ftp->fileListNode.dataLengthBytes == ftp->currentOffset+bytesRead;
+                smallFileTotalSize=0;
+                while (done && ftp->currentOffset==0 && smallFileTotalSize<ftp->chunkSize)
+                {
+                    // The reason for 2 is that ID_FILE_LIST_REFERENCE_PUSH gets ID_FILE_LIST_REFERENCE_PUSH_ACK. WIthout ID_FILE_LIST_REFERENCE_PUSH_ACK, SendIRIToAddressCB would not be called again
+                    if (ftpr->filesToPush.Size()<2)
+                        break;
+
+                    // Send all small files at once, rather than wait for ID_FILE_LIST_REFERENCE_PUSH. But at least one ID_FILE_LIST_REFERENCE_PUSH must be sent
+                    outBitstream.Reset();
+                    outBitstream.Write((MessageID)ID_FILE_LIST_TRANSFER_FILE);
+                    // outBitstream.Write(ftp->fileListNode.context);
+                    outBitstream << ftp->fileListNode.context;
+                    outBitstream.Write(setId);
+                    StringCompressor::Instance().EncodeString(ftp->fileListNode.filename, 512, &outBitstream);
+                    outBitstream.WriteCompressed(ftp->setIndex);
+                    outBitstream.WriteCompressed(ftp->fileListNode.dataLengthBytes); // Original length in bytes
+                    sendLength=bytesRead;
+                    sendData=FileListTransfer::WriteFilePartCompression(ftp->compressor, &outBitstream, fileData, &sendLength, &compressBuffer, &compressBufferSize);
+                    outBitstream.AlignWriteToByteBoundary();
+                    dataBlocks[0]=(char*) outBitstream.GetData();
+                    lengths[0]=outBitstream.GetNumberOfBytesUsed();
+                    dataBlocks[1]=sendData;
+                    lengths[1]=sendLength;
+
+                    fileListTransfer->SendListUnified(dataBlocks,lengths,2,ftp->packetPriority, RELIABLE_ORDERED, ftp->orderingChannel, systemAddress, false);
+
+                    FileListTransfer::ReleaseFilePart(ftp, fileData, readBuffer);
+                    // LWS : fixed freed pointer reference
+                    delete ftp;
+                    smallFileTotalSize+=bytesRead;
+                    ftp = ftpr->filesToPush.Pop();
+
+                    fileData = FileListTransfer::ReadFilePart(ftp, &readBuffer, &readBufferSize, &bytesRead);
+                    if (fileData==0)
+                        break;
+                    done = ftp->fileListNode.dataLengthBytes == ftp->currentOffset+bytesRead;
+                }
+                if (fileData==0)
+                {
+                    ftpr->filesToPush.PushAtHead(ftp,0,_FILE_AND_LINE_);
+                    RakAssert(0)
                     break;
                 }
-                ////ftpr->filesToPushMutex.Unlock();
 
-                // Send all small files at once, rather than wait for ID_FILE_LIST_REFERENCE_PUSH. But at least one ID_FILE_LIST_REFERENCE_PUSH must be sent
                 outBitstream.Reset();
-                outBitstream.Write((MessageID)ID_FILE_LIST_TRANSFER_FILE);
+                outBitstream.Write((MessageID)ID_FILE_LIST_REFERENCE_PUSH);
                 // outBitstream.Write(ftp->fileListNode.context);
                 outBitstream << ftp->fileListNode.context;
                 outBitstream.Write(setId);
                 StringCompressor::Instance().EncodeString(ftp->fileListNode.filename, 512, &outBitstream);
                 outBitstream.WriteCompressed(ftp->setIndex);
                 outBitstream.WriteCompressed(ftp->fileListNode.dataLengthBytes); // Original length in bytes
-                outBitstream.AlignWriteToByteBoundary();
-                dataBlocks[0]=(char*) outBitstream.GetData();
-                lengths[0]=outBitstream.GetNumberOfBytesUsed();
-                dataBlocks[1]=(const char*) buff;
-                lengths[1]=bytesRead;
+                outBitstream.WriteCompressed(ftp->currentOffset);
+                ftp->currentOffset+=bytesRead;
+                outBitstream.WriteCompressed(bytesRead);
+                outBitstream.Write(done);
+                sendLength=bytesRead;
+                sendData=FileListTransfer::WriteFilePartCompression(ftp->compressor, &outBitstream, fileData, &sendLength, &compressBuffer, &compressBufferSize);
 
-                fileListTransfer->SendListUnified(dataBlocks,lengths,2,ftp->packetPriority, RELIABLE_ORDERED, ftp->orderingChannel, systemAddress, false);
+                for (unsigned int flpcIndex=0; flpcIndex < fileListTransfer->fileListProgressCallbacks.Size(); flpcIndex++)
+                    fileListTransfer->fileListProgressCallbacks[flpcIndex]->OnFilePush(ftp->fileListNode.filename, ftp->fileListNode.fileLengthBytes, ftp->currentOffset-bytesRead, bytesRead, done, systemAddress, setId);
 
-                // LWS : fixed freed pointer reference
-//                unsigned int chunkSize = ftp->chunkSize;
-                delete ftp;
-                smallFileTotalSize+=bytesRead;
-                //done = bytesRead!=ftp->chunkSize;
-                ////ftpr->filesToPushMutex.Lock();
-                ftp = ftpr->filesToPush.Pop();
-                ////ftpr->filesToPushMutex.Unlock();
-
-                bytesRead=ftp->incrementalReadInterface->GetFilePart(ftp->fileListNode.fullPathToFile, ftp->currentOffset, ftp->chunkSize, buff, ftp->fileListNode.context);
-                done = ftp->fileListNode.dataLengthBytes == ftp->currentOffset+bytesRead;
-            }
-
-
-            outBitstream.Reset();
-            outBitstream.Write((MessageID)ID_FILE_LIST_REFERENCE_PUSH);
-            // outBitstream.Write(ftp->fileListNode.context);
-            outBitstream << ftp->fileListNode.context;
-            outBitstream.Write(setId);
-            StringCompressor::Instance().EncodeString(ftp->fileListNode.filename, 512, &outBitstream);
-            outBitstream.WriteCompressed(ftp->setIndex);
-            outBitstream.WriteCompressed(ftp->fileListNode.dataLengthBytes); // Original length in bytes
-            outBitstream.WriteCompressed(ftp->currentOffset);
-            ftp->currentOffset+=bytesRead;
-            outBitstream.WriteCompressed(bytesRead);
-            outBitstream.Write(done);
-
-            for (unsigned int flpcIndex=0; flpcIndex < fileListTransfer->fileListProgressCallbacks.Size(); flpcIndex++)
-                fileListTransfer->fileListProgressCallbacks[flpcIndex]->OnFilePush(ftp->fileListNode.filename, ftp->fileListNode.fileLengthBytes, ftp->currentOffset-bytesRead, bytesRead, done, systemAddress, setId);
-
-            dataBlocks[0]=(char*) outBitstream.GetData();
-            lengths[0]=outBitstream.GetNumberOfBytesUsed();
-            dataBlocks[1]=(char*) buff;
-            lengths[1]=bytesRead;
-            //rakPeerInterface->SendList(dataBlocks,lengths,2,ftp->packetPriority, RELIABLE_ORDERED, ftp->orderingChannel, ftp->systemAddress, false);
-            char orderingChannel = ftp->orderingChannel;
-            PacketPriority packetPriority = ftp->packetPriority;
+                dataBlocks[0]=(char*) outBitstream.GetData();
+                lengths[0]=outBitstream.GetNumberOfBytesUsed();
+                dataBlocks[1]=sendData;
+                lengths[1]=sendLength;
+                //rakPeerInterface->SendList(dataBlocks,lengths,2,ftp->packetPriority, RELIABLE_ORDERED, ftp->orderingChannel, ftp->systemAddress, false);
+                fileListTransfer->SendListUnified(dataBlocks,lengths,2, ftp->packetPriority, RELIABLE_ORDERED, ftp->orderingChannel, systemAddress, false);
+                ftpr->chunksInFlight++;
 
-            // Mutex state: FileToPushRecipient (ftpr) has AddRef. fileToPushRecipientListMutex not locked.
-            if (done)
-            {
-                // Done
-                //unsigned short setId = ftp->setID;
-                delete ftp;
+                // The data was copied into the send buffers
+                FileListTransfer::ReleaseFilePart(ftp, fileData, readBuffer);
 
-                ////ftpr->filesToPushMutex.Lock();
-                if (ftpr->filesToPush.Size()==0)
+                if (done)
                 {
-                    ////ftpr->filesToPushMutex.Unlock();
-
-                    for (unsigned int flpcIndex=0; flpcIndex < fileListTransfer->fileListProgressCallbacks.Size(); flpcIndex++)
-                        fileListTransfer->fileListProgressCallbacks[flpcIndex]->OnFilePushesComplete(systemAddress, setId);
-
-                    // Remove ftpr from fileToPushRecipientList
-                    fileListTransfer->RemoveFromList(ftpr);
+                    // Done
+                    delete ftp;
+                    sentLastChunk = ftpr->filesToPush.IsEmpty();
                 }
                 else
                 {
-                    ////ftpr->filesToPushMutex.Unlock();
+                    ftpr->filesToPush.PushAtHead(ftp,0,_FILE_AND_LINE_);
                 }
             }
-            else
+            ftpr->filesToPushMutex.Unlock();
+
+            // Mutex state: FileToPushRecipient (ftpr) has AddRef. fileToPushRecipientListMutex not locked.
+            if (sentLastChunk)
             {
-                ////ftpr->filesToPushMutex.Lock();
-                ftpr->filesToPush.PushAtHead(ftp,0,_FILE_AND_LINE_);
-                ////ftpr->filesToPushMutex.Unlock();
+                for (unsigned int flpcIndex=0; flpcIndex < fileListTransfer->fileListProgressCallbacks.Size(); flpcIndex++)
+                    fileListTransfer->fileListProgressCallbacks[flpcIndex]->OnFilePushesComplete(systemAddress, setId);
+
+                // Remove ftpr from fileToPushRecipientList
+                fileListTransfer->RemoveFromList(ftpr);
             }
+
             // ftpr out of scope
             ftpr->Deref();
 
-            // 2/12/2012 Moved this line at after the if (done) block above.
-            // See http://www.jenkinssoftware.com/forum/index.php?topic=4768.msg19738#msg19738
-            fileListTransfer->SendListUnified(dataBlocks,lengths,2, packetPriority, RELIABLE_ORDERED, orderingChannel, systemAddress, false);
-
-            free(buff);
+            free(readBuffer);
+            free(compressBuffer);
             return 0;
         }
         else
@@ -1100,12 +1170,80 @@ int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutp
     return 0;
 }
 }
-void FileListTransfer::SendIRIToAddress(SystemAddress systemAddress, unsigned short setId)
+const char *FileListTransfer::ReadFilePart(FileToPush *ftp, char **readBuffer, unsigned int *readBufferSize, unsigned int *bytesRead)
+{
+    // Prefer reading in place, so the chunk is only copied once, into the send buffers
+    const char *fileData = ftp->incrementalReadInterface->MapFilePart(ftp->fileListNode.fullPathToFile, ftp->currentOffset, ftp->chunkSize, bytesRead, ftp->fileListNode.context);
+    if (fileData)
+        return fileData;
+
+    if (*readBufferSize < ftp->chunkSize)
+    {
+        free(*readBuffer);
+        *readBuffer = (char*) malloc(ftp->chunkSize);
+        if (*readBuffer==0)
+        {
+            *readBufferSize=0;
+            return 0;
+        }
+        *readBufferSize=ftp->chunkSize;
+    }
+    *bytesRead=ftp->incrementalReadInterface->GetFilePart(ftp->fileListNode.fullPathToFile, ftp->currentOffset, ftp->chunkSize, *readBuffer, ftp->fileListNode.context);
+    return *readBuffer;
+}
+void FileListTransfer::ReleaseFilePart(FileToPush *ftp, const char *fileData, const char *readBuffer)
+{
+    if (fileData!=readBuffer)
+        ftp->incrementalReadInterface->UnmapFilePart(ftp->fileListNode.fullPathToFile, fileData);
+}
+const char *FileListTransfer::WriteFilePartCompression(CompressionInterface *compressor, RakNet::BitStream *outBitstream, const char *data, unsigned int *length, char **compressBuffer, unsigned int *compressBufferSize)
+{
+    if (compressor==0)
+        return data;
+
+    unsigned int compressedLength=0;
+    if (*length>0)
+    {
+        unsigned int maxCompressedLength = compressor->GetMaxCompressedLength(*length);
+        if (*compressBufferSize < maxCompressedLength)
+        {
+            free(*compressBuffer);
+            *compressBuffer = (char*) malloc(maxCompressedLength);
+            *compressBufferSize = *compressBuffer ? maxCompressedLength : 0;
+        }
+        if (*compressBuffer)
+            compressedLength = compressor->Compress((const unsigned char*) data, *length, (unsigned char*) *compressBuffer, *compressBufferSize);
+    }
+
+    // Send data that does not compress as is
+    bool compressed = compressedLength>0 && compressedLength<*length;
+    outBitstream->Write(compressed);
+    if (compressed==false)
+        return data;
+    outBitstream->WriteCompressed(compressedLength);
+    *length=compressedLength;
+    return *compressBuffer;
+}
+bool FileListTransfer::ReadFilePartData(RakNet::BitStream *inBitStream, bool compressed, unsigned int compressedLength, char *output, unsigned int length)
+{
+    if (compressed==false)
+        return inBitStream->Read(output, length);
+
+    // If this assert hits, call SetCompressor() with the same type of compressor as the sender
+    RakAssert(compressor);
+    if (compressor==0 || BITS_TO_BYTES(inBitStream->GetNumberOfUnreadBits()) < compressedLength)
+        return false;
+    const unsigned char *compressedData = inBitStream->GetData()+BITS_TO_BYTES(inBitStream->GetReadOffset());
+    inBitStream->IgnoreBytes(compressedLength);
+    return compressor->Decompress(compressedData, compressedLength, (unsigned char*) output, length);
+}
+void FileListTransfer::SendIRIToAddress(SystemAddress systemAddress, unsigned short setId, bool chunkAcknowledged)
 {
     ThreadData threadData;
     threadData.fileListTransfer=this;
     threadData.systemAddress=systemAddress;
     threadData.setId=setId;
+    threadData.chunkAcknowledged=chunkAcknowledged;
 
     if (threadPool.WasStarted())
     {
@@ -1123,7 +1261,7 @@ void FileListTransfer::OnReferencePushAck(Packet *packet)
     inBitStream.IgnoreBits(8);
     unsigned short setId;
     inBitStream.Read(setId);
-    SendIRIToAddress(packet->systemAddress, setId);
+    SendIRIToAddress(packet->systemAddress, setId, true);
 }
 void FileListTransfer::RemoveFromList(FileToPushRecipient *ftpr)
 {
@@ -1141,6 +1279,23 @@ void FileListTransfer::RemoveFromList(FileToPushRecipient *ftpr)
     }
     fileToPushRecipientListMutex.Unlock();
 }
+void FileListTransfer::SetMaxChunksInFlight(unsigned int count)
+{
+    RakAssert(count>0);
+    maxChunksInFlight = count > 0 ? count : 1;
+}
+unsigned int FileListTransfer::GetMaxChunksInFlight(void) const
+{
+    return maxChunksInFlight;
+}
+void FileListTransfer::SetCompressor(CompressionInterface *_compressor)
+{
+    compressor=_compressor;
+}
+CompressionInterface *FileListTransfer::GetCompressor(void) const
+{
+    return compressor;
+}
 unsigned int FileListTransfer::GetPendingFilesToAddress(SystemAddress recipient)
 {
     fileToPushRecipientListMutex.Lock();
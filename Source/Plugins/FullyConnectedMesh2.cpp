@@ -38,6 +38,13 @@ STATIC_FACTORY_DEFINITIONS(FullyConnectedMesh2,FullyConnectedMesh2)
 
 FullyConnectedMesh2::FullyConnectedMesh2()
 {
+    AddReceivedMessageID(ID_REMOTE_NEW_INCOMING_CONNECTION);
+    AddReceivedMessageIDRange(ID_FCM2_NEW_HOST, ID_FCM2_UPDATE_MIN_TOTAL_CONNECTION_COUNT);
+    AddReceivedMessageIDRange(ID_FCM2_VERIFIED_JOIN_START, ID_FCM2_VERIFIED_JOIN_REJECTED);
+    AddReceivedMessageID(ID_NAT_TARGET_UNRESPONSIVE);
+    AddReceivedMessageID(ID_NAT_TARGET_NOT_CONNECTED);
+    AddReceivedMessageID(ID_NAT_CONNECTION_TO_TARGET_LOST);
+    AddReceivedMessageID(ID_NAT_PUNCHTHROUGH_FAILED);
     startupTime=0;
     totalConnectionCount=0;
     ourFCMGuid=0;
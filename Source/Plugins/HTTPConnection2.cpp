@@ -13,23 +13,141 @@
 
 #include "HTTPConnection2.h"
 #include "TCPInterface.h"
+#include "GetTime.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
 
 using namespace RakNet;
 
 STATIC_FACTORY_DEFINITIONS(HTTPConnection2,HTTPConnection2)
 
+// Case insensitive, as header names and values such as "close" are
+static bool StartsWithNoCase(const char *str, const char *end, const char *prefix)
+{
+    for (; *prefix; str++, prefix++)
+    {
+        if (str >= end || tolower((unsigned char) *str) != tolower((unsigned char) *prefix))
+            return false;
+    }
+    return true;
+}
+
+// Finds a header in headers ending at end, which end with a blank line
+// \return The start of its value, or 0
+static const char *FindHeader(const char *headers, const char *end, const char *name)
+{
+    size_t nameLength = strlen(name);
+    const char *line = headers;
+    while (line < end)
+    {
+        const char *lineEnd = (const char *) memchr(line, '\n', end - line);
+        if (lineEnd == 0)
+            return 0;
+        if (StartsWithNoCase(line, lineEnd, name) && line[nameLength] == ':')
+        {
+            const char *value = line + nameLength + 1;
+            while (value < lineEnd && (*value == ' ' || *value == '\t'))
+                value++;
+            return value;
+        }
+        line = lineEnd + 1;
+    }
+    return 0;
+}
+
+// Whether a comma separated header value has this token
+static bool HeaderHasToken(const char *value, const char *token)
+{
+    size_t tokenLength = strlen(token);
+    while (*value && *value != '\r' && *value != '\n')
+    {
+        while (*value == ' ' || *value == '\t' || *value == ',')
+            value++;
+        const char *end = value;
+        while (*end && *end != ',' && *end != '\r' && *end != '\n' && *end != ' ' && *end != '\t')
+            end++;
+        if ((size_t) (end - value) == tokenLength && StartsWithNoCase(value, end, token))
+            return true;
+        if (end == value)
+            break;
+        value = end;
+    }
+    return false;
+}
+
+// Safe methods, which a server does not act on, so the request may be pipelined and sent again (RFC 7230 6.3.1 and 6.3.2).
+// PUT and DELETE are idempotent too, but a second one may still be seen, for example by a Rackspace2 container, so they are sent once like POST.
+static bool IsRepeatableMethod(const char *request)
+{
+    return strncmp(request, "GET ", 4)==0 || strncmp(request, "HEAD ", 5)==0 || strncmp(request, "OPTIONS ", 8)==0 || strncmp(request, "TRACE ", 6)==0;
+}
+
+// Parses a Content-Length value, which may be over 2 GB
+// \return false if it is not a number, or does not fit in 63 bits
+static bool ParseContentLength(const char *value, int64_t *contentLength)
+{
+    if (*value < '0' || *value > '9')
+        return false;
+    uint64_t result=0;
+    for (; *value >= '0' && *value <= '9'; value++)
+    {
+        if (result > (((uint64_t) 1 << 63) - 1 - (uint64_t) (*value - '0')) / 10)
+            return false;
+        result = result * 10 + (uint64_t) (*value - '0');
+    }
+    *contentLength = (int64_t) result;
+    return true;
+}
+
 HTTPConnection2::HTTPConnection2()
 {
+    sentRequestCount=0;
+    maxConnectionsPerHost=4;
+    maxPipelinedRequests=4;
+    idleTimeout=30000;
+    maxRetries=1;
 }
 HTTPConnection2::~HTTPConnection2()
 {
-
+    unsigned int i;
+    for (i=0; i < connections.Size(); i++)
+    {
+        while (connections[i]->sentRequests.Size())
+            delete connections[i]->sentRequests.Pop();
+        free(connections[i]->response);
+        delete connections[i];
+    }
+    while (pendingRequests.Size())
+        delete pendingRequests.Pop();
+    for (i=0; i < completedRequests.Size(); i++)
+        delete completedRequests[i];
+}
+void HTTPConnection2::SetMaxConnectionsPerHost(unsigned int count)
+{
+    RakAssert(count > 0);
+    maxConnectionsPerHost=count;
+}
+void HTTPConnection2::SetMaxPipelinedRequests(unsigned int count)
+{
+    RakAssert(count > 0);
+    maxPipelinedRequests=count;
+}
+void HTTPConnection2::SetIdleTimeout(RakNet::TimeMS timeoutMS)
+{
+    idleTimeout=timeoutMS;
+}
+void HTTPConnection2::SetMaxRetries(unsigned int count)
+{
+    maxRetries=count;
 }
 bool HTTPConnection2::TransmitRequest(const char* stringToTransmit, const char* host, unsigned short port, bool useSSL, int ipVersion, SystemAddress useAddress, void *userData)
 {
     Request *request =new Request;
     request->host=host;
     request->chunked = false;
+    request->repeatable = IsRepeatableMethod(stringToTransmit);
+    request->retryCount = 0;
     if (useAddress!=UNASSIGNED_SYSTEM_ADDRESS)
     {
         request->hostEstimatedAddress=useAddress;
@@ -56,46 +174,17 @@ bool HTTPConnection2::TransmitRequest(const char* stringToTransmit, const char*
     request->ipVersion=ipVersion;
     request->userData=userData;
 
-    if (IsConnected(request->hostEstimatedAddress))
+    connectionsMutex.Lock();
+    if (useAddress!=UNASSIGNED_SYSTEM_ADDRESS && GetConnection(useAddress, 0)==0)
     {
-        sentRequestsMutex.Lock();
-        if (sentRequests.Size()==0)
-        {
-            request->hostCompletedAddress=request->hostEstimatedAddress;
-            sentRequests.Push(request, _FILE_AND_LINE_);
-            sentRequestsMutex.Unlock();
-
-            SendRequest(request);
-        }
-        else
-        {
-            // Request pending, push it
-            pendingRequestsMutex.Lock();
-            pendingRequests.Push(request, _FILE_AND_LINE_);
-            pendingRequestsMutex.Unlock();
-
-            sentRequestsMutex.Unlock();
-        }
-    }
-    else
-    {
-        pendingRequestsMutex.Lock();
-        pendingRequests.Push(request, _FILE_AND_LINE_);
-        pendingRequestsMutex.Unlock();
-
-        if (ipVersion!=6)
-        {
-            tcpInterface->Connect(host, port, false, AF_INET);
-        }
-        else
-        {
-            #if RAKNET_SUPPORT_IPV6
-                tcpInterface->Connect(host, port, false, AF_INET6);
-            #else
-                RakAssert("HTTPConnection2::TransmitRequest needs define  RAKNET_SUPPORT_IPV6" && 0);
-            #endif
-        }
+        // Connected by the user, so use it like a connection of the pool of this host
+        Connection *connection = NewConnection(request);
+        connection->systemAddress=useAddress;
+        connection->connected=true;
     }
+    pendingRequests.Push(request, _FILE_AND_LINE_);
+    SendPendingRequests();
+    connectionsMutex.Unlock();
     return true;
 }
 bool HTTPConnection2::GetResponse( RakString &stringTransmitted, RakString &hostTransmitted, RakString &responseReceived, SystemAddress &hostReceived, int &contentOffset )
@@ -110,7 +199,7 @@ bool HTTPConnection2::GetResponse( RakString &stringTransmitted, RakString &host
     if (completedRequests.Size()>0)
     {
         Request *completedRequest = completedRequests[0];
-        completedRequests.RemoveAtIndexFast(0);
+        completedRequests.RemoveAtIndex(0);
         completedRequestsMutex.Unlock();
 
         responseReceived = completedRequest->stringReceived;
@@ -131,473 +220,547 @@ bool HTTPConnection2::GetResponse( RakString &stringTransmitted, RakString &host
 }
 bool HTTPConnection2::IsBusy(void) const
 {
-    return pendingRequests.Size()>0 || sentRequests.Size()>0;
+    return pendingRequests.Size()>0 || sentRequestCount>0;
 }
 bool HTTPConnection2::HasResponse(void) const
 {
     return completedRequests.Size()>0;
 }
-int ReadChunkSize( char *txtStart, char **txtEnd ) 
+bool HTTPConnection2::IsSameHost(const Connection *connection, const Request *request) const
 {
-//     char lengthStr[32];
-//     memset(lengthStr, 0, 32);
-//     memcpy(lengthStr, txtStart, txtEnd - txtStart);
-    return strtoul(txtStart, txtEnd,16);
-    // return atoi(lengthStr);
+    return connection->port==request->port && connection->useSSL==request->useSSL && connection->ipVersion==request->ipVersion && connection->host==request->host;
 }
-void ReadChunkBlock( size_t &currentChunkSize, size_t &bytesReadSoFar, char *txtIn, RakString &txtOut)
+bool HTTPConnection2::IsSameHost(const Request *request1, const Request *request2) const
 {
-    size_t bytesToRead;
-    size_t sLen;
-
-    do
+    return request1->port==request2->port && request1->useSSL==request2->useSSL && request1->ipVersion==request2->ipVersion && request1->host==request2->host;
+}
+HTTPConnection2::Connection *HTTPConnection2::GetConnection(const SystemAddress &systemAddress, unsigned int *index)
+{
+    unsigned int i;
+    for (i=0; i < connections.Size(); i++)
     {
-        bytesToRead = currentChunkSize - bytesReadSoFar;
-        sLen = strlen(txtIn);
-        if (sLen < bytesToRead)
-            bytesToRead = sLen;
-        txtOut.AppendBytes(txtIn, bytesToRead);
-        txtIn += bytesToRead;
-        bytesReadSoFar += bytesToRead;
-        if (*txtIn == 0)
+        Connection *connection = connections[i];
+        if (connection->connected && connection->systemAddress==systemAddress && connection->systemAddress.systemIndex==systemAddress.systemIndex)
         {
-        //    currentChunkSize=0;
-            return;
+            if (index)
+                *index=i;
+            return connection;
         }
-        // char *newLine = strstr(txtIn, "\r\n");
-        if (txtIn[0] && txtIn[0]=='\r' && txtIn[1] && txtIn[1]=='\n' )
-            txtIn += 2; // Newline
-        char *newLine;
-        currentChunkSize = ReadChunkSize(txtIn, &newLine);
-        RakAssert(currentChunkSize < 50000); // Sanity check
-        if (currentChunkSize == 0)
-            return;
-        if (newLine == 0)
-            return;
-        bytesReadSoFar=0;
-        txtIn = newLine + 2;
-    } while (txtIn);
+    }
+    return 0;
 }
-PluginReceiveResult HTTPConnection2::OnReceive(Packet *packet)
+void HTTPConnection2::SendPendingRequests(void)
 {
-    unsigned int i;
-
-    bool locked=true;
-    sentRequestsMutex.Lock();
-    for (i=0; i < sentRequests.Size(); i++)
+    // The hosts of the requests left waiting so far, and how many of each, so connections are opened only for requests that wait for them
+    DataStructures::List<Request*> waitingHosts;
+    DataStructures::List<unsigned int> waitingCounts;
+    unsigned int i=0, j;
+    while (i < pendingRequests.Size())
     {
-        Request *sentRequest = sentRequests[i];
-        if (sentRequest->hostCompletedAddress==packet->systemAddress)
-        {
-            sentRequests.RemoveAtIndexFast(i);
-            locked=false;
-            sentRequestsMutex.Unlock();
-
-            /*
-            static FILE * pFile = 0;
-            if (pFile==0)
-            {
-                long lSize;
-                char * buffer;
-                size_t result;
-
-                pFile = fopen ( "string_received.txt" , "rb" );
-                if (pFile==NULL) {fputs ("File error",stderr); exit (1);}
+        Request *request = pendingRequests[i];
 
-                // obtain file size:
-                fseek (pFile , 0 , SEEK_END);
-                lSize = ftell (pFile);
-                rewind (pFile);
+        // The connection of this host with the fewest requests waiting, if any has room
+        Connection *best=0;
+        unsigned int poolSize=0, connecting=0;
+        for (j=0; j < connections.Size(); j++)
+        {
+            Connection *connection = connections[j];
+            if (IsSameHost(connection, request)==false)
+                continue;
+            poolSize++;
+            if (connection->connected==false)
+                connecting++;
+            else if (HasRoomFor(connection, request) && (best==0 || connection->sentRequests.Size() < best->sentRequests.Size()))
+                best=connection;
+        }
 
-                // allocate memory to contain the whole file:
-                buffer = (char*) malloc (sizeof(char)*lSize);
-                if (buffer == NULL) {fputs ("Memory error",stderr); exit (2);}
+        if (best)
+        {
+            pendingRequests.RemoveAtIndex(i);
+            SendRequest(best, request);
+            continue;
+        }
 
-                // copy the file into the buffer:
-                result = fread (buffer,1,lSize,pFile);
-                if (result != lSize) {fputs ("Reading error",stderr); exit (3);}
+        // Connect again only if the connections being opened are already wanted by earlier requests
+        for (j=0; j < waitingHosts.Size(); j++)
+        {
+            if (IsSameHost(waitingHosts[j], request))
+                break;
+        }
+        if (j==waitingHosts.Size())
+        {
+            waitingHosts.Push(request, _FILE_AND_LINE_);
+            waitingCounts.Push(0, _FILE_AND_LINE_);
+        }
+        unsigned int waitingBefore=waitingCounts[j]++;
+        if (connecting <= waitingBefore && poolSize < maxConnectionsPerHost)
+        {
+            NewConnection(request);
 
-                packet->data=(unsigned char*) buffer;
-                packet->length=lSize;
+            if (request->ipVersion!=6)
+            {
+                tcpInterface->Connect(request->host.C_String(), request->port, false, AF_INET);
             }
-            */
-
-
-            const char *isFirstChunk = strstr((char*) packet->data, "Transfer-Encoding: chunked");
-            if (isFirstChunk)
+            else
             {
-                //printf((char*) packet->data);
+#if RAKNET_SUPPORT_IPV6
+                tcpInterface->Connect(request->host.C_String(), request->port, false, AF_INET6);
+#else
+                RakAssert("HTTPConnection2::TransmitRequest needs define  RAKNET_SUPPORT_IPV6" && 0);
+#endif
+            }
+        }
+        i++;
+    }
+}
+HTTPConnection2::Connection *HTTPConnection2::NewConnection(const Request *request)
+{
+    Connection *connection = new Connection;
+    connection->host=request->host;
+    connection->port=request->port;
+    connection->useSSL=request->useSSL;
+    connection->ipVersion=request->ipVersion;
+    connection->hostEstimatedAddress=request->hostEstimatedAddress;
+    connection->connected=false;
+    connection->closeAfterResponses=false;
+    connection->serverCloses=false;
+    connection->idleSince=RakNet::GetTimeMS();
+    connection->state=RS_HEADERS;
+    connection->response=0;
+    connection->responseLength=0;
+    connection->responseCapacity=0;
+    connection->lineLength=0;
+    connections.Push(connection, _FILE_AND_LINE_);
+    return connection;
+}
 
-                locked=false;
-                sentRequestsMutex.Unlock();
+bool HTTPConnection2::HasRoomFor(const Connection *connection, const Request *request) const
+{
+    if (connection->connected==false || connection->closeAfterResponses || connection->sentRequests.Size() >= maxPipelinedRequests)
+        return false;
+    // Only repeatable requests go after one another, so nothing is sent after another request until it is answered
+    return connection->sentRequests.IsEmpty() || (request->repeatable && connection->sentRequests.Peek()->repeatable);
+}
+bool HTTPConnection2::AppendResponse(Connection *connection, const char *data, unsigned int length)
+{
+    // One more byte for the terminator RakString expects
+    if ((uint64_t) connection->responseLength + length + 1 > 0xFFFFFFFFu)
+        return false;
+    if (connection->responseLength + length + 1 > connection->responseCapacity)
+    {
+        uint64_t capacity = connection->responseCapacity ? (uint64_t) connection->responseCapacity * 2 : 4096;
+        while (capacity < connection->responseLength + length + 1)
+            capacity *= 2;
+        if (capacity > 0xFFFFFFFFu)
+            capacity = 0xFFFFFFFFu;
+        char *response = (char*) realloc(connection->response, (size_t) capacity);
+        if (response==0)
+            return false;
+        connection->response = response;
+        connection->responseCapacity = (unsigned int) capacity;
+    }
+    memcpy(connection->response + connection->responseLength, data, length);
+    connection->responseLength += length;
+    connection->response[connection->responseLength]=0;
+    return true;
+}
+bool HTTPConnection2::ReadLine(Connection *connection, const char **data, unsigned int *length)
+{
+    const char *newLine = (const char*) memchr(*data, '\n', *length);
+    unsigned int bytes = newLine ? (unsigned int) (newLine - *data) + 1 : *length;
+
+    // Only the start of a line is needed, such as the size before chunk extensions
+    unsigned int copy = bytes;
+    if (connection->lineLength + copy > sizeof(connection->line) - 1)
+        copy = sizeof(connection->line) - 1 - connection->lineLength;
+    memcpy(connection->line + connection->lineLength, *data, copy);
+    connection->lineLength += copy;
+    *data += bytes;
+    *length -= bytes;
+    if (newLine==0)
+        return false;
+
+    connection->line[connection->lineLength]=0;
+    while (connection->lineLength > 0 && (connection->line[connection->lineLength-1]=='\n' || connection->line[connection->lineLength-1]=='\r'))
+        connection->line[--connection->lineLength]=0;
+    connection->lineLength=0;
+    return true;
+}
+bool HTTPConnection2::ParseHeaders(Connection *connection)
+{
+    Request *request = connection->sentRequests.Peek();
+    const char *headers = connection->response;
+    const char *end = connection->response + connection->headersLength;
+
+    // "HTTP/1.1 200 OK"
+    int status = 0;
+    const char *space = (const char*) memchr(headers, ' ', end - headers);
+    if (space)
+        status = atoi(space + 1);
+
+    bool keepAlive = StartsWithNoCase(headers, end, "HTTP/1.0")==false;
+    const char *value = FindHeader(headers, end, "Connection");
+    if (value)
+    {
+        if (HeaderHasToken(value, "close"))
+            keepAlive=false;
+        else if (HeaderHasToken(value, "keep-alive"))
+            keepAlive=true;
+    }
+    if (keepAlive==false)
+    {
+        connection->closeAfterResponses=true;
+        connection->serverCloses=true;
+    }
 
-                sentRequest->chunked = true;
-                char *chunkStrStart = strstr((char*) packet->data, "\r\n\r\n");
-                RakAssert(chunkStrStart);
+    if (status >= 100 && status < 200)
+    {
+        // 100 Continue and the like come before the actual response
+        connection->responseLength=0;
+        return true;
+    }
 
-                chunkStrStart += 4; // strlen("\r\n\r\n");
-                char *body_header; // = strstr(chunkStrStart, "\r\n");
-                sentRequest->thisChunkSize = ReadChunkSize(chunkStrStart, &body_header);
-                sentRequest->bytesReadForThisChunk = 0;
-                sentRequest->contentOffset = 0;
+    value = FindHeader(headers, end, "Transfer-Encoding");
+    request->chunked = value!=0 && HeaderHasToken(value, "chunked");
+    value = FindHeader(headers, end, "Content-Length");
+    request->contentLength = -1;
+    if (value && request->chunked==false && ParseContentLength(value, &request->contentLength)==false)
+        return false;
 
-                if (sentRequest->thisChunkSize == 0)
-                {
-                    // Done
-                    completedRequestsMutex.Lock();
-                    completedRequests.Push(sentRequest, _FILE_AND_LINE_);
-                    completedRequestsMutex.Unlock();
+    if (status==204 || status==304 || StartsWithNoCase(request->stringToTransmit.C_String(), request->stringToTransmit.C_String() + request->stringToTransmit.GetLength(), "HEAD "))
+    {
+        connection->bytesRemaining=0;
+        connection->state=RS_BODY;
+    }
+    else if (request->chunked)
+        connection->state=RS_CHUNK_SIZE;
+    else if (request->contentLength >= 0)
+    {
+        // The response is held in memory, after the headers
+        if ((uint64_t) request->contentLength >= 0xFFFFFFFFu - connection->headersLength)
+            return false;
+        connection->bytesRemaining=(size_t) request->contentLength;
+        connection->state=RS_BODY;
+    }
+    else
+    {
+        // The server closes the connection at the end of the body
+        connection->closeAfterResponses=true;
+        connection->serverCloses=true;
+        connection->state=RS_BODY_UNTIL_CLOSE;
+    }
+    return true;
+}
+bool HTTPConnection2::ParseResponse(Connection *connection, const char *data, unsigned int length)
+{
+    while (length > 0 || (connection->state==RS_BODY && connection->bytesRemaining==0))
+    {
+        if (connection->sentRequests.IsEmpty())
+            return false;
 
-                    // If there is another command waiting for this server, send it
-                    SendPendingRequestToConnectedSystem(packet->systemAddress);
-                }
-                else
+        switch (connection->state)
+        {
+        case RS_HEADERS:
+            {
+                // Search only what is new, and the three bytes before it that may start the blank line
+                unsigned int searchStart = connection->responseLength > 3 ? connection->responseLength - 3 : 0;
+                if (AppendResponse(connection, data, length)==false)
+                    return false;
+                const char *blankLine = 0;
+                for (const char *c = connection->response + searchStart; c + 4 <= connection->response + connection->responseLength; c++)
                 {
-
-                    // char *offset = strstr((char*) packet->data+1, "2000");
-
-                    body_header+=2;
-                    ReadChunkBlock(sentRequest->thisChunkSize, sentRequest->bytesReadForThisChunk, body_header, sentRequest->stringReceived);
-
-                    if (sentRequest->thisChunkSize==0)
-                    {
-                        // Done
-                        completedRequestsMutex.Lock();
-                        completedRequests.Push(sentRequest, _FILE_AND_LINE_);
-                        completedRequestsMutex.Unlock();
-
-                        // If there is another command waiting for this server, send it
-                        SendPendingRequestToConnectedSystem(packet->systemAddress);
-                    }
-                    else
+                    if (c[0]=='\r' && c[1]=='\n' && c[2]=='\r' && c[3]=='\n')
                     {
-                        // Not done
-                        sentRequestsMutex.Lock();
-                        sentRequests.Push(sentRequest, _FILE_AND_LINE_);
-                        sentRequestsMutex.Unlock();
+                        blankLine = c;
+                        break;
                     }
                 }
+                if (blankLine==0)
+                    return true;
+
+                // What follows the headers is parsed as the body
+                unsigned int headersLength = (unsigned int) (blankLine + 4 - connection->response);
+                unsigned int bodyBytes = connection->responseLength - headersLength;
+                data += length - bodyBytes;
+                length = bodyBytes;
+                connection->responseLength = headersLength;
+                connection->response[headersLength]=0;
+                connection->headersLength = headersLength;
+                if (ParseHeaders(connection)==false)
+                    return false;
             }
-            else if (sentRequest->chunked)
+            break;
+        case RS_BODY:
             {
-                ReadChunkBlock(sentRequest->thisChunkSize, sentRequest->bytesReadForThisChunk, (char*) packet->data, sentRequest->stringReceived);
-
-                if (sentRequest->thisChunkSize==0)
-                {
-                    // Done
-                    completedRequestsMutex.Lock();
-                    completedRequests.Push(sentRequest, _FILE_AND_LINE_);
-                    completedRequestsMutex.Unlock();
-
-                    // If there is another command waiting for this server, send it
-                    SendPendingRequestToConnectedSystem(packet->systemAddress);
-                }
-                else
-                {
-                    // Not done
-                    sentRequestsMutex.Lock();
-                    sentRequests.Push(sentRequest, _FILE_AND_LINE_);
-                    sentRequestsMutex.Unlock();
-                }
-
+                unsigned int bytes = length;
+                if (bytes > connection->bytesRemaining)
+                    bytes = (unsigned int) connection->bytesRemaining;
+                if (AppendResponse(connection, data, bytes)==false)
+                    return false;
+                data += bytes;
+                length -= bytes;
+                connection->bytesRemaining -= bytes;
+                if (connection->bytesRemaining==0)
+                    CompleteRequest(connection);
             }
-            else
+            break;
+        case RS_BODY_UNTIL_CLOSE:
+            if (AppendResponse(connection, data, length)==false)
+                return false;
+            length=0;
+            break;
+        case RS_CHUNK_SIZE:
+            if (ReadLine(connection, &data, &length))
             {
-                sentRequest->stringReceived+=packet->data;
-
-                if (sentRequest->contentLength==-1)
-                {
-                    const char *length_header = strstr(sentRequest->stringReceived.C_String(), "Content-Length: ");
-                    if(length_header)
-                    {
-                        length_header += 16; // strlen("Content-Length: ");
-
-                        unsigned int clLength;
-                        for (clLength=0; length_header[clLength] && length_header[clLength] >= '0' && length_header[clLength] <= '9'; clLength++)
-                            ;
-                        if (clLength>0 && (length_header[clLength]=='\r' || length_header[clLength]=='\n'))
-                        {
-                            sentRequest->contentLength = RakString::ReadIntFromSubstring(length_header, 0, clLength);
-                        }
-                    }
-                }
-
-                // If we know the content length, find \r\n\r\n
-                if (sentRequest->contentLength != -1)
-                {
-                    if (sentRequest->contentLength > 0)
-                    {
-                        const char *body_header = strstr(sentRequest->stringReceived.C_String(), "\r\n\r\n");
-                        if (body_header)
-                        {
-                            body_header += 4; // strlen("\r\n\r\n");
-                            size_t slen = strlen(body_header);
-                            //RakAssert(slen <= (size_t) sentRequest->contentLength);
-                            if (slen >= (size_t) sentRequest->contentLength)
-                            {
-                                sentRequest->contentOffset = body_header - sentRequest->stringReceived.C_String();
-                                completedRequestsMutex.Lock();
-                                completedRequests.Push(sentRequest, _FILE_AND_LINE_);
-                                completedRequestsMutex.Unlock();
-
-                                // If there is another command waiting for this server, send it
-                                SendPendingRequestToConnectedSystem(packet->systemAddress);
-                            }
-                            else
-                            {
-                                sentRequestsMutex.Lock();
-                                sentRequests.Push(sentRequest, _FILE_AND_LINE_);
-                                sentRequestsMutex.Unlock();
-                            }
-                        }
-
-                        else
-                        {
-                            sentRequestsMutex.Lock();
-                            sentRequests.Push(sentRequest, _FILE_AND_LINE_);
-                            sentRequestsMutex.Unlock();
-                        }
-                    }
-                    else
-                    {
-                        sentRequest->contentOffset=-1;
-                        completedRequestsMutex.Lock();
-                        completedRequests.Push(sentRequest, _FILE_AND_LINE_);
-                        completedRequestsMutex.Unlock();
-
-                        // If there is another command waiting for this server, send it
-                        SendPendingRequestToConnectedSystem(packet->systemAddress);
-                    }
-                }
-                else
-                {
-                    const char *firstNewlineSet = strstr(sentRequest->stringReceived.C_String(), "\r\n\r\n");
-                    if (firstNewlineSet!=0)
-                    {
-                        int offset = firstNewlineSet - sentRequest->stringReceived.C_String();
-                        if (sentRequest->stringReceived.C_String()[offset+4]==0)
-                            sentRequest->contentOffset=-1;
-                        else
-                            sentRequest->contentOffset=offset+4;
-                        completedRequestsMutex.Lock();
-                        completedRequests.Push(sentRequest, _FILE_AND_LINE_);
-                        completedRequestsMutex.Unlock();
-
-                        // If there is another command waiting for this server, send it
-                        SendPendingRequestToConnectedSystem(packet->systemAddress);
-                    }
-                    else
-                    {
-                        sentRequestsMutex.Lock();
-                        sentRequests.Push(sentRequest, _FILE_AND_LINE_);
-                        sentRequestsMutex.Unlock();
-                    }
-                }
+                char *sizeEnd;
+                connection->bytesRemaining = strtoul(connection->line, &sizeEnd, 16);
+                if (sizeEnd==connection->line)
+                    return false;
+                connection->state = connection->bytesRemaining ? RS_CHUNK_DATA : RS_CHUNK_TRAILER;
             }
-
-
+            break;
+        case RS_CHUNK_DATA:
+            {
+                // Appended as it arrives, so the body is never held twice
+                unsigned int bytes = length;
+                if (bytes > connection->bytesRemaining)
+                    bytes = (unsigned int) connection->bytesRemaining;
+                if (AppendResponse(connection, data, bytes)==false)
+                    return false;
+                data += bytes;
+                length -= bytes;
+                connection->bytesRemaining -= bytes;
+                if (connection->bytesRemaining==0)
+                    connection->state=RS_CHUNK_DATA_END;
+            }
+            break;
+        case RS_CHUNK_DATA_END:
+            if (ReadLine(connection, &data, &length))
+            {
+                if (connection->line[0]!=0)
+                    return false;
+                connection->state=RS_CHUNK_SIZE;
+            }
+            break;
+        case RS_CHUNK_TRAILER:
+            // Trailer headers are skipped, up to the blank line
+            if (ReadLine(connection, &data, &length) && connection->line[0]==0)
+                CompleteRequest(connection);
             break;
         }
     }
-
-    if (locked==true)
-        sentRequestsMutex.Unlock();
-
-    return RR_CONTINUE_PROCESSING;
-}
-
-void HTTPConnection2::OnNewConnection(const SystemAddress &systemAddress, RakNetGUID rakNetGUID, bool isIncoming)
-{
-    (void) rakNetGUID;
-    (void) isIncoming; // unknown
-
-    SendPendingRequestToConnectedSystem(systemAddress);
+    return true;
 }
-void HTTPConnection2::SendPendingRequestToConnectedSystem(SystemAddress sa)
+void HTTPConnection2::CompleteRequest(Connection *connection)
 {
-    if (sa==UNASSIGNED_SYSTEM_ADDRESS)
-        return;
-
-    unsigned int requestsSent=0;
-
-    // Search through requests to find a match for this instance of TCPInterface and SystemAddress
-    unsigned int i;
-    i=0;
-    pendingRequestsMutex.Lock();
-    while (i < pendingRequests.Size())
+    Request *request = connection->sentRequests.Pop();
+    sentRequestCount--;
+    request->hostCompletedAddress=connection->systemAddress;
+    if (connection->responseLength > 0)
     {
-        Request *request = pendingRequests[i];
-        if (request->hostEstimatedAddress==sa)
-        {
-            pendingRequests.RemoveAtIndex(i);
-            // Send this request
-            request->hostCompletedAddress=sa;
-
-            sentRequestsMutex.Lock();
-            sentRequests.Push(request, _FILE_AND_LINE_);
-            sentRequestsMutex.Unlock();
-
-            pendingRequestsMutex.Unlock();
-
-#if OPEN_SSL_CLIENT_SUPPORT==1
-            if (request->useSSL)
-                tcpInterface->StartSSLClient(sa);
-#endif
-
-            SendRequest(request);
-            requestsSent++;
-            pendingRequestsMutex.Lock();
-            break;
-        }
+        request->stringReceived.AppendBytes(connection->response, connection->responseLength);
+        if (connection->state==RS_HEADERS)
+            request->contentOffset = 0;
         else
-        {
-            i++;
-        }
+            request->contentOffset = connection->responseLength > connection->headersLength ? (int) connection->headersLength : -1;
     }
-    pendingRequestsMutex.Unlock();
+    CompleteRequest(request);
 
-    if (requestsSent==0)
+    connection->state=RS_HEADERS;
+    connection->responseLength=0;
+    connection->lineLength=0;
+    connection->idleSince=RakNet::GetTimeMS();
+}
+void HTTPConnection2::CompleteRequest(Request *request)
+{
+    completedRequestsMutex.Lock();
+    completedRequests.Push(request, _FILE_AND_LINE_);
+    completedRequestsMutex.Unlock();
+}
+void HTTPConnection2::RemoveConnection(unsigned int index, bool retry)
+{
+    Connection *connection = connections[index];
+    connections.RemoveAtIndex(index);
+
+    // The body of the oldest request may run to the close
+    if (connection->sentRequests.Size() > 0 && connection->state==RS_BODY_UNTIL_CLOSE)
+        CompleteRequest(connection);
+
+    // The oldest request uses up a retry, as the server may have closed because of it, unless the server said it would close before that request.
+    // The requests pipelined after it were not answered either way, so they are sent again without counting. Each time, one request was answered or used up a retry.
+    bool oldest = connection->serverCloses==false || connection->state!=RS_HEADERS || connection->responseLength > 0;
+    unsigned int retryIndex=0;
+    while (connection->sentRequests.Size() > 0)
     {
-        pendingRequestsMutex.Lock();
-        if (pendingRequests.Size() > 0)
+        Request *request = connection->sentRequests.Pop();
+        sentRequestCount--;
+        if (retry && request->repeatable && (oldest==false || request->retryCount < maxRetries))
         {
-            // Just assign
-            Request *request = pendingRequests[0];
-            pendingRequests.RemoveAtIndex(0);
-
-            request->hostCompletedAddress=sa;
-
-            sentRequestsMutex.Lock();
-            sentRequests.Push(request, _FILE_AND_LINE_);
-            sentRequestsMutex.Unlock();
-            pendingRequestsMutex.Unlock();
-
-            // Send
-#if OPEN_SSL_CLIENT_SUPPORT==1
-            if (request->useSSL)
-                tcpInterface->StartSSLClient(sa);
-#endif
-
-
-            SendRequest(request);
+            if (oldest)
+                request->retryCount++;
+            pendingRequests.PushAtHead(request, retryIndex++, _FILE_AND_LINE_);
         }
         else
         {
-            pendingRequestsMutex.Unlock();
+            // A request that is not repeatable may have been acted on, so it fails with no response rather than be sent twice. So does one cut off too often.
+            request->hostCompletedAddress=connection->systemAddress;
+            CompleteRequest(request);
         }
+        oldest=false;
     }
+
+    free(connection->response);
+    delete connection;
 }
-void HTTPConnection2::RemovePendingRequest(SystemAddress sa)
+PluginReceiveResult HTTPConnection2::OnReceive(Packet *packet)
 {
-    unsigned int i;
-    i=0;
-    pendingRequestsMutex.Lock();
-    for (i=0; i < pendingRequests.Size(); i++)
+    bool closeConnection=false;
+    connectionsMutex.Lock();
+    Connection *connection = GetConnection(packet->systemAddress, 0);
+    if (connection)
     {
-        Request *request = pendingRequests[i];
-        if (request->hostEstimatedAddress==sa)
+        if (ParseResponse(connection, (const char*) packet->data, packet->length)==false)
         {
-            pendingRequests.RemoveAtIndex(i);
-            delete request;
+            // Sending it again would get the same response, so the request fails with no response
+            if (connection->sentRequests.Size() > 0)
+            {
+                Request *request = connection->sentRequests.Pop();
+                sentRequestCount--;
+                CompleteRequest(request);
+                connection->state=RS_HEADERS;
+                connection->responseLength=0;
+            }
+            closeConnection=true;
         }
-        else
-            i++;
+        else if (connection->closeAfterResponses && connection->sentRequests.IsEmpty())
+            closeConnection=true;
+        SendPendingRequests();
     }
+    connectionsMutex.Unlock();
+
+    // This calls OnClosedConnection()
+    if (closeConnection)
+        tcpInterface->CloseConnection(packet->systemAddress);
 
-    pendingRequestsMutex.Unlock();
+    return RR_CONTINUE_PROCESSING;
 }
-void HTTPConnection2::SendNextPendingRequest(void)
+
+void HTTPConnection2::OnNewConnection(const SystemAddress &systemAddress, RakNetGUID rakNetGUID, bool isIncoming)
 {
-    // Send a pending request
-    pendingRequestsMutex.Lock();
-    if (pendingRequests.Size()>0)
-    {
-        Request *pendingRequest = pendingRequests.Peek();
-        pendingRequestsMutex.Unlock();
+    (void) rakNetGUID;
+    (void) isIncoming; // unknown
 
-        if (pendingRequest->ipVersion!=6)
-        {
-            tcpInterface->Connect(pendingRequest->host.C_String(), pendingRequest->port, false, AF_INET);
-        }
-        else
+    if (systemAddress==UNASSIGNED_SYSTEM_ADDRESS)
+        return;
+
+    connectionsMutex.Lock();
+    unsigned int i;
+    for (i=0; i < connections.Size(); i++)
+    {
+        Connection *connection = connections[i];
+        if (connection->connected==false && connection->hostEstimatedAddress==systemAddress)
         {
-#if RAKNET_SUPPORT_IPV6
-            tcpInterface->Connect(pendingRequest->host.C_String(), pendingRequest->port, false, AF_INET6);
-#else
-            RakAssert("HTTPConnection2::TransmitRequest needs define  RAKNET_SUPPORT_IPV6" && 0);
+            connection->connected=true;
+            connection->systemAddress=systemAddress;
+            connection->idleSince=RakNet::GetTimeMS();
+#if OPEN_SSL_CLIENT_SUPPORT==1
+            if (connection->useSSL)
+                tcpInterface->StartSSLClient(systemAddress);
 #endif
+            SendPendingRequests();
+            break;
         }
     }
-    else
-    {
-        pendingRequestsMutex.Unlock();
-    }
+    connectionsMutex.Unlock();
 }
-
 void HTTPConnection2::OnFailedConnectionAttempt(Packet *packet, PI2_FailedConnectionAttemptReason failedConnectionAttemptReason)
 {
     (void) failedConnectionAttemptReason;
     if (packet->systemAddress==UNASSIGNED_SYSTEM_ADDRESS)
         return;
 
-    RemovePendingRequest(packet->systemAddress);
-
-    SendNextPendingRequest();
-}
-void HTTPConnection2::OnClosedConnection(const SystemAddress &systemAddress, RakNetGUID rakNetGUID, PI2_LostConnectionReason lostConnectionReason )
-{
-    (void) lostConnectionReason;
-    (void) rakNetGUID;
-
-    if (systemAddress==UNASSIGNED_SYSTEM_ADDRESS)
-        return;
-
-    // Update sent requests to completed requests
-    unsigned int i;
-    i=0;
-    sentRequestsMutex.Lock();
-    while (i < sentRequests.Size())
+    connectionsMutex.Lock();
+    unsigned int i, j;
+    for (i=0; i < connections.Size(); i++)
     {
-        if (sentRequests[i]->hostCompletedAddress==systemAddress)
+        Connection *connection = connections[i];
+        if (connection->connected==false && connection->hostEstimatedAddress==packet->systemAddress)
         {
-            Request *sentRequest = sentRequests[i];
-            if (sentRequest->chunked==false && sentRequest->stringReceived.IsEmpty()==false)
+            // If no connection to this host is open to take its requests, they fail with no response.
+            // Other connections still being opened are not waited for, as they would likely fail too, and the failed one would be opened again.
+            bool hasOpenConnection=false;
+            for (j=0; j < connections.Size(); j++)
+            {
+                if (connections[j]->connected && connections[j]->port==connection->port && connections[j]->useSSL==connection->useSSL &&
+                    connections[j]->ipVersion==connection->ipVersion && connections[j]->host==connection->host)
+                    hasOpenConnection=true;
+            }
+            if (hasOpenConnection==false)
             {
-                if (strstr(sentRequest->stringReceived.C_String(), "Content-Length: "))
+                j=0;
+                while (j < pendingRequests.Size())
                 {
-                    char *body_header = strstr((char*) sentRequest->stringReceived.C_String(), "\r\n\r\n");
-                    if (body_header)
+                    Request *request = pendingRequests[j];
+                    if (IsSameHost(connection, request))
                     {
-                        body_header += 4; // strlen("\r\n\r\n");
-                        sentRequest->contentOffset = body_header - sentRequest->stringReceived.C_String();
+                        pendingRequests.RemoveAtIndex(j);
+                        CompleteRequest(request);
                     }
                     else
-                    {
-                        sentRequest->contentOffset = 0;
-                    }
-
-                }
-                else
-                {
-                    sentRequest->contentOffset = 0;
+                        j++;
                 }
             }
+            RemoveConnection(i, false);
+            break;
+        }
+    }
+    SendPendingRequests();
+    connectionsMutex.Unlock();
+}
+void HTTPConnection2::OnClosedConnection(const SystemAddress &systemAddress, RakNetGUID rakNetGUID, PI2_LostConnectionReason lostConnectionReason )
+{
+    (void) lostConnectionReason;
+    (void) rakNetGUID;
 
+    if (systemAddress==UNASSIGNED_SYSTEM_ADDRESS)
+        return;
 
-            completedRequestsMutex.Lock();
-            completedRequests.Push(sentRequests[i], _FILE_AND_LINE_);
-            completedRequestsMutex.Unlock();
-
-            sentRequests.RemoveAtIndexFast(i);
-        }
-        else
-        {
-            i++;
-        }
+    connectionsMutex.Lock();
+    unsigned int index;
+    if (GetConnection(systemAddress, &index))
+    {
+        RemoveConnection(index, true);
+        SendPendingRequests();
     }
-    sentRequestsMutex.Unlock();
+    connectionsMutex.Unlock();
+}
+void HTTPConnection2::OnRakPeerShutdown(void)
+{
+    // TCPInterface drops its connections without calling OnClosedConnection()
+    connectionsMutex.Lock();
+    while (connections.Size())
+        RemoveConnection(connections.Size()-1, false);
+    while (pendingRequests.Size())
+        CompleteRequest(pendingRequests.Pop());
+    connectionsMutex.Unlock();
+}
+void HTTPConnection2::Update(void)
+{
+    // Close connections idle for too long. Collected first, as closing calls OnClosedConnection().
+    SystemAddress idleConnections[16];
+    unsigned int idleCount=0, i;
+    RakNet::TimeMS time = RakNet::GetTimeMS();
+    connectionsMutex.Lock();
+    for (i=0; i < connections.Size() && idleCount < sizeof(idleConnections)/sizeof(idleConnections[0]); i++)
+    {
+        Connection *connection = connections[i];
+        if (connection->connected && connection->sentRequests.IsEmpty() && time - connection->idleSince > idleTimeout)
+            idleConnections[idleCount++]=connection->systemAddress;
+    }
+    connectionsMutex.Unlock();
 
-    SendNextPendingRequest();
+    for (i=0; i < idleCount; i++)
+        tcpInterface->CloseConnection(idleConnections[i]);
 }
 bool HTTPConnection2::IsConnected(SystemAddress sa)
 {
@@ -613,9 +776,17 @@ bool HTTPConnection2::IsConnected(SystemAddress sa)
     }
     return false;
 }
-void HTTPConnection2::SendRequest(Request *request)
+void HTTPConnection2::SendRequest(Connection *connection, Request *request)
 {
-    tcpInterface->Send(request->stringToTransmit.C_String(), (unsigned int) request->stringToTransmit.GetLength(), request->hostCompletedAddress, false);
+    request->hostCompletedAddress=connection->systemAddress;
+    connection->sentRequests.Push(request, _FILE_AND_LINE_);
+    sentRequestCount++;
+
+    // No more requests go after one that asks the server to close
+    if (strstr(request->stringToTransmit.C_String(), "Connection: close"))
+        connection->closeAfterResponses=true;
+
+    tcpInterface->Send(request->stringToTransmit.C_String(), (unsigned int) request->stringToTransmit.GetLength(), connection->systemAddress, false);
 }
 
 #endif // #if _RAKNET_SUPPORT_HTTPConnection2==1 && _RAKNET_SUPPORT_TCPInterface==1
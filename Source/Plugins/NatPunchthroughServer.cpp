@@ -112,110 +112,154 @@ int RakNet::NatPunchthroughServer::NatPunchthroughUserComp( const RakNetGUID &ke
     return 0;
 }
 
+NatPunchthroughServer::UserPair::UserPair(RakNetGUID g1, RakNetGUID g2)
+{
+    if (g1 < g2)
+    {
+        lowGuid=g1;
+        highGuid=g2;
+    }
+    else
+    {
+        lowGuid=g2;
+        highGuid=g1;
+    }
+}
+unsigned long NatPunchthroughServer::UserPair::ToInteger(const UserPair &userPair)
+{
+    return RakNetGUID::ToUint32(userPair.lowGuid) * 31 + RakNetGUID::ToUint32(userPair.highGuid);
+}
+
 STATIC_FACTORY_DEFINITIONS(NatPunchthroughServer,NatPunchthroughServer)
 
 NatPunchthroughServer::NatPunchthroughServer()
 {
+    AddReceivedMessageID(ID_NAT_PUNCHTHROUGH_REQUEST);
+    AddReceivedMessageID(ID_NAT_GET_MOST_RECENT_PORT);
+    AddReceivedMessageID(ID_NAT_CLIENT_READY);
+    AddReceivedMessageID(ID_NAT_REQUEST_BOUND_ADDRESSES);
+    AddReceivedMessageID(ID_NAT_PING);
+    AddReceivedMessageID(ID_OUT_OF_BAND_INTERNAL);
     lastUpdate=0;
     sessionId=0;
     natPunchthroughServerDebugInterface=0;
     for (int i=0; i < MAXIMUM_NUMBER_OF_INTERNAL_IDS; i++)
         boundAddresses[i]=UNASSIGNED_SYSTEM_ADDRESS;
     boundAddressCount=0;
+    timeoutQueueHead=0;
+    timeoutQueueTail=0;
 }
 NatPunchthroughServer::~NatPunchthroughServer()
 {
-    User *user, *otherUser;
-    ConnectionAttempt *connectionAttempt;
-    unsigned int j;
-    while(users.Size())
+    DataStructures::List<User*> userList;
+    DataStructures::List<RakNetGUID> guidList;
+    users.GetAsList(userList,guidList,_FILE_AND_LINE_);
+    unsigned int i,j;
+    for (i=0; i < userList.Size(); i++)
     {
-        user = users[0];
-        for (j=0; j < user->connectionAttempts.Size(); j++)
+        // Each attempt is in the list of both users, but has only one sender
+        for (j=0; j < userList[i]->connectionAttempts.Size(); j++)
         {
-            connectionAttempt=user->connectionAttempts[j];
-            if (connectionAttempt->sender==user)
-                otherUser=connectionAttempt->recipient;
-            else
-                otherUser=connectionAttempt->sender;
-            otherUser->DeleteConnectionAttempt(connectionAttempt);
+            if (userList[i]->connectionAttempts[j]->sender==userList[i])
+                delete userList[i]->connectionAttempts[j];
         }
-        delete user;
-        users[0]=users[users.Size()-1];
-        users.RemoveAtIndex(users.Size()-1);
     }
+    for (i=0; i < userList.Size(); i++)
+        delete userList[i];
+    users.Clear(_FILE_AND_LINE_);
+    connectionAttemptsByUsers.Clear(_FILE_AND_LINE_);
 }
 void NatPunchthroughServer::SetDebugInterface(NatPunchthroughServerDebugInterface *i)
 {
     natPunchthroughServerDebugInterface=i;
 }
+void NatPunchthroughServer::AddToTimeoutQueue(ConnectionAttempt *ca)
+{
+    ca->timeoutPrev=timeoutQueueTail;
+    ca->timeoutNext=0;
+    if (timeoutQueueTail)
+        timeoutQueueTail->timeoutNext=ca;
+    else
+        timeoutQueueHead=ca;
+    timeoutQueueTail=ca;
+}
+void NatPunchthroughServer::RemoveFromTimeoutQueue(ConnectionAttempt *ca)
+{
+    if (ca->timeoutPrev)
+        ca->timeoutPrev->timeoutNext=ca->timeoutNext;
+    else
+        timeoutQueueHead=ca->timeoutNext;
+    if (ca->timeoutNext)
+        ca->timeoutNext->timeoutPrev=ca->timeoutPrev;
+    else
+        timeoutQueueTail=ca->timeoutPrev;
+    ca->timeoutPrev=0;
+    ca->timeoutNext=0;
+}
+void NatPunchthroughServer::DeleteConnectionAttempt(ConnectionAttempt *ca)
+{
+    if (ca->attemptPhase==ConnectionAttempt::NAT_ATTEMPT_PHASE_GETTING_RECENT_PORTS)
+        RemoveFromTimeoutQueue(ca);
+    connectionAttemptsByUsers.Remove(UserPair(ca->sender->guid, ca->recipient->guid), _FILE_AND_LINE_);
+    ca->sender->DerefConnectionAttempt(ca);
+    ca->recipient->DeleteConnectionAttempt(ca);
+}
 void NatPunchthroughServer::Update(void)
 {
     ConnectionAttempt *connectionAttempt;
-    User *user, *recipient;
-    unsigned int i,j;
+    User *sender, *recipient;
     RakNet::Time time = RakNet::GetTime();
     if (time > lastUpdate+250)
     {
         lastUpdate=time;
 
-        for (i=0; i < users.Size(); i++)
+        // The queue is in order of startTime, so stop at the first attempt that has not timed out
+        while (timeoutQueueHead &&
+            time > timeoutQueueHead->startTime &&
+            time > 10000 + timeoutQueueHead->startTime ) // Formerly 5000, but sometimes false positives
         {
-            user=users[i];
-            for (j=0; j < user->connectionAttempts.Size(); j++)
+            connectionAttempt=timeoutQueueHead;
+            RakNet::BitStream outgoingBs;
+
+            // that other system might not be running the plugin
+            outgoingBs.Write((MessageID)ID_NAT_TARGET_UNRESPONSIVE);
+            outgoingBs.Write(connectionAttempt->recipient->guid);
+            outgoingBs.Write(connectionAttempt->sessionId);
+            rakPeerInterface->Send(&outgoingBs,HIGH_PRIORITY,RELIABLE_ORDERED,0,connectionAttempt->sender->systemAddress,false);
+
+            // 05/28/09 Previously only told sender about ID_NAT_CONNECTION_TO_TARGET_LOST
+            // However, recipient may be expecting it due to external code
+            // In that case, recipient would never get any response if the sender dropped
+            outgoingBs.Reset();
+            outgoingBs.Write((MessageID)ID_NAT_TARGET_UNRESPONSIVE);
+            outgoingBs.Write(connectionAttempt->sender->guid);
+            outgoingBs.Write(connectionAttempt->sessionId);
+            rakPeerInterface->Send(&outgoingBs,HIGH_PRIORITY,RELIABLE_ORDERED,0,connectionAttempt->recipient->systemAddress,false);
+
+            connectionAttempt->sender->isReady=true;
+            connectionAttempt->recipient->isReady=true;
+            sender=connectionAttempt->sender;
+            recipient=connectionAttempt->recipient;
+
+            if (natPunchthroughServerDebugInterface)
             {
-                connectionAttempt=user->connectionAttempts[j];
-                if (connectionAttempt->sender==user)
-                {
-                    if (connectionAttempt->attemptPhase!=ConnectionAttempt::NAT_ATTEMPT_PHASE_NOT_STARTED &&
-                        time > connectionAttempt->startTime &&
-                        time > 10000 + connectionAttempt->startTime ) // Formerly 5000, but sometimes false positives
-                    {
-                        RakNet::BitStream outgoingBs;
-
-                        // that other system might not be running the plugin
-                        outgoingBs.Write((MessageID)ID_NAT_TARGET_UNRESPONSIVE);
-                        outgoingBs.Write(connectionAttempt->recipient->guid);
-                        outgoingBs.Write(connectionAttempt->sessionId);
-                        rakPeerInterface->Send(&outgoingBs,HIGH_PRIORITY,RELIABLE_ORDERED,0,connectionAttempt->sender->systemAddress,false);
-
-                        // 05/28/09 Previously only told sender about ID_NAT_CONNECTION_TO_TARGET_LOST
-                        // However, recipient may be expecting it due to external code
-                        // In that case, recipient would never get any response if the sender dropped
-                        outgoingBs.Reset();
-                        outgoingBs.Write((MessageID)ID_NAT_TARGET_UNRESPONSIVE);
-                        outgoingBs.Write(connectionAttempt->sender->guid);
-                        outgoingBs.Write(connectionAttempt->sessionId);
-                        rakPeerInterface->Send(&outgoingBs,HIGH_PRIORITY,RELIABLE_ORDERED,0,connectionAttempt->recipient->systemAddress,false);
-
-                        connectionAttempt->sender->isReady=true;
-                        connectionAttempt->recipient->isReady=true;
-                        recipient=connectionAttempt->recipient;
-
-                        if (natPunchthroughServerDebugInterface)
-                        {
-                            char str[1024];
-                            char addr1[128], addr2[128];
-                            // 8/01/09 Fixed bug where this was after DeleteConnectionAttempt()
-                            connectionAttempt->sender->systemAddress.ToString(true,addr1);
-                            connectionAttempt->recipient->systemAddress.ToString(true,addr2);
-                            sprintf(str, "Sending ID_NAT_TARGET_UNRESPONSIVE to sender %s and recipient %s.", addr1, addr2);
-                            natPunchthroughServerDebugInterface->OnServerMessage(str);
-                            RakNet::RakString log;
-                            connectionAttempt->sender->LogConnectionAttempts(log);
-                            connectionAttempt->recipient->LogConnectionAttempts(log);
-                        }
-
-                        connectionAttempt->sender->DerefConnectionAttempt(connectionAttempt);
-                        connectionAttempt->recipient->DeleteConnectionAttempt(connectionAttempt);
-
-                        StartPunchthroughForUser(user);
-                        StartPunchthroughForUser(recipient);
-
-                        break;
-                    }
-                }
+                char str[1024];
+                char addr1[128], addr2[128];
+                // 8/01/09 Fixed bug where this was after DeleteConnectionAttempt()
+                connectionAttempt->sender->systemAddress.ToString(true,addr1);
+                connectionAttempt->recipient->systemAddress.ToString(true,addr2);
+                sprintf(str, "Sending ID_NAT_TARGET_UNRESPONSIVE to sender %s and recipient %s.", addr1, addr2);
+                natPunchthroughServerDebugInterface->OnServerMessage(str);
+                RakNet::RakString log;
+                connectionAttempt->sender->LogConnectionAttempts(log);
+                connectionAttempt->recipient->LogConnectionAttempts(log);
             }
+
+            DeleteConnectionAttempt(connectionAttempt);
+
+            // Attempts started here go to the tail of the queue with the current time, so the loop ends
+            StartPunchthroughForUser(sender);
+            StartPunchthroughForUser(recipient);
         }
     }
 }
@@ -287,19 +331,20 @@ void NatPunchthroughServer::OnClosedConnection(const SystemAddress &systemAddres
     (void) systemAddress;
 
     unsigned int i=0;
-    bool objectExists;
-    i = users.GetIndexFromKey(rakNetGUID, &objectExists);
-    if (objectExists)
+    User **userPtr = users.Peek(rakNetGUID);
+    if (userPtr)
     {
         RakNet::BitStream outgoingBs;
         DataStructures::List<User *> freedUpInProgressUsers;
-        User *user = users[i];
+        User *user = *userPtr;
         User *otherUser;
         unsigned int connectionAttemptIndex;
         ConnectionAttempt *connectionAttempt;
-        for (connectionAttemptIndex=0; connectionAttemptIndex < user->connectionAttempts.Size(); connectionAttemptIndex++)
+        // Copy, as DeleteConnectionAttempt() removes from user->connectionAttempts
+        DataStructures::List<ConnectionAttempt *> connectionAttempts = user->connectionAttempts;
+        for (connectionAttemptIndex=0; connectionAttemptIndex < connectionAttempts.Size(); connectionAttemptIndex++)
         {
-            connectionAttempt=user->connectionAttempts[connectionAttemptIndex];
+            connectionAttempt=connectionAttempts[connectionAttemptIndex];
             outgoingBs.Reset();
             if (connectionAttempt->recipient==user)
             {
@@ -325,11 +370,11 @@ void NatPunchthroughServer::OnClosedConnection(const SystemAddress &systemAddres
                 freedUpInProgressUsers.Insert(otherUser, _FILE_AND_LINE_ );
             }
 
-            otherUser->DeleteConnectionAttempt(connectionAttempt);
+            DeleteConnectionAttempt(connectionAttempt);
         }
 
-        delete users[i];
-        users.RemoveAtIndex(i);
+        users.Remove(rakNetGUID, _FILE_AND_LINE_);
+        delete user;
 
         for (i=0; i < freedUpInProgressUsers.Size(); i++)
         {
@@ -364,12 +409,15 @@ void NatPunchthroughServer::OnNewConnection(const SystemAddress &systemAddress,
     (void) systemAddress;
     (void) isIncoming;
 
+    if (users.HasData(rakNetGUID))
+        return;
+
     User *user =new User;
     user->guid=rakNetGUID;
     user->mostRecentPort=0;
     user->systemAddress=systemAddress;
     user->isReady=true;
-    users.Insert(rakNetGUID, user, true, _FILE_AND_LINE_);
+    users.Push(rakNetGUID, user, _FILE_AND_LINE_);
 
 //    printf("Adding to users %s\n", rakNetGUID.ToString());
 //    printf("DEBUG users[0] guid=%s\n", users[0]->guid.ToString());
@@ -382,16 +430,16 @@ void NatPunchthroughServer::OnNATPunchthroughRequest(Packet *packet)
     RakNetGUID recipientGuid, senderGuid;
     incomingBs.Read(recipientGuid);
     senderGuid=packet->guid;
-    unsigned int i;
-    bool objectExists;
-    i = users.GetIndexFromKey(senderGuid, &objectExists);
-    RakAssert(objectExists);
+    User **senderPtr = users.Peek(senderGuid);
+    RakAssert(senderPtr);
+    if (senderPtr==0)
+        return;
 
     ConnectionAttempt *ca =new ConnectionAttempt;
-    ca->sender=users[i];
+    ca->sender=*senderPtr;
     ca->sessionId=sessionId++;
-    i = users.GetIndexFromKey(recipientGuid, &objectExists);
-    if (objectExists==false || ca->sender == ca->recipient)
+    User **recipientPtr = users.Peek(recipientGuid);
+    if (recipientPtr==0 || recipientGuid == senderGuid)
     {
 //         printf("DEBUG %i\n", __LINE__);
 //         printf("DEBUG recipientGuid=%s\n", recipientGuid.ToString());
@@ -403,8 +451,9 @@ void NatPunchthroughServer::OnNATPunchthroughRequest(Packet *packet)
         delete ca;
         return;
     }
-    ca->recipient=users[i];
-    if (ca->recipient->HasConnectionAttemptToUser(ca->sender))
+    ca->recipient=*recipientPtr;
+    UserPair userPair(senderGuid, recipientGuid);
+    if (connectionAttemptsByUsers.HasData(userPair))
     {
         outgoingBs.Write((MessageID)ID_NAT_ALREADY_IN_PROGRESS);
         outgoingBs.Write(recipientGuid);
@@ -415,18 +464,17 @@ void NatPunchthroughServer::OnNATPunchthroughRequest(Packet *packet)
 
     ca->sender->connectionAttempts.Insert(ca, _FILE_AND_LINE_ );
     ca->recipient->connectionAttempts.Insert(ca, _FILE_AND_LINE_ );
+    connectionAttemptsByUsers.Push(userPair, ca, _FILE_AND_LINE_);
 
     StartPunchthroughForUser(ca->sender);
 }
 void NatPunchthroughServer::OnClientReady(Packet *packet)
 {
-    unsigned int i;
-    bool objectExists;
-    i = users.GetIndexFromKey(packet->guid, &objectExists);
-    if (objectExists)
+    User **userPtr = users.Peek(packet->guid);
+    if (userPtr)
     {
-        users[i]->isReady=true;
-        StartPunchthroughForUser(users[i]);
+        (*userPtr)->isReady=true;
+        StartPunchthroughForUser(*userPtr);
     }
 }
 void NatPunchthroughServer::OnGetMostRecentPort(Packet *packet)
@@ -438,11 +486,11 @@ void NatPunchthroughServer::OnGetMostRecentPort(Packet *packet)
     bsIn.Read(sessionId);
     bsIn.Read(mostRecentPort);
 
-    unsigned int i,j;
+    unsigned int j;
     User *user;
     ConnectionAttempt *connectionAttempt;
-    bool objectExists;
-    i = users.GetIndexFromKey(packet->guid, &objectExists);
+    User **userPtr = users.Peek(packet->guid);
+    bool objectExists = userPtr!=0;
 
     if (natPunchthroughServerDebugInterface)
     {
@@ -456,7 +504,7 @@ void NatPunchthroughServer::OnGetMostRecentPort(Packet *packet)
 
     if (objectExists)
     {
-        user=users[i];
+        user=*userPtr;
         user->mostRecentPort=mostRecentPort;
         RakNet::Time time = RakNet::GetTime();
 
@@ -539,8 +587,7 @@ void NatPunchthroughServer::OnGetMostRecentPort(Packet *packet)
                 bsOut.Write(true);
                 rakPeerInterface->Send(&bsOut,HIGH_PRIORITY,RELIABLE_ORDERED,0,senderSystemAddress,false);
 
-                connectionAttempt->recipient->DerefConnectionAttempt(connectionAttempt);
-                connectionAttempt->sender->DeleteConnectionAttempt(connectionAttempt);
+                DeleteConnectionAttempt(connectionAttempt);
 
                 // 04/29/08 missing return
                 return;
@@ -600,8 +647,12 @@ void NatPunchthroughServer::StartPunchthroughForUser(User *user)
 
             sender->isReady=false;
             recipient->isReady=false;
+            // Restarting an attempt moves it to the tail of the timeout queue, keeping the queue in order of startTime
+            if (connectionAttempt->attemptPhase==ConnectionAttempt::NAT_ATTEMPT_PHASE_GETTING_RECENT_PORTS)
+                RemoveFromTimeoutQueue(connectionAttempt);
             connectionAttempt->attemptPhase=ConnectionAttempt::NAT_ATTEMPT_PHASE_GETTING_RECENT_PORTS;
             connectionAttempt->startTime=RakNet::GetTime();
+            AddToTimeoutQueue(connectionAttempt);
 
             sender->mostRecentPort=0;
             recipient->mostRecentPort=0;
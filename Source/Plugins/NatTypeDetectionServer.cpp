@@ -29,6 +29,7 @@ STATIC_FACTORY_DEFINITIONS(NatTypeDetectionServer,NatTypeDetectionServer)
 
 NatTypeDetectionServer::NatTypeDetectionServer()
 {
+    AddReceivedMessageID(ID_NAT_TYPE_DETECTION_REQUEST);
     s1p2=s2p3=s3p4=s4p5=0;
 }
 NatTypeDetectionServer::~NatTypeDetectionServer()
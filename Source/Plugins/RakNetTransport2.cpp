@@ -31,6 +31,7 @@ STATIC_FACTORY_DEFINITIONS(RakNetTransport2,RakNetTransport2)
 
 RakNetTransport2::RakNetTransport2()
 {
+    AddReceivedMessageID(ID_TRANSPORT_STRING);
 }
 RakNetTransport2::~RakNetTransport2()
 {
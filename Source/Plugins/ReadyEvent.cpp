@@ -47,6 +47,8 @@ STATIC_FACTORY_DEFINITIONS(ReadyEvent,ReadyEvent)
 
 ReadyEvent::ReadyEvent()
 {
+    AddReceivedMessageIDRange(ID_READY_EVENT_SET, ID_READY_EVENT_QUERY);
+    AddReceivedMessageID(ID_READY_EVENT_FORCE_ALL_SET);
     channel=0;
 }
 
@@ -22,6 +22,7 @@ STATIC_FACTORY_DEFINITIONS(RelayPlugin,RelayPlugin)
 
 RelayPlugin::RelayPlugin()
 {
+    AddReceivedMessageID(ID_RELAY_PLUGIN);
     acceptAddParticipantRequests=false;
 }
 
@@ -33,8 +34,11 @@ RelayPlugin::~RelayPlugin()
     guidToStrHash.Clear(_FILE_AND_LINE_);
     for (unsigned int i=0; i < itemList.Size(); i++)
         delete itemList[i];
-    for (unsigned int i=0; i < chatRooms.Size(); i++)
-        delete chatRooms[i];
+    DataStructures::List<RP_Group*> roomList;
+    chatRooms.GetAsList(roomList, keyList, _FILE_AND_LINE_);
+    chatRooms.Clear(_FILE_AND_LINE_);
+    for (unsigned int i=0; i < roomList.Size(); i++)
+        delete roomList[i];
 }
 
 RelayPluginEnums RelayPlugin::AddParticipantOnServer(const RakString &key, const RakNetGUID &guid)
@@ -50,6 +54,7 @@ RelayPluginEnums RelayPlugin::AddParticipantOnServer(const RakString &key, const
     StrAndGuidAndRoom *strAndGuidExisting;
     if (guidToStrHash.Pop(strAndGuidExisting, guid, _FILE_AND_LINE_))
     {
+        LeaveGroup(&strAndGuidExisting);
         strToGuidHash.Remove(strAndGuidExisting->str, _FILE_AND_LINE_);
         delete strAndGuidExisting;
     }
@@ -57,6 +62,7 @@ RelayPluginEnums RelayPlugin::AddParticipantOnServer(const RakString &key, const
     StrAndGuidAndRoom *strAndGuid =new StrAndGuidAndRoom;
     strAndGuid->guid=guid;
     strAndGuid->str=key;
+    strAndGuid->indexInRoom=0;
 
     strToGuidHash.Push(key, strAndGuid, _FILE_AND_LINE_);
     guidToStrHash.Push(guid, strAndGuid, _FILE_AND_LINE_);
@@ -152,8 +158,6 @@ PluginReceiveResult RelayPlugin::OnReceive(Packet *packet)
                 bsIn.Read(orderingChannel);
                 RakString key;
                 bsIn.ReadCompressed(key);
-                BitStream bsData;
-                bsIn.Read(&bsData);
                 StrAndGuidAndRoom **strAndGuid = strToGuidHash.Peek(key);
                 StrAndGuidAndRoom **strAndGuidSender = guidToStrHash.Peek(packet->guid);
                 if (strAndGuid && strAndGuidSender)
@@ -163,7 +167,8 @@ PluginReceiveResult RelayPlugin::OnReceive(Packet *packet)
                     bsOut.WriteCasted<MessageID>(RPE_MESSAGE_TO_CLIENT_FROM_SERVER);
                     bsOut.WriteCompressed( (*strAndGuidSender)->str );
                     bsOut.AlignWriteToByteBoundary();
-                    bsOut.Write(bsData);
+                    // Copy the relayed data straight from the packet
+                    bsOut.Write(&bsIn);
                     SendUnified(&bsOut, priority, reliability, orderingChannel, (*strAndGuid)->guid, false);
                 }
 
@@ -237,6 +242,7 @@ RelayPlugin::RP_Group* RelayPlugin::JoinGroup(RP_Group* room, StrAndGuidAndRoom
     sag.guid=(*strAndGuidSender)->guid;
     sag.str=(*strAndGuidSender)->str;
 
+    (*strAndGuidSender)->indexInRoom=room->usersInRoom.Size();
     room->usersInRoom.Push(sag, _FILE_AND_LINE_);
     (*strAndGuidSender)->currentRoom=room->roomName;
 
@@ -264,21 +270,17 @@ RelayPlugin::RP_Group* RelayPlugin::JoinGroup(RakNetGUID userGuid, RakString roo
         if ((*strAndGuidSender)->currentRoom.IsEmpty()==false)
             LeaveGroup(strAndGuidSender);
 
-        RakString userName = (*strAndGuidSender)->str;
-
-        for (unsigned int i=0; i < chatRooms.Size(); i++)
+        RP_Group **existingRoom = chatRooms.Peek(roomName);
+        if (existingRoom)
         {
-            if (chatRooms[i]->roomName==roomName)
-            {
-                // Join existing room
-                return JoinGroup(chatRooms[i],strAndGuidSender);
-            }
+            // Join existing room
+            return JoinGroup(*existingRoom,strAndGuidSender);
         }
 
         // Create new room
         RP_Group *room =new RP_Group;
         room->roomName=roomName;
-        chatRooms.Push(room, _FILE_AND_LINE_);
+        chatRooms.Push(roomName, room, _FILE_AND_LINE_);
         return JoinGroup(room,strAndGuidSender);
     }
 
@@ -289,86 +291,89 @@ void RelayPlugin::LeaveGroup(StrAndGuidAndRoom **strAndGuidSender)
     if (strAndGuidSender==0)
         return;
 
-    RakString userName = (*strAndGuidSender)->str;
-    for (unsigned int i=0; i < chatRooms.Size(); i++)
-    {
-        if (chatRooms[i]->roomName==(*strAndGuidSender)->currentRoom)
-        {
-            (*strAndGuidSender)->currentRoom.Clear();
-
-            RP_Group *room = chatRooms[i];
-            for (unsigned int j=0; j < room->usersInRoom.Size(); j++)
-            {
-                if (room->usersInRoom[j].guid==(*strAndGuidSender)->guid)
-                {
-                    room->usersInRoom.RemoveAtIndexFast(j);
-
-                    if (room->usersInRoom.Size()==0)
-                    {
-                        delete room;
-                        chatRooms.RemoveAtIndexFast(i);
-                        return;
-                    }
-                }
-            }
+    if ((*strAndGuidSender)->currentRoom.IsEmpty())
+        return;
 
-            NotifyUsersInRoom(room, RPE_USER_LEFT_ROOM, userName);
+    RakString userName = (*strAndGuidSender)->str;
+    RP_Group **roomPtr = chatRooms.Peek((*strAndGuidSender)->currentRoom);
+    (*strAndGuidSender)->currentRoom.Clear();
+    if (roomPtr==0)
+        return;
 
-            return;
+    RP_Group *room = *roomPtr;
+    unsigned int index = (*strAndGuidSender)->indexInRoom;
+    RakAssert(index < room->usersInRoom.Size() && room->usersInRoom[index].guid==(*strAndGuidSender)->guid);
+    room->usersInRoom.RemoveAtIndexFast(index);
+    if (index < room->usersInRoom.Size())
+    {
+        // The last user was moved into this index
+        StrAndGuidAndRoom **strAndGuidMoved = guidToStrHash.Peek(room->usersInRoom[index].guid);
+        if (strAndGuidMoved)
+            (*strAndGuidMoved)->indexInRoom=index;
+    }
 
-        }
+    if (room->usersInRoom.Size()==0)
+    {
+        chatRooms.Remove(room->roomName, _FILE_AND_LINE_);
+        delete room;
+        return;
     }
+
+    NotifyUsersInRoom(room, RPE_USER_LEFT_ROOM, userName);
 }
 void RelayPlugin::NotifyUsersInRoom(RP_Group *room, int msg, const RakString& message)
 {
-    for (unsigned int i=0; i < room->usersInRoom.Size(); i++)
-    {
-        BitStream bsOut;
-        bsOut.WriteCasted<MessageID>(ID_RELAY_PLUGIN);
-        bsOut.WriteCasted<MessageID>(msg);
-        bsOut.WriteCompressed(message);
+    BitStream bsOut;
+    bsOut.WriteCasted<MessageID>(ID_RELAY_PLUGIN);
+    bsOut.WriteCasted<MessageID>(msg);
+    bsOut.WriteCompressed(message);
 
-        SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, room->usersInRoom[i].guid, false);
-    }
+    DataStructures::List<RakNetGUID> systemIdentifiers;
+    for (unsigned int i=0; i < room->usersInRoom.Size(); i++)
+        systemIdentifiers.Push(room->usersInRoom[i].guid, _FILE_AND_LINE_);
+    SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, systemIdentifiers);
 }
 void RelayPlugin::SendMessageToRoom(StrAndGuidAndRoom **strAndGuidSender, BitStream* message)
 {
     if ((*strAndGuidSender)->currentRoom.IsEmpty())
         return;
 
-    for (unsigned int i=0; i < chatRooms.Size(); i++)
-    {
-        if (chatRooms[i]->roomName==(*strAndGuidSender)->currentRoom)
-        {
-            BitStream bsOut;
-            bsOut.WriteCasted<MessageID>(ID_RELAY_PLUGIN);
-            bsOut.WriteCasted<MessageID>(RPE_GROUP_MSG_FROM_SERVER);
-            message->ResetReadPointer();
-            bsOut.WriteCompressed((*strAndGuidSender)->str);
-            bsOut.AlignWriteToByteBoundary();
-            bsOut.Write(message);
-
-            RP_Group *room = chatRooms[i];
-            for (unsigned int i=0; i < room->usersInRoom.Size(); i++)
-            {
-                if (room->usersInRoom[i].guid!=(*strAndGuidSender)->guid)
-                    SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, room->usersInRoom[i].guid, false);
-            }
+    RP_Group **roomPtr = chatRooms.Peek((*strAndGuidSender)->currentRoom);
+    if (roomPtr==0)
+        return;
 
-            break;
-        }
+    // Serialized once, then sent to everyone else in the room
+    BitStream bsOut;
+    bsOut.WriteCasted<MessageID>(ID_RELAY_PLUGIN);
+    bsOut.WriteCasted<MessageID>(RPE_GROUP_MSG_FROM_SERVER);
+    bsOut.WriteCompressed((*strAndGuidSender)->str);
+    bsOut.AlignWriteToByteBoundary();
+    bsOut.Write(message);
+
+    RP_Group *room = *roomPtr;
+    DataStructures::List<RakNetGUID> systemIdentifiers;
+    for (unsigned int i=0; i < room->usersInRoom.Size(); i++)
+    {
+        if (room->usersInRoom[i].guid!=(*strAndGuidSender)->guid)
+            systemIdentifiers.Push(room->usersInRoom[i].guid, _FILE_AND_LINE_);
     }
+    if (systemIdentifiers.Size()>0)
+        SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, systemIdentifiers);
 }
 void RelayPlugin::SendChatRoomsList(RakNetGUID target)
 {
+    DataStructures::List<RP_Group*> roomList;
+    DataStructures::List<RakString> keyList;
+    chatRooms.GetAsList(roomList, keyList, _FILE_AND_LINE_);
+
     BitStream bsOut;
     bsOut.WriteCasted<MessageID>(ID_RELAY_PLUGIN);
     bsOut.WriteCasted<MessageID>(RPE_GET_GROUP_LIST_REPLY_FROM_SERVER);
-    bsOut.WriteCasted<uint16_t>(chatRooms.Size());
-    for (unsigned int i=0; i < chatRooms.Size(); i++)
+    bsOut.WriteCasted<uint16_t>(roomList.Size());
+    for (unsigned int i=0; i < roomList.Size(); i++)
     {
-        bsOut.WriteCompressed(chatRooms[i]->roomName);
-        bsOut.WriteCasted<uint16_t>(chatRooms[i]->usersInRoom.Size());
+        bsOut.WriteCompressed(roomList[i]->roomName);
+        bsOut.WriteCasted<uint16_t>(roomList[i]->usersInRoom.Size());
     }
     SendUnified(&bsOut, HIGH_PRIORITY, RELIABLE_ORDERED, 0, target, false);
 }
@@ -386,13 +391,12 @@ void RelayPlugin::OnGroupMessageFromClient(Packet *packet)
     bsIn.Read(cIn);
     //reliability = (PacketReliability) cIn;
     bsIn.Read(orderingChannel);
-    BitStream bsData;
-    bsIn.Read(&bsData);
 
     StrAndGuidAndRoom **strAndGuidSender = guidToStrHash.Peek(packet->guid);
     if (strAndGuidSender)
     {
-        SendMessageToRoom(strAndGuidSender,&bsData);
+        // The rest of bsIn is the message, written without another copy
+        SendMessageToRoom(strAndGuidSender,&bsIn);
     }
 }
 void RelayPlugin::OnJoinGroupRequestFromClient(Packet *packet)
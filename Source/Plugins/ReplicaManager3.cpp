@@ -77,6 +77,9 @@ void LastSerializationResult::AllocBS(void)
 
 ReplicaManager3::ReplicaManager3()
 {
+    AddReceivedMessageIDRange(ID_REPLICA_MANAGER_CONSTRUCTION, ID_REPLICA_MANAGER_DOWNLOAD_COMPLETE);
+    // Truncated timestamped messages are dispatched as ID_TIMESTAMP, and dropped by OnReceive()
+    AddReceivedMessageID(ID_TIMESTAMP);
     defaultSendParameters.orderingChannel=0;
     defaultSendParameters.priority=HIGH_PRIORITY;
     defaultSendParameters.reliability=RELIABLE_ORDERED;
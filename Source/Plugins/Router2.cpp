@@ -85,6 +85,12 @@ STATIC_FACTORY_DEFINITIONS(Router2,Router2)
 
 Router2::Router2()
 {
+    AddReceivedMessageID(ID_ROUTER_2_INTERNAL);
+    AddReceivedMessageID(ID_OUT_OF_BAND_INTERNAL);
+    AddReceivedMessageID(ID_ROUTER_2_FORWARDING_ESTABLISHED);
+    AddReceivedMessageID(ID_ROUTER_2_REROUTED);
+    AddReceivedMessageID(ID_ROUTER_2_FORWARDING_NO_PATH);
+    AddReceivedMessageID(ID_CONNECTION_REQUEST_ACCEPTED);
     udpForwarder=0;
     maximumForwardingRequests=0;
     debugInterface=0;
@@ -19,31 +19,77 @@ using namespace RakNet;
 
 ThreadsafePacketLogger::ThreadsafePacketLogger()
 {
-
+    logOverflowSize=0;
 }
 ThreadsafePacketLogger::~ThreadsafePacketLogger()
 {
-    char **msg;
-    while ((msg = logMessages.ReadLock()) != 0)
-    {
-        free(*msg);
-    }
+    char *msg;
+    while ((msg = PopLogMessage()) != 0)
+        free(msg);
 }
 void ThreadsafePacketLogger::Update(void)
 {
-    char **msg;
-    while ((msg = logMessages.ReadLock()) != 0)
+    // Read before the ring. If anything overflowed, the ring is not written again until it was all read.
+    bool overflowed = logOverflowSize.load(std::memory_order_acquire) > 0;
+    char **msgs;
+    unsigned int count = logMessages.GetCapacity();
+    while ((msgs = logMessages.ReadLock(&count)) != 0)
+    {
+        for (unsigned int i=0; i < count; i++)
+        {
+            WriteLog(msgs[i]);
+            free(msgs[i]);
+        }
+        logMessages.ReadUnlock(count);
+        count = logMessages.GetCapacity();
+    }
+
+    char *msg;
+    while (overflowed && (msg = PopLogMessage()) != 0)
     {
-        WriteLog(*msg);
-        free(*msg);
+        WriteLog(msg);
+        free(msg);
     }
 }
 void ThreadsafePacketLogger::AddToLog(const char *str)
 {
-    char **msg = logMessages.WriteLock();
-    *msg = (char*) malloc(strlen(str)+1);
-    strcpy(*msg, str);
-    logMessages.WriteUnlock();
+    char *msg = (char*) malloc(strlen(str)+1);
+    if (msg==0)
+        return;
+    strcpy(msg, str);
+
+    // Lines come from the user thread (Ping, SendOutOfBand, SendTTL) as well as the update thread, but the ring takes one writer at a time
+    logWriterMutex.Lock();
+    if (logOverflowSize.load(std::memory_order_acquire)==0 && logMessages.Push(msg))
+    {
+        logWriterMutex.Unlock();
+        return;
+    }
+
+    logOverflowMutex.Lock();
+    logOverflow.Push(msg, _FILE_AND_LINE_);
+    logOverflowSize.store(logOverflow.Size(), std::memory_order_release);
+    logOverflowMutex.Unlock();
+    logWriterMutex.Unlock();
+}
+char *ThreadsafePacketLogger::PopLogMessage(void)
+{
+    bool overflowed = logOverflowSize.load(std::memory_order_acquire) > 0;
+    char *msg;
+    if (logMessages.Pop(&msg))
+        return msg;
+    if (overflowed==false)
+        return 0;
+
+    msg=0;
+    logOverflowMutex.Lock();
+    if (logOverflow.IsEmpty()==false)
+    {
+        msg=logOverflow.Pop();
+        logOverflowSize.store(logOverflow.Size(), std::memory_order_release);
+    }
+    logOverflowMutex.Unlock();
+    return msg;
 }
 
 #endif // _RAKNET_SUPPORT_*
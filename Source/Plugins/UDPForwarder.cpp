@@ -25,6 +25,12 @@
 #include "../WSAStartupSingleton.h"
 #endif
 
+#if UDP_FORWARDER_USE_EPOLL==1
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 #ifndef INVALID_SOCKET
 #define INVALID_SOCKET -1
 #endif
@@ -43,11 +49,35 @@ UDPForwarder::ForwardEntry::ForwardEntry()
     timeLastDatagramForwarded=RakNet::GetTimeMS();
     addr1Confirmed=UNASSIGNED_SYSTEM_ADDRESS;
     addr2Confirmed=UNASSIGNED_SYSTEM_ADDRESS;
+    forwardListIndex=(unsigned int) -1;
+    timerNext=timerPrev=0;
+    timerSlot=(unsigned int) -1;
 }
 UDPForwarder::ForwardEntry::~ForwardEntry() {
     if (socket!=INVALID_SOCKET)
         closesocket__(socket);
 }
+UDPForwarder::ForwardEntryKey::ForwardEntryKey(const SystemAddress &a, const SystemAddress &b)
+{
+    if (a < b)
+    {
+        lower=a;
+        upper=b;
+    }
+    else
+    {
+        lower=b;
+        upper=a;
+    }
+}
+bool UDPForwarder::ForwardEntryKey::operator==( const ForwardEntryKey& right ) const
+{
+    return lower==right.lower && upper==right.upper;
+}
+unsigned long UDPForwarder::ForwardEntryKey::ToInteger( const ForwardEntryKey &key )
+{
+    return SystemAddress::ToInteger(key.lower) * 31 + SystemAddress::ToInteger(key.upper);
+}
 
 UDPForwarder::UDPForwarder()
 {
@@ -61,10 +91,20 @@ UDPForwarder::UDPForwarder()
     nextInputId=0;
     startForwardingInput.SetPageSize(sizeof(StartForwardingInputStruct)*16);
     stopForwardingCommands.SetPageSize(sizeof(StopForwardingStruct)*16);
+    startForwardingOutputEvent.InitEvent();
+    memset(timerWheel, 0, sizeof(timerWheel));
+    timerWheelSlot=0;
+    timerWheelTime=0;
+#if UDP_FORWARDER_USE_EPOLL==1
+    epollFd=-1;
+    wakeEventFd=-1;
+    relayBuffers=0;
+#endif
 }
 UDPForwarder::~UDPForwarder()
 {
     Shutdown();
+    startForwardingOutputEvent.CloseEvent();
 
 #ifdef _WIN32
     WSAStartupSingleton::Deref();
@@ -77,6 +117,19 @@ void UDPForwarder::Startup(void)
 
     isRunning++;
 
+    timerWheelTime=RakNet::GetTimeMS();
+
+#if UDP_FORWARDER_USE_EPOLL==1
+    epollFd=epoll_create1(EPOLL_CLOEXEC);
+    wakeEventFd=eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    RakAssert(epollFd!=-1 && wakeEventFd!=-1);
+    epoll_event ev;
+    ev.events=EPOLLIN;
+    ev.data.ptr=0;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeEventFd, &ev);
+    relayBuffers=(char*) malloc(RELAY_BATCH_SIZE*MAXIMUM_MTU_SIZE);
+#endif
+
     int errorCode;
 
 
@@ -97,14 +150,26 @@ void UDPForwarder::Shutdown(void)
     if (isRunning == 0)
         return;
     isRunning--;
+    WakeForwarderThread();
 
     while (threadRunning > 0)
         RakSleep(30);
 
     unsigned int j;
-    for (j=0; j < forwardListNotUpdated.Size(); j++)
-        delete forwardListNotUpdated[j];
-    forwardListNotUpdated.Clear(false, _FILE_AND_LINE_);
+    for (j=0; j < forwardList.Size(); j++)
+        delete forwardList[j];
+    forwardList.Clear(false, _FILE_AND_LINE_);
+    forwardEntries.Clear(_FILE_AND_LINE_);
+    memset(timerWheel, 0, sizeof(timerWheel));
+
+#if UDP_FORWARDER_USE_EPOLL==1
+    close(epollFd);
+    close(wakeEventFd);
+    epollFd=-1;
+    wakeEventFd=-1;
+    free(relayBuffers);
+    relayBuffers=0;
+#endif
 }
 void UDPForwarder::SetMaxForwardEntries(unsigned short maxEntries)
 {
@@ -117,7 +182,7 @@ int UDPForwarder::GetMaxForwardEntries(void) const
 }
 int UDPForwarder::GetUsedForwardEntries(void) const
 {
-    return (int) forwardListNotUpdated.Size();
+    return (int) forwardEntries.Size();
 }
 UDPForwarderResult UDPForwarder::StartForwarding(SystemAddress source, SystemAddress destination, RakNet::TimeMS timeoutOnNoDataMS, const char *forceHostAddress, unsigned short socketFamily,
                                   unsigned short *forwardingPort, __UDPSOCKET__ *forwardingSocket)
@@ -144,13 +209,15 @@ UDPForwarderResult UDPForwarder::StartForwarding(SystemAddress source, SystemAdd
     sfis->socketFamily=socketFamily;
     sfis->inputId=inputId;
     startForwardingInput.Push(sfis);
+    WakeForwarderThread();
 
 #ifdef _MSC_VER
 #pragma warning( disable : 4127 ) // warning C4127: conditional expression is constant
 #endif
     while (1)
     {
-        RakSleep(0);
+        // Another caller may consume the signal meant for us, so do not wait long before checking again
+        startForwardingOutputEvent.WaitOnEvent(10);
         startForwardingOutputMutex.Lock();
         for (unsigned int i=0; i < startForwardingOutput.Size(); i++)
         {
@@ -181,6 +248,59 @@ void UDPForwarder::StopForwarding(SystemAddress source, SystemAddress destinatio
     sfs->destination=destination;
     sfs->source=source;
     stopForwardingCommands.Push(sfs);
+    WakeForwarderThread();
+}
+void UDPForwarder::WakeForwarderThread(void)
+{
+#if UDP_FORWARDER_USE_EPOLL==1
+    if (wakeEventFd!=-1)
+    {
+        uint64_t one=1;
+        ssize_t written=write(wakeEventFd, &one, sizeof(one));
+        (void) written;
+    }
+#endif
+}
+bool UDPForwarder::GetForwardTarget(ForwardEntry *forwardEntry, const SystemAddress &receivedAddr, SystemAddress *forwardTarget)
+{
+    bool confirmed1 = forwardEntry->addr1Confirmed!=UNASSIGNED_SYSTEM_ADDRESS;
+    bool confirmed2 = forwardEntry->addr2Confirmed!=UNASSIGNED_SYSTEM_ADDRESS;
+    bool matchConfirmed1 =
+        confirmed1 &&
+        forwardEntry->addr1Confirmed==receivedAddr;
+    bool matchConfirmed2 =
+        confirmed2 &&
+        forwardEntry->addr2Confirmed==receivedAddr;
+    bool matchUnconfirmed1 = forwardEntry->addr1Unconfirmed.EqualsExcludingPort(receivedAddr);
+    bool matchUnconfirmed2 = forwardEntry->addr2Unconfirmed.EqualsExcludingPort(receivedAddr);
+
+    if (matchConfirmed1==true || (matchConfirmed2==false && confirmed1==false && matchUnconfirmed1==true))
+    {
+        // Forward to addr2
+        if (forwardEntry->addr1Confirmed==UNASSIGNED_SYSTEM_ADDRESS)
+        {
+            forwardEntry->addr1Confirmed=receivedAddr;
+        }
+        if (forwardEntry->addr2Confirmed!=UNASSIGNED_SYSTEM_ADDRESS)
+            *forwardTarget=forwardEntry->addr2Confirmed;
+        else
+            *forwardTarget=forwardEntry->addr2Unconfirmed;
+        return true;
+    }
+    else if (matchConfirmed2==true || (confirmed2==false && matchUnconfirmed2==true))
+    {
+        // Forward to addr1
+        if (forwardEntry->addr2Confirmed==UNASSIGNED_SYSTEM_ADDRESS)
+        {
+            forwardEntry->addr2Confirmed=receivedAddr;
+        }
+        if (forwardEntry->addr1Confirmed!=UNASSIGNED_SYSTEM_ADDRESS)
+            *forwardTarget=forwardEntry->addr1Confirmed;
+        else
+            *forwardTarget=forwardEntry->addr1Unconfirmed;
+        return true;
+    }
+    return false;
 }
 void UDPForwarder::RecvFrom(RakNet::TimeMS curTime, ForwardEntry *forwardEntry)
 {
@@ -279,46 +399,8 @@ void UDPForwarder::RecvFrom(RakNet::TimeMS curTime, ForwardEntry *forwardEntry)
     //portnum=receivedAddr.GetPort();
 
     SystemAddress forwardTarget;
-
-    bool confirmed1 = forwardEntry->addr1Confirmed!=UNASSIGNED_SYSTEM_ADDRESS;
-    bool confirmed2 = forwardEntry->addr2Confirmed!=UNASSIGNED_SYSTEM_ADDRESS;
-    bool matchConfirmed1 =
-        confirmed1 &&
-        forwardEntry->addr1Confirmed==receivedAddr;
-    bool matchConfirmed2 =
-        confirmed2 &&
-        forwardEntry->addr2Confirmed==receivedAddr;
-    bool matchUnconfirmed1 = forwardEntry->addr1Unconfirmed.EqualsExcludingPort(receivedAddr);
-    bool matchUnconfirmed2 = forwardEntry->addr2Unconfirmed.EqualsExcludingPort(receivedAddr);
-
-    if (matchConfirmed1==true || (matchConfirmed2==false && confirmed1==false && matchUnconfirmed1==true))
-    {
-        // Forward to addr2
-        if (forwardEntry->addr1Confirmed==UNASSIGNED_SYSTEM_ADDRESS)
-        {
-            forwardEntry->addr1Confirmed=receivedAddr;
-        }
-        if (forwardEntry->addr2Confirmed!=UNASSIGNED_SYSTEM_ADDRESS)
-            forwardTarget=forwardEntry->addr2Confirmed;
-        else
-            forwardTarget=forwardEntry->addr2Unconfirmed;
-    }
-    else if (matchConfirmed2==true || (confirmed2==false && matchUnconfirmed2==true))
-    {
-        // Forward to addr1
-        if (forwardEntry->addr2Confirmed==UNASSIGNED_SYSTEM_ADDRESS)
-        {
-            forwardEntry->addr2Confirmed=receivedAddr;
-        }
-        if (forwardEntry->addr1Confirmed!=UNASSIGNED_SYSTEM_ADDRESS)
-            forwardTarget=forwardEntry->addr1Confirmed;
-        else
-            forwardTarget=forwardEntry->addr1Unconfirmed;
-    }
-    else
-    {
+    if (GetForwardTarget(forwardEntry, receivedAddr, &forwardTarget)==false)
         return;
-    }
 
     // Forward to dest
     len=0;
@@ -360,16 +442,13 @@ void UDPForwarder::RecvFrom(RakNet::TimeMS curTime, ForwardEntry *forwardEntry)
 }
 void UDPForwarder::UpdateUDPForwarder(void)
 {
-    /*
-#if !defined(SN_TARGET_PSP2)
-    timeval tv;
-    tv.tv_sec=0;
-    tv.tv_usec=0;
-#endif
-    */
-
     RakNet::TimeMS curTime = RakNet::GetTimeMS();
-
+    ProcessCommands(curTime);
+    AdvanceTimerWheel(curTime);
+    WaitAndRelay(curTime);
+}
+void UDPForwarder::ProcessCommands(RakNet::TimeMS curTime)
+{
     StartForwardingInputStruct *sfis;
     StartForwardingOutputStruct sfos;
     sfos.forwardingSocket=INVALID_SOCKET;
@@ -394,22 +473,13 @@ void UDPForwarder::UpdateUDPForwarder(void)
         {
             sfos.result=UDPFORWARDER_RESULT_COUNT;
 
-            for (unsigned int i=0; i < forwardListNotUpdated.Size(); i++)
+            ForwardEntry **existing = forwardEntries.Peek(ForwardEntryKey(sfis->source, sfis->destination));
+            if (existing)
             {
-                if (
-                    (forwardListNotUpdated[i]->addr1Unconfirmed==sfis->source &&
-                    forwardListNotUpdated[i]->addr2Unconfirmed==sfis->destination)
-                    ||
-                    (forwardListNotUpdated[i]->addr1Unconfirmed==sfis->destination &&
-                    forwardListNotUpdated[i]->addr2Unconfirmed==sfis->source)
-                    )
-                {
-                    ForwardEntry *fe = forwardListNotUpdated[i];
-                    sfos.forwardingPort = SocketLayer::GetLocalPort ( fe->socket );
-                    sfos.forwardingSocket=fe->socket;
-                    sfos.result=UDPFORWARDER_FORWARDING_ALREADY_EXISTS;
-                    break;
-                }
+                ForwardEntry *fe = *existing;
+                sfos.forwardingPort = SocketLayer::GetLocalPort ( fe->socket );
+                sfos.forwardingSocket=fe->socket;
+                sfos.result=UDPFORWARDER_FORWARDING_ALREADY_EXISTS;
             }
 
             if (sfos.result==UDPFORWARDER_RESULT_COUNT)
@@ -499,7 +569,7 @@ void UDPForwarder::UpdateUDPForwarder(void)
                     fcntl( fe->socket, F_SETFL, O_NONBLOCK );
 #endif
 
-                    forwardListNotUpdated.Insert(fe,_FILE_AND_LINE_);
+                    AddForwardEntry(fe, curTime);
                 }
             }
         }
@@ -509,6 +579,7 @@ void UDPForwarder::UpdateUDPForwarder(void)
         startForwardingOutputMutex.Lock();
         startForwardingOutput.Push(sfos,_FILE_AND_LINE_);
         startForwardingOutputMutex.Unlock();
+        startForwardingOutputEvent.SetEvent();
 
         startForwardingInput.Deallocate(sfis, _FILE_AND_LINE_);
     }
@@ -524,49 +595,241 @@ void UDPForwarder::UpdateUDPForwarder(void)
         if (sfs==0)
             break;
 
-        ForwardEntry *fe;
-        for (unsigned int i=0; i < forwardListNotUpdated.Size(); i++)
+        ForwardEntry **fe = forwardEntries.Peek(ForwardEntryKey(sfs->source, sfs->destination));
+        if (fe)
+            RemoveForwardEntry(*fe);
+
+        stopForwardingCommands.Deallocate(sfs, _FILE_AND_LINE_);
+    }
+}
+void UDPForwarder::AddForwardEntry(ForwardEntry *fe, RakNet::TimeMS curTime)
+{
+    fe->forwardListIndex=forwardList.Size();
+    forwardList.Insert(fe,_FILE_AND_LINE_);
+    forwardEntries.Push(ForwardEntryKey(fe->addr1Unconfirmed, fe->addr2Unconfirmed), fe, _FILE_AND_LINE_);
+    ScheduleTimeout(fe, curTime);
+
+#if UDP_FORWARDER_USE_EPOLL==1
+    epoll_event ev;
+    ev.events=EPOLLIN;
+    ev.data.ptr=fe;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fe->socket, &ev);
+#endif
+}
+void UDPForwarder::RemoveForwardEntry(ForwardEntry *fe)
+{
+#if UDP_FORWARDER_USE_EPOLL==1
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fe->socket, 0);
+#endif
+
+    UnscheduleTimeout(fe);
+    forwardEntries.Remove(ForwardEntryKey(fe->addr1Unconfirmed, fe->addr2Unconfirmed), _FILE_AND_LINE_);
+    unsigned int index = fe->forwardListIndex;
+    forwardList.RemoveAtIndexFast(index);
+    if (index < forwardList.Size())
+        forwardList[index]->forwardListIndex=index;
+    delete fe;
+}
+void UDPForwarder::ScheduleTimeout(ForwardEntry *fe, RakNet::TimeMS curTime)
+{
+    // Round up, so an entry is never checked before its timeout could have elapsed
+    RakNet::TimeMS remaining = fe->timeoutOnNoDataMS - (curTime - fe->timeLastDatagramForwarded);
+    if (curTime - fe->timeLastDatagramForwarded > fe->timeoutOnNoDataMS)
+        remaining = 0;
+    unsigned int ticks = (unsigned int) ((remaining + TIMER_WHEEL_RESOLUTION_MS - 1) / TIMER_WHEEL_RESOLUTION_MS);
+    if (ticks==0)
+        ticks=1;
+    else if (ticks>=TIMER_WHEEL_SLOTS)
+        ticks=TIMER_WHEEL_SLOTS-1;
+
+    // Entries further out than one revolution are moved on again when their slot comes due
+    fe->timerSlot=(timerWheelSlot+ticks) % TIMER_WHEEL_SLOTS;
+    fe->timerPrev=0;
+    fe->timerNext=timerWheel[fe->timerSlot];
+    if (fe->timerNext)
+        fe->timerNext->timerPrev=fe;
+    timerWheel[fe->timerSlot]=fe;
+}
+void UDPForwarder::UnscheduleTimeout(ForwardEntry *fe)
+{
+    if (fe->timerSlot==(unsigned int) -1)
+        return;
+    if (fe->timerPrev)
+        fe->timerPrev->timerNext=fe->timerNext;
+    else
+        timerWheel[fe->timerSlot]=fe->timerNext;
+    if (fe->timerNext)
+        fe->timerNext->timerPrev=fe->timerPrev;
+    fe->timerNext=fe->timerPrev=0;
+    fe->timerSlot=(unsigned int) -1;
+}
+void UDPForwarder::AdvanceTimerWheel(RakNet::TimeMS curTime)
+{
+    while (curTime - timerWheelTime >= TIMER_WHEEL_RESOLUTION_MS)
+    {
+        timerWheelTime+=TIMER_WHEEL_RESOLUTION_MS;
+        timerWheelSlot=(timerWheelSlot+1) % TIMER_WHEEL_SLOTS;
+
+        ForwardEntry *fe = timerWheel[timerWheelSlot];
+        timerWheel[timerWheelSlot]=0;
+        while (fe)
         {
-            if (
-                (forwardListNotUpdated[i]->addr1Unconfirmed==sfs->source &&
-                forwardListNotUpdated[i]->addr2Unconfirmed==sfs->destination)
-                ||
-                (forwardListNotUpdated[i]->addr1Unconfirmed==sfs->destination &&
-                forwardListNotUpdated[i]->addr2Unconfirmed==sfs->source)
-                )
-            {
-                fe = forwardListNotUpdated[i];
-                forwardListNotUpdated.RemoveAtIndexFast(i);
-                delete fe;
-                break;
-            }
+            ForwardEntry *next = fe->timerNext;
+            fe->timerSlot=(unsigned int) -1;
+            if (curTime - fe->timeLastDatagramForwarded > fe->timeoutOnNoDataMS)
+                RemoveForwardEntry(fe);
+            else
+                ScheduleTimeout(fe, curTime);
+            fe=next;
+        }
+    }
+}
+void UDPForwarder::WaitAndRelay(RakNet::TimeMS curTime)
+{
+    // Sleep until data arrives, a command is pushed, or the next timer wheel slot is due
+    RakNet::TimeMS waitMS = TIMER_WHEEL_RESOLUTION_MS - (curTime - timerWheelTime);
+    if (waitMS > TIMER_WHEEL_RESOLUTION_MS)
+        waitMS = 0;
+
+#if UDP_FORWARDER_USE_EPOLL==1
+    epoll_event events[64];
+    int numEvents = epoll_wait(epollFd, events, 64, (int) waitMS);
+    curTime = RakNet::GetTimeMS();
+    for (int i=0; i < numEvents; i++)
+    {
+        if (events[i].data.ptr==0)
+        {
+            uint64_t count;
+            ssize_t bytesRead=read(wakeEventFd, &count, sizeof(count));
+            (void) bytesRead;
+            continue;
         }
+        RecvFromBatch(curTime, (ForwardEntry*) events[i].data.ptr);
+    }
+#else
+    // Commands are only noticed between waits, so do not wait long
+    if (waitMS > 10)
+        waitMS = 10;
 
-        stopForwardingCommands.Deallocate(sfs, _FILE_AND_LINE_);
+    if (forwardList.Size()==0)
+    {
+        RakSleep(waitMS);
+        return;
+    }
+
+    fd_set readFD;
+    FD_ZERO(&readFD);
+    __UDPSOCKET__ largestDescriptor=0;
+    unsigned int i;
+    for (i=0; i < forwardList.Size(); i++)
+    {
+        FD_SET(forwardList[i]->socket, &readFD);
+        if (forwardList[i]->socket > largestDescriptor)
+            largestDescriptor=forwardList[i]->socket;
+    }
+
+    timeval tv;
+    tv.tv_sec=0;
+    tv.tv_usec=waitMS*1000;
+    int selectResult = select__((int) largestDescriptor+1, &readFD, 0, 0, &tv);
+    if (selectResult<=0)
+        return;
+
+    curTime = RakNet::GetTimeMS();
+    for (i=0; i < forwardList.Size(); i++)
+    {
+        if (FD_ISSET(forwardList[i]->socket, &readFD))
+            RecvFrom(curTime, forwardList[i]);
     }
+#endif
+}
 
+#if UDP_FORWARDER_USE_EPOLL==1
+void UDPForwarder::RecvFromBatch(RakNet::TimeMS curTime, ForwardEntry *forwardEntry)
+{
+    mmsghdr recvHeaders[RELAY_BATCH_SIZE], sendHeaders[RELAY_BATCH_SIZE];
+    iovec recvIov[RELAY_BATCH_SIZE], sendIov[RELAY_BATCH_SIZE];
+    sockaddr_storage recvAddrs[RELAY_BATCH_SIZE];
+    SystemAddress forwardTargets[RELAY_BATCH_SIZE];
     unsigned int i;
 
-    i=0;
-    while (i < forwardListNotUpdated.Size())
+    for (i=0; i < RELAY_BATCH_SIZE; i++)
     {
-        if (curTime > forwardListNotUpdated[i]->timeLastDatagramForwarded && // Account for timestamp wrap
-            curTime > forwardListNotUpdated[i]->timeLastDatagramForwarded+forwardListNotUpdated[i]->timeoutOnNoDataMS)
+        recvIov[i].iov_base=relayBuffers+i*MAXIMUM_MTU_SIZE;
+        recvIov[i].iov_len=MAXIMUM_MTU_SIZE;
+        memset(&recvHeaders[i], 0, sizeof(mmsghdr));
+        recvHeaders[i].msg_hdr.msg_name=&recvAddrs[i];
+        recvHeaders[i].msg_hdr.msg_namelen=sizeof(sockaddr_storage);
+        recvHeaders[i].msg_hdr.msg_iov=&recvIov[i];
+        recvHeaders[i].msg_hdr.msg_iovlen=1;
+    }
+
+    // Level triggered, so anything beyond one batch is picked up on the next wait
+    int received = recvmmsg(forwardEntry->socket, recvHeaders, RELAY_BATCH_SIZE, MSG_DONTWAIT, 0);
+    if (received<=0)
+        return;
+
+    unsigned int toSend=0;
+    for (i=0; i < (unsigned int) received; i++)
+    {
+        if (recvHeaders[i].msg_len==0)
+            continue;
+
+        SystemAddress receivedAddr;
+        if (recvAddrs[i].ss_family==AF_INET)
+            memcpy(&receivedAddr.address.addr4,&recvAddrs[i],sizeof(sockaddr_in));
+#if RAKNET_SUPPORT_IPV6==1
+        else if (recvAddrs[i].ss_family==AF_INET6)
+            memcpy(&receivedAddr.address.addr6,&recvAddrs[i],sizeof(sockaddr_in6));
+#endif
+        else
+            continue;
+
+        SystemAddress *forwardTarget = &forwardTargets[toSend];
+        if (GetForwardTarget(forwardEntry, receivedAddr, forwardTarget)==false)
+            continue;
+
+        sendIov[toSend].iov_base=recvIov[i].iov_base;
+        sendIov[toSend].iov_len=recvHeaders[i].msg_len;
+        memset(&sendHeaders[toSend], 0, sizeof(mmsghdr));
+#if RAKNET_SUPPORT_IPV6==1
+        if (forwardTarget->address.addr4.sin_family!=AF_INET)
         {
-            delete forwardListNotUpdated[i];
-            forwardListNotUpdated.RemoveAtIndex(i);
+            sendHeaders[toSend].msg_hdr.msg_name=&forwardTarget->address.addr6;
+            sendHeaders[toSend].msg_hdr.msg_namelen=sizeof(sockaddr_in6);
         }
         else
-            i++;
+#endif
+        {
+            sendHeaders[toSend].msg_hdr.msg_name=&forwardTarget->address.addr4;
+            sendHeaders[toSend].msg_hdr.msg_namelen=sizeof(sockaddr_in);
+        }
+        sendHeaders[toSend].msg_hdr.msg_iov=&sendIov[toSend];
+        sendHeaders[toSend].msg_hdr.msg_iovlen=1;
+        toSend++;
     }
 
-    ForwardEntry *forwardEntry;
-    for (i=0; i < forwardListNotUpdated.Size(); i++)
+    if (toSend==0)
+        return;
+
+    unsigned int sent=0;
+    while (sent < toSend)
     {
-        forwardEntry = forwardListNotUpdated[i];
-        RecvFrom(curTime, forwardEntry);
+        int result = sendmmsg(forwardEntry->socket, sendHeaders+sent, toSend-sent, 0);
+        if (result<=0)
+        {
+            // Drop the datagram that failed, as sendto would, and carry on with the rest
+            if (result<0 && errno==EINTR)
+                continue;
+            sent++;
+        }
+        else
+            sent+=(unsigned int) result;
     }
+
+    forwardEntry->timeLastDatagramForwarded=curTime;
 }
+#endif
 
 namespace RakNet {
 RAK_THREAD_DECLARATION(UpdateUDPForwarderGlobal)
@@ -576,15 +839,8 @@ RAK_THREAD_DECLARATION(UpdateUDPForwarderGlobal)
     udpForwarder->threadRunning++;
     while (udpForwarder->isRunning > 0)
     {
+        // Blocks until there is data to relay, a command, or a timeout to check
         udpForwarder->UpdateUDPForwarder();
-
-        // 12/1/2010 Do not change from 0
-        // See http://www.jenkinssoftware.com/forum/index.php?topic=4033.0;topicseen
-        // Avoid 100% reported CPU usage
-        if (udpForwarder->forwardListNotUpdated.Size()==0)
-            RakSleep(30);
-        else
-            RakSleep(0);
     }
     udpForwarder->threadRunning--;
     return 0;
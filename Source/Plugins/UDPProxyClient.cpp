@@ -29,6 +29,8 @@ STATIC_FACTORY_DEFINITIONS(UDPProxyClient,UDPProxyClient)
 
 UDPProxyClient::UDPProxyClient()
 {
+    AddReceivedMessageID(ID_UDP_PROXY_GENERAL);
+    AddReceivedMessageID(ID_UNCONNECTED_PONG);
     resultHandler=0;
 }
 UDPProxyClient::~UDPProxyClient()
@@ -71,6 +71,7 @@ STATIC_FACTORY_DEFINITIONS(UDPProxyCoordinator,UDPProxyCoordinator)
 
 UDPProxyCoordinator::UDPProxyCoordinator()
 {
+    AddReceivedMessageID(ID_UDP_PROXY_GENERAL);
 
 }
 UDPProxyCoordinator::~UDPProxyCoordinator()
@@ -81,6 +82,16 @@ void UDPProxyCoordinator::SetRemoteLoginPassword(RakNet::RakString password)
 {
     remoteLoginPassword=password;
 }
+void UDPProxyCoordinator::GetServerShardLoad(const SystemAddress &serverAddress, DataStructures::List<ShardLoad> &shardLoads) const
+{
+    shardLoads.Clear(true, _FILE_AND_LINE_);
+    unsigned int idx = serverList.GetIndexOf(serverAddress);
+    if (idx==(unsigned int)-1)
+        return;
+    const ServerLoad *serverLoad = serverLoadList[idx];
+    for (unsigned int i=0; i < serverLoad->shards.Size(); i++)
+        shardLoads.Push(serverLoad->shards[i], _FILE_AND_LINE_);
+}
 void UDPProxyCoordinator::Update(void)
 {
     unsigned int idx;
@@ -127,6 +138,9 @@ PluginReceiveResult UDPProxyCoordinator::OnReceive(Packet *packet)
         case ID_UDP_PROXY_PING_SERVERS_REPLY_FROM_CLIENT_TO_COORDINATOR:
             OnPingServersReplyFromClientToCoordinator(packet);
             return RR_STOP_PROCESSING_AND_DEALLOCATE;
+        case ID_UDP_PROXY_SHARD_LOAD_FROM_SERVER_TO_COORDINATOR:
+            OnShardLoadFromServerToCoordinator(packet);
+            return RR_STOP_PROCESSING_AND_DEALLOCATE;
         }
     }
     return RR_CONTINUE_PROCESSING;
@@ -168,6 +182,8 @@ void UDPProxyCoordinator::OnClosedConnection(const SystemAddress &systemAddress,
 
         // Remove dead server
         serverList.RemoveAtIndexFast(idx);
+        delete serverLoadList[idx];
+        serverLoadList.RemoveAtIndexFast(idx);
     }
 }
 void UDPProxyCoordinator::OnForwardingRequestFromClientToCoordinator(Packet *packet)
@@ -299,6 +315,24 @@ void UDPProxyCoordinator::SendForwardingRequest(SystemAddress sourceAddress, Sys
     outgoingBs.Write(sourceAddress);
     outgoingBs.Write(targetAddress);
     outgoingBs.Write(timeoutOnNoDataMS);
+
+    // Place the session on the shard with the most free entries, if the server has reported its shards
+    unsigned int idx = serverList.GetIndexOf(serverAddress);
+    if (idx!=(unsigned int)-1 && serverLoadList[idx]->shards.Size()>0)
+    {
+        DataStructures::List<ShardLoad> &shards = serverLoadList[idx]->shards;
+        unsigned short best=0;
+        for (unsigned short i=1; i < shards.Size(); i++)
+        {
+            if ((int) shards[i].maxForwardEntries-(int) shards[i].usedForwardEntries >
+                (int) shards[best].maxForwardEntries-(int) shards[best].usedForwardEntries)
+                best=i;
+        }
+        // Count it now, so requests before the next report spread out
+        shards[best].usedForwardEntries++;
+        outgoingBs.Write(best);
+    }
+
     rakPeerInterface->Send(&outgoingBs, MEDIUM_PRIORITY, RELIABLE_ORDERED, 0, serverAddress, false);
 }
 void UDPProxyCoordinator::OnLoginRequestFromServerToCoordinator(Packet *packet)
@@ -338,6 +372,7 @@ void UDPProxyCoordinator::OnLoginRequestFromServerToCoordinator(Packet *packet)
         return;
     }
     serverList.Push(packet->systemAddress, _FILE_AND_LINE_ );
+    serverLoadList.Push(new ServerLoad, _FILE_AND_LINE_ );
     outgoingBs.Write((MessageID)ID_UDP_PROXY_GENERAL);
     outgoingBs.Write((MessageID)ID_UDP_PROXY_LOGIN_SUCCESS_FROM_COORDINATOR_TO_SERVER);
     outgoingBs.Write(password);
@@ -430,6 +465,28 @@ void UDPProxyCoordinator::OnForwardingReplyFromServerToCoordinator(Packet *packe
         delete fw;
     }
 }
+void UDPProxyCoordinator::OnShardLoadFromServerToCoordinator(Packet *packet)
+{
+    unsigned int idx = serverList.GetIndexOf(packet->systemAddress);
+    if (idx==(unsigned int)-1)
+        return;
+
+    RakNet::BitStream incomingBs(packet->data, packet->length, false);
+    incomingBs.IgnoreBytes(2);
+    unsigned short shardCount;
+    if (incomingBs.Read(shardCount)==false)
+        return;
+
+    DataStructures::List<ShardLoad> &shards = serverLoadList[idx]->shards;
+    shards.Clear(true, _FILE_AND_LINE_);
+    ShardLoad shardLoad;
+    for (unsigned short i=0; i < shardCount; i++)
+    {
+        if (incomingBs.Read(shardLoad.usedForwardEntries)==false || incomingBs.Read(shardLoad.maxForwardEntries)==false)
+            break;
+        shards.Push(shardLoad, _FILE_AND_LINE_);
+    }
+}
 void UDPProxyCoordinator::OnPingServersReplyFromClientToCoordinator(Packet *packet)
 {
     RakNet::BitStream incomingBs(packet->data, packet->length, false);
@@ -527,6 +584,9 @@ void UDPProxyCoordinator::SendAllBusy(SystemAddress senderClientAddress, SystemA
 void UDPProxyCoordinator::Clear(void)
 {
     serverList.Clear(true, _FILE_AND_LINE_);
+    for (unsigned int i=0; i < serverLoadList.Size(); i++)
+        delete serverLoadList[i];
+    serverLoadList.Clear(true, _FILE_AND_LINE_);
     for (unsigned int i=0; i < forwardingRequestList.Size(); i++)
     {
         delete forwardingRequestList[i];
@@ -16,19 +16,86 @@
 #include "UDPProxyCommon.h"
 #include "RakPeerInterface.h"
 #include "MessageIdentifiers.h"
+#include "GetTime.h"
 
 using namespace RakNet;
 
+static const RakNet::TimeMS SHARD_LOAD_REPORT_INTERVAL_MS=1000;
+
 STATIC_FACTORY_DEFINITIONS(UDPProxyServer,UDPProxyServer)
 
 UDPProxyServer::UDPProxyServer()
 {
+    AddReceivedMessageID(ID_UDP_PROXY_GENERAL);
     resultHandler=0;
     socketFamily=AF_INET;
+    forwardersRunning=false;
+    nextShardLoadReportTime=0;
 }
 UDPProxyServer::~UDPProxyServer()
 {
+    SetForwarderShardCount(1);
+}
+void UDPProxyServer::SetForwarderShardCount(unsigned int count)
+{
+    if (count==0)
+        count=1;
 
+    while (additionalForwarders.Size()+1 > count)
+    {
+        UDPForwarder *forwarder = additionalForwarders[additionalForwarders.Size()-1];
+        additionalForwarders.RemoveFromEnd();
+        // Shutdown does nothing if not running
+        delete forwarder;
+    }
+    while (additionalForwarders.Size()+1 < count)
+    {
+        UDPForwarder *forwarder = new UDPForwarder;
+        forwarder->SetMaxForwardEntries((unsigned short) udpForwarder.GetMaxForwardEntries());
+        if (forwardersRunning)
+            forwarder->Startup();
+        additionalForwarders.Push(forwarder, _FILE_AND_LINE_);
+    }
+}
+unsigned int UDPProxyServer::GetForwarderShardCount(void) const
+{
+    return additionalForwarders.Size()+1;
+}
+UDPForwarder *UDPProxyServer::GetForwarderShard(unsigned int index)
+{
+    if (index==0)
+        return &udpForwarder;
+    return additionalForwarders[index-1];
+}
+unsigned int UDPProxyServer::GetLeastLoadedShard(void)
+{
+    unsigned int best=0;
+    int bestFree=udpForwarder.GetMaxForwardEntries()-udpForwarder.GetUsedForwardEntries();
+    for (unsigned int i=0; i < additionalForwarders.Size(); i++)
+    {
+        int freeEntries=additionalForwarders[i]->GetMaxForwardEntries()-additionalForwarders[i]->GetUsedForwardEntries();
+        if (freeEntries > bestFree)
+        {
+            bestFree=freeEntries;
+            best=i+1;
+        }
+    }
+    return best;
+}
+void UDPProxyServer::SendShardLoad(const SystemAddress &coordinatorAddress)
+{
+    RakNet::BitStream outgoingBs;
+    outgoingBs.Write((MessageID)ID_UDP_PROXY_GENERAL);
+    outgoingBs.Write((MessageID)ID_UDP_PROXY_SHARD_LOAD_FROM_SERVER_TO_COORDINATOR);
+    unsigned short shardCount = (unsigned short) GetForwarderShardCount();
+    outgoingBs.Write(shardCount);
+    for (unsigned int i=0; i < shardCount; i++)
+    {
+        UDPForwarder *forwarder = GetForwarderShard(i);
+        outgoingBs.Write((unsigned short) forwarder->GetUsedForwardEntries());
+        outgoingBs.Write((unsigned short) forwarder->GetMaxForwardEntries());
+    }
+    rakPeerInterface->Send(&outgoingBs, MEDIUM_PRIORITY, RELIABLE_ORDERED, 0, coordinatorAddress, false);
 }
 void UDPProxyServer::SetSocketFamily(unsigned short _socketFamily)
 {
@@ -62,6 +129,16 @@ void UDPProxyServer::SetServerPublicIP(RakString ip)
 }
 void UDPProxyServer::Update(void)
 {
+    if (loggedInCoordinators.Size()==0)
+        return;
+
+    RakNet::TimeMS curTime = RakNet::GetTimeMS();
+    if ((int) (curTime - nextShardLoadReportTime) < 0)
+        return;
+    nextShardLoadReportTime=curTime+SHARD_LOAD_REPORT_INTERVAL_MS;
+
+    for (unsigned int i=0; i < loggedInCoordinators.Size(); i++)
+        SendShardLoad(loggedInCoordinators[i]);
 }
 PluginReceiveResult UDPProxyServer::OnReceive(Packet *packet)
 {
@@ -111,6 +188,7 @@ PluginReceiveResult UDPProxyServer::OnReceive(Packet *packet)
                     case ID_UDP_PROXY_LOGIN_SUCCESS_FROM_COORDINATOR_TO_SERVER:
                         // RakAssert(loggedInCoordinators.GetIndexOf(packet->systemAddress)==(unsigned int)-1);
                         loggedInCoordinators.Insert(packet->systemAddress, packet->systemAddress, true, _FILE_AND_LINE_);
+                        SendShardLoad(packet->systemAddress);
                         if (resultHandler)
                             resultHandler->OnLoginSuccess(password, this);
                         break;
@@ -135,10 +213,16 @@ void UDPProxyServer::OnClosedConnection(const SystemAddress &systemAddress, RakN
 void UDPProxyServer::OnRakPeerStartup(void)
 {
     udpForwarder.Startup();
+    for (unsigned int i=0; i < additionalForwarders.Size(); i++)
+        additionalForwarders[i]->Startup();
+    forwardersRunning=true;
 }
 void UDPProxyServer::OnRakPeerShutdown(void)
 {
     udpForwarder.Shutdown();
+    for (unsigned int i=0; i < additionalForwarders.Size(); i++)
+        additionalForwarders[i]->Shutdown();
+    forwardersRunning=false;
     loggingInCoordinators.Clear(true,_FILE_AND_LINE_);
     loggedInCoordinators.Clear(true,_FILE_AND_LINE_);
 }
@@ -162,8 +246,23 @@ void UDPProxyServer::OnForwardingRequestFromCoordinatorToServer(Packet *packet)
     incomingBs.Read(timeoutOnNoDataMS);
     RakAssert(timeoutOnNoDataMS > 0 && timeoutOnNoDataMS <= UDP_FORWARDER_MAXIMUM_TIMEOUT);
 
+    // Coordinators that know about shards say which one to use. Otherwise pick it here.
+    unsigned short shardIndex;
+    if (incomingBs.Read(shardIndex)==false || shardIndex >= GetForwarderShardCount())
+        shardIndex=(unsigned short) GetLeastLoadedShard();
+
     unsigned short forwardingPort=0;
-    UDPForwarderResult success = udpForwarder.StartForwarding(sourceAddress, targetAddress, timeoutOnNoDataMS, 0, socketFamily, &forwardingPort, 0);
+    UDPForwarderResult success = GetForwarderShard(shardIndex)->StartForwarding(sourceAddress, targetAddress, timeoutOnNoDataMS, 0, socketFamily, &forwardingPort, 0);
+    if (success==UDPFORWARDER_NO_SOCKETS && GetForwarderShardCount() > 1)
+    {
+        // The coordinator's view of the load is up to a second old
+        unsigned int leastLoaded=GetLeastLoadedShard();
+        if (leastLoaded!=shardIndex)
+        {
+            shardIndex=(unsigned short) leastLoaded;
+            success = GetForwarderShard(shardIndex)->StartForwarding(sourceAddress, targetAddress, timeoutOnNoDataMS, 0, socketFamily, &forwardingPort, 0);
+        }
+    }
     RakNet::BitStream outgoingBs;
     outgoingBs.Write((MessageID)ID_UDP_PROXY_GENERAL);
     outgoingBs.Write((MessageID)ID_UDP_PROXY_FORWARDING_REPLY_FROM_SERVER_TO_COORDINATOR);
@@ -172,6 +271,7 @@ void UDPProxyServer::OnForwardingRequestFromCoordinatorToServer(Packet *packet)
     outgoingBs.Write(serverPublicIp);
     outgoingBs.Write((unsigned char) success);
     outgoingBs.Write(forwardingPort);
+    outgoingBs.Write(shardIndex);
     rakPeerInterface->Send(&outgoingBs, MEDIUM_PRIORITY, RELIABLE_ORDERED, 0, packet->systemAddress, false);
 }
 
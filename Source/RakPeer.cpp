@@ -57,6 +57,10 @@
 #ifdef USE_THREADED_SEND
 #include "SendToThread.h"
 #endif
+#ifdef LIBCAT_SECURITY
+#include "EncryptThread.h"
+#include "HandshakeThread.h"
+#endif
 
 #ifdef CAT_AUDIT
 #define CAT_AUDIT_PRINTF(...) printf(__VA_ARGS__)
@@ -126,6 +130,12 @@ struct RakPeerAndIndex
 
 static const unsigned int MAX_OFFLINE_DATA_LENGTH = 400; // I set this because I limit ID_CONNECTION_REQUEST to 512 bytes, and the password is appended to that packet.
 
+// Received datagrams each socket can pass to the update thread without locking
+static const unsigned int BUFFERED_PACKET_RING_SIZE = 1024;
+
+// Connection cookies change this often. A cookie is accepted until the end of the period after the one it was made in.
+static const RakNet::TimeMS CONNECTION_COOKIE_PERIOD_MS = 5000;
+
 // Used to distinguish between offline messages with data, and messages from the reliability layer
 // Should be different than any message that could result from messages from the reliability layer
 #if  !defined(__GNUC__)
@@ -136,54 +146,18 @@ static const unsigned char OFFLINE_MESSAGE_DATA_ID[16] = {
         0x00, 0xFF, 0xFF, 0x00, 0xFE, 0xFE, 0xFE, 0xFE, 0xFD, 0xFD, 0xFD, 0xFD, 0x12, 0x34, 0x56, 0x78
 };
 
-struct PacketFollowedByData
-{
-    Packet p;
-    unsigned char data[1];
-};
-
 Packet *RakPeer::AllocPacket(unsigned dataSize, const char *file, unsigned int line)
 {
-    // Crashes when dataSize is 4 bytes - not sure why
-//     unsigned char *data = (unsigned char *) malloc(sizeof(PacketFollowedByData)+dataSize);
-//     Packet *p = &((PacketFollowedByData *)data)->p;
-//     p->data=((PacketFollowedByData *)data)->data;
-//     p->length=dataSize;
-//     p->bitSize=BYTES_TO_BITS(dataSize);
-//     p->deleteData=false;
-//     p->guid=UNASSIGNED_RAKNET_GUID;
-//     return p;
-
-    RakNet::Packet *p;
-    packetAllocationPoolMutex.Lock();
-    p = packetAllocationPool.Allocate(file, line);
-    packetAllocationPoolMutex.Unlock();
-    p = new((void *) p) Packet;
-    p->data = (unsigned char *) malloc(dataSize);
-    p->length = dataSize;
-    p->bitSize = BYTES_TO_BITS(dataSize);
-    p->deleteData = true;
-    p->guid = UNASSIGNED_RAKNET_GUID;
-    p->wasGeneratedLocally = false;
-    return p;
+    (void) file;
+    (void) line;
+    return packetAllocationPool.Allocate(dataSize);
 }
 
 Packet *RakPeer::AllocPacket(unsigned dataSize, unsigned char *data, const char *file, unsigned int line)
 {
-    // Packet *p = (Packet *)malloc(sizeof(Packet));
-    RakNet::Packet *p;
-    packetAllocationPoolMutex.Lock();
-    p = packetAllocationPool.Allocate(file, line);
-    packetAllocationPoolMutex.Unlock();
-    p = new((void *) p) Packet;
-    RakAssert(p);
-    p->data = data;
-    p->length = dataSize;
-    p->bitSize = BYTES_TO_BITS(dataSize);
-    p->deleteData = true;
-    p->guid = UNASSIGNED_RAKNET_GUID;
-    p->wasGeneratedLocally = false;
-    return p;
+    (void) file;
+    (void) line;
+    return packetAllocationPool.Allocate(dataSize, data);
 }
 
 STATIC_FACTORY_DEFINITIONS(RakPeerInterface, RakPeer)
@@ -200,6 +174,8 @@ RakPeer::RakPeer()
     _using_security = false;
     _server_handshake = 0;
     _cookie_jar = 0;
+    anySecureConnections = false;
+    nextHandshakeId = 0;
 #endif
 
 #ifdef _WIN32
@@ -219,6 +195,7 @@ RakPeer::RakPeer()
     endThreads = true;
     isMainLoopThreadActive = false;
     incomingDatagramEventHandler = 0;
+    bufferedPacketsQueueSize = 0;
 
     // isRecvfromThreadActive=false;
 #if defined(GET_TIME_SPIKE_LIMIT) && GET_TIME_SPIKE_LIMIT > 0
@@ -235,6 +212,12 @@ RakPeer::RakPeer()
     splitMessageProgressInterval = 0;
     //unreliableTimeout=0;
     unreliableTimeout = 1000;
+    coalesceMaxDelay = 0;
+    coalesceMaxMessageBytes = 0;
+    coalesceOrderingChannelMask = 0;
+    messageCompressor = 0;
+    compressMinMessageBytes = 0;
+    compressOrderingChannelMask = 0;
     maxOutgoingBPS = 0;
     firstExternalID = UNASSIGNED_SYSTEM_ADDRESS;
     myGuid = UNASSIGNED_RAKNET_GUID;
@@ -257,13 +240,10 @@ RakPeer::RakPeer()
     bufferedCommands.SetPageSize(sizeof(BufferedCommandStruct) * 16);
     socketQueryOutput.SetPageSize(sizeof(SocketQueryOutput) * 8);
 
-    packetAllocationPoolMutex.Lock();
-    packetAllocationPool.SetPageSize(sizeof(DataStructures::MemoryPool<Packet>::MemoryWithPage) * 32);
-    packetAllocationPoolMutex.Unlock();
-
     remoteSystemIndexPool.SetPageSize(sizeof(DataStructures::MemoryPool<RemoteSystemIndex>::MemoryWithPage) * 32);
 
     GenerateGUID();
+    GenerateConnectionCookieSecret();
 
     quitAndDataEvents.InitEvent();
     limitConnectionFrequencyFromTheSameIP = false;
@@ -494,6 +474,8 @@ br == BR_REQUIRES_RAKNET_SUPPORT_IPV6_DEFINE)
 
     }
 
+    SetupBufferedPackets();
+
 #if !defined(__native_client__)
     for (i = 0; i < socketDescriptorCount; i++)
     {
@@ -551,6 +533,7 @@ br == BR_REQUIRES_RAKNET_SUPPORT_IPV6_DEFINE)
             remoteSystemList[i].connectMode = RemoteSystemStruct::NO_ACTION;
             remoteSystemList[i].MTUSize = defaultMTUSize;
             remoteSystemList[i].remoteSystemIndex = (SystemIndex) i;
+            remoteSystemList[i].reliabilityLayer.SetPacketPool(&packetAllocationPool);
 #ifdef _DEBUG
             remoteSystemList[i].reliabilityLayer.ApplyNetworkSimulator(_packetloss, _minExtraPing, _extraPingVariance);
 #endif
@@ -563,6 +546,9 @@ br == BR_REQUIRES_RAKNET_SUPPORT_IPV6_DEFINE)
         {
             remoteSystemLookup[i] = 0;
         }
+
+        remoteSystemGuidIndex.Init(maximumNumberOfPeers);
+        remoteSystemAddressIndex.Init(maximumNumberOfPeers);
     }
 
     // For histogram statistics
@@ -579,6 +565,12 @@ br == BR_REQUIRES_RAKNET_SUPPORT_IPV6_DEFINE)
         ClearBufferedPackets();
         ClearSocketQueryOutput();
 
+#ifdef LIBCAT_SECURITY
+        // Before the update thread, which queues the handshakes
+        if (_using_security)
+            handshakeThread.Start(my_public_key, my_private_key, &quitAndDataEvents);
+#endif
+
         if (isMainLoopThreadActive == false)
         {
 #if RAKPEER_USER_THREADED != 1
@@ -650,6 +642,9 @@ br == BR_REQUIRES_RAKNET_SUPPORT_IPV6_DEFINE)
 #ifdef USE_THREADED_SEND
     RakNet::SendToThread::AddRef();
 #endif
+#ifdef LIBCAT_SECURITY
+    RakNet::EncryptThread::AddRef();
+#endif
 
     return RAKNET_STARTED;
 }
@@ -706,6 +701,7 @@ bool RakPeer::InitializeSecurity(const char *public_key, const char *private_key
         _server_handshake->FillCookieJar(_cookie_jar);
 
         memcpy(my_public_key, public_key, sizeof(my_public_key));
+        memcpy(my_private_key, private_key, sizeof(my_private_key));
 
         _using_security = true;
         return true;
@@ -743,6 +739,7 @@ void RakPeer::DisableSecurity(void)
     _server_handshake = 0;
     delete _cookie_jar;
     _cookie_jar = 0;
+    memset(my_private_key, 0, sizeof(my_private_key));
 
     _using_security = false;
 #endif
@@ -1101,14 +1098,8 @@ void RakPeer::Shutdown(unsigned int blockDuration, unsigned char orderingChannel
     //remoteSystemListSize = 0;
 
     // Free any packets the user didn't deallocate
-    packetReturnMutex.Lock();
-    for (i = 0; i < packetReturnQueue.Size(); i++)
-        DeallocatePacket(packetReturnQueue[i]);
-    packetReturnQueue.Clear(_FILE_AND_LINE_);
-    packetReturnMutex.Unlock();
-    packetAllocationPoolMutex.Lock();
-    packetAllocationPool.Clear(_FILE_AND_LINE_);
-    packetAllocationPoolMutex.Unlock();
+    // Slabs are kept until destruction, since the user may still hold packets returned by Receive()
+    packetReturnQueue.Clear(&packetAllocationPool);
 
     /*
     if (isRecvFromLoopThreadActive.GetValue()>0)
@@ -1143,6 +1134,12 @@ void RakPeer::Shutdown(unsigned int blockDuration, unsigned char orderingChannel
 #ifdef USE_THREADED_SEND
     RakNet::SendToThread::Deref();
 #endif
+#ifdef LIBCAT_SECURITY
+    // Every reliability layer was reset above, which waited for its sends
+    RakNet::EncryptThread::Deref();
+    // Handshakes not yet answered are dropped, their connections are gone
+    handshakeThread.Stop();
+#endif
 
     ResetSendReceipt();
 }
@@ -1401,6 +1398,39 @@ uint32_t RakPeer::SendList(const char **data, const int *lengths, const int numP
     return usedSendReceipt;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+// Sends the same data to a list of systems, copying and queuing it only once
+// ---------------------------------------------------------------------------------------------------------------------
+uint32_t RakPeer::SendToSystems(const RakNet::BitStream *bitStream, PacketPriority priority, PacketReliability reliability,
+                                char orderingChannel, const DataStructures::List<RakNetGUID> &systemIdentifiers,
+                                uint32_t forceReceiptNumber)
+{
+#ifdef _DEBUG
+    RakAssert(bitStream->GetNumberOfBytesUsed() > 0);
+#endif
+
+    RakAssert(!(reliability >= NUMBER_OF_RELIABILITIES || reliability < 0));
+    RakAssert(!(priority > NUMBER_OF_PRIORITIES || priority < 0));
+    RakAssert(!(orderingChannel >= NUMBER_OF_ORDERED_STREAMS));
+
+    if (bitStream->GetNumberOfBytesUsed() == 0 || systemIdentifiers.Size() == 0)
+        return 0;
+
+    if (remoteSystemList == 0 || endThreads == true)
+        return 0;
+
+    uint32_t usedSendReceipt;
+    if (forceReceiptNumber != 0)
+        usedSendReceipt = forceReceiptNumber;
+    else
+        usedSendReceipt = IncrementNextSendReceipt();
+
+    SendBufferedToSystems((const char *) bitStream->GetData(), bitStream->GetNumberOfBitsUsed(), priority, reliability,
+                          orderingChannel, systemIdentifiers, usedSendReceipt);
+
+    return usedSendReceipt;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Description:
 // Gets a packet from the incoming packet queue. Use DeallocatePacket to deallocate the packet after you are done with it.
@@ -1422,10 +1452,6 @@ Packet *RakPeer::Receive(void)
 
     RakNet::Packet *packet;
 //    Packet **threadPacket;
-    PluginReceiveResult pluginResult;
-
-    int offset;
-    unsigned int i;
 
     // User should call RunUpdateCycle and RunRecvFromOnce to do this commented code
     /*
@@ -1464,6 +1490,46 @@ Packet *RakPeer::Receive(void)
 #endif
     */
 
+    UpdatePlugins();
+
+    packet = PopPacketForUser();
+
+#ifdef _DEBUG
+    RakAssert(packet == 0 || packet->data);
+#endif
+
+    return packet;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Description:
+// Gets up to maxPackets packets from the incoming packet queue, updating plugins once for the whole batch.
+//
+// Returns:
+// How many packets were written to packets
+// ---------------------------------------------------------------------------------------------------------------------
+unsigned int RakPeer::ReceiveBatch(Packet **packets, unsigned int maxPackets)
+{
+    if (!(IsActive()) || maxPackets == 0)
+        return 0;
+
+    UpdatePlugins();
+
+    unsigned int numPackets = 0;
+    while (numPackets < maxPackets)
+    {
+        packets[numPackets] = PopPacketForUser();
+        if (packets[numPackets] == 0)
+            break;
+        numPackets++;
+    }
+    return numPackets;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::UpdatePlugins(void)
+{
+    unsigned int i;
     for (i = 0; i < pluginListTS.Size(); i++)
     {
         pluginListTS[i]->Update();
@@ -1472,15 +1538,20 @@ Packet *RakPeer::Receive(void)
     {
         pluginListNTS[i]->Update();
     }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+Packet *RakPeer::PopPacketForUser(void)
+{
+    RakNet::Packet *packet;
+    PluginReceiveResult pluginResult;
+    MessageID messageId;
+    int offset;
+    unsigned int i;
 
     do
     {
-        packetReturnMutex.Lock();
-        if (packetReturnQueue.IsEmpty())
-            packet = 0;
-        else
-            packet = packetReturnQueue.Pop();
-        packetReturnMutex.Unlock();
+        packet = packetReturnQueue.Pop();
         if (packet == 0)
             return 0;
 
@@ -1504,25 +1575,14 @@ Packet *RakPeer::Receive(void)
         CallPluginCallbacks(pluginListTS, packet);
         CallPluginCallbacks(pluginListNTS, packet);
 
-        for (i = 0; i < pluginListTS.Size(); i++)
-        {
-            pluginResult = pluginListTS[i]->OnReceive(packet);
-            if (pluginResult == RR_STOP_PROCESSING_AND_DEALLOCATE)
-            {
-                DeallocatePacket(packet);
-                packet = 0; // Will do the loop again and get another packet
-                break; // break out of the enclosing for
-            }
-            else if (pluginResult == RR_STOP_PROCESSING)
-            {
-                packet = 0;
-                break;
-            }
-        }
-
-        for (i = 0; i < pluginListNTS.Size(); i++)
+        // Only plugins that handle this message identifier get OnReceive()
+        messageId = packet->data[0];
+        if (messageId == ID_TIMESTAMP && packet->length > sizeof(MessageID) + sizeof(RakNet::Time))
+            messageId = packet->data[sizeof(MessageID) + sizeof(RakNet::Time)];
+        DataStructures::List<PluginInterface2 *> &dispatchList = pluginDispatchTable[messageId];
+        for (i = 0; i < dispatchList.Size(); i++)
         {
-            pluginResult = pluginListNTS[i]->OnReceive(packet);
+            pluginResult = dispatchList[i]->OnReceive(packet);
             if (pluginResult == RR_STOP_PROCESSING_AND_DEALLOCATE)
             {
                 DeallocatePacket(packet);
@@ -1538,10 +1598,6 @@ Packet *RakPeer::Receive(void)
 
     } while (packet == 0);
 
-#ifdef _DEBUG
-    RakAssert(packet->data);
-#endif
-
     return packet;
 }
 
@@ -1556,11 +1612,7 @@ void RakPeer::DeallocatePacket(Packet *packet)
 
     if (packet->deleteData)
     {
-        free(packet->data);
-        packet->~Packet();
-        packetAllocationPoolMutex.Lock();
-        packetAllocationPool.Release(packet, _FILE_AND_LINE_);
-        packetAllocationPoolMutex.Unlock();
+        packetAllocationPool.Release(packet);
     }
     else
     {
@@ -1568,6 +1620,16 @@ void RakPeer::DeallocatePacket(Packet *packet)
     }
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+// Description:
+// Call this to deallocate packets returned by ReceiveBatch
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::DeallocatePackets(Packet **packets, unsigned int numPackets)
+{
+    for (unsigned int i = 0; i < numPackets; i++)
+        DeallocatePacket(packets[i]);
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Description:
 // Return the total number of connections we are allowed
@@ -1799,54 +1861,157 @@ RakPeer::GetSystemList(DataStructures::List<SystemAddress> &addresses, DataStruc
     }
 }
 
+// Ban list keys are the IP version followed by the address, so IPv4 and IPv6 prefixes never overlap
+static const unsigned int BAN_KEY_IPV4_BITS = 8 + 32;
+static const unsigned int BAN_KEY_IPV6_BITS = 8 + 128;
+
+struct BanPrefix
+{
+    unsigned char key[DataStructures::PrefixTrie::MAX_KEY_BYTES];
+    unsigned int prefixBits;
+};
+
+// Writes the ban list key of an address, and returns its length in bits. IPv4 mapped IPv6 addresses use the IPv4 key.
+static unsigned int GetBanKey(const SystemAddress &systemAddress, unsigned char *key)
+{
+#if RAKNET_SUPPORT_IPV6==1
+    if (systemAddress.address.addr4.sin_family == AF_INET6)
+    {
+        static const unsigned char v4MappedPrefix[12] = {0,0,0,0,0,0,0,0,0,0,0xFF,0xFF};
+        const unsigned char *bytes = systemAddress.address.addr6.sin6_addr.s6_addr;
+        if (memcmp(bytes, v4MappedPrefix, sizeof(v4MappedPrefix)) != 0)
+        {
+            key[0] = 6;
+            memcpy(key + 1, bytes, 16);
+            return BAN_KEY_IPV6_BITS;
+        }
+        key[0] = 4;
+        memcpy(key + 1, bytes + 12, 4);
+        return BAN_KEY_IPV4_BITS;
+    }
+#endif
+    key[0] = 4;
+    memcpy(key + 1, &systemAddress.address.addr4.sin_addr.s_addr, 4);
+    return BAN_KEY_IPV4_BITS;
+}
+
+// Converts an entry of the ban list to the prefixes it covers. Returns false if it is not a valid entry.
+// A * after a dot covers the rest of the address. A * after part of an octet, such as 128.1*, covers each value of that
+// octet that starts with those digits, which is what the string compare this replaced did.
+static bool ParseBanPattern(const char *IP, DataStructures::List<BanPrefix> &prefixes)
+{
+    BanPrefix prefix;
+    memset(&prefix, 0, sizeof(prefix));
+
+    int cidrBits = -1;
+    const char *slash = strchr(IP, '/');
+    if (slash)
+    {
+        if (isdigit((unsigned char) slash[1]) == 0)
+            return false;
+        cidrBits = atoi(slash + 1);
+    }
+
+    if (strchr(IP, ':'))
+    {
+        // IPv6, which has no wildcards
+        char address[64];
+        size_t length = slash ? (size_t) (slash - IP) : strlen(IP);
+        if (length >= sizeof(address))
+            return false;
+        memcpy(address, IP, length);
+        address[length] = 0;
+        SystemAddress systemAddress;
+        if (systemAddress.FromString(address, '|', 6) == false)
+            return false;
+        prefix.prefixBits = GetBanKey(systemAddress, prefix.key);
+        if (cidrBits >= 0)
+        {
+            // CIDR bits of an IPv4 mapped address count the 96 bit mapping prefix
+            if (prefix.prefixBits == BAN_KEY_IPV4_BITS)
+                cidrBits -= 96;
+            if (cidrBits < 0 || 8 + (unsigned int) cidrBits > prefix.prefixBits)
+                return false;
+            prefix.prefixBits = 8 + cidrBits;
+        }
+        prefixes.Push(prefix, _FILE_AND_LINE_);
+        return true;
+    }
+
+    prefix.key[0] = 4;
+    const char *c = IP;
+    for (unsigned int octet = 0; octet < 4; octet++)
+    {
+        if (*c == '*')
+        {
+            prefix.prefixBits = 8 + octet * 8;
+            prefixes.Push(prefix, _FILE_AND_LINE_);
+            return true;
+        }
+
+        const char *digits = c;
+        unsigned int value = 0;
+        while (isdigit((unsigned char) *c) && c - digits < 3)
+            value = value * 10 + (*c++ - '0');
+        if (c == digits || value > 255)
+            return false;
+
+        if (*c == '*')
+        {
+            prefix.prefixBits = 8 + (octet + 1) * 8;
+            for (value = 0; value < 256; value++)
+            {
+                char str[4];
+                sprintf(str, "%u", value);
+                if (strncmp(str, digits, c - digits) == 0)
+                {
+                    prefix.key[1 + octet] = (unsigned char) value;
+                    prefixes.Push(prefix, _FILE_AND_LINE_);
+                }
+            }
+            return true;
+        }
+
+        prefix.key[1 + octet] = (unsigned char) value;
+        if (octet < 3 && *c++ != '.')
+            return false;
+    }
+
+    if (*c != 0 && *c != '/')
+        return false;
+    if (cidrBits > 32)
+        return false;
+    prefix.prefixBits = 8 + (cidrBits >= 0 ? cidrBits : 32);
+    prefixes.Push(prefix, _FILE_AND_LINE_);
+    return true;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Description:
 // Bans an IP from connecting. Banned IPs persist between connections.
 //
 // Parameters
 // IP - Dotted IP address.  Can use * as a wildcard, such as 128.0.0.* will ban
-// All IP addresses starting with 128.0.0
+// All IP addresses starting with 128.0.0. Can also be an IPv4 or IPv6 CIDR range, such as 128.0.0.0/16
 // milliseconds - how many ms for a temporary ban.  Use 0 for a permanent ban
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::AddToBanList(const char *IP, RakNet::TimeMS milliseconds)
 {
-    unsigned index;
     RakNet::TimeMS time = RakNet::GetTimeMS();
 
-    if (IP == 0 || IP[0] == 0 || strlen(IP) > 15)
+    if (IP == 0 || IP[0] == 0 || strlen(IP) > 63)
         return;
 
-    // If this guy is already in the ban list, do nothing
-    index = 0;
-
-    banListMutex.Lock();
-
-    for (; index < banList.Size(); index++)
-    {
-        if (strcmp(IP, banList[index]->IP) == 0)
-        {
-            // Already in the ban list.  Just update the time
-            if (milliseconds == 0)
-                banList[index]->timeout = 0; // Infinite
-            else
-                banList[index]->timeout = time + milliseconds;
-            banListMutex.Unlock();
-            return;
-        }
-    }
+    DataStructures::List<BanPrefix> prefixes;
+    if (ParseBanPattern(IP, prefixes) == false)
+        return;
 
-    banListMutex.Unlock();
+    // Each Add() increments banList.GetAddCount(), so connected systems are checked again.
+    // Removing bans does not need this, as it only unbans
+    for (unsigned int i = 0; i < prefixes.Size(); i++)
+        banList.Add(prefixes[i].key, prefixes[i].prefixBits, milliseconds == 0 ? 0 : time + milliseconds);
 
-    BanStruct *banStruct = new BanStruct;
-    banStruct->IP = (char *) malloc(16);
-    if (milliseconds == 0)
-        banStruct->timeout = 0; // Infinite
-    else
-        banStruct->timeout = time + milliseconds;
-    strcpy(banStruct->IP, IP);
-    banListMutex.Lock();
-    banList.Insert(banStruct, _FILE_AND_LINE_);
-    banListMutex.Unlock();
+    banList.RemoveExpired(time);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -1859,36 +2024,15 @@ void RakPeer::AddToBanList(const char *IP, RakNet::TimeMS milliseconds)
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::RemoveFromBanList(const char *IP)
 {
-    unsigned index;
-    BanStruct *temp;
-
-    if (IP == 0 || IP[0] == 0 || strlen(IP) > 15)
+    if (IP == 0 || IP[0] == 0 || strlen(IP) > 63)
         return;
 
-    index = 0;
-    temp = 0;
-
-    banListMutex.Lock();
-
-    for (; index < banList.Size(); index++)
-    {
-        if (strcmp(IP, banList[index]->IP) == 0)
-        {
-            temp = banList[index];
-            banList[index] = banList[banList.Size() - 1];
-            banList.RemoveAtIndex(banList.Size() - 1);
-            break;
-        }
-    }
-
-    banListMutex.Unlock();
-
-    if (temp)
-    {
-        free(temp->IP);
-        delete temp;
-    }
+    DataStructures::List<BanPrefix> prefixes;
+    if (ParseBanPattern(IP, prefixes) == false)
+        return;
 
+    for (unsigned int i = 0; i < prefixes.Size(); i++)
+        banList.Remove(prefixes[i].key, prefixes[i].prefixBits);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -1897,19 +2041,7 @@ void RakPeer::RemoveFromBanList(const char *IP)
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::ClearBanList(void)
 {
-    unsigned index;
-    index = 0;
-    banListMutex.Lock();
-
-    for (; index < banList.Size(); index++)
-    {
-        free(banList[index]->IP);
-        delete banList[index];
-    }
-
-    banList.Clear(false, _FILE_AND_LINE_);
-
-    banListMutex.Unlock();
+    banList.Clear();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -1931,89 +2063,38 @@ void RakPeer::SetLimitIPConnectionFrequency(bool b)
 // ---------------------------------------------------------------------------------------------------------------------
 bool RakPeer::IsBanned(const char *IP)
 {
-    unsigned banListIndex, characterIndex;
-    RakNet::TimeMS time;
-    BanStruct *temp;
-
-    if (IP == 0 || IP[0] == 0 || strlen(IP) > 15)
+    if (IP == 0 || IP[0] == 0 || strlen(IP) > 63)
         return false;
 
-    banListIndex = 0;
-
     if (banList.Size() == 0)
-        return false; // Skip the mutex if possible
-
-    time = RakNet::GetTimeMS();
+        return false;
 
-    banListMutex.Lock();
+    DataStructures::List<BanPrefix> prefixes;
+    if (ParseBanPattern(IP, prefixes) == false)
+        return false;
 
-    while (banListIndex < banList.Size())
+    RakNet::TimeMS time = RakNet::GetTimeMS();
+    for (unsigned int i = 0; i < prefixes.Size(); i++)
     {
-        if (banList[banListIndex]->timeout > 0 && banList[banListIndex]->timeout < time)
-        {
-            // Delete expired ban
-            temp = banList[banListIndex];
-            banList[banListIndex] = banList[banList.Size() - 1];
-            banList.RemoveAtIndex(banList.Size() - 1);
-            free(temp->IP);
-            delete temp;
-        }
-        else
-        {
-            characterIndex = 0;
-
-#ifdef _MSC_VER
-#pragma warning( disable : 4127 ) // warning C4127: conditional expression is constant
-#endif
-            while (true)
-            {
-                if (banList[banListIndex]->IP[characterIndex] == IP[characterIndex])
-                {
-                    // Equal characters
-
-                    if (IP[characterIndex] == 0)
-                    {
-                        banListMutex.Unlock();
-                        // End of the string and the strings match
-
-                        return true;
-                    }
-
-                    characterIndex++;
-                }
-
-                else
-                {
-                    if (banList[banListIndex]->IP[characterIndex] == 0 || IP[characterIndex] == 0)
-                    {
-                        // End of one of the strings
-                        break;
-                    }
-
-                    // Characters do not match
-                    if (banList[banListIndex]->IP[characterIndex] == '*')
-                    {
-                        banListMutex.Unlock();
-
-                        // Domain is banned.
-                        return true;
-                    }
-
-                    // Characters do not match and it is not a *
-                    break;
-                }
-            }
-
-            banListIndex++;
-        }
+        if (banList.Contains(prefixes[i].key, prefixes[i].prefixBits, time))
+            return true;
     }
 
-    banListMutex.Unlock();
-
     // No match found.
     return false;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+bool RakPeer::IsBanned(const SystemAddress &systemAddress)
+{
+    if (banList.Size() == 0)
+        return false;
+
+    unsigned char key[DataStructures::PrefixTrie::MAX_KEY_BYTES];
+    unsigned int keyBits = GetBanKey(systemAddress, key);
+    return banList.Contains(key, keyBits, RakNet::GetTimeMS());
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Description:
 // Send a ping to the specified connected system.
@@ -2384,19 +2465,7 @@ unsigned int RakPeer::GetSystemIndexFromGuid(const RakNetGUID input) const
         remoteSystemList[input.systemIndex].guid == input)
         return input.systemIndex;
 
-    unsigned int i;
-    for (i = 0; i < maximumNumberOfPeers; i++)
-    {
-        if (remoteSystemList[i].guid == input)
-        {
-            // Set the systemIndex so future lookups will be fast
-            remoteSystemList[i].guid.systemIndex = (SystemIndex) i;
-
-            return i;
-        }
-    }
-
-    return (unsigned int) -1;
+    return LookupRemoteSystemIndexByGuid(input);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -2413,17 +2482,9 @@ SystemAddress RakPeer::GetSystemAddressFromGuid(const RakNetGUID input) const
         remoteSystemList[input.systemIndex].guid == input)
         return remoteSystemList[input.systemIndex].systemAddress;
 
-    unsigned int i;
-    for (i = 0; i < maximumNumberOfPeers; i++)
-    {
-        if (remoteSystemList[i].guid == input)
-        {
-            // Set the systemIndex so future lookups will be fast
-            remoteSystemList[i].guid.systemIndex = (SystemIndex) i;
-
-            return remoteSystemList[i].systemAddress;
-        }
-    }
+    unsigned int index = LookupRemoteSystemIndexByGuid(input);
+    if (index != (unsigned int) -1)
+        return remoteSystemList[index].systemAddress;
 
     return UNASSIGNED_SYSTEM_ADDRESS;
 }
@@ -2673,6 +2734,56 @@ void RakPeer::SetUnreliableTimeout(RakNet::TimeMS timeoutMS)
         remoteSystemList[i].reliabilityLayer.SetUnreliableTimeout(unreliableTimeout);
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SetMessageCoalescing(RakNet::TimeUS maxDelayUS, unsigned int maxMessageBytes, uint32_t orderingChannelMask,
+                                   const SystemAddress target)
+{
+    if (target == UNASSIGNED_SYSTEM_ADDRESS)
+    {
+        coalesceMaxDelay = maxDelayUS;
+        coalesceMaxMessageBytes = maxMessageBytes;
+        coalesceOrderingChannelMask = orderingChannelMask;
+
+        for (unsigned i = 0; i < maximumNumberOfPeers; i++)
+        {
+            if (remoteSystemList[i].isActive)
+                remoteSystemList[i].reliabilityLayer.SetMessageCoalescing(maxDelayUS, maxMessageBytes, orderingChannelMask);
+        }
+    }
+    else
+    {
+        RemoteSystemStruct *remoteSystem = GetRemoteSystemFromSystemAddress(target, false, true);
+
+        if (remoteSystem != 0)
+            remoteSystem->reliabilityLayer.SetMessageCoalescing(maxDelayUS, maxMessageBytes, orderingChannelMask);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SetMessageCompression(CompressionInterface *compressor, unsigned int minMessageBytes,
+                                    uint32_t orderingChannelMask, const SystemAddress target)
+{
+    if (target == UNASSIGNED_SYSTEM_ADDRESS)
+    {
+        messageCompressor = compressor;
+        compressMinMessageBytes = minMessageBytes;
+        compressOrderingChannelMask = orderingChannelMask;
+
+        for (unsigned i = 0; i < maximumNumberOfPeers; i++)
+        {
+            if (remoteSystemList[i].isActive)
+                remoteSystemList[i].reliabilityLayer.SetMessageCompression(compressor, minMessageBytes, orderingChannelMask);
+        }
+    }
+    else
+    {
+        RemoteSystemStruct *remoteSystem = GetRemoteSystemFromSystemAddress(target, false, true);
+
+        if (remoteSystem != 0)
+            remoteSystem->reliabilityLayer.SetMessageCompression(compressor, minMessageBytes, orderingChannelMask);
+    }
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Send a message to host, with the IP socket option TTL set to 3
 // This message will not reach the host, but will open the router.
@@ -2729,6 +2840,7 @@ void RakPeer::AttachPlugin(PluginInterface2 *plugin)
             pluginListTS.Insert(plugin, _FILE_AND_LINE_);
         }
     }
+    RebuildPluginDispatchTable();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -2764,10 +2876,31 @@ void RakPeer::DetachPlugin(PluginInterface2 *plugin)
             pluginListTS.RemoveFromEnd();
         }
     }
+    RebuildPluginDispatchTable();
     plugin->OnDetach();
     plugin->SetRakPeerInterface(0);
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::RebuildPluginDispatchTable(void)
+{
+    unsigned int messageId, i;
+    for (messageId = 0; messageId < 256; messageId++)
+    {
+        pluginDispatchTable[messageId].Clear(true, _FILE_AND_LINE_);
+        for (i = 0; i < pluginListTS.Size(); i++)
+        {
+            if (pluginListTS[i]->ReceivesMessageID((MessageID) messageId))
+                pluginDispatchTable[messageId].Insert(pluginListTS[i], _FILE_AND_LINE_);
+        }
+        for (i = 0; i < pluginListNTS.Size(); i++)
+        {
+            if (pluginListNTS[i]->ReceivesMessageID((MessageID) messageId))
+                pluginDispatchTable[messageId].Insert(pluginListNTS[i], _FILE_AND_LINE_);
+        }
+    }
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // Put a packet back at the end of the receive queue in case you don't want to deal with it immediately
 //
@@ -2785,12 +2918,11 @@ void RakPeer::PushBackPacket(Packet *packet, bool pushAtHead)
     for (i = 0; i < pluginListNTS.Size(); i++)
         pluginListNTS[i]->OnPushBackPacket((const char *) packet->data, packet->bitSize, packet->systemAddress);
 
-    packetReturnMutex.Lock();
+    // PushAtHead is only valid from the thread that calls Receive()
     if (pushAtHead)
-        packetReturnQueue.PushAtHead(packet, 0, _FILE_AND_LINE_);
+        packetReturnQueue.PushAtHead(packet);
     else
-        packetReturnQueue.Push(packet, _FILE_AND_LINE_);
-    packetReturnMutex.Unlock();
+        packetReturnQueue.Push(packet);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -3082,6 +3214,16 @@ void RakPeer::GetStatisticsList(DataStructures::List<SystemAddress> &addresses,
     }
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::GetHandshakeStatistics(HandshakeStatistics *stats)
+{
+#ifdef LIBCAT_SECURITY
+    handshakeThread.GetStatistics(stats);
+#else
+    memset(stats, 0, sizeof(HandshakeStatistics));
+#endif
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 bool RakPeer::GetStatistics(const unsigned int index, RakNetStatistics *rns)
 {
@@ -3096,11 +3238,7 @@ bool RakPeer::GetStatistics(const unsigned int index, RakNetStatistics *rns)
 // ---------------------------------------------------------------------------------------------------------------------
 unsigned int RakPeer::GetReceiveBufferSize(void)
 {
-    unsigned int size;
-    packetReturnMutex.Lock();
-    size = packetReturnQueue.Size();
-    packetReturnMutex.Unlock();
-    return size;
+    return packetReturnQueue.Size();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -3116,20 +3254,10 @@ int RakPeer::GetIndexFromSystemAddress(const SystemAddress systemAddress, bool c
 
     if (calledFromNetworkThread)
         return GetRemoteSystemIndex(systemAddress);
-    else
-    {
-        // remoteSystemList in user and network thread
-        for (unsigned i = 0; i < maximumNumberOfPeers; i++)
-            if (remoteSystemList[i].isActive && remoteSystemList[i].systemAddress == systemAddress)
-                return i;
-
-        // If no active results found, try previously active results.
-        for (unsigned i = 0; i < maximumNumberOfPeers; i++)
-            if (remoteSystemList[i].systemAddress == systemAddress)
-                return i;
-    }
 
-    return -1;
+    // remoteSystemList in user and network thread
+    // The index holds the most recent system assigned this address, whether or not it is still active
+    return (int) LookupRemoteSystemIndexByAddress(systemAddress);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -3143,16 +3271,8 @@ int RakPeer::GetIndexFromGuid(const RakNetGUID guid)
         return guid.systemIndex;
 
     // remoteSystemList in user and network thread
-    for (unsigned i = 0; i < maximumNumberOfPeers; i++)
-        if (remoteSystemList[i].isActive && remoteSystemList[i].guid == guid)
-            return i;
-
-    // If no active results found, try previously active results.
-    for (unsigned i = 0; i < maximumNumberOfPeers; i++)
-        if (remoteSystemList[i].guid == guid)
-            return i;
-
-    return -1;
+    // The index holds the most recent system assigned this guid, whether or not it is still active
+    return (int) LookupRemoteSystemIndexByGuid(guid);
 }
 // ---------------------------------------------------------------------------------------------------------------------
 #ifdef LIBCAT_SECURITY
@@ -3376,24 +3496,11 @@ RakPeer::RemoteSystemStruct *RakPeer::GetRemoteSystemFromSystemAddress(const Sys
             }
         }
     }
-    else
-    {
-        int deadConnectionIndex = -1;
-
-        // Active connections take priority.  But if there are no active connections, return the first systemAddress match found
-        for (unsigned i = 0; i < maximumNumberOfPeers; i++)
-        {
-            if (remoteSystemList[i].systemAddress == systemAddress)
-            {
-                if (remoteSystemList[i].isActive)
-                    return remoteSystemList + i;
-                else if (deadConnectionIndex == -1)
-                    deadConnectionIndex = i;
-            }
-        }
-
-        if (deadConnectionIndex != -1 && !onlyActive)
-            return remoteSystemList + deadConnectionIndex;
+    else
+    {
+        unsigned int index = LookupRemoteSystemIndexByAddress(systemAddress);
+        if (index != (unsigned int) -1 && (!onlyActive || remoteSystemList[index].isActive))
+            return remoteSystemList + index;
     }
 
     return 0;
@@ -3404,11 +3511,9 @@ RakPeer::RemoteSystemStruct *RakPeer::GetRemoteSystemFromGUID(const RakNetGUID g
     if (guid == UNASSIGNED_RAKNET_GUID)
         return 0;
 
-    for (unsigned i = 0; i < maximumNumberOfPeers; i++)
-    {
-        if (remoteSystemList[i].guid == guid && (!onlyActive || remoteSystemList[i].isActive))
-            return remoteSystemList + i;
-    }
+    unsigned int index = LookupRemoteSystemIndexByGuid(guid);
+    if (index != (unsigned int) -1 && (!onlyActive || remoteSystemList[index].isActive))
+        return remoteSystemList + index;
     return 0;
 }
 
@@ -3604,16 +3709,27 @@ RakPeer::AssignSystemAddressToRemoteSystemList(const SystemAddress systemAddress
             remoteSystem = remoteSystemList + assignedIndex;
             ReferenceRemoteSystem(systemAddress, assignedIndex);
             remoteSystem->MTUSize = defaultMTUSize;
+            if (remoteSystem->guid != UNASSIGNED_RAKNET_GUID)
+                remoteSystemGuidIndex.RemoveIfValue(remoteSystem->guid.g, assignedIndex);
             remoteSystem->guid = guid;
+            if (guid != UNASSIGNED_RAKNET_GUID)
+                remoteSystemGuidIndex.Set(guid.g, assignedIndex);
             remoteSystem->isActive = true; // This one line causes future incoming packets to go through the reliability layer
             // Reserve this reliability layer for ourselves.
             if (incomingMTU > remoteSystem->MTUSize)
                 remoteSystem->MTUSize = incomingMTU;
             RakAssert(remoteSystem->MTUSize <= MAXIMUM_MTU_SIZE);
             remoteSystem->reliabilityLayer.Reset(true, remoteSystem->MTUSize, useSecurity);
+#ifdef LIBCAT_SECURITY
+            if (useSecurity)
+                anySecureConnections.store(true, std::memory_order_relaxed);
+            remoteSystem->pendingHandshakeId = 0;
+#endif
             remoteSystem->reliabilityLayer.SetSplitMessageProgressInterval(splitMessageProgressInterval);
             remoteSystem->reliabilityLayer.SetUnreliableTimeout(unreliableTimeout);
             remoteSystem->reliabilityLayer.SetTimeoutTime(defaultTimeoutTime);
+            remoteSystem->reliabilityLayer.SetMessageCoalescing(coalesceMaxDelay, coalesceMaxMessageBytes, coalesceOrderingChannelMask);
+            remoteSystem->reliabilityLayer.SetMessageCompression(messageCompressor, compressMinMessageBytes, compressOrderingChannelMask);
             AddToActiveSystemList(assignedIndex);
             if (incomingRakNetSocket->GetBoundAddress() == bindingAddress)
                 remoteSystem->rakNetSocket = incomingRakNetSocket;
@@ -3640,6 +3756,7 @@ RakPeer::AssignSystemAddressToRemoteSystemList(const SystemAddress systemAddress
             remoteSystem->connectionTime = time;
             remoteSystem->myExternalSystemAddress = UNASSIGNED_SYSTEM_ADDRESS;
             remoteSystem->lastReliableSend = time;
+            remoteSystem->banListVersion = 0;
 
 #ifdef _DEBUG
             int indexLoopupCheck = GetIndexFromSystemAddress(systemAddress, true);
@@ -3699,10 +3816,13 @@ void RakPeer::ReferenceRemoteSystem(const SystemAddress &sa, unsigned int remote
         // Remove the reference if the reference is pointing to this inactive system
         if (GetRemoteSystem(oldAddress) == &remoteSystemList[remoteSystemListIndex])
             DereferenceRemoteSystem(oldAddress);
+        // Either way, this slot no longer has the old address
+        remoteSystemAddressIndex.RemoveIfValue(SystemAddressToIndexKey(oldAddress), remoteSystemListIndex);
     }
     DereferenceRemoteSystem(sa);
 
     remoteSystemList[remoteSystemListIndex].systemAddress = sa;
+    remoteSystemAddressIndex.Add(SystemAddressToIndexKey(sa), remoteSystemListIndex);
 
     unsigned int hashIndex = RemoteSystemLookupHashIndex(sa);
     RemoteSystemIndex *rsi = remoteSystemIndexPool.Allocate(_FILE_AND_LINE_);
@@ -3737,6 +3857,7 @@ void RakPeer::DereferenceRemoteSystem(const SystemAddress &sa)
     {
         if (remoteSystemList[cur->index].systemAddress == sa)
         {
+            remoteSystemAddressIndex.RemoveIfValue(SystemAddressToIndexKey(sa), cur->index);
             if (last == 0)
                 remoteSystemLookup[hashIndex] = cur->next;
             else
@@ -3772,12 +3893,47 @@ RakPeer::RemoteSystemStruct *RakPeer::GetRemoteSystem(const SystemAddress &sa) c
     return remoteSystemList + remoteSystemIndex;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+uint64_t RakPeer::SystemAddressToIndexKey(const SystemAddress &sa)
+{
+#if RAKNET_SUPPORT_IPV6 == 1
+    if (sa.address.addr4.sin_family != AF_INET)
+    {
+        // Keys can collide, so remoteSystemAddressIndex keeps every system under its key, and lookups compare the full address
+        uint64_t high = SuperFastHash((const char *) &sa.address.addr6.sin6_addr.s6_addr, sizeof(sa.address.addr6.sin6_addr.s6_addr));
+        return (high << 32) | (uint64_t) SystemAddress::ToInteger(sa);
+    }
+#endif
+    return ((uint64_t) sa.address.addr4.sin_addr.s_addr << 16) | (uint64_t) sa.address.addr4.sin_port;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+unsigned int RakPeer::LookupRemoteSystemIndexByGuid(const RakNetGUID &guid) const
+{
+    unsigned int index;
+    if (remoteSystemGuidIndex.Get(guid.g, index) && index < maximumNumberOfPeers && remoteSystemList[index].guid == guid)
+        return index;
+    return (unsigned int) -1;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+unsigned int RakPeer::LookupRemoteSystemIndexByAddress(const SystemAddress &sa) const
+{
+    unsigned int index;
+    if (remoteSystemAddressIndex.Get(SystemAddressToIndexKey(sa), index, [&](unsigned int candidate)
+        { return candidate < maximumNumberOfPeers && remoteSystemList[candidate].systemAddress == sa; }))
+        return index;
+    return (unsigned int) -1;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::ClearRemoteSystemLookup(void)
 {
     remoteSystemIndexPool.Clear(_FILE_AND_LINE_);
     delete[] remoteSystemLookup;
     remoteSystemLookup = 0;
+    remoteSystemGuidIndex.Clear();
+    remoteSystemAddressIndex.Clear();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -3915,32 +4071,61 @@ void RakPeer::ClearBufferedPackets(void)
         delete bufferedPacketsFreePool.Pop();
     bufferedPacketsFreePoolMutex.Unlock();
 
+    // Reads the rings, which is what the update thread does, so the receive threads may still be writing
+    RNS2RecvStruct *s;
+    for (unsigned int i = 0; i < bufferedPacketRings.Size(); i++)
+    {
+        while (bufferedPacketRings[i]->Pop(&s))
+            delete s;
+    }
+
     bufferedPacketsQueueMutex.Lock();
     while (bufferedPacketsQueue.Size() > 0)
         delete bufferedPacketsQueue.Pop();
+    bufferedPacketsQueueSize = 0;
     bufferedPacketsQueueMutex.Unlock();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::SetupBufferedPackets(void)
 {
+    for (unsigned int i = bufferedPacketRings.Size(); i < socketList.Size(); i++)
+        bufferedPacketRings.Push(new DataStructures::SingleProducerConsumerRing<RNS2RecvStruct*>(BUFFERED_PACKET_RING_SIZE), _FILE_AND_LINE_);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::PushBufferedPacket(RNS2RecvStruct *p)
 {
+    // socketList does not change while the receive threads run
+    if (bufferedPacketsQueueSize.load(std::memory_order_acquire) == 0)
+    {
+        for (unsigned int i = 0; i < socketList.Size() && i < bufferedPacketRings.Size(); i++)
+        {
+            if (socketList[i] == p->socket)
+            {
+                if (bufferedPacketRings[i]->Push(p))
+                    return;
+                break;
+            }
+        }
+    }
+
     bufferedPacketsQueueMutex.Lock();
     bufferedPacketsQueue.Push(p, _FILE_AND_LINE_);
+    bufferedPacketsQueueSize.store(bufferedPacketsQueue.Size(), std::memory_order_release);
     bufferedPacketsQueueMutex.Unlock();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 RNS2RecvStruct *RakPeer::PopBufferedPacket(void)
 {
+    if (bufferedPacketsQueueSize.load(std::memory_order_acquire) == 0)
+        return 0;
     bufferedPacketsQueueMutex.Lock();
     if (bufferedPacketsQueue.Size() > 0)
     {
         RNS2RecvStruct *s = bufferedPacketsQueue.Pop();
+        bufferedPacketsQueueSize.store(bufferedPacketsQueue.Size(), std::memory_order_release);
         bufferedPacketsQueueMutex.Unlock();
         return s;
     }
@@ -3948,6 +4133,19 @@ RNS2RecvStruct *RakPeer::PopBufferedPacket(void)
     return 0;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::ProcessBufferedPacket(RNS2RecvStruct *recvFromStruct, BitStream &updateBitStream)
+{
+#ifdef LIBCAT_SECURITY
+    unsigned int decryptedEpoch = recvFromStruct->decryptedEpoch;
+#else
+    unsigned int decryptedEpoch = 0;
+#endif
+    ProcessNetworkPacket(recvFromStruct->systemAddress, recvFromStruct->data, recvFromStruct->bytesRead, this,
+                         recvFromStruct->socket, recvFromStruct->timeRead, updateBitStream, decryptedEpoch);
+    DeallocRNS2RecvStruct(recvFromStruct, _FILE_AND_LINE_);
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 void RakPeer::PingInternal(const SystemAddress target, bool performImmediate, PacketReliability reliability)
 {
@@ -4003,6 +4201,7 @@ void RakPeer::CloseConnectionInternal(const AddressOrGUID &systemIdentifier, boo
                     // printf("--- Address %s has become inactive\n", remoteSystemList[index].systemAddress.ToString());
                     remoteSystemList[index].isActive = false;
 
+                    remoteSystemGuidIndex.RemoveIfValue(remoteSystemList[index].guid.g, index);
                     remoteSystemList[index].guid = UNASSIGNED_RAKNET_GUID;
 
                     // Reserve this reliability layer for ourselves
@@ -4127,6 +4326,59 @@ void RakPeer::SendBufferedList(const char **data, const int *lengths, const int
         quitAndDataEvents.SetEvent(); // Forces pending sends to go out now, rather than waiting to the next update interval
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::SendBufferedToSystems(const char *data, BitSize_t numberOfBitsToSend, PacketPriority priority,
+                                    PacketReliability reliability, char orderingChannel,
+                                    const DataStructures::List<RakNetGUID> &systemIdentifiers, uint32_t receipt)
+{
+    RakNetGUID *targetGuids = (RakNetGUID *) malloc(sizeof(RakNetGUID) * systemIdentifiers.Size());
+    if (targetGuids == 0)
+    {
+        RakAssert(0)
+        return;
+    }
+    unsigned int targetGuidsCount = 0;
+    for (unsigned int i = 0; i < systemIdentifiers.Size(); i++)
+    {
+        if (systemIdentifiers[i] == myGuid)
+            SendLoopback(data, (int) BITS_TO_BYTES(numberOfBitsToSend));
+        else if (systemIdentifiers[i] != UNASSIGNED_RAKNET_GUID)
+            targetGuids[targetGuidsCount++] = systemIdentifiers[i];
+    }
+    if (targetGuidsCount == 0)
+    {
+        free(targetGuids);
+        return;
+    }
+
+    BufferedCommandStruct *bcs = bufferedCommands.Allocate(_FILE_AND_LINE_);
+    // One copy for all systems. The reliability layer of the last system takes ownership of it
+    bcs->data = (char *) malloc((size_t) BITS_TO_BYTES(numberOfBitsToSend));
+    if (bcs->data == 0)
+    {
+        RakAssert(0)
+        free(targetGuids);
+        bufferedCommands.Deallocate(bcs, _FILE_AND_LINE_);
+        return;
+    }
+    memcpy(bcs->data, data, (size_t) BITS_TO_BYTES(numberOfBitsToSend));
+    bcs->numberOfBitsToSend = numberOfBitsToSend;
+    bcs->priority = priority;
+    bcs->reliability = reliability;
+    bcs->orderingChannel = orderingChannel;
+    bcs->systemIdentifier = UNASSIGNED_RAKNET_GUID;
+    bcs->broadcast = false;
+    bcs->connectionMode = RemoteSystemStruct::NO_ACTION;
+    bcs->receipt = receipt;
+    bcs->targetGuids = targetGuids;
+    bcs->targetGuidsCount = targetGuidsCount;
+    bcs->command = BufferedCommandStruct::BCS_SEND_TO_SYSTEMS;
+    bufferedCommands.Push(bcs);
+
+    if (priority == IMMEDIATE_PRIORITY)
+        quitAndDataEvents.SetEvent(); // Forces pending sends to go out now, rather than waiting to the next update interval
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 bool RakPeer::SendImmediate(char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability,
                             char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast,
@@ -4266,6 +4518,8 @@ void RakPeer::ClearBufferedCommands(void)
     {
         if (bcs->data)
             free(bcs->data);
+        if (bcs->command == BufferedCommandStruct::BCS_SEND_TO_SYSTEMS)
+            free(bcs->targetGuids);
 
         bufferedCommands.Deallocate(bcs, _FILE_AND_LINE_);
     }
@@ -4300,9 +4554,7 @@ void RakPeer::ClearRequestedConnectionList(void)
 
 inline void RakPeer::AddPacketToProducer(RakNet::Packet *p)
 {
-    packetReturnMutex.Lock();
-    packetReturnQueue.Push(p, _FILE_AND_LINE_);
-    packetReturnMutex.Unlock();
+    packetReturnQueue.Push(p);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -4311,6 +4563,71 @@ void RakPeer::GenerateGUID(void)
     myGuid.g = Get64BitUniqueRandomNumber();
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::GenerateConnectionCookieSecret(void)
+{
+    // Hash whatever is hard to guess. Where /dev/urandom exists, it is enough on its own.
+    CSHA1 sha1;
+    sha1.Reset();
+    RakNet::TimeUS time = RakNet::GetTimeUS();
+    sha1.Update((unsigned char *) &time, sizeof(time));
+    sha1.Update((unsigned char *) &myGuid.g, sizeof(myGuid.g));
+    RakPeer *self = this;
+    sha1.Update((unsigned char *) &self, sizeof(self));
+    uint64_t unique = Get64BitUniqueRandomNumber();
+    sha1.Update((unsigned char *) &unique, sizeof(unique));
+#if !defined(_WIN32)
+    FILE *fp = fopen("/dev/urandom", "rb");
+    if (fp)
+    {
+        unsigned char random[32];
+        if (fread(random, 1, sizeof(random), fp) == sizeof(random))
+            sha1.Update(random, sizeof(random));
+        fclose(fp);
+    }
+#endif
+    sha1.Final();
+    memcpy(connectionCookieSecret, sha1.GetHash(), sizeof(connectionCookieSecret));
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+uint32_t RakPeer::GenerateConnectionCookie(const SystemAddress &systemAddress, RakNet::TimeMS time) const
+{
+    // HMAC of the time period and the address, keyed with the secret
+    unsigned char data[sizeof(uint32_t) + sizeof(unsigned short) + 16];
+    uint32_t period = time / CONNECTION_COOKIE_PERIOD_MS;
+    unsigned short port = systemAddress.GetPort();
+    memcpy(data, &period, sizeof(period));
+    memcpy(data + sizeof(period), &port, sizeof(port));
+    int dataLength = sizeof(period) + sizeof(port);
+#if RAKNET_SUPPORT_IPV6==1
+    if (systemAddress.address.addr4.sin_family == AF_INET6)
+    {
+        memcpy(data + dataLength, systemAddress.address.addr6.sin6_addr.s6_addr, 16);
+        dataLength += 16;
+    }
+    else
+#endif
+    {
+        memcpy(data + dataLength, &systemAddress.address.addr4.sin_addr.s_addr, 4);
+        dataLength += 4;
+    }
+
+    unsigned char hmac[SHA1_LENGTH];
+    CSHA1::HMAC((unsigned char *) connectionCookieSecret, sizeof(connectionCookieSecret), data, dataLength, hmac);
+    uint32_t cookie;
+    memcpy(&cookie, hmac, sizeof(cookie));
+    return cookie;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool RakPeer::VerifyConnectionCookie(const SystemAddress &systemAddress, uint32_t cookie, RakNet::TimeMS time) const
+{
+    // Cookies from the previous period are also accepted, so a cookie is good for at least one full period
+    return cookie == GenerateConnectionCookie(systemAddress, time) ||
+           cookie == GenerateConnectionCookie(systemAddress, time - CONNECTION_COOKIE_PERIOD_MS);
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 // void RakNet::ProcessPortUnreachable( SystemAddress systemAddress, RakPeer *rakPeer )
 // {
@@ -4322,6 +4639,56 @@ void RakPeer::GenerateGUID(void)
 // ---------------------------------------------------------------------------------------------------------------------
 namespace RakNet
 {
+    // True if the datagram is an offline message rather than a datagram from the reliability layer
+    static bool IsOfflineMessage(const char *data, unsigned int length)
+    {
+        // The reason for all this is that the reliability layer has no way to tell between offline messages that arrived late for a player that is now connected,
+        // and a regular encoding. So I insert OFFLINE_MESSAGE_DATA_ID into the stream, the encoding of which is essentially impossible to hit by chance
+        if (length <= 2)
+            return true;
+        // The reliability layer writes the isValid bit first, so its datagrams start with the high bit set. No offline message ID does.
+        if ((unsigned char) data[0] & 0x80)
+            return false;
+        if (((unsigned char) data[0] == ID_UNCONNECTED_PING || (unsigned char) data[0] == ID_UNCONNECTED_PING_OPEN_CONNECTIONS) &&
+            length >= sizeof(unsigned char) + sizeof(RakNet::Time) + sizeof(OFFLINE_MESSAGE_DATA_ID))
+        {
+            return memcmp(data + sizeof(unsigned char) + sizeof(RakNet::Time), OFFLINE_MESSAGE_DATA_ID,
+                          sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
+        }
+        if ((unsigned char) data[0] == ID_UNCONNECTED_PONG && (size_t) length >=
+                                                              sizeof(unsigned char) + sizeof(RakNet::TimeMS) +
+                                                              RakNetGUID::size() + sizeof(OFFLINE_MESSAGE_DATA_ID))
+        {
+            return memcmp(data + sizeof(unsigned char) + sizeof(RakNet::Time) + RakNetGUID::size(),
+                          OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
+        }
+        if ((unsigned char) data[0] == ID_OUT_OF_BAND_INTERNAL &&
+            (size_t) length >= sizeof(MessageID) + RakNetGUID::size() + sizeof(OFFLINE_MESSAGE_DATA_ID))
+        {
+            return memcmp(data + sizeof(MessageID) + RakNetGUID::size(), OFFLINE_MESSAGE_DATA_ID,
+                          sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
+        }
+        if (((unsigned char) data[0] == ID_OPEN_CONNECTION_REPLY_1 ||
+             (unsigned char) data[0] == ID_OPEN_CONNECTION_REPLY_2 ||
+             (unsigned char) data[0] == ID_OPEN_CONNECTION_REQUEST_1 ||
+             (unsigned char) data[0] == ID_OPEN_CONNECTION_REQUEST_2 ||
+             (unsigned char) data[0] == ID_CONNECTION_ATTEMPT_FAILED ||
+             (unsigned char) data[0] == ID_NO_FREE_INCOMING_CONNECTIONS ||
+             (unsigned char) data[0] == ID_CONNECTION_BANNED ||
+             (unsigned char) data[0] == ID_ALREADY_CONNECTED ||
+             (unsigned char) data[0] == ID_IP_RECENTLY_CONNECTED) &&
+            (size_t) length >= sizeof(MessageID) + RakNetGUID::size() + sizeof(OFFLINE_MESSAGE_DATA_ID))
+        {
+            return memcmp(data + sizeof(MessageID), OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
+        }
+        if ((unsigned char) data[0] == ID_INCOMPATIBLE_PROTOCOL_VERSION &&
+            (size_t) length == sizeof(MessageID) * 2 + RakNetGUID::size() + sizeof(OFFLINE_MESSAGE_DATA_ID))
+        {
+            return memcmp(data + sizeof(MessageID) * 2, OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
+        }
+        return false;
+    }
+
     bool ProcessOfflineNetworkPacket(SystemAddress systemAddress, const char *data, unsigned int length, RakPeer *rakPeer,
                                      RakNetSocket2 *rakNetSocket, bool *isOfflineMessage, RakNet::TimeUS timeRead)
     {
@@ -4329,9 +4696,7 @@ namespace RakNet
         RakPeer::RemoteSystemStruct *remoteSystem;
         RakNet::Packet *packet;
 
-        char str1[64];
-        systemAddress.ToString(false, str1);
-        if (rakPeer->IsBanned(str1))
+        if (rakPeer->IsBanned(systemAddress))
         {
             for (unsigned i = 0; i < rakPeer->pluginListNTS.Size(); i++)
                 rakPeer->pluginListNTS[i]->OnDirectSocketReceive(data, length * 8, systemAddress);
@@ -4362,49 +4727,7 @@ namespace RakNet
 
 
 
-        // The reason for all this is that the reliability layer has no way to tell between offline messages that arrived late for a player that is now connected,
-        // and a regular encoding. So I insert OFFLINE_MESSAGE_DATA_ID into the stream, the encoding of which is essentially impossible to hit by chance
-        if (length <= 2)
-            *isOfflineMessage = true;
-        else if (((unsigned char) data[0] == ID_UNCONNECTED_PING || (unsigned char) data[0] == ID_UNCONNECTED_PING_OPEN_CONNECTIONS) &&
-                length >= sizeof(unsigned char) + sizeof(RakNet::Time) + sizeof(OFFLINE_MESSAGE_DATA_ID))
-        {
-            *isOfflineMessage = memcmp(data + sizeof(unsigned char) + sizeof(RakNet::Time), OFFLINE_MESSAGE_DATA_ID,
-                                       sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
-        }
-        else if ((unsigned char) data[0] == ID_UNCONNECTED_PONG && (size_t) length >=
-                                                                   sizeof(unsigned char) + sizeof(RakNet::TimeMS) +
-                                                                   RakNetGUID::size() + sizeof(OFFLINE_MESSAGE_DATA_ID))
-        {
-            *isOfflineMessage = memcmp(data + sizeof(unsigned char) + sizeof(RakNet::Time) + RakNetGUID::size(),
-                                       OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
-        }
-        else if ((unsigned char) data[0] == ID_OUT_OF_BAND_INTERNAL &&
-                (size_t) length >= sizeof(MessageID) + RakNetGUID::size() + sizeof(OFFLINE_MESSAGE_DATA_ID))
-        {
-            *isOfflineMessage = memcmp(data + sizeof(MessageID) + RakNetGUID::size(), OFFLINE_MESSAGE_DATA_ID,
-                                       sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
-        }
-        else if (((unsigned char) data[0] == ID_OPEN_CONNECTION_REPLY_1 ||
-                  (unsigned char) data[0] == ID_OPEN_CONNECTION_REPLY_2 ||
-                  (unsigned char) data[0] == ID_OPEN_CONNECTION_REQUEST_1 ||
-                  (unsigned char) data[0] == ID_OPEN_CONNECTION_REQUEST_2 ||
-                  (unsigned char) data[0] == ID_CONNECTION_ATTEMPT_FAILED ||
-                  (unsigned char) data[0] == ID_NO_FREE_INCOMING_CONNECTIONS ||
-                  (unsigned char) data[0] == ID_CONNECTION_BANNED ||
-                  (unsigned char) data[0] == ID_ALREADY_CONNECTED ||
-                  (unsigned char) data[0] == ID_IP_RECENTLY_CONNECTED) &&
-                 (size_t) length >= sizeof(MessageID) + RakNetGUID::size() + sizeof(OFFLINE_MESSAGE_DATA_ID))
-        {
-            *isOfflineMessage = memcmp(data + sizeof(MessageID), OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
-        }
-        else if (((unsigned char) data[0] == ID_INCOMPATIBLE_PROTOCOL_VERSION &&
-                  (size_t) length == sizeof(MessageID) * 2 + RakNetGUID::size() + sizeof(OFFLINE_MESSAGE_DATA_ID)))
-        {
-            *isOfflineMessage = memcmp(data + sizeof(MessageID) * 2, OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID)) == 0;
-        }
-        else
-            *isOfflineMessage = false;
+        *isOfflineMessage = IsOfflineMessage(data, length);
 
         if (*isOfflineMessage)
         {
@@ -4533,6 +4856,8 @@ namespace RakNet
                 bsIn.IgnoreBytes(sizeof(OFFLINE_MESSAGE_DATA_ID));
                 RakNetGUID serverGuid;
                 bsIn.Read(serverGuid);
+                uint32_t connectionCookie;
+                bsIn.Read(connectionCookie);
                 unsigned char serverHasSecurity;
                 uint32_t cookie;
                 (void) cookie;
@@ -4545,6 +4870,7 @@ namespace RakNet
                 bsOut.Write((MessageID) ID_OPEN_CONNECTION_REQUEST_2);
                 bsOut.WriteAlignedBytes((const unsigned char *) OFFLINE_MESSAGE_DATA_ID,
                                         sizeof(OFFLINE_MESSAGE_DATA_ID));
+                bsOut.Write(connectionCookie);
                 if (serverHasSecurity)
                     bsOut.Write(cookie);
 
@@ -4924,6 +5250,7 @@ namespace RakNet
                 bsOut.Write((MessageID) ID_OPEN_CONNECTION_REPLY_1);
                 bsOut.WriteAlignedBytes((const unsigned char *) OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID));
                 bsOut.Write(rakPeer->GetGuidFromSystemAddress(UNASSIGNED_SYSTEM_ADDRESS));
+                bsOut.Write(rakPeer->GenerateConnectionCookie(systemAddress, RakNet::GetTimeMS()));
 #ifdef LIBCAT_SECURITY
                 if (rakPeer->_using_security)
                 {
@@ -4963,6 +5290,12 @@ namespace RakNet
                 bs.IgnoreBytes(sizeof(MessageID));
                 bs.IgnoreBytes(sizeof(OFFLINE_MESSAGE_DATA_ID));
 
+                // Drop requests that do not echo the cookie sent to this address, before anything is looked up or allocated
+                uint32_t connectionCookie;
+                if (bs.Read(connectionCookie) == false ||
+                    rakPeer->VerifyConnectionCookie(systemAddress, connectionCookie, RakNet::GetTimeMS()) == false)
+                    return true;
+
                 bool requiresSecurityOfThisClient = false;
 #ifdef LIBCAT_SECURITY
                 char remoteHandshakeChallenge[cat::EasyHandshake::CHALLENGE_BYTES];
@@ -5053,6 +5386,10 @@ namespace RakNet
                     // Duplicate connection request packet from packetloss
                     // Send back the same answer
 #ifdef LIBCAT_SECURITY
+                    // The answer is sent when the handshake finishes
+                    if (rssFromSA->pendingHandshakeId != 0)
+                        return true;
+
                     if (requiresSecurityOfThisClient)
                     {
                         CAT_AUDIT_PRINTF(
@@ -5144,23 +5481,17 @@ namespace RakNet
 #ifdef LIBCAT_SECURITY
                 if (requiresSecurityOfThisClient)
                 {
-                    CAT_AUDIT_PRINTF("AUDIT: Writing public key.  Sending ID_OPEN_CONNECTION_REPLY_2\n");
-                    if (rakPeer->_server_handshake->ProcessChallenge(remoteHandshakeChallenge, rssFromSA->answer,
-                                                                     rssFromSA->reliabilityLayer.GetAuthenticatedEncryption()))
-                    {
-                        CAT_AUDIT_PRINTF("AUDIT: Challenge good!\n");
-                        // Keep going to OK block
-                    }
-                    else
-                    {
-                        CAT_AUDIT_PRINTF("AUDIT: Challenge BAD!\n");
-
-                        // Unassign this remote system
-                        rakPeer->DereferenceRemoteSystem(systemAddress);
-                        return true;
-                    }
-
-                    bsAnswer.WriteAlignedBytes((const unsigned char *) rssFromSA->answer, sizeof(rssFromSA->answer));
+                    // The key agreement takes much longer than anything else here, so a worker does it, and OnHandshakeFinished() sends the answer
+                    CAT_AUDIT_PRINTF("AUDIT: Queueing challenge for a handshake worker\n");
+                    HandshakeThread::Job *job = rakPeer->handshakeThread.AllocateJob();
+                    job->systemAddress = systemAddress;
+                    job->mtu = mtu;
+                    memcpy(job->challenge, remoteHandshakeChallenge, sizeof(job->challenge));
+                    if (++rakPeer->nextHandshakeId == 0)
+                        rakPeer->nextHandshakeId = 1;
+                    job->id = rssFromSA->pendingHandshakeId = rakPeer->nextHandshakeId;
+                    rakPeer->handshakeThread.ProcessJob(job);
+                    return true;
                 }
 #endif // LIBCAT_SECURITY
                 for (unsigned i = 0; i < rakPeer->pluginListNTS.Size(); i++)
@@ -5182,11 +5513,12 @@ namespace RakNet
     void ProcessNetworkPacket(SystemAddress systemAddress, const char *data, unsigned int length, RakPeer *rakPeer,
                               RakNet::TimeUS timeRead, BitStream &updateBitStream)
     {
-        ProcessNetworkPacket(systemAddress, data, length, rakPeer, rakPeer->socketList[0], timeRead, updateBitStream);
+        ProcessNetworkPacket(systemAddress, data, length, rakPeer, rakPeer->socketList[0], timeRead, updateBitStream, 0);
     }
 
     void ProcessNetworkPacket(SystemAddress systemAddress, const char *data, unsigned int length, RakPeer *rakPeer,
-                              RakNetSocket2 *rakNetSocket, RakNet::TimeUS timeRead, BitStream &updateBitStream)
+                              RakNetSocket2 *rakNetSocket, RakNet::TimeUS timeRead, BitStream &updateBitStream,
+                              unsigned int decryptedEpoch)
     {
 #ifdef LIBCAT_SECURITY
 #ifdef CAT_AUDIT
@@ -5198,19 +5530,39 @@ namespace RakNet
 #endif // LIBCAT_SECURITY
 
         RakAssert(systemAddress.GetPort());
+
+        // Fast path for datagrams from connected systems that were already checked against the current ban list
+        // Skips IsBanned() and offline message handling, which used to be paid by every datagram
+        RakPeer::RemoteSystemStruct *remoteSystem = rakPeer->GetRemoteSystemFromSystemAddress(systemAddress, true, true);
+        // Datagrams decrypted on a receive thread were not offline messages
+        if (remoteSystem && remoteSystem->banListVersion == rakPeer->banList.GetAddCount() &&
+            (decryptedEpoch != 0 || IsOfflineMessage(data, length) == false))
+        {
+            remoteSystem->reliabilityLayer.HandleSocketReceiveFromConnectedPlayer(data, length, systemAddress,
+                                                                                  rakPeer->pluginListNTS, remoteSystem->MTUSize,
+                                                                                  rakNetSocket, &rnr, timeRead, updateBitStream,
+                                                                                  decryptedEpoch);
+            return;
+        }
+
+        // Read before the ban check, so a ban added during the check forces another one
+        unsigned int banListVersion = rakPeer->banList.GetAddCount();
         bool isOfflineMessage;
         if (ProcessOfflineNetworkPacket(systemAddress, data, length, rakPeer, rakNetSocket, &isOfflineMessage, timeRead))
             return;
 
         // See if this datagram came from a connected system
-        RakPeer::RemoteSystemStruct *remoteSystem = rakPeer->GetRemoteSystemFromSystemAddress(systemAddress, true, true);
+        remoteSystem = rakPeer->GetRemoteSystemFromSystemAddress(systemAddress, true, true);
         if (remoteSystem && !isOfflineMessage)
         {
+            // ProcessOfflineNetworkPacket() returns true for banned systems, so this one is not banned
+            remoteSystem->banListVersion = banListVersion;
             // Handle regular incoming data
             // HandleSocketReceiveFromConnectedPlayer is only safe to be called from the same thread as Update, which is this thread
             remoteSystem->reliabilityLayer.HandleSocketReceiveFromConnectedPlayer(data, length, systemAddress,
                                                                                   rakPeer->pluginListNTS, remoteSystem->MTUSize,
-                                                                                  rakNetSocket, &rnr, timeRead, updateBitStream);
+                                                                                  rakNetSocket, &rnr, timeRead, updateBitStream,
+                                                                                  decryptedEpoch);
         }
     }
 
@@ -5247,6 +5599,16 @@ void RakPeer::DerefAllSockets(void)
         delete socketList[i];
     }
     socketList.Clear(false, _FILE_AND_LINE_);
+
+    // Their receive threads stopped with them
+    RNS2RecvStruct *s;
+    for (i = 0; i < bufferedPacketRings.Size(); i++)
+    {
+        while (bufferedPacketRings[i]->Pop(&s))
+            delete s;
+        delete bufferedPacketRings[i];
+    }
+    bufferedPacketRings.Clear(false, _FILE_AND_LINE_);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -5335,28 +5697,38 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
         do {
             len = ((RNS2_Windows*)socketList[0])->GetSocketLayerOverride()->RakNetRecvFrom(dataOut,&sender,true);
             if (len>0)
-                ProcessNetworkPacket( sender, dataOut, len, this, socketList[0], RakNet::GetTimeUS(), updateBitStream );
+                ProcessNetworkPacket( sender, dataOut, len, this, socketList[0], RakNet::GetTimeUS(), updateBitStream, 0 );
         } while (len>0);
     }
 #endif
 
-//    unsigned int socketListIndex;
-    RNS2RecvStruct *recvFromStruct;
-    while ((recvFromStruct = PopBufferedPacket()) != 0)
+    // Read before the rings. If anything overflowed, the rings are not written again until it was all read,
+    // so what overflowed follows what is in the rings now.
+    bool overflowed = bufferedPacketsQueueSize.load(std::memory_order_acquire) > 0;
+    RNS2RecvStruct **recvFromStructs;
+    unsigned int recvFromStructCount;
+    for (unsigned int ringIndex = 0; ringIndex < bufferedPacketRings.Size(); ringIndex++)
     {
-        /*
-        for (socketListIndex=0; socketListIndex < socketList.Size(); socketListIndex++)
+        recvFromStructCount = BUFFERED_PACKET_RING_SIZE;
+        while ((recvFromStructs = bufferedPacketRings[ringIndex]->ReadLock(&recvFromStructCount)) != 0)
         {
-            if ((RakNetSocket*) socketList[socketListIndex]==recvFromStruct->s)
-                break;
+            for (unsigned int i = 0; i < recvFromStructCount; i++)
+                ProcessBufferedPacket(recvFromStructs[i], updateBitStream);
+            bufferedPacketRings[ringIndex]->ReadUnlock(recvFromStructCount);
+            recvFromStructCount = BUFFERED_PACKET_RING_SIZE;
         }
-        if (socketListIndex!=socketList.Size())
-        */
-        ProcessNetworkPacket(recvFromStruct->systemAddress, recvFromStruct->data, recvFromStruct->bytesRead, this,
-                             recvFromStruct->socket, recvFromStruct->timeRead, updateBitStream);
-        DeallocRNS2RecvStruct(recvFromStruct, _FILE_AND_LINE_);
     }
 
+    RNS2RecvStruct *recvFromStruct;
+    while (overflowed && (recvFromStruct = PopBufferedPacket()) != 0)
+        ProcessBufferedPacket(recvFromStruct, updateBitStream);
+
+#ifdef LIBCAT_SECURITY
+    HandshakeThread::Job *handshakeJob;
+    while ((handshakeJob = handshakeThread.GetFinishedJob()) != 0)
+        OnHandshakeFinished(handshakeJob);
+#endif
+
     BufferedCommandStruct *bcs;
     while ((bcs = bufferedCommands.PopInaccurate()) != 0)
     {
@@ -5383,6 +5755,27 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                     remoteSystem->connectMode = bcs->connectionMode;
             }
         }
+        else if (bcs->command == BufferedCommandStruct::BCS_SEND_TO_SYSTEMS)
+        {
+            if (timeNS == 0)
+            {
+                timeNS = RakNet::GetTimeUS();
+                timeMS = (RakNet::TimeMS) (timeNS / (RakNet::TimeUS) 1000);
+            }
+
+            // Each reliability layer copies the data, except the last one which takes ours
+            callerDataAllocationUsed = false;
+            for (unsigned int i = 0; i < bcs->targetGuidsCount; i++)
+            {
+                if (SendImmediate((char *) bcs->data, bcs->numberOfBitsToSend, bcs->priority, bcs->reliability,
+                                  bcs->orderingChannel, bcs->targetGuids[i], false, i + 1 == bcs->targetGuidsCount,
+                                  timeNS, bcs->receipt))
+                    callerDataAllocationUsed = true;
+            }
+            if (!callerDataAllocationUsed)
+                free(bcs->data);
+            free(bcs->targetGuids);
+        }
         else if (bcs->command == BufferedCommandStruct::BCS_CLOSE_CONNECTION)
             CloseConnectionInternal(bcs->systemIdentifier, false, true, bcs->orderingChannel, bcs->priority);
         else if (bcs->command == BufferedCommandStruct::BCS_CHANGE_SYSTEM_ADDRESS)
@@ -5559,6 +5952,9 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
         requestedConnectionQueueMutex.Unlock();
     }
 
+    // Only locks when a temporary ban expired
+    banList.RemoveExpired(RakNet::GetTimeMS());
+
     // remoteSystemList in network thread
     for (unsigned activeSystemListIndex = 0; activeSystemListIndex < activeSystemListSize; ++activeSystemListIndex)
         //for ( remoteSystemIndex = 0; remoteSystemIndex < remoteSystemListSize; ++remoteSystemIndex )
@@ -5696,7 +6092,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                 if ((data)[0] == ID_CONNECTION_REQUEST)
                 {
                     ParseConnectionRequestPacket(remoteSystem, systemAddress, (const char *) data, byteSize);
-                    free(data);
+                    packetAllocationPool.ReleaseData(data);
                 }
                 else
                 {
@@ -5709,7 +6105,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                     systemAddress.ToString(false, str1);
                     AddToBanList(str1, remoteSystem->reliabilityLayer.GetTimeoutTime());
 
-                    free(data);
+                    packetAllocationPool.ReleaseData(data);
                 }
             }
             else
@@ -5736,7 +6132,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                         // This can happen due to race conditions with the fully connected mesh
                         OnConnectionRequest(remoteSystem, incomingTimestamp);
                     }
-                    free(data);
+                    packetAllocationPool.ReleaseData(data);
                 }
                 else if (data[0] == ID_NEW_INCOMING_CONNECTION && byteSize > sizeof(unsigned char) + sizeof(unsigned int) +
                                                                              sizeof(unsigned short) + sizeof(RakNet::Time) * 2)
@@ -5811,7 +6207,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
 
                     OnConnectedPong(sendPingTime, sendPongTime, remoteSystem);
 
-                    free(data);
+                    packetAllocationPool.ReleaseData(data);
                 }
                 else if (data[0] == ID_CONNECTED_PING && byteSize == sizeof(unsigned char) + sizeof(RakNet::Time))
                 {
@@ -5830,20 +6226,20 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                     // Update again immediately after this tick so the ping goes out right away
                     quitAndDataEvents.SetEvent();
 
-                    free(data);
+                    packetAllocationPool.ReleaseData(data);
                 }
                 else if (data[0] == ID_DISCONNECTION_NOTIFICATION)
                 {
                     // We shouldn't close the connection immediately because we need to ack the ID_DISCONNECTION_NOTIFICATION
                     remoteSystem->connectMode = RemoteSystemStruct::DISCONNECT_ON_NO_ACK;
-                    free(data);
+                    packetAllocationPool.ReleaseData(data);
 
                     //    AddPacketToProducer(packet);
                 }
                 else if ((data)[0] == ID_DETECT_LOST_CONNECTIONS && byteSize == sizeof(unsigned char))
                 {
                     // Do nothing
-                    free(data);
+                    packetAllocationPool.ReleaseData(data);
                 }
                 else if ((data)[0] == ID_INVALID_PASSWORD)
                 {
@@ -5861,7 +6257,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                     }
                     else
                     {
-                        free(data);
+                        packetAllocationPool.ReleaseData(data);
                     }
                 }
                 else if ((unsigned char) (data)[0] == ID_CONNECTION_REQUEST_ACCEPTED)
@@ -5943,13 +6339,13 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                                 PingInternal(systemAddress, true, UNRELIABLE);
                         }
                         else
-                            free(data); // Ignore, already connected
+                            packetAllocationPool.ReleaseData(data); // Ignore, already connected
                     }
                     else
                     {
                         // Version mismatch error?
                         RakAssert(0);
-                        free(data);
+                        packetAllocationPool.ReleaseData(data);
                     }
                 }
                 else
@@ -5969,7 +6365,7 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
                         AddPacketToProducer(packet);
                     }
                     else
-                        free(data);
+                        packetAllocationPool.ReleaseData(data);
                 }
             }
 
@@ -5988,12 +6384,105 @@ bool RakPeer::RunUpdateCycle(BitStream &updateBitStream)
 void RakPeer::OnRNS2Recv(RNS2RecvStruct *recvStruct)
 {
     if (incomingDatagramEventHandler && !incomingDatagramEventHandler(recvStruct))
+    {
+        DeallocRNS2RecvStruct(recvStruct, _FILE_AND_LINE_);
+        return;
+    }
+
+#ifdef LIBCAT_SECURITY
+    if (DecryptOnRecvThread(recvStruct) == false)
+    {
+        DeallocRNS2RecvStruct(recvStruct, _FILE_AND_LINE_);
         return;
+    }
+#endif
 
     PushBufferedPacket(recvStruct);
     quitAndDataEvents.SetEvent();
 }
 
+#ifdef LIBCAT_SECURITY
+// ---------------------------------------------------------------------------------------------------------------------
+bool RakPeer::DecryptOnRecvThread(RNS2RecvStruct *recvStruct)
+{
+    recvStruct->decryptedEpoch = 0;
+    if (anySecureConnections.load(std::memory_order_relaxed) == false)
+        return true;
+
+    // Offline messages are not encrypted, even from connected systems. Short ones are left for the update thread to report.
+    if (recvStruct->bytesRead <= (int) cat::AuthenticatedEncryption::OVERHEAD_BYTES ||
+        IsOfflineMessage(recvStruct->data, recvStruct->bytesRead))
+        return true;
+
+    // Best effort, since this is not the update thread. The reliability layer only decrypts once it has keys.
+    unsigned int index = LookupRemoteSystemIndexByAddress(recvStruct->systemAddress);
+    if (index == (unsigned int) -1)
+        return true;
+
+    unsigned int length = (unsigned int) recvStruct->bytesRead;
+    switch (remoteSystemList[index].reliabilityLayer.DecryptOnRecvThread(recvStruct->data, &length, &recvStruct->decryptedEpoch))
+    {
+    case ReliabilityLayer::RTD_DECRYPTED:
+        recvStruct->bytesRead = (int) length;
+        return true;
+    case ReliabilityLayer::RTD_INVALID:
+        recvStruct->decryptedEpoch = 0;
+        return false;
+    default:
+        recvStruct->decryptedEpoch = 0;
+        return true;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void RakPeer::OnHandshakeFinished(HandshakeThread::Job *job)
+{
+    // The connection may have timed out, or been replaced, while the job was queued
+    RemoteSystemStruct *remoteSystem = GetRemoteSystemFromSystemAddress(job->systemAddress, true, true);
+    if (remoteSystem == 0 || remoteSystem->pendingHandshakeId != job->id ||
+        remoteSystem->connectMode != RemoteSystemStruct::UNVERIFIED_SENDER)
+    {
+        handshakeThread.DeallocateJob(job, HandshakeThread::JOB_DISCARDED);
+        return;
+    }
+    remoteSystem->pendingHandshakeId = 0;
+
+    if (job->valid == false)
+    {
+        CAT_AUDIT_PRINTF("AUDIT: Challenge BAD!\n");
+
+        // Unassign this remote system
+        DereferenceRemoteSystem(job->systemAddress);
+        handshakeThread.DeallocateJob(job, HandshakeThread::JOB_REJECTED);
+        return;
+    }
+    CAT_AUDIT_PRINTF("AUDIT: Challenge good!  Sending ID_OPEN_CONNECTION_REPLY_2\n");
+
+    *remoteSystem->reliabilityLayer.GetAuthenticatedEncryption() = job->authEnc;
+    memcpy(remoteSystem->answer, job->answer, sizeof(remoteSystem->answer));
+
+    // Same as the reply in ProcessOfflineNetworkPacket()
+    RakNet::BitStream bsAnswer;
+    bsAnswer.Write((MessageID) ID_OPEN_CONNECTION_REPLY_2);
+    bsAnswer.WriteAlignedBytes((const unsigned char *) OFFLINE_MESSAGE_DATA_ID, sizeof(OFFLINE_MESSAGE_DATA_ID));
+    bsAnswer.Write(GetGuidFromSystemAddress(UNASSIGNED_SYSTEM_ADDRESS));
+    bsAnswer.Write(job->systemAddress);
+    bsAnswer.Write(job->mtu);
+    bsAnswer.Write(true);
+    bsAnswer.WriteAlignedBytes((const unsigned char *) remoteSystem->answer, sizeof(remoteSystem->answer));
+
+    for (unsigned i = 0; i < pluginListNTS.Size(); i++)
+        pluginListNTS[i]->OnDirectSocketSend((const char *) bsAnswer.GetData(), bsAnswer.GetNumberOfBitsUsed(), job->systemAddress);
+    RNS2_SendParameters bsp;
+    bsp.data = (char *) bsAnswer.GetData();
+    bsp.length = bsAnswer.GetNumberOfBytesUsed();
+    bsp.systemAddress = job->systemAddress;
+    remoteSystem->rakNetSocket->Send(&bsp, _FILE_AND_LINE_);
+
+    handshakeThread.DeallocateJob(job, HandshakeThread::JOB_ANSWERED);
+}
+#endif // LIBCAT_SECURITY
+
 // ---------------------------------------------------------------------------------------------------------------------
 
 /*
@@ -6129,54 +6618,62 @@ RAK_THREAD_DECLARATION(RakNet::UpdateNetworkLoop)
 
 void RakPeer::CallPluginCallbacks(DataStructures::List<PluginInterface2 *> &pluginList, Packet *packet)
 {
-    for (unsigned i = 0; i < pluginList.Size(); i++)
+    // Most messages are not connection events, so decide once rather than per plugin
+    unsigned i;
+    PI2_FailedConnectionAttemptReason failedConnectionAttemptReason;
+    switch (packet->data[0])
     {
-        switch (packet->data[0])
-        {
-            case ID_DISCONNECTION_NOTIFICATION:
+        case ID_DISCONNECTION_NOTIFICATION:
+            for (i = 0; i < pluginList.Size(); i++)
                 pluginList[i]->OnClosedConnection(packet->systemAddress, packet->guid, LCR_DISCONNECTION_NOTIFICATION);
-                break;
-            case ID_CONNECTION_LOST:
+            return;
+        case ID_CONNECTION_LOST:
+            for (i = 0; i < pluginList.Size(); i++)
                 pluginList[i]->OnClosedConnection(packet->systemAddress, packet->guid, LCR_CONNECTION_LOST);
-                break;
-            case ID_NEW_INCOMING_CONNECTION:
+            return;
+        case ID_NEW_INCOMING_CONNECTION:
+            for (i = 0; i < pluginList.Size(); i++)
                 pluginList[i]->OnNewConnection(packet->systemAddress, packet->guid, true);
-                break;
-            case ID_CONNECTION_REQUEST_ACCEPTED:
+            return;
+        case ID_CONNECTION_REQUEST_ACCEPTED:
+            for (i = 0; i < pluginList.Size(); i++)
                 pluginList[i]->OnNewConnection(packet->systemAddress, packet->guid, false);
-                break;
-            case ID_CONNECTION_ATTEMPT_FAILED:
-                pluginList[i]->OnFailedConnectionAttempt(packet, FCAR_CONNECTION_ATTEMPT_FAILED);
-                break;
-            case ID_REMOTE_SYSTEM_REQUIRES_PUBLIC_KEY:
-                pluginList[i]->OnFailedConnectionAttempt(packet, FCAR_REMOTE_SYSTEM_REQUIRES_PUBLIC_KEY);
-                break;
-            case ID_OUR_SYSTEM_REQUIRES_SECURITY:
-                pluginList[i]->OnFailedConnectionAttempt(packet, FCAR_OUR_SYSTEM_REQUIRES_SECURITY);
-                break;
-            case ID_PUBLIC_KEY_MISMATCH:
-                pluginList[i]->OnFailedConnectionAttempt(packet, FCAR_PUBLIC_KEY_MISMATCH);
-                break;
-            case ID_ALREADY_CONNECTED:
-                pluginList[i]->OnFailedConnectionAttempt(packet, FCAR_ALREADY_CONNECTED);
-                break;
-            case ID_NO_FREE_INCOMING_CONNECTIONS:
-                pluginList[i]->OnFailedConnectionAttempt(packet, FCAR_NO_FREE_INCOMING_CONNECTIONS);
-                break;
-            case ID_CONNECTION_BANNED:
-                pluginList[i]->OnFailedConnectionAttempt(packet, FCAR_CONNECTION_BANNED);
-                break;
-            case ID_INVALID_PASSWORD:
-                pluginList[i]->OnFailedConnectionAttempt(packet, FCAR_INVALID_PASSWORD);
-                break;
-            case ID_INCOMPATIBLE_PROTOCOL_VERSION:
-                pluginList[i]->OnFailedConnectionAttempt(packet, FCAR_INCOMPATIBLE_PROTOCOL);
-                break;
-            case ID_IP_RECENTLY_CONNECTED:
-                pluginList[i]->OnFailedConnectionAttempt(packet, FCAR_IP_RECENTLY_CONNECTED);
-                break;
-        }
+            return;
+        case ID_CONNECTION_ATTEMPT_FAILED:
+            failedConnectionAttemptReason = FCAR_CONNECTION_ATTEMPT_FAILED;
+            break;
+        case ID_REMOTE_SYSTEM_REQUIRES_PUBLIC_KEY:
+            failedConnectionAttemptReason = FCAR_REMOTE_SYSTEM_REQUIRES_PUBLIC_KEY;
+            break;
+        case ID_OUR_SYSTEM_REQUIRES_SECURITY:
+            failedConnectionAttemptReason = FCAR_OUR_SYSTEM_REQUIRES_SECURITY;
+            break;
+        case ID_PUBLIC_KEY_MISMATCH:
+            failedConnectionAttemptReason = FCAR_PUBLIC_KEY_MISMATCH;
+            break;
+        case ID_ALREADY_CONNECTED:
+            failedConnectionAttemptReason = FCAR_ALREADY_CONNECTED;
+            break;
+        case ID_NO_FREE_INCOMING_CONNECTIONS:
+            failedConnectionAttemptReason = FCAR_NO_FREE_INCOMING_CONNECTIONS;
+            break;
+        case ID_CONNECTION_BANNED:
+            failedConnectionAttemptReason = FCAR_CONNECTION_BANNED;
+            break;
+        case ID_INVALID_PASSWORD:
+            failedConnectionAttemptReason = FCAR_INVALID_PASSWORD;
+            break;
+        case ID_INCOMPATIBLE_PROTOCOL_VERSION:
+            failedConnectionAttemptReason = FCAR_INCOMPATIBLE_PROTOCOL;
+            break;
+        case ID_IP_RECENTLY_CONNECTED:
+            failedConnectionAttemptReason = FCAR_IP_RECENTLY_CONNECTED;
+            break;
+        default:
+            return;
     }
+    for (i = 0; i < pluginList.Size(); i++)
+        pluginList[i]->OnFailedConnectionAttempt(packet, failedConnectionAttemptReason);
 }
 
 void RakPeer::FillIPList(void)
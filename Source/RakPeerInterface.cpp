@@ -1,4 +1,7 @@
 #include "RakPeerInterface.h"
+#include "RakNetStatistics.h"
+#include "BitStream.h"
+#include <string.h>
 using namespace RakNet;
 
 #if defined(_WIN32)
@@ -39,3 +42,50 @@ uint64_t RakPeerInterface::Get64BitUniqueRandomNumber(void)
     return tv.tv_usec + tv.tv_sec * 1000000;
 }
 #endif
+
+void RakPeerInterface::GetHandshakeStatistics(HandshakeStatistics *stats)
+{
+    memset(stats, 0, sizeof(HandshakeStatistics));
+}
+
+uint32_t RakPeerInterface::SendToSystems( const RakNet::BitStream * bitStream, PacketPriority priority, PacketReliability reliability, char orderingChannel, const DataStructures::List<RakNetGUID> &systemIdentifiers, uint32_t forceReceiptNumber )
+{
+    // The first system sent to chooses the receipt number, and the others share it
+    for (unsigned int i=0; i < systemIdentifiers.Size(); i++)
+    {
+        uint32_t receiptNumber = Send(bitStream, priority, reliability, orderingChannel, systemIdentifiers[i], false, forceReceiptNumber);
+        if (forceReceiptNumber==0)
+            forceReceiptNumber=receiptNumber;
+    }
+    return forceReceiptNumber;
+}
+
+unsigned int RakPeerInterface::ReceiveBatch( Packet **packets, unsigned int maxPackets )
+{
+    unsigned int count=0;
+    while (count < maxPackets && (packets[count]=Receive())!=0)
+        count++;
+    return count;
+}
+
+void RakPeerInterface::DeallocatePackets( Packet **packets, unsigned int numPackets )
+{
+    for (unsigned int i=0; i < numPackets; i++)
+        DeallocatePacket(packets[i]);
+}
+
+void RakPeerInterface::SetMessageCoalescing(RakNet::TimeUS maxDelayUS, unsigned int maxMessageBytes, uint32_t orderingChannelMask, const SystemAddress target)
+{
+    (void) maxDelayUS;
+    (void) maxMessageBytes;
+    (void) orderingChannelMask;
+    (void) target;
+}
+
+void RakPeerInterface::SetMessageCompression(CompressionInterface *compressor, unsigned int minMessageBytes, uint32_t orderingChannelMask, const SystemAddress target)
+{
+    (void) compressor;
+    (void) minMessageBytes;
+    (void) orderingChannelMask;
+    (void) target;
+}
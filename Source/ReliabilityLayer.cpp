@@ -20,11 +20,18 @@
 #include "RakAssert.h"
 #include "Rand.h"
 #include "MessageIdentifiers.h"
+#include "CompressionInterface.h"
+#include "PacketPool.h"
 
 #ifdef USE_THREADED_SEND
 #include "SendToThread.h"
 #endif
 
+#ifdef LIBCAT_SECURITY
+#include "EncryptThread.h"
+#include "RakSleep.h"
+#endif
+
 #include <math.h>
 
 using namespace RakNet;
@@ -336,7 +343,13 @@ ReliabilityLayer::ReliabilityLayer()
         fp = fopen("reliableorderedoutput.txt", "wt");
 #endif
 
+    packetPool = 0;
     InitializeVariables();
+#ifdef LIBCAT_SECURITY
+    recvDecryptState = RECV_DECRYPT_OFF;
+    securityEpoch = 1;
+    pendingEncryptedSends = 0;
+#endif
     datagramHistoryMessagePool.SetPageSize(sizeof(MessageNumberNode) * 128);
     internalPacketPool.SetPageSize(sizeof(InternalPacket) * INTERNAL_PACKET_PAGE_SIZE);
     refCountedDataPool.SetPageSize(sizeof(InternalPacketRefCountedData) * 32);
@@ -347,6 +360,9 @@ ReliabilityLayer::ReliabilityLayer()
 //-------------------------------------------------------------------------------------------------------
 ReliabilityLayer::~ReliabilityLayer()
 {
+#ifdef LIBCAT_SECURITY
+    StopCryptoThreads();
+#endif
     FreeMemory(true); // Free all memory immediately
 }
 
@@ -357,6 +373,9 @@ void ReliabilityLayer::Reset(bool resetVariables, int MTUSize, bool _useSecurity
 {
     // true because making a memory reset pending in the update cycle causes resets after reconnects.
     // Instead, just call Reset from a single thread
+#ifdef LIBCAT_SECURITY
+    StopCryptoThreads();
+#endif
     FreeMemory(true);
     if (resetVariables)
     {
@@ -374,6 +393,76 @@ void ReliabilityLayer::Reset(bool resetVariables, int MTUSize, bool _useSecurity
     }
 }
 
+#ifdef LIBCAT_SECURITY
+//-------------------------------------------------------------------------------------------------------
+// Decrypts on a socket receive thread, if auth_enc is free and has keys
+//-------------------------------------------------------------------------------------------------------
+ReliabilityLayer::RecvThreadDecryptResult ReliabilityLayer::DecryptOnRecvThread(char *buffer, unsigned int *length, unsigned int *decryptedEpoch)
+{
+    int state = RECV_DECRYPT_IDLE;
+    if (!recvDecryptState.compare_exchange_strong(state, RECV_DECRYPT_BUSY, std::memory_order_acquire))
+        return RTD_NOT_DECRYPTED;
+
+    cat::u32 received = *length;
+    bool success = auth_enc.Decrypt((cat::u8 *) buffer, received);
+    *decryptedEpoch = securityEpoch;
+    recvDecryptState.store(RECV_DECRYPT_IDLE, std::memory_order_release);
+
+    if (!success)
+        return RTD_INVALID;
+    *length = received;
+    return RTD_DECRYPTED;
+}
+
+//-------------------------------------------------------------------------------------------------------
+bool ReliabilityLayer::DecryptOnUpdateThread(char *buffer, unsigned int &length)
+{
+    // Receive threads only use auth_enc after this thread allowed them to
+    bool shared = recvDecryptState.load(std::memory_order_relaxed) != RECV_DECRYPT_OFF;
+    if (shared)
+    {
+        int state = RECV_DECRYPT_IDLE;
+        while (!recvDecryptState.compare_exchange_weak(state, RECV_DECRYPT_BUSY, std::memory_order_acquire))
+        {
+            state = RECV_DECRYPT_IDLE;
+            RakSleep(0);
+        }
+    }
+
+    unsigned int received = length;
+    bool success = auth_enc.Decrypt((cat::u8 *) buffer, received);
+
+    // The first datagram that decrypts shows the keys are set, so receive threads can decrypt from now on
+    if (shared || success)
+        recvDecryptState.store(RECV_DECRYPT_IDLE, std::memory_order_release);
+
+    if (!success)
+        return false;
+    length = received;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::StopCryptoThreads(void)
+{
+    int state = recvDecryptState.load(std::memory_order_acquire);
+    while (state != RECV_DECRYPT_OFF)
+    {
+        if (state == RECV_DECRYPT_IDLE && recvDecryptState.compare_exchange_weak(state, RECV_DECRYPT_OFF, std::memory_order_acquire))
+            break;
+        RakSleep(0);
+        state = recvDecryptState.load(std::memory_order_acquire);
+    }
+
+    // Datagrams that receive threads already decrypted with these keys are dropped when they arrive here
+    if (++securityEpoch == 0)
+        securityEpoch = 1;
+
+    while (pendingEncryptedSends.load(std::memory_order_acquire) != 0)
+        RakSleep(0);
+}
+#endif // LIBCAT_SECURITY
+
 //-------------------------------------------------------------------------------------------------------
 // Set the time, in MS, to use before considering ourselves disconnected after not being able to deliver a reliable packet
 //-------------------------------------------------------------------------------------------------------
@@ -416,6 +505,18 @@ void ReliabilityLayer::InitializeVariables(void)
     unreliableTimeout = 0;
     lastBpsClear = 0;
 
+    memset(coalescedMessages, 0, sizeof(coalescedMessages));
+    coalescedMessagesPending = 0;
+    flushingCoalescedMessages = false;
+    coalesceMaxDelay = 0;
+    coalesceMaxMessageBytes = 0;
+    coalesceOrderingChannelMask = 0;
+    receivedCoalescedData = 0;
+    receivedCoalescedLength = receivedCoalescedOffset = 0;
+    messageCompressor = 0;
+    compressMinMessageBytes = 0;
+    compressOrderingChannelMask = 0;
+
     // Disable packet pairs
     countdownToNextPacketPair = 15;
 
@@ -507,6 +608,15 @@ void ReliabilityLayer::FreeThreadSafeMemory(void)
 
     outputQueue.ClearAndForceAllocation(32, _FILE_AND_LINE_);
 
+    for (unsigned i = 0; i < NUMBER_OF_ORDERED_STREAMS; i++)
+    {
+        free(coalescedMessages[i].data);
+        coalescedMessages[i].data = 0;
+    }
+    coalescedMessagesPending = 0;
+    FreeReceivedData(receivedCoalescedData);
+    receivedCoalescedData = 0;
+
     /*
     for ( i = 0; i < orderingList.Size(); i++ )
     {
@@ -644,7 +754,7 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
         const char *buffer, unsigned int length, SystemAddress &systemAddress,
         DataStructures::List<PluginInterface2 *> &messageHandlerList, int MTUSize,
         RakNetSocket2 *s, RakNetRandom *rnr, CCTimeType timeRead,
-        BitStream &updateBitStream)
+        BitStream &updateBitStream, unsigned int decryptedEpoch)
 {
     RakAssert(buffer != 0);
 
@@ -652,6 +762,12 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
     timeRead/=1000;
 #endif
 
+#ifdef LIBCAT_SECURITY
+    // Count the bytes that arrived, before decryption
+    if (decryptedEpoch != 0)
+        bpsMetrics[(int) ACTUAL_BYTES_RECEIVED].Push1(timeRead, length + cat::AuthenticatedEncryption::OVERHEAD_BYTES);
+    else
+#endif
     bpsMetrics[(int) ACTUAL_BYTES_RECEIVED].Push1(timeRead, length);
 
     (void) MTUSize;
@@ -671,15 +787,19 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
     DatagramSequenceNumberType holeCount;
 
 #ifdef LIBCAT_SECURITY
-    if (useSecurity)
+    if (decryptedEpoch != 0)
     {
-        unsigned int received = length;
-
-        if (!auth_enc.Decrypt((cat::u8 *) buffer, received))
+        // Decrypted by a receive thread. Drop it if that was with the keys of an earlier connection.
+        if (!useSecurity || decryptedEpoch != securityEpoch)
+            return false;
+    }
+    else if (useSecurity)
+    {
+        if (!DecryptOnUpdateThread((char *) buffer, length))
             return false;
-
-        length = received;
     }
+#else
+    (void) decryptedEpoch;
 #endif
 
     RakNet::BitStream socketData((unsigned char *) buffer, length,
@@ -764,7 +884,7 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
                         if (unreliableWithAckReceiptHistory[k].datagramNumber == datagramNumber)
                         {
                             InternalPacket *ackReceipt = AllocateFromInternalPacketPool();
-                            AllocInternalPacketData(ackReceipt, 5, false, _FILE_AND_LINE_);
+                            AllocReceivedInternalPacketData(ackReceipt, 5);
                             ackReceipt->dataBitLength = BYTES_TO_BITS(5);
                             ackReceipt->data[0] = (MessageID) ID_SND_RECEIPT_ACKED;
                             memcpy(ackReceipt->data + sizeof(MessageID),
@@ -1532,24 +1652,114 @@ bool ReliabilityLayer::HandleSocketReceiveFromConnectedPlayer(
 BitSize_t ReliabilityLayer::Receive(unsigned char **data)
 {
     InternalPacket *internalPacket;
+    BitSize_t bitLength;
+
+    while (receivedCoalescedData)
+    {
+        bitLength = ReceiveCoalescedMessage(data);
+        if (bitLength > 0 && (*data)[0] == ID_COMPRESSED_MESSAGE)
+            bitLength = DecompressMessage(data, bitLength);
+        if (bitLength > 0)
+            return bitLength;
+    }
 
-    if (outputQueue.Size() > 0)
+    while (outputQueue.Size() > 0)
     {
         //  #ifdef _DEBUG
         //  RakAssert(bitStream->GetNumberOfBitsUsed()==0);
         //  #endif
         internalPacket = outputQueue.Pop();
 
-        BitSize_t bitLength;
         *data = internalPacket->data;
         bitLength = internalPacket->dataBitLength;
         ReleaseToInternalPacketPool(internalPacket);
-        return bitLength;
+
+        if ((*data)[0] == ID_COMPRESSED_MESSAGE)
+        {
+            bitLength = DecompressMessage(data, bitLength);
+            if (bitLength == 0)
+                continue;
+        }
+
+        if ((*data)[0] != ID_COALESCED_MESSAGES)
+            return bitLength;
+
+        // Split merged messages back out, one per call
+        receivedCoalescedData = *data;
+        receivedCoalescedLength = (unsigned int) BITS_TO_BYTES(bitLength);
+        receivedCoalescedOffset = sizeof(MessageID);
+        while (receivedCoalescedData)
+        {
+            bitLength = ReceiveCoalescedMessage(data);
+            if (bitLength > 0 && (*data)[0] == ID_COMPRESSED_MESSAGE)
+                bitLength = DecompressMessage(data, bitLength);
+            if (bitLength > 0)
+                return bitLength;
+        }
     }
 
-    else
-        return 0;
+    return 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+BitSize_t ReliabilityLayer::ReceiveCoalescedMessage(unsigned char **data)
+{
+    if (receivedCoalescedOffset + 2 <= receivedCoalescedLength)
+    {
+        BitSize_t bitLength = (BitSize_t) receivedCoalescedData[receivedCoalescedOffset] |
+                              ((BitSize_t) receivedCoalescedData[receivedCoalescedOffset + 1] << 8);
+        unsigned int byteLength = (unsigned int) BITS_TO_BYTES(bitLength);
+        receivedCoalescedOffset += 2;
+
+        // Ignore the remainder of a malformed message
+        if (bitLength > 0 && receivedCoalescedOffset + byteLength <= receivedCoalescedLength)
+        {
+            *data = AllocReceivedData(byteLength);
+            if (*data)
+            {
+                memcpy(*data, receivedCoalescedData + receivedCoalescedOffset, byteLength);
+                receivedCoalescedOffset += byteLength;
+                return bitLength;
+            }
+            // Out of memory, so drop the rest as well
+        }
+    }
 
+    FreeReceivedData(receivedCoalescedData);
+    receivedCoalescedData = 0;
+    return 0;
+}
+
+//-------------------------------------------------------------------------------------------------------
+BitSize_t ReliabilityLayer::DecompressMessage(unsigned char **data, BitSize_t bitLength)
+{
+    unsigned int compressedLength = (unsigned int) BITS_TO_BYTES(bitLength);
+    unsigned char *original = 0;
+    BitSize_t originalBitLength = 0;
+
+    // ID_COMPRESSED_MESSAGE, the bit length of the original message in 32 bits, then the compressed data
+    if (messageCompressor && compressedLength > sizeof(MessageID) + 4)
+    {
+        originalBitLength = (BitSize_t) (*data)[1] | ((BitSize_t) (*data)[2] << 8) |
+                            ((BitSize_t) (*data)[3] << 16) | ((BitSize_t) (*data)[4] << 24);
+        unsigned int originalLength = (unsigned int) BITS_TO_BYTES(originalBitLength);
+        // Limits what a malicious sender can make us allocate. Compression also gets no better than 256 to 1.
+        if (originalBitLength > 0 && originalLength <= MAX_DECOMPRESSED_MESSAGE_SIZE && originalLength / 256 <= compressedLength)
+        {
+            original = AllocReceivedData(originalLength);
+            if (original && messageCompressor->Decompress(*data + sizeof(MessageID) + 4,
+                                                          compressedLength - sizeof(MessageID) - 4, original,
+                                                          originalLength) == false)
+            {
+                FreeReceivedData(original);
+                original = 0;
+            }
+        }
+    }
+
+    FreeReceivedData(*data);
+    *data = original;
+    return original ? originalBitLength : 0;
 }
 
 //-------------------------------------------------------------------------------------------------------
@@ -1571,6 +1781,15 @@ ReliabilityLayer::Send(char *data, BitSize_t numberOfBitsToSend, PacketPriority
     RakAssert(numberOfBitsToSend > 0);
 #endif
 
+    if (messageCompressor && flushingCoalescedMessages == false && orderingChannel < NUMBER_OF_ORDERED_STREAMS &&
+        CompressMessage(&data, &numberOfBitsToSend, makeDataCopy, orderingChannel))
+        makeDataCopy = false;
+
+    if ((coalesceMaxDelay > 0 || coalescedMessagesPending != 0) && flushingCoalescedMessages == false &&
+        orderingChannel < NUMBER_OF_ORDERED_STREAMS &&
+        CoalesceMessage(data, numberOfBitsToSend, priority, reliability, orderingChannel, makeDataCopy, currentTime))
+        return true;
+
 #if CC_TIME_TYPE_BYTES == 4
     currentTime/=1000;
 #endif
@@ -1710,6 +1929,122 @@ ReliabilityLayer::Send(char *data, BitSize_t numberOfBitsToSend, PacketPriority
     return true;
 }
 
+//-------------------------------------------------------------------------------------------------------
+bool ReliabilityLayer::CoalesceMessage(char *data, BitSize_t numberOfBitsToSend, PacketPriority priority,
+                                       PacketReliability reliability, unsigned char orderingChannel, bool makeDataCopy,
+                                       CCTimeType currentTime)
+{
+    CoalescedMessage *cm = &coalescedMessages[orderingChannel];
+    unsigned int numberOfBytesToSend = (unsigned int) BITS_TO_BYTES(numberOfBitsToSend);
+    unsigned int maxDataSizeBytes =
+            GetMaxDatagramSizeExcludingMessageHeaderBytes() - BITS_TO_BYTES(GetMaxMessageHeaderLengthBits());
+
+    bool canCoalesce = coalesceMaxDelay > 0 &&
+                       (coalesceOrderingChannelMask & ((uint32_t) 1 << orderingChannel)) != 0 &&
+                       (reliability == UNRELIABLE || reliability == RELIABLE || reliability == RELIABLE_ORDERED) &&
+                       priority > IMMEDIATE_PRIORITY && priority < NUMBER_OF_PRIORITIES &&
+                       numberOfBitsToSend > 0 && numberOfBytesToSend <= coalesceMaxMessageBytes &&
+                       sizeof(MessageID) + 2 + numberOfBytesToSend <= maxDataSizeBytes &&
+                       // Connection setup and pings are timing sensitive, and must never be merged
+                       (unsigned char) data[0] >= ID_TIMESTAMP && (unsigned char) data[0] != ID_COALESCED_MESSAGES;
+
+    // Anything sent on this channel that cannot join the pending message must go after it
+    if (cm->data && (canCoalesce == false || cm->priority != priority || cm->reliability != reliability ||
+                     cm->byteLength + 2 + numberOfBytesToSend > maxDataSizeBytes))
+        FlushCoalescedMessages(orderingChannel, currentTime);
+
+    if (canCoalesce == false)
+        return false;
+
+    if (cm->data == 0)
+    {
+        cm->data = (unsigned char *) malloc(maxDataSizeBytes);
+        cm->data[0] = ID_COALESCED_MESSAGES;
+        cm->byteLength = sizeof(MessageID);
+        cm->messageCount = 0;
+        cm->priority = priority;
+        cm->reliability = reliability;
+        cm->firstMessageTime = currentTime;
+        coalescedMessagesPending |= (uint32_t) 1 << orderingChannel;
+    }
+
+    cm->data[cm->byteLength] = (unsigned char) (numberOfBitsToSend & 0xFF);
+    cm->data[cm->byteLength + 1] = (unsigned char) (numberOfBitsToSend >> 8);
+    memcpy(cm->data + cm->byteLength + 2, data, numberOfBytesToSend);
+    cm->byteLength += 2 + numberOfBytesToSend;
+    cm->messageCount++;
+
+    // The caller passed ownership of data
+    if (makeDataCopy == false)
+        free(data);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------
+bool ReliabilityLayer::CompressMessage(char **data, BitSize_t *numberOfBitsToSend, bool makeDataCopy,
+                                       unsigned char orderingChannel)
+{
+    unsigned int numberOfBytesToSend = (unsigned int) BITS_TO_BYTES(*numberOfBitsToSend);
+    unsigned char messageId = (unsigned char) (*data)[0];
+
+    // Connection setup and pings must be readable by systems that never set a compressor
+    if ((compressOrderingChannelMask & ((uint32_t) 1 << orderingChannel)) == 0 ||
+        numberOfBytesToSend < compressMinMessageBytes || numberOfBytesToSend <= sizeof(MessageID) + 4 ||
+        numberOfBytesToSend > MAX_DECOMPRESSED_MESSAGE_SIZE ||
+        messageId < ID_TIMESTAMP || messageId == ID_COALESCED_MESSAGES || messageId == ID_COMPRESSED_MESSAGE)
+        return false;
+
+    unsigned int capacity = messageCompressor->GetMaxCompressedLength(numberOfBytesToSend);
+    unsigned char *compressed = (unsigned char *) malloc(sizeof(MessageID) + 4 + capacity);
+    if (compressed == 0)
+        return false;
+    unsigned int compressedLength = messageCompressor->Compress((const unsigned char *) *data, numberOfBytesToSend,
+                                                                compressed + sizeof(MessageID) + 4, capacity);
+    // Only worth sending if smaller, including the header
+    if (compressedLength == 0 || sizeof(MessageID) + 4 + compressedLength >= numberOfBytesToSend)
+    {
+        free(compressed);
+        return false;
+    }
+
+    compressed[0] = ID_COMPRESSED_MESSAGE;
+    compressed[1] = (unsigned char) (*numberOfBitsToSend & 0xFF);
+    compressed[2] = (unsigned char) ((*numberOfBitsToSend >> 8) & 0xFF);
+    compressed[3] = (unsigned char) ((*numberOfBitsToSend >> 16) & 0xFF);
+    compressed[4] = (unsigned char) ((*numberOfBitsToSend >> 24) & 0xFF);
+
+    // The caller passed ownership of data
+    if (makeDataCopy == false)
+        free(*data);
+    *data = (char *) compressed;
+    *numberOfBitsToSend = BYTES_TO_BITS(sizeof(MessageID) + 4 + compressedLength);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::FlushCoalescedMessages(unsigned char orderingChannel, CCTimeType currentTime)
+{
+    CoalescedMessage *cm = &coalescedMessages[orderingChannel];
+    if (cm->data == 0)
+        return;
+
+    unsigned char *bundle = cm->data;
+    BitSize_t bitLength = BYTES_TO_BITS(cm->byteLength);
+    cm->data = 0;
+    coalescedMessagesPending &= ~((uint32_t) 1 << orderingChannel);
+
+    if (cm->messageCount == 1)
+    {
+        // Nothing joined it, so send the original message without the extra header
+        bitLength = (BitSize_t) bundle[sizeof(MessageID)] | ((BitSize_t) bundle[sizeof(MessageID) + 1] << 8);
+        memmove(bundle, bundle + sizeof(MessageID) + 2, BITS_TO_BYTES(bitLength));
+    }
+
+    flushingCoalescedMessages = true;
+    Send((char *) bundle, bitLength, cm->priority, cm->reliability, orderingChannel, false, 0, currentTime, 0);
+    flushingCoalescedMessages = false;
+}
+
 //-------------------------------------------------------------------------------------------------------
 // Run this once per game cycle.  Handles internal lists and actually does the send
 //-------------------------------------------------------------------------------------------------------
@@ -1721,6 +2056,15 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
 {
     (void) MTUSize;
 
+    if (coalescedMessagesPending)
+    {
+        for (unsigned char i = 0; i < NUMBER_OF_ORDERED_STREAMS; i++)
+        {
+            if (coalescedMessages[i].data && (CCTimeType) (time - coalescedMessages[i].firstMessageTime) >= coalesceMaxDelay)
+                FlushCoalescedMessages(i, time);
+        }
+    }
+
     RakNet::TimeMS timeMs;
 #if CC_TIME_TYPE_BYTES == 4
     time /= 1000;
@@ -1880,7 +2224,7 @@ void ReliabilityLayer::Update(RakNetSocket2 *s, SystemAddress &systemAddress, in
             if (time - unreliableWithAckReceiptHistory[i].nextActionTime < (((CCTimeType) -1) / 2))
             {
                 InternalPacket *ackReceipt = AllocateFromInternalPacketPool();
-                AllocInternalPacketData(ackReceipt, 5, false, _FILE_AND_LINE_);
+                AllocReceivedInternalPacketData(ackReceipt, 5);
                 ackReceipt->dataBitLength = BYTES_TO_BITS(5);
                 ackReceipt->data[0] = (MessageID) ID_SND_RECEIPT_LOSS;
                 memcpy(ackReceipt->data + sizeof(MessageID), &unreliableWithAckReceiptHistory[i].sendReceiptSerial, sizeof(uint32_t));
@@ -2295,6 +2639,26 @@ void ReliabilityLayer::SendBitStream(RakNetSocket2 *s, SystemAddress &systemAddr
 #endif
 
 #ifdef LIBCAT_SECURITY
+    if (useSecurity && EncryptThread::IsRunning())
+    {
+        // Encrypt and send on a worker. The IV is reserved here, so IVs still increase in the order datagrams are sent.
+        EncryptThread::EncryptThreadBlock *block = EncryptThread::AllocateBlock();
+        memcpy(block->data, bitStream->GetData(), length);
+        block->dataWriteOffset = length;
+        block->authEnc = &auth_enc;
+        block->iv = auth_enc.NextIV();
+        block->s = s;
+        block->systemAddress = systemAddress;
+        block->pendingSends = &pendingEncryptedSends;
+        pendingEncryptedSends.fetch_add(1, std::memory_order_relaxed);
+
+        length += cat::AuthenticatedEncryption::OVERHEAD_BYTES;
+        bpsMetrics[(int) ACTUAL_BYTES_SENT].Push1(currentTime, length);
+        RakAssert(length <= congestionManager.GetMTU());
+        EncryptThread::ProcessBlock(block);
+        return;
+    }
+
     if (useSecurity)
     {
         unsigned char *buffer = bitStream->GetData();
@@ -2337,7 +2701,7 @@ void ReliabilityLayer::SendBitStream(RakNetSocket2 *s, SystemAddress &systemAddr
 //-------------------------------------------------------------------------------------------------------
 bool ReliabilityLayer::IsOutgoingDataWaiting(void)
 {
-    if (outgoingPacketBuffer.Size() > 0)
+    if (outgoingPacketBuffer.Size() > 0 || coalescedMessagesPending != 0)
         return true;
 
     //     unsigned i;
@@ -2391,6 +2755,25 @@ void ReliabilityLayer::SetUnreliableTimeout(RakNet::TimeMS timeoutMS)
 #endif
 }
 
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SetMessageCoalescing(RakNet::TimeUS maxDelayUS, unsigned int maxMessageBytes,
+                                            uint32_t orderingChannelMask)
+{
+    // Send() and Update() compare against times in microseconds, before any conversion to CCTimeType units
+    coalesceMaxDelay = (CCTimeType) maxDelayUS;
+    coalesceMaxMessageBytes = maxMessageBytes;
+    coalesceOrderingChannelMask = orderingChannelMask;
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SetMessageCompression(CompressionInterface *compressor, unsigned int minMessageBytes,
+                                             uint32_t orderingChannelMask)
+{
+    messageCompressor = compressor;
+    compressMinMessageBytes = minMessageBytes;
+    compressOrderingChannelMask = orderingChannelMask;
+}
+
 //-------------------------------------------------------------------------------------------------------
 // This will return true if we should not send at this time
 //-------------------------------------------------------------------------------------------------------
@@ -2476,7 +2859,7 @@ ReliabilityLayer::RemovePacketFromResendListAndDeleteOlderReliableSequenced(cons
              internalPacket->splitPacketIndex + 1 == internalPacket->splitPacketCount))
         {
             InternalPacket *ackReceipt = AllocateFromInternalPacketPool();
-            AllocInternalPacketData(ackReceipt, 5, false, _FILE_AND_LINE_);
+            AllocReceivedInternalPacketData(ackReceipt, 5);
             ackReceipt->dataBitLength = BYTES_TO_BITS(5);
             ackReceipt->data[0] = (MessageID) ID_SND_RECEIPT_ACKED;
             memcpy(ackReceipt->data + sizeof(MessageID), &internalPacket->sendReceiptSerial, sizeof(internalPacket->sendReceiptSerial));
@@ -2731,7 +3114,7 @@ InternalPacket *ReliabilityLayer::CreateInternalPacketFromBitStream(RakNet::BitS
     }
 
     // Allocate memory to hold our data
-    AllocInternalPacketData(internalPacket, BITS_TO_BYTES(internalPacket->dataBitLength), false, _FILE_AND_LINE_);
+    AllocReceivedInternalPacketData(internalPacket, BITS_TO_BYTES(internalPacket->dataBitLength));
     RakAssert(BITS_TO_BYTES(internalPacket->dataBitLength) < MAXIMUM_MTU_SIZE);
 
     if (internalPacket->data == 0)
@@ -3002,7 +3385,7 @@ void ReliabilityLayer::InsertIntoSplitPacketList(InternalPacket *internalPacket,
         newChannel->returnedPacket=CreateInternalPacketCopy( internalPacket, 0, 0, time );
         newChannel->gotFirstPacket=false;
         newChannel->splitPacketsArrived=0;
-        AllocInternalPacketData(newChannel->returnedPacket, BITS_TO_BYTES( internalPacket->dataBitLength*internalPacket->splitPacketCount ),  false, __FILE__, __LINE__ );
+        AllocReceivedInternalPacketData(newChannel->returnedPacket, BITS_TO_BYTES( internalPacket->dataBitLength*internalPacket->splitPacketCount ) );
         RakAssert(newChannel->returnedPacket->data);
 #else
         newChannel->firstPacket = 0;
@@ -3068,7 +3451,7 @@ void ReliabilityLayer::InsertIntoSplitPacketList(InternalPacket *internalPacket,
         //        unsigned int len = sizeof(MessageID) + sizeof(unsigned int)*2 + sizeof(unsigned int) + (unsigned int) BITS_TO_BYTES(splitPacketChannelList[index]->firstPacket->dataBitLength);
         unsigned int l = (unsigned int) splitPacketChannelList[index]->stride;
         const unsigned int len = sizeof(MessageID) + sizeof(unsigned int)*2 + sizeof(unsigned int) + l;
-        AllocInternalPacketData(progressIndicator, len,  false, __FILE__, __LINE__ );
+        AllocReceivedInternalPacketData(progressIndicator, len );
         progressIndicator->dataBitLength=BYTES_TO_BITS(len);
         progressIndicator->data[0]=(MessageID)ID_DOWNLOAD_PROGRESS;
         unsigned int temp;
@@ -3113,7 +3496,7 @@ void ReliabilityLayer::InsertIntoSplitPacketList(InternalPacket *internalPacket,
         InternalPacket *progressIndicator = AllocateFromInternalPacketPool();
         unsigned int length = sizeof(MessageID) + sizeof(unsigned int) * 2 + sizeof(unsigned int) +
                               (unsigned int) BITS_TO_BYTES(firstPacket->dataBitLength);
-        AllocInternalPacketData(progressIndicator, length, false, __FILE__, __LINE__);
+        AllocReceivedInternalPacketData(progressIndicator, length);
         progressIndicator->dataBitLength = BYTES_TO_BITS(length);
         progressIndicator->data[0] = (MessageID) ID_DOWNLOAD_PROGRESS;
         unsigned int temp;
@@ -3146,22 +3529,54 @@ ReliabilityLayer::BuildPacketFromSplitPacketList(SplitPacketChannel *splitPacket
     (void) time;
     return returnedPacket;
 #else
-    // Reconstruct
-    InternalPacket *internalPacket = CreateInternalPacketCopy(splitPacketChannel->splitPacketList[0], 0, 0, time);
-    internalPacket->dataBitLength = 0;
+    // splitPacketList is in arrival order, which differs from splitPacketIndex order after loss or resends.
+    // Every part but the last is the same size, so each part goes at splitPacketIndex times that size.
+    SplitPacketIndexType splitPacketCount = splitPacketChannel->splitPacketList[0]->splitPacketCount;
+    BitSize_t dataBitLength = 0;
+    size_t stride = 0;
     for (unsigned j = 0; j < splitPacketChannel->splitPacketList.Size(); j++)
-        internalPacket->dataBitLength += splitPacketChannel->splitPacketList[j]->dataBitLength;
+    {
+        InternalPacket *splitPacket = splitPacketChannel->splitPacketList[j];
+        dataBitLength += splitPacket->dataBitLength;
+        if (stride == 0 && splitPacket->splitPacketIndex + 1 != splitPacket->splitPacketCount)
+            stride = BITS_TO_BYTES(splitPacket->dataBitLength);
+    }
 
-    internalPacket->data = (unsigned char *) malloc((size_t) BITS_TO_BYTES(internalPacket->dataBitLength));
-    internalPacket->allocationScheme = InternalPacket::NORMAL;
+    // The list is complete when it holds splitPacketCount parts, so a part sent twice would stand in for a missing one.
+    // Check every part has its own place in the message before copying, and drop the message otherwise.
+    unsigned char *placed = (unsigned char *) malloc(splitPacketCount / 8 + 1);
+    bool valid = placed != 0;
+    if (valid)
+        memset(placed, 0, splitPacketCount / 8 + 1);
+    for (unsigned j = 0; valid && j < splitPacketChannel->splitPacketList.Size(); j++)
+    {
+        InternalPacket *splitPacket = splitPacketChannel->splitPacketList[j];
+        SplitPacketIndexType splitPacketIndex = splitPacket->splitPacketIndex;
+        if (splitPacket->splitPacketCount != splitPacketCount ||
+            splitPacketIndex >= splitPacketCount ||
+            (placed[splitPacketIndex / 8] & (1 << (splitPacketIndex % 8))) != 0 ||
+            (splitPacketIndex + 1 != splitPacketCount && splitPacket->dataBitLength != BYTES_TO_BITS(stride)) ||
+            splitPacketIndex * stride + BITS_TO_BYTES(splitPacket->dataBitLength) > BITS_TO_BYTES(dataBitLength))
+            valid = false;
+        else
+            placed[splitPacketIndex / 8] |= (unsigned char) (1 << (splitPacketIndex % 8));
+    }
+    free(placed);
 
-    BitSize_t offset = 0;
-    for (unsigned j = 0; j < splitPacketChannel->splitPacketList.Size(); j++)
+    InternalPacket *internalPacket = 0;
+    if (valid)
+    {
+        // Reconstruct
+        internalPacket = CreateInternalPacketCopy(splitPacketChannel->splitPacketList[0], 0, 0, time);
+        internalPacket->dataBitLength = dataBitLength;
+        AllocReceivedInternalPacketData(internalPacket, (unsigned int) BITS_TO_BYTES(internalPacket->dataBitLength));
+    }
+
+    for (unsigned j = 0; valid && j < splitPacketChannel->splitPacketList.Size(); j++)
     {
         InternalPacket *splitPacket = splitPacketChannel->splitPacketList[j];
         size_t splitPacketPartLength = BITS_TO_BYTES(splitPacketChannel->splitPacketList[j]->dataBitLength);
-        memcpy(internalPacket->data + BITS_TO_BYTES(offset), splitPacket->data, splitPacketPartLength);
-        offset += splitPacketChannel->splitPacketList[j]->dataBitLength;
+        memcpy(internalPacket->data + splitPacket->splitPacketIndex * stride, splitPacket->data, splitPacketPartLength);
     }
 
     for (unsigned j = 0; j < splitPacketChannel->splitPacketList.Size(); j++)
@@ -3880,10 +4295,50 @@ void ReliabilityLayer::FreeInternalPacketData(InternalPacket *internalPacket, co
         free(internalPacket->data);
         internalPacket->data = 0;
     }
+    else if (internalPacket->allocationScheme == InternalPacket::PACKET_POOL)
+    {
+        if (internalPacket->data == 0)
+            return;
+
+        packetPool->ReleaseData(internalPacket->data);
+        internalPacket->data = 0;
+    }
     else // Data was on stack
         internalPacket->data = 0;
 }
 
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::AllocReceivedInternalPacketData(InternalPacket *internalPacket, unsigned int numBytes)
+{
+    internalPacket->allocationScheme = packetPool ? InternalPacket::PACKET_POOL : InternalPacket::NORMAL;
+    internalPacket->data = AllocReceivedData(numBytes);
+}
+
+//-------------------------------------------------------------------------------------------------------
+unsigned char *ReliabilityLayer::AllocReceivedData(unsigned int numBytes)
+{
+    if (packetPool)
+        return packetPool->AllocateData(numBytes);
+    return (unsigned char *) malloc(numBytes);
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::FreeReceivedData(unsigned char *data)
+{
+    if (data == 0)
+        return;
+    if (packetPool)
+        packetPool->ReleaseData(data);
+    else
+        free(data);
+}
+
+//-------------------------------------------------------------------------------------------------------
+void ReliabilityLayer::SetPacketPool(RakNet::PacketPool *pool)
+{
+    packetPool = pool;
+}
+
 //-------------------------------------------------------------------------------------------------------
 unsigned int ReliabilityLayer::GetMaxDatagramSizeExcludingMessageHeaderBytes(void)
 {
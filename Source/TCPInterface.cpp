@@ -26,6 +26,8 @@ typedef int socklen_t;
 #include <sys/time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #include <string.h>
@@ -38,11 +40,34 @@ typedef int socklen_t;
 #include "Itoa.h"
 #include "SocketLayer.h"
 #include "Utils/SocketDefines.h"
+#include "BitStream.h"
+#include "MessageIdentifiers.h"
 
 #if (defined(__GNUC__) || defined(__GCCXML__)) && !defined(__WIN32__)
 #include <netdb.h>
 #endif
 
+#if TCP_INTERFACE_USE_EPOLL==1
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#endif
+
+// Queued chunks are sent with one sendmsg() rather than copied together first
+#if !defined(_WIN32) && !defined(__native_client__)
+#define TCP_INTERFACE_GATHER_SEND 1
+#else
+#define TCP_INTERFACE_GATHER_SEND 0
+#endif
+
+// Completions of MSG_ZEROCOPY sends come on the error queue of the socket, which only the epoll backend watches
+#if TCP_INTERFACE_USE_EPOLL==1 && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define TCP_INTERFACE_ZERO_COPY 1
+#include <linux/errqueue.h>
+#else
+#define TCP_INTERFACE_ZERO_COPY 0
+#endif
+
 #ifdef _DO_PRINTF
 #endif
 
@@ -59,6 +84,48 @@ using namespace RakNet;
 
 STATIC_FACTORY_DEFINITIONS(TCPInterface, TCPInterface)
 
+// Accepted sockets inherit the options of the listen socket, so only make it nonblocking.
+// SocketLayer::SetSocketOptions() is for UDP. Its fixed SO_SNDBUF of 16K turns off the buffer autotuning of the system, which held sends to about 2 MB/s.
+static void SetListenSocketOptions(__TCPSOCKET__ listenSocket)
+{
+#ifdef _WIN32
+    unsigned long nonblocking = 1;
+    ioctlsocket__(listenSocket, FIONBIO, &nonblocking);
+#else
+    fcntl(listenSocket, F_SETFL, fcntl(listenSocket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+#if TCP_INTERFACE_GATHER_SEND==1
+// Vectors per sendmsg()
+static const int MAX_SEND_VECTORS = 64;
+// Each vector costs the system more than copying a chunk smaller than this, so these are copied together
+static const unsigned int GATHER_COPY_BYTES = 4096;
+#endif
+#if TCP_INTERFACE_ZERO_COPY==1
+// Pinning the pages of a smaller send costs more than copying it
+static const unsigned int ZERO_COPY_MIN_BYTES = 16384;
+#endif
+
+// With framedReceive, the rest of a message at least this long is read directly into it. A shorter rest is read with what follows it, saving a call.
+static const unsigned int FRAME_DIRECT_READ_BYTES = 16384;
+// With framedReceive, ID_DOWNLOAD_PROGRESS is returned each time this much more of a message arrived
+static const unsigned int FRAME_PROGRESS_BYTES = 65536;
+
+#if TCP_INTERFACE_USE_EPOLL==1
+// epoll_event::data of the sockets that are not connections
+static const uint64_t EPOLL_LISTEN_SOCKET = (uint64_t) -1;
+static const uint64_t EPOLL_WAKE_EVENT = (uint64_t) -2;
+// Each connection is reported as its slot and socket, so a stale report for a slot that now has another socket is ignored
+static inline uint64_t EpollKey(unsigned int index, __TCPSOCKET__ socket) {return ((uint64_t) index << 32) | (uint32_t) socket;}
+// Reads of a connection per wait, so one busy connection does not hold up the others
+static const int MAX_READS_PER_WAIT = 4;
+static void SetNonBlocking(__TCPSOCKET__ s)
+{
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+}
+#endif
+
 TCPInterface::TCPInterface()
 {
     isStarted = 0;
@@ -66,6 +133,14 @@ TCPInterface::TCPInterface()
     listenSocket = 0;
     remoteClients = 0;
     remoteClientsLength = 0;
+    scheduledRemoteClients = 0;
+    framedReceive = false;
+    maxFramedMessageLength = PACKETIZED_TCP_MAX_MESSAGE_LENGTH;
+    incomingPacketsOverflowSize = 0;
+#if TCP_INTERFACE_USE_EPOLL==1
+    epollFd = -1;
+    wakeEventFd = -1;
+#endif
 
 #if OPEN_SSL_CLIENT_SUPPORT == 1
     ctx = 0;
@@ -107,7 +182,7 @@ bool TCPInterface::CreateListenSocket(unsigned short port, unsigned short maxInc
 
     serverAddress.sin_port = htons(port);
 
-    SocketLayer::SetSocketOptions(listenSocket, false, false);
+    SetListenSocketOptions(listenSocket);
 
     if (bind__(listenSocket, (struct sockaddr *) &serverAddress, sizeof(serverAddress)) < 0)
         return false;
@@ -144,7 +219,7 @@ bool TCPInterface::CreateListenSocket(unsigned short port, unsigned short maxInc
     if (listenSocket == 0)
         return false;
 
-    SocketLayer::SetSocketOptions(listenSocket, false, false);
+    SetListenSocketOptions(listenSocket);
 
     listen__(listenSocket, maxIncomingConnections);
 #endif // #if RAKNET_SUPPORT_IPV6!=1
@@ -182,12 +257,37 @@ bool TCPInterface::Start(unsigned short port, unsigned short maxIncomingConnecti
 
     remoteClientsLength = maxConnections;
     remoteClients = new RemoteClient[maxConnections];
-
+    // Lowest index first
+    freeRemoteClients.Clear(true, _FILE_AND_LINE_);
+    freeRemoteClients.Preallocate(maxConnections, _FILE_AND_LINE_);
+    for (int i = maxConnections - 1; i >= 0; i--)
+        freeRemoteClients.Push((unsigned short) i, _FILE_AND_LINE_);
+    scheduledRemoteClients = 0;
+
+#if TCP_INTERFACE_USE_EPOLL==1
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    RakAssert(epollFd != -1 && wakeEventFd != -1);
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = EPOLL_WAKE_EVENT;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeEventFd, &ev);
+#endif
 
     listenSocket = 0;
     if (maxIncomingConnections > 0)
         CreateListenSocket(port, maxIncomingConnections, socketFamily, bindAddress);
 
+#if TCP_INTERFACE_USE_EPOLL==1
+    if (listenSocket != 0)
+    {
+        // Accepted until EAGAIN, which CreateListenSocket() made possible by making it nonblocking
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.u64 = EPOLL_LISTEN_SOCKET;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSocket, &ev);
+    }
+#endif
+
 
     // Start the update thread
     int errorCode = RakNet::RakThread::Create(UpdateTCPInterfaceLoop, this, threadPriority);
@@ -239,6 +339,10 @@ void TCPInterface::Stop(void)
         closesocket__(blockingSocketList[i]);
     blockingSocketListMutex.Unlock();
 
+#if TCP_INTERFACE_USE_EPOLL==1
+    WakeUpdateThread();
+#endif
+
     // Wait for the thread to stop
     while (threadRunning > 0)
         RakSleep(15);
@@ -250,7 +354,8 @@ void TCPInterface::Stop(void)
     // Stuff from here on to the end of the function is not threadsafe
     for (unsigned int i = 0; i < (unsigned int) remoteClientsLength; i++)
     {
-        closesocket__(remoteClients[i].socket);
+        if (remoteClients[i].socket != 0)
+            closesocket__(remoteClients[i].socket);
 #if OPEN_SSL_CLIENT_SUPPORT == 1
         remoteClients[i].FreeSSL();
 #endif
@@ -258,7 +363,19 @@ void TCPInterface::Stop(void)
     remoteClientsLength = 0;
     delete[] remoteClients;
     remoteClients = 0;
+    freeRemoteClients.Clear(false, _FILE_AND_LINE_);
+    scheduledRemoteClients = 0;
+
+#if TCP_INTERFACE_USE_EPOLL==1
+    close(epollFd);
+    close(wakeEventFd);
+    epollFd = -1;
+    wakeEventFd = -1;
+#endif
 
+    Packet *packet;
+    while ((packet = PopIncomingPacket()) != 0)
+        DeallocatePacket(packet);
     incomingMessages.Clear(_FILE_AND_LINE_);
     newIncomingConnections.Clear(_FILE_AND_LINE_);
     newRemoteClients.Clear(_FILE_AND_LINE_);
@@ -290,19 +407,7 @@ TCPInterface::Connect(const char *host, unsigned short remotePort, bool block, u
     if (threadRunning == 0)
         return UNASSIGNED_SYSTEM_ADDRESS;
 
-    int newRemoteClientIndex;
-    for (newRemoteClientIndex = 0; newRemoteClientIndex < remoteClientsLength; newRemoteClientIndex++)
-    {
-        auto &newRemoteClient = remoteClients[newRemoteClientIndex];
-        newRemoteClient.isActiveMutex.Lock();
-        if (!remoteClients[newRemoteClientIndex].isActive)
-        {
-            newRemoteClient.SetActive(true);
-            newRemoteClient.isActiveMutex.Unlock();
-            break;
-        }
-        newRemoteClient.isActiveMutex.Unlock();
-    }
+    int newRemoteClientIndex = AllocateRemoteClient();
     if (newRemoteClientIndex == -1)
         return UNASSIGNED_SYSTEM_ADDRESS;
 
@@ -319,9 +424,7 @@ TCPInterface::Connect(const char *host, unsigned short remotePort, bool block, u
         __TCPSOCKET__ sockfd = SocketConnect(buffout, remotePort, socketFamily, bindAddress);
         if (sockfd == 0)
         {
-            newRemoteClient.isActiveMutex.Lock();
-            newRemoteClient.SetActive(false);
-            newRemoteClient.isActiveMutex.Unlock();
+            DeactivateRemoteClient(&newRemoteClient);
 
             failedConnectionAttemptMutex.Lock();
             failedConnectionAttempts.Push(systemAddress, _FILE_AND_LINE_);
@@ -330,8 +433,18 @@ TCPInterface::Connect(const char *host, unsigned short remotePort, bool block, u
             return UNASSIGNED_SYSTEM_ADDRESS;
         }
 
+        // Closed while connecting
+        newRemoteClient.isActiveMutex.Lock();
+        if (newRemoteClient.isActive == false)
+        {
+            newRemoteClient.isActiveMutex.Unlock();
+            closesocket__(sockfd);
+            return UNASSIGNED_SYSTEM_ADDRESS;
+        }
         newRemoteClient.socket = sockfd;
         newRemoteClient.systemAddress = systemAddress;
+        newRemoteClient.isActiveMutex.Unlock();
+        RegisterRemoteClientSocket(&newRemoteClient);
 
         completedConnectionAttemptMutex.Lock();
         completedConnectionAttempts.Push(newRemoteClient.systemAddress, _FILE_AND_LINE_);
@@ -356,8 +469,11 @@ TCPInterface::Connect(const char *host, unsigned short remotePort, bool block, u
 
         if (errorCode != 0)
         {
-            delete s;
+            DeactivateRemoteClient(&remoteClients[newRemoteClientIndex]);
+            failedConnectionAttemptMutex.Lock();
             failedConnectionAttempts.Push(s->systemAddress, _FILE_AND_LINE_);
+            failedConnectionAttemptMutex.Unlock();
+            delete s;
         }
         return UNASSIGNED_SYSTEM_ADDRESS;
     }
@@ -380,6 +496,9 @@ void TCPInterface::StartSSLClient(SystemAddress systemAddress)
     SystemAddress *id = startSSL.Allocate( _FILE_AND_LINE_ );
     *id=systemAddress;
     startSSL.Push(id);
+#if TCP_INTERFACE_USE_EPOLL==1
+    WakeUpdateThread();
+#endif
     unsigned index = activeSSLConnections.GetIndexOf(systemAddress);
     if (index==(unsigned)-1)
         activeSSLConnections.Insert(systemAddress,_FILE_AND_LINE_);
@@ -418,8 +537,8 @@ bool TCPInterface::SendList(const char **data, const unsigned int *lengths, cons
         // Send to all, possible exception system
         for (int i = 0; i < remoteClientsLength; i++)
         {
-            if (remoteClients[i].systemAddress != systemAddress)
-                remoteClients[i].SendOrBuffer(data, lengths, numParameters);
+            if (remoteClients[i].systemAddress != systemAddress && remoteClients[i].SendOrBuffer(data, lengths, numParameters))
+                ScheduleRemoteClient(&remoteClients[i]);
         }
     }
     else
@@ -427,13 +546,16 @@ bool TCPInterface::SendList(const char **data, const unsigned int *lengths, cons
         // Send to this player
         const SystemIndex &si = systemAddress.systemIndex;
         if (si < remoteClientsLength && remoteClients[si].systemAddress == systemAddress)
-            remoteClients[si].SendOrBuffer(data, lengths, numParameters);
+        {
+            if (remoteClients[si].SendOrBuffer(data, lengths, numParameters))
+                ScheduleRemoteClient(&remoteClients[si]);
+        }
         else
         {
             for (int i = 0; i < remoteClientsLength; i++)
             {
-                if (remoteClients[i].systemAddress == systemAddress)
-                    remoteClients[i].SendOrBuffer(data, lengths, numParameters);
+                if (remoteClients[i].systemAddress == systemAddress && remoteClients[i].SendOrBuffer(data, lengths, numParameters))
+                    ScheduleRemoteClient(&remoteClients[i]);
             }
         }
     }
@@ -441,9 +563,61 @@ bool TCPInterface::SendList(const char **data, const unsigned int *lengths, cons
     return true;
 }
 
+char *TCPInterface::AllocateSendBuffer(unsigned int length)
+{
+    // The buffer is the data of a chunk, so it is queued as it is
+    if (length > (size_t) -1 - sizeof(OutgoingChunk))
+        return 0;
+    OutgoingChunk *chunk = (OutgoingChunk *) malloc(sizeof(OutgoingChunk) + length);
+    if (chunk == 0)
+        return 0;
+    chunk->length = length;
+    return chunk->Data();
+}
+
+bool TCPInterface::SendBuffer(char *buffer, unsigned int length, const SystemAddress &systemAddress)
+{
+    OutgoingChunk *chunk = (OutgoingChunk *) (buffer - sizeof(OutgoingChunk));
+    RakAssert(length <= chunk->length);
+    chunk->length = length;
+
+    RemoteClient *remoteClient = 0;
+    if (isStarted != 0 && length > 0 && systemAddress != UNASSIGNED_SYSTEM_ADDRESS)
+    {
+        const SystemIndex &si = systemAddress.systemIndex;
+        if (si < remoteClientsLength && remoteClients[si].systemAddress == systemAddress)
+            remoteClient = &remoteClients[si];
+        else
+        {
+            for (int i = 0; i < remoteClientsLength; i++)
+            {
+                if (remoteClients[i].isActive && remoteClients[i].systemAddress == systemAddress)
+                {
+                    remoteClient = &remoteClients[i];
+                    break;
+                }
+            }
+        }
+    }
+
+    if (remoteClient == 0 || remoteClient->PushOutgoing(chunk) == false)
+    {
+        free(chunk);
+        return false;
+    }
+    ScheduleRemoteClient(remoteClient);
+    return true;
+}
+
+void TCPInterface::DeallocateSendBuffer(char *buffer)
+{
+    if (buffer)
+        free(buffer - sizeof(OutgoingChunk));
+}
+
 bool TCPInterface::ReceiveHasPackets(void)
 {
-    return !headPush.IsEmpty() || !incomingMessages.IsEmpty() || !tailPush.IsEmpty();
+    return !headPush.IsEmpty() || !incomingPackets.IsEmpty() || incomingPacketsOverflowSize > 0 || !tailPush.IsEmpty();
 }
 
 Packet *TCPInterface::Receive(void)
@@ -480,9 +654,18 @@ Packet *TCPInterface::ReceiveInt(void)
         return 0;
     if (!headPush.IsEmpty())
         return headPush.Pop();
-    Packet *p = incomingMessages.PopInaccurate();
-    if (p)
-        return p;
+    Packet *p;
+    while ((p = PopIncomingPacket()) != 0)
+    {
+        if (p->data != 0)
+            return p;
+
+        // A lost connection. Plugins are told now that the data received before it was returned,
+        // and before any data that follows, which may be from the next connection in its slot.
+        for (unsigned int i = 0; i < messageHandlerList.Size(); i++)
+            messageHandlerList[i]->OnClosedConnection(p->systemAddress, UNASSIGNED_RAKNET_GUID, LCR_DISCONNECTION_NOTIFICATION);
+        incomingMessages.Deallocate(p, _FILE_AND_LINE_);
+    }
     if (!tailPush.IsEmpty())
         return tailPush.Pop();
     return 0;
@@ -528,22 +711,17 @@ void TCPInterface::CloseConnection(SystemAddress systemAddress)
     if (systemAddress.systemIndex < remoteClientsLength &&
         remoteClients[systemAddress.systemIndex].systemAddress == systemAddress)
     {
-        remoteClients[systemAddress.systemIndex].isActiveMutex.Lock();
-        remoteClients[systemAddress.systemIndex].SetActive(false);
-        remoteClients[systemAddress.systemIndex].isActiveMutex.Unlock();
+        DeactivateRemoteClient(&remoteClients[systemAddress.systemIndex]);
     }
     else
     {
         for (int i = 0; i < remoteClientsLength; i++)
         {
-            remoteClients[i].isActiveMutex.Lock();
             if (remoteClients[i].isActive && remoteClients[i].systemAddress == systemAddress)
             {
-                remoteClients[systemAddress.systemIndex].SetActive(false);
-                remoteClients[i].isActiveMutex.Unlock();
+                DeactivateRemoteClient(&remoteClients[i]);
                 break;
             }
-            remoteClients[i].isActiveMutex.Unlock();
         }
     }
 
@@ -659,16 +837,13 @@ SystemAddress TCPInterface::HasNewIncomingConnection(void)
 
 SystemAddress TCPInterface::HasLostConnection(void)
 {
+    // Plugins are told when Receive() reaches the loss
     SystemAddress *out = lostConnections.PopInaccurate();
     if (out)
     {
         SystemAddress out2 = *out;
         lostConnections.Deallocate(out, _FILE_AND_LINE_);
-
-        for (unsigned int i = 0; i < messageHandlerList.Size(); i++)
-            messageHandlerList[i]->OnClosedConnection(out2, UNASSIGNED_RAKNET_GUID, LCR_DISCONNECTION_NOTIFICATION);
-
-        return *out;
+        return out2;
     }
 
     return UNASSIGNED_SYSTEM_ADDRESS;
@@ -708,20 +883,13 @@ unsigned int TCPInterface::GetOutgoingDataBufferSize(SystemAddress systemAddress
         remoteClients[systemAddress.systemIndex].isActive &&
         remoteClients[systemAddress.systemIndex].systemAddress == systemAddress)
     {
-        remoteClients[systemAddress.systemIndex].outgoingDataMutex.Lock();
-        bytesWritten = remoteClients[systemAddress.systemIndex].outgoingData.GetBytesWritten();
-        remoteClients[systemAddress.systemIndex].outgoingDataMutex.Unlock();
-        return bytesWritten;
+        return remoteClients[systemAddress.systemIndex].outgoingBytes.load(std::memory_order_relaxed);
     }
 
     for (int i = 0; i < remoteClientsLength; i++)
     {
         if (remoteClients[i].isActive && remoteClients[i].systemAddress == systemAddress)
-        {
-            remoteClients[i].outgoingDataMutex.Lock();
-            bytesWritten += remoteClients[i].outgoingData.GetBytesWritten();
-            remoteClients[i].outgoingDataMutex.Unlock();
-        }
+            bytesWritten += remoteClients[i].outgoingBytes.load(std::memory_order_relaxed);
     }
     return bytesWritten;
 }
@@ -809,16 +977,17 @@ RAK_THREAD_DECLARATION(RakNet::ConnectionAttemptLoop)
     TCPInterface *tcpInterface = s->tcpInterface;
     const int newRemoteClientIndex = systemAddress.systemIndex;
     const unsigned short socketFamily = s->socketFamily;
+    char bindAddress[64];
+    strcpy(bindAddress, s->bindAddress);
     delete s;
 
     char str1[64];
     systemAddress.ToString(false, str1);
-    __TCPSOCKET__ sockfd = tcpInterface->SocketConnect(str1, systemAddress.GetPort(), socketFamily, s->bindAddress);
+    RemoteClient *newRemoteClient = &tcpInterface->remoteClients[newRemoteClientIndex];
+    __TCPSOCKET__ sockfd = tcpInterface->SocketConnect(str1, systemAddress.GetPort(), socketFamily, bindAddress);
     if (sockfd == 0)
     {
-        tcpInterface->remoteClients[newRemoteClientIndex].isActiveMutex.Lock();
-        tcpInterface->remoteClients[newRemoteClientIndex].SetActive(false);
-        tcpInterface->remoteClients[newRemoteClientIndex].isActiveMutex.Unlock();
+        tcpInterface->DeactivateRemoteClient(newRemoteClient);
 
         tcpInterface->failedConnectionAttemptMutex.Lock();
         tcpInterface->failedConnectionAttempts.Push(systemAddress, _FILE_AND_LINE_);
@@ -826,8 +995,18 @@ RAK_THREAD_DECLARATION(RakNet::ConnectionAttemptLoop)
         return 0;
     }
 
-    tcpInterface->remoteClients[newRemoteClientIndex].socket = sockfd;
-    tcpInterface->remoteClients[newRemoteClientIndex].systemAddress = systemAddress;
+    // Closed while connecting
+    newRemoteClient->isActiveMutex.Lock();
+    if (newRemoteClient->isActive == false)
+    {
+        newRemoteClient->isActiveMutex.Unlock();
+        closesocket__(sockfd);
+        return 0;
+    }
+    newRemoteClient->socket = sockfd;
+    newRemoteClient->systemAddress = systemAddress;
+    newRemoteClient->isActiveMutex.Unlock();
+    tcpInterface->RegisterRemoteClientSocket(newRemoteClient);
 
     // Notify user that the connection attempt has completed.
     if (tcpInterface->threadRunning > 0)
@@ -840,6 +1019,23 @@ RAK_THREAD_DECLARATION(RakNet::ConnectionAttemptLoop)
 
 }
 
+// Fills in the address of a connection that was accepted
+static void SetAcceptedAddress(RemoteClient *remoteClient, int index, const void *sockAddr)
+{
+#if RAKNET_SUPPORT_IPV6 != 1
+    const sockaddr_in *sockAddr4 = (const sockaddr_in *) sockAddr;
+    remoteClient->systemAddress.address.addr4.sin_addr.s_addr = sockAddr4->sin_addr.s_addr;
+    remoteClient->systemAddress.SetPortNetworkOrder(sockAddr4->sin_port);
+    remoteClient->systemAddress.systemIndex = index;
+#else
+    if (((const sockaddr_storage *) sockAddr)->ss_family==AF_INET)
+        memcpy(&remoteClient->systemAddress.address.addr4,sockAddr,sizeof(sockaddr_in));
+    else
+        memcpy(&remoteClient->systemAddress.address.addr6,sockAddr,sizeof(sockaddr_in6));
+    remoteClient->systemAddress.systemIndex = index;
+#endif // #if RAKNET_SUPPORT_IPV6!=1
+}
+
 RAK_THREAD_DECLARATION(RakNet::UpdateTCPInterfaceLoop)
 {
 //    const int BUFF_SIZE=8096;
@@ -847,6 +1043,12 @@ RAK_THREAD_DECLARATION(RakNet::UpdateTCPInterfaceLoop)
     const unsigned int BUFF_SIZE = 1048576;
     char *data = (char *) malloc(BUFF_SIZE);
 
+#if TCP_INTERFACE_USE_EPOLL == 1
+    // Connections that were not read dry in their turn. Being edge triggered, they are not reported again until they are.
+    DataStructures::List<uint64_t> stillReadable, readable;
+    const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+#else
 #if RAKNET_SUPPORT_IPV6 != 1
     sockaddr_in sockAddr;
     int sockAddrSize = sizeof(sockAddr);
@@ -858,6 +1060,7 @@ RAK_THREAD_DECLARATION(RakNet::UpdateTCPInterfaceLoop)
     timeval tv;
     tv.tv_sec = 0;
     tv.tv_usec = 30000;
+#endif
 
     TCPInterface *sts = (TCPInterface *) arguments;
     sts->threadRunning++;
@@ -891,6 +1094,73 @@ RAK_THREAD_DECLARATION(RakNet::UpdateTCPInterfaceLoop)
         }
 #endif
 
+#if TCP_INTERFACE_USE_EPOLL == 1
+        // Whatever gives this thread work wakes it, so the timeout is only a backstop
+        int numEvents = epoll_wait(sts->epollFd, events, MAX_EVENTS, stillReadable.Size() > 0 ? 0 : 1000);
+
+        readable.Clear(true, _FILE_AND_LINE_);
+        for (unsigned int i = 0; i < stillReadable.Size(); i++)
+            readable.Push(stillReadable[i], _FILE_AND_LINE_);
+        stillReadable.Clear(true, _FILE_AND_LINE_);
+
+        for (int i = 0; i < numEvents; i++)
+        {
+            uint64_t key = events[i].data.u64;
+            if (key == EPOLL_WAKE_EVENT)
+            {
+                uint64_t count;
+                ssize_t bytesRead = read(sts->wakeEventFd, &count, sizeof(count));
+                (void) bytesRead;
+                continue;
+            }
+            if (key == EPOLL_LISTEN_SOCKET)
+            {
+                sts->AcceptConnections();
+                continue;
+            }
+#if TCP_INTERFACE_ZERO_COPY == 1
+            // Completions of MSG_ZEROCOPY sends, which a closed connection waits for before it is released
+            if (events[i].events & EPOLLERR)
+            {
+                RemoteClient *closingClient = sts->GetRemoteClient(key, true);
+                if (closingClient != 0 && closingClient->zeroCopyNext != closingClient->zeroCopyCompleted)
+                {
+                    closingClient->ReadZeroCopyCompletions();
+                    if (closingClient->isActive == false)
+                        sts->ReleaseRemoteClient(closingClient);
+                }
+            }
+#endif
+            RemoteClient *rc = sts->GetRemoteClient(key);
+            if (rc == 0)
+                continue;
+            if (events[i].events & EPOLLOUT)
+                sts->FlushOutgoing(rc, data, BUFF_SIZE);
+            if (events[i].events & (EPOLLRDHUP | EPOLLHUP))
+                rc->peerClosed = true;
+            if (events[i].events & EPOLLERR)
+            {
+                // With MSG_ZEROCOPY, EPOLLERR also reports completions on a healthy socket, which were read above.
+                // Only a pending socket error closes the connection.
+                int socketError = 0;
+                socklen_t socketErrorLength = sizeof(socketError);
+                if (getsockopt(rc->socket, SOL_SOCKET, SO_ERROR, (char *) &socketError, &socketErrorLength) != 0 || socketError != 0)
+                    rc->peerClosed = true;
+            }
+            if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) || rc->peerClosed)
+                readable.Push(key, _FILE_AND_LINE_);
+        }
+
+        // After the wake event was read, so a push made after the stack is taken wakes the next wait
+        sts->ProcessScheduledRemoteClients(data, BUFF_SIZE);
+
+        for (unsigned int i = 0; i < readable.Size(); i++)
+        {
+            RemoteClient *rc = sts->GetRemoteClient(readable[i]);
+            if (rc != 0 && sts->ReadRemoteClient(rc, data, BUFF_SIZE))
+                stillReadable.Push(readable[i], _FILE_AND_LINE_);
+        }
+#else
         // Linux' select__() implementation changes the timeout
         tv.tv_sec = 0;
         tv.tv_usec = 30000;
@@ -902,6 +1172,9 @@ RAK_THREAD_DECLARATION(RakNet::UpdateTCPInterfaceLoop)
         fd_set readFD, exceptionFD, writeFD;
         while (1)
         {
+            // Close connections that were closed by another thread
+            sts->ProcessScheduledRemoteClients(data, BUFF_SIZE);
+
             // Reset readFD, writeFD, and exceptionFD since select seems to clear it
             FD_ZERO(&readFD);
             FD_ZERO(&exceptionFD);
@@ -919,13 +1192,13 @@ RAK_THREAD_DECLARATION(RakNet::UpdateTCPInterfaceLoop)
                 sts->remoteClients[i].isActiveMutex.Lock();
                 if (sts->remoteClients[i].isActive)
                 {
-                    // calling FD_ISSET with -1 as socket (that�s what 0 is set to) produces a bus error under Linux 64-Bit
+                    // calling FD_ISSET with -1 as socket (that's what 0 is set to) produces a bus error under Linux 64-Bit
                     __TCPSOCKET__ socketCopy = sts->remoteClients[i].socket;
                     if (socketCopy != 0)
                     {
                         FD_SET(socketCopy, &readFD);
                         FD_SET(socketCopy, &exceptionFD);
-                        if (sts->remoteClients[i].outgoingData.GetBytesWritten() > 0)
+                        if (sts->remoteClients[i].HasOutgoingData())
                             FD_SET(socketCopy, &writeFD);
                         if (socketCopy > largestDescriptor) // @see largestDescriptorDef
                             largestDescriptor = socketCopy;
@@ -943,49 +1216,24 @@ RAK_THREAD_DECLARATION(RakNet::UpdateTCPInterfaceLoop)
 
             if (sts->listenSocket != 0 && FD_ISSET(sts->listenSocket, &readFD))
             {
+                sockAddrSize = sizeof(sockAddr);
                 __TCPSOCKET__ newSock = accept__(sts->listenSocket, (sockaddr *) &sockAddr, (socklen_t *) &sockAddrSize);
 
                 if (newSock != 0)
                 {
-                    int newRemoteClientIndex;
-                    for (newRemoteClientIndex = 0; newRemoteClientIndex < sts->remoteClientsLength; newRemoteClientIndex++)
+                    int newRemoteClientIndex = sts->AllocateRemoteClient();
+                    if (newRemoteClientIndex == -1)
+                        closesocket__(newSock);
+                    else
                     {
-                        auto &newRemoteClient = sts->remoteClients[newRemoteClientIndex];
-                        newRemoteClient.isActiveMutex.Lock();
-                        if (!newRemoteClient.isActive)
-                        {
-                            newRemoteClient.socket = newSock;
+                        RemoteClient &newRemoteClient = sts->remoteClients[newRemoteClientIndex];
+                        newRemoteClient.socket = newSock;
+                        SetAcceptedAddress(&newRemoteClient, newRemoteClientIndex, &sockAddr);
 
-#if RAKNET_SUPPORT_IPV6 != 1
-                            newRemoteClient.systemAddress.address.addr4.sin_addr.s_addr = sockAddr.sin_addr.s_addr;
-                            newRemoteClient.systemAddress.SetPortNetworkOrder(sockAddr.sin_port);
-                            newRemoteClient.systemAddress.systemIndex = newRemoteClientIndex;
-#else
-                            if (sockAddr.ss_family==AF_INET)
-                            {
-                                memcpy(&newRemoteClient.systemAddress.address.addr4,(sockaddr_in *)&sockAddr,sizeof(sockaddr_in));
-                            //    newRemoteClient.systemAddress.address.addr4.sin_port=ntohs( newRemoteClient.systemAddress.address.addr4.sin_port );
-                            }
-                            else
-                            {
-                                memcpy(&newRemoteClient.systemAddress.address.addr6,(sockaddr_in6 *)&sockAddr,sizeof(sockaddr_in6));
-                            //    newRemoteClient.systemAddress.address.addr6.sin6_port=ntohs( newRemoteClient.systemAddress.address.addr6.sin6_port );
-                            }
-
-#endif // #if RAKNET_SUPPORT_IPV6!=1
-                            newRemoteClient.SetActive(true);
-                            newRemoteClient.isActiveMutex.Unlock();
-
-                            SystemAddress *newConnectionSystemAddress = sts->newIncomingConnections.Allocate(_FILE_AND_LINE_);
-                            *newConnectionSystemAddress = newRemoteClient.systemAddress;
-                            sts->newIncomingConnections.Push(newConnectionSystemAddress);
-
-                            break;
-                        }
-                        newRemoteClient.isActiveMutex.Unlock();
+                        SystemAddress *newConnectionSystemAddress = sts->newIncomingConnections.Allocate(_FILE_AND_LINE_);
+                        *newConnectionSystemAddress = newRemoteClient.systemAddress;
+                        sts->newIncomingConnections.Push(newConnectionSystemAddress);
                     }
-                    if (newRemoteClientIndex == -1)
-                        closesocket__(sts->listenSocket);
                 }
 #ifdef _DO_PRINTF
                 else
@@ -1017,72 +1265,33 @@ RAK_THREAD_DECLARATION(RakNet::UpdateTCPInterfaceLoop)
                     continue;
                 }
 
+                RemoteClient *rc = &sts->remoteClients[i];
                 if (FD_ISSET(socketCopy, &exceptionFD))
                 {
                     // Connection lost abruptly
-                    SystemAddress *lostConnectionSystemAddress = sts->lostConnections.Allocate(_FILE_AND_LINE_);
-                    *lostConnectionSystemAddress = sts->remoteClients[i].systemAddress;
-                    sts->lostConnections.Push(lostConnectionSystemAddress);
-                    sts->remoteClients[i].isActiveMutex.Lock();
-                    sts->remoteClients[i].SetActive(false);
-                    sts->remoteClients[i].isActiveMutex.Unlock();
+                    sts->PushLostConnection(rc);
+                    sts->DeactivateRemoteClient(rc);
+                    sts->ReleaseRemoteClient(rc);
                 }
                 else
                 {
                     if (FD_ISSET(socketCopy, &readFD))
                     {
                         // if recv returns 0 this was a graceful close
-                        int len = sts->remoteClients[i].Recv(data, BUFF_SIZE);
+                        unsigned int requested;
+                        int len = sts->ReceiveIncoming(rc, data, BUFF_SIZE, &requested);
 
-                        if (len > 0)
-                        {
-                            Packet *incomingMessage = sts->incomingMessages.Allocate(_FILE_AND_LINE_);
-                            incomingMessage->data = (unsigned char *) malloc(len + 1);
-                            memcpy(incomingMessage->data, data, len);
-                            // Null terminate this so we can print it out as regular strings.  This is different from RakNet which does not do this.
-                            incomingMessage->data[len] = 0;
-
-                            incomingMessage->length = len;
-                            incomingMessage->deleteData = true; // actually means came from SPSC, rather than AllocatePacket
-                            incomingMessage->systemAddress = sts->remoteClients[i].systemAddress;
-                            sts->incomingMessages.Push(incomingMessage);
-                        }
-                        else
+                        if (len <= 0)
                         {
                             // Connection lost gracefully
-                            SystemAddress *lostConnectionSystemAddress = sts->lostConnections.Allocate(_FILE_AND_LINE_);
-                            *lostConnectionSystemAddress = sts->remoteClients[i].systemAddress;
-                            sts->lostConnections.Push(lostConnectionSystemAddress);
-                            sts->remoteClients[i].isActiveMutex.Lock();
-                            sts->remoteClients[i].SetActive(false);
-                            sts->remoteClients[i].isActiveMutex.Unlock();
+                            sts->PushLostConnection(rc);
+                            sts->DeactivateRemoteClient(rc);
+                            sts->ReleaseRemoteClient(rc);
                             continue;
                         }
                     }
                     if (FD_ISSET(socketCopy, &writeFD))
-                    {
-                        RemoteClient *rc = &sts->remoteClients[i];
-                        rc->outgoingDataMutex.Lock();
-                        unsigned int bytesInBuffer = rc->outgoingData.GetBytesWritten();
-                        if (bytesInBuffer > 0)
-                        {
-                            unsigned int bytesSent;
-                            unsigned int contiguousLength;
-                            char *contiguousBytesPointer = rc->outgoingData.PeekContiguousBytes(&contiguousLength);
-                            if (contiguousLength < BUFF_SIZE && contiguousLength < bytesInBuffer)
-                            {
-                                unsigned int bytesAvailable = bytesInBuffer > BUFF_SIZE ? BUFF_SIZE : bytesInBuffer;
-                                rc->outgoingData.ReadBytes(data, bytesAvailable, true);
-                                bytesSent = rc->Send(data, bytesAvailable);
-                            }
-                            else
-                                bytesSent = rc->Send(contiguousBytesPointer, contiguousLength);
-
-                            if (bytesSent > 0)
-                                rc->outgoingData.IncrementReadOffset(bytesSent);
-                        }
-                        rc->outgoingDataMutex.Unlock();
-                    }
+                        sts->FlushOutgoing(rc, data, BUFF_SIZE);
 
                     i++; // Nothing deleted so increment the index
                 }
@@ -1091,6 +1300,7 @@ RAK_THREAD_DECLARATION(RakNet::UpdateTCPInterfaceLoop)
 
         // Sleep 0 on Linux monopolizes the CPU
         RakSleep(30);
+#endif // TCP_INTERFACE_USE_EPOLL
     }
     sts->threadRunning--;
 
@@ -1100,51 +1310,767 @@ RAK_THREAD_DECLARATION(RakNet::UpdateTCPInterfaceLoop)
 
 }
 
-void RemoteClient::SetActive(bool a)
+int TCPInterface::AllocateRemoteClient(void)
+{
+    freeRemoteClientsMutex.Lock();
+    if (freeRemoteClients.Size() == 0)
+    {
+        freeRemoteClientsMutex.Unlock();
+        return -1;
+    }
+    unsigned short index = freeRemoteClients.Pop();
+    freeRemoteClientsMutex.Unlock();
+
+    RemoteClient *remoteClient = &remoteClients[index];
+    // A send that raced the close of the last connection in this slot
+    remoteClient->DiscardOutgoingInbox();
+    remoteClient->isActiveMutex.Lock();
+    remoteClient->isActive = true;
+    remoteClient->isActiveMutex.Unlock();
+    return index;
+}
+
+void TCPInterface::DeactivateRemoteClient(RemoteClient *remoteClient)
+{
+    remoteClient->isActiveMutex.Lock();
+    bool wasActive = remoteClient->isActive;
+    if (wasActive)
+    {
+        remoteClient->isActive = false;
+        remoteClient->closing = true;
+    }
+    remoteClient->isActiveMutex.Unlock();
+
+    if (wasActive)
+        ScheduleRemoteClient(remoteClient);
+}
+
+void TCPInterface::ScheduleRemoteClient(RemoteClient *remoteClient)
+{
+    // Already on the stack, and the update thread has not yet cleared the flag, so it will see what was pushed
+    if (remoteClient->scheduled.exchange(true))
+        return;
+    RemoteClient *head = scheduledRemoteClients.load(std::memory_order_relaxed);
+    do
+    {
+        remoteClient->nextScheduled = head;
+    } while (!scheduledRemoteClients.compare_exchange_weak(head, remoteClient));
+
+#if TCP_INTERFACE_USE_EPOLL == 1
+    // Otherwise whoever pushed onto the empty stack woke the thread, and it has not taken the stack yet
+    if (head == 0)
+        WakeUpdateThread();
+#endif
+}
+
+void TCPInterface::RegisterRemoteClientSocket(RemoteClient *remoteClient)
+{
+#if TCP_INTERFACE_USE_EPOLL == 1
+    SetNonBlocking(remoteClient->socket);
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = EpollKey((unsigned int) (remoteClient - remoteClients), remoteClient->socket);
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, remoteClient->socket, &ev);
+#endif
+#if TCP_INTERFACE_ZERO_COPY == 1
+    // The system numbers the sends of each socket from 0
+    int enable = 1;
+    remoteClient->zeroCopy = setsockopt__(remoteClient->socket, SOL_SOCKET, SO_ZEROCOPY, (char *) &enable, sizeof(enable)) == 0;
+    remoteClient->zeroCopyNext = 0;
+    remoteClient->zeroCopyCompleted = 0;
+#endif
+
+    // Sends made while connecting were queued with no socket to send them on
+    if (remoteClient->outgoingInbox.load() != 0)
+        ScheduleRemoteClient(remoteClient);
+}
+
+void TCPInterface::ProcessScheduledRemoteClients(char *buffer, unsigned int bufferSize)
+{
+    RemoteClient *remoteClient = scheduledRemoteClients.exchange(0);
+    while (remoteClient)
+    {
+        // Once the flag is cleared, another thread may push it again, changing the link
+        RemoteClient *next = remoteClient->nextScheduled;
+        remoteClient->scheduled.store(false);
+
+        if (remoteClient->isActive == false)
+            ReleaseRemoteClient(remoteClient);
+#if TCP_INTERFACE_USE_EPOLL == 1
+        else if (remoteClient->socket != 0)
+            FlushOutgoing(remoteClient, buffer, bufferSize);
+#else
+        // Sent when select__() says the socket is writable
+        (void) buffer;
+        (void) bufferSize;
+#endif
+        remoteClient = next;
+    }
+}
+
+void TCPInterface::ReleaseRemoteClient(RemoteClient *remoteClient)
+{
+#if TCP_INTERFACE_ZERO_COPY == 1
+    // After close() the system would still send what is in the socket buffer, from chunks that would be freed.
+    // So end the connection once that is sent, and release it when the last send completes.
+    if (remoteClient->zeroCopyNext != remoteClient->zeroCopyCompleted && remoteClient->socket != 0)
+    {
+        if (remoteClient->lingering == false)
+        {
+            remoteClient->lingering = true;
+            shutdown(remoteClient->socket, SHUT_WR);
+        }
+        return;
+    }
+    remoteClient->lingering = false;
+#endif
+
+    remoteClient->isActiveMutex.Lock();
+    if (remoteClient->closing == false)
+    {
+        remoteClient->isActiveMutex.Unlock();
+        return;
+    }
+    remoteClient->closing = false;
+    __TCPSOCKET__ socketCopy = remoteClient->socket;
+    remoteClient->socket = 0;
+    remoteClient->systemAddress = UNASSIGNED_SYSTEM_ADDRESS;
+    remoteClient->isActiveMutex.Unlock();
+
+    // Closing also removes it from epoll
+    if (socketCopy != 0)
+        closesocket__(socketCopy);
+#if OPEN_SSL_CLIENT_SUPPORT == 1
+    remoteClient->FreeSSL();
+    remoteClient->ssl = 0;
+#endif
+    remoteClient->ClearOutgoing();
+    remoteClient->ClearIncomingFrame();
+    remoteClient->writeInterest = false;
+    remoteClient->peerClosed = false;
+
+    freeRemoteClientsMutex.Lock();
+    freeRemoteClients.Push((unsigned short) (remoteClient - remoteClients), _FILE_AND_LINE_);
+    freeRemoteClientsMutex.Unlock();
+}
+
+void TCPInterface::FlushOutgoing(RemoteClient *remoteClient, char *buffer, unsigned int bufferSize)
+{
+    remoteClient->TakeOutgoingInbox();
+    while (remoteClient->outgoingHead)
+    {
+        unsigned int sendLength;
+        bool zeroCopied;
+        int bytesSent = remoteClient->SendQueued(buffer, bufferSize, &sendLength, &zeroCopied);
+        if (bytesSent > 0)
+            remoteClient->ConsumeOutgoing((unsigned int) bytesSent, zeroCopied);
+#if TCP_INTERFACE_USE_EPOLL == 1
+        // The socket buffer is full, or the connection failed, which is reported as a read
+        if (bytesSent < (int) sendLength)
+            break;
+#else
+        // The socket blocks, so send only once each time select__() says it is writable
+        break;
+#endif
+    }
+
+#if TCP_INTERFACE_USE_EPOLL == 1
+    // Watch for room in the socket buffer only while there is something left to send
+    bool wantsWrite = remoteClient->outgoingHead != 0;
+    if (wantsWrite != remoteClient->writeInterest)
+    {
+        remoteClient->writeInterest = wantsWrite;
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (wantsWrite ? (uint32_t) EPOLLOUT : 0u);
+        ev.data.u64 = EpollKey((unsigned int) (remoteClient - remoteClients), remoteClient->socket);
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, remoteClient->socket, &ev);
+    }
+#endif
+}
+
+#if TCP_INTERFACE_USE_EPOLL == 1
+void TCPInterface::AcceptConnections(void)
+{
+#if RAKNET_SUPPORT_IPV6 != 1
+    sockaddr_in sockAddr;
+#else
+    struct sockaddr_storage sockAddr;
+#endif
+
+    // Edge triggered, so take every connection waiting
+    while (1)
+    {
+        socklen_t sockAddrSize = sizeof(sockAddr);
+        __TCPSOCKET__ newSock = accept4(listenSocket, (sockaddr *) &sockAddr, &sockAddrSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (newSock == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // EAGAIN when none are left. Out of descriptors, the rest wait until the next connection arrives.
+            break;
+        }
+
+        int newRemoteClientIndex = AllocateRemoteClient();
+        if (newRemoteClientIndex == -1)
+        {
+            closesocket__(newSock);
+            continue;
+        }
+        RemoteClient *newRemoteClient = &remoteClients[newRemoteClientIndex];
+        newRemoteClient->socket = newSock;
+        SetAcceptedAddress(newRemoteClient, newRemoteClientIndex, &sockAddr);
+        RegisterRemoteClientSocket(newRemoteClient);
+
+        SystemAddress *newConnectionSystemAddress = newIncomingConnections.Allocate(_FILE_AND_LINE_);
+        *newConnectionSystemAddress = newRemoteClient->systemAddress;
+        newIncomingConnections.Push(newConnectionSystemAddress);
+    }
+}
+
+bool TCPInterface::ReadRemoteClient(RemoteClient *remoteClient, char *buffer, unsigned int bufferSize)
 {
-    if (isActive != a)
+    for (int reads = 0; reads < MAX_READS_PER_WAIT; reads++)
     {
-        isActive = a;
-        Reset();
-        if (!isActive && socket != 0)
+        unsigned int requested;
+        int len = ReceiveIncoming(remoteClient, buffer, bufferSize, &requested);
+        if (len > 0)
         {
-            closesocket__(socket);
-            socket = 0;
+            // A short read from a stream socket emptied it, and more data will be reported again.
+            // A close reported with the data is not reported again, so then read on until it is reached.
+#if OPEN_SSL_CLIENT_SUPPORT == 1
+            if (remoteClient->ssl == 0 && (unsigned int) len < requested && remoteClient->peerClosed == false)
+                return false;
+#else
+            if ((unsigned int) len < requested && remoteClient->peerClosed == false)
+                return false;
+#endif
+            continue;
         }
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return false;
+        if (len < 0 && errno == EINTR)
+            continue;
+
+        // 0 is a graceful close
+        PushLostConnection(remoteClient);
+        DeactivateRemoteClient(remoteClient);
+        ReleaseRemoteClient(remoteClient);
+        return false;
     }
+    return true;
 }
 
-void RemoteClient::SendOrBuffer(const char **data, const unsigned int *lengths, const int numParameters)
+RemoteClient *TCPInterface::GetRemoteClient(uint64_t epollKey, bool includeClosing)
 {
-    // True can save memory and buffer copies, but gives worse performance overall
-    // Do not use true for the XBOX, as it just locks up
-    const bool ALLOW_SEND_FROM_USER_THREAD = false;
+    unsigned int index = (unsigned int) (epollKey >> 32);
+    if (index >= (unsigned int) remoteClientsLength)
+        return 0;
+    RemoteClient *remoteClient = &remoteClients[index];
+    if ((remoteClient->isActive == false && (includeClosing == false || remoteClient->closing == false)) || remoteClient->socket == 0 || (uint32_t) remoteClient->socket != (uint32_t) epollKey)
+        return 0;
+    return remoteClient;
+}
 
-    if (!isActive)
+void TCPInterface::WakeUpdateThread(void)
+{
+    uint64_t one = 1;
+    ssize_t bytesWritten = write(wakeEventFd, &one, sizeof(one));
+    (void) bytesWritten;
+}
+#endif // TCP_INTERFACE_USE_EPOLL
+
+void TCPInterface::PushIncomingMessage(RemoteClient *remoteClient, const char *data, int length)
+{
+    Packet *incomingMessage = incomingMessages.Allocate(_FILE_AND_LINE_);
+    incomingMessage->data = (unsigned char *) malloc(length + 1);
+    memcpy(incomingMessage->data, data, length);
+    // Null terminate this so we can print it out as regular strings.  This is different from RakNet which does not do this.
+    incomingMessage->data[length] = 0;
+
+    incomingMessage->length = length;
+    incomingMessage->deleteData = true; // actually means came from SPSC, rather than AllocatePacket
+    incomingMessage->systemAddress = remoteClient->systemAddress;
+    PushIncomingPacket(incomingMessage);
+}
+
+int TCPInterface::ReceiveIncoming(RemoteClient *remoteClient, char *buffer, unsigned int bufferSize, unsigned int *requested)
+{
+    if (framedReceive && remoteClient->frameData != 0 && remoteClient->frameLength - remoteClient->frameBytes >= FRAME_DIRECT_READ_BYTES)
+    {
+        // Read the rest of a long message into it, rather than copying it there from buffer
+        *requested = remoteClient->frameLength - remoteClient->frameBytes;
+        if (*requested > bufferSize)
+            *requested = bufferSize;
+        int len = remoteClient->Recv((char *) remoteClient->frameData + remoteClient->frameBytes, (int) *requested);
+        if (len > 0)
+            AdvanceIncomingFrame(remoteClient, (unsigned int) len);
+        return len;
+    }
+
+    *requested = bufferSize;
+    int len = remoteClient->Recv(buffer, (int) bufferSize);
+    if (len > 0)
+    {
+        if (framedReceive == false)
+            PushIncomingMessage(remoteClient, buffer, len);
+        else if (PushIncomingFrames(remoteClient, buffer, (unsigned int) len) == false)
+            return 0;
+    }
+    return len;
+}
+
+bool TCPInterface::PushIncomingFrames(RemoteClient *remoteClient, const char *data, unsigned int length)
+{
+    while (length > 0)
+    {
+        if (remoteClient->frameData == 0)
+        {
+            // The header may be split across reads
+            unsigned int headerBytes = sizeof(remoteClient->frameHeader) - remoteClient->frameHeaderBytes;
+            if (headerBytes > length)
+                headerBytes = length;
+            memcpy(remoteClient->frameHeader + remoteClient->frameHeaderBytes, data, headerBytes);
+            remoteClient->frameHeaderBytes += headerBytes;
+            data += headerBytes;
+            length -= headerBytes;
+            if (remoteClient->frameHeaderBytes < sizeof(remoteClient->frameHeader))
+                return true;
+            remoteClient->frameHeaderBytes = 0;
+
+            uint32_t frameLength;
+            memcpy(&frameLength, remoteClient->frameHeader, sizeof(frameLength));
+#ifndef __BITSTREAM_NATIVE_END
+            if (RakNet::BitStream::DoEndianSwap())
+                RakNet::BitStream::ReverseBytesInPlace((unsigned char *) &frameLength, sizeof(frameLength));
+#endif
+            // The whole message is allocated now, so do not let the sender choose how much
+            if (frameLength > maxFramedMessageLength.load(std::memory_order_relaxed) || (size_t) frameLength + 1 == 0)
+                return false;
+            // Becomes the data of the packet, so the message is not copied again.
+            // One more byte to null terminate it, as PushIncomingMessage() does.
+            remoteClient->frameData = (unsigned char *) malloc((size_t) frameLength + 1);
+            if (remoteClient->frameData == 0)
+                return false;
+            remoteClient->frameLength = frameLength;
+            remoteClient->frameBytes = 0;
+        }
+
+        unsigned int bytes = remoteClient->frameLength - remoteClient->frameBytes;
+        if (bytes > length)
+            bytes = length;
+        memcpy(remoteClient->frameData + remoteClient->frameBytes, data, bytes);
+        data += bytes;
+        length -= bytes;
+        AdvanceIncomingFrame(remoteClient, bytes);
+    }
+    return true;
+}
+
+void TCPInterface::AdvanceIncomingFrame(RemoteClient *remoteClient, unsigned int bytes)
+{
+    unsigned int oldBytes = remoteClient->frameBytes;
+    remoteClient->frameBytes += bytes;
+    if (remoteClient->frameBytes == remoteClient->frameLength)
+    {
+        Packet *incomingMessage = incomingMessages.Allocate(_FILE_AND_LINE_);
+        incomingMessage->data = remoteClient->frameData;
+        incomingMessage->data[remoteClient->frameLength] = 0;
+        incomingMessage->length = remoteClient->frameLength;
+        incomingMessage->bitSize = BYTES_TO_BITS(remoteClient->frameLength);
+        incomingMessage->deleteData = true;
+        incomingMessage->guid = UNASSIGNED_RAKNET_GUID;
+        incomingMessage->systemAddress = remoteClient->systemAddress;
+        PushIncomingPacket(incomingMessage);
+        remoteClient->frameData = 0;
+        return;
+    }
+
+    // Report a long message as it arrives. As PacketizedTCP always did, the data is the first part of the message, whichever part was just completed
+    if (remoteClient->frameBytes / FRAME_PROGRESS_BYTES == oldBytes / FRAME_PROGRESS_BYTES)
+        return;
+    unsigned int partIndex = remoteClient->frameBytes / FRAME_PROGRESS_BYTES;
+    unsigned int totalParts = remoteClient->frameLength / FRAME_PROGRESS_BYTES;
+    unsigned int oneChunkSize = FRAME_PROGRESS_BYTES;
+    unsigned int progressLength = sizeof(MessageID) + sizeof(unsigned int) * 3 + oneChunkSize;
+    unsigned char *progressData = (unsigned char *) malloc(progressLength);
+    if (progressData == 0)
+    {
+        // Progress is only informational, so skip it rather than lose the message
+        RakAssert(0);
         return;
+    }
+    Packet *progress = incomingMessages.Allocate(_FILE_AND_LINE_);
+    progress->length = progressLength;
+    progress->bitSize = BYTES_TO_BITS(progress->length);
+    progress->data = progressData;
+    progress->data[0] = (MessageID) ID_DOWNLOAD_PROGRESS;
+    memcpy(progress->data + sizeof(MessageID), &partIndex, sizeof(unsigned int));
+    memcpy(progress->data + sizeof(MessageID) + sizeof(unsigned int) * 1, &totalParts, sizeof(unsigned int));
+    memcpy(progress->data + sizeof(MessageID) + sizeof(unsigned int) * 2, &oneChunkSize, sizeof(unsigned int));
+    memcpy(progress->data + sizeof(MessageID) + sizeof(unsigned int) * 3, remoteClient->frameData, oneChunkSize);
+    progress->deleteData = true;
+    progress->guid = UNASSIGNED_RAKNET_GUID;
+    progress->systemAddress = remoteClient->systemAddress;
+    PushIncomingPacket(progress);
+}
+
+void TCPInterface::PushLostConnection(RemoteClient *remoteClient)
+{
+    SystemAddress *lostConnectionSystemAddress = lostConnections.Allocate(_FILE_AND_LINE_);
+    *lostConnectionSystemAddress = remoteClient->systemAddress;
+    lostConnections.Push(lostConnectionSystemAddress);
+
+    // For plugins, also queued after the data of the connection, without data.
+    // Otherwise a plugin could see the data after the connection was lost, or as data of the next connection in the slot.
+    Packet *lostConnection = incomingMessages.Allocate(_FILE_AND_LINE_);
+    lostConnection->data = 0;
+    lostConnection->length = 0;
+    lostConnection->deleteData = true;
+    lostConnection->systemAddress = remoteClient->systemAddress;
+    PushIncomingPacket(lostConnection);
+}
+
+void TCPInterface::PushIncomingPacket(Packet *packet)
+{
+    if (incomingPacketsOverflowSize.load(std::memory_order_acquire) == 0 && incomingPackets.Push(packet))
+        return;
+
+    incomingPacketsOverflowMutex.Lock();
+    incomingPacketsOverflow.Push(packet, _FILE_AND_LINE_);
+    incomingPacketsOverflowSize.store(incomingPacketsOverflow.Size(), std::memory_order_release);
+    incomingPacketsOverflowMutex.Unlock();
+}
+
+Packet *TCPInterface::PopIncomingPacket(void)
+{
+    // Read before the ring. If anything overflowed, the ring is not written again until it was all read,
+    // so once the ring is empty, what overflowed is next.
+    bool overflowed = incomingPacketsOverflowSize.load(std::memory_order_acquire) > 0;
+    Packet *packet;
+    if (incomingPackets.Pop(&packet))
+        return packet;
+    if (overflowed == false)
+        return 0;
+
+    packet = 0;
+    incomingPacketsOverflowMutex.Lock();
+    if (incomingPacketsOverflow.IsEmpty() == false)
+    {
+        packet = incomingPacketsOverflow.Pop();
+        incomingPacketsOverflowSize.store(incomingPacketsOverflow.Size(), std::memory_order_release);
+    }
+    incomingPacketsOverflowMutex.Unlock();
+    return packet;
+}
+
+bool RemoteClient::SendOrBuffer(const char **data, const unsigned int *lengths, const int numParameters)
+{
+    if (!isActive)
+        return false;
+    unsigned int totalLength = 0;
     for (int parameterIndex = 0; parameterIndex < numParameters; parameterIndex++)
+        totalLength += lengths[parameterIndex];
+    if (totalLength == 0)
+        return false;
+
+    // One chunk, so concurrent sends do not interleave their parameters
+    OutgoingChunk *chunk = (OutgoingChunk *) malloc(sizeof(OutgoingChunk) + totalLength);
+    if (chunk == 0)
+        return false;
+    unsigned int offset = 0;
+    for (int parameterIndex = 0; parameterIndex < numParameters; parameterIndex++)
+    {
+        memcpy(chunk->Data() + offset, data[parameterIndex], lengths[parameterIndex]);
+        offset += lengths[parameterIndex];
+    }
+    chunk->length = totalLength;
+    if (PushOutgoing(chunk) == false)
+    {
+        free(chunk);
+        return false;
+    }
+    return true;
+}
+
+bool RemoteClient::PushOutgoing(OutgoingChunk *chunk)
+{
+    if (!isActive)
+        return false;
+    chunk->offset = 0;
+    outgoingBytes.fetch_add(chunk->length, std::memory_order_relaxed);
+    OutgoingChunk *head = outgoingInbox.load(std::memory_order_relaxed);
+    do
+    {
+        chunk->next = head;
+    } while (!outgoingInbox.compare_exchange_weak(head, chunk));
+    return true;
+}
+
+void RemoteClient::TakeOutgoingInbox(void)
+{
+    OutgoingChunk *chunk = outgoingInbox.exchange(0);
+    if (chunk == 0)
+        return;
+
+    // Newest first, so reverse it
+    OutgoingChunk *newest = chunk, *reversed = 0;
+    while (chunk)
     {
-        outgoingDataMutex.Lock();
-        if (ALLOW_SEND_FROM_USER_THREAD && outgoingData.GetBytesWritten() == 0)
+        OutgoingChunk *next = chunk->next;
+        chunk->next = reversed;
+        reversed = chunk;
+        chunk = next;
+    }
+    if (outgoingTail)
+        outgoingTail->next = reversed;
+    else
+        outgoingHead = reversed;
+    outgoingTail = newest;
+}
+
+int RemoteClient::SendQueued(char *buffer, unsigned int bufferSize, unsigned int *sendLength, bool *zeroCopied)
+{
+    *zeroCopied = false;
+#if TCP_INTERFACE_GATHER_SEND==1
+#if OPEN_SSL_CLIENT_SUPPORT==1
+    if (ssl == 0)
+#endif
+    {
+#if TCP_INTERFACE_USE_EPOLL==1
+        const unsigned int maxBytes = (unsigned int) -1;
+#else
+        // The socket blocks until all of it is in the socket buffer
+        const unsigned int maxBytes = bufferSize;
+#endif
+        // The socket may take only some of it, and copying what it does not take is wasted
+        const unsigned int maxCopied = 65536 < bufferSize ? 65536 : bufferSize;
+        iovec vectors[MAX_SEND_VECTORS];
+        int vectorCount = 0;
+        unsigned int total = 0, copied = 0;
+        bool lastCopied = false;
+        for (OutgoingChunk *chunk = outgoingHead; chunk != 0 && total < maxBytes; chunk = chunk->next)
         {
-            outgoingDataMutex.Unlock();
-            int bytesSent = Send(data[parameterIndex], lengths[parameterIndex]);
-            if (bytesSent < (int) lengths[parameterIndex])
+            unsigned int length = chunk->length - chunk->offset;
+            if (length > maxBytes - total)
+                length = maxBytes - total;
+            // By the size of the whole chunk. Bounding length instead lets compilers inline the copy as rep movs, which is several times slower for small chunks.
+            bool copy = chunk->length < GATHER_COPY_BYTES;
+            if (copy && length > maxCopied - copied)
+                break;
+            if (copy && lastCopied)
+            {
+                // Continues the vector of the previous chunk
+                vectors[vectorCount - 1].iov_len += length;
+            }
+            else
             {
-                // Push remainder
-                outgoingDataMutex.Lock();
-                outgoingData.WriteBytes(data[parameterIndex] + bytesSent, lengths[parameterIndex] - bytesSent,
-                                        _FILE_AND_LINE_);
-                outgoingDataMutex.Unlock();
+                if (vectorCount == MAX_SEND_VECTORS)
+                    break;
+                vectors[vectorCount].iov_base = copy ? buffer + copied : chunk->Data() + chunk->offset;
+                vectors[vectorCount].iov_len = length;
+                vectorCount++;
             }
+            if (copy)
+            {
+                memcpy(buffer + copied, chunk->Data() + chunk->offset, length);
+                copied += length;
+            }
+            lastCopied = copy;
+            total += length;
+        }
+        *sendLength = total;
+
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = vectors;
+        message.msg_iovlen = vectorCount;
+#if TCP_INTERFACE_ZERO_COPY==1
+        // buffer is reused by the next call, so only chunks may be sent from in place
+        if (zeroCopy && copied == 0 && total >= ZERO_COPY_MIN_BYTES)
+        {
+            int bytesSent = (int) sendmsg(socket, &message, MSG_ZEROCOPY);
+            if (bytesSent > 0)
+            {
+                // Each send that takes data gets the next number
+                zeroCopyNext++;
+                *zeroCopied = true;
+                return bytesSent;
+            }
+            // Out of memory to track sends that are not complete, so copy this one
+            if (bytesSent == 0 || errno != ENOBUFS)
+                return bytesSent;
+        }
+#endif
+        return (int) sendmsg(socket, &message, 0);
+    }
+#endif
+
+#if TCP_INTERFACE_GATHER_SEND==0 || OPEN_SSL_CLIENT_SUPPORT==1
+    // Small chunks are copied together up to this, so they go in one call
+    const unsigned int COALESCE_BYTES = 65536 < bufferSize ? 65536 : bufferSize;
+    OutgoingChunk *chunk = outgoingHead;
+    const char *sendData = chunk->Data() + chunk->offset;
+    *sendLength = chunk->length - chunk->offset;
+    if (chunk->next != 0 && *sendLength < COALESCE_BYTES)
+    {
+        *sendLength = 0;
+        for (; chunk != 0 && *sendLength < COALESCE_BYTES; chunk = chunk->next)
+        {
+            unsigned int length = chunk->length - chunk->offset;
+            if (length > COALESCE_BYTES - *sendLength)
+                length = COALESCE_BYTES - *sendLength;
+            memcpy(buffer + *sendLength, chunk->Data() + chunk->offset, length);
+            *sendLength += length;
+        }
+        sendData = buffer;
+    }
+    return Send(sendData, *sendLength);
+#endif
+}
+
+void RemoteClient::ConsumeOutgoing(unsigned int bytes, bool zeroCopied)
+{
+    outgoingBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    // Only the first chunk can be partly sent, so the other chunks of a send do not need the number of it
+    uint32_t zeroCopyId = zeroCopyNext - 1;
+    if (zeroCopied)
+    {
+        outgoingHeadZeroCopied = true;
+        outgoingHeadZeroCopyId = zeroCopyId;
+    }
+    while (bytes > 0)
+    {
+        OutgoingChunk *chunk = outgoingHead;
+        unsigned int remaining = chunk->length - chunk->offset;
+        if (bytes < remaining)
+        {
+            chunk->offset += bytes;
+            return;
+        }
+        bytes -= remaining;
+        outgoingHead = chunk->next;
+        if (outgoingHead == 0)
+            outgoingTail = 0;
+        bool chunkZeroCopied = outgoingHeadZeroCopied;
+        uint32_t chunkZeroCopyId = outgoingHeadZeroCopyId;
+        outgoingHeadZeroCopied = zeroCopied && bytes > 0;
+        // Numbers wrap, so compare the difference
+        if (chunkZeroCopied == false || (int32_t) (chunkZeroCopyId - zeroCopyCompleted) < 0)
+        {
+            free(chunk);
+            continue;
         }
+
+        // The system still reads it, until the send completes
+        chunk->offset = chunkZeroCopyId;
+        chunk->next = 0;
+        if (zeroCopyTail)
+            zeroCopyTail->next = chunk;
         else
+            zeroCopyHead = chunk;
+        zeroCopyTail = chunk;
+    }
+}
+
+#if TCP_INTERFACE_ZERO_COPY==1
+void RemoteClient::ReadZeroCopyCompletions(void)
+{
+    while (1)
+    {
+        char control[128];
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(socket, &message, MSG_ERRQUEUE) < 0)
+            return;
+
+        for (cmsghdr *cm = CMSG_FIRSTHDR(&message); cm != 0; cm = CMSG_NXTHDR(&message, cm))
         {
-            outgoingData.WriteBytes(data[parameterIndex], lengths[parameterIndex], _FILE_AND_LINE_);
-            outgoingDataMutex.Unlock();
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+            sock_extended_err error;
+            memcpy(&error, CMSG_DATA(cm), sizeof(error));
+            if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            // The device could not send from our memory, such as loopback, so the system copied it after all.
+            // Then pinning the pages and reading completions only costs more.
+            if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zeroCopy = false;
+            CompleteZeroCopy(error.ee_info, error.ee_data);
         }
     }
 }
+#endif
+
+void RemoteClient::CompleteZeroCopy(uint32_t first, uint32_t last)
+{
+    // Usually in order. Keep ones that are not, until the sends before them complete.
+    if (first != zeroCopyCompleted)
+    {
+        zeroCopyEarlyCompletions.Push(((uint64_t) first << 32) | last, _FILE_AND_LINE_);
+        return;
+    }
+    zeroCopyCompleted = last + 1;
+    unsigned int i = 0;
+    while (i < zeroCopyEarlyCompletions.Size())
+    {
+        if ((uint32_t) (zeroCopyEarlyCompletions[i] >> 32) == zeroCopyCompleted)
+        {
+            zeroCopyCompleted = (uint32_t) zeroCopyEarlyCompletions[i] + 1;
+            zeroCopyEarlyCompletions.RemoveAtIndexFast(i);
+            i = 0;
+        }
+        else
+            i++;
+    }
+
+    while (zeroCopyHead && (int32_t) (zeroCopyHead->offset - zeroCopyCompleted) < 0)
+    {
+        OutgoingChunk *next = zeroCopyHead->next;
+        free(zeroCopyHead);
+        zeroCopyHead = next;
+    }
+    if (zeroCopyHead == 0)
+        zeroCopyTail = 0;
+}
+
+void RemoteClient::DiscardOutgoingInbox(void)
+{
+    OutgoingChunk *chunk = outgoingInbox.exchange(0);
+    while (chunk)
+    {
+        OutgoingChunk *next = chunk->next;
+        outgoingBytes.fetch_sub(chunk->length, std::memory_order_relaxed);
+        free(chunk);
+        chunk = next;
+    }
+}
+
+void RemoteClient::ClearOutgoing(void)
+{
+    DiscardOutgoingInbox();
+    while (outgoingHead)
+    {
+        OutgoingChunk *next = outgoingHead->next;
+        outgoingBytes.fetch_sub(outgoingHead->length - outgoingHead->offset, std::memory_order_relaxed);
+        free(outgoingHead);
+        outgoingHead = next;
+    }
+    outgoingTail = 0;
+    outgoingHeadZeroCopied = false;
+
+    // The socket is closed, so the system is done with these
+    while (zeroCopyHead)
+    {
+        OutgoingChunk *next = zeroCopyHead->next;
+        free(zeroCopyHead);
+        zeroCopyHead = next;
+    }
+    zeroCopyTail = 0;
+    zeroCopyEarlyCompletions.Clear(true, _FILE_AND_LINE_);
+}
 
 #if OPEN_SSL_CLIENT_SUPPORT == 1
 bool RemoteClient::InitSSL(SSL_CTX* ctx, SSL_METHOD *meth)
@@ -0,0 +1,327 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "DS_PrefixTrie.h"
+#include "RakAssert.h"
+#include "RakSleep.h"
+#include <string.h>
+
+using namespace DataStructures;
+
+static inline unsigned int GetBit(const unsigned char *key, unsigned int bit)
+{
+    return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+// Number of leading bits, from startBit up to endBit, that a and b have in common, plus startBit
+static unsigned int CommonPrefixBits(const unsigned char *a, const unsigned char *b, unsigned int startBit, unsigned int endBit)
+{
+    unsigned int bit=startBit;
+    while (bit < endBit)
+    {
+        unsigned char diff = a[bit >> 3] ^ b[bit >> 3];
+        // Ignore the bits of this byte before bit
+        diff &= (unsigned char) (0xFF >> (bit & 7));
+        if (diff)
+        {
+            unsigned int firstDiff = bit & ~7U;
+            while ((diff & 0x80)==0)
+            {
+                diff <<= 1;
+                firstDiff++;
+            }
+            return firstDiff < endBit ? firstDiff : endBit;
+        }
+        bit = (bit & ~7U) + 8;
+    }
+    return endBit;
+}
+
+PrefixTrie::PrefixTrie()
+{
+    root.store(0);
+    readers[0].store(0);
+    readers[1].store(0);
+    readerEpoch.store(0);
+    addCount.store(1);
+    nextExpiry.store(0);
+    size=0;
+}
+PrefixTrie::~PrefixTrie()
+{
+    Clear();
+}
+PrefixTrie::Node *PrefixTrie::NewNode(const unsigned char *key, unsigned int prefixBits, bool inSet, RakNet::TimeMS timeout)
+{
+    RakAssert(prefixBits <= MAX_KEY_BYTES*8);
+    Node *node = new Node;
+    memset(node->key, 0, sizeof(node->key));
+    memcpy(node->key, key, (prefixBits+7)/8);
+    // Clear bits past the prefix, so equal prefixes have equal keys
+    if (prefixBits & 7)
+        node->key[prefixBits >> 3] &= (unsigned char) (0xFF << (8 - (prefixBits & 7)));
+    node->prefixBits=prefixBits;
+    node->inSet=inSet;
+    node->timeout=timeout;
+    node->child[0]=0;
+    node->child[1]=0;
+    node->refCount=1;
+    return node;
+}
+PrefixTrie::Node *PrefixTrie::CloneNode(Node *node)
+{
+    Node *copy = new Node;
+    *copy=*node;
+    copy->refCount=1;
+    if (copy->child[0])
+        copy->child[0]->refCount++;
+    if (copy->child[1])
+        copy->child[1]->refCount++;
+    return copy;
+}
+void PrefixTrie::ReleaseNode(Node *node)
+{
+    if (node==0 || --node->refCount > 0)
+        return;
+    ReleaseNode(node->child[0]);
+    ReleaseNode(node->child[1]);
+    delete node;
+}
+PrefixTrie::Node *PrefixTrie::InsertNode(Node *node, const unsigned char *key, unsigned int prefixBits, RakNet::TimeMS timeout)
+{
+    if (node==0)
+        return NewNode(key, prefixBits, true, timeout);
+
+    unsigned int common = CommonPrefixBits(node->key, key, 0, node->prefixBits < prefixBits ? node->prefixBits : prefixBits);
+    if (common==node->prefixBits && common==prefixBits)
+    {
+        // Same prefix
+        Node *copy = CloneNode(node);
+        copy->inSet=true;
+        copy->timeout=timeout;
+        return copy;
+    }
+    if (common==node->prefixBits)
+    {
+        // Longer than this node, so goes under it
+        Node *copy = CloneNode(node);
+        unsigned int side = GetBit(key, common);
+        Node *oldChild = copy->child[side];
+        copy->child[side]=InsertNode(oldChild, key, prefixBits, timeout);
+        ReleaseNode(oldChild);
+        return copy;
+    }
+    if (common==prefixBits)
+    {
+        // Shorter than this node, so goes above it
+        Node *parent = NewNode(key, prefixBits, true, timeout);
+        parent->child[GetBit(node->key, common)]=node;
+        node->refCount++;
+        return parent;
+    }
+
+    // Diverges partway through this node. Branch where they differ.
+    Node *branch = NewNode(key, common, false, 0);
+    branch->child[GetBit(node->key, common)]=node;
+    node->refCount++;
+    branch->child[GetBit(key, common)]=NewNode(key, prefixBits, true, timeout);
+    return branch;
+}
+PrefixTrie::Node *PrefixTrie::Collapse(Node *node)
+{
+    // Nodes that are not in the set are only needed to branch
+    if (node->inSet || (node->child[0] && node->child[1]))
+        return node;
+    Node *onlyChild = node->child[0] ? node->child[0] : node->child[1];
+    if (onlyChild)
+        onlyChild->refCount++;
+    ReleaseNode(node);
+    return onlyChild;
+}
+PrefixTrie::Node *PrefixTrie::RemoveNode(Node *node, const unsigned char *key, unsigned int prefixBits, bool *removed)
+{
+    if (node==0)
+        return 0;
+    if (prefixBits < node->prefixBits || CommonPrefixBits(node->key, key, 0, node->prefixBits) < node->prefixBits)
+    {
+        node->refCount++;
+        return node;
+    }
+    if (prefixBits==node->prefixBits)
+    {
+        if (node->inSet==false)
+        {
+            node->refCount++;
+            return node;
+        }
+        *removed=true;
+        Node *copy = CloneNode(node);
+        copy->inSet=false;
+        copy->timeout=0;
+        return Collapse(copy);
+    }
+
+    unsigned int side = GetBit(key, node->prefixBits);
+    Node *newChild = RemoveNode(node->child[side], key, prefixBits, removed);
+    if (newChild==node->child[side])
+    {
+        // Not found below, keep this node
+        ReleaseNode(newChild);
+        node->refCount++;
+        return node;
+    }
+    Node *copy = CloneNode(node);
+    ReleaseNode(copy->child[side]);
+    copy->child[side]=newChild;
+    return Collapse(copy);
+}
+const PrefixTrie::Node *PrefixTrie::FindNode(const unsigned char *key, unsigned int prefixBits) const
+{
+    // Writer only, so the root cannot change during the search
+    const Node *node = root.load(std::memory_order_relaxed);
+    while (node && node->prefixBits <= prefixBits)
+    {
+        if (CommonPrefixBits(node->key, key, 0, node->prefixBits) < node->prefixBits)
+            return 0;
+        if (node->prefixBits==prefixBits)
+            return node->inSet ? node : 0;
+        node=node->child[GetBit(key, node->prefixBits)];
+    }
+    return 0;
+}
+void PrefixTrie::WaitForReaders(void)
+{
+    // Flip twice, so a reader that read the epoch just before a flip is also waited for
+    for (int pass=0; pass < 2; pass++)
+    {
+        unsigned int epoch = readerEpoch.load(std::memory_order_relaxed);
+        readerEpoch.store(epoch ^ 1, std::memory_order_seq_cst);
+        while (readers[epoch].load(std::memory_order_seq_cst)!=0)
+            RakSleep(0);
+    }
+}
+void PrefixTrie::Publish(Node *newRoot)
+{
+    Node *oldRoot = root.exchange(newRoot, std::memory_order_seq_cst);
+    WaitForReaders();
+    ReleaseNode(oldRoot);
+}
+void PrefixTrie::Add(const unsigned char *key, unsigned int prefixBits, RakNet::TimeMS timeout)
+{
+    writeMutex.Lock();
+    if (FindNode(key, prefixBits)==0)
+        size++;
+    Publish(InsertNode(root.load(std::memory_order_relaxed), key, prefixBits, timeout));
+    if (timeout!=0)
+    {
+        ExpiryEntry entry;
+        memcpy(entry.key, key, (prefixBits+7)/8);
+        entry.prefixBits=prefixBits;
+        expiryHeap.Push(timeout, entry, _FILE_AND_LINE_);
+        nextExpiry.store(expiryHeap.PeekWeight(), std::memory_order_relaxed);
+    }
+    addCount.fetch_add(1, std::memory_order_release);
+    writeMutex.Unlock();
+}
+bool PrefixTrie::Remove(const unsigned char *key, unsigned int prefixBits)
+{
+    writeMutex.Lock();
+    bool removed=false;
+    Node *oldRoot = root.load(std::memory_order_relaxed);
+    Node *newRoot = RemoveNode(oldRoot, key, prefixBits, &removed);
+    if (removed)
+    {
+        size--;
+        Publish(newRoot);
+    }
+    else
+        ReleaseNode(newRoot);
+    writeMutex.Unlock();
+    return removed;
+}
+void PrefixTrie::Clear(void)
+{
+    writeMutex.Lock();
+    Publish(0);
+    size=0;
+    expiryHeap.Clear(false, _FILE_AND_LINE_);
+    nextExpiry.store(0, std::memory_order_relaxed);
+    writeMutex.Unlock();
+}
+void PrefixTrie::RemoveExpired(RakNet::TimeMS time)
+{
+    RakNet::TimeMS earliest = nextExpiry.load(std::memory_order_relaxed);
+    if (earliest==0 || earliest >= time)
+        return;
+
+    writeMutex.Lock();
+    if (expiryHeap.Size()==0 || expiryHeap.PeekWeight() >= time)
+    {
+        writeMutex.Unlock();
+        return;
+    }
+
+    // Remove everything that expired from a private version, then publish once
+    Node *newRoot = root.load(std::memory_order_relaxed);
+    if (newRoot)
+        newRoot->refCount++;
+    bool anyRemoved=false;
+    while (expiryHeap.Size() && expiryHeap.PeekWeight() < time)
+    {
+        ExpiryEntry entry = expiryHeap.Pop(0);
+        // The prefix may have been removed, or added again with a later timeout, since this entry was pushed
+        const Node *node = FindNode(entry.key, entry.prefixBits);
+        if (node==0 || node->timeout==0 || node->timeout >= time)
+            continue;
+        bool removed=false;
+        Node *next = RemoveNode(newRoot, entry.key, entry.prefixBits, &removed);
+        ReleaseNode(newRoot);
+        newRoot=next;
+        if (removed)
+        {
+            size--;
+            anyRemoved=true;
+        }
+    }
+    nextExpiry.store(expiryHeap.Size() ? expiryHeap.PeekWeight() : 0, std::memory_order_relaxed);
+    if (anyRemoved)
+        Publish(newRoot);
+    else
+        ReleaseNode(newRoot);
+    writeMutex.Unlock();
+}
+bool PrefixTrie::Contains(const unsigned char *key, unsigned int keyBits, RakNet::TimeMS time) const
+{
+    unsigned int epoch = readerEpoch.load(std::memory_order_acquire);
+    readers[epoch].fetch_add(1, std::memory_order_seq_cst);
+    const Node *node = root.load(std::memory_order_seq_cst);
+    bool found=false;
+    unsigned int matchedBits=0;
+    while (node && node->prefixBits <= keyBits)
+    {
+        matchedBits = CommonPrefixBits(node->key, key, matchedBits, node->prefixBits);
+        if (matchedBits < node->prefixBits)
+            break;
+        if (node->inSet && (node->timeout==0 || node->timeout >= time))
+        {
+            found=true;
+            break;
+        }
+        if (node->prefixBits==keyBits)
+            break;
+        node=node->child[GetBit(key, node->prefixBits)];
+    }
+    readers[epoch].fetch_sub(1, std::memory_order_release);
+    return found;
+}
+unsigned int PrefixTrie::Size(void) const
+{
+    return size.load(std::memory_order_relaxed);
+}
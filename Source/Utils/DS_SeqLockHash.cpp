@@ -0,0 +1,185 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "DS_SeqLockHash.h"
+#include "RakAssert.h"
+
+using namespace DataStructures;
+
+SeqLockHash::SeqLockHash()
+{
+    slots=0;
+    capacityMask=0;
+    sequence.store(0);
+}
+SeqLockHash::~SeqLockHash()
+{
+    Clear();
+}
+void SeqLockHash::Init(unsigned int maxElements)
+{
+    Clear();
+
+    // Keep the load factor at or below one half so probe sequences stay short
+    unsigned int capacity=16;
+    while (capacity < maxElements*2)
+        capacity<<=1;
+    slots = new Slot[capacity];
+    for (unsigned int i=0; i < capacity; i++)
+    {
+        slots[i].key.store(0, std::memory_order_relaxed);
+        slots[i].value.store(EMPTY_VALUE, std::memory_order_relaxed);
+    }
+    capacityMask=capacity-1;
+    sequence.store(0, std::memory_order_release);
+}
+void SeqLockHash::Clear(void)
+{
+    delete [] slots;
+    slots=0;
+    capacityMask=0;
+}
+unsigned int SeqLockHash::HomeSlot(uint64_t key) const
+{
+    // Fibonacci hashing spreads sequential keys, such as ports and guids, over the table
+    return (unsigned int) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & capacityMask;
+}
+unsigned int SeqLockHash::FindSlot(uint64_t key) const
+{
+    unsigned int slotIndex=HomeSlot(key);
+    for (unsigned int probes=0; probes <= capacityMask; probes++)
+    {
+        if (slots[slotIndex].value.load(std::memory_order_relaxed)==EMPTY_VALUE)
+            return (unsigned int) -1;
+        if (slots[slotIndex].key.load(std::memory_order_relaxed)==key)
+            return slotIndex;
+        slotIndex=(slotIndex+1) & capacityMask;
+    }
+    return (unsigned int) -1;
+}
+unsigned int SeqLockHash::FindSlot(uint64_t key, unsigned int value) const
+{
+    unsigned int slotIndex=HomeSlot(key);
+    for (unsigned int probes=0; probes <= capacityMask; probes++)
+    {
+        unsigned int slotValue=slots[slotIndex].value.load(std::memory_order_relaxed);
+        if (slotValue==EMPTY_VALUE)
+            return (unsigned int) -1;
+        if (slotValue==value && slots[slotIndex].key.load(std::memory_order_relaxed)==key)
+            return slotIndex;
+        slotIndex=(slotIndex+1) & capacityMask;
+    }
+    return (unsigned int) -1;
+}
+void SeqLockHash::InsertSlot(uint64_t key, unsigned int value)
+{
+    BeginWrite();
+    unsigned int slotIndex=HomeSlot(key);
+    while (slots[slotIndex].value.load(std::memory_order_relaxed)!=EMPTY_VALUE)
+        slotIndex=(slotIndex+1) & capacityMask;
+    slots[slotIndex].key.store(key, std::memory_order_relaxed);
+    slots[slotIndex].value.store(value, std::memory_order_relaxed);
+    EndWrite();
+}
+void SeqLockHash::BeginWrite(void)
+{
+    sequence.store(sequence.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+void SeqLockHash::EndWrite(void)
+{
+    sequence.store(sequence.load(std::memory_order_relaxed)+1, std::memory_order_release);
+}
+void SeqLockHash::Set(uint64_t key, unsigned int value)
+{
+    RakAssert(slots);
+    RakAssert(value!=EMPTY_VALUE);
+    unsigned int slotIndex=FindSlot(key);
+    if (slotIndex==(unsigned int) -1)
+    {
+        InsertSlot(key, value);
+        return;
+    }
+    BeginWrite();
+    slots[slotIndex].value.store(value, std::memory_order_relaxed);
+    EndWrite();
+}
+void SeqLockHash::Add(uint64_t key, unsigned int value)
+{
+    RakAssert(slots);
+    RakAssert(value!=EMPTY_VALUE);
+    if (FindSlot(key, value)==(unsigned int) -1)
+        InsertSlot(key, value);
+}
+void SeqLockHash::Remove(uint64_t key)
+{
+    if (slots==0)
+        return;
+    unsigned int slotIndex=FindSlot(key);
+    if (slotIndex!=(unsigned int) -1)
+        RemoveSlot(slotIndex);
+}
+void SeqLockHash::RemoveIfValue(uint64_t key, unsigned int value)
+{
+    if (slots==0)
+        return;
+    unsigned int slotIndex=FindSlot(key, value);
+    if (slotIndex!=(unsigned int) -1)
+        RemoveSlot(slotIndex);
+}
+void SeqLockHash::RemoveSlot(unsigned int slotIndex)
+{
+    BeginWrite();
+
+    // Backward shift deletion, so lookups never need tombstones
+    unsigned int hole=slotIndex;
+    unsigned int next=(hole+1) & capacityMask;
+    while (slots[next].value.load(std::memory_order_relaxed)!=EMPTY_VALUE)
+    {
+        uint64_t nextKey=slots[next].key.load(std::memory_order_relaxed);
+        unsigned int home=HomeSlot(nextKey);
+        // Move next into the hole if its home is not cyclically within (hole, next]
+        if (((next-home) & capacityMask) >= ((next-hole) & capacityMask))
+        {
+            slots[hole].key.store(nextKey, std::memory_order_relaxed);
+            slots[hole].value.store(slots[next].value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            hole=next;
+        }
+        next=(next+1) & capacityMask;
+    }
+    slots[hole].value.store(EMPTY_VALUE, std::memory_order_relaxed);
+
+    EndWrite();
+}
+bool SeqLockHash::Get(uint64_t key, unsigned int &value) const
+{
+    if (slots==0)
+        return false;
+
+    unsigned int before, after, result;
+    do
+    {
+        before=sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            after=before+1;
+            continue;
+        }
+        unsigned int slotIndex=FindSlot(key);
+        result = slotIndex==(unsigned int) -1 ? EMPTY_VALUE : slots[slotIndex].value.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after=sequence.load(std::memory_order_relaxed);
+    } while (before!=after);
+
+    if (result==EMPTY_VALUE)
+        return false;
+    value=result;
+    return true;
+}
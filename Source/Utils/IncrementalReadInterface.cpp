@@ -25,3 +25,15 @@ unsigned int IncrementalReadInterface::GetFilePart(const char *filename, unsigne
     fclose(fp);
     return numRead;
 }
+
+const char *IncrementalReadInterface::MapFilePart(const char * /*filename*/, unsigned int /*startReadBytes*/,
+                                                  unsigned int /*numBytesToRead*/, unsigned int *bytesMapped,
+                                                  FileListNodeContext /*context*/)
+{
+    *bytesMapped=0;
+    return 0;
+}
+
+void IncrementalReadInterface::UnmapFilePart(const char * /*filename*/, const char * /*data*/)
+{
+}
@@ -0,0 +1,307 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "MappedFileReadInterface.h"
+#include "RakAssert.h"
+#include <string.h>
+
+#if defined(_WIN32)
+#include "WindowsIncludes.h"
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace RakNet;
+
+MappedFileReadInterface::MappedFileReadInterface()
+{
+    maxIdleMappings=16;
+}
+
+MappedFileReadInterface::~MappedFileReadInterface()
+{
+    Clear();
+    RakAssert(mappedFiles.Size()==0);
+}
+
+void MappedFileReadInterface::SetMaxIdleMappings(unsigned int count)
+{
+    mappedFilesMutex.Lock();
+    maxIdleMappings=count;
+    TrimIdle();
+    mappedFilesMutex.Unlock();
+}
+
+unsigned int MappedFileReadInterface::GetMappedFileCount(void)
+{
+    mappedFilesMutex.Lock();
+    unsigned int count = mappedFiles.Size();
+    mappedFilesMutex.Unlock();
+    return count;
+}
+
+void MappedFileReadInterface::Clear(void)
+{
+    mappedFilesMutex.Lock();
+    unsigned int oldMax = maxIdleMappings;
+    maxIdleMappings=0;
+    TrimIdle();
+    maxIdleMappings=oldMax;
+    mappedFilesMutex.Unlock();
+}
+
+unsigned int MappedFileReadInterface::GetFilePart(const char *filename, unsigned int startReadBytes,
+                                                  unsigned int numBytesToRead, void *preallocatedDestination,
+                                                  FileListNodeContext context)
+{
+    unsigned int bytesMapped;
+    const char *data = MapFilePart(filename, startReadBytes, numBytesToRead, &bytesMapped, context);
+    if (data==0)
+        return IncrementalReadInterface::GetFilePart(filename, startReadBytes, numBytesToRead, preallocatedDestination, context);
+    memcpy(preallocatedDestination, data, bytesMapped);
+    UnmapFilePart(filename, data);
+    return bytesMapped;
+}
+
+const char *MappedFileReadInterface::MapFilePart(const char *filename, unsigned int startReadBytes,
+                                                 unsigned int numBytesToRead, unsigned int *bytesMapped,
+                                                 FileListNodeContext /*context*/)
+{
+    *bytesMapped=0;
+    MappedFile *mappedFile = Acquire(filename);
+    if (mappedFile==0)
+        return 0;
+
+    // The caller reads it with IncrementalReadInterface::GetFilePart() instead
+    if ((uint64_t) startReadBytes >= mappedFile->length || IsUnchanged(mappedFile)==false)
+    {
+        Release(mappedFile);
+        return 0;
+    }
+
+    uint64_t remaining = mappedFile->length - startReadBytes;
+    *bytesMapped = remaining < numBytesToRead ? (unsigned int) remaining : numBytesToRead;
+    const char *data = mappedFile->data + startReadBytes;
+
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+    // Start reading the chunk in before it is copied into the send buffers
+    static const uintptr_t pageMask = (uintptr_t) sysconf(_SC_PAGESIZE) - 1;
+    char *pageStart = (char*) ((uintptr_t) data & ~pageMask);
+    madvise(pageStart, (size_t) (data + *bytesMapped - pageStart), MADV_WILLNEED);
+#endif
+
+    return data;
+}
+
+void MappedFileReadInterface::UnmapFilePart(const char *filename, const char *data)
+{
+    (void) data;
+
+    mappedFilesMutex.Lock();
+    MappedFile **mappedFilePtr = mappedFiles.Peek(RakString(filename));
+    RakAssert(mappedFilePtr);
+    if (mappedFilePtr)
+    {
+        MappedFile *mappedFile = *mappedFilePtr;
+        RakAssert(data >= mappedFile->data && data < mappedFile->data + mappedFile->length);
+        RakAssert(mappedFile->refCount>0);
+        if (--mappedFile->refCount==0)
+        {
+            idleMappings.Push(mappedFile, _FILE_AND_LINE_);
+            TrimIdle();
+        }
+    }
+    mappedFilesMutex.Unlock();
+}
+
+MappedFileReadInterface::MappedFile *MappedFileReadInterface::Acquire(const char *filename)
+{
+    RakString key(filename);
+
+    mappedFilesMutex.Lock();
+    MappedFile **mappedFilePtr = mappedFiles.Peek(key);
+    if (mappedFilePtr)
+    {
+        MappedFile *mappedFile = *mappedFilePtr;
+        if (mappedFile->refCount>0)
+        {
+            // Concurrent downloads share the mapping they started with, even if the file changed since
+            mappedFile->refCount++;
+            mappedFilesMutex.Unlock();
+            return mappedFile;
+        }
+
+        uint64_t length;
+        int64_t modificationTime;
+        RemoveIdle(mappedFile);
+        if (GetFileInfo(filename, &length, &modificationTime) &&
+            length==mappedFile->length && modificationTime==mappedFile->modificationTime)
+        {
+            mappedFile->refCount=1;
+            mappedFilesMutex.Unlock();
+            return mappedFile;
+        }
+
+        // Changed or deleted since it was mapped
+        mappedFiles.Remove(key, _FILE_AND_LINE_);
+        UnmapFile(mappedFile);
+        delete mappedFile;
+    }
+
+    MappedFile *mappedFile = new MappedFile;
+    mappedFile->filename=key;
+    mappedFile->refCount=1;
+    if (GetFileInfo(filename, &mappedFile->length, &mappedFile->modificationTime)==false || MapFile(mappedFile)==false)
+    {
+        delete mappedFile;
+        mappedFilesMutex.Unlock();
+        return 0;
+    }
+    mappedFiles.Push(key, mappedFile, _FILE_AND_LINE_);
+    mappedFilesMutex.Unlock();
+    return mappedFile;
+}
+
+void MappedFileReadInterface::Release(MappedFile *mappedFile)
+{
+    UnmapFilePart(mappedFile->filename.C_String(), mappedFile->data);
+}
+
+void MappedFileReadInterface::RemoveIdle(MappedFile *mappedFile)
+{
+    unsigned int index = idleMappings.GetIndexOf(mappedFile);
+    if (index!=(unsigned int) -1)
+        idleMappings.RemoveAtIndex(index);
+}
+
+void MappedFileReadInterface::TrimIdle(void)
+{
+    while (idleMappings.Size() > maxIdleMappings)
+    {
+        MappedFile *mappedFile = idleMappings[0];
+        idleMappings.RemoveAtIndex(0);
+        mappedFiles.Remove(mappedFile->filename, _FILE_AND_LINE_);
+        UnmapFile(mappedFile);
+        delete mappedFile;
+    }
+}
+
+#if defined(_WIN32)
+
+bool MappedFileReadInterface::GetFileInfo(const char *filename, uint64_t *length, int64_t *modificationTime)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (GetFileAttributesExA(filename, GetFileExInfoStandard, &attributes)==0)
+        return false;
+    *length = ((uint64_t) attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+    *modificationTime = (int64_t) (((uint64_t) attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime);
+    return true;
+}
+
+bool MappedFileReadInterface::MapFile(MappedFile *mappedFile)
+{
+    if (mappedFile->length==0 || mappedFile->length > (uint64_t) (size_t) -1)
+        return false;
+
+    // Mappings stay open while idle, so do not stop other programs writing, renaming or deleting the file
+    HANDLE fileHandle = CreateFileA(mappedFile->filename.C_String(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (fileHandle==INVALID_HANDLE_VALUE)
+        return false;
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, 0, PAGE_READONLY, 0, 0, 0);
+    if (mappingHandle==0)
+    {
+        CloseHandle(fileHandle);
+        return false;
+    }
+    void *data = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, (SIZE_T) mappedFile->length);
+    if (data==0)
+    {
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        return false;
+    }
+    mappedFile->data=(char*) data;
+    mappedFile->fileHandle=fileHandle;
+    mappedFile->mappingHandle=mappingHandle;
+    return true;
+}
+
+bool MappedFileReadInterface::IsUnchanged(MappedFile *mappedFile)
+{
+    // A mapped file cannot be truncated, but it can be written to
+    BY_HANDLE_FILE_INFORMATION fileInfo;
+    if (GetFileInformationByHandle((HANDLE) mappedFile->fileHandle, &fileInfo)==0)
+        return false;
+    uint64_t length = ((uint64_t) fileInfo.nFileSizeHigh << 32) | fileInfo.nFileSizeLow;
+    int64_t modificationTime = (int64_t) (((uint64_t) fileInfo.ftLastWriteTime.dwHighDateTime << 32) | fileInfo.ftLastWriteTime.dwLowDateTime);
+    return length==mappedFile->length && modificationTime==mappedFile->modificationTime;
+}
+
+void MappedFileReadInterface::UnmapFile(MappedFile *mappedFile)
+{
+    UnmapViewOfFile(mappedFile->data);
+    CloseHandle((HANDLE) mappedFile->mappingHandle);
+    CloseHandle((HANDLE) mappedFile->fileHandle);
+}
+
+#else
+
+bool MappedFileReadInterface::GetFileInfo(const char *filename, uint64_t *length, int64_t *modificationTime)
+{
+    struct stat fileInfo;
+    if (stat(filename, &fileInfo)!=0 || S_ISREG(fileInfo.st_mode)==0)
+        return false;
+    *length = (uint64_t) fileInfo.st_size;
+    *modificationTime = (int64_t) fileInfo.st_mtime;
+    return true;
+}
+
+bool MappedFileReadInterface::MapFile(MappedFile *mappedFile)
+{
+    if (mappedFile->length==0 || mappedFile->length > (uint64_t) (size_t) -1)
+        return false;
+
+    int fd = open(mappedFile->filename.C_String(), O_RDONLY);
+    if (fd<0)
+        return false;
+    void *data = mmap(0, (size_t) mappedFile->length, PROT_READ, MAP_SHARED, fd, 0);
+    if (data==MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(data, (size_t) mappedFile->length, MADV_SEQUENTIAL);
+#endif
+    mappedFile->data=(char*) data;
+    // Kept open to check the file is not truncated under the mapping
+    mappedFile->fileDescriptor=fd;
+    return true;
+}
+
+bool MappedFileReadInterface::IsUnchanged(MappedFile *mappedFile)
+{
+    struct stat fileInfo;
+    return fstat(mappedFile->fileDescriptor, &fileInfo)==0 && (uint64_t) fileInfo.st_size==mappedFile->length &&
+        (int64_t) fileInfo.st_mtime==mappedFile->modificationTime;
+}
+
+void MappedFileReadInterface::UnmapFile(MappedFile *mappedFile)
+{
+    munmap(mappedFile->data, (size_t) mappedFile->length);
+    close(mappedFile->fileDescriptor);
+}
+
+#endif
@@ -58,6 +58,11 @@ struct RAK_DLL_EXPORT CloudKey
 
     /// \internal
     void Serialize(bool writeToBitstream, BitStream *bitStream);
+
+    bool operator==(const CloudKey &rhs) const {return secondaryKey==rhs.secondaryKey && primaryKey==rhs.primaryKey;}
+
+    /// \internal Hash of both keys, for DataStructures::Hash
+    static unsigned long ToInteger(const CloudKey &key);
 };
 
 /// \internal
@@ -26,11 +26,23 @@
 #include "DS_Hash.h"
 #include "CloudCommon.h"
 #include "DS_OrderedList.h"
+#include "SimpleMutex.h"
+#include "BitStream.h"
+#include "ThreadPool.h"
 #include <cstdlib>
 
 /// If the data is smaller than this value, an allocation is avoid. However, this value exists for every row
 #define CLOUD_SERVER_DATA_STACK_SIZE 32
 
+/// Keys are split into this many shards by primary key, each with its own lock, so Get() queries on worker threads only wait on the keys they read. At most 32.
+#define CLOUD_SERVER_SHARD_COUNT 16
+
+/// Hash table size of each shard
+#define CLOUD_SERVER_SHARD_HASH_SIZE 8192
+
+/// Hash table size of the keys uploaded by each client. Allocated on the first upload
+#define CLOUD_SERVER_CLIENT_KEYS_HASH_SIZE 1024
+
 namespace RakNet
 {
 /// Forward declarations
@@ -87,6 +99,12 @@ public:
     /// \param[in] bytes Max bytes a client can download from a single Get(). 0 means unlimited.
     void SetMaxBytesPerDownload(uint64_t bytes);
 
+    /// \brief Combine subscription notifications for keys that change rapidly
+    /// \details Changes are held for up to \a intervalMS. Subscribers then get only the latest value of each changed row, serialized once and sent to all of them together.
+    /// Defaults to 0, to send each change as it happens
+    /// \param[in] intervalMS How long to hold notifications. 0 to send them immediately.
+    void SetNotificationCoalesceInterval(RakNet::TimeMS intervalMS);
+
     /// \brief Add a server, which is assumed to be connected in a fully connected mesh to all other servers and also running the CloudServer plugin
     /// The other system must also call AddServer before getting the subscription data, or it will be rejected.
     /// Sending a message telling the other system to call AddServer(), followed by calling AddServer() locally, would be sufficient for this to work.
@@ -125,6 +143,16 @@ public:
     /// The instances are not deleted, only unreferenced. It is up to the user to delete the instances, if necessary
     void RemoveAllQueryFilters(void);
 
+    /// \brief Run Get() queries on worker threads instead of the thread that calls RakPeerInterface::Receive().
+    /// \details Queries over many keys or rows, from clients or from other servers, then no longer stall the game loop. Posts, releases and subscriptions still run in Receive().
+    /// Results are sent from Receive() after a worker finishes. A query sees any change posted before the worker reads that key, which may be after the query arrived.
+    /// \param[in] numThreads How many threads to start
+    /// \return True on success
+    bool StartGetThreads(int numThreads);
+
+    /// \brief Stop the threads started with StartGetThreads(). Queries not yet answered are processed and sent first.
+    void StopGetThreads(void);
+
 protected:
     virtual void Update(void);
     virtual PluginReceiveResult OnReceive(Packet *packet);
@@ -205,8 +233,20 @@ protected:
         DataStructures::OrderedList<RakNetGUID, RakNetGUID> nonSpecificSubscribers;
     };
 
-    static int KeyDataListComp( const CloudKey &key, CloudDataList * const &data );
-    DataStructures::OrderedList<CloudKey, CloudDataList*, CloudServer::KeyDataListComp> dataRepository;
+    // Only the thread that calls Receive() modifies the repository, while holding the lock of the shard. Get worker threads lock shards to read.
+    struct DataRepositoryShard
+    {
+        SimpleMutex mutex;
+        DataStructures::Hash<CloudKey, CloudDataList*, CLOUD_SERVER_SHARD_HASH_SIZE, CloudKey::ToInteger> dataLists;
+    };
+    DataRepositoryShard dataRepository[CLOUD_SERVER_SHARD_COUNT];
+    static unsigned int GetShardIndex(const CloudKey &key);
+    DataRepositoryShard *GetShard(const CloudKey &key) {return &dataRepository[GetShardIndex(key)];}
+    CloudDataList *GetCloudDataList(const CloudKey &key);
+    void RemoveCloudDataList(const CloudKey &key);
+    void GetDataRepositoryAsList(DataStructures::List<CloudDataList*> &cloudDataLists);
+    // Lock or unlock, in order, the shards of all of \a keys
+    void LockShards(DataStructures::List<CloudKey> &keys, bool lock);
 
     struct KeySubscriberID
     {
@@ -220,7 +260,7 @@ protected:
     {
         bool IsUnused(void) const {return uploadedKeys.Size()==0 && subscribedKeys.Size()==0;}
 
-        DataStructures::OrderedList<CloudKey,CloudKey,CloudKeyComp> uploadedKeys;
+        DataStructures::Hash<CloudKey,CloudKey,CLOUD_SERVER_CLIENT_KEYS_HASH_SIZE,CloudKey::ToInteger> uploadedKeys;
         DataStructures::OrderedList<CloudKey,KeySubscriberID*,CloudServer::KeySubscriberIDComp> subscribedKeys;
         uint64_t uploadedBytes;
     };
@@ -236,13 +276,28 @@ protected:
     void NotifyClientSubscribersOfDataChange( CloudQueryRow *row, DataStructures::OrderedList<RakNetGUID, RakNetGUID> &subscribers, bool wasUpdated );
     void NotifyServerSubscribersOfDataChange( CloudData *cloudData, CloudKey &key, bool wasUpdated );
 
+    // Latest notification for a row, held for SetNotificationCoalesceInterval()
+    struct PendingNotification
+    {
+        RakNetGUID clientGUID;
+        RakNet::BitStream bsOut;
+        DataStructures::OrderedList<RakNetGUID, RakNetGUID> subscribers;
+        // Same key, uploaded by other clients
+        PendingNotification *next;
+    };
+    DataStructures::Hash<CloudKey, PendingNotification*, 2048, CloudKey::ToInteger> pendingNotifications;
+    RakNet::TimeMS notificationCoalesceInterval;
+    RakNet::Time nextPendingNotificationsSend;
+    void SendPendingNotifications(void);
+    void ClearPendingNotifications(void);
+
     struct RemoteServer
     {
         RakNetGUID serverAddress;
         // This server needs to know about these keys when they are updated or deleted
-        DataStructures::OrderedList<CloudKey,CloudKey,CloudKeyComp> subscribedKeys;
+        DataStructures::Hash<CloudKey,CloudKey,CLOUD_SERVER_SHARD_HASH_SIZE,CloudKey::ToInteger> subscribedKeys;
         // This server has uploaded these keys, and needs to know about Get() requests
-        DataStructures::OrderedList<CloudKey,CloudKey,CloudKeyComp> uploadedKeys;
+        DataStructures::Hash<CloudKey,CloudKey,CLOUD_SERVER_SHARD_HASH_SIZE,CloudKey::ToInteger> uploadedKeys;
 
         // Just for processing
         bool workingFlag;
@@ -295,7 +350,23 @@ protected:
 
     uint32_t nextGetRequestId;
 
-    void ProcessAndTransmitGetRequest(GetRequest *getRequest);
+    // Answers and deletes getRequest, on a worker thread if started
+    void ProcessAndTransmitGetRequest(GetRequest *getRequest, bool fromRemoteServer=false);
+    void WriteGetResponse(GetRequest *getRequest, BitStream *bsOut);
+
+    struct GetRequestJob
+    {
+        CloudServer *cloudServer;
+        GetRequest *getRequest;
+        // Answering STSC_PROCESS_GET_REQUEST rather than a client
+        bool fromRemoteServer;
+        RakNet::BitStream bsOut;
+    };
+    static GetRequestJob* ProcessGetRequestJobCB(GetRequestJob* job, bool *returnOutput, void* perThreadData);
+    void SendGetRequestJob(GetRequestJob *job);
+    void DeallocateGetRequestJob(GetRequestJob *job);
+    void ClearGetRequestJobs(void);
+    ThreadPool<GetRequestJob*, GetRequestJob*> getRequestThreadPool;
 
     void ProcessCloudQueryWithAddresses(
         CloudServer::CloudQueryWithAddresses &cloudQueryWithAddresses,
@@ -321,7 +392,7 @@ protected:
         DataStructures::List<RemoteServer*> &remoteServersWithData
         );
 
-    CloudServer::CloudDataList *GetOrAllocateCloudDataList(CloudKey key, bool *dataRepositoryExists, unsigned int &dataRepositoryIndex);
+    CloudServer::CloudDataList *GetOrAllocateCloudDataList(CloudKey key, bool *dataRepositoryExists);
 
     void UnsubscribeFromKey(RemoteCloudClient *remoteCloudClient, RakNetGUID remoteCloudClientGuid, unsigned int keySubscriberIndex, CloudKey &cloudKey, DataStructures::List<RakNetGUID> &specificSystems);
     void RemoveSpecificSubscriber(RakNetGUID specificSubscriber, CloudDataList *cloudDataList, RakNetGUID remoteCloudClientGuid);
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file CompressionInterface.h
+/// \brief Interface for block compression codecs used by DataCompressor, FileListTransfer and RakPeer::SetMessageCompression()
+///
+
+
+#ifndef __COMPRESSION_INTERFACE_H
+#define __COMPRESSION_INTERFACE_H
+
+#include "Export.h"
+
+namespace RakNet
+{
+
+/// \brief Compresses and decompresses independent blocks of data.
+/// \details Derive from this to plug a codec into DataCompressor, FileListTransfer::SetCompressor() and RakPeer::SetMessageCompression().
+/// The sender and the receiver must use the same codec. LZCompressor is included with RakNet.<BR>
+/// Compress() and Decompress() may be called by several threads at once, so implementations should not keep state between calls.
+class RAK_DLL_EXPORT CompressionInterface
+{
+public:
+    virtual ~CompressionInterface() {}
+
+    /// \return The largest output Compress() can produce for \a inputLength bytes of input
+    virtual unsigned int GetMaxCompressedLength(unsigned int inputLength) const=0;
+
+    /// \brief Compress \a inputLength bytes of \a input to \a output.
+    /// \param[in] outputCapacity Size of \a output. Must be at least GetMaxCompressedLength(inputLength).
+    /// \return How many bytes were written to \a output, or 0 on failure
+    virtual unsigned int Compress(const unsigned char *input, unsigned int inputLength, unsigned char *output, unsigned int outputCapacity) const=0;
+
+    /// \brief Decompress data written by Compress().
+    /// \details Must not read or write out of bounds, whatever \a input contains.
+    /// \param[in] outputLength The length of the original data. Exactly this many bytes are written to \a output.
+    /// \return false if \a input is corrupt or does not decompress to \a outputLength bytes
+    virtual bool Decompress(const unsigned char *input, unsigned int inputLength, unsigned char *output, unsigned int outputLength) const=0;
+};
+
+} // namespace RakNet
+
+#endif
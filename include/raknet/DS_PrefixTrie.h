@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file DS_PrefixTrie.h
+/// \internal
+/// \brief Set of bit string prefixes with expiry times, such as address ranges, written under a mutex and read without locking
+///
+
+
+#ifndef __PREFIX_TRIE_H
+#define __PREFIX_TRIE_H
+
+#include "Export.h"
+#include "RakNetTime.h"
+#include "SimpleMutex.h"
+#include "DS_Heap.h"
+#include <atomic>
+
+namespace DataStructures
+{
+    /// \brief Binary radix trie of prefixes of keys up to MAX_KEY_BYTES long.
+    /// Contains() is true if any unexpired prefix in the set matches the start of a key, in O(key bits).
+    /// Writers are serialized by an internal mutex. A write copies the path it changes and publishes a new root, so readers see
+    /// either the old or the new version and never lock. The replaced nodes are freed once every reader that could still hold them has finished.
+    /// Expiry times are also kept in a heap, so RemoveExpired() only visits prefixes that expired.
+    class RAK_DLL_EXPORT PrefixTrie
+    {
+    public:
+        static const unsigned int MAX_KEY_BYTES = 17;
+
+        PrefixTrie();
+        ~PrefixTrie();
+
+        /// Adds the first \a prefixBits bits of \a key. If the prefix is already in the set, only its timeout changes.
+        /// \param[in] timeout Time after which the prefix no longer matches. 0 to never expire.
+        void Add(const unsigned char *key, unsigned int prefixBits, RakNet::TimeMS timeout);
+
+        /// Removes the first \a prefixBits bits of \a key, if it is in the set. Longer and shorter prefixes are unaffected.
+        /// \return true if the prefix was in the set
+        bool Remove(const unsigned char *key, unsigned int prefixBits);
+
+        /// Removes every prefix
+        void Clear(void);
+
+        /// Removes prefixes whose timeout is before \a time. Does not lock if none have.
+        void RemoveExpired(RakNet::TimeMS time);
+
+        /// \return true if a prefix in the set, that has not expired at \a time, matches the first bits of \a key. Threadsafe, does not lock.
+        bool Contains(const unsigned char *key, unsigned int keyBits, RakNet::TimeMS time) const;
+
+        /// \return Number of prefixes in the set, including expired ones not yet removed
+        unsigned int Size(void) const;
+
+        /// Incremented by every Add(). Lets callers cache that a key was not contained.
+        unsigned int GetAddCount(void) const {return addCount.load(std::memory_order_acquire);}
+
+    protected:
+        struct Node
+        {
+            unsigned char key[MAX_KEY_BYTES];
+            unsigned int prefixBits;
+            // Nodes created only to branch are not in the set
+            bool inSet;
+            RakNet::TimeMS timeout;
+            Node *child[2];
+            // Number of parents and roots, over all versions, pointing to this node. Only changed by writers.
+            unsigned int refCount;
+        };
+
+        Node *NewNode(const unsigned char *key, unsigned int prefixBits, bool inSet, RakNet::TimeMS timeout);
+        Node *CloneNode(Node *node);
+        void ReleaseNode(Node *node);
+        // These return a node holding one reference for the caller, which may be the unchanged input
+        Node *InsertNode(Node *node, const unsigned char *key, unsigned int prefixBits, RakNet::TimeMS timeout);
+        Node *RemoveNode(Node *node, const unsigned char *key, unsigned int prefixBits, bool *removed);
+        Node *Collapse(Node *node);
+        const Node *FindNode(const unsigned char *key, unsigned int prefixBits) const;
+        void Publish(Node *newRoot);
+        void WaitForReaders(void);
+
+        std::atomic<Node*> root;
+        // Readers count themselves in the slot for the current epoch. Writers flip the epoch and wait for the old slot to drain.
+        mutable std::atomic<unsigned int> readers[2];
+        std::atomic<unsigned int> readerEpoch;
+        std::atomic<unsigned int> addCount;
+        // Earliest timeout in expiryHeap, or 0 if it is empty
+        std::atomic<RakNet::TimeMS> nextExpiry;
+        std::atomic<unsigned int> size;
+        RakNet::SimpleMutex writeMutex;
+
+        struct ExpiryEntry
+        {
+            unsigned char key[MAX_KEY_BYTES];
+            unsigned int prefixBits;
+        };
+        Heap<RakNet::TimeMS, ExpiryEntry, false> expiryHeap;
+    };
+}
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file DS_SeqLockHash.h
+/// \internal
+/// \brief Fixed capacity hash of 64 bit keys to indices, written by one thread and read by any thread without locking
+///
+
+
+#ifndef __SEQ_LOCK_HASH_H
+#define __SEQ_LOCK_HASH_H
+
+#include "Export.h"
+#include <stdint.h>
+#include <atomic>
+
+namespace DataStructures
+{
+    /// \brief Maps 64 bit keys to unsigned int values with open addressing.
+    /// Use Set() to keep one value per key, or Add() to keep several, such as when keys are hashes that can collide.
+    /// Only one thread may call Set(), Remove() and RemoveIfValue(). Any thread may call Get() at the same time.
+    /// Readers never block the writer. A reader retries if the writer changed the table during its lookup, using a sequence counter.
+    class RAK_DLL_EXPORT SeqLockHash
+    {
+    public:
+        SeqLockHash();
+        ~SeqLockHash();
+
+        /// Allocates room for \a maxElements keys. Not threadsafe.
+        void Init(unsigned int maxElements);
+
+        /// Frees all memory. Not threadsafe.
+        void Clear(void);
+
+        /// Adds \a key, or changes its value if it already exists. Writer thread only.
+        void Set(uint64_t key, unsigned int value);
+
+        /// Adds \a value for \a key, keeping any other values \a key already has. Does nothing if \a key already has \a value.
+        /// Every value counts toward the maxElements passed to Init(). Writer thread only.
+        void Add(uint64_t key, unsigned int value);
+
+        /// Removes \a key if it exists. Writer thread only.
+        void Remove(uint64_t key);
+
+        /// Removes \a value for \a key, if \a key has it. Writer thread only.
+        void RemoveIfValue(uint64_t key, unsigned int value);
+
+        /// \param[out] value Written with the value for \a key if it exists
+        /// \return true if \a key exists. Threadsafe.
+        bool Get(uint64_t key, unsigned int &value) const;
+
+        /// Like Get(), for keys with values from Add(). \a matches is called with each value of \a key, and may be called again if the writer changed the table meanwhile.
+        /// \param[out] value Written with the first value for \a key that \a matches returns true for
+        /// \return true if there is such a value. Threadsafe.
+        template <class Matches>
+        bool Get(uint64_t key, unsigned int &value, const Matches &matches) const;
+
+        static const unsigned int EMPTY_VALUE = (unsigned int) -1;
+
+    protected:
+        struct Slot
+        {
+            std::atomic<uint64_t> key;
+            std::atomic<unsigned int> value;
+        };
+
+        unsigned int FindSlot(uint64_t key) const;
+        unsigned int FindSlot(uint64_t key, unsigned int value) const;
+        void InsertSlot(uint64_t key, unsigned int value);
+        void RemoveSlot(unsigned int slotIndex);
+        void BeginWrite(void);
+        void EndWrite(void);
+        unsigned int HomeSlot(uint64_t key) const;
+
+        Slot *slots;
+        unsigned int capacityMask;
+        std::atomic<unsigned int> sequence;
+    };
+
+    template <class Matches>
+    bool SeqLockHash::Get(uint64_t key, unsigned int &value, const Matches &matches) const
+    {
+        if (slots==0)
+            return false;
+
+        unsigned int before, after, result;
+        do
+        {
+            before=sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                after=before+1;
+                continue;
+            }
+            result=EMPTY_VALUE;
+            unsigned int slotIndex=HomeSlot(key);
+            for (unsigned int probes=0; probes <= capacityMask; probes++)
+            {
+                unsigned int slotValue=slots[slotIndex].value.load(std::memory_order_relaxed);
+                if (slotValue==EMPTY_VALUE)
+                    break;
+                if (slots[slotIndex].key.load(std::memory_order_relaxed)==key && matches(slotValue))
+                {
+                    result=slotValue;
+                    break;
+                }
+                slotIndex=(slotIndex+1) & capacityMask;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after=sequence.load(std::memory_order_relaxed);
+        } while (before!=after);
+
+        if (result==EMPTY_VALUE)
+            return false;
+        value=result;
+        return true;
+    }
+}
+
+#endif
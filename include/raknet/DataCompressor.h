@@ -22,6 +22,7 @@
 
 namespace RakNet
 {
+class CompressionInterface;
 
 /// \brief Does compression on a block of data.  Not very good compression, but it's small and fast so is something you can compute at runtime.
 class RAK_DLL_EXPORT DataCompressor
@@ -32,6 +33,16 @@ public:
 
     static void Compress( unsigned char *userData, unsigned sizeInBytes, RakNet::BitStream * output );
     static unsigned DecompressAndAllocate( RakNet::BitStream * input, unsigned char **output );
+
+    /// \brief Compress with \a compressor instead of Huffman encoding, such as with LZCompressor, which is much faster and usually compresses better.
+    /// \details Unlike the Huffman version, works for any size of data. Data that does not compress is written as is.
+    /// Read with the DecompressAndAllocate() that takes a compressor of the same type.
+    static void Compress( unsigned char *userData, unsigned sizeInBytes, RakNet::BitStream * output, CompressionInterface *compressor );
+
+    /// \brief Read data written by the Compress() that takes \a compressor.
+    /// \param[out] output Allocated with malloc(). Not allocated if 0 is returned.
+    /// \return The number of bytes written to \a output, or 0 if \a input was corrupt or empty
+    static unsigned DecompressAndAllocate( RakNet::BitStream * input, unsigned char **output, CompressionInterface *compressor );
 };
 
 } // namespace RakNet
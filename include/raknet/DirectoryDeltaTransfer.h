@@ -59,6 +59,7 @@ class FileListTransfer;
 class FileListTransferCBInterface;
 class FileListProgress;
 class IncrementalReadInterface;
+class FileHasher;
 
 class RAK_DLL_EXPORT DirectoryDeltaTransfer : public PluginInterface2
 {
@@ -150,6 +151,11 @@ public:
     /// \param[in] _chunkSize How large of a block of a file to send at once
     void SetDownloadRequestIncrementalReadInterface(IncrementalReadInterface *_incrementalReadInterface, unsigned int _chunkSize);
 
+    /// \brief Hash files with \a hasher in AddUploadsFromSubdirectory(), GenerateHashes(), and DownloadFromSubdirectory().
+    /// \details \a hasher reads files on its worker threads, and remembers hashes of files that did not change, so directories are not reread in full every time.
+    /// \param[in] hasher An externally allocated FileHasher, which must remain valid while in use. Pass 0 to hash serially.
+    void SetFileHasher(FileHasher *hasher);
+
     /// \internal For plugin handling
     virtual PluginReceiveResult OnReceive(Packet *packet);
 protected:
@@ -162,6 +168,7 @@ protected:
     char orderingChannel;
     IncrementalReadInterface *incrementalReadInterface;
     unsigned int chunkSize;
+    FileHasher *fileHasher;
 };
 
 } // namespace RakNet
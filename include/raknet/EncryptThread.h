@@ -0,0 +1,83 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file EncryptThread.h
+/// \internal
+/// \brief Encrypts and sends the datagrams of secure connections on worker threads
+///
+
+
+#ifndef __ENCRYPT_THREAD_H
+#define __ENCRYPT_THREAD_H
+
+#include "NativeFeatureIncludes.h"
+
+#ifdef LIBCAT_SECURITY
+
+#include "SecureHandshake.h"
+#include "RakNetTypes.h"
+#include "MTUSize.h"
+#include "SimpleMutex.h"
+#include "DS_ThreadsafeAllocatingQueue.h"
+#include "ThreadPool.h"
+#include <atomic>
+
+namespace RakNet
+{
+class RakNetSocket2;
+
+/// \internal
+/// Pool of workers, one per processor by default, that encrypt datagrams and send them, so the update thread does not have to.
+/// Datagrams to the same system always go to the same worker, so they are sent in the order they were queued.
+/// The IV of each datagram is reserved by the update thread when it is queued, so IVs still increase in send order.
+/// Shared by every RakPeer in the process, like SendToThread.
+class EncryptThread
+{
+public:
+    struct EncryptThreadBlock
+    {
+        // Only the keys are read, which do not change until pendingSends is 0
+        const cat::AuthenticatedEncryption *authEnc;
+        cat::u64 iv;
+        RakNetSocket2 *s;
+        SystemAddress systemAddress;
+        // Decremented after the datagram was sent
+        std::atomic<unsigned int> *pendingSends;
+        unsigned int dataWriteOffset;
+        char data[MAXIMUM_MTU_SIZE];
+    };
+
+    static EncryptThreadBlock* AllocateBlock(void);
+    /// Queues \a block on the worker for its system address. Increment *block->pendingSends first.
+    static void ProcessBlock(EncryptThreadBlock* block);
+
+    /// \return true if there are workers. If not, encrypt and send on the calling thread.
+    static bool IsRunning(void);
+
+    /// Sets how many workers to start the next time the pool starts.
+    /// 0, the default, for one less than the number of processors, so the update thread keeps a processor to itself. That is no workers on a single processor.
+    static void SetNumberOfThreads(unsigned int _numberOfThreads);
+
+    static void AddRef(void);
+    static void Deref(void);
+    static DataStructures::ThreadsafeAllocatingQueue<EncryptThreadBlock> objectQueue;
+protected:
+    static int refCount;
+    static SimpleMutex refCountMutex;
+    static unsigned int numberOfThreads;
+    // One pool of one thread per worker, so each has its own queue
+    static ThreadPool<EncryptThreadBlock*,EncryptThreadBlock*> *workers;
+    static std::atomic<unsigned int> numWorkers;
+};
+}
+
+#endif // LIBCAT_SECURITY
+
+#endif
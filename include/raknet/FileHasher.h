@@ -0,0 +1,135 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file FileHasher.h
+/// \brief Hashes files on worker threads, remembering the hash of each file by path, size and modification time
+///
+
+
+#include "NativeFeatureIncludes.h"
+#if _RAKNET_SUPPORT_FileOperations==1
+
+#ifndef __FILE_HASHER_H
+#define __FILE_HASHER_H
+
+#include "Export.h"
+#include "RakString.h"
+#include "DS_Hash.h"
+#include "SimpleMutex.h"
+#include "SignaledEvent.h"
+#include "ThreadPool.h"
+#include <stdint.h>
+
+namespace RakNet
+{
+
+/// \brief Computes SuperFastHashFile() for many files at once, skipping files whose hash is already known.
+/// \details Every hash computed is stored in a manifest keyed by the full path of the file, along with the file size and modification time.
+/// A file whose size and modification time match the manifest is not read again. Save the manifest with SaveManifest() and load it with
+/// LoadManifest() on the next run, so that startup only reads files that changed.<BR>
+/// Files that are not in the manifest are hashed by the threads started with StartThreads(), or by the calling thread if none were started.<BR>
+/// Pass an instance to FileList::SetFileHasher() or DirectoryDeltaTransfer::SetFileHasher() to use it for directory scans.
+/// All functions are threadsafe.
+class RAK_DLL_EXPORT FileHasher
+{
+public:
+    // GetInstance() and DestroyInstance(instance*)
+    STATIC_FACTORY_DECLARATIONS(FileHasher)
+
+    FileHasher();
+    virtual ~FileHasher();
+
+    /// \brief Start worker threads to read and hash files.
+    /// \param[in] numThreads How many threads to start. Disk bound hashing usually gains little beyond 4 to 8.
+    /// \return True on success
+    bool StartThreads(int numThreads);
+
+    /// Stop the threads started with StartThreads(). Files are then hashed on the calling thread.
+    void StopThreads(void);
+
+    /// \brief Hash \a count files.
+    /// \details Blocks until all files are hashed.
+    /// \param[in] fullPaths Path to each file
+    /// \param[in] count How many elements are in \a fullPaths, \a hashes, and \a succeeded
+    /// \param[out] hashes The result of SuperFastHashFile() for each file. 0 for files that could not be read.
+    /// \param[out] succeeded Optional. Set to false for files that could not be read.
+    void HashFiles(const char * const *fullPaths, unsigned int count, uint32_t *hashes, bool *succeeded=0);
+
+    /// Hash one file. Same as HashFiles() with a count of 1.
+    /// \return False if the file could not be read
+    bool HashFile(const char *fullPath, uint32_t *hash);
+
+    /// \brief Read a manifest written by SaveManifest(), adding its entries to the current manifest.
+    /// \return False if the file could not be read or is not a manifest
+    bool LoadManifest(const char *path);
+
+    /// \brief Write the current manifest to disk.
+    /// \param[in] path Where to write the manifest
+    /// \param[in] onlyUsedEntries If true, leave out entries that were neither loaded and then looked up, nor hashed, since the manifest was loaded. This drops deleted files.
+    /// \return False if the file could not be written
+    bool SaveManifest(const char *path, bool onlyUsedEntries=false);
+
+    /// Forget all known hashes
+    void ClearManifest(void);
+
+    /// Returns how many files are in the manifest
+    unsigned int GetManifestSize(void);
+
+    /// Returns how many lookups were answered from the manifest without reading the file
+    unsigned int GetCacheHitCount(void);
+
+    /// Returns how many files were read and hashed
+    unsigned int GetFilesHashedCount(void);
+
+protected:
+    struct ManifestEntry
+    {
+        uint64_t fileLength;
+        int64_t modificationTime;
+        uint32_t hash;
+        bool used;
+    };
+
+    struct HashBatch
+    {
+        const char * const *fullPaths;
+        uint32_t *hashes;
+        bool *succeeded;
+        uint64_t *fileLengths;
+        int64_t *modificationTimes;
+        unsigned int remaining;
+        SimpleMutex remainingMutex;
+        SignaledEvent doneEvent;
+    };
+
+    struct HashJob
+    {
+        FileHasher *fileHasher;
+        HashBatch *batch;
+        unsigned int index;
+    };
+
+    static int HashJobCB(HashJob job, bool *returnOutput, void* perThreadData);
+    void HashAndStore(HashBatch *batch, unsigned int index);
+    bool LookupManifest(const char *fullPath, uint64_t fileLength, int64_t modificationTime, uint32_t *hash);
+    static bool GetFileInfo(const char *fullPath, uint64_t *fileLength, int64_t *modificationTime);
+
+    DataStructures::Hash<RakString, ManifestEntry, 16384, RakString::ToInteger> manifest;
+    SimpleMutex manifestMutex;
+    unsigned int cacheHitCount, filesHashedCount;
+
+    ThreadPool<HashJob, int> threadPool;
+};
+
+} // namespace RakNet
+
+#endif
+
+#endif // _RAKNET_SUPPORT_*
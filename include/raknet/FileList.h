@@ -38,6 +38,7 @@ namespace RakNet
 /// Forward declarations
 class RakPeerInterface;
 class FileList;
+class FileHasher;
 
 
 /// Represents once instance of a file
@@ -246,12 +247,24 @@ public:
     /// \param[out] callbacks The list is set to the list of callbacks
     void GetCallbacks(DataStructures::List<FileListProgress*> &callbacks);
 
+    /// \brief Hash files with \a hasher in AddFilesFromDirectory() and ListMissingOrChangedFiles(), rather than reading each file on the calling thread.
+    /// \details \a hasher reads files on its worker threads, and skips files it has already hashed that have not changed since. Hashes are identical either way.
+    /// \param[in] hasher An externally allocated FileHasher, which must remain valid while in use. Pass 0 to hash serially.
+    void SetFileHasher(FileHasher *hasher);
+
+    /// Returns the value passed to SetFileHasher()
+    FileHasher *GetFileHasher(void) const;
+
     // Here so you can read it, but don't modify it
     DataStructures::List<FileListNode> fileList;
 
     static bool FixEndingSlash(char *str);
 protected:
+    /// Same as AddFile(), but skips the search for an existing file of the same name if \a checkDuplicates is false
+    void AddFileInternal(const char *filename, const char *fullPathToFile, const char *data, const unsigned dataLength, const unsigned fileLength, FileListNodeContext context, bool isAReference, bool takeDataPointer, bool checkDuplicates);
+
     DataStructures::List<FileListProgress*> fileListProgressCallbacks;
+    FileHasher *fileHasher;
 };
 
 } // namespace RakNet
@@ -36,6 +36,7 @@ namespace RakNet
 class IncrementalReadInterface;
 class FileListTransferCBInterface;
 class FileListProgress;
+class CompressionInterface;
 struct FileListReceiver;
 
 /// \defgroup FILE_LIST_TRANSFER_GROUP FileListTransfer
@@ -82,10 +83,31 @@ public:
     /// \param[in] setID The return value of SetupReceive() which was previously called on \a recipient
     /// \param[in] priority Passed to RakPeerInterface::Send()
     /// \param[in] orderingChannel Passed to RakPeerInterface::Send()
-    /// \param[in] _incrementalReadInterface If a file in \a fileList has no data, _incrementalReadInterface will be used to read the file in chunks of size \a chunkSize
+    /// \param[in] _incrementalReadInterface If a file in \a fileList has no data, _incrementalReadInterface will be used to read the file in chunks of size \a chunkSize. Pass a MappedFileReadInterface to stream files from memory mapped pages shared by all recipients
     /// \param[in] _chunkSize How large of a block of a file to read/send at once. Large values use more memory but transfer slightly faster.
     void Send(FileList *fileList, RakNet::RakPeerInterface *rakPeer, SystemAddress recipient, unsigned short setID, PacketPriority priority, char orderingChannel, IncrementalReadInterface *_incrementalReadInterface=0, unsigned int _chunkSize=262144*4*16);
 
+    /// \brief How many chunks read with an IncrementalReadInterface may be sent to one recipient before that recipient acknowledges them.
+    /// Each chunk is sent as ID_FILE_LIST_REFERENCE_PUSH, which the recipient acknowledges once it fully arrives.
+    /// Higher values keep the connection busy on high latency links, but hold up to \a count * \a _chunkSize bytes per recipient in RakPeer's send and resend buffers.
+    /// With small chunk sizes and MappedFileReadInterface, large files stream without being read into memory in full. Defaults to 1.
+    /// \param[in] count How many chunks may be in flight, at least 1
+    void SetMaxChunksInFlight(unsigned int count);
+
+    /// Returns the value passed to SetMaxChunksInFlight()
+    unsigned int GetMaxChunksInFlight(void) const;
+
+    /// \brief Compress each file, and each chunk read with an IncrementalReadInterface, with \a compressor before sending it.
+    /// \details The receiving FileListTransfer must be given the same type of compressor to decompress it, and must be from a version that has SetCompressor(). Data that does not compress is sent as is.
+    /// Progress notifications for a compressed file that is still arriving do not include its data.
+    /// Without a compressor, what is sent is the same as before compression was added. With one, ID_FILE_LIST_TRANSFER_HEADER ends with a bit set to 1, which older receivers do not read.
+    /// Then each ID_FILE_LIST_TRANSFER_FILE and ID_FILE_LIST_REFERENCE_PUSH has, before the data, a bit that says whether that part is compressed, followed if so by its compressed length written with WriteCompressed().
+    /// \param[in] compressor For example, an LZCompressor. This pointer is held internally, so should remain valid as long as this class is valid. Pass 0 to not compress, which is the default.
+    void SetCompressor(CompressionInterface *compressor);
+
+    /// Returns the value passed to SetCompressor()
+    CompressionInterface *GetCompressor(void) const;
+
     /// Return number of files waiting to go out to a particular address
     unsigned int GetPendingFilesToAddress(SystemAddress recipient);
 
@@ -130,7 +152,7 @@ protected:
 
     void OnReferencePush(Packet *packet, bool fullFile);
     void OnReferencePushAck(Packet *packet);
-    void SendIRIToAddress(SystemAddress systemAddress, unsigned short setId);
+    void SendIRIToAddress(SystemAddress systemAddress, unsigned short setId, bool chunkAcknowledged);
 
     DataStructures::Map<unsigned short, FileListReceiver*> fileListReceivers;
     unsigned short setId;
@@ -146,6 +168,8 @@ protected:
         unsigned int setIndex;
         IncrementalReadInterface *incrementalReadInterface;
         unsigned int chunkSize;
+        // From SetCompressor() when the set header was sent, which says whether the chunks say they are compressed
+        CompressionInterface *compressor;
     };
     struct FileToPushRecipient
     {
@@ -158,20 +182,34 @@ protected:
         SystemAddress systemAddress;
         unsigned short setId;
 
-        //// SimpleMutex filesToPushMutex;
+        // Held while reading and sending chunks, so worker threads handling acks for the same recipient send in order
+        SimpleMutex filesToPushMutex;
         DataStructures::Queue<FileToPush*> filesToPush;
+        // ID_FILE_LIST_REFERENCE_PUSH sent without ID_FILE_LIST_REFERENCE_PUSH_ACK yet
+        unsigned int chunksInFlight;
     };
     DataStructures::List< FileToPushRecipient* > fileToPushRecipientList;
     SimpleMutex fileToPushRecipientListMutex;
     void RemoveFromList(FileToPushRecipient *ftpr);
+    // Returns the next chunk of ftp, either mapped in place or read into readBuffer, which is grown as needed
+    static const char *ReadFilePart(FileToPush *ftp, char **readBuffer, unsigned int *readBufferSize, unsigned int *bytesRead);
+    static void ReleaseFilePart(FileToPush *ftp, const char *fileData, const char *readBuffer);
+    // With a compressor, writes whether the data is compressed, and returns what to send after the header: either data, or data compressed into compressBuffer, which is grown as needed
+    static const char *WriteFilePartCompression(CompressionInterface *compressor, RakNet::BitStream *outBitstream, const char *data, unsigned int *length, char **compressBuffer, unsigned int *compressBufferSize);
+    // Reads what WriteFilePartCompression() wrote, and copies or decompresses \a length bytes to \a output
+    bool ReadFilePartData(RakNet::BitStream *inBitStream, bool compressed, unsigned int compressedLength, char *output, unsigned int length);
 
     struct ThreadData
     {
         FileListTransfer *fileListTransfer;
         SystemAddress systemAddress;
         unsigned short setId;
+        bool chunkAcknowledged;
     };
 
+    unsigned int maxChunksInFlight;
+    CompressionInterface *compressor;
+
     ThreadPool<ThreadData, int> threadPool;
 
     friend int SendIRIToAddressCB(FileListTransfer::ThreadData threadData, bool *returnOutput, void* perThreadData);
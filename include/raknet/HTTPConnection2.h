@@ -25,6 +25,7 @@
 #include "DS_Queue.h"
 #include "PluginInterface2.h"
 #include "SimpleMutex.h"
+#include "RakNetTime.h"
 
 namespace RakNet
 {
@@ -34,7 +35,14 @@ struct SystemAddress;
 
 /// \brief Use HTTPConnection2 to communicate with a web server.
 /// \details Start an instance of TCPInterface via the Start() command.
-/// This class will handle connecting to transmit a request
+/// This class will handle connecting to transmit a request.
+/// Connections are kept open and reused for later requests to the same host, up to SetMaxConnectionsPerHost() of them.
+/// Several requests may be sent on one connection before their responses arrive (HTTP/1.1 pipelining), up to SetMaxPipelinedRequests().
+/// Responses are parsed as they arrive, including chunked ones. Requests on different connections may complete in a different order than they were transmitted.
+/// The body is not streamed to the caller: the whole response is held in memory, and returned by GetResponse() once complete, so it must fit in 4 GB.
+/// Only GET, HEAD, OPTIONS and TRACE requests are pipelined, and sent again if their connection closes before the response is complete, up to SetMaxRetries() times.
+/// Other requests, such as POST, PUT and DELETE, are sent only on a connection with no other request waiting, and nothing is sent after them until they are answered.
+/// They are never sent twice: if their connection closes first, they complete with no response.
 class RAK_DLL_EXPORT HTTPConnection2 : public PluginInterface2
 {
 public:
@@ -45,6 +53,7 @@ public:
     virtual ~HTTPConnection2();
 
     /// \brief Connect to, then transmit a request to a TCP based server
+    /// \details If a connection to the host is open and has room, the request is sent on it rather than connecting again
     /// \param[in] tcp An instance of TCPInterface that previously had TCPInterface::Start() called
     /// \param[in] stringToTransmit What string to transmit. See RakString::FormatForPOST(), RakString::FormatForGET(), RakString::FormatForDELETE()
     /// \param[in] host The IP address to connect to
@@ -62,9 +71,9 @@ public:
     /// This will only potentially return true after a call to ProcessTCPPacket() or OnLostConnection()
     /// \param[out] stringTransmitted The original string transmitted
     /// \param[out] hostTransmitted The parameter of the same name passed to TransmitRequest()
-    /// \param[out] responseReceived The response, if any
+    /// \param[out] responseReceived The response, if any. A chunked body is returned joined, after the headers. Empty if the request failed, or its connection closed before the response was complete.
     /// \param[out] hostReceived The SystemAddress from ProcessTCPPacket() or OnLostConnection()
-    /// \param[out] contentOffset The offset from the start of responseReceived to the data body. Equivalent to searching for \r\n\r\n in responseReceived.
+    /// \param[out] contentOffset The offset from the start of responseReceived to the data body, or -1 if there is no body.
     /// \param[out] userData Whatever you passed to TransmitRequest
     /// \return true if there was a response. false if not.
     bool GetResponse( RakString &stringTransmitted, RakString &hostTransmitted, RakString &responseReceived, SystemAddress &hostReceived, int &contentOffset, void **userData );
@@ -76,6 +85,20 @@ public:
     /// \brief Return if any requests are waiting to be read by the user
     bool HasResponse(void) const;
 
+    /// \brief How many connections to open to one host, when the open ones are busy. Defaults to 4.
+    void SetMaxConnectionsPerHost(unsigned int count);
+
+    /// \brief How many requests to send on one connection before their responses arrive. Defaults to 4.
+    /// \details 1 waits for each response before sending the next request on that connection.
+    void SetMaxPipelinedRequests(unsigned int count);
+
+    /// \brief How long to keep a connection with no requests open, in milliseconds. Defaults to 30000.
+    void SetIdleTimeout(RakNet::TimeMS timeoutMS);
+
+    /// \brief How many times to send a GET, HEAD, OPTIONS or TRACE request again, when its connection closes before the response is complete. Defaults to 1.
+    /// \details Requests pipelined after it are sent again too, without counting, as the server did not get to them.
+    void SetMaxRetries(unsigned int count);
+
     struct Request
     {
         RakString stringToTransmit;
@@ -86,34 +109,114 @@ public:
         unsigned short port;
         bool useSSL;
         int contentOffset;
-        int contentLength;
+        // From the Content-Length header, or -1
+        int64_t contentLength;
         int ipVersion;
         void *userData;
         bool chunked;
-        size_t thisChunkSize;
-        size_t bytesReadForThisChunk;
+        // GET, HEAD, OPTIONS or TRACE, which may be pipelined and sent again (RFC 7230 6.3.1 and 6.3.2)
+        bool repeatable;
+        // Times sent again because its connection closed before the response was complete, as a server may close an idle connection as a request is sent
+        unsigned int retryCount;
     };
 
     /// \internal
+    virtual void Update(void);
     virtual PluginReceiveResult OnReceive(Packet *packet);
     virtual void OnClosedConnection(const SystemAddress &systemAddress, RakNetGUID rakNetGUID, PI2_LostConnectionReason lostConnectionReason );
     virtual void OnNewConnection(const SystemAddress &systemAddress, RakNetGUID rakNetGUID, bool isIncoming);
     virtual void OnFailedConnectionAttempt(Packet *packet, PI2_FailedConnectionAttemptReason failedConnectionAttemptReason);
+    virtual void OnRakPeerShutdown(void);
 
 protected:
+    /// What the response parser of a connection reads next
+    enum ResponseState
+    {
+        RS_HEADERS,
+        RS_BODY,
+        RS_BODY_UNTIL_CLOSE,
+        RS_CHUNK_SIZE,
+        RS_CHUNK_DATA,
+        RS_CHUNK_DATA_END,
+        RS_CHUNK_TRAILER
+    };
+
+    /// A connection to a host, and the responses it is receiving
+    struct Connection
+    {
+        RakString host;
+        unsigned short port;
+        bool useSSL;
+        int ipVersion;
+        // Matched with the address of a completed or failed connection attempt, which does not say which attempt it was
+        SystemAddress hostEstimatedAddress;
+        // Once connected. Includes systemIndex, which tells apart connections to the same host.
+        SystemAddress systemAddress;
+        bool connected;
+        // A request or response said Connection: close, so no more requests are sent on it
+        bool closeAfterResponses;
+        // A response said the server closes the connection after it, so it did not read the requests sent after that one
+        bool serverCloses;
+        // Sent and not yet answered, oldest first, as the responses arrive in this order
+        DataStructures::Queue<Request*> sentRequests;
+        RakNet::TimeMS idleSince;
+
+        // The response to sentRequests.Peek(), as received so far
+        ResponseState state;
+        char *response;
+        unsigned int responseLength, responseCapacity;
+        // Length of the headers, once they are complete
+        unsigned int headersLength;
+        // Of the body or the current chunk
+        size_t bytesRemaining;
+        // A chunk size or trailer line, which may arrive in pieces
+        char line[64];
+        unsigned int lineLength;
+    };
 
     bool IsConnected(SystemAddress sa);
-    void SendRequest(Request *request);
-    void RemovePendingRequest(SystemAddress sa);
-    void SendNextPendingRequest(void);
-    void SendPendingRequestToConnectedSystem(SystemAddress sa);
+    void SendRequest(Connection *connection, Request *request);
+    bool IsSameHost(const Connection *connection, const Request *request) const;
+    bool IsSameHost(const Request *request1, const Request *request2) const;
+    /// \return The connection with this address and systemIndex, or 0
+    Connection *GetConnection(const SystemAddress &systemAddress, unsigned int *index);
+    /// Adds a connection, not yet connected, to the host of \a request
+    Connection *NewConnection(const Request *request);
+    /// Sends pending requests on connections with room, and opens connections for the rest
+    void SendPendingRequests(void);
+    /// \return Whether \a request may be sent on \a connection now
+    bool HasRoomFor(const Connection *connection, const Request *request) const;
+    /// Appends to the response of \a connection
+    /// \return false if it would not fit in memory
+    bool AppendResponse(Connection *connection, const char *data, unsigned int length);
+    /// Reads a line into Connection::line
+    /// \return true once the line is complete
+    bool ReadLine(Connection *connection, const char **data, unsigned int *length);
+    /// Reads the status line and headers, once all have arrived
+    /// \return false if the body would not fit in memory
+    bool ParseHeaders(Connection *connection);
+    /// \return false if the data is not a valid response, or nothing asked for it
+    bool ParseResponse(Connection *connection, const char *data, unsigned int length);
+    /// Moves the oldest request of \a connection to completedRequests, with what was received of its response
+    void CompleteRequest(Connection *connection);
+    void CompleteRequest(Request *request);
+    /// Deallocates a connection that was closed or never opened
+    /// \param[in] retry Send again, on another connection, the GET, HEAD, OPTIONS and TRACE requests without a complete response, that have retries left
+    void RemoveConnection(unsigned int index, bool retry);
 
     DataStructures::Queue<Request*> pendingRequests;
-    DataStructures::List<Request*> sentRequests;
+    DataStructures::List<Connection*> connections;
     DataStructures::List<Request*> completedRequests;
+    // Requests sent on connections and not yet answered
+    unsigned int sentRequestCount;
 
-    SimpleMutex pendingRequestsMutex, sentRequestsMutex, completedRequestsMutex;
+    // connectionsMutex is for pendingRequests, connections and sentRequestCount. Never call TCPInterface::CloseConnection() holding it, as that calls OnClosedConnection().
+    SimpleMutex connectionsMutex, completedRequestsMutex;
 
+    unsigned int maxConnectionsPerHost;
+    unsigned int maxPipelinedRequests;
+    RakNet::TimeMS idleTimeout;
+    unsigned int maxRetries;
 };
 
 } // namespace RakNet
@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file HandshakeThread.h
+/// \internal
+/// \brief Answers the secure handshake challenges of incoming connections on worker threads
+///
+
+
+#ifndef __HANDSHAKE_THREAD_H
+#define __HANDSHAKE_THREAD_H
+
+#include "NativeFeatureIncludes.h"
+
+#ifdef LIBCAT_SECURITY
+
+#include "SecureHandshake.h"
+#include "RakNetTypes.h"
+#include "RakNetStatistics.h"
+#include "SimpleMutex.h"
+#include "SignaledEvent.h"
+#include "DS_Queue.h"
+#include "ThreadPool.h"
+#include <atomic>
+
+namespace RakNet
+{
+class RakNetSocket2;
+
+/// \internal
+/// Pool of workers that run the key agreement of a server, ServerEasyHandshake::ProcessChallenge(), so the update thread does not have to.
+/// cat::ServerEasyHandshake is not threadsafe, so each worker has its own, made from the same keys.
+/// Finished handshakes are queued for the update thread, which resumes the connection and sends the answer.
+/// Owned by one RakPeer, since the keys belong to it.
+class HandshakeThread : public ThreadDataInterface
+{
+public:
+    struct Job
+    {
+        // Set by the update thread
+        SystemAddress systemAddress;
+        // Matches RemoteSystemStruct::pendingHandshakeId while the connection still waits for this job
+        unsigned int id;
+        uint16_t mtu;
+        char challenge[cat::EasyHandshake::CHALLENGE_BYTES];
+        RakNet::TimeUS queuedTime;
+
+        // Set by the worker
+        bool valid;
+        char answer[cat::EasyHandshake::ANSWER_BYTES];
+        cat::AuthenticatedEncryption authEnc;
+    };
+
+    /// What happened to a job, for statistics
+    enum JobResult
+    {
+        JOB_ANSWERED,
+        JOB_REJECTED,
+        JOB_DISCARDED
+    };
+
+    HandshakeThread();
+    ~HandshakeThread();
+
+    /// Starts the workers. Call Stop() first if they are running.
+    /// \param[in] publicKey The server public key, EasyHandshake::PUBLIC_KEY_BYTES long
+    /// \param[in] privateKey The server private key, EasyHandshake::PRIVATE_KEY_BYTES long
+    /// \param[in] _wakeEvent Set when a job finishes, so the update thread resumes it without waiting for its next cycle
+    void Start(const char *publicKey, const char *privateKey, SignaledEvent *_wakeEvent);
+
+    /// Stops the workers, and deallocates jobs that were queued or finished but not yet resumed
+    void Stop(void);
+
+    bool IsRunning(void) const {return running;}
+
+    Job *AllocateJob(void);
+
+    /// Queues \a job for a worker
+    void ProcessJob(Job *job);
+
+    /// \return A job a worker finished, or 0 if there are none. Pass it to DeallocateJob() after resuming its connection.
+    Job *GetFinishedJob(void);
+
+    /// Deallocates a job returned by GetFinishedJob(), and records what happened to it
+    void DeallocateJob(Job *job, JobResult result);
+
+    /// \param[out] stats Queue depth, outcome counts, and latency percentiles over the most recent handshakes. Threadsafe.
+    void GetStatistics(HandshakeStatistics *stats);
+
+    // ThreadDataInterface. Makes the handshake object of each worker.
+    virtual void* PerThreadFactory(void *context);
+    virtual void PerThreadDestructor(void* factoryResult, void *context);
+
+protected:
+    static Job* HandshakeWorkerThread(Job* input, bool *returnOutput, void* perThreadData);
+
+    // Latencies of the most recent handshakes are kept for the percentiles
+    static const unsigned int LATENCY_HISTORY = 1024;
+
+    ThreadPool<Job*,Job*> workers;
+    bool running;
+    char publicKey[cat::EasyHandshake::PUBLIC_KEY_BYTES];
+    char privateKey[cat::EasyHandshake::PRIVATE_KEY_BYTES];
+    SignaledEvent *wakeEvent;
+
+    DataStructures::Queue<Job*> finishedJobs;
+    SimpleMutex finishedJobsMutex;
+
+    // Jobs queued and not yet deallocated
+    std::atomic<unsigned int> jobsInProgress;
+
+    SimpleMutex statisticsMutex;
+    uint64_t jobCounts[3];
+    RakNet::TimeUS latencies[LATENCY_HISTORY];
+    unsigned int latencyCount;
+    unsigned int latencyWriteIndex;
+};
+}
+
+#endif // LIBCAT_SECURITY
+
+#endif
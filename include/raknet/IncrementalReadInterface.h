@@ -31,6 +31,20 @@ public:
     /// \param[out] preallocatedDestination Write your data here
     /// \return The number of bytes read, or 0 if none
     virtual unsigned int GetFilePart( const char *filename, unsigned int startReadBytes, unsigned int numBytesToRead, void *preallocatedDestination, FileListNodeContext context);
+
+    /// Optionally return part of a file in place, so the caller can send it without copying it into its own buffer first
+    /// The default implementation returns 0, in which case the caller uses GetFilePart() instead.
+    /// \param[in] filename Filename to read
+    /// \param[in] startReadBytes What offset from the start of the file to read from
+    /// \param[in] numBytesToRead The most bytes to return
+    /// \param[out] bytesMapped How many bytes the returned pointer refers to
+    /// \return Pointer to the file data, valid until UnmapFilePart() is called with it, or 0 if not supported
+    virtual const char *MapFilePart( const char *filename, unsigned int startReadBytes, unsigned int numBytesToRead, unsigned int *bytesMapped, FileListNodeContext context);
+
+    /// Releases a pointer returned by MapFilePart()
+    /// \param[in] filename Filename passed to MapFilePart()
+    /// \param[in] data The return value of MapFilePart()
+    virtual void UnmapFilePart( const char *filename, const char *data);
 };
 
 } // namespace RakNet
@@ -106,7 +106,10 @@ struct InternalPacket : public InternalPacketFixedSizeTransmissionHeader
 
         /// If allocation scheme is STACK, data points to stackData and should not be deallocated
         /// This is only used when sending. Received packets are deallocated in RakPeer
-        STACK
+        STACK,
+
+        /// Data is the payload of a PacketPool block, which RakPeer turns into a Packet without copying. Only used when receiving
+        PACKET_POOL
     } allocationScheme;
     InternalPacketRefCountedData *refCountedData;
     /// How many attempts we made at sending this message
@@ -0,0 +1,42 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file LZCompressor.h
+/// \brief Fast byte oriented LZ77 compression, for use wherever a CompressionInterface is taken
+///
+
+
+#ifndef __LZ_COMPRESSOR_H
+#define __LZ_COMPRESSOR_H
+
+#include "CompressionInterface.h"
+#include "Export.h"
+
+namespace RakNet
+{
+
+/// \brief LZ77 compression with no entropy coding, using the LZ4 block format.
+/// \details Compresses at hundreds of megabytes per second and decompresses several times faster than that, so it can be used per message and on file transfers.
+/// Typical game data and text shrinks to about half. Data that is already compressed grows by at most 0.4%.
+/// Keeps no state, so one instance may be shared by any number of threads and classes.
+class RAK_DLL_EXPORT LZCompressor : public CompressionInterface
+{
+public:
+    // GetInstance() and DestroyInstance(instance*)
+    STATIC_FACTORY_DECLARATIONS(LZCompressor)
+
+    virtual unsigned int GetMaxCompressedLength(unsigned int inputLength) const;
+    virtual unsigned int Compress(const unsigned char *input, unsigned int inputLength, unsigned char *output, unsigned int outputCapacity) const;
+    virtual bool Decompress(const unsigned char *input, unsigned int inputLength, unsigned char *output, unsigned int outputLength) const;
+};
+
+} // namespace RakNet
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file MappedFileReadInterface.h
+/// \brief An IncrementalReadInterface that memory maps files, sharing one mapping between every transfer of the same file
+///
+
+
+#ifndef __MAPPED_FILE_READ_INTERFACE_H
+#define __MAPPED_FILE_READ_INTERFACE_H
+
+#include "IncrementalReadInterface.h"
+#include "RakString.h"
+#include "SimpleMutex.h"
+#include "DS_Hash.h"
+#include "DS_List.h"
+#include "Export.h"
+#include <stdint.h>
+
+namespace RakNet
+{
+
+/// \brief Reads files for FileListTransfer::Send() by memory mapping them.
+/// A file is mapped once, and every recipient downloading it at the same time reads from the same pages, so memory use
+/// does not grow with the number of downloads. MapFilePart() returns pointers into the mapping, so chunks are sent without being copied into a read buffer first.
+/// Mappings no longer in use are kept open up to SetMaxIdleMappings(), and are remapped if the file size or modification time changed.
+/// If a file cannot be mapped, GetFilePart() falls back to IncrementalReadInterface::GetFilePart().
+/// Files can be written to while mapped. Outside Windows, one could be truncated under the mapping, and reading past its new end would raise SIGBUS.
+/// So before each part, the size and modification time of the open file are checked, and if either changed, MapFilePart() returns 0 and the part is read with IncrementalReadInterface::GetFilePart() instead.
+/// This leaves only the time between that check and the copy of the part, so do not truncate files while they are being sent.
+/// On Windows, mapped files can also be renamed and deleted, but not truncated, including while only idle mappings are open. Call Clear() to release them.
+/// One instance may be shared by any number of FileListTransfer instances and threads.
+class RAK_DLL_EXPORT MappedFileReadInterface : public IncrementalReadInterface
+{
+public:
+    MappedFileReadInterface();
+    virtual ~MappedFileReadInterface();
+
+    /// How many mappings to keep open after the last transfer using them finishes. Defaults to 16.
+    void SetMaxIdleMappings(unsigned int count);
+
+    /// Returns how many files are currently mapped, in use or idle
+    unsigned int GetMappedFileCount(void);
+
+    /// Unmaps all idle files. Files still in use are unmapped when released.
+    void Clear(void);
+
+    /// \internal
+    virtual unsigned int GetFilePart( const char *filename, unsigned int startReadBytes, unsigned int numBytesToRead, void *preallocatedDestination, FileListNodeContext context);
+    /// \internal
+    virtual const char *MapFilePart( const char *filename, unsigned int startReadBytes, unsigned int numBytesToRead, unsigned int *bytesMapped, FileListNodeContext context);
+    /// \internal
+    virtual void UnmapFilePart( const char *filename, const char *data);
+
+protected:
+    struct MappedFile
+    {
+        RakString filename;
+        char *data;
+        uint64_t length;
+        int64_t modificationTime;
+        unsigned int refCount;
+#ifdef _WIN32
+        void *fileHandle;
+        void *mappingHandle;
+#else
+        int fileDescriptor;
+#endif
+    };
+
+    MappedFile *Acquire(const char *filename);
+    void Release(MappedFile *mappedFile);
+    static bool GetFileInfo(const char *filename, uint64_t *length, int64_t *modificationTime);
+    static bool MapFile(MappedFile *mappedFile);
+    // Whether the file still has the size and modification time it was mapped with, so the whole mapping can be read
+    static bool IsUnchanged(MappedFile *mappedFile);
+    static void UnmapFile(MappedFile *mappedFile);
+    void RemoveIdle(MappedFile *mappedFile);
+    void TrimIdle(void);
+
+    DataStructures::Hash<RakString, MappedFile*, 256, RakString::ToInteger> mappedFiles;
+    // Mappings with refCount of 0, least recently used first
+    DataStructures::List<MappedFile*> idleMappings;
+    unsigned int maxIdleMappings;
+    SimpleMutex mappedFilesMutex;
+};
+
+} // namespace RakNet
+
+#endif
@@ -68,12 +68,12 @@ enum DefaultMessageIDTypes
     /// C2S: Initial query: Header(1), OfflineMesageID(16), Protocol number(1), Pad(toMTU), sent with no fragment set.
     /// If protocol fails on server, returns ID_INCOMPATIBLE_PROTOCOL_VERSION to client
     ID_OPEN_CONNECTION_REQUEST_1,
-    /// S2C: Header(1), OfflineMesageID(16), server GUID(8), HasSecurity(1), Cookie(4, if HasSecurity)
+    /// S2C: Header(1), OfflineMesageID(16), server GUID(8), ConnectionCookie(4), HasSecurity(1), Cookie(4, if HasSecurity)
     /// , public key (if do security is true), MTU(2). If public key fails on client, returns ID_PUBLIC_KEY_MISMATCH
     ID_OPEN_CONNECTION_REPLY_1,
-    /// C2S: Header(1), OfflineMesageID(16), Cookie(4, if HasSecurity is true on the server), clientSupportsSecurity(1 bit),
+    /// C2S: Header(1), OfflineMesageID(16), ConnectionCookie(4), Cookie(4, if HasSecurity is true on the server), clientSupportsSecurity(1 bit),
     /// handshakeChallenge (if has security on both server and client), remoteBindingAddress(6), MTU(2), client GUID(8)
-    /// Connection slot allocated if cookie is valid, server is not full, GUID and IP not already in use.
+    /// Dropped unless ConnectionCookie is the one sent to this address. Connection slot allocated if cookie is valid, server is not full, GUID and IP not already in use.
     ID_OPEN_CONNECTION_REQUEST_2,
     /// S2C: Header(1), OfflineMesageID(16), server GUID(8), mtu(2), doSecurity(1 bit), handshakeAnswer (if do security is true)
     ID_OPEN_CONNECTION_REPLY_2,
@@ -418,8 +418,10 @@ enum DefaultMessageIDTypes
     ID_NAT_REQUEST_BOUND_ADDRESSES,
     ID_NAT_RESPOND_BOUND_ADDRESSES,
     ID_FCM2_UPDATE_USER_CONTEXT,
-    ID_RESERVED_3,
-    ID_RESERVED_4,
+    /// \internal ReliabilityLayer - Several small messages merged by ReliabilityLayer::SetMessageCoalescing(). Never returned to the user.
+    ID_COALESCED_MESSAGES,
+    /// \internal ReliabilityLayer - A message compressed by ReliabilityLayer::SetMessageCompression(). Never returned to the user.
+    ID_COMPRESSED_MESSAGE,
     ID_RESERVED_5,
     ID_RESERVED_6,
     ID_RESERVED_7,
@@ -25,8 +25,12 @@
 #include "PacketPriority.h"
 #include "SocketIncludes.h"
 #include "DS_OrderedList.h"
+#include "DS_Hash.h"
 #include "RakString.h"
 
+/// Number of buckets in the hashes of users and connection attempts. Sized for hundreds of thousands of concurrent users.
+#define NAT_PUNCHTHROUGH_SERVER_HASH_SIZE 65536
+
 namespace RakNet
 {
 /// Forward declarations
@@ -105,7 +109,7 @@ public:
     struct User;
     struct ConnectionAttempt
     {
-        ConnectionAttempt() {sender=0; recipient=0; startTime=0; attemptPhase=NAT_ATTEMPT_PHASE_NOT_STARTED;}
+        ConnectionAttempt() {sender=0; recipient=0; startTime=0; attemptPhase=NAT_ATTEMPT_PHASE_NOT_STARTED; timeoutPrev=0; timeoutNext=0;}
         User *sender, *recipient;
         uint16_t sessionId;
         RakNet::Time startTime;
@@ -114,6 +118,17 @@ public:
             NAT_ATTEMPT_PHASE_NOT_STARTED,
             NAT_ATTEMPT_PHASE_GETTING_RECENT_PORTS,
         } attemptPhase;
+        // Links in the timeout queue, while attemptPhase is NAT_ATTEMPT_PHASE_GETTING_RECENT_PORTS
+        ConnectionAttempt *timeoutPrev, *timeoutNext;
+    };
+    // Key of connectionAttemptsByUsers. The guids are stored in sorted order, so the pair is the same whichever user is the sender
+    struct UserPair
+    {
+        UserPair() {}
+        UserPair(RakNetGUID g1, RakNetGUID g2);
+        RakNetGUID lowGuid, highGuid;
+        bool operator==(const UserPair &right) const {return lowGuid==right.lowGuid && highGuid==right.highGuid;}
+        static unsigned long ToInteger(const UserPair &userPair);
     };
     struct User
     {
@@ -133,7 +148,19 @@ public:
     static int NatPunchthroughUserComp( const RakNetGUID &key, User * const &data );
 protected:
     void OnNATPunchthroughRequest(Packet *packet);
-    DataStructures::OrderedList<RakNetGUID, User*, NatPunchthroughServer::NatPunchthroughUserComp> users;
+    DataStructures::Hash<RakNetGUID, User*, NAT_PUNCHTHROUGH_SERVER_HASH_SIZE, RakNetGUID::ToUint32> users;
+
+    // One entry per connection attempt, so HasConnectionAttemptToUser() does not have to search the lists of busy users
+    DataStructures::Hash<UserPair, ConnectionAttempt*, NAT_PUNCHTHROUGH_SERVER_HASH_SIZE, UserPair::ToInteger> connectionAttemptsByUsers;
+
+    // Attempts in NAT_ATTEMPT_PHASE_GETTING_RECENT_PORTS, ordered by startTime
+    // All attempts have the same timeout, so Update() only has to look at the head
+    ConnectionAttempt *timeoutQueueHead, *timeoutQueueTail;
+    void AddToTimeoutQueue(ConnectionAttempt *ca);
+    void RemoveFromTimeoutQueue(ConnectionAttempt *ca);
+
+    // Removes the attempt from both users, the indices, and the timeout queue, then deletes it
+    void DeleteConnectionAttempt(ConnectionAttempt *ca);
 
     void OnGetMostRecentPort(Packet *packet);
     void OnClientReady(Packet *packet);
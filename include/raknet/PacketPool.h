@@ -0,0 +1,148 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file PacketPool.h
+/// \internal
+/// \brief Single block Packet allocation from size class slabs, and a lock-free queue to hand packets to the user thread
+///
+
+
+
+#ifndef __PACKET_POOL_H
+#define __PACKET_POOL_H
+
+#include "RakNetTypes.h"
+#include "SimpleMutex.h"
+#include "DS_Queue.h"
+#include "Export.h"
+#include <atomic>
+
+namespace RakNet
+{
+
+/// \internal
+/// Precedes every Packet returned by PacketPool. The Packet and, when it fits, its payload follow in the same block.
+struct PacketPoolBlock
+{
+    /// Link used by PacketReturnQueue
+    std::atomic<PacketPoolBlock*> queueNext;
+    /// Link used by the free list of the owning size class, as blockIndex+1. 0 terminates the list.
+    std::atomic<uint32_t> freeNext;
+    /// Index of this block within its size class
+    uint32_t blockIndex;
+    /// Which size class this came from, or PacketPool::OVERSIZED_CLASS if it was malloced on its own
+    unsigned char sizeClass;
+};
+
+/// \internal
+/// \brief Allocates a Packet and its data as one block.
+/// Blocks come from per size class slabs with a lock-free free list, so the network thread and user thread never contend on a mutex
+/// to allocate or release a packet. Payloads larger than the biggest size class are malloced as a single block, header included.
+class RAK_DLL_EXPORT PacketPool
+{
+public:
+    PacketPool();
+    ~PacketPool();
+
+    /// Returns a packet with \a dataSize bytes of data, stored in the same block as the packet
+    Packet *Allocate(unsigned dataSize);
+
+    /// Returns a packet whose data is \a data, without copying it
+    /// \param[in] data Returned by AllocateData(), for at least \a dataSize bytes. The packet is built in the same block.
+    Packet *Allocate(unsigned dataSize, unsigned char *data);
+
+    /// Returns room for \a dataSize bytes in a block, so the data can be read in before it is known which packet it becomes. Thread-safe.
+    /// Pass it to Allocate(unsigned, unsigned char*), or give it back with ReleaseData()
+    /// \return 0 if out of memory
+    unsigned char *AllocateData(unsigned dataSize);
+
+    /// Returns data from AllocateData() that did not become a packet. Thread-safe.
+    void ReleaseData(unsigned char *data);
+
+    /// Returns a packet previously returned by Allocate(). Thread-safe.
+    void Release(Packet *packet);
+
+    /// Frees all slabs. Not thread-safe, and all packets must have been released.
+    void Clear(void);
+
+    /// Returns the block header for a packet returned by Allocate()
+    static PacketPoolBlock *GetBlock(Packet *packet);
+
+    /// Returns the packet following a block header
+    static Packet *GetPacket(PacketPoolBlock *block);
+
+    static const unsigned char OVERSIZED_CLASS = 255;
+
+protected:
+    static const int NUM_SIZE_CLASSES = 4;
+    static const unsigned int BLOCKS_PER_PAGE = 64;
+    static const unsigned int MAX_PAGES_PER_CLASS = 4096;
+
+    struct SizeClass
+    {
+        /// Largest payload a block in this class holds
+        unsigned int maxDataSize;
+        /// Bytes per block, including PacketPoolBlock and Packet
+        unsigned int blockSize;
+        /// Low 32 bits are the head blockIndex+1, high 32 bits are a tag incremented on every change to avoid ABA
+        std::atomic<uint64_t> freeHead;
+        std::atomic<unsigned int> pageCount;
+        char *pages[MAX_PAGES_PER_CLASS];
+        SimpleMutex growMutex;
+    };
+
+    PacketPoolBlock *PopFree(SizeClass *sc);
+    void PushFree(SizeClass *sc, PacketPoolBlock *first, PacketPoolBlock *last);
+    PacketPoolBlock *Grow(SizeClass *sc);
+    PacketPoolBlock *GetBlockAtIndex(SizeClass *sc, uint32_t blockIndex);
+    PacketPoolBlock *AllocateBlock(unsigned dataSize);
+    static unsigned char *GetInlineData(Packet *packet);
+
+    SizeClass sizeClasses[NUM_SIZE_CLASSES];
+};
+
+/// \internal
+/// \brief Multiple producer, single consumer queue of packets allocated by PacketPool.
+/// Push is lock-free from any thread. Pop, PushAtHead and Clear may only be called from the one consuming thread, and never block on producers.
+/// Uses the PacketPoolBlock::queueNext link, so no memory is allocated to queue a packet.
+class RAK_DLL_EXPORT PacketReturnQueue
+{
+public:
+    PacketReturnQueue();
+    ~PacketReturnQueue();
+
+    /// Adds a packet to the tail of the queue. Thread-safe.
+    void Push(Packet *packet);
+
+    /// Adds a packet so the next call to Pop() returns it. Consumer thread only.
+    void PushAtHead(Packet *packet);
+
+    /// Returns the oldest packet, or 0 if no packet is available yet. Consumer thread only.
+    Packet *Pop(void);
+
+    /// Estimate of how many packets are waiting. Thread-safe.
+    unsigned int Size(void) const;
+
+    /// Releases all waiting packets to \a pool. Consumer thread only, with no concurrent producers.
+    void Clear(PacketPool *pool);
+
+protected:
+    PacketPoolBlock *PopTail(void);
+
+    std::atomic<PacketPoolBlock*> head;
+    PacketPoolBlock *tail;
+    PacketPoolBlock stub;
+    std::atomic<unsigned int> count;
+    DataStructures::Queue<Packet*> pushedAtHead;
+};
+
+} // namespace RakNet
+
+#endif
@@ -20,8 +20,6 @@
 #define __PACKETIZED_TCP
 
 #include "TCPInterface.h"
-#include "DS_ByteQueue.h"
-#include "DS_Map.h"
 
 namespace RakNet
 {
@@ -35,21 +33,29 @@ public:
     PacketizedTCP();
     virtual ~PacketizedTCP();
 
-    /// Stops the TCP server
-    void Stop(void);
-
     /// Sends a byte stream
     void Send( const char *data, unsigned length, const SystemAddress &systemAddress, bool broadcast );
 
     // Sends a concatenated list of byte streams
     bool SendList( const char **data, const unsigned int *lengths, const int numParameters, const SystemAddress &systemAddress, bool broadcast );
 
+    /// Allocates a buffer for SendBuffer(), with room for the length header before it
+    /// \return 0 if out of memory
+    char* AllocateSendBuffer( unsigned int length );
+
+    /// Sends a buffer from AllocateSendBuffer() as one message, without copying it
+    bool SendBuffer( char *buffer, unsigned int length, const SystemAddress &systemAddress );
+
+    /// Deallocates a buffer from AllocateSendBuffer() that was not passed to SendBuffer()
+    void DeallocateSendBuffer( char *buffer );
+
+    /// Connections that send a message longer than this are closed, as the memory for each message is allocated when its length arrives.
+    /// \param[in] length Defaults to PACKETIZED_TCP_MAX_MESSAGE_LENGTH
+    void SetMaxFramedMessageLength( unsigned int length );
+
     /// Returns data received
     Packet* Receive( void );
 
-    /// Disconnects a player/address
-    void CloseConnection( SystemAddress systemAddress );
-
     /// Has a previous call to connect succeeded?
     /// \return UNASSIGNED_SYSTEM_ADDRESS = no. Anything else means yes.
     SystemAddress HasCompletedConnectionAttempt(void);
@@ -65,16 +71,10 @@ public:
     SystemAddress HasLostConnection(void);
 
 protected:
-    void ClearAllConnections(void);
-    void RemoveFromConnectionList(const SystemAddress &sa);
-    void AddToConnectionList(const SystemAddress &sa);
     void PushNotificationsToQueues(void);
+    /// \return The next message that no plugin took, or 0
     Packet *ReturnOutgoingPacket(void);
 
-    // A single TCP recieve may generate multiple split packets. They are stored in the waitingPackets list until Receive is called
-    DataStructures::Queue<Packet*> waitingPackets;
-    DataStructures::Map<SystemAddress, DataStructures::ByteQueue *> connections;
-
     // Mirrors single producer / consumer, but processes them in Receive() before returning to user
     DataStructures::Queue<SystemAddress> _newIncomingConnections, _lostConnections, _failedConnectionAttempts, _completedConnectionAttempts;
 };
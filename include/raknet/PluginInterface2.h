@@ -20,6 +20,7 @@
 #include "RakNetTypes.h"
 #include "Export.h"
 #include "PacketPriority.h"
+#include "DS_List.h"
 
 namespace RakNet {
 
@@ -176,6 +177,14 @@ public:
     /// \param[in] remoteSystemAddress The player we sent or got this packet from
     virtual void OnPushBackPacket(const char *data, const BitSize_t bitsUsed, SystemAddress remoteSystemAddress) {(void) data; (void) bitsUsed; (void) remoteSystemAddress;}
 
+    /// Returns if OnReceive() should be called for messages with this identifier.
+    /// RakPeer uses this to build its dispatch table when the plugin is attached.
+    /// Messages starting with ID_TIMESTAMP are looked up by the identifier following the timestamp.
+    bool ReceivesMessageID(MessageID messageId) const;
+
+    /// Returns true unless the plugin restricted OnReceive() with AddReceivedMessageIDRange() or SetReceivesAllMessageIDs()
+    bool ReceivesAllMessageIDs(void) const {return receivesAllMessageIDs;}
+
     RakPeerInterface *GetRakPeerInterface(void) const {return rakPeerInterface;}
 
     RakNetGUID GetMyGUIDUnified(void) const;
@@ -192,14 +201,30 @@ protected:
     // Send through either rakPeerInterface or tcpInterface, whichever is available
     void SendUnified( const RakNet::BitStream * bitStream, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast );
     void SendUnified( const char * data, const int length, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast );
+    // Send the same data to each of systemIdentifiers, serialized and queued once when using RakPeer
+    void SendUnified( const RakNet::BitStream * bitStream, PacketPriority priority, PacketReliability reliability, char orderingChannel, const DataStructures::List<RakNetGUID> &systemIdentifiers );
     bool SendListUnified( const char **data, const int *lengths, const int numParameters, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast );
 
+    /// Restricts OnReceive() to messages with identifiers between \a firstMessageId and \a lastMessageId inclusive.
+    /// Call more than once to add more identifiers. Must be called before the plugin is attached.
+    /// Plugins that never call this get every message.
+    /// Most built-in plugins, such as RelayPlugin, ReplicaManager3, FullyConnectedMesh2 and Router2, call this in their constructors.
+    /// A subclass of one of them that overrides OnReceive() for its own identifiers must add those identifiers too, or it will not get them.
+    void AddReceivedMessageIDRange(MessageID firstMessageId, MessageID lastMessageId);
+    void AddReceivedMessageID(MessageID messageId) {AddReceivedMessageIDRange(messageId, messageId);}
+
+    /// Pass false for a plugin that does not handle any message in OnReceive(), or true to go back to getting every message
+    void SetReceivesAllMessageIDs(bool b);
+
     Packet *AllocatePacketUnified(unsigned dataSize);
     void PushBackPacketUnified(Packet *packet, bool pushAtHead);
     void DeallocPacketUnified(Packet *packet);
 
     // Filled automatically in when attached
     RakPeerInterface *rakPeerInterface;
+
+    bool receivesAllMessageIDs;
+    unsigned int receivedMessageIDs[256/32];
 #if _RAKNET_SUPPORT_TCPInterface==1
     TCPInterface *tcpInterface;
 #endif
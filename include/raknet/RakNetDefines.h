@@ -127,6 +127,18 @@
 #define PREALLOCATE_LARGE_MESSAGES 0
 #endif
 
+// Largest message decompressed from an ID_COMPRESSED_MESSAGE. See RakPeerInterface::SetMessageCompression()
+// The sender says how large the original message was, so this limits how much memory a small message can make the receiver allocate. Larger ones are dropped.
+#ifndef MAX_DECOMPRESSED_MESSAGE_SIZE
+#define MAX_DECOMPRESSED_MESSAGE_SIZE 16777216
+#endif
+
+// Default of PacketizedTCP::SetMaxFramedMessageLength()
+// The sender says how long each message is, and the receiver allocates that much before it arrives, so this limits how much memory one connection can make it allocate.
+#ifndef PACKETIZED_TCP_MAX_MESSAGE_LENGTH
+#define PACKETIZED_TCP_MAX_MESSAGE_LENGTH 67108864
+#endif
+
 #ifndef RAKNET_SUPPORT_IPV6
 #define RAKNET_SUPPORT_IPV6 0
 #endif
@@ -82,6 +82,10 @@ struct RNS2RecvStruct
     SystemAddress systemAddress;
     RakNet::TimeUS timeRead;
     RakNetSocket2 *socket;
+#ifdef LIBCAT_SECURITY
+    // Nonzero if data was already decrypted on the receive thread. See ReliabilityLayer::DecryptOnRecvThread()
+    unsigned int decryptedEpoch;
+#endif
 };
 
 class RakNetSocket2Allocator
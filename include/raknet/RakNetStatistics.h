@@ -118,6 +118,31 @@ struct RAK_DLL_EXPORT RakNetStatistics
     }
 };
 
+/// \brief Secure handshakes of incoming connections
+///
+/// The key agreement of each handshake runs on a worker thread, and the connection continues when it finishes.
+/// \sa RakPeerInterface::GetHandshakeStatistics()
+struct RAK_DLL_EXPORT HandshakeStatistics
+{
+    /// Handshakes waiting for a worker, being processed, or finished and waiting for the update thread
+    unsigned int queued;
+
+    /// Handshakes answered since Startup()
+    uint64_t answered;
+
+    /// Handshakes whose challenge was invalid. The connection was dropped.
+    uint64_t rejected;
+
+    /// Handshakes whose connection went away before they finished
+    uint64_t discarded;
+
+    /// Microseconds from receiving the challenge to sending the answer, over the last latencySamples answered handshakes
+    RakNet::TimeUS latencyPercentile50, latencyPercentile90, latencyPercentile99, latencyMax;
+
+    /// How many handshakes the latencies are from, up to 1024
+    unsigned int latencySamples;
+};
+
 /// Verbosity level currently supports 0 (low), 1 (medium), 2 (high)
 /// \param[in] s The Statistical information to format out
 /// \param[in] buffer The buffer containing a formated report
@@ -22,7 +22,7 @@
 #include "ReliabilityLayer.h"
 #include "RakPeerInterface.h"
 #include "BitStream.h"
-#include "SingleProducerConsumer.h"
+#include "SingleProducerConsumerRing.h"
 #include "SimpleMutex.h"
 #include "DS_OrderedList.h"
 #include "Export.h"
@@ -34,7 +34,11 @@
 #include "SignaledEvent.h"
 #include "NativeFeatureIncludes.h"
 #include "SecureHandshake.h"
+#include "HandshakeThread.h"
 #include "DS_Queue.h"
+#include "PacketPool.h"
+#include "DS_SeqLockHash.h"
+#include "DS_PrefixTrie.h"
 
 namespace RakNet {
 /// Forward declarations
@@ -264,6 +268,19 @@ public:
     /// \return 0 on bad input. Otherwise a number that identifies this message. If \a reliability is a type that returns a receipt, on a later call to Receive() you will get ID_SND_RECEIPT_ACKED or ID_SND_RECEIPT_LOSS with bytes 1-4 inclusive containing this number
     uint32_t SendList( const char **data, const int *lengths, const int numParameters, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, uint32_t forceReceiptNumber=0 );
 
+    /// \brief Sends the same data to a list of systems.
+    ///
+    /// Equivalent to calling Send() once per system, but the data is copied and queued for the network thread only once.
+    /// This function only works when connected.
+    /// \param[in] bitStream Bitstream to send
+    /// \param[in] priority Priority level to send on.  See PacketPriority.h
+    /// \param[in] reliability How reliably to send this data.  See PacketPriority.h
+    /// \param[in] orderingChannel Channel to order the messages on, when using ordered or sequenced messages. Messages are only ordered relative to other messages on the same stream.
+    /// \param[in] systemIdentifiers RakNetGUIDs to send this packet to. Systems that are not connected are skipped.
+    /// \param[in] forceReceipt If 0, will automatically determine the receipt number to return. If non-zero, will return what you give it.
+    /// \return 0 on bad input. Otherwise a number that identifies this message, shared by all systems it was sent to.
+    uint32_t SendToSystems( const RakNet::BitStream * bitStream, PacketPriority priority, PacketReliability reliability, char orderingChannel, const DataStructures::List<RakNetGUID> &systemIdentifiers, uint32_t forceReceiptNumber=0 );
+
     /// \brief Gets a message from the incoming message queue.
     /// \details Use DeallocatePacket() to deallocate the message after you are done with it.
     /// User-thread functions, such as RPC calls and the plugin function PluginInterface::Update occur here.
@@ -276,6 +293,19 @@ public:
     /// \param[in] packet Message to deallocate.
     void DeallocatePacket( Packet *packet );
 
+    /// \brief Gets up to \a maxPackets messages from the incoming message queue in one call.
+    /// \details Plugin updates run once per call rather than once per message, so prefer this when draining many messages per tick.
+    /// Use DeallocatePackets() or DeallocatePacket() to deallocate the messages after you are done with them.
+    /// \param[out] packets Array of at least \a maxPackets elements to write the messages to.
+    /// \param[in] maxPackets The most messages to return.
+    /// \return How many messages were written to \a packets. 0 if none are waiting.
+    unsigned int ReceiveBatch( Packet **packets, unsigned int maxPackets );
+
+    /// \brief Call this to deallocate messages returned by ReceiveBatch() when you are done handling them.
+    /// \param[in] packets Messages to deallocate.
+    /// \param[in] numPackets How many elements of \a packets to deallocate.
+    void DeallocatePackets( Packet **packets, unsigned int numPackets );
+
     /// \brief Return the total number of connections we are allowed.
     /// \return Total number of connections allowed.
     unsigned int GetMaximumNumberOfPeers( void ) const;
@@ -327,6 +357,7 @@ public:
     /// \brief Bans an IP from connecting.
     /// \details Banned IPs persist between connections but are not saved on shutdown nor loaded on startup.
     /// \param[in] IP Dotted IP address. You can use * for a wildcard address, such as 128.0.0. * will ban all IP addresses starting with 128.0.0.
+    /// An IPv4 or IPv6 address followed by /bits bans a CIDR range, such as 128.0.0.0/16 or 2001:db8::/32.
     /// \param[in] milliseconds Gives time in milli seconds for a temporary ban of the IP address.  Use 0 for a permanent ban.
     void AddToBanList( const char *IP, RakNet::TimeMS milliseconds=0 );
 
@@ -515,6 +546,23 @@ public:
     /// \param[in] timeoutMS How many ms to wait before simply not sending an unreliable message.
     void SetUnreliableTimeout(RakNet::TimeMS timeoutMS);
 
+    /// \brief Merge small messages sent to a system into one internal message.
+    /// \details Messages on the same ordering channel with the same reliability and priority wait at most \a maxDelayUS for others to join them.
+    /// The remote system returns the original messages from Receive(). Only UNRELIABLE, RELIABLE and RELIABLE_ORDERED below IMMEDIATE_PRIORITY are merged.
+    /// \param[in] maxDelayUS How long a message may wait for others, in microseconds. 0 to disable, which is the default.
+    /// \param[in] maxMessageBytes Messages longer than this are sent on their own.
+    /// \param[in] orderingChannelMask Bit n set to merge messages sent on ordering channel n.
+    /// \param[in] target Which system to do this for. Pass UNASSIGNED_SYSTEM_ADDRESS for all systems, including systems that connect later.
+    void SetMessageCoalescing(RakNet::TimeUS maxDelayUS, unsigned int maxMessageBytes, uint32_t orderingChannelMask, const SystemAddress target);
+
+    /// Compress messages sent to a system on the given ordering channels, when that makes them smaller.
+    /// The remote system must set the same kind of compressor for the same system, or it drops the compressed messages.
+    /// \param[in] compressor Codec to use, such as LZCompressor, which must outlive this instance. 0 to disable, which is the default.
+    /// \param[in] minMessageBytes Messages shorter than this are sent as they are.
+    /// \param[in] orderingChannelMask Bit n set to compress messages sent on ordering channel n.
+    /// \param[in] target Which system to do this for. Pass UNASSIGNED_SYSTEM_ADDRESS for all systems, including systems that connect later.
+    void SetMessageCompression(CompressionInterface *compressor, unsigned int minMessageBytes, uint32_t orderingChannelMask, const SystemAddress target);
+
     /// \brief Send a message to a host, with the IP socket option TTL set to 3.
     /// \details This message will not reach the host, but will open the router.
     /// \param[in] host The address of the remote host in dotted notation.
@@ -622,6 +670,10 @@ public:
     /// \param[out] statistics Calculated RakNetStatistics for each connected system
     virtual void GetStatisticsList(DataStructures::List<SystemAddress> &addresses, DataStructures::List<RakNetGUID> &guids, DataStructures::List<RakNetStatistics> &statistics);
 
+    /// \brief Returns statistics on the secure handshakes of incoming connections, which run on worker threads. See InitializeSecurity()
+    /// \param[out] stats How many handshakes are queued, what happened to them, and their latency. All 0 without LIBCAT_SECURITY.
+    virtual void GetHandshakeStatistics(HandshakeStatistics *stats);
+
     /// \Returns how many messages are waiting when you call Receive()
     virtual unsigned int GetReceiveBufferSize(void);
 
@@ -679,11 +731,16 @@ public:
         // Reference counted socket to send back on
         RakNetSocket2* rakNetSocket;
         SystemIndex remoteSystemIndex;
+        // Value of banList.GetAddCount() when this system was last found to not be banned, or 0. Network thread only.
+        unsigned int banListVersion;
 
 #ifdef LIBCAT_SECURITY
         // Cached answer used internally by RakPeer to prevent DoS attacks based on the connexion handshake
         char answer[cat::EasyHandshake::ANSWER_BYTES];
 
+        // Id of the HandshakeThread job making the answer, or 0 if there is none
+        unsigned int pendingHandshakeId;
+
         // If the server has bRequireClientKey = true, then this is set to the validated public key of the connected client
         // Valid after connectMode reaches HANDLING_CONNECTION_REQUEST
         char client_public_key[cat::EasyHandshake::PUBLIC_KEY_BYTES];
@@ -703,7 +760,7 @@ protected:
 
     friend bool ProcessOfflineNetworkPacket( SystemAddress systemAddress, const char *data, unsigned int length, RakPeer *rakPeer, RakNetSocket2* rakNetSocket, bool *isOfflineMessage, RakNet::TimeUS timeRead );
     friend void ProcessNetworkPacket( const SystemAddress systemAddress, const char *data, unsigned int length, RakPeer *rakPeer, RakNet::TimeUS timeRead, BitStream &updateBitStream );
-    friend void ProcessNetworkPacket( const SystemAddress systemAddress, const char *data, unsigned int length, RakPeer *rakPeer, RakNetSocket2* rakNetSocket, RakNet::TimeUS timeRead, BitStream &updateBitStream );
+    friend void ProcessNetworkPacket( const SystemAddress systemAddress, const char *data, unsigned int length, RakPeer *rakPeer, RakNetSocket2* rakNetSocket, RakNet::TimeUS timeRead, BitStream &updateBitStream, unsigned int decryptedEpoch );
 
     int GetIndexFromSystemAddress( const SystemAddress systemAddress, bool calledFromNetworkThread ) const;
     int GetIndexFromGuid( const RakNetGUID guid );
@@ -746,6 +803,8 @@ protected:
 
     bool IsLoopbackAddress(const AddressOrGUID &systemIdentifier, bool matchPort) const;
     SystemAddress GetLoopbackAddress(void) const;
+    /// Same as IsBanned(const char*), without formatting the address. Does not lock.
+    bool IsBanned( const SystemAddress &systemAddress );
 
     ///Set this to true to terminate the Peer thread execution
     std::atomic<bool> endThreads;
@@ -790,6 +849,14 @@ protected:
     void ClearRemoteSystemLookup(void);
     DataStructures::MemoryPool<RemoteSystemIndex> remoteSystemIndexPool;
 
+    /// remoteSystemList indices by RakNetGUID and by SystemAddress. Written only by the network thread, readable from any thread without locking
+    DataStructures::SeqLockHash remoteSystemGuidIndex, remoteSystemAddressIndex;
+    static uint64_t SystemAddressToIndexKey(const SystemAddress &sa);
+    /// Returns the remoteSystemList index assigned \a guid, or -1. Threadsafe.
+    unsigned int LookupRemoteSystemIndexByGuid(const RakNetGUID &guid) const;
+    /// Returns the remoteSystemList index assigned \a sa, or -1. Threadsafe.
+    unsigned int LookupRemoteSystemIndexByAddress(const SystemAddress &sa) const;
+
     void AddToActiveSystemList(unsigned int remoteSystemListIndex);
     void RemoveFromActiveSystemList(const SystemAddress &sa);
 
@@ -817,16 +884,10 @@ protected:
     // bool isSocketLayerBlocking;
     // bool continualPing,isRecvfromThreadActive,isMainLoopThreadActive, endThreads, isSocketLayerBlocking;
     unsigned int validationInteger;
-    SimpleMutex incomingQueueMutex, banListMutex; //,synchronizedMemoryQueueMutex, automaticVariableSynchronizationMutex;
+    SimpleMutex incomingQueueMutex; //,synchronizedMemoryQueueMutex, automaticVariableSynchronizationMutex;
     //DataStructures::Queue<Packet *> incomingpacketSingleProducerConsumer; //, synchronizedMemorypacketSingleProducerConsumer;
     // BitStream enumerationData;
 
-    struct BanStruct
-    {
-        char *IP;
-        RakNet::TimeMS timeout; // 0 for none
-    };
-
     struct RequestedConnectionStruct
     {
         SystemAddress systemAddress;
@@ -858,9 +919,14 @@ protected:
 #endif
 
     //DataStructures::List<DataStructures::List<MemoryBlock>* > automaticVariableSynchronizationList;
-    DataStructures::List<BanStruct*> banList;
+    // Address prefixes, keyed by IP version then address bytes. GetAddCount() is incremented by AddToBanList(),
+    // so datagrams from connected systems checked against the current count skip IsBanned()
+    DataStructures::PrefixTrie banList;
     // Threadsafe, and not thread safe
     DataStructures::List<PluginInterface2*> pluginListTS, pluginListNTS;
+    /// For each MessageID, the plugins from pluginListTS then pluginListNTS whose OnReceive() handles it. Rebuilt on AttachPlugin() and DetachPlugin()
+    DataStructures::List<PluginInterface2*> pluginDispatchTable[256];
+    void RebuildPluginDispatchTable(void);
 
     DataStructures::Queue<RequestedConnectionStruct*> requestedConnectionQueue;
     SimpleMutex requestedConnectionQueueMutex;
@@ -886,7 +952,10 @@ protected:
         RakNetSocket2* socket;
         unsigned short port;
         uint32_t receipt;
-        enum {BCS_SEND, BCS_CLOSE_CONNECTION, BCS_GET_SOCKET, BCS_CHANGE_SYSTEM_ADDRESS,/* BCS_USE_USER_SOCKET, BCS_REBIND_SOCKET_ADDRESS, BCS_RPC, BCS_RPC_SHIFT,*/ BCS_DO_NOTHING} command;
+        // Only for BCS_SEND_TO_SYSTEMS
+        RakNetGUID *targetGuids;
+        unsigned int targetGuidsCount;
+        enum {BCS_SEND, BCS_SEND_TO_SYSTEMS, BCS_CLOSE_CONNECTION, BCS_GET_SOCKET, BCS_CHANGE_SYSTEM_ADDRESS,/* BCS_USE_USER_SOCKET, BCS_REBIND_SOCKET_ADDRESS, BCS_RPC, BCS_RPC_SHIFT,*/ BCS_DO_NOTHING} command;
     };
 
     // Single producer single consumer queue using a linked list
@@ -899,14 +968,20 @@ protected:
 
     DataStructures::Queue<RNS2RecvStruct*> bufferedPacketsFreePool;
     RakNet::SimpleMutex bufferedPacketsFreePoolMutex;
+    // From the receive threads to the update thread, one for each socket of socketList, written by its receive thread
+    DataStructures::List<DataStructures::SingleProducerConsumerRing<RNS2RecvStruct*>*> bufferedPacketRings;
+    // Once a ring was full, the receive threads push here instead until it was read, so each socket's packets stay in order
     DataStructures::Queue<RNS2RecvStruct*> bufferedPacketsQueue;
     RakNet::SimpleMutex bufferedPacketsQueueMutex;
+    std::atomic<unsigned int> bufferedPacketsQueueSize;
 
     virtual void DeallocRNS2RecvStruct(RNS2RecvStruct *s, const char *file, unsigned int line);
     virtual RNS2RecvStruct *AllocRNS2RecvStruct(const char *file, unsigned int line);
+    /// Creates bufferedPacketRings for socketList, before the receive threads start
     void SetupBufferedPackets(void);
     void PushBufferedPacket(RNS2RecvStruct * p);
     RNS2RecvStruct *PopBufferedPacket(void);
+    void ProcessBufferedPacket(RNS2RecvStruct *recvFromStruct, BitStream &updateBitStream);
 
     struct SocketQueryOutput
     {
@@ -924,6 +999,7 @@ protected:
     // This stores the user send calls to be handled by the update thread.  This way we don't have thread contention over systemAddresss
     void CloseConnectionInternal( const AddressOrGUID& systemIdentifier, bool sendDisconnectionNotification, bool performImmediate, unsigned char orderingChannel, PacketPriority disconnectionNotificationPriority );
     void SendBuffered( const char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, RemoteSystemStruct::ConnectMode connectionMode, uint32_t receipt );
+    void SendBufferedToSystems( const char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability, char orderingChannel, const DataStructures::List<RakNetGUID> &systemIdentifiers, uint32_t receipt );
     void SendBufferedList( const char **data, const int *lengths, const int numParameters, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, RemoteSystemStruct::ConnectMode connectionMode, uint32_t receipt );
     bool SendImmediate( char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, bool useCallerDataAllocation, RakNet::TimeUS currentTime, uint32_t receipt );
     //bool HandleBufferedRPC(BufferedCommandStruct *bcs, RakNet::TimeMS time);
@@ -956,6 +1032,13 @@ protected:
     unsigned int GetSystemIndexFromGuid( const RakNetGUID input ) const;
     RakNetGUID myGuid;
 
+    // Stateless cookie sent in ID_OPEN_CONNECTION_REPLY_1 and echoed in ID_OPEN_CONNECTION_REQUEST_2.
+    // Nothing is allocated for a connection until it is echoed, which a sender that does not receive at its address cannot do.
+    void GenerateConnectionCookieSecret(void);
+    uint32_t GenerateConnectionCookie( const SystemAddress &systemAddress, RakNet::TimeMS time ) const;
+    bool VerifyConnectionCookie( const SystemAddress &systemAddress, uint32_t cookie, RakNet::TimeMS time ) const;
+    unsigned char connectionCookieSecret[20];
+
     unsigned maxOutgoingBPS;
 
     // Nobody would use the internet simulator in a final build.
@@ -972,6 +1055,12 @@ protected:
     SystemAddress firstExternalID;
     int splitMessageProgressInterval;
     RakNet::TimeMS unreliableTimeout;
+    RakNet::TimeUS coalesceMaxDelay;
+    unsigned int coalesceMaxMessageBytes;
+    uint32_t coalesceOrderingChannelMask;
+    CompressionInterface *messageCompressor;
+    unsigned int compressMinMessageBytes;
+    uint32_t compressOrderingChannelMask;
 
     bool (*incomingDatagramEventHandler)(RNS2RecvStruct *);
 
@@ -989,11 +1078,11 @@ protected:
     SignaledEvent quitAndDataEvents;
     bool limitConnectionFrequencyFromTheSameIP;
 
-    SimpleMutex packetAllocationPoolMutex;
-    DataStructures::MemoryPool<Packet> packetAllocationPool;
+    /// Packets and their data are allocated together, lock-free, so the network thread and user thread do not contend
+    PacketPool packetAllocationPool;
 
-    SimpleMutex packetReturnMutex;
-    DataStructures::Queue<Packet*> packetReturnQueue;
+    /// Written by any thread, read only by the thread calling Receive()
+    PacketReturnQueue packetReturnQueue;
     Packet *AllocPacket(unsigned dataSize, const char *file, unsigned int line);
     Packet *AllocPacket(unsigned dataSize, unsigned char *data, const char *file, unsigned int line);
 
@@ -1005,6 +1094,9 @@ protected:
     void ResetSendReceipt(void);
     void OnConnectedPong(RakNet::Time sendPingTime, RakNet::Time sendPongTime, RemoteSystemStruct *remoteSystem);
     void CallPluginCallbacks(DataStructures::List<PluginInterface2*> &pluginList, Packet *packet);
+    void UpdatePlugins(void);
+    /// Returns the next packet from packetReturnQueue that plugins did not consume, or 0 if none are waiting
+    Packet *PopPacketForUser(void);
 
 #ifdef LIBCAT_SECURITY
     // Encryption and security
@@ -1012,7 +1104,18 @@ protected:
     char my_public_key[cat::EasyHandshake::PUBLIC_KEY_BYTES];
     cat::ServerEasyHandshake *_server_handshake;
     cat::CookieJar *_cookie_jar;
+    // Kept to give each handshake worker its own cat::ServerEasyHandshake
+    char my_private_key[cat::EasyHandshake::PRIVATE_KEY_BYTES];
+    HandshakeThread handshakeThread;
+    unsigned int nextHandshakeId;
+    // Sends the answer of a handshake a worker finished, if its connection still waits for it
+    void OnHandshakeFinished(HandshakeThread::Job *job);
     bool InitializeClientSecurity(RequestedConnectionStruct *rcs, const char *public_key);
+    // Called from receive threads. Decrypts datagrams from connected systems, so the update thread does not have to.
+    // \return false to drop the datagram
+    bool DecryptOnRecvThread(RNS2RecvStruct *recvStruct);
+    // Set once any connection uses security, so peers that never do skip the lookup in DecryptOnRecvThread
+    std::atomic<bool> anySecureConnections;
 #endif
     virtual void OnRNS2Recv(RNS2RecvStruct *recvStruct);
     void FillIPList(void);
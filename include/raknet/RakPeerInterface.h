@@ -29,8 +29,10 @@ namespace RakNet
 // Forward declarations
 class BitStream;
 class PluginInterface2;
+class CompressionInterface;
 struct RPCMap;
 struct RakNetStatistics;
+struct HandshakeStatistics;
 struct RakNetBandwidth;
 class RouterInterface;
 class NetworkIDManager;
@@ -237,11 +239,26 @@ public:
     /// \return 0 on bad input. Otherwise a number that identifies this message. If \a reliability is a type that returns a receipt, on a later call to Receive() you will get ID_SND_RECEIPT_ACKED or ID_SND_RECEIPT_LOSS with bytes 1-4 inclusive containing this number
     virtual uint32_t SendList( const char **data, const int *lengths, const int numParameters, PacketPriority priority, PacketReliability reliability, char orderingChannel, const AddressOrGUID systemIdentifier, bool broadcast, uint32_t forceReceiptNumber=0 )=0;
 
+    /// Sends the same data to a list of systems.
+    ///
+    /// Equivalent to calling Send() once per system, but the data is copied and queued for the network thread only once
+    /// This function only works while connected
+    /// \param[in] bitStream The bitstream to send
+    /// \param[in] priority What priority level to send on.  See PacketPriority.h
+    /// \param[in] reliability How reliability to send this data.  See PacketPriority.h
+    /// \param[in] orderingChannel When using ordered or sequenced messages, what channel to order these on. Messages are only ordered relative to other messages on the same stream
+    /// \param[in] systemIdentifiers Who to send this packet to. Systems that are not connected are skipped
+    /// \param[in] forceReceipt If 0, will automatically determine the receipt number to return. If non-zero, will return what you give it.
+    /// \return 0 on bad input. Otherwise a number that identifies this message, shared by all systems it was sent to.
+    /// Not pure, so existing implementations of this interface still compile. The default calls Send() once per system.
+    virtual uint32_t SendToSystems( const RakNet::BitStream * bitStream, PacketPriority priority, PacketReliability reliability, char orderingChannel, const DataStructures::List<RakNetGUID> &systemIdentifiers, uint32_t forceReceiptNumber=0 );
+
     /// Gets a message from the incoming message queue.
     /// Use DeallocatePacket() to deallocate the message after you are done with it.
     /// User-thread functions, such as RPC calls and the plugin function PluginInterface::Update occur here.
     /// \return 0 if no packets are waiting to be handled, otherwise a pointer to a packet.
     /// \note COMMON MISTAKE: Be sure to call this in a loop, once per game tick, until it returns 0. If you only process one packet per game tick they will buffer up.
+    /// \note Only call this from one thread at a time. It never waits on the network thread.
     /// sa RakNetTypes.h contains struct Packet
     virtual Packet* Receive( void )=0;
 
@@ -249,6 +266,21 @@ public:
     /// \param[in] packet The message to deallocate.
     virtual void DeallocatePacket( Packet *packet )=0;
 
+    /// Gets up to \a maxPackets messages from the incoming message queue in one call.
+    /// Plugin updates run once per call rather than once per message, so prefer this when draining many messages per tick.
+    /// Use DeallocatePackets() or DeallocatePacket() to deallocate the messages after you are done with them.
+    /// \param[out] packets Array of at least \a maxPackets elements to write the messages to.
+    /// \param[in] maxPackets The most messages to return.
+    /// \return How many messages were written to \a packets. 0 if none are waiting.
+    /// Not pure, so existing implementations of this interface still compile. The default calls Receive() until it returns 0 or \a maxPackets were returned.
+    virtual unsigned int ReceiveBatch( Packet **packets, unsigned int maxPackets );
+
+    /// Call this to deallocate messages returned by ReceiveBatch() when you are done handling them.
+    /// \param[in] packets The messages to deallocate.
+    /// \param[in] numPackets How many elements of \a packets to deallocate.
+    /// The default calls DeallocatePacket() for each.
+    virtual void DeallocatePackets( Packet **packets, unsigned int numPackets );
+
     /// Return the total number of connections we are allowed
     virtual unsigned int GetMaximumNumberOfPeers( void ) const=0;
 
@@ -482,6 +514,29 @@ public:
     /// \param[in] timeoutMS How many ms to wait before simply not sending an unreliable message.
     virtual void SetUnreliableTimeout(RakNet::TimeMS timeoutMS)=0;
 
+    /// Merge small messages sent to a system into one internal message, to save per message headers, acks and bookkeeping.
+    /// Messages on the same ordering channel with the same reliability and priority are merged, and wait at most \a maxDelayUS for others to join them.
+    /// The remote system returns the original messages from Receive() as usual. Only UNRELIABLE, RELIABLE and RELIABLE_ORDERED messages below IMMEDIATE_PRIORITY are merged.
+    /// Sends go out on the next update after the delay elapses, and the update thread runs at least every 10 milliseconds.
+    /// Both systems must run a version of RakNet that supports ID_COALESCED_MESSAGES.
+    /// \param[in] maxDelayUS How long a message may wait for others, in microseconds. 0 to disable, which is the default.
+    /// \param[in] maxMessageBytes Messages longer than this are sent on their own
+    /// \param[in] orderingChannelMask Bit n set to merge messages sent on ordering channel n
+    /// \param[in] target Which system to do this for. Pass UNASSIGNED_SYSTEM_ADDRESS for all systems, including systems that connect later.
+    /// Not pure, so existing implementations of this interface still compile. The default does nothing, so messages are sent on their own.
+    virtual void SetMessageCoalescing(RakNet::TimeUS maxDelayUS, unsigned int maxMessageBytes, uint32_t orderingChannelMask, const SystemAddress target);
+
+    /// Compress messages sent to a system on the given ordering channels, when that makes them smaller.
+    /// Suits large, repetitive messages such as serialized state or text. Messages used to connect and ping are never compressed.
+    /// The remote system must set the same kind of compressor, or it drops compressed messages. Both systems must run a version of RakNet that supports ID_COMPRESSED_MESSAGE.
+    /// Messages larger than MAX_DECOMPRESSED_MESSAGE_SIZE are sent as they are, as the receiver drops compressed messages that decompress to more than that.
+    /// \param[in] compressor Codec to use, such as LZCompressor, which must outlive this instance. 0 to disable, which is the default.
+    /// \param[in] minMessageBytes Messages shorter than this are sent as they are
+    /// \param[in] orderingChannelMask Bit n set to compress messages sent on ordering channel n
+    /// \param[in] target Which system to do this for. Pass UNASSIGNED_SYSTEM_ADDRESS for all systems, including systems that connect later.
+    /// Not pure, so existing implementations of this interface still compile. The default does nothing, so messages are sent uncompressed.
+    virtual void SetMessageCompression(CompressionInterface *compressor, unsigned int minMessageBytes, uint32_t orderingChannelMask, const SystemAddress target);
+
     /// Send a message to host, with the IP socket option TTL set to 3
     /// This message will not reach the host, but will open the router.
     /// Used for NAT-Punchthrough
@@ -503,6 +558,7 @@ public:
     /// Put a message back at the end of the receive queue in case you don't want to deal with it immediately
     /// \param[in] packet The packet you want to push back.
     /// \param[in] pushAtHead True to push the packet so that the next receive call returns it.  False to push it at the end of the queue (obviously pushing it at the end makes the packets out of order)
+    /// \note pushAtHead==true may only be used from the thread that calls Receive(). Pushing at the end of the queue is safe from any thread.
     virtual void PushBackPacket( Packet *packet, bool pushAtHead )=0;
 
     /// \internal
@@ -586,6 +642,11 @@ public:
     /// \param[out] statistics Calculated RakNetStatistics for each connected system
     virtual void GetStatisticsList(DataStructures::List<SystemAddress> &addresses, DataStructures::List<RakNetGUID> &guids, DataStructures::List<RakNetStatistics> &statistics)=0;
 
+    /// \brief Returns statistics on the secure handshakes of incoming connections, which run on worker threads. See InitializeSecurity()
+    /// \param[out] stats How many handshakes are queued, what happened to them, and their latency. All 0 without LIBCAT_SECURITY.
+    /// Not pure, so existing implementations of this interface still compile. The default reports all 0.
+    virtual void GetHandshakeStatistics(HandshakeStatistics *stats);
+
     /// \Returns how many messages are waiting when you call Receive()
     virtual unsigned int GetReceiveBufferSize(void)=0;
 
@@ -122,6 +122,8 @@ public:
         RakString str;
         RakNetGUID guid;
         RakString currentRoom;
+        // Where this participant is in RP_Group::usersInRoom of currentRoom
+        unsigned int indexInRoom;
     };
 
     struct StrAndGuid
@@ -150,7 +152,7 @@ protected:
 
     DataStructures::Hash<RakString, StrAndGuidAndRoom*, 8096, RakNet::RakString::ToInteger> strToGuidHash;
     DataStructures::Hash<RakNetGUID, StrAndGuidAndRoom*, 8096, RakNet::RakNetGUID::ToUint32> guidToStrHash;
-    DataStructures::List<RP_Group*> chatRooms;
+    DataStructures::Hash<RakString, RP_Group*, 8096, RakNet::RakString::ToInteger> chatRooms;
     bool acceptAddParticipantRequests;
 
 };
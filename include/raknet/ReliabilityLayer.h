@@ -38,6 +38,7 @@
 #include "PluginInterface2.h"
 #include "Rand.h"
 #include "RakNetSocket2.h"
+#include <atomic>
 
 #if USE_SLIDING_WINDOW_CONGESTION_CONTROL!=1
 #include "CCRakNetUDT.h"
@@ -57,6 +58,8 @@ namespace RakNet {
     /// Forward declarations
 class PluginInterface2;
 class RakNetRandom;
+class CompressionInterface;
+class PacketPool;
 typedef uint64_t reliabilityHeapWeightType;
 
 // int SplitPacketIndexComp( SplitPacketIndexType const &key, InternalPacket* const &data );
@@ -142,17 +145,23 @@ public:
     /// \param[in] systemAddress The player that this data is from
     /// \param[in] messageHandlerList A list of registered plugins
     /// \param[in] MTUSize maximum datagram size
+    /// \param[in] decryptedEpoch From DecryptOnRecvThread() if \a buffer was already decrypted, otherwise 0
     /// \retval true Success
     /// \retval false Modified packet
     bool HandleSocketReceiveFromConnectedPlayer(
         const char *buffer, unsigned int length, SystemAddress &systemAddress, DataStructures::List<PluginInterface2*> &messageHandlerList, int MTUSize,
-        RakNetSocket2 *s, RakNetRandom *rnr, CCTimeType timeRead, BitStream &updateBitStream);
+        RakNetSocket2 *s, RakNetRandom *rnr, CCTimeType timeRead, BitStream &updateBitStream, unsigned int decryptedEpoch=0);
 
     /// This allocates bytes and writes a user-level message to those bytes.
-    /// \param[out] data The message
+    /// \param[out] data The message, from PacketPool::AllocateData() if SetPacketPool() was called, otherwise from malloc
     /// \return Returns number of BITS put into the buffer
     BitSize_t Receive( unsigned char**data );
 
+    /// Allocate received messages from \a pool, so the data returned by Receive() becomes a Packet without being copied.
+    /// Kept by Reset(). Call before any data is received.
+    /// \param[in] pool Must outlive this object. 0 to use malloc.
+    void SetPacketPool(RakNet::PacketPool *pool);
+
     /// Puts data on the send queue
     /// \param[in] data The data to send
     /// \param[in] numberOfBitsToSend The length of \a data in bits
@@ -202,6 +211,21 @@ public:
 
     void SetSplitMessageProgressInterval(int interval);
     void SetUnreliableTimeout(RakNet::TimeMS timeoutMS);
+
+    /// Merge small messages sent on the same ordering channel, with the same reliability and priority, into one message.
+    /// The merged message goes out once \a maxDelayUS has elapsed since its first message, or when the next message would not fit in one datagram.
+    /// Only UNRELIABLE, RELIABLE and RELIABLE_ORDERED below IMMEDIATE_PRIORITY are merged. Receive() on the remote system returns the original messages.
+    /// \param[in] maxDelayUS How long a message may wait for others to merge with, in microseconds. 0 to disable.
+    /// \param[in] maxMessageBytes Messages longer than this are never merged
+    /// \param[in] orderingChannelMask Bit n set to merge messages sent on ordering channel n
+    void SetMessageCoalescing(RakNet::TimeUS maxDelayUS, unsigned int maxMessageBytes, uint32_t orderingChannelMask);
+
+    /// Compress messages sent on the given ordering channels with \a compressor. Messages that do not get smaller are sent as they are.
+    /// Receive() decompresses messages from the remote system with the compressor set here, and drops them if none is set, or if they would be larger than MAX_DECOMPRESSED_MESSAGE_SIZE.
+    /// \param[in] compressor Codec to use, which must outlive this object. 0 to disable.
+    /// \param[in] minMessageBytes Messages shorter than this are not compressed
+    /// \param[in] orderingChannelMask Bit n set to compress messages sent on ordering channel n
+    void SetMessageCompression(RakNet::CompressionInterface *compressor, unsigned int minMessageBytes, uint32_t orderingChannelMask);
     /// Has a lot of time passed since the last ack
     bool AckTimeout(RakNet::Time curTime);
     CCTimeType GetNextSendTime(void) const;
@@ -224,6 +248,24 @@ private:
     /// \param[in] bitStream The data to send.
     void SendBitStream( RakNetSocket2 *s, SystemAddress &systemAddress, RakNet::BitStream *bitStream, RakNetRandom *rnr, CCTimeType currentTime);
 
+    /// Adds a message to the pending merged message for its ordering channel, if it qualifies
+    /// \return true if the message was taken. false to send it as usual, after any pending merged message it must follow
+    bool CoalesceMessage( char *data, BitSize_t numberOfBitsToSend, PacketPriority priority, PacketReliability reliability, unsigned char orderingChannel, bool makeDataCopy, CCTimeType currentTime );
+
+    /// Sends the pending merged message for \a orderingChannel, if any
+    void FlushCoalescedMessages( unsigned char orderingChannel, CCTimeType currentTime );
+
+    /// Returns the next message of a merged message being split by Receive(), or 0 when it is used up
+    BitSize_t ReceiveCoalescedMessage( unsigned char **data );
+
+    /// Replaces \a data with an ID_COMPRESSED_MESSAGE, if it qualifies and compresses
+    /// \return true if \a data now points to the compressed message, which the caller owns
+    bool CompressMessage( char **data, BitSize_t *numberOfBitsToSend, bool makeDataCopy, unsigned char orderingChannel );
+
+    /// Replaces an ID_COMPRESSED_MESSAGE in \a data with the original message
+    /// \return The bit length of the original message, or 0 if it was malformed and was freed
+    BitSize_t DecompressMessage( unsigned char **data, BitSize_t bitLength );
+
     ///Parse an internalPacket and create a bitstream to represent this data
     /// \return Returns number of bits used
     BitSize_t WriteToBitStreamFromInternalPacket( RakNet::BitStream *bitStream, const InternalPacket *const internalPacket, CCTimeType curTime );
@@ -330,6 +372,31 @@ private:
     int splitMessageProgressInterval;
     CCTimeType unreliableTimeout;
 
+    /// Messages waiting to be merged, per ordering channel. Each starts with ID_COALESCED_MESSAGES, followed by a 16 bit bit length and the data of each message.
+    struct CoalescedMessage
+    {
+        unsigned char *data;
+        unsigned int byteLength;
+        unsigned int messageCount;
+        PacketPriority priority;
+        PacketReliability reliability;
+        CCTimeType firstMessageTime;
+    };
+    CoalescedMessage coalescedMessages[NUMBER_OF_ORDERED_STREAMS];
+    uint32_t coalescedMessagesPending;
+    bool flushingCoalescedMessages;
+    CCTimeType coalesceMaxDelay;
+    unsigned int coalesceMaxMessageBytes;
+    uint32_t coalesceOrderingChannelMask;
+
+    /// A received merged message, and how far Receive() has read into it
+    unsigned char *receivedCoalescedData;
+    unsigned int receivedCoalescedLength, receivedCoalescedOffset;
+
+    RakNet::CompressionInterface *messageCompressor;
+    unsigned int compressMinMessageBytes;
+    uint32_t compressOrderingChannelMask;
+
     struct MessageNumberNode
     {
         DatagramSequenceNumberType messageNumber;
@@ -575,6 +642,11 @@ private:
     // Allocate new
     void AllocInternalPacketData(InternalPacket *internalPacket, unsigned int numBytes, bool allowStack, const char *file, unsigned int line);
     void FreeInternalPacketData(InternalPacket *internalPacket, const char *file, unsigned int line);
+    // Allocate the data of a received message, from packetPool if set
+    void AllocReceivedInternalPacketData(InternalPacket *internalPacket, unsigned int numBytes);
+    unsigned char *AllocReceivedData(unsigned int numBytes);
+    void FreeReceivedData(unsigned char *data);
+    RakNet::PacketPool *packetPool;
     DataStructures::MemoryPool<InternalPacketRefCountedData> refCountedDataPool;
 
     BPSTracker bpsMetrics[RNS_PER_SECOND_METRICS_COUNT];
@@ -584,9 +656,41 @@ private:
 public:
     cat::AuthenticatedEncryption* GetAuthenticatedEncryption(void) { return &auth_enc; }
 
+    enum RecvThreadDecryptResult
+    {
+        /// Left for the update thread to decrypt as usual
+        RTD_NOT_DECRYPTED,
+        /// Decrypted in place. Pass decryptedEpoch to HandleSocketReceiveFromConnectedPlayer().
+        RTD_DECRYPTED,
+        /// Failed authentication or was replayed, and the buffer may have been changed. Drop it.
+        RTD_INVALID
+    };
+
+    /// Decrypts a datagram in place, from a socket receive thread, so the update thread does not have to.
+    /// Leaves it to the update thread until the update thread has decrypted a datagram from this connection, which means the keys are set,
+    /// and whenever another thread is decrypting for this connection at the same time.
+    RecvThreadDecryptResult DecryptOnRecvThread(char *buffer, unsigned int *length, unsigned int *decryptedEpoch);
+
 protected:
+    enum
+    {
+        RECV_DECRYPT_OFF,
+        RECV_DECRYPT_IDLE,
+        RECV_DECRYPT_BUSY
+    };
+
+    bool DecryptOnUpdateThread(char *buffer, unsigned int &length);
+    // Takes auth_enc back from receive threads, and waits for datagrams still being encrypted with its keys
+    void StopCryptoThreads(void);
+
     cat::AuthenticatedEncryption auth_enc;
     bool useSecurity;
+    // Receive threads only decrypt when this is RECV_DECRYPT_IDLE, and set it to RECV_DECRYPT_BUSY meanwhile. The update thread locks it the same way.
+    std::atomic<int> recvDecryptState;
+    // Changed by Reset(), so datagrams decrypted with the keys of an earlier connection are dropped. Never 0.
+    unsigned int securityEpoch;
+    // Datagrams queued on EncryptThread and not sent yet
+    std::atomic<unsigned int> pendingEncryptedSends;
 #endif // LIBCAT_SECURITY
 };
 
@@ -0,0 +1,292 @@
+/*
+ *  Copyright (c) 2014, Oculus VR, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+/// \file
+/// \brief \b [Internal] Passes data from one thread to another through a fixed size ring buffer
+///
+
+
+
+#ifndef __SINGLE_PRODUCER_CONSUMER_RING_H
+#define __SINGLE_PRODUCER_CONSUMER_RING_H
+
+#include "RakAssert.h"
+#include "Export.h"
+
+#include <atomic>
+
+/// Indices written by different threads are kept this far apart, so they are not on the same cache line
+#ifndef SPSC_RING_CACHE_LINE_SIZE
+#define SPSC_RING_CACHE_LINE_SIZE 64
+#endif
+
+/// The namespace DataStructures was only added to avoid compiler errors for commonly named data structures
+/// As these data structures are stand-alone, you can use them outside of RakNet for your own projects if you wish.
+namespace DataStructures
+{
+    /// \brief A bounded single producer consumer queue without critical sections.
+    /// Unlike SingleProducerConsumer it never allocates once created: when it is full, writes fail, and the producer decides what to do with the data.
+    /// One thread only writes, and one thread only reads.
+    template <class SingleProducerConsumerType>
+    class RAK_DLL_EXPORT SingleProducerConsumerRing
+    {
+    public:
+        /// \param[in] capacity How many elements fit, rounded up to a power of two
+        SingleProducerConsumerRing(unsigned int capacity=1024);
+        ~SingleProducerConsumerRing();
+
+        /// Changes how many elements fit, rounded up to a power of two, and drops what was in it.
+        /// Not thread-safe, call before the threads start.
+        void SetCapacity(unsigned int capacity);
+
+        /// \return How many elements fit
+        unsigned int GetCapacity(void) const;
+
+        /// WriteLock must be followed by WriteUnlock before the next WriteLock.  These two functions must be called in the same thread.
+        /// \retval 0 The ring is full
+        /// \retval Non-zero A pointer to an element you can write to
+        SingleProducerConsumerType* WriteLock(void);
+
+        /// Locks up to \a count elements at once, which are contiguous in memory
+        /// \param[in,out] count How many elements to lock at most. Returns how many were locked.
+        /// \retval 0 The ring is full
+        /// \retval Non-zero A pointer to the first element you can write to
+        SingleProducerConsumerType* WriteLock(unsigned int *count);
+
+        /// Makes the element from WriteLock() available to the reader
+        void WriteUnlock(void);
+
+        /// Makes the first \a count elements from WriteLock(count) available to the reader, in order. The others are not written after all.
+        void WriteUnlock(unsigned int count);
+
+        /// ReadLock must be followed by ReadUnlock before the next ReadLock. These two functions must be called in the same thread.
+        /// \retval 0 No data is available to read
+        /// \retval Non-zero The data previously written to, in another thread, by WriteLock followed by WriteUnlock.
+        SingleProducerConsumerType* ReadLock(void);
+
+        /// Locks up to \a count elements at once, which are contiguous in memory, oldest first
+        /// \param[in,out] count How many elements to lock at most. Returns how many were locked.
+        /// \retval 0 No data is available to read
+        /// \retval Non-zero A pointer to the oldest element
+        SingleProducerConsumerType* ReadLock(unsigned int *count);
+
+        /// Signals that we are done reading the data from ReadLock().
+        /// At this point that pointer is no longer valid, and should no longer be read.
+        void ReadUnlock(void);
+
+        /// Signals that we are done reading the first \a count elements from ReadLock(count). The others are read again by the next ReadLock.
+        void ReadUnlock(unsigned int count);
+
+        /// Copies \a input in, from the writing thread
+        /// \return false if the ring is full
+        bool Push(const SingleProducerConsumerType &input);
+
+        /// Copies the oldest element out, from the reading thread
+        /// \return false if the ring is empty
+        bool Pop(SingleProducerConsumerType *output);
+
+        /// Clear is not thread-safe and none of the lock or unlock functions should be called while it is running.
+        void Clear(void);
+
+        /// \return An ESTIMATE of how many data elements are waiting to be read, exact from either thread when the other is not running
+        unsigned int Size(void) const;
+
+        /// \return An ESTIMATE of whether there is nothing to read
+        bool IsEmpty(void) const;
+
+    private:
+        SingleProducerConsumerRing(const SingleProducerConsumerRing&);
+        SingleProducerConsumerRing& operator=(const SingleProducerConsumerRing&);
+
+        // Read only once created
+        SingleProducerConsumerType *data;
+        unsigned int mask;
+        char padding0[SPSC_RING_CACHE_LINE_SIZE];
+
+        // Owned by the writer. The indices count up forever, and wrap along with unsigned arithmetic.
+        std::atomic<unsigned int> writeIndex;
+        // The last readIndex the writer saw. Read again only when this says the ring is full.
+        unsigned int readIndexCache;
+        char padding1[SPSC_RING_CACHE_LINE_SIZE];
+
+        // Owned by the reader
+        std::atomic<unsigned int> readIndex;
+        // The last writeIndex the reader saw. Read again only when this says the ring is empty.
+        unsigned int writeIndexCache;
+        char padding2[SPSC_RING_CACHE_LINE_SIZE];
+    };
+
+    template <class SingleProducerConsumerType>
+        SingleProducerConsumerRing<SingleProducerConsumerType>::SingleProducerConsumerRing(unsigned int capacity)
+    {
+        data=0;
+        SetCapacity(capacity);
+    }
+
+    template <class SingleProducerConsumerType>
+        SingleProducerConsumerRing<SingleProducerConsumerType>::~SingleProducerConsumerRing()
+    {
+        delete [] data;
+    }
+
+    template <class SingleProducerConsumerType>
+        void SingleProducerConsumerRing<SingleProducerConsumerType>::SetCapacity(unsigned int capacity)
+    {
+        RakAssert(capacity <= 0x80000000u);
+        unsigned int powerOfTwo=1;
+        while (powerOfTwo < capacity)
+            powerOfTwo<<=1;
+
+        delete [] data;
+        data = new SingleProducerConsumerType[powerOfTwo];
+        mask=powerOfTwo-1;
+        Clear();
+    }
+
+    template <class SingleProducerConsumerType>
+        unsigned int SingleProducerConsumerRing<SingleProducerConsumerType>::GetCapacity(void) const
+    {
+        return mask+1;
+    }
+
+    template <class SingleProducerConsumerType>
+        SingleProducerConsumerType* SingleProducerConsumerRing<SingleProducerConsumerType>::WriteLock( void )
+    {
+        unsigned int count=1;
+        return WriteLock(&count);
+    }
+
+    template <class SingleProducerConsumerType>
+        SingleProducerConsumerType* SingleProducerConsumerRing<SingleProducerConsumerType>::WriteLock( unsigned int *count )
+    {
+        unsigned int write = writeIndex.load(std::memory_order_relaxed);
+        unsigned int available = mask + 1 - (write - readIndexCache);
+        if (available < *count)
+        {
+            // Synchronizes with ReadUnlock(), so the reader is done with the elements it gave back
+            readIndexCache = readIndex.load(std::memory_order_acquire);
+            available = mask + 1 - (write - readIndexCache);
+        }
+        if (available==0)
+            return 0;
+
+        unsigned int offset = write & mask;
+        if (available > mask + 1 - offset)
+            available = mask + 1 - offset;
+        if (*count > available)
+            *count = available;
+        return data + offset;
+    }
+
+    template <class SingleProducerConsumerType>
+        void SingleProducerConsumerRing<SingleProducerConsumerType>::WriteUnlock( void )
+    {
+        WriteUnlock(1);
+    }
+
+    template <class SingleProducerConsumerType>
+        void SingleProducerConsumerRing<SingleProducerConsumerType>::WriteUnlock( unsigned int count )
+    {
+#ifdef _DEBUG
+        RakAssert(writeIndex.load(std::memory_order_relaxed) + count - readIndexCache <= mask + 1);
+#endif
+        writeIndex.store(writeIndex.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    template <class SingleProducerConsumerType>
+        SingleProducerConsumerType* SingleProducerConsumerRing<SingleProducerConsumerType>::ReadLock( void )
+    {
+        unsigned int count=1;
+        return ReadLock(&count);
+    }
+
+    template <class SingleProducerConsumerType>
+        SingleProducerConsumerType* SingleProducerConsumerRing<SingleProducerConsumerType>::ReadLock( unsigned int *count )
+    {
+        unsigned int read = readIndex.load(std::memory_order_relaxed);
+        unsigned int available = writeIndexCache - read;
+        if (available < *count)
+        {
+            // Synchronizes with WriteUnlock(), so the elements written are visible
+            writeIndexCache = writeIndex.load(std::memory_order_acquire);
+            available = writeIndexCache - read;
+        }
+        if (available==0)
+            return 0;
+
+        unsigned int offset = read & mask;
+        if (available > mask + 1 - offset)
+            available = mask + 1 - offset;
+        if (*count > available)
+            *count = available;
+        return data + offset;
+    }
+
+    template <class SingleProducerConsumerType>
+        void SingleProducerConsumerRing<SingleProducerConsumerType>::ReadUnlock( void )
+    {
+        ReadUnlock(1);
+    }
+
+    template <class SingleProducerConsumerType>
+        void SingleProducerConsumerRing<SingleProducerConsumerType>::ReadUnlock( unsigned int count )
+    {
+#ifdef _DEBUG
+        RakAssert(writeIndexCache - readIndex.load(std::memory_order_relaxed) >= count);
+#endif
+        readIndex.store(readIndex.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    template <class SingleProducerConsumerType>
+        bool SingleProducerConsumerRing<SingleProducerConsumerType>::Push( const SingleProducerConsumerType &input )
+    {
+        SingleProducerConsumerType *slot = WriteLock();
+        if (slot==0)
+            return false;
+        *slot=input;
+        WriteUnlock();
+        return true;
+    }
+
+    template <class SingleProducerConsumerType>
+        bool SingleProducerConsumerRing<SingleProducerConsumerType>::Pop( SingleProducerConsumerType *output )
+    {
+        SingleProducerConsumerType *slot = ReadLock();
+        if (slot==0)
+            return false;
+        *output=*slot;
+        ReadUnlock();
+        return true;
+    }
+
+    template <class SingleProducerConsumerType>
+        void SingleProducerConsumerRing<SingleProducerConsumerType>::Clear( void )
+    {
+        writeIndex.store(0, std::memory_order_relaxed);
+        readIndex.store(0, std::memory_order_relaxed);
+        readIndexCache=0;
+        writeIndexCache=0;
+    }
+
+    template <class SingleProducerConsumerType>
+        unsigned int SingleProducerConsumerRing<SingleProducerConsumerType>::Size( void ) const
+    {
+        unsigned int read = readIndex.load(std::memory_order_acquire);
+        return writeIndex.load(std::memory_order_acquire) - read;
+    }
+
+    template <class SingleProducerConsumerType>
+        bool SingleProducerConsumerRing<SingleProducerConsumerType>::IsEmpty( void ) const
+    {
+        return Size()==0;
+    }
+}
+
+#endif
@@ -30,8 +30,19 @@
 #include "SocketIncludes.h"
 #include "DS_ByteQueue.h"
 #include "DS_ThreadsafeAllocatingQueue.h"
+#include "SingleProducerConsumerRing.h"
 #include "PluginInterface2.h"
 
+/// On Linux the update thread sleeps in epoll_wait(), edge triggered, and only visits connections that have something to do.
+/// Elsewhere it sleeps in select(), which visits every connection, and cannot watch more than FD_SETSIZE sockets.
+#ifndef TCP_INTERFACE_USE_EPOLL
+#if defined(__linux__) && !defined(__native_client__) && !defined(ANDROID)
+#define TCP_INTERFACE_USE_EPOLL 1
+#else
+#define TCP_INTERFACE_USE_EPOLL 0
+#endif
+#endif
+
 #if OPEN_SSL_CLIENT_SUPPORT==1
 #include <openssl/crypto.h>
 #include <openssl/x509.h>
@@ -85,6 +96,20 @@ public:
     // Sends a concatenated list of byte streams
     virtual bool SendList( const char **data, const unsigned int  *lengths, const int numParameters, const SystemAddress &systemAddress, bool broadcast );
 
+    /// Allocates a buffer for SendBuffer(). Write the data to send into it.
+    /// \param[in] length The most that will be sent from it
+    /// \return 0 if out of memory
+    virtual char* AllocateSendBuffer( unsigned int length );
+
+    /// Sends a buffer from AllocateSendBuffer() to one system, without copying it. Send() copies the data, because the caller keeps it.
+    /// The buffer is deallocated once it was sent, or here if it cannot be sent, so do not use it after calling this.
+    /// \param[in] length How much of it to send, up to the length it was allocated with
+    /// \return false if not connected to \a systemAddress
+    virtual bool SendBuffer( char *buffer, unsigned int length, const SystemAddress &systemAddress );
+
+    /// Deallocates a buffer from AllocateSendBuffer() that was not passed to SendBuffer()
+    virtual void DeallocateSendBuffer( char *buffer );
+
     // Get how many bytes are waiting to be sent. If too many, you may want to skip sending
     unsigned int GetOutgoingDataBufferSize(SystemAddress systemAddress) const;
 
@@ -121,6 +146,7 @@ public:
     SystemAddress HasNewIncomingConnection(void);
 
     /// Queued events of lost connections
+    /// Plugins are told of a connection lost by the other end when Receive() has returned the data it sent before closing
     SystemAddress HasLostConnection(void);
 
     /// Return an allocated but empty packet, for custom use
@@ -140,6 +166,43 @@ protected:
 
     bool CreateListenSocket(unsigned short port, unsigned short maxIncomingConnections, unsigned short socketFamily, const char *hostAddress);
 
+    /// \return Index of a free slot of remoteClients, now active, or -1 if all are in use
+    int AllocateRemoteClient(void);
+    /// Any thread. The update thread closes the socket and frees the slot afterwards.
+    void DeactivateRemoteClient(RemoteClient *remoteClient);
+    /// Any thread. Passes \a remoteClient to the update thread, to send what was queued or to close it.
+    void ScheduleRemoteClient(RemoteClient *remoteClient);
+    /// Any thread, once the socket of \a remoteClient is connected
+    void RegisterRemoteClientSocket(RemoteClient *remoteClient);
+
+    // Update thread only
+    void ProcessScheduledRemoteClients(char *buffer, unsigned int bufferSize);
+    void ReleaseRemoteClient(RemoteClient *remoteClient);
+    void FlushOutgoing(RemoteClient *remoteClient, char *buffer, unsigned int bufferSize);
+#if TCP_INTERFACE_USE_EPOLL==1
+    void AcceptConnections(void);
+    /// \return true if there may be more to read, as only so much is read per turn
+    bool ReadRemoteClient(RemoteClient *remoteClient, char *buffer, unsigned int bufferSize);
+    /// \return The connection reported by epoll, or 0 if it is gone
+    RemoteClient *GetRemoteClient(uint64_t epollKey, bool includeClosing=false);
+    void WakeUpdateThread(void);
+#endif
+    /// Update thread. Reads once from \a remoteClient and queues what was read.
+    /// \param[out] requested How much the read asked for
+    /// \return What the read returned, or 0 if a message could not be allocated, which ends the connection like a close
+    int ReceiveIncoming(RemoteClient *remoteClient, char *buffer, unsigned int bufferSize, unsigned int *requested);
+    void PushIncomingMessage(RemoteClient *remoteClient, const char *data, int length);
+    /// Update thread, with framedReceive. Splits \a data into the messages of \a remoteClient.
+    /// \return false if a message could not be allocated, or is longer than maxFramedMessageLength
+    bool PushIncomingFrames(RemoteClient *remoteClient, const char *data, unsigned int length);
+    /// Update thread, with framedReceive. \a bytes more of the message being received were written to it. Queues the message once complete.
+    void AdvanceIncomingFrame(RemoteClient *remoteClient, unsigned int bytes);
+    void PushLostConnection(RemoteClient *remoteClient);
+    /// Update thread. Passes \a packet to the user thread.
+    void PushIncomingPacket(Packet *packet);
+    /// User thread. \return The oldest packet from the update thread, or 0 if there is none
+    Packet *PopIncomingPacket(void);
+
     // Plugins
     DataStructures::List<PluginInterface2*> messageHandlerList;
 
@@ -150,6 +213,22 @@ protected:
     RemoteClient* remoteClients;
     int remoteClientsLength;
 
+    // Slots of remoteClients not in use. The update thread frees slots, after closing their sockets.
+    DataStructures::List<unsigned short> freeRemoteClients;
+    SimpleMutex freeRemoteClientsMutex;
+
+    // Stack of connections with something for the update thread to do, linked by RemoteClient::nextScheduled. Pushed by any thread without locking.
+    std::atomic<RemoteClient*> scheduledRemoteClients;
+
+    // Set by PacketizedTCP before Start(). The update thread splits what it reads into messages, each after its length as a uint32_t, rather than returning each read.
+    bool framedReceive;
+    // With framedReceive, a connection that sends a longer message is closed. Read by the update thread.
+    std::atomic<unsigned int> maxFramedMessageLength;
+
+#if TCP_INTERFACE_USE_EPOLL==1
+    int epollFd, wakeEventFd;
+#endif
+
     // Assuming remoteClients is only used by one thread!
     // DataStructures::List<RemoteClient*> remoteClients;
     // Use this thread-safe queue to add to remoteClients
@@ -170,7 +249,14 @@ protected:
 //    DataStructures::SingleProducerConsumer<SystemAddress> newIncomingConnections, lostConnections, requestedCloseConnections;
 //    DataStructures::SingleProducerConsumer<RemoteClient*> newRemoteClients;
 //    DataStructures::ThreadsafeAllocatingQueue<OutgoingMessage> outgoingMessages;
+    // Allocates the packets passed in incomingPackets
     DataStructures::ThreadsafeAllocatingQueue<Packet> incomingMessages;
+    // From the update thread to the user thread
+    DataStructures::SingleProducerConsumerRing<Packet*> incomingPackets;
+    // Once incomingPackets was full, the update thread pushes here instead until it was read, so the packets stay in order
+    DataStructures::Queue<Packet*> incomingPacketsOverflow;
+    SimpleMutex incomingPacketsOverflowMutex;
+    std::atomic<unsigned int> incomingPacketsOverflowSize;
     DataStructures::ThreadsafeAllocatingQueue<SystemAddress> newIncomingConnections, lostConnections, requestedCloseConnections;
     DataStructures::ThreadsafeAllocatingQueue<RemoteClient*> newRemoteClients;
     SimpleMutex completedConnectionAttemptMutex, failedConnectionAttemptMutex;
@@ -210,6 +296,18 @@ protected:
 #endif
 };
 
+/// \internal
+/// Bytes to send on a connection, copied from one call to TCPInterface::SendList()
+struct OutgoingChunk
+{
+    OutgoingChunk *next;
+    unsigned int length;
+    /// How much of this chunk was sent already.
+    /// Once all of it was sent, and it waits in RemoteClient::zeroCopyHead, the number of the last MSG_ZEROCOPY send with some of it instead.
+    unsigned int offset;
+    char *Data(void) {return (char*) (this+1);}
+};
+
 /// Stores information about a remote client.
 struct RemoteClient
 {
@@ -218,15 +316,71 @@ struct RemoteClient
         ssl=0;
 #endif
         isActive=false;
+        closing=false;
         socket=0;
+        outgoingInbox=0;
+        outgoingHead=0;
+        outgoingTail=0;
+        outgoingBytes=0;
+        scheduled=false;
+        nextScheduled=0;
+        writeInterest=false;
+        peerClosed=false;
+        zeroCopy=false;
+        outgoingHeadZeroCopied=false;
+        zeroCopyHead=0;
+        zeroCopyTail=0;
+        zeroCopyNext=0;
+        zeroCopyCompleted=0;
+        lingering=false;
+        frameData=0;
+        frameHeaderBytes=0;
     }
+    ~RemoteClient() {ClearOutgoing(); ClearIncomingFrame();}
     __TCPSOCKET__ socket;
     SystemAddress systemAddress;
-    DataStructures::ByteQueue outgoingData;
     bool isActive;
-    SimpleMutex outgoingDataMutex;
+    /// Set with isActive cleared, until the update thread has closed the socket and freed the slot
+    bool closing;
     SimpleMutex isActiveMutex;
 
+    /// Chunks pushed by any thread, newest first
+    std::atomic<OutgoingChunk*> outgoingInbox;
+    /// Chunks the update thread took from outgoingInbox, oldest first. Only the update thread uses these.
+    OutgoingChunk *outgoingHead, *outgoingTail;
+    /// Bytes pushed and not yet sent
+    std::atomic<unsigned int> outgoingBytes;
+
+    /// Set while in TCPInterface::scheduledRemoteClients
+    std::atomic<bool> scheduled;
+    RemoteClient *nextScheduled;
+    /// EPOLLOUT is registered for the socket, because the last send filled the socket buffer
+    bool writeInterest;
+    /// epoll reported that the other end closed, so reads go on past a short one until they reach the close
+    bool peerClosed;
+
+    /// Large sends use MSG_ZEROCOPY. Cleared if the socket does not support it, or if the system copied the data anyway.
+    bool zeroCopy;
+    /// Some of outgoingHead was sent with MSG_ZEROCOPY, last by send number outgoingHeadZeroCopyId
+    bool outgoingHeadZeroCopied;
+    uint32_t outgoingHeadZeroCopyId;
+    /// Chunks sent with MSG_ZEROCOPY that the system may still read, oldest first
+    OutgoingChunk *zeroCopyHead, *zeroCopyTail;
+    /// The system numbers each send with MSG_ZEROCOPY. Sends before zeroCopyCompleted are done with their data.
+    uint32_t zeroCopyNext, zeroCopyCompleted;
+    /// Ranges of sends that completed before an earlier send did, first number in the high bits, last in the low bits
+    DataStructures::List<uint64_t> zeroCopyEarlyCompletions;
+    /// Closed, but the socket and slot are kept until the MSG_ZEROCOPY sends complete, because the system still sends from their chunks
+    bool lingering;
+
+    /// With TCPInterface::framedReceive, the message being received, frameBytes of frameLength so far. 0 while its header is being received.
+    /// Only the update thread uses these.
+    unsigned char *frameData;
+    unsigned int frameLength, frameBytes;
+    /// What was received of the header of the next message
+    char frameHeader[4];
+    unsigned int frameHeaderBytes;
+
 #if OPEN_SSL_CLIENT_SUPPORT==1
     SSL*     ssl;
     bool InitSSL(SSL_CTX* ctx, SSL_METHOD *meth);
@@ -238,14 +392,35 @@ struct RemoteClient
     int Send(const char *data, unsigned int length);
     int Recv(char *data, const int dataSize);
 #endif
-    void Reset(void)
-    {
-        outgoingDataMutex.Lock();
-        outgoingData.Clear(_FILE_AND_LINE_);
-        outgoingDataMutex.Unlock();
-    }
-    void SetActive(bool a);
-    void SendOrBuffer(const char **data, const unsigned int *lengths, const int numParameters);
+    /// Copies the data into one chunk and pushes it, without locking
+    /// \return false if not active
+    bool SendOrBuffer(const char **data, const unsigned int *lengths, const int numParameters);
+    /// Pushes a chunk, without locking. Its length must be set.
+    /// \return false if not active, in which case the caller still owns the chunk
+    bool PushOutgoing(OutgoingChunk *chunk);
+    bool HasOutgoingData(void) const {return outgoingHead!=0 || outgoingInbox.load(std::memory_order_relaxed)!=0;}
+    /// Update thread. Moves the pushed chunks after the ones already taken.
+    void TakeOutgoingInbox(void);
+    /// Update thread. Sends from the start of the taken chunks in one call.
+    /// Without SSL, large chunks are passed to sendmsg() as they are, and runs of small ones are copied together into \a buffer.
+    /// With SSL, small chunks are copied together into \a buffer.
+    /// \param[out] sendLength How much was passed to the call
+    /// \param[out] zeroCopied Sent with MSG_ZEROCOPY
+    /// \return What the call returned
+    int SendQueued(char *buffer, unsigned int bufferSize, unsigned int *sendLength, bool *zeroCopied);
+    /// Update thread. Advances past \a bytes that were sent, freeing finished chunks.
+    /// \param[in] zeroCopied The bytes were sent with MSG_ZEROCOPY, so finished chunks are kept until the send completes
+    void ConsumeOutgoing(unsigned int bytes, bool zeroCopied=false);
+    /// Update thread. Reads the completions of MSG_ZEROCOPY sends from the error queue of the socket, and frees the chunks they are done with.
+    void ReadZeroCopyCompletions(void);
+    /// Update thread. Sends \a first to \a last completed.
+    void CompleteZeroCopy(uint32_t first, uint32_t last);
+    /// Frees the chunks pushed but not yet taken
+    void DiscardOutgoingInbox(void);
+    /// Update thread, or when no thread runs
+    void ClearOutgoing(void);
+    /// Update thread, or when no thread runs. Frees the message being received.
+    void ClearIncomingFrame(void) {free(frameData); frameData=0; frameHeaderBytes=0;}
 };
 
 } // namespace RakNet
@@ -491,6 +491,7 @@ void ThreadPool<InputType, OutputType>::Clear(void)
     }
     else
     {
+        runThreadsMutex.Unlock();
         inputFunctionQueue.Clear(_FILE_AND_LINE_);
         inputQueue.Clear(_FILE_AND_LINE_);
         outputQueue.Clear(_FILE_AND_LINE_);
@@ -20,7 +20,10 @@
 #define __THREADSAFE_PACKET_LOGGER_H
 
 #include "PacketLogger.h"
-#include "SingleProducerConsumer.h"
+#include "SingleProducerConsumerRing.h"
+#include "DS_Queue.h"
+#include "SimpleMutex.h"
+#include <atomic>
 
 namespace RakNet
 {
@@ -38,7 +41,15 @@ public:
 protected:
     virtual void AddToLog(const char *str);
 
-    DataStructures::SingleProducerConsumer<char*> logMessages;
+    char *PopLogMessage(void);
+
+    // Written by more than one thread, so AddToLog holds logWriterMutex
+    DataStructures::SingleProducerConsumerRing<char*> logMessages;
+    SimpleMutex logWriterMutex;
+    // Once logMessages was full, lines are pushed here instead until it was read, so they stay in order
+    DataStructures::Queue<char*> logOverflow;
+    SimpleMutex logOverflowMutex;
+    std::atomic<unsigned int> logOverflowSize;
 };
 
 } // namespace RakNet
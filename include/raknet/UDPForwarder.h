@@ -30,7 +30,19 @@
 #include "RakThread.h"
 #include "DS_Queue.h"
 #include "DS_OrderedList.h"
+#include "DS_Hash.h"
 #include "DS_ThreadsafeAllocatingQueue.h"
+#include "SignaledEvent.h"
+
+/// On Linux the forwarder thread sleeps in epoll_wait() and relays datagrams with recvmmsg() and sendmmsg().
+/// Elsewhere it sleeps in select() and relays one datagram at a time.
+#ifndef UDP_FORWARDER_USE_EPOLL
+#if defined(__linux__) && !defined(__native_client__) && !defined(ANDROID)
+#define UDP_FORWARDER_USE_EPOLL 1
+#else
+#define UDP_FORWARDER_USE_EPOLL 0
+#endif
+#endif
 
 namespace RakNet
 {
@@ -104,6 +116,21 @@ public:
         __UDPSOCKET__ socket;
         RakNet::TimeMS timeoutOnNoDataMS;
         short socketFamily;
+        /// Index into forwardList
+        unsigned int forwardListIndex;
+        /// Links in the timer wheel slot this entry is scheduled in
+        ForwardEntry *timerNext, *timerPrev;
+        unsigned int timerSlot;
+    };
+
+    /// Identifies a ForwardEntry by its two unconfirmed addresses, in either order
+    struct ForwardEntryKey
+    {
+        ForwardEntryKey() {}
+        ForwardEntryKey(const SystemAddress &a, const SystemAddress &b);
+        bool operator==( const ForwardEntryKey& right ) const;
+        static unsigned long ToInteger( const ForwardEntryKey &key );
+        SystemAddress lower, upper;
     };
 
 
@@ -112,6 +139,18 @@ protected:
 
     void UpdateUDPForwarder(void);
     void RecvFrom(RakNet::TimeMS curTime, ForwardEntry *forwardEntry);
+    void ProcessCommands(RakNet::TimeMS curTime);
+    void WaitAndRelay(RakNet::TimeMS curTime);
+    void AddForwardEntry(ForwardEntry *fe, RakNet::TimeMS curTime);
+    void RemoveForwardEntry(ForwardEntry *fe);
+    void ScheduleTimeout(ForwardEntry *fe, RakNet::TimeMS curTime);
+    void UnscheduleTimeout(ForwardEntry *fe);
+    void AdvanceTimerWheel(RakNet::TimeMS curTime);
+    void WakeForwarderThread(void);
+    static bool GetForwardTarget(ForwardEntry *forwardEntry, const SystemAddress &receivedAddr, SystemAddress *forwardTarget);
+#if UDP_FORWARDER_USE_EPOLL==1
+    void RecvFromBatch(RakNet::TimeMS curTime, ForwardEntry *forwardEntry);
+#endif
 
     struct StartForwardingInputStruct
     {
@@ -134,6 +173,7 @@ protected:
     };
     DataStructures::Queue<StartForwardingOutputStruct> startForwardingOutput;
     SimpleMutex startForwardingOutputMutex;
+    SignaledEvent startForwardingOutputEvent;
 
     struct StopForwardingStruct
     {
@@ -143,9 +183,23 @@ protected:
     DataStructures::ThreadsafeAllocatingQueue<StopForwardingStruct> stopForwardingCommands;
     unsigned int nextInputId;
 
-    // New entries are added to forwardListNotUpdated
-    DataStructures::List<ForwardEntry*> forwardListNotUpdated;
-//    SimpleMutex forwardListNotUpdatedMutex;
+    /// All entries, for iteration. Entries know their own index, so removal is O(1).
+    DataStructures::List<ForwardEntry*> forwardList;
+    /// All entries, by address pair
+    DataStructures::Hash<ForwardEntryKey, ForwardEntry*, 4096, ForwardEntryKey::ToInteger> forwardEntries;
+
+    /// Each entry sits in the slot for about when it would time out. When a slot comes due, entries that forwarded data since are moved on instead of removed.
+    static const unsigned int TIMER_WHEEL_SLOTS = 256;
+    static const RakNet::TimeMS TIMER_WHEEL_RESOLUTION_MS = 100;
+    ForwardEntry *timerWheel[TIMER_WHEEL_SLOTS];
+    unsigned int timerWheelSlot;
+    RakNet::TimeMS timerWheelTime;
+
+#if UDP_FORWARDER_USE_EPOLL==1
+    int epollFd, wakeEventFd;
+    static const unsigned int RELAY_BATCH_SIZE = 32;
+    char *relayBuffers;
+#endif
 
     unsigned short maxForwardEntries;
     std::atomic<uint32_t> isRunning, threadRunning;
@@ -58,7 +58,8 @@ enum UDPProxyMessages
     ID_UDP_PROXY_LOGIN_SUCCESS_FROM_COORDINATOR_TO_SERVER,
     ID_UDP_PROXY_ALREADY_LOGGED_IN_FROM_COORDINATOR_TO_SERVER,
     ID_UDP_PROXY_NO_PASSWORD_SET_FROM_COORDINATOR_TO_SERVER,
-    ID_UDP_PROXY_WRONG_PASSWORD_FROM_COORDINATOR_TO_SERVER
+    ID_UDP_PROXY_WRONG_PASSWORD_FROM_COORDINATOR_TO_SERVER,
+    ID_UDP_PROXY_SHARD_LOAD_FROM_SERVER_TO_COORDINATOR
 };
 
 
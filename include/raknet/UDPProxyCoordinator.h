@@ -48,6 +48,17 @@ namespace RakNet
         /// By default, no password is set
         void SetRemoteLoginPassword(RakNet::RakString password);
 
+        struct ShardLoad
+        {
+            unsigned short usedForwardEntries;
+            unsigned short maxForwardEntries;
+        };
+
+        /// Returns the load of each forwarder shard on a logged in UDPProxyServer, as last reported plus sessions placed since
+        /// \param[in] serverAddress Address of the UDPProxyServer
+        /// \param[out] shardLoads One element per shard. Empty if the server is not logged in, or has not reported yet
+        void GetServerShardLoad(const SystemAddress &serverAddress, DataStructures::List<ShardLoad> &shardLoads) const;
+
         /// \internal
         virtual void Update(void);
         virtual PluginReceiveResult OnReceive(Packet *packet);
@@ -92,6 +103,7 @@ namespace RakNet
         void OnLoginRequestFromServerToCoordinator(Packet *packet);
         void OnForwardingReplyFromServerToCoordinator(Packet *packet);
         void OnPingServersReplyFromClientToCoordinator(Packet *packet);
+        void OnShardLoadFromServerToCoordinator(Packet *packet);
         void TryNextServer(SenderAndTargetAddress sata, ForwardingRequest *fw);
         void SendAllBusy(SystemAddress senderClientAddress, SystemAddress targetClientAddress, RakNetGUID targetClientGuid, SystemAddress requestingAddress);
         void Clear(void);
@@ -102,6 +114,13 @@ namespace RakNet
         //DataStructures::Multilist<ML_UNORDERED_LIST, SystemAddress> serverList;
         DataStructures::List<SystemAddress> serverList;
 
+        // Forwarder shard loads for each server in serverList, at the same index
+        struct ServerLoad
+        {
+            DataStructures::List<ShardLoad> shards;
+        };
+        DataStructures::List<ServerLoad*> serverLoadList;
+
         // Forwarding requests in progress
         //DataStructures::Multilist<ML_ORDERED_LIST, ForwardingRequest*, SenderAndTargetAddress> forwardingRequestList;
         DataStructures::OrderedList<SenderAndTargetAddress, ForwardingRequest*, ForwardingRequestComp> forwardingRequestList;
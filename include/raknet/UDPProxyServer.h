@@ -92,11 +92,23 @@ public:
     /// \param[in] ip IP address to report in UDPProxyClientResultHandler::OnForwardingSuccess() and UDPProxyClientResultHandler::OnForwardingNotification() as proxyIPAddress
     void SetServerPublicIP(RakString ip);
 
-    /// Operative class that performs the forwarding
+    /// Operative class that performs the forwarding, and the first forwarder shard
     /// Exposed so you can call UDPForwarder::SetMaxForwardEntries() if you want to change away from the default
     /// UDPForwarder::Startup(), UDPForwarder::Shutdown(), and UDPForwarder::Update() are called automatically by the plugin
     UDPForwarder udpForwarder;
 
+    /// Relay through \a count forwarders, each with its own thread and sockets, so forwarding is not limited to one core.
+    /// The coordinator places each new forwarding session on the least loaded shard, using loads this server reports every second.
+    /// Shards added while running start immediately. Sessions on removed shards are dropped.
+    /// \param[in] count Number of forwarders, including udpForwarder. Defaults to 1.
+    void SetForwarderShardCount(unsigned int count);
+
+    /// \return The value passed to SetForwarderShardCount()
+    unsigned int GetForwarderShardCount(void) const;
+
+    /// \return Forwarder shard \a index, where shard 0 is udpForwarder. Call UDPForwarder::SetMaxForwardEntries() on each shard to change its capacity.
+    UDPForwarder *GetForwarderShard(unsigned int index);
+
     virtual void OnAttach(void);
     virtual void OnDetach(void);
 
@@ -109,6 +121,13 @@ public:
 
 protected:
     void OnForwardingRequestFromCoordinatorToServer(Packet *packet);
+    unsigned int GetLeastLoadedShard(void);
+    void SendShardLoad(const SystemAddress &coordinatorAddress);
+
+    /// Shards after the first, which is udpForwarder
+    DataStructures::List<UDPForwarder*> additionalForwarders;
+    bool forwardersRunning;
+    RakNet::TimeMS nextShardLoadReportTime;
 
     DataStructures::OrderedList<SystemAddress, SystemAddress> loggingInCoordinators;
     DataStructures::OrderedList<SystemAddress, SystemAddress> loggedInCoordinators;